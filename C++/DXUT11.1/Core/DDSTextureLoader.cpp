@@ -1323,33 +1323,27 @@ namespace
     }
 
     //--------------------------------------------------------------------------------------
-    HRESULT CreateTextureFromDDS(
-        _In_ ID3D11Device* d3dDevice,
-        _In_opt_ ID3D11DeviceContext* d3dContext,
+    HRESULT GetTextureDesc(
         _In_ const DDS_HEADER* header,
-        _In_reads_bytes_(bitSize) const uint8_t* bitData,
-        _In_ size_t bitSize,
-        _In_ size_t maxsize,
-        _In_ D3D11_USAGE usage,
-        _In_ unsigned int bindFlags,
-        _In_ unsigned int cpuAccessFlags,
-        _In_ unsigned int miscFlags,
-        _In_ DDS_LOADER_FLAGS loadFlags,
-        _Outptr_opt_ ID3D11Resource** texture,
-        _Outptr_opt_ ID3D11ShaderResourceView** textureView) noexcept
+        _Out_ uint32_t& resDim,
+        _Out_ UINT& width,
+        _Out_ UINT& height,
+        _Out_ UINT& depth,
+        _Out_ size_t& mipCount,
+        _Out_ UINT& arraySize,
+        _Out_ DXGI_FORMAT& format,
+        _Out_ bool& isCubeMap) noexcept
     {
-        HRESULT hr = S_OK;
+        width = header->width;
+        height = header->height;
+        depth = header->depth;
 
-        const UINT width = header->width;
-        UINT height = header->height;
-        UINT depth = header->depth;
+        resDim = D3D11_RESOURCE_DIMENSION_UNKNOWN;
+        arraySize = 1;
+        format = DXGI_FORMAT_UNKNOWN;
+        isCubeMap = false;
 
-        uint32_t resDim = D3D11_RESOURCE_DIMENSION_UNKNOWN;
-        UINT arraySize = 1;
-        DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
-        bool isCubeMap = false;
-
-        size_t mipCount = header->mipMapCount;
+        mipCount = header->mipMapCount;
         if (0 == mipCount)
         {
             mipCount = 1;
@@ -1534,6 +1528,43 @@ namespace
             return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
         }
 
+        return S_OK;
+    }
+
+
+    //--------------------------------------------------------------------------------------
+    HRESULT CreateTextureFromDDS(
+        _In_ ID3D11Device* d3dDevice,
+        _In_opt_ ID3D11DeviceContext* d3dContext,
+        _In_ const DDS_HEADER* header,
+        _In_reads_bytes_(bitSize) const uint8_t* bitData,
+        _In_ size_t bitSize,
+        _In_ size_t maxsize,
+        _In_ D3D11_USAGE usage,
+        _In_ unsigned int bindFlags,
+        _In_ unsigned int cpuAccessFlags,
+        _In_ unsigned int miscFlags,
+        _In_ DDS_LOADER_FLAGS loadFlags,
+        _Outptr_opt_ ID3D11Resource** texture,
+        _Outptr_opt_ ID3D11ShaderResourceView** textureView) noexcept
+    {
+        uint32_t resDim = D3D11_RESOURCE_DIMENSION_UNKNOWN;
+        UINT width = 0;
+        UINT height = 0;
+        UINT depth = 0;
+        size_t mipCount = 0;
+        UINT arraySize = 0;
+        DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+        bool isCubeMap = false;
+
+        HRESULT hr = GetTextureDesc(header,
+            resDim, width, height, depth, mipCount, arraySize,
+            format, isCubeMap);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
         bool autogen = false;
         if (mipCount == 1 && d3dContext && textureView) // Must have context and shader-view to auto generate mipmaps
         {
@@ -1723,6 +1754,164 @@ namespace
     }
 
 
+    //--------------------------------------------------------------------------------------
+    struct FileRange
+    {
+        uint64_t    offset;
+        size_t      size;
+    };
+
+    constexpr size_t MAX_DDS_HEADER_SIZE = sizeof(uint32_t) + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10);
+
+    constexpr size_t MAX_OUTSTANDING_READS = 16;
+
+    //--------------------------------------------------------------------------------------
+    // Reads the ranges back to back into dest, keeping up to MAX_OUTSTANDING_READS
+    // overlapped requests in flight. hFile must be opened with FILE_FLAG_OVERLAPPED.
+    //--------------------------------------------------------------------------------------
+    HRESULT ReadFileRanges(
+        _In_ HANDLE hFile,
+        _In_reads_(rangeCount) const FileRange* ranges,
+        _In_ size_t rangeCount,
+        _Out_writes_bytes_(destSize) uint8_t* dest,
+        _In_ size_t destSize) noexcept
+    {
+        if (!ranges || !dest)
+        {
+            return E_POINTER;
+        }
+
+        ScopedHandle events[MAX_OUTSTANDING_READS];
+        for (size_t j = 0; j < MAX_OUTSTANDING_READS && j < rangeCount; ++j)
+        {
+            events[j].reset(CreateEventEx(nullptr, nullptr, CREATE_EVENT_MANUAL_RESET, EVENT_MODIFY_STATE | SYNCHRONIZE));
+            if (!events[j])
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+        }
+
+        HRESULT hr = S_OK;
+        uint8_t* pDest = dest;
+        const uint8_t* pEnd = dest + destSize;
+
+        OVERLAPPED ov[MAX_OUTSTANDING_READS];
+        for (size_t first = 0; first < rangeCount; first += MAX_OUTSTANDING_READS)
+        {
+            const size_t count = std::min(rangeCount - first, MAX_OUTSTANDING_READS);
+
+            size_t issued = 0;
+            for (; issued < count; ++issued)
+            {
+                const FileRange& range = ranges[first + issued];
+                if (range.size > UINT32_MAX)
+                {
+                    hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+                    break;
+                }
+
+                if (range.size > size_t(pEnd - pDest))
+                {
+                    hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+                    break;
+                }
+
+                memset(&ov[issued], 0, sizeof(OVERLAPPED));
+                ov[issued].Offset = static_cast<DWORD>(range.offset);
+                ov[issued].OffsetHigh = static_cast<DWORD>(range.offset >> 32);
+                ov[issued].hEvent = events[issued].get();
+
+                if (!ReadFile(hFile, pDest, static_cast<DWORD>(range.size), nullptr, &ov[issued]))
+                {
+                    const DWORD err = GetLastError();
+                    if (err != ERROR_IO_PENDING)
+                    {
+                        hr = HRESULT_FROM_WIN32(err);
+                        break;
+                    }
+                }
+
+                pDest += range.size;
+            }
+
+            // Always drain what was issued, the OVERLAPPED structures and buffer must outlive the reads
+            for (size_t j = 0; j < issued; ++j)
+            {
+                DWORD bytesRead = 0;
+                if (!GetOverlappedResult(hFile, &ov[j], &bytesRead, TRUE))
+                {
+                    if (SUCCEEDED(hr))
+                        hr = HRESULT_FROM_WIN32(GetLastError());
+                }
+                else if (bytesRead < ranges[first + j].size)
+                {
+                    if (SUCCEEDED(hr))
+                        hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+                }
+            }
+
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+
+        return S_OK;
+    }
+
+
+    //--------------------------------------------------------------------------------------
+    struct FileRangeRequest
+    {
+        ID3D11Device*               d3dDevice;
+        std::unique_ptr<wchar_t[]>  fileName;
+        size_t                      firstMip;
+        size_t                      mipLevels;
+        size_t                      firstArraySlice;
+        size_t                      arraySlices;
+        size_t                      maxsize;
+        D3D11_USAGE                 usage;
+        unsigned int                bindFlags;
+        unsigned int                cpuAccessFlags;
+        unsigned int                miscFlags;
+        DDS_LOADER_FLAGS            loadFlags;
+        DDS_LOADER_CALLBACK         callback;
+        void*                       callbackContext;
+    };
+
+    void CALLBACK LoadFileRangeWork(_Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ void* context) noexcept
+    {
+        std::unique_ptr<FileRangeRequest> request(static_cast<FileRangeRequest*>(context));
+
+        ID3D11Resource* texture = nullptr;
+        ID3D11ShaderResourceView* textureView = nullptr;
+        DDS_ALPHA_MODE alphaMode = DDS_ALPHA_MODE_UNKNOWN;
+
+        const HRESULT hr = CreateDDSTextureFromFileRange(request->d3dDevice,
+            request->fileName.get(),
+            request->firstMip, request->mipLevels,
+            request->firstArraySlice, request->arraySlices,
+            request->maxsize,
+            request->usage, request->bindFlags, request->cpuAccessFlags, request->miscFlags,
+            request->loadFlags,
+            &texture,
+            (request->bindFlags & D3D11_BIND_SHADER_RESOURCE) ? &textureView : nullptr,
+            &alphaMode);
+
+        request->callback(hr, texture, textureView, alphaMode, request->callbackContext);
+
+        if (textureView)
+        {
+            textureView->Release();
+        }
+        if (texture)
+        {
+            texture->Release();
+        }
+        request->d3dDevice->Release();
+    }
+
+
     //--------------------------------------------------------------------------------------
     DDS_ALPHA_MODE GetAlphaMode(_In_ const DDS_HEADER* header) noexcept
     {
@@ -2069,3 +2258,351 @@ HRESULT DirectX::CreateDDSTextureFromFileEx(
 
     return hr;
 }
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::CreateDDSTextureFromFileRange(
+    ID3D11Device* d3dDevice,
+    const wchar_t* fileName,
+    size_t firstMip,
+    size_t mipLevels,
+    size_t firstArraySlice,
+    size_t arraySlices,
+    size_t maxsize,
+    D3D11_USAGE usage,
+    unsigned int bindFlags,
+    unsigned int cpuAccessFlags,
+    unsigned int miscFlags,
+    DDS_LOADER_FLAGS loadFlags,
+    ID3D11Resource** texture,
+    ID3D11ShaderResourceView** textureView,
+    DDS_ALPHA_MODE* alphaMode) noexcept
+{
+    if (texture)
+    {
+        *texture = nullptr;
+    }
+    if (textureView)
+    {
+        *textureView = nullptr;
+    }
+    if (alphaMode)
+    {
+        *alphaMode = DDS_ALPHA_MODE_UNKNOWN;
+    }
+
+    if (!d3dDevice || !fileName || (!texture && !textureView))
+    {
+        return E_INVALIDARG;
+    }
+
+    if (textureView && !(bindFlags & D3D11_BIND_SHADER_RESOURCE))
+    {
+        return E_INVALIDARG;
+    }
+
+    // open the file for overlapped reads
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    CREATEFILE2_EXTENDED_PARAMETERS params = {};
+    params.dwSize = sizeof(CREATEFILE2_EXTENDED_PARAMETERS);
+    params.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+    params.dwFileFlags = FILE_FLAG_OVERLAPPED;
+    ScopedHandle hFile(safe_handle(CreateFile2(
+        fileName,
+        GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING,
+        &params)));
+#else
+    ScopedHandle hFile(safe_handle(CreateFileW(
+        fileName,
+        GENERIC_READ, FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+        nullptr)));
+#endif
+
+    if (!hFile)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Get the file size
+    FILE_STANDARD_INFO fileInfo;
+    if (!GetFileInformationByHandleEx(hFile.get(), FileStandardInfo, &fileInfo, sizeof(fileInfo)))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // File is too big for 32-bit allocation, so reject read
+    if (fileInfo.EndOfFile.HighPart > 0)
+    {
+        return E_FAIL;
+    }
+
+    const size_t fileSize = fileInfo.EndOfFile.LowPart;
+
+    // Read and validate only the magic number and headers
+    alignas(uint32_t) uint8_t headerData[MAX_DDS_HEADER_SIZE] = {};
+    const FileRange headerRange = { 0, std::min(fileSize, MAX_DDS_HEADER_SIZE) };
+
+    HRESULT hr = ReadFileRanges(hFile.get(), &headerRange, 1, headerData, sizeof(headerData));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    const DDS_HEADER* header = nullptr;
+    const uint8_t* bitData = nullptr;
+    size_t bitSize = 0;
+    hr = LoadTextureDataFromMemory(headerData, headerRange.size,
+        &header,
+        &bitData,
+        &bitSize
+    );
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    const size_t dataOffset = static_cast<size_t>(bitData - headerData);
+
+    uint32_t resDim = D3D11_RESOURCE_DIMENSION_UNKNOWN;
+    UINT width = 0;
+    UINT height = 0;
+    UINT depth = 0;
+    size_t mipCount = 0;
+    UINT arraySize = 0;
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    bool isCubeMap = false;
+
+    hr = GetTextureDesc(header,
+        resDim, width, height, depth, mipCount, arraySize,
+        format, isCubeMap);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Resolve the requested window, a count of 0 means 'through the last one'
+    if (firstMip >= mipCount || firstArraySlice >= arraySize)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (!mipLevels)
+    {
+        mipLevels = mipCount - firstMip;
+    }
+    if (!arraySlices)
+    {
+        arraySlices = arraySize - firstArraySlice;
+    }
+
+    if ((mipLevels > mipCount - firstMip) || (arraySlices > arraySize - firstArraySlice))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Cubemaps can only be split on whole cubes
+    if (isCubeMap && ((firstArraySlice % 6) != 0 || (arraySlices % 6) != 0))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Drop top mips that exceed maxsize before anything is read
+    while (maxsize && mipLevels > 1
+        && (std::max<size_t>(width >> firstMip, 1) > maxsize
+            || std::max<size_t>(height >> firstMip, 1) > maxsize
+            || std::max<size_t>(depth >> firstMip, 1) > maxsize))
+    {
+        ++firstMip;
+        --mipLevels;
+    }
+
+    // Every array item has the same mip chain, so one pass gives the item stride and the window within it
+    size_t itemSize = 0;
+    size_t windowOffset = 0;
+    size_t windowSize = 0;
+    {
+        size_t w = width;
+        size_t h = height;
+        size_t d = depth;
+        for (size_t level = 0; level < mipCount; ++level)
+        {
+            size_t numBytes = 0;
+            hr = GetSurfaceInfo(w, h, format, &numBytes, nullptr, nullptr);
+            if (FAILED(hr))
+                return hr;
+
+            if (numBytes > UINT32_MAX)
+                return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+
+            const uint64_t levelSize = uint64_t(numBytes) * d;
+            if (levelSize > UINT32_MAX)
+                return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+
+            if (level < firstMip)
+            {
+                windowOffset += static_cast<size_t>(levelSize);
+            }
+            else if (level < firstMip + mipLevels)
+            {
+                windowSize += static_cast<size_t>(levelSize);
+            }
+            itemSize += static_cast<size_t>(levelSize);
+
+            w = std::max<size_t>(w >> 1, 1);
+            h = std::max<size_t>(h >> 1, 1);
+            d = std::max<size_t>(d >> 1, 1);
+        }
+    }
+
+    if (uint64_t(dataOffset) + uint64_t(itemSize) * arraySize > fileSize)
+    {
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    // One range per array item, merged when items are contiguous on disk (e.g. full mip chains)
+    std::unique_ptr<FileRange[]> ranges(new (std::nothrow) FileRange[arraySlices]);
+    if (!ranges)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    size_t rangeCount = 0;
+    for (size_t item = firstArraySlice; item < firstArraySlice + arraySlices; ++item)
+    {
+        const uint64_t offset = dataOffset + uint64_t(item) * itemSize + windowOffset;
+        if (rangeCount > 0 && (ranges[rangeCount - 1].offset + ranges[rangeCount - 1].size) == offset)
+        {
+            ranges[rangeCount - 1].size += windowSize;
+        }
+        else
+        {
+            ranges[rangeCount].offset = offset;
+            ranges[rangeCount].size = windowSize;
+            ++rangeCount;
+        }
+    }
+
+    const size_t windowBytes = windowSize * arraySlices;
+    std::unique_ptr<uint8_t[]> windowData(new (std::nothrow) uint8_t[windowBytes]);
+    if (!windowData)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = ReadFileRanges(hFile.get(), ranges.get(), rangeCount, windowData.get(), windowBytes);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hFile.reset();
+
+    // The window is packed exactly like a DDS payload with fewer mips and items
+    std::unique_ptr<D3D11_SUBRESOURCE_DATA[]> initData(new (std::nothrow) D3D11_SUBRESOURCE_DATA[mipLevels * arraySlices]);
+    if (!initData)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    size_t skipMip = 0;
+    size_t twidth = 0;
+    size_t theight = 0;
+    size_t tdepth = 0;
+    hr = FillInitData(std::max<size_t>(width >> firstMip, 1),
+        std::max<size_t>(height >> firstMip, 1),
+        std::max<size_t>(depth >> firstMip, 1),
+        mipLevels, arraySlices,
+        format, 0, windowBytes, windowData.get(),
+        twidth, theight, tdepth, skipMip, initData.get());
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = CreateD3DResources(d3dDevice,
+        resDim, twidth, theight, tdepth, mipLevels, arraySlices,
+        format,
+        usage, bindFlags, cpuAccessFlags, miscFlags,
+        loadFlags,
+        isCubeMap,
+        initData.get(),
+        texture, textureView);
+
+    if (SUCCEEDED(hr))
+    {
+        SetDebugTextureInfo(fileName, texture, textureView);
+
+        if (alphaMode)
+            *alphaMode = GetAlphaMode(header);
+    }
+
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::CreateDDSTextureFromFileRangeAsync(
+    ID3D11Device* d3dDevice,
+    const wchar_t* fileName,
+    size_t firstMip,
+    size_t mipLevels,
+    size_t firstArraySlice,
+    size_t arraySlices,
+    size_t maxsize,
+    D3D11_USAGE usage,
+    unsigned int bindFlags,
+    unsigned int cpuAccessFlags,
+    unsigned int miscFlags,
+    DDS_LOADER_FLAGS loadFlags,
+    DDS_LOADER_CALLBACK callback,
+    void* callbackContext) noexcept
+{
+    if (!d3dDevice || !fileName || !callback)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::unique_ptr<FileRangeRequest> request(new (std::nothrow) FileRangeRequest);
+    if (!request)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    const size_t nameLength = wcslen(fileName) + 1;
+    request->fileName.reset(new (std::nothrow) wchar_t[nameLength]);
+    if (!request->fileName)
+    {
+        return E_OUTOFMEMORY;
+    }
+    memcpy(request->fileName.get(), fileName, nameLength * sizeof(wchar_t));
+
+    request->d3dDevice = d3dDevice;
+    request->firstMip = firstMip;
+    request->mipLevels = mipLevels;
+    request->firstArraySlice = firstArraySlice;
+    request->arraySlices = arraySlices;
+    request->maxsize = maxsize;
+    request->usage = usage;
+    request->bindFlags = bindFlags;
+    request->cpuAccessFlags = cpuAccessFlags;
+    request->miscFlags = miscFlags;
+    request->loadFlags = loadFlags;
+    request->callback = callback;
+    request->callbackContext = callbackContext;
+
+    d3dDevice->AddRef();
+
+    if (!TrySubmitThreadpoolCallback(LoadFileRangeWork, request.get(), nullptr))
+    {
+        const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        d3dDevice->Release();
+        return hr;
+    }
+
+    // The work item owns the request from here on
+    request.release();
+
+    return S_OK;
+}
@@ -142,6 +142,58 @@ namespace DirectX
         _Outptr_opt_ ID3D11ShaderResourceView** textureView,
         _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr) noexcept;
 
+    // Partial version
+    //
+    // Parses only the header, then reads just the bytes of mips [firstMip, firstMip + mipLevels)
+    // of array items [firstArraySlice, firstArraySlice + arraySlices) using overlapped IO.
+    // A count of 0 means 'through the last one', and mips larger than maxsize are skipped
+    // before they are read. Streaming callers can load a small tail of the mip chain first
+    // and the full chain later. Cubemaps must be split on whole cubes.
+    HRESULT __cdecl CreateDDSTextureFromFileRange(
+        _In_ ID3D11Device* d3dDevice,
+        _In_z_ const wchar_t* szFileName,
+        _In_ size_t firstMip,
+        _In_ size_t mipLevels,
+        _In_ size_t firstArraySlice,
+        _In_ size_t arraySlices,
+        _In_ size_t maxsize,
+        _In_ D3D11_USAGE usage,
+        _In_ unsigned int bindFlags,
+        _In_ unsigned int cpuAccessFlags,
+        _In_ unsigned int miscFlags,
+        _In_ DDS_LOADER_FLAGS loadFlags,
+        _Outptr_opt_ ID3D11Resource** texture,
+        _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr) noexcept;
+
+    // Called on a thread pool thread once an async load finishes. The texture and view are
+    // released after the callback returns, so AddRef any that are kept.
+    using DDS_LOADER_CALLBACK = void(__cdecl*)(
+        _In_ HRESULT hr,
+        _In_opt_ ID3D11Resource* texture,
+        _In_opt_ ID3D11ShaderResourceView* textureView,
+        _In_ DDS_ALPHA_MODE alphaMode,
+        _In_opt_ void* callbackContext);
+
+    // Queues CreateDDSTextureFromFileRange on the thread pool. A shader resource view is created
+    // when bindFlags includes D3D11_BIND_SHADER_RESOURCE. On S_OK the callback is invoked exactly
+    // once with the result; the device must not have been created single-threaded.
+    HRESULT __cdecl CreateDDSTextureFromFileRangeAsync(
+        _In_ ID3D11Device* d3dDevice,
+        _In_z_ const wchar_t* szFileName,
+        _In_ size_t firstMip,
+        _In_ size_t mipLevels,
+        _In_ size_t firstArraySlice,
+        _In_ size_t arraySlices,
+        _In_ size_t maxsize,
+        _In_ D3D11_USAGE usage,
+        _In_ unsigned int bindFlags,
+        _In_ unsigned int cpuAccessFlags,
+        _In_ unsigned int miscFlags,
+        _In_ DDS_LOADER_FLAGS loadFlags,
+        _In_ DDS_LOADER_CALLBACK callback,
+        _In_opt_ void* callbackContext) noexcept;
+
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-dynamic-exception-spec"
@@ -12,6 +12,7 @@
 #include "DXUT.h"
 #include "SDKMesh.h"
 #include "SDKMisc.h"
+#include <xnamath.h>
 
 //--------------------------------------------------------------------------------------
 void CDXUTSDKMesh::LoadMaterials( ID3D11Device* pd3dDevice, SDKMESH_MATERIAL* pMaterials, UINT numMaterials,
@@ -314,12 +315,9 @@ HRESULT CDXUTSDKMesh::CreateIndexBuffer( IDirect3DDevice9* pd3dDevice, SDKMESH_I
 }
 
 //--------------------------------------------------------------------------------------
-HRESULT CDXUTSDKMesh::CreateFromFile( ID3D11Device* pDev11,
-                                      IDirect3DDevice9* pDev9,
-                                      LPCTSTR szFileName,
-                                      bool bCreateAdjacencyIndices,
-                                      SDKMESH_CALLBACKS11* pLoaderCallbacks11,
-                                      SDKMESH_CALLBACKS9* pLoaderCallbacks9 )
+// Finds and opens szFileName into m_hFile and leaves m_strPathW/m_strPath set to its directory
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTSDKMesh::OpenMeshFile( LPCTSTR szFileName )
 {
     HRESULT hr = S_OK;
 
@@ -341,6 +339,21 @@ HRESULT CDXUTSDKMesh::CreateFromFile( ID3D11Device* pDev11,
 
     WideCharToMultiByte( CP_ACP, 0, m_strPathW, -1, m_strPath, MAX_PATH, NULL, FALSE );
 
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTSDKMesh::CreateFromFile( ID3D11Device* pDev11,
+                                      IDirect3DDevice9* pDev9,
+                                      LPCTSTR szFileName,
+                                      bool bCreateAdjacencyIndices,
+                                      SDKMESH_CALLBACKS11* pLoaderCallbacks11,
+                                      SDKMESH_CALLBACKS9* pLoaderCallbacks9 )
+{
+    HRESULT hr = S_OK;
+
+    V_RETURN( OpenMeshFile( szFileName ) );
+
     // Get the file size
     LARGE_INTEGER FileSize;
     GetFileSizeEx( m_hFile, &FileSize );
@@ -378,6 +391,85 @@ HRESULT CDXUTSDKMesh::CreateFromFile( ID3D11Device* pDev11,
     return hr;
 }
 
+//--------------------------------------------------------------------------------------
+// The view is mapped FILE_MAP_COPY so the pointer fixups only dirty the pages of the header block; the
+// buffer data stays backed by the file and is paged in when a VB or IB is first created from it.
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTSDKMesh::CreateMapped( ID3D11Device* pDev11, LPCTSTR szFileName, bool bCreateAdjacencyIndices,
+                                    SDKMESH_CALLBACKS11* pLoaderCallbacks )
+{
+    HRESULT hr = S_OK;
+
+    V_RETURN( OpenMeshFile( szFileName ) );
+
+    // Get the file size
+    LARGE_INTEGER FileSize;
+    if( !GetFileSizeEx( m_hFile, &FileSize ) || FileSize.HighPart != 0 ||
+        FileSize.LowPart < sizeof( SDKMESH_HEADER ) )
+    {
+        CloseHandle( m_hFile );
+        m_hFile = 0;
+        return E_FAIL;
+    }
+    UINT cBytes = FileSize.LowPart;
+
+    // The mapping keeps its own reference to the file
+    m_hFileMappingObject = CreateFileMapping( m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+    CloseHandle( m_hFile );
+    m_hFile = 0;
+    if( !m_hFileMappingObject )
+        return HRESULT_FROM_WIN32( GetLastError() );
+
+    BYTE* pView = ( BYTE* )MapViewOfFile( m_hFileMappingObject, FILE_MAP_COPY, 0, 0, 0 );
+    if( !pView )
+    {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        CloseHandle( m_hFileMappingObject );
+        m_hFileMappingObject = 0;
+        return hr;
+    }
+    m_MappedPointers.Add( pView );
+
+    if( pLoaderCallbacks )
+    {
+        m_LoaderCallbacks11 = *pLoaderCallbacks;
+        m_pLazyCallbacks11 = &m_LoaderCallbacks11;
+    }
+    else
+    {
+        m_pLazyCallbacks11 = NULL;
+    }
+    m_bLazyBuffers = true;
+
+    hr = CreateFromMemory( pDev11, NULL, pView, cBytes, bCreateAdjacencyIndices, false, NULL, NULL );
+    if( FAILED( hr ) )
+    {
+        SAFE_DELETE_ARRAY( m_pBufferRequested );
+        SAFE_DELETE_ARRAY( m_pMeshBoundsValid );
+        m_bLazyBuffers = false;
+        m_pLazyCallbacks11 = NULL;
+        m_pHeapData = NULL;
+        m_pStaticMeshData = NULL;
+        UnmapMeshFile();
+    }
+
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::UnmapMeshFile()
+{
+    for( int i = 0; i < m_MappedPointers.GetSize(); i++ )
+        UnmapViewOfFile( m_MappedPointers[i] );
+    m_MappedPointers.RemoveAll();
+
+    if( m_hFileMappingObject )
+    {
+        CloseHandle( m_hFileMappingObject );
+        m_hFileMappingObject = 0;
+    }
+}
+
 HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
                                         IDirect3DDevice9* pDev9,
                                         BYTE* pData,
@@ -388,8 +480,6 @@ HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
                                         SDKMESH_CALLBACKS9* pLoaderCallbacks9 )
 {
     HRESULT hr = E_FAIL;
-    D3DXVECTOR3 lower;
-    D3DXVECTOR3 upper;
 
     m_pDev9 = pDev9;
 	m_pDev11 = pDev11;
@@ -447,6 +537,20 @@ HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
     // Get the start of the buffer data
     UINT64 BufferDataStart = m_pMeshHeader->HeaderSize + m_pMeshHeader->NonBufferDataSize;
 
+    if( m_bLazyBuffers )
+    {
+        UINT NumBuffers = m_pMeshHeader->NumVertexBuffers + m_pMeshHeader->NumIndexBuffers;
+        m_pBufferRequested = new BYTE[ NumBuffers ];
+        m_pMeshBoundsValid = new bool[ m_pMeshHeader->NumMeshes ];
+        if( !m_pBufferRequested || !m_pMeshBoundsValid )
+        {
+            hr = E_OUTOFMEMORY;
+            goto Error;
+        }
+        ZeroMemory( m_pBufferRequested, NumBuffers );
+        ZeroMemory( m_pMeshBoundsValid, m_pMeshHeader->NumMeshes * sizeof( bool ) );
+    }
+
     // Create VBs
     m_ppVertices = new BYTE*[m_pMeshHeader->NumVertexBuffers];
     for( UINT i = 0; i < m_pMeshHeader->NumVertexBuffers; i++ )
@@ -454,7 +558,10 @@ HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
         BYTE* pVertices = NULL;
         pVertices = ( BYTE* )( pBufferData + ( m_pVertexBufferArray[i].DataOffset - BufferDataStart ) );
 
-        if( pDev11 )
+        // DataOffset shares storage with the buffer pointer, so clear it until RequestVB11 creates the buffer
+        if( m_bLazyBuffers )
+            m_pVertexBufferArray[i].DataOffset = 0;
+        else if( pDev11 )
             CreateVertexBuffer( pDev11, &m_pVertexBufferArray[i], pVertices, pLoaderCallbacks11 );
         else if( pDev9 )
             CreateVertexBuffer( pDev9, &m_pVertexBufferArray[i], pVertices, pLoaderCallbacks9 );
@@ -469,7 +576,9 @@ HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
         BYTE* pIndices = NULL;
         pIndices = ( BYTE* )( pBufferData + ( m_pIndexBufferArray[i].DataOffset - BufferDataStart ) );
 
-        if( pDev11 )
+        if( m_bLazyBuffers )
+            m_pIndexBufferArray[i].DataOffset = 0;
+        else if( pDev11 )
             CreateIndexBuffer( pDev11, &m_pIndexBufferArray[i], pIndices, pLoaderCallbacks11 );
         else if( pDev9 )
             CreateIndexBuffer( pDev9, &m_pIndexBufferArray[i], pIndices, pLoaderCallbacks9 );
@@ -479,7 +588,8 @@ HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
 
     // Load Materials
     if( pDev11 )
-        LoadMaterials( pDev11, m_pMaterialArray, m_pMeshHeader->NumMaterials, pLoaderCallbacks11 );
+        LoadMaterials( pDev11, m_pMaterialArray, m_pMeshHeader->NumMaterials,
+                       m_bLazyBuffers ? m_pLazyCallbacks11 : pLoaderCallbacks11 );
     else if( pDev9 )
         LoadMaterials( pDev9, m_pMaterialArray, m_pMeshHeader->NumMaterials, pLoaderCallbacks9 );
 
@@ -495,107 +605,78 @@ HRESULT CDXUTSDKMesh::CreateFromMemory( ID3D11Device* pDev11,
     m_pWorldPoseFrameMatrices = new D3DXMATRIX[ m_pMeshHeader->NumFrames ];
     if( !m_pWorldPoseFrameMatrices )
         goto Error;
+    m_pInvBindPoseFrameMatrices = new D3DXMATRIX[ m_pMeshHeader->NumFrames ];
+    if( !m_pInvBindPoseFrameMatrices )
+        goto Error;
 
-    SDKMESH_SUBSET* pSubset = NULL;
-    D3D11_PRIMITIVE_TOPOLOGY PrimType;
+    // Update bounding volumes.  Lazily loaded meshes wait until the bounds are asked for so the vertex and index
+    // data are not paged in here.
+    if( !m_bLazyBuffers )
+    {
+        for( UINT i = 0; i < m_pMeshHeader->NumMeshes; i++ )
+            UpdateMeshBounds( i );
+    }
 
-    // update bounding volume
-    SDKMESH_MESH* currentMesh = &m_pMeshArray[0];
-    int tris = 0;
-    for (UINT meshi=0; meshi < m_pMeshHeader->NumMeshes; ++meshi) {
-        lower.x = FLT_MAX; lower.y = FLT_MAX; lower.z = FLT_MAX;
-        upper.x = -FLT_MAX; upper.y = -FLT_MAX; upper.z = -FLT_MAX;
-        currentMesh = GetMesh( meshi );
-        INT indsize;
-        if (m_pIndexBufferArray[currentMesh->IndexBuffer].IndexType == IT_16BIT ) {
-            indsize = 2;
-        }else {
-            indsize = 4;
-        }
+    hr = S_OK;
+Error:
 
-        for( UINT subset = 0; subset < currentMesh->NumSubsets; subset++ )
-        {
-            pSubset = GetSubset( meshi, subset ); //&m_pSubsetArray[ currentMesh->pSubsets[subset] ];
+    if( !pLoaderCallbacks9 )
+    {
+        CheckLoadDone();
+    }
 
-            PrimType = GetPrimitiveType11( ( SDKMESH_PRIMITIVE_TYPE )pSubset->PrimitiveType );
-            assert( PrimType == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );// only triangle lists are handled.
+    return hr;
+}
 
-            UINT IndexCount = ( UINT )pSubset->IndexCount;
-            UINT IndexStart = ( UINT )pSubset->IndexStart;
+//--------------------------------------------------------------------------------------
+// Computes the bounding box of a mesh from its raw vertex and index data
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::UpdateMeshBounds( UINT iMesh )
+{
+    SDKMESH_MESH* currentMesh = GetMesh( iMesh );
+    D3DXVECTOR3 lower( FLT_MAX, FLT_MAX, FLT_MAX );
+    D3DXVECTOR3 upper( -FLT_MAX, -FLT_MAX, -FLT_MAX );
 
-            /*if( bAdjacent )
-            {
-                IndexCount *= 2;
-                IndexStart *= 2;
-            }*/
-
-        //BYTE* pIndices = NULL;
-            //m_ppIndices[i]
-            UINT *ind = ( UINT * )m_ppIndices[currentMesh->IndexBuffer];
-            FLOAT *verts =  ( FLOAT* )m_ppVertices[currentMesh->VertexBuffers[0]];
-            UINT stride = (UINT)m_pVertexBufferArray[currentMesh->VertexBuffers[0]].StrideBytes;
-            assert (stride % 4 == 0);
-            stride /=4;
-            for (UINT vertind = IndexStart; vertind < IndexStart + IndexCount; ++vertind) {
-                UINT current_ind=0;
-                if (indsize == 2) {
-                    UINT ind_div2 = vertind / 2;
-                    current_ind = ind[ind_div2];
-                    if (vertind %2 ==0) {
-                        current_ind = current_ind << 16;
-                        current_ind = current_ind >> 16;
-                    }else {
-                        current_ind = current_ind >> 16;
-                    }
-                }else {
-                    current_ind = ind[vertind];
-                }
-                tris++;
-                D3DXVECTOR3 *pt = (D3DXVECTOR3*)&(verts[stride * current_ind]);
-                if (pt->x < lower.x) {
-                    lower.x = pt->x;
-                }
-                if (pt->y < lower.y) {
-                    lower.y = pt->y;
-                }
-                if (pt->z < lower.z) {
-                    lower.z = pt->z;
-                }
-                if (pt->x > upper.x) {
-                    upper.x = pt->x;
-                }
-                if (pt->y > upper.y) {
-                    upper.y = pt->y;
-                }
-                if (pt->z > upper.z) {
-                    upper.z = pt->z;
-                }
-                //BYTE** m_ppVertices;
-                //BYTE** m_ppIndices;
-            }
-            //pd3dDeviceContext->DrawIndexed( IndexCount, IndexStart, VertexStart );
-        }
+    bool b16Bit = ( m_pIndexBufferArray[currentMesh->IndexBuffer].IndexType == IT_16BIT );
+    BYTE* pIndices = m_ppIndices[currentMesh->IndexBuffer];
+    FLOAT* verts = ( FLOAT* )m_ppVertices[currentMesh->VertexBuffers[0]];
+    UINT stride = ( UINT )m_pVertexBufferArray[currentMesh->VertexBuffers[0]].StrideBytes;
+    assert( stride % 4 == 0 );
+    stride /= 4;
 
-        D3DXVECTOR3 half = upper - lower;
-        half *=0.5f;
+    for( UINT subset = 0; subset < currentMesh->NumSubsets; subset++ )
+    {
+        SDKMESH_SUBSET* pSubset = GetSubset( iMesh, subset );
 
-        currentMesh->BoundingBoxCenter = lower + half;
-        currentMesh->BoundingBoxExtents = half;
+        D3D11_PRIMITIVE_TOPOLOGY PrimType = GetPrimitiveType11( ( SDKMESH_PRIMITIVE_TYPE )pSubset->PrimitiveType );
+        assert( PrimType == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );// only triangle lists are handled.
+        UNREFERENCED_PARAMETER( PrimType );
 
-    }
-    // Update
+        UINT IndexCount = ( UINT )pSubset->IndexCount;
+        UINT IndexStart = ( UINT )pSubset->IndexStart;
 
+        for( UINT vertind = IndexStart; vertind < IndexStart + IndexCount; ++vertind )
+        {
+            UINT current_ind;
+            if( b16Bit )
+                current_ind = ( ( USHORT* )pIndices )[vertind];
+            else
+                current_ind = ( ( UINT* )pIndices )[vertind];
 
+            D3DXVECTOR3* pt = ( D3DXVECTOR3* )&( verts[stride * current_ind] );
+            D3DXVec3Minimize( &lower, &lower, pt );
+            D3DXVec3Maximize( &upper, &upper, pt );
+        }
+    }
 
-    hr = S_OK;
-Error:
+    D3DXVECTOR3 half = upper - lower;
+    half *= 0.5f;
 
-    if( !pLoaderCallbacks9 )
-    {
-        CheckLoadDone();
-    }
+    currentMesh->BoundingBoxCenter = lower + half;
+    currentMesh->BoundingBoxExtents = half;
 
-    return hr;
+    if( m_pMeshBoundsValid )
+        m_pMeshBoundsValid[iMesh] = true;
 }
 
 //--------------------------------------------------------------------------------------
@@ -722,6 +803,199 @@ void CDXUTSDKMesh::TransformFrameAbsolute( UINT iFrame, double fTime )
 }
 
 #define MAX_D3D11_VERTEX_STREAMS D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT
+//--------------------------------------------------------------------------------------
+// Flatten the frame hierarchy below frame 0 into parent-before-child order and copy the
+// animation keys out of the file layout into key-major translation and orientation
+// arrays.  Orientations are normalized here so evaluation doesn't have to.
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTSDKMesh::BuildAnimationEvaluator()
+{
+    DestroyAnimationEvaluator();
+
+    if( !m_pMeshHeader || !m_pAnimationHeader || 0 == m_pMeshHeader->NumFrames ||
+        0 == m_pAnimationHeader->NumAnimationKeys )
+        return S_OK;
+
+    UINT NumFrames = m_pMeshHeader->NumFrames;
+    UINT NumTracks = m_pAnimationHeader->NumFrames;
+    UINT NumKeys = m_pAnimationHeader->NumAnimationKeys;
+    UINT* pStack = NULL;
+    UINT iTop = 0;
+
+    m_pEvalFrames = new UINT[ NumFrames ];
+    m_pEvalParents = new UINT[ NumFrames ];
+    m_pEvalWorldScratch = new D3DXMATRIX[ NumFrames ];
+    pStack = new UINT[ ( NumFrames + 1 ) * 2 ];
+    m_pKeyTranslations = ( D3DXVECTOR4* )_aligned_malloc( sizeof( D3DXVECTOR4 ) * NumKeys * NumTracks, 16 );
+    m_pKeyOrientations = ( D3DXVECTOR4* )_aligned_malloc( sizeof( D3DXVECTOR4 ) * NumKeys * NumTracks, 16 );
+    if( !m_pEvalFrames || !m_pEvalParents || !m_pEvalWorldScratch || !pStack || !m_pKeyTranslations ||
+        !m_pKeyOrientations )
+    {
+        SAFE_DELETE_ARRAY( pStack );
+        DestroyAnimationEvaluator();
+        return E_OUTOFMEMORY;
+    }
+
+    // Same traversal as TransformFrame: siblings share the parent, children hang off the frame.  Every pass
+    // pops one entry and pushes at most two, and there are at most NumFrames passes.
+    pStack[iTop++] = 0;
+    pStack[iTop++] = INVALID_FRAME;
+    while( iTop > 0 && m_NumEvalFrames < NumFrames )
+    {
+        UINT iParent = pStack[--iTop];
+        UINT iFrame = pStack[--iTop];
+        if( iFrame >= NumFrames )
+            continue;
+
+        m_pEvalFrames[m_NumEvalFrames] = iFrame;
+        m_pEvalParents[m_NumEvalFrames] = iParent;
+        m_NumEvalFrames++;
+
+        if( m_pFrameArray[iFrame].SiblingFrame != INVALID_FRAME )
+        {
+            pStack[iTop++] = m_pFrameArray[iFrame].SiblingFrame;
+            pStack[iTop++] = iParent;
+        }
+        if( m_pFrameArray[iFrame].ChildFrame != INVALID_FRAME )
+        {
+            pStack[iTop++] = m_pFrameArray[iFrame].ChildFrame;
+            pStack[iTop++] = iFrame;
+        }
+    }
+    SAFE_DELETE_ARRAY( pStack );
+
+    for( UINT t = 0; t < NumTracks; t++ )
+    {
+        SDKANIMATION_DATA* pData = m_pAnimationFrameData[t].pAnimationData;
+        for( UINT k = 0; k < NumKeys; k++ )
+        {
+            D3DXVECTOR4* pTranslation = &m_pKeyTranslations[k * NumTracks + t];
+            D3DXVECTOR4* pOrientation = &m_pKeyOrientations[k * NumTracks + t];
+
+            *pTranslation = D3DXVECTOR4( pData[k].Translation, 1.0f );
+
+            D3DXQUATERNION quat( pData[k].Orientation.x, pData[k].Orientation.y, pData[k].Orientation.z,
+                                 pData[k].Orientation.w );
+            if( quat.w == 0 && quat.x == 0 && quat.y == 0 && quat.z == 0 )
+                D3DXQuaternionIdentity( &quat );
+            D3DXQuaternionNormalize( &quat, &quat );
+            *pOrientation = D3DXVECTOR4( quat.x, quat.y, quat.z, quat.w );
+        }
+    }
+    m_NumAnimTracks = NumTracks;
+
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::DestroyAnimationEvaluator()
+{
+    SAFE_DELETE_ARRAY( m_pEvalFrames );
+    SAFE_DELETE_ARRAY( m_pEvalParents );
+    SAFE_DELETE_ARRAY( m_pEvalWorldScratch );
+    if( m_pKeyTranslations )
+        _aligned_free( m_pKeyTranslations );
+    if( m_pKeyOrientations )
+        _aligned_free( m_pKeyOrientations );
+    m_pKeyTranslations = NULL;
+    m_pKeyOrientations = NULL;
+    m_NumEvalFrames = 0;
+    m_NumAnimTracks = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// The keys on either side of fTime, following the same wrap as GetAnimationKeyFromTime
+// (key 0 is only used as the rest pose), and how far fTime is from the first to the second
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::GetAnimationKeysFromTime( double fTime, UINT* piKey0, UINT* piKey1, FLOAT* pfLerp )
+{
+    UINT NumKeys = m_pAnimationHeader->NumAnimationKeys;
+    if( NumKeys < 2 )
+    {
+        *piKey0 = 0;
+        *piKey1 = 0;
+        *pfLerp = 0.0f;
+        return;
+    }
+
+    double fKey = fmod( m_pAnimationHeader->AnimationFPS * fTime, ( double )( NumKeys - 1 ) );
+    if( fKey < 0 )
+        fKey += NumKeys - 1;
+
+    UINT iKey = ( UINT )fKey;
+    if( iKey >= NumKeys - 1 )
+        iKey = 0;
+
+    *piKey0 = iKey + 1;
+    *piKey1 = ( iKey + 1 ) % ( NumKeys - 1 ) + 1;
+    *pfLerp = ( FLOAT )( fKey - iKey );
+}
+
+//--------------------------------------------------------------------------------------
+// Evaluate the animation for a batch of instances.  Each frame slerps its orientation
+// and lerps its translation between the bracketing keys, then walks the flattened
+// hierarchy in order so every parent is finished before its children.
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::EvaluateAnimation( SDKMESH_ANIMATION_INSTANCE* pInstances, UINT NumInstances )
+{
+    if( !m_pEvalFrames )
+        return;
+
+    const XMFLOAT4A* pTranslations = ( const XMFLOAT4A* )m_pKeyTranslations;
+    const XMFLOAT4A* pOrientations = ( const XMFLOAT4A* )m_pKeyOrientations;
+
+    for( UINT i = 0; i < NumInstances; i++ )
+    {
+        SDKMESH_ANIMATION_INSTANCE* pInstance = &pInstances[i];
+        D3DXMATRIX* pWorldMatrices = pInstance->pWorldMatrices ? pInstance->pWorldMatrices : m_pEvalWorldScratch;
+
+        UINT iKey0, iKey1;
+        FLOAT fLerp;
+        GetAnimationKeysFromTime( pInstance->fTime, &iKey0, &iKey1, &fLerp );
+        const XMFLOAT4A* pTranslations0 = &pTranslations[iKey0 * m_NumAnimTracks];
+        const XMFLOAT4A* pTranslations1 = &pTranslations[iKey1 * m_NumAnimTracks];
+        const XMFLOAT4A* pOrientations0 = &pOrientations[iKey0 * m_NumAnimTracks];
+        const XMFLOAT4A* pOrientations1 = &pOrientations[iKey1 * m_NumAnimTracks];
+        XMVECTOR vLerp = XMVectorReplicate( fLerp );
+
+        XMMATRIX mRoot = XMLoadFloat4x4( ( const XMFLOAT4X4* )pInstance->pWorld );
+
+        for( UINT f = 0; f < m_NumEvalFrames; f++ )
+        {
+            UINT iFrame = m_pEvalFrames[f];
+            UINT iTrack = m_pFrameArray[iFrame].AnimationDataIndex;
+
+            XMMATRIX mLocal;
+            if( iTrack < m_NumAnimTracks )
+            {
+                XMVECTOR q = XMQuaternionSlerpV( XMLoadFloat4A( &pOrientations0[iTrack] ),
+                                                 XMLoadFloat4A( &pOrientations1[iTrack] ), vLerp );
+                XMVECTOR t = XMVectorLerpV( XMLoadFloat4A( &pTranslations0[iTrack] ),
+                                            XMLoadFloat4A( &pTranslations1[iTrack] ), vLerp );
+                mLocal = XMMatrixRotationQuaternion( q );
+                mLocal.r[3] = t;
+            }
+            else
+            {
+                mLocal = XMLoadFloat4x4( ( const XMFLOAT4X4* )&m_pFrameArray[iFrame].Matrix );
+            }
+
+            UINT iParent = m_pEvalParents[f];
+            XMMATRIX mParent = ( iParent == INVALID_FRAME ) ? mRoot :
+                XMLoadFloat4x4( ( const XMFLOAT4X4* )&pWorldMatrices[iParent] );
+            XMMATRIX mWorld = XMMatrixMultiply( mLocal, mParent );
+            XMStoreFloat4x4( ( XMFLOAT4X4* )&pWorldMatrices[iFrame], mWorld );
+
+            if( pInstance->pFrameMatrices )
+            {
+                XMMATRIX mInvBindPose = XMLoadFloat4x4( ( const XMFLOAT4X4* )&m_pInvBindPoseFrameMatrices[iFrame] );
+                XMStoreFloat4x4( ( XMFLOAT4X4* )&pInstance->pFrameMatrices[iFrame],
+                                 XMMatrixMultiply( mInvBindPose, mWorld ) );
+            }
+        }
+    }
+}
+
 //--------------------------------------------------------------------------------------
 void CDXUTSDKMesh::RenderMesh( UINT iMesh,
                                bool bAdjacent,
@@ -730,7 +1004,13 @@ void CDXUTSDKMesh::RenderMesh( UINT iMesh,
                                UINT iNormalSlot,
                                UINT iSpecularSlot )
 {
-    if( 0 < GetOutstandingBufferResources() )
+    if( m_bLazyBuffers )
+    {
+        // Only the buffers of this mesh have to be ready to draw it
+        if( !RequestMeshBuffers11( iMesh ) )
+            return;
+    }
+    else if( 0 < GetOutstandingBufferResources() )
         return;
 
     SDKMESH_MESH* pMesh = &m_pMeshArray[iMesh];
@@ -986,8 +1266,20 @@ CDXUTSDKMesh::CDXUTSDKMesh() : m_NumOutstandingResources( 0 ),
                                m_pBindPoseFrameMatrices( NULL ),
                                m_pTransformedFrameMatrices( NULL ),
                                m_pWorldPoseFrameMatrices( NULL ),
+                               m_pInvBindPoseFrameMatrices( NULL ),
+                               m_NumEvalFrames( 0 ),
+                               m_pEvalFrames( NULL ),
+                               m_pEvalParents( NULL ),
+                               m_NumAnimTracks( 0 ),
+                               m_pKeyTranslations( NULL ),
+                               m_pKeyOrientations( NULL ),
+                               m_pEvalWorldScratch( NULL ),
                                m_pDev9( NULL ),
-							   m_pDev11( NULL )
+							   m_pDev11( NULL ),
+                               m_bLazyBuffers( false ),
+                               m_pBufferRequested( NULL ),
+                               m_pMeshBoundsValid( NULL ),
+                               m_pLazyCallbacks11( NULL )
 {
 }
 
@@ -1085,7 +1377,7 @@ HRESULT CDXUTSDKMesh::LoadAnimation( WCHAR* szFileName )
         }
     }
 
-    hr = S_OK;
+    hr = BuildAnimationEvaluator();
 Error:
     CloseHandle( hFile );
     return hr;
@@ -1162,12 +1454,27 @@ void CDXUTSDKMesh::Destroy()
     }
     SAFE_DELETE_ARRAY( m_pAdjacencyIndexBufferArray );
 
-    SAFE_DELETE_ARRAY( m_pHeapData );
+    // m_pHeapData points into the view when the mesh was mapped
+    if( m_MappedPointers.GetSize() > 0 )
+    {
+        m_pHeapData = NULL;
+        UnmapMeshFile();
+    }
+    else
+    {
+        SAFE_DELETE_ARRAY( m_pHeapData );
+    }
     m_pStaticMeshData = NULL;
+    SAFE_DELETE_ARRAY( m_pBufferRequested );
+    SAFE_DELETE_ARRAY( m_pMeshBoundsValid );
+    m_bLazyBuffers = false;
+    m_pLazyCallbacks11 = NULL;
     SAFE_DELETE_ARRAY( m_pAnimationData );
     SAFE_DELETE_ARRAY( m_pBindPoseFrameMatrices );
     SAFE_DELETE_ARRAY( m_pTransformedFrameMatrices );
     SAFE_DELETE_ARRAY( m_pWorldPoseFrameMatrices );
+    SAFE_DELETE_ARRAY( m_pInvBindPoseFrameMatrices );
+    DestroyAnimationEvaluator();
 
     SAFE_DELETE_ARRAY( m_ppVertices );
     SAFE_DELETE_ARRAY( m_ppIndices );
@@ -1191,6 +1498,12 @@ void CDXUTSDKMesh::Destroy()
 void CDXUTSDKMesh::TransformBindPose( D3DXMATRIX* pWorld )
 {
     TransformBindPoseFrame( 0, pWorld );
+
+    if( m_pInvBindPoseFrameMatrices )
+    {
+        for( UINT i = 0; i < m_pMeshHeader->NumFrames; i++ )
+            D3DXMatrixInverse( &m_pInvBindPoseFrameMatrices[i], NULL, &m_pBindPoseFrameMatrices[i] );
+    }
 }
 
 //--------------------------------------------------------------------------------------
@@ -1198,7 +1511,16 @@ void CDXUTSDKMesh::TransformBindPose( D3DXMATRIX* pWorld )
 //--------------------------------------------------------------------------------------
 void CDXUTSDKMesh::TransformMesh( D3DXMATRIX* pWorld, double fTime )
 {
-    if( m_pAnimationHeader == NULL || FTT_RELATIVE == m_pAnimationHeader->FrameTransformType )
+    if( m_pEvalFrames && FTT_RELATIVE == m_pAnimationHeader->FrameTransformType )
+    {
+        SDKMESH_ANIMATION_INSTANCE Instance;
+        Instance.pWorld = pWorld;
+        Instance.fTime = fTime;
+        Instance.pFrameMatrices = m_pTransformedFrameMatrices;
+        Instance.pWorldMatrices = m_pWorldPoseFrameMatrices;
+        EvaluateAnimation( &Instance, 1 );
+    }
+    else if( m_pAnimationHeader == NULL || FTT_RELATIVE == m_pAnimationHeader->FrameTransformType )
     {
         TransformFrame( 0, pWorld, fTime );
 
@@ -1306,13 +1628,13 @@ DXGI_FORMAT CDXUTSDKMesh::GetIBFormat11( UINT iMesh )
 //--------------------------------------------------------------------------------------
 ID3D11Buffer* CDXUTSDKMesh::GetVB11( UINT iMesh, UINT iVB )
 {
-    return m_pVertexBufferArray[ m_pMeshArray[ iMesh ].VertexBuffers[iVB] ].pVB11;
+    return GetVB11At( ( UINT )m_pMeshArray[ iMesh ].VertexBuffers[iVB] );
 }
 
 //--------------------------------------------------------------------------------------
 ID3D11Buffer* CDXUTSDKMesh::GetIB11( UINT iMesh )
 {
-    return m_pIndexBufferArray[ m_pMeshArray[ iMesh ].IndexBuffer ].pIB11;
+    return GetIB11At( m_pMeshArray[ iMesh ].IndexBuffer );
 }
 SDKMESH_INDEX_TYPE CDXUTSDKMesh::GetIndexType( UINT iMesh )
 {
@@ -1423,15 +1745,65 @@ UINT CDXUTSDKMesh::GetNumIBs()
 //--------------------------------------------------------------------------------------
 ID3D11Buffer* CDXUTSDKMesh::GetVB11At( UINT iVB )
 {
+    if( m_bLazyBuffers )
+        RequestVB11( iVB );
     return m_pVertexBufferArray[ iVB ].pVB11;
 }
 
 //--------------------------------------------------------------------------------------
 ID3D11Buffer* CDXUTSDKMesh::GetIB11At( UINT iIB )
 {
+    if( m_bLazyBuffers )
+        RequestIB11( iIB );
     return m_pIndexBufferArray[ iIB ].pIB11;
 }
 
+//--------------------------------------------------------------------------------------
+// Creates a lazily loaded VB the first time it is asked for.  With loader callbacks the buffer may still be NULL
+// on return and shows up in GetOutstandingBufferResources until the callback fills it in.
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::RequestVB11( UINT iVB )
+{
+    if( m_pBufferRequested[iVB] )
+        return;
+
+    m_pBufferRequested[iVB] = TRUE;
+    CreateVertexBuffer( m_pDev11, &m_pVertexBufferArray[iVB], m_ppVertices[iVB], m_pLazyCallbacks11 );
+}
+
+//--------------------------------------------------------------------------------------
+void CDXUTSDKMesh::RequestIB11( UINT iIB )
+{
+    BYTE* pRequested = &m_pBufferRequested[m_pMeshHeader->NumVertexBuffers + iIB];
+    if( *pRequested )
+        return;
+
+    *pRequested = TRUE;
+    CreateIndexBuffer( m_pDev11, &m_pIndexBufferArray[iIB], m_ppIndices[iIB], m_pLazyCallbacks11 );
+}
+
+//--------------------------------------------------------------------------------------
+// Requests every buffer used by a mesh and returns true once they can all be bound
+//--------------------------------------------------------------------------------------
+bool CDXUTSDKMesh::RequestMeshBuffers11( UINT iMesh )
+{
+    SDKMESH_MESH* pMesh = &m_pMeshArray[iMesh];
+    bool bReady = true;
+
+    for( UINT i = 0; i < pMesh->NumVertexBuffers; i++ )
+    {
+        ID3D11Buffer* pVB = GetVB11At( pMesh->VertexBuffers[i] );
+        if( !pVB || IsErrorResource( pVB ) )
+            bReady = false;
+    }
+
+    ID3D11Buffer* pIB = GetIB11At( pMesh->IndexBuffer );
+    if( !pIB || IsErrorResource( pIB ) )
+        bReady = false;
+
+    return bReady;
+}
+
 //--------------------------------------------------------------------------------------
 IDirect3DVertexBuffer9* CDXUTSDKMesh::GetVB9At( UINT iVB )
 {
@@ -1527,12 +1899,16 @@ UINT64 CDXUTSDKMesh::GetNumIndices( UINT iMesh )
 //--------------------------------------------------------------------------------------
 D3DXVECTOR3 CDXUTSDKMesh::GetMeshBBoxCenter( UINT iMesh )
 {
+    if( m_pMeshBoundsValid && !m_pMeshBoundsValid[iMesh] )
+        UpdateMeshBounds( iMesh );
     return m_pMeshArray[iMesh].BoundingBoxCenter;
 }
 
 //--------------------------------------------------------------------------------------
 D3DXVECTOR3 CDXUTSDKMesh::GetMeshBBoxExtents( UINT iMesh )
 {
+    if( m_pMeshBoundsValid && !m_pMeshBoundsValid[iMesh] )
+        UpdateMeshBounds( iMesh );
     return m_pMeshArray[iMesh].BoundingBoxExtents;
 }
 
@@ -1603,14 +1979,19 @@ UINT CDXUTSDKMesh::GetOutstandingBufferResources()
     if( !m_pMeshHeader )
         return 1;
 
+    // Lazily loaded buffers are only outstanding once they have been asked for
     for( UINT i = 0; i < m_pMeshHeader->NumVertexBuffers; i++ )
     {
+        if( m_bLazyBuffers && !m_pBufferRequested[i] )
+            continue;
         if( !m_pVertexBufferArray[i].pVB9 && !IsErrorResource( m_pVertexBufferArray[i].pVB9 ) )
             outstandingResources ++;
     }
 
     for( UINT i = 0; i < m_pMeshHeader->NumIndexBuffers; i++ )
     {
+        if( m_bLazyBuffers && !m_pBufferRequested[m_pMeshHeader->NumVertexBuffers + i] )
+            continue;
         if( !m_pIndexBufferArray[i].pIB9 && !IsErrorResource( m_pIndexBufferArray[i].pIB9 ) )
             outstandingResources ++;
     }
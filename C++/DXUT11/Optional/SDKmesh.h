@@ -292,6 +292,19 @@ struct SDKMESH_CALLBACKS11
     void* pContext;
 };
 
+//--------------------------------------------------------------------------------------
+// One character for CDXUTSDKMesh::EvaluateAnimation.  pFrameMatrices receives the same
+// bind-pose relative matrices as GetInfluenceMatrix; pWorldMatrices is optional.  Both
+// must hold GetNumFrames() matrices.
+//--------------------------------------------------------------------------------------
+struct SDKMESH_ANIMATION_INSTANCE
+{
+    const D3DXMATRIX* pWorld;
+    double fTime;
+    D3DXMATRIX* pFrameMatrices;
+    D3DXMATRIX* pWorldMatrices;
+};
+
 //--------------------------------------------------------------------------------------
 // CDXUTSDKMesh class.  This class reads the sdkmesh file format for use by the samples
 //--------------------------------------------------------------------------------------
@@ -308,6 +321,20 @@ private:
     ID3D11Device* m_pDev11;
     ID3D11DeviceContext* m_pDevContext11;
 
+    // Lazy buffer creation (CreateMapped).  m_pBufferRequested holds one flag per VB followed by one per IB.
+    bool m_bLazyBuffers;
+    BYTE* m_pBufferRequested;
+    bool* m_pMeshBoundsValid;
+    SDKMESH_CALLBACKS11 m_LoaderCallbacks11;
+    SDKMESH_CALLBACKS11* m_pLazyCallbacks11;
+
+    HRESULT                         OpenMeshFile( LPCTSTR szFileName );
+    void                            UnmapMeshFile();
+    void                            RequestVB11( UINT iVB );
+    void                            RequestIB11( UINT iIB );
+    bool                            RequestMeshBuffers11( UINT iMesh );
+    void                            UpdateMeshBounds( UINT iMesh );
+
 protected:
     //These are the pointers to the two chunks of data loaded in from the mesh file
     BYTE* m_pStaticMeshData;
@@ -338,6 +365,17 @@ protected:
     D3DXMATRIX* m_pBindPoseFrameMatrices;
     D3DXMATRIX* m_pTransformedFrameMatrices;
     D3DXMATRIX* m_pWorldPoseFrameMatrices;
+    D3DXMATRIX* m_pInvBindPoseFrameMatrices;
+
+    //Flattened animation built by LoadAnimation.  Frames are stored parent before child and the keys are
+    //key-major: the orientation of track t at key k is m_pKeyOrientations[k * m_NumAnimTracks + t].
+    UINT m_NumEvalFrames;
+    UINT* m_pEvalFrames;
+    UINT* m_pEvalParents;
+    UINT m_NumAnimTracks;
+    D3DXVECTOR4* m_pKeyTranslations;
+    D3DXVECTOR4* m_pKeyOrientations;
+    D3DXMATRIX* m_pEvalWorldScratch;
 
 protected:
     void                            LoadMaterials( ID3D11Device* pd3dDevice, SDKMESH_MATERIAL* pMaterials,
@@ -379,6 +417,10 @@ protected:
     void                            TransformBindPoseFrame( UINT iFrame, D3DXMATRIX* pParentWorld );
     void                            TransformFrame( UINT iFrame, D3DXMATRIX* pParentWorld, double fTime );
     void                            TransformFrameAbsolute( UINT iFrame, double fTime );
+    HRESULT                         BuildAnimationEvaluator();
+    void                            DestroyAnimationEvaluator();
+    void                            GetAnimationKeysFromTime( double fTime, UINT* piKey0, UINT* piKey1,
+                                                              FLOAT* pfLerp );
 
     //Direct3D 11 rendering helpers
     void                            RenderMesh( UINT iMesh,
@@ -425,6 +467,13 @@ public:
     virtual HRESULT                 Create( IDirect3DDevice9* pDev9, BYTE* pData, UINT DataBytes,
                                             bool bCreateAdjacencyIndices=false, bool bCopyStatic=false,
                                             SDKMESH_CALLBACKS9* pLoaderCallbacks=NULL );
+
+    // Maps the file copy-on-write and fixes up pointers in the view instead of reading it into the heap.  Each VB
+    // and IB is created the first time it is asked for (GetVB11, GetIB11, Render), through pLoaderCallbacks if
+    // given, and mesh bounds are computed on first use.  pDev11 must outlive the mesh.
+    virtual HRESULT                 CreateMapped( ID3D11Device* pDev11, LPCTSTR szFileName,
+                                                  bool bCreateAdjacencyIndices=false,
+                                                  SDKMESH_CALLBACKS11* pLoaderCallbacks=NULL );
     virtual HRESULT                 LoadAnimation( WCHAR* szFileName );
     virtual void                    Destroy();
 
@@ -432,6 +481,11 @@ public:
     void                            TransformBindPose( D3DXMATRIX* pWorld );
     void                            TransformMesh( D3DXMATRIX* pWorld, double fTime );
 
+    // Interpolates between the keys on either side of each instance's time.  Not thread safe: the instances
+    // of one mesh share scratch space.
+    void                            EvaluateAnimation( SDKMESH_ANIMATION_INSTANCE* pInstances,
+                                                       UINT NumInstances );
+
 
     //Direct3D 11 Rendering
     virtual void                    Render( ID3D11DeviceContext* pd3dDeviceContext,
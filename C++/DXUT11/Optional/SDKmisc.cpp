@@ -443,8 +443,12 @@ CDXUTResourceCache::~CDXUTResourceCache()
     OnDestroyDevice();
 
     m_TextureCache.RemoveAll();
+    m_TextureHashBuckets.RemoveAll();
+    m_PendingTextures.RemoveAll();
     m_EffectCache.RemoveAll();
     m_FontCache.RemoveAll();
+
+    DeleteCriticalSection( &m_cs );
 }
 
 //--------------------------------------------------------------------------------------
@@ -549,49 +553,460 @@ HRESULT CDXUTResourceCache::CreateTextureFromFileEx( LPDIRECT3DDEVICE9 pDevice,
 
 
 
+//--------------------------------------------------------------------------------------
+// Pending background texture load
+//--------------------------------------------------------------------------------------
+struct DXUTCache_PendingTexture
+{
+    volatile LONG cRef;
+    HANDLE hDone;                       // Signaled once the load has been resolved
+    HRESULT hrLoad;
+    bool bOwnSrcInfo;
+    CDXUTResourceCache* pCache;
+    ID3D11Device* pDevice;
+    ID3D11ShaderResourceView* pSRV;     // Set once the load has succeeded
+    DXUTCache_Texture Key;
+    D3DX11_IMAGE_LOAD_INFO LoadInfo;
+    D3DX11_IMAGE_INFO SrcInfo;
+};
+
+static void ReleasePendingTexture( DXUTCache_PendingTexture* pPending )
+{
+    if( InterlockedDecrement( &pPending->cRef ) == 0 )
+    {
+        SAFE_RELEASE( pPending->pSRV );
+        SAFE_RELEASE( pPending->pDevice );
+        if( pPending->hDone )
+            CloseHandle( pPending->hDone );
+        delete pPending;
+    }
+}
+
+static bool TextureKeysMatch( const DXUTCache_Texture& Entry, const DXUTCache_Texture& Key )
+{
+    return Entry.Hash == Key.Hash &&
+           Entry.Location == Key.Location &&
+           Entry.Width == Key.Width &&
+           Entry.Height == Key.Height &&
+           Entry.Depth == Key.Depth &&
+           Entry.MipLevels == Key.MipLevels &&
+           Entry.Usage11 == Key.Usage11 &&
+           Entry.Format == Key.Format &&
+           Entry.CpuAccessFlags == Key.CpuAccessFlags &&
+           Entry.BindFlags == Key.BindFlags &&
+           Entry.MiscFlags == Key.MiscFlags &&
+           Entry.bSRGB == Key.bSRGB &&
+           !lstrcmpW( Entry.wszSource, Key.wszSource );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Fills in the identity of a D3D11 texture load, as requested by the caller, so a cache
+// hit can be found without opening the file
+//--------------------------------------------------------------------------------------
+void CDXUTResourceCache::BuildTextureKey( LPCTSTR pSrcFile, const D3DX11_IMAGE_LOAD_INFO* pLoadInfo, bool bSRGB,
+                                          DXUTCache_Texture& Key )
+{
+    D3DX11_IMAGE_LOAD_INFO ZeroInfo;
+    if( !pLoadInfo )
+        pLoadInfo = &ZeroInfo;
+
+    Key.Location = DXUTCACHE_LOCATION_FILE;
+    wcscpy_s( Key.wszSource, MAX_PATH, pSrcFile );
+    Key.Width = pLoadInfo->Width;
+    Key.Height = pLoadInfo->Height;
+    Key.Depth = pLoadInfo->Depth;
+    Key.MipLevels = pLoadInfo->MipLevels;
+    Key.Usage11 = pLoadInfo->Usage;
+    Key.Format = pLoadInfo->Format;
+    Key.CpuAccessFlags = pLoadInfo->CpuAccessFlags;
+    Key.BindFlags = pLoadInfo->BindFlags;
+    Key.MiscFlags = pLoadInfo->MiscFlags;
+    Key.bSRGB = bSRGB;
+
+    // FNV-1a over the path and the load parameters
+    UINT Hash = 2166136261U;
+    for( const WCHAR* pch = Key.wszSource; *pch; ++pch )
+        Hash = ( Hash ^ *pch ) * 16777619U;
+
+    const UINT Fields[] =
+    {
+        Key.Width, Key.Height, Key.Depth, Key.MipLevels, ( UINT )Key.Usage11, ( UINT )Key.Format,
+        Key.CpuAccessFlags, Key.BindFlags, Key.MiscFlags, Key.bSRGB ? 1U : 0U
+    };
+    for( UINT i = 0; i < ARRAYSIZE( Fields ); ++i )
+        Hash = ( Hash ^ Fields[i] ) * 16777619U;
+
+    Key.Hash = Hash;
+    Key.iNextHash = -1;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Returns the index of the D3D11 texture entry matching Key, or -1.  Caller holds m_cs.
+//--------------------------------------------------------------------------------------
+int CDXUTResourceCache::FindTexture( const DXUTCache_Texture& Key )
+{
+    if( m_TextureHashBuckets.GetSize() == 0 )
+        return -1;
+
+    int i = m_TextureHashBuckets[ Key.Hash & ( m_TextureHashBuckets.GetSize() - 1 ) ];
+    while( i >= 0 )
+    {
+        const DXUTCache_Texture& Entry = m_TextureCache[i];
+        if( TextureKeysMatch( Entry, Key ) )
+            return i;
+        i = Entry.iNextHash;
+    }
+
+    return -1;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Relinks every D3D11 texture entry into the hash chains, sizing the bucket array to keep
+// chains short.  Needed whenever entries are removed, since that shifts their indices.
+// Caller holds m_cs.
+//--------------------------------------------------------------------------------------
+void CDXUTResourceCache::RebuildTextureIndex()
+{
+    int nBuckets = 16;
+    while( nBuckets < m_TextureCache.GetSize() )
+        nBuckets *= 2;
+
+    if( m_TextureHashBuckets.GetSize() != nBuckets )
+    {
+        m_TextureHashBuckets.RemoveAll();
+        for( int i = 0; i < nBuckets; ++i )
+        {
+            if( FAILED( m_TextureHashBuckets.Add( -1 ) ) )
+            {
+                m_TextureHashBuckets.RemoveAll();
+                return;
+            }
+        }
+    }
+    else
+    {
+        for( int i = 0; i < nBuckets; ++i )
+            m_TextureHashBuckets[i] = -1;
+    }
+
+    for( int i = 0; i < m_TextureCache.GetSize(); ++i )
+    {
+        DXUTCache_Texture& Entry = m_TextureCache[i];
+        Entry.iNextHash = -1;
+        if( !Entry.pSRV11 )
+            continue;
+
+        int& Head = m_TextureHashBuckets[ Entry.Hash & ( nBuckets - 1 ) ];
+        Entry.iNextHash = Head;
+        Head = i;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Adds a loaded D3D11 texture to the cache.  If another thread cached the same texture
+// while this one was loading, *ppOutputRV is swapped for the cached view.
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTResourceCache::AddTexture( DXUTCache_Texture& NewEntry, ID3D11ShaderResourceView** ppOutputRV )
+{
+    HRESULT hr = S_OK;
+
+    EnterCriticalSection( &m_cs );
+
+    int iExisting = FindTexture( NewEntry );
+    if( iExisting >= 0 )
+    {
+        SAFE_RELEASE( *ppOutputRV );
+        hr = m_TextureCache[iExisting].pSRV11->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )ppOutputRV );
+    }
+    else
+    {
+        ( *ppOutputRV )->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )&NewEntry.pSRV11 );
+
+        // If the entry can't be stored the view simply isn't cached, so drop the cache's reference
+        if( m_TextureCache.GetSize() >= m_TextureHashBuckets.GetSize() )
+        {
+            if( FAILED( m_TextureCache.Add( NewEntry ) ) )
+                SAFE_RELEASE( NewEntry.pSRV11 );
+            RebuildTextureIndex();
+        }
+        else
+        {
+            int& Head = m_TextureHashBuckets[ NewEntry.Hash & ( m_TextureHashBuckets.GetSize() - 1 ) ];
+            NewEntry.iNextHash = Head;
+            if( SUCCEEDED( m_TextureCache.Add( NewEntry ) ) )
+                Head = m_TextureCache.GetSize() - 1;
+            else
+                SAFE_RELEASE( NewEntry.pSRV11 );
+        }
+    }
+
+    LeaveCriticalSection( &m_cs );
+
+    return hr;
+}
+
+
 //--------------------------------------------------------------------------------------
 HRESULT CDXUTResourceCache::CreateTextureFromFileEx( ID3D11Device* pDevice, ID3D11DeviceContext* pContext, LPCTSTR pSrcFile,
                                                      D3DX11_IMAGE_LOAD_INFO* pLoadInfo, ID3DX11ThreadPump* pPump,
                                                      ID3D11ShaderResourceView** ppOutputRV, bool bSRGB )
 {
+    UNREFERENCED_PARAMETER( pContext );
 
-    bool is10L9 = DXUTGetDeviceSettings().d3d11.DeviceFeatureLevel < D3D_FEATURE_LEVEL_10_0;
-    HRESULT hr = S_OK;
-    D3DX11_IMAGE_LOAD_INFO ZeroInfo;	//D3DX11_IMAGE_LOAD_INFO has a default constructor
-    D3DX11_IMAGE_INFO SrcInfo;
+    // Search the cache for a matching entry, keyed on the load info as requested so a hit does no IO.
+    DXUTCache_Texture Key;
+    BuildTextureKey( pSrcFile, pLoadInfo, bSRGB, Key );
 
-    if( !pLoadInfo )
+    EnterCriticalSection( &m_cs );
+    int iEntry = FindTexture( Key );
+    if( iEntry >= 0 )
     {
-        pLoadInfo = &ZeroInfo;
+        HRESULT hrFound = m_TextureCache[iEntry].pSRV11->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )ppOutputRV );
+        LeaveCriticalSection( &m_cs );
+        return hrFound;
     }
+    LeaveCriticalSection( &m_cs );
+
+    // Load it here, unless another thread already is, in which case wait for that load
+    DXUTCache_PendingTexture* pPending = NULL;
+    bool bLoad = false;
+    HRESULT hr = BeginTextureLoad( pDevice, pSrcFile, pLoadInfo, bSRGB, &pPending, &bLoad );
+    if( FAILED( hr ) )
+        return hr;
+
+    if( bLoad )
+        LoadTexture( pPending, pPump );
+    else
+        WaitForSingleObject( pPending->hDone, INFINITE );
 
-    if( !pLoadInfo->pSrcInfo )
+    hr = pPending->hrLoad;
+    if( SUCCEEDED( hr ) )
+        hr = pPending->pSRV->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )ppOutputRV );
+
+    ReleasePendingTexture( pPending );
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Finds or starts the load of a D3D11 texture.  A request for a texture that is already
+// loading gets that load's handle, so each file is read and decoded once however many
+// threads ask for it.  *pbLoad is set when the caller has to run LoadTexture itself.
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTResourceCache::BeginTextureLoad( ID3D11Device* pDevice, LPCTSTR pSrcFile, const D3DX11_IMAGE_LOAD_INFO* pLoadInfo,
+                                              bool bSRGB, DXUTCache_PendingTexture** ppPending, bool* pbLoad )
+{
+    *ppPending = NULL;
+    *pbLoad = false;
+
+    DXUTCache_PendingTexture* pPending = new DXUTCache_PendingTexture;
+    if( !pPending )
+        return E_OUTOFMEMORY;
+
+    pPending->cRef = 1;
+    pPending->hrLoad = E_PENDING;
+    pPending->bOwnSrcInfo = false;
+    pPending->pCache = this;
+    pPending->pDevice = NULL;
+    pPending->pSRV = NULL;
+    pPending->hDone = CreateEvent( NULL, TRUE, FALSE, NULL );
+    if( !pPending->hDone )
     {
-        D3DX11GetImageInfoFromFile( pSrcFile, NULL, &SrcInfo, NULL );
-        pLoadInfo->pSrcInfo = &SrcInfo;
+        HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
+        ReleasePendingTexture( pPending );
+        return hr;
+    }
+
+    BuildTextureKey( pSrcFile, pLoadInfo, bSRGB, pPending->Key );
 
-        pLoadInfo->Format = pLoadInfo->pSrcInfo->Format;
+    if( pLoadInfo )
+        pPending->LoadInfo = *pLoadInfo;
+
+    if( pPending->LoadInfo.pSrcInfo )
+        pPending->SrcInfo = *pPending->LoadInfo.pSrcInfo;
+    else
+        pPending->bOwnSrcInfo = true;
+    pPending->LoadInfo.pSrcInfo = &pPending->SrcInfo;
+
+    pPending->pDevice = pDevice;
+    pDevice->AddRef();
+
+    EnterCriticalSection( &m_cs );
+
+    int iEntry = FindTexture( pPending->Key );
+    if( iEntry >= 0 )
+    {
+        // Cached by now, so the handle is complete from the start
+        m_TextureCache[iEntry].pSRV11->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )&pPending->pSRV );
+        pPending->hrLoad = S_OK;
+        SetEvent( pPending->hDone );
     }
+    else
+    {
+        for( int i = 0; i < m_PendingTextures.GetSize(); ++i )
+        {
+            if( TextureKeysMatch( m_PendingTextures[i]->Key, pPending->Key ) )
+            {
+                InterlockedIncrement( &m_PendingTextures[i]->cRef );
+                *ppPending = m_PendingTextures[i];
+                break;
+            }
+        }
 
-    // Search the cache for a matching entry.
-    for( int i = 0; i < m_TextureCache.GetSize(); ++i )
+        if( !*ppPending )
+        {
+            if( FAILED( m_PendingTextures.Add( pPending ) ) )
+            {
+                LeaveCriticalSection( &m_cs );
+                ReleasePendingTexture( pPending );
+                return E_OUTOFMEMORY;
+            }
+            *pbLoad = true;
+        }
+    }
+
+    LeaveCriticalSection( &m_cs );
+
+    if( *ppPending )
+        ReleasePendingTexture( pPending );
+    else
+        *ppPending = pPending;
+
+    return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Reads, decodes and caches the texture for a handle BeginTextureLoad asked the caller to
+// load, then wakes everyone waiting on it.  This may run on any thread; the only device
+// context use, the sRGB copy, is made under m_cs.
+//--------------------------------------------------------------------------------------
+void CDXUTResourceCache::LoadTexture( DXUTCache_PendingTexture* pPending, ID3DX11ThreadPump* pPump )
+{
+    D3DX11_IMAGE_LOAD_INFO& LoadInfo = pPending->LoadInfo;
+
+    HRESULT hr = S_OK;
+    if( pPending->bOwnSrcInfo )
     {
-        DXUTCache_Texture& Entry = m_TextureCache[i];
-        if( Entry.Location == DXUTCACHE_LOCATION_FILE &&
-            !lstrcmpW( Entry.wszSource, pSrcFile ) &&
-            Entry.Width == pLoadInfo->Width &&
-            Entry.Height == pLoadInfo->Height &&
-            Entry.MipLevels == pLoadInfo->MipLevels &&
-            Entry.Usage11 == pLoadInfo->Usage &&
-            Entry.Format == pLoadInfo->Format &&
-            Entry.CpuAccessFlags == pLoadInfo->CpuAccessFlags &&
-            Entry.BindFlags == pLoadInfo->BindFlags &&
-            Entry.MiscFlags == pLoadInfo->MiscFlags )
+        hr = D3DX11GetImageInfoFromFile( pPending->Key.wszSource, NULL, &pPending->SrcInfo, NULL );
+        LoadInfo.Format = pPending->SrcInfo.Format;
+    }
+
+    // This is a workaround so that we can load linearly, but sample in SRGB.  We can't load
+    // as _SRGB since D3DX will try to do conversion on load (decompressing and re-encoding
+    // BC data), and loading as typed _UNORM doesn't allow us to create an SRGB view.  So the
+    // texels are loaded as they are stored into a staging texture and copied into an _SRGB
+    // texture with the usage the caller asked for.
+    D3DX11_IMAGE_LOAD_INFO SRGBInfo = LoadInfo;
+    bool bCopySRGB = SUCCEEDED( hr ) && pPending->Key.bSRGB && MAKE_SRGB( LoadInfo.Format ) != LoadInfo.Format;
+    if( bCopySRGB )
+    {
+        LoadInfo.Usage = D3D11_USAGE_STAGING;
+        LoadInfo.BindFlags = 0;
+        LoadInfo.CpuAccessFlags = D3D11_CPU_ACCESS_READ;
+        LoadInfo.MiscFlags = pPending->SrcInfo.MiscFlags & D3D11_RESOURCE_MISC_TEXTURECUBE;
+    }
+
+    ID3D11Texture2D* pRes = NULL;
+    if( SUCCEEDED( hr ) )
+        hr = D3DX11CreateTextureFromFile( pPending->pDevice, pPending->Key.wszSource, &LoadInfo, pPump,
+                                          ( ID3D11Resource** )&pRes, NULL );
+
+    if( SUCCEEDED( hr ) && bCopySRGB )
+        hr = CopyToSRGBTexture( pPending->pDevice, &SRGBInfo, &pRes );
+
+    if( SUCCEEDED( hr ) )
+        hr = FinishTexture( pPending->pDevice, pPending->Key.wszSource, &LoadInfo, pRes, &pPending->pSRV );
+
+    if( SUCCEEDED( hr ) )
+    {
+        DXUTCache_Texture NewEntry = pPending->Key;
+        hr = AddTexture( NewEntry, &pPending->pSRV );
+    }
+
+    if( FAILED( hr ) )
+        SAFE_RELEASE( pPending->pSRV );
+
+    // From here on, new requests find the texture in the cache
+    EnterCriticalSection( &m_cs );
+    for( int i = 0; i < m_PendingTextures.GetSize(); ++i )
+    {
+        if( m_PendingTextures[i] == pPending )
         {
-            // A match is found. Obtain the IDirect3DTexture9 interface and return that.
-            return Entry.pSRV11->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )ppOutputRV );
+            m_PendingTextures.Remove( i );
+            break;
         }
     }
+    LeaveCriticalSection( &m_cs );
+
+    pPending->hrLoad = hr;
+    SetEvent( pPending->hDone );
+}
+
+
+//--------------------------------------------------------------------------------------
+void CALLBACK CDXUTResourceCache::LoadTextureCallback( PTP_CALLBACK_INSTANCE, PVOID pContext )
+{
+    DXUTCache_PendingTexture* pPending = ( DXUTCache_PendingTexture* )pContext;
+
+    pPending->pCache->LoadTexture( pPending, NULL );
+    ReleasePendingTexture( pPending );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Replaces *ppRes, a staging texture in a _UNORM format, with a texture in the _SRGB twin of
+// that format holding the same bits, created with the usage, bind, CPU access and misc flags
+// pLoadInfo asks for.  The immediate context isn't thread safe, so the copy is made under
+// m_cs to keep loads on other threads off it.
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTResourceCache::CopyToSRGBTexture( ID3D11Device* pDevice, const D3DX11_IMAGE_LOAD_INFO* pLoadInfo,
+                                               ID3D11Texture2D** ppRes )
+{
+    D3D11_TEXTURE2D_DESC Desc;
+    ( *ppRes )->GetDesc( &Desc );
+
+    // The copy needs a destination that can be written after creation
+    Desc.Format = MAKE_SRGB( Desc.Format );
+    Desc.Usage = D3D11_USAGE_DEFAULT;
+    if( pLoadInfo->Usage != ( D3D11_USAGE )D3DX11_DEFAULT && pLoadInfo->Usage != D3D11_USAGE_IMMUTABLE )
+        Desc.Usage = pLoadInfo->Usage;
+    Desc.BindFlags = ( pLoadInfo->BindFlags == D3DX11_DEFAULT ) ? D3D11_BIND_SHADER_RESOURCE : pLoadInfo->BindFlags;
+    Desc.CPUAccessFlags = ( pLoadInfo->CpuAccessFlags == D3DX11_DEFAULT ) ? 0 : pLoadInfo->CpuAccessFlags;
+    if( pLoadInfo->MiscFlags != D3DX11_DEFAULT )
+        Desc.MiscFlags = pLoadInfo->MiscFlags;
+
+    ID3D11Texture2D* pSRGB = NULL;
+    HRESULT hr = pDevice->CreateTexture2D( &Desc, NULL, &pSRGB );
+    if( SUCCEEDED( hr ) )
+    {
+        ID3D11DeviceContext* pContext = NULL;
+        pDevice->GetImmediateContext( &pContext );
+
+        EnterCriticalSection( &m_cs );
+        pContext->CopyResource( pSRGB, *ppRes );
+        LeaveCriticalSection( &m_cs );
+
+        SAFE_RELEASE( pContext );
+    }
+
+    SAFE_RELEASE( *ppRes );
+    *ppRes = pSRGB;
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Creates the view for a texture D3DX has loaded.  Takes ownership of pRes.
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTResourceCache::FinishTexture( ID3D11Device* pDevice, LPCTSTR pSrcFile, D3DX11_IMAGE_LOAD_INFO* pLoadInfo,
+                                           ID3D11Texture2D* pRes, ID3D11ShaderResourceView** ppOutputRV )
+{
+    HRESULT hr;
 
 #if defined(PROFILE) || defined(DEBUG)
     CHAR strFileA[MAX_PATH];
@@ -603,91 +1018,12 @@ HRESULT CDXUTResourceCache::CreateTextureFromFileEx( ID3D11Device* pDevice, ID3D
         pstrName++;
 #endif
 
-    //Ready a new entry to the texture cache
-    //Do this before creating the texture since pLoadInfo may be volatile
-    DXUTCache_Texture NewEntry;
-    NewEntry.Location = DXUTCACHE_LOCATION_FILE;
-    wcscpy_s( NewEntry.wszSource, MAX_PATH, pSrcFile );
-    NewEntry.Width = pLoadInfo->Width;
-    NewEntry.Height = pLoadInfo->Height;
-    NewEntry.MipLevels = pLoadInfo->MipLevels;
-    NewEntry.Usage11 = pLoadInfo->Usage;
-    // 10L9 can't handle typesless, so we cant make a typesless format
-    if (is10L9 && bSRGB) {
-        NewEntry.Format = MAKE_SRGB(pLoadInfo->Format);
-    }else {
-        NewEntry.Format = pLoadInfo->Format;
-    }
-    NewEntry.CpuAccessFlags = pLoadInfo->CpuAccessFlags;
-    NewEntry.BindFlags = pLoadInfo->BindFlags;
-    NewEntry.MiscFlags = pLoadInfo->MiscFlags;
-
-    //Create the rexture
-    ID3D11Texture2D* pRes = NULL;
-    hr = D3DX11CreateTextureFromFile( pDevice, pSrcFile, pLoadInfo, pPump, ( ID3D11Resource** )&pRes, NULL );
-
-    if( FAILED( hr ) )
-        return hr;
     D3D11_TEXTURE2D_DESC tex_dsc;
     pRes->GetDesc(&tex_dsc);
 
-
-
-    if (bSRGB ) {
-        // This is a workaround so that we can load linearly, but sample in SRGB.  Right now, we can't load
-        // as linear since D3DX will try to do conversion on load.  Loading as TYPELESS doesn't work either, and
-        // loading as typed _UNORM doesn't allow us to create an SRGB view.
-
-        // on d3d11 featuer levels this is just a copy, but on 10L9 we must use a cpu side copy with 2 staging resources.
-        ID3D11Texture2D* unormStaging = NULL;
-        ID3D11Texture2D* srgbStaging = NULL;
-
-        D3D11_TEXTURE2D_DESC CopyDesc;
-        pRes->GetDesc( &CopyDesc );
-
-        pLoadInfo->BindFlags = 0;
-        pLoadInfo->CpuAccessFlags = D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ;
-        pLoadInfo->Depth = 0;
-        pLoadInfo->Filter = D3DX11_FILTER_LINEAR;
-        pLoadInfo->FirstMipLevel = 0;
-        pLoadInfo->Format = CopyDesc.Format;
-        pLoadInfo->Height = CopyDesc.Height;
-        pLoadInfo->MipFilter = D3DX11_FILTER_LINEAR;
-        pLoadInfo->MiscFlags = CopyDesc.MiscFlags;
-        pLoadInfo->Usage = D3D11_USAGE_STAGING;
-        pLoadInfo->Width = CopyDesc.Width;
-
-        CopyDesc.BindFlags = 0;
-        CopyDesc.Usage = D3D11_USAGE_STAGING;
-        CopyDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ;
-        CopyDesc.Format = MAKE_SRGB(CopyDesc.Format);
-
-        hr = D3DX11CreateTextureFromFile( pDevice, pSrcFile, pLoadInfo, pPump, ( ID3D11Resource** )&unormStaging, NULL );
-        DXUT_SetDebugName( unormStaging, "CDXUTResourceCache" );
-
-        hr = pDevice->CreateTexture2D(&CopyDesc, NULL, &srgbStaging);
-        DXUT_SetDebugName( srgbStaging, "CDXUTResourceCache" );
-        pContext->CopyResource( srgbStaging, unormStaging );
-        ID3D11Texture2D* srgbGPU;
-
-        pRes->GetDesc( &CopyDesc );
-        CopyDesc.Format = MAKE_SRGB(CopyDesc.Format);
-        hr = pDevice->CreateTexture2D(&CopyDesc, NULL, &srgbGPU);
-        pContext->CopyResource( srgbGPU, srgbStaging );
-
-        SAFE_RELEASE(pRes);
-        SAFE_RELEASE(srgbStaging);
-        SAFE_RELEASE(unormStaging);
-        pRes = srgbGPU;
-    }
-
     DXUT_SetDebugName( pRes, pstrName );
 
     D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc;
-    if( bSRGB )
-        SRVDesc.Format = MAKE_SRGB( ZeroInfo.Format );
-    else
-        SRVDesc.Format = ZeroInfo.Format;
     if( pLoadInfo->pSrcInfo->ResourceDimension == D3D11_RESOURCE_DIMENSION_TEXTURE1D )
     {
         SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE1D;
@@ -713,11 +1049,7 @@ HRESULT CDXUTResourceCache::CreateTextureFromFileEx( ID3D11Device* pDevice, ID3D
         SRVDesc.Texture3D.MostDetailedMip = 0;
         SRVDesc.Texture3D.MipLevels = pLoadInfo->pSrcInfo->MipLevels;
     }
-    if (bSRGB) {
-        SRVDesc.Format = MAKE_SRGB(tex_dsc.Format);
-    }else {
-        SRVDesc.Format = tex_dsc.Format;
-    }
+    SRVDesc.Format = tex_dsc.Format;
     SRVDesc.Texture2D.MipLevels = tex_dsc.MipLevels;
     SRVDesc.Texture2D.MostDetailedMip = 0;
     hr = pDevice->CreateShaderResourceView( pRes, &SRVDesc, ppOutputRV );
@@ -727,14 +1059,69 @@ HRESULT CDXUTResourceCache::CreateTextureFromFileEx( ID3D11Device* pDevice, ID3D
 
     DXUT_SetDebugName( *ppOutputRV, pstrName );
 
-    ( *ppOutputRV )->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )&NewEntry.pSRV11 );
+    return S_OK;
+}
 
-    m_TextureCache.Add( NewEntry );
 
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTResourceCache::CreateTextureFromFileAsync( ID3D11Device* pDevice, LPCTSTR pSrcFile,
+                                                        D3DX11_IMAGE_LOAD_INFO* pLoadInfo, bool bSRGB,
+                                                        DXUTTEXTUREHANDLE* phTexture )
+{
+    if( !pDevice || !pSrcFile || !phTexture )
+        return E_INVALIDARG;
+
+    *phTexture = NULL;
+
+    DXUTCache_PendingTexture* pPending = NULL;
+    bool bLoad = false;
+    HRESULT hr = BeginTextureLoad( pDevice, pSrcFile, pLoadInfo, bSRGB, &pPending, &bLoad );
+    if( FAILED( hr ) )
+        return hr;
+
+    if( bLoad )
+    {
+        // One reference for the worker, one for the caller
+        InterlockedIncrement( &pPending->cRef );
+        if( !TrySubmitThreadpoolCallback( LoadTextureCallback, pPending, NULL ) )
+        {
+            // Other requests may already share this handle, so it can't be abandoned; load it here instead
+            LoadTexture( pPending, NULL );
+            ReleasePendingTexture( pPending );
+        }
+    }
+
+    *phTexture = pPending;
     return S_OK;
 }
 
 
+//--------------------------------------------------------------------------------------
+HRESULT CDXUTResourceCache::GetAsyncTexture( ID3D11DeviceContext* pContext, DXUTTEXTUREHANDLE hTexture, bool bWait,
+                                             ID3D11ShaderResourceView** ppOutputRV )
+{
+    UNREFERENCED_PARAMETER( pContext );
+
+    if( !hTexture || !ppOutputRV )
+        return E_INVALIDARG;
+
+    if( WaitForSingleObject( hTexture->hDone, bWait ? INFINITE : 0 ) != WAIT_OBJECT_0 )
+        return S_FALSE;
+
+    if( FAILED( hTexture->hrLoad ) )
+        return hTexture->hrLoad;
+
+    return hTexture->pSRV->QueryInterface( __uuidof( ID3D11ShaderResourceView ), ( LPVOID* )ppOutputRV );
+}
+
+
+void CDXUTResourceCache::ReleaseAsyncTexture( DXUTTEXTUREHANDLE hTexture )
+{
+    if( hTexture )
+        ReleasePendingTexture( hTexture );
+}
+
+
 //--------------------------------------------------------------------------------------
 HRESULT CDXUTResourceCache::CreateTextureFromResource( LPDIRECT3DDEVICE9 pDevice, HMODULE hSrcModule,
                                                        LPCTSTR pSrcResource, LPDIRECT3DTEXTURE9* ppTexture )
@@ -1251,12 +1638,15 @@ HRESULT CDXUTResourceCache::OnLostDevice()
         m_FontCache[i].pFont->OnLostDevice();
 
     // Release all the default pool textures
+    EnterCriticalSection( &m_cs );
     for( int i = m_TextureCache.GetSize() - 1; i >= 0; --i )
         if( m_TextureCache[i].Pool9 == D3DPOOL_DEFAULT )
         {
             SAFE_RELEASE( m_TextureCache[i].pTexture9 );
             m_TextureCache.Remove( i );  // Remove the entry
         }
+    RebuildTextureIndex();
+    LeaveCriticalSection( &m_cs );
 
     return S_OK;
 }
@@ -1276,12 +1666,36 @@ HRESULT CDXUTResourceCache::OnDestroyDevice()
         SAFE_RELEASE( m_FontCache[i].pFont );
         m_FontCache.Remove( i );
     }
+
+    // Let loads still running on the thread pool finish first, or they would cache their
+    // views after the device is gone
+    for( ;; )
+    {
+        DXUTCache_PendingTexture* pPending = NULL;
+        EnterCriticalSection( &m_cs );
+        if( m_PendingTextures.GetSize() > 0 )
+        {
+            pPending = m_PendingTextures[0];
+            InterlockedIncrement( &pPending->cRef );
+        }
+        LeaveCriticalSection( &m_cs );
+
+        if( !pPending )
+            break;
+
+        WaitForSingleObject( pPending->hDone, INFINITE );
+        ReleasePendingTexture( pPending );
+    }
+
+    EnterCriticalSection( &m_cs );
     for( int i = m_TextureCache.GetSize() - 1; i >= 0; --i )
     {
         SAFE_RELEASE( m_TextureCache[i].pTexture9 );
         SAFE_RELEASE( m_TextureCache[i].pSRV11 );
         m_TextureCache.Remove( i );
     }
+    RebuildTextureIndex();
+    LeaveCriticalSection( &m_cs );
 
     return S_OK;
 }
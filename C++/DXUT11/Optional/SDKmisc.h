@@ -52,16 +52,26 @@ struct DXUTCache_Texture
         D3DRESOURCETYPE Type9;
         UINT BindFlags;
     };
+    bool bSRGB;
+    UINT Hash;          // Hash of the source and load info (D3D11 entries only)
+    int iNextHash;      // Next entry in the same hash bucket, -1 ends the chain
     IDirect3DBaseTexture9* pTexture9;
     ID3D11ShaderResourceView* pSRV11;
 
             DXUTCache_Texture()
             {
+                bSRGB = false;
+                Hash = 0;
+                iNextHash = -1;
                 pTexture9 = NULL;
                 pSRV11 = NULL;
             }
 };
 
+// Handle to a texture being loaded on the thread pool, see CDXUTResourceCache::CreateTextureFromFileAsync
+struct DXUTCache_PendingTexture;
+typedef DXUTCache_PendingTexture* DXUTTEXTUREHANDLE;
+
 struct DXUTCache_Font : public D3DXFONT_DESC
 {
     ID3DXFont* pFont;
@@ -98,6 +108,23 @@ public:
     HRESULT                 CreateTextureFromFileEx( ID3D11Device* pDevice, ID3D11DeviceContext* pContext, LPCTSTR pSrcFile,
                                                      D3DX11_IMAGE_LOAD_INFO* pLoadInfo, ID3DX11ThreadPump* pPump,
                                                      ID3D11ShaderResourceView** ppOutputRV, bool bSRGB );
+
+    // The D3D11 texture functions may be called from several loader threads. Lookups and
+    // inserts are serialized, the load itself is not, and requests for a texture that is
+    // already loading wait for that load instead of reading the file again. sRGB textures
+    // are loaded as they are stored into a staging texture and copied into an _SRGB
+    // texture on the device's immediate context, under the cache lock (pContext is kept for
+    // compatibility).
+    //
+    // CreateTextureFromFileAsync returns at once and loads the file on the thread pool.
+    // GetAsyncTexture returns S_FALSE while the load is pending (unless bWait), otherwise the
+    // result. Each handle must be released once.
+    HRESULT                 CreateTextureFromFileAsync( ID3D11Device* pDevice, LPCTSTR pSrcFile,
+                                                        D3DX11_IMAGE_LOAD_INFO* pLoadInfo, bool bSRGB,
+                                                        DXUTTEXTUREHANDLE* phTexture );
+    HRESULT                 GetAsyncTexture( ID3D11DeviceContext* pContext, DXUTTEXTUREHANDLE hTexture, bool bWait,
+                                             ID3D11ShaderResourceView** ppOutputRV );
+    void                    ReleaseAsyncTexture( DXUTTEXTUREHANDLE hTexture );
     HRESULT                 CreateTextureFromResource( LPDIRECT3DDEVICE9 pDevice, HMODULE hSrcModule,
                                                        LPCTSTR pSrcResource, LPDIRECT3DTEXTURE9* ppTexture );
     HRESULT                 CreateTextureFromResourceEx( LPDIRECT3DDEVICE9 pDevice, HMODULE hSrcModule,
@@ -166,8 +193,26 @@ protected:
 
                             CDXUTResourceCache()
                             {
+                                InitializeCriticalSection( &m_cs );
                             }
 
+    void                    BuildTextureKey( LPCTSTR pSrcFile, const D3DX11_IMAGE_LOAD_INFO* pLoadInfo, bool bSRGB,
+                                             DXUTCache_Texture& Key );
+    int                     FindTexture( const DXUTCache_Texture& Key );
+    HRESULT                 AddTexture( DXUTCache_Texture& NewEntry, ID3D11ShaderResourceView** ppOutputRV );
+    void                    RebuildTextureIndex();
+    HRESULT                 BeginTextureLoad( ID3D11Device* pDevice, LPCTSTR pSrcFile, const D3DX11_IMAGE_LOAD_INFO* pLoadInfo,
+                                              bool bSRGB, DXUTCache_PendingTexture** ppPending, bool* pbLoad );
+    void                    LoadTexture( DXUTCache_PendingTexture* pPending, ID3DX11ThreadPump* pPump );
+    static void CALLBACK    LoadTextureCallback( PTP_CALLBACK_INSTANCE, PVOID pContext );
+    HRESULT                 FinishTexture( ID3D11Device* pDevice, LPCTSTR pSrcFile, D3DX11_IMAGE_LOAD_INFO* pLoadInfo,
+                                           ID3D11Texture2D* pRes, ID3D11ShaderResourceView** ppOutputRV );
+    HRESULT                 CopyToSRGBTexture( ID3D11Device* pDevice, const D3DX11_IMAGE_LOAD_INFO* pLoadInfo,
+                                               ID3D11Texture2D** ppRes );
+
+    CRITICAL_SECTION m_cs;                      // Guards the caches and the texture index
+    CGrowableArray <int> m_TextureHashBuckets;  // Heads of the D3D11 texture hash chains, power of two in size
+    CGrowableArray <DXUTCache_PendingTexture*> m_PendingTextures;  // D3D11 loads in flight, by key
     CGrowableArray <DXUTCache_Texture> m_TextureCache;
     CGrowableArray <DXUTCache_Effect> m_EffectCache;
     CGrowableArray <DXUTCache_Font> m_FontCache;
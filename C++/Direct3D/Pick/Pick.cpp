@@ -9,6 +9,7 @@
 #include "DXUTsettingsdlg.h"
 #include "SDKmesh.h"
 #include "SDKmisc.h"
+#include "TriangleBVH.h"
 #include "resource.h"
 
 //#define DEBUG_VS   // Uncomment this line to debug vertex shaders
@@ -51,12 +52,14 @@ ID3DXFont*                  g_pFont = NULL;         // Font for drawing text
 ID3DXSprite*                g_pTextSprite = NULL;   // Sprite for batching draw text calls
 ID3DXEffect*                g_pEffect = NULL;       // D3DX effect interface
 CDXUTXFileMesh              g_Mesh;                 // The mesh to be rendered
+CTriangleBVH                g_BVH;                  // Ray query acceleration structure for g_Mesh
 CModelViewerCamera          g_Camera;               // A model viewing camera
 DWORD                       g_dwNumIntersections;   // Number of faces intersected
 INTERSECTION g_IntersectionArray[MAX_INTERSECTIONS]; // Intersection info
 LPDIRECT3DVERTEXBUFFER9     g_pVB;                  // VB for picked triangles
 bool                        g_bShowHelp = true;     // If true, it renders the UI control text
 bool                        g_bUseD3DXIntersect = true;      // Whether to use D3DXIntersect
+bool                        g_bUseBVH = false;      // Whether to use g_BVH, takes precedence over D3DXIntersect
 bool                        g_bAllHits = true;      // Whether to just get the first "hit" or all "hits"
 CDXUTDialogResourceManager  g_DialogResourceManager; // manager for shared resources of dialogs
 CD3DSettingsDlg             g_SettingsDlg;          // Device settings dialog
@@ -72,6 +75,7 @@ CDXUTDialog                 g_SampleUI;             // dialog for sample specifi
 #define IDC_CHANGEDEVICE        3
 #define IDC_USED3DX             4
 #define IDC_ALLHITS             5
+#define IDC_USEBVH              6
 
 
 
@@ -173,6 +177,7 @@ void InitApp()
     g_HUD.AddButton( IDC_CHANGEDEVICE, L"Change device (F2)", 35, iY += 24, 125, 22, VK_F2 );
     g_HUD.AddCheckBox( IDC_USED3DX, L"Use D3DXIntersect", 35, iY += 24, 125, 22, g_bUseD3DXIntersect, VK_F4 );
     g_HUD.AddCheckBox( IDC_ALLHITS, L"Show All Hits", 35, iY += 24, 125, 22, g_bAllHits, VK_F5 );
+    g_HUD.AddCheckBox( IDC_USEBVH, L"Use BVH", 35, iY += 24, 125, 22, g_bUseBVH, VK_F6 );
 
     g_SampleUI.SetCallback( OnGUIEvent ); iY = 10;
 }
@@ -286,6 +291,9 @@ HRESULT CALLBACK OnCreateDevice( IDirect3DDevice9* pd3dDevice, const D3DSURFACE_
     V_RETURN( g_Mesh.Create( pd3dDevice, str ) );
     V_RETURN( g_Mesh.SetFVF( pd3dDevice, D3DVERTEX::FVF ) );
 
+    // Build the BVH once up front so picking only pays for the traversal
+    V_RETURN( g_BVH.BuildFromMesh( g_Mesh.GetMesh() ) );
+
     // Create the vertex buffer
     if( FAILED( pd3dDevice->CreateVertexBuffer( 3 * MAX_INTERSECTIONS * sizeof( D3DVERTEX ),
                                                 D3DUSAGE_WRITEONLY, D3DVERTEX::FVF,
@@ -654,6 +662,8 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
             g_bUseD3DXIntersect = !g_bUseD3DXIntersect; break;
         case IDC_ALLHITS:
             g_bAllHits = !g_bAllHits; break;
+        case IDC_USEBVH:
+            g_bUseBVH = !g_bUseBVH; break;
     }
 }
 
@@ -688,6 +698,7 @@ void CALLBACK OnDestroyDevice( void* pUserContext )
     g_DialogResourceManager.OnD3D9DestroyDevice();
     g_SettingsDlg.OnD3D9DestroyDevice();
     g_Mesh.Destroy();
+    g_BVH.Destroy();
     SAFE_RELEASE( g_pVB );
     SAFE_RELEASE( g_pEffect );
     SAFE_RELEASE( g_pFont );
@@ -758,7 +769,25 @@ HRESULT Pick()
         pIB->Lock( 0, 0, ( void** )&pIndices, 0 );
         pVB->Lock( 0, 0, ( void** )&pVertices, 0 );
 
-        if( g_bUseD3DXIntersect )
+        if( g_bUseBVH )
+        {
+            // The BVH returns the closest hit, or the nearest MAX_INTERSECTIONS hits sorted
+            // front to back, in the same face/barycentric/distance form as D3DXIntersect
+            BVHHIT hits[MAX_INTERSECTIONS];
+            if( !g_bAllHits )
+                g_dwNumIntersections = g_BVH.IntersectClosest( vPickRayOrig, vPickRayDir, &hits[0] ) ? 1 : 0;
+            else
+                g_dwNumIntersections = g_BVH.IntersectAll( vPickRayOrig, vPickRayDir, hits, MAX_INTERSECTIONS );
+
+            for( DWORD iIntersection = 0; iIntersection < g_dwNumIntersections; iIntersection++ )
+            {
+                g_IntersectionArray[iIntersection].dwFace = hits[iIntersection].dwFace;
+                g_IntersectionArray[iIntersection].fBary1 = hits[iIntersection].fBary1;
+                g_IntersectionArray[iIntersection].fBary2 = hits[iIntersection].fBary2;
+                g_IntersectionArray[iIntersection].fDist = hits[iIntersection].fDist;
+            }
+        }
+        else if( g_bUseD3DXIntersect )
         {
             // When calling D3DXIntersect, one can get just the closest intersection and not
             // need to work with a D3DXBUFFER.  Or, to get all intersections between the ray and
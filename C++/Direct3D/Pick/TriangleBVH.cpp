@@ -0,0 +1,821 @@
+//--------------------------------------------------------------------------------------
+// File: TriangleBVH.cpp
+//
+// Bounding volume hierarchy over a triangle mesh for fast ray queries
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#include "DXUT.h"
+#include "TriangleBVH.h"
+#include <float.h>
+#include <algorithm>
+#include <ppl.h>
+
+#define BVH_NUM_BINS            16      // SAH candidate planes per axis are the bin boundaries
+#define BVH_MAX_LEAF_TRIS       8       // two SSE blocks
+#define BVH_TRAVERSAL_COST      1.0f    // cost of visiting a node, relative to one triangle test
+#define BVH_MAX_SAH_DEPTH       48      // deeper nodes use median splits so the tree stays shallow
+#define BVH_STACK_SIZE          128     // > BVH_MAX_SAH_DEPTH + log2 of the largest face count
+#define BVH_PARALLEL_BUILD      4096    // nodes with more triangles build their children in parallel
+#define BVH_PACKETS_PER_TASK    16      // 4-ray packets traced per task in IntersectClosestBatch
+#define BVH_DET_EPSILON         0.0001f // same threshold IntersectTriangle uses
+
+
+//--------------------------------------------------------------------------------------
+// Ray set up for single-ray traversal.  The origin and inverse direction are padded with
+// 0 and 1 so lane 3 of a slab test against a node's padded bounds never clips the ray.
+//--------------------------------------------------------------------------------------
+struct BVHRAY1
+{
+    __m128 vOrig;
+    __m128 vInvDir;
+    __m128 vOrigS[3];             // origin and direction splatted for the 4-triangle test
+    __m128 vDirS[3];
+    bool bNegDir[3];
+};
+
+
+//--------------------------------------------------------------------------------------
+static inline FLOAT SafeRcp( FLOAT f )
+{
+    // Keep 1/0 finite so (min - orig) * invdir never evaluates 0 * inf
+    if( fabsf( f ) < 1e-20f )
+        f = ( f < 0.0f ) ? -1e-20f : 1e-20f;
+    return 1.0f / f;
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline __m128 Select( __m128 vMask, __m128 vA, __m128 vB )
+{
+    return _mm_or_ps( _mm_and_ps( vMask, vA ), _mm_andnot_ps( vMask, vB ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline void Cross4( const __m128 a[3], const __m128 b[3], __m128 out[3] )
+{
+    out[0] = _mm_sub_ps( _mm_mul_ps( a[1], b[2] ), _mm_mul_ps( a[2], b[1] ) );
+    out[1] = _mm_sub_ps( _mm_mul_ps( a[2], b[0] ), _mm_mul_ps( a[0], b[2] ) );
+    out[2] = _mm_sub_ps( _mm_mul_ps( a[0], b[1] ), _mm_mul_ps( a[1], b[0] ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline __m128 Dot4( const __m128 a[3], const __m128 b[3] )
+{
+    return _mm_add_ps( _mm_add_ps( _mm_mul_ps( a[0], b[0] ), _mm_mul_ps( a[1], b[1] ) ),
+                       _mm_mul_ps( a[2], b[2] ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline void SetLane( __m128* pV, UINT uLane, const D3DXVECTOR3& v )
+{
+    ( ( FLOAT* )&pV[0] )[uLane] = v.x;
+    ( ( FLOAT* )&pV[1] )[uLane] = v.y;
+    ( ( FLOAT* )&pV[2] )[uLane] = v.z;
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline void SplatLane( const __m128* pV, UINT uLane, __m128 out[3] )
+{
+    out[0] = _mm_load1_ps( &( ( const FLOAT* )&pV[0] )[uLane] );
+    out[1] = _mm_load1_ps( &( ( const FLOAT* )&pV[1] )[uLane] );
+    out[2] = _mm_load1_ps( &( ( const FLOAT* )&pV[2] )[uLane] );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Moller-Trumbore on four lanes at once.  Each lane is one ray/triangle pair, so the same
+// code tests one ray against a block of four triangles or a packet of four rays against
+// one triangle.  Returns the mask of lanes that hit in [0, vMaxDist).
+//--------------------------------------------------------------------------------------
+static inline __m128 IntersectTriangles4( const __m128 vOrig[3], const __m128 vDir[3],
+                                          const __m128 vV0[3], const __m128 vE1[3], const __m128 vE2[3],
+                                          __m128 vMaxDist, __m128* pT, __m128* pU, __m128* pV )
+{
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128 vOne = _mm_set1_ps( 1.0f );
+
+    __m128 vP[3], vT[3], vQ[3];
+    Cross4( vDir, vE2, vP );
+    __m128 vDet = Dot4( vE1, vP );
+
+    vT[0] = _mm_sub_ps( vOrig[0], vV0[0] );
+    vT[1] = _mm_sub_ps( vOrig[1], vV0[1] );
+    vT[2] = _mm_sub_ps( vOrig[2], vV0[2] );
+    Cross4( vT, vE1, vQ );
+
+    // Lanes with a tiny determinant divide by ~0 here, but are masked off below
+    __m128 vInvDet = _mm_div_ps( vOne, vDet );
+    __m128 vU = _mm_mul_ps( Dot4( vT, vP ), vInvDet );
+    __m128 vV = _mm_mul_ps( Dot4( vDir, vQ ), vInvDet );
+    __m128 vDist = _mm_mul_ps( Dot4( vE2, vQ ), vInvDet );
+
+    __m128 vAbsDet = _mm_max_ps( vDet, _mm_sub_ps( vZero, vDet ) );
+    __m128 vMask = _mm_cmpge_ps( vAbsDet, _mm_set1_ps( BVH_DET_EPSILON ) );
+    vMask = _mm_and_ps( vMask, _mm_cmpge_ps( vU, vZero ) );
+    vMask = _mm_and_ps( vMask, _mm_cmpge_ps( vV, vZero ) );
+    vMask = _mm_and_ps( vMask, _mm_cmple_ps( _mm_add_ps( vU, vV ), vOne ) );
+    vMask = _mm_and_ps( vMask, _mm_cmpge_ps( vDist, vZero ) );
+    vMask = _mm_and_ps( vMask, _mm_cmplt_ps( vDist, vMaxDist ) );
+
+    *pT = vDist;
+    *pU = vU;
+    *pV = vV;
+    return vMask;
+}
+
+
+//--------------------------------------------------------------------------------------
+static void SetupRay( const D3DXVECTOR3& vOrig, const D3DXVECTOR3& vDir, BVHRAY1* pRay )
+{
+    pRay->vOrig = _mm_set_ps( 0.0f, vOrig.z, vOrig.y, vOrig.x );
+    pRay->vInvDir = _mm_set_ps( 1.0f, SafeRcp( vDir.z ), SafeRcp( vDir.y ), SafeRcp( vDir.x ) );
+    pRay->vOrigS[0] = _mm_set1_ps( vOrig.x );
+    pRay->vOrigS[1] = _mm_set1_ps( vOrig.y );
+    pRay->vOrigS[2] = _mm_set1_ps( vOrig.z );
+    pRay->vDirS[0] = _mm_set1_ps( vDir.x );
+    pRay->vDirS[1] = _mm_set1_ps( vDir.y );
+    pRay->vDirS[2] = _mm_set1_ps( vDir.z );
+    pRay->bNegDir[0] = vDir.x < 0.0f;
+    pRay->bNegDir[1] = vDir.y < 0.0f;
+    pRay->bNegDir[2] = vDir.z < 0.0f;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Slab test of one ray against one node's bounds, all three axes in one SSE register
+//--------------------------------------------------------------------------------------
+static inline bool IntersectBox1( const FLOAT* pMin, const FLOAT* pMax, const BVHRAY1& ray, FLOAT fMaxDist )
+{
+    __m128 vT0 = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( pMin ), ray.vOrig ), ray.vInvDir );
+    __m128 vT1 = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( pMax ), ray.vOrig ), ray.vInvDir );
+    __m128 vNear = _mm_min_ps( vT0, vT1 );
+    __m128 vFar = _mm_max_ps( vT0, vT1 );
+
+    // Horizontal max of the entry distances and min of the exit distances
+    vNear = _mm_max_ps( vNear, _mm_shuffle_ps( vNear, vNear, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    vNear = _mm_max_ss( vNear, _mm_movehl_ps( vNear, vNear ) );
+    vFar = _mm_min_ps( vFar, _mm_shuffle_ps( vFar, vFar, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    vFar = _mm_min_ss( vFar, _mm_movehl_ps( vFar, vFar ) );
+
+    FLOAT fNear = _mm_cvtss_f32( vNear );
+    FLOAT fFar = _mm_cvtss_f32( vFar );
+    return fNear <= fFar && fFar >= 0.0f && fNear < fMaxDist;
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline FLOAT HalfArea( const D3DXVECTOR3& vMin, const D3DXVECTOR3& vMax )
+{
+    D3DXVECTOR3 vExtent = vMax - vMin;
+    return vExtent.x * vExtent.y + vExtent.y * vExtent.z + vExtent.z * vExtent.x;
+}
+
+
+//--------------------------------------------------------------------------------------
+CTriangleBVH::CTriangleBVH() : m_pNodes( NULL ),
+                               m_pBlocks( NULL ),
+                               m_dwNumFaces( 0 ),
+                               m_dwNumNodes( 0 ),
+                               m_dwNumBlocks( 0 ),
+                               m_lNextNode( 0 )
+{
+}
+
+
+//--------------------------------------------------------------------------------------
+CTriangleBVH::~CTriangleBVH()
+{
+    Destroy();
+}
+
+
+//--------------------------------------------------------------------------------------
+void CTriangleBVH::Destroy()
+{
+    if( m_pNodes )
+        _aligned_free( m_pNodes );
+    if( m_pBlocks )
+        _aligned_free( m_pBlocks );
+    m_pNodes = NULL;
+    m_pBlocks = NULL;
+    m_dwNumFaces = 0;
+    m_dwNumNodes = 0;
+    m_dwNumBlocks = 0;
+    m_lNextNode = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+HRESULT CTriangleBVH::BuildFromMesh( ID3DXMesh* pMesh )
+{
+    HRESULT hr;
+    BYTE* pVertices = NULL;
+    void* pIndices = NULL;
+
+    if( pMesh == NULL )
+        return E_INVALIDARG;
+
+    // The position is the first element of every FVF vertex
+    if( ( pMesh->GetFVF() & D3DFVF_POSITION_MASK ) == 0 )
+        return E_INVALIDARG;
+
+    V_RETURN( pMesh->LockVertexBuffer( D3DLOCK_READONLY, ( void** )&pVertices ) );
+    if( FAILED( hr = pMesh->LockIndexBuffer( D3DLOCK_READONLY, &pIndices ) ) )
+    {
+        pMesh->UnlockVertexBuffer();
+        return hr;
+    }
+
+    hr = Build( ( const D3DXVECTOR3* )pVertices, pMesh->GetNumBytesPerVertex(), pMesh->GetNumVertices(),
+                pIndices, ( pMesh->GetOptions() & D3DXMESH_32BIT ) != 0, pMesh->GetNumFaces() );
+
+    pMesh->UnlockIndexBuffer();
+    pMesh->UnlockVertexBuffer();
+
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+HRESULT CTriangleBVH::Build( const D3DXVECTOR3* pPositions, DWORD dwStride, DWORD dwNumVertices,
+                             const void* pIndices, bool b32BitIndices, DWORD dwNumFaces )
+{
+    HRESULT hr = S_OK;
+    D3DXVECTOR3* pTris = NULL;
+    BUILDREF* pRefs = NULL;
+    DWORD* pLeaves = NULL;
+    DWORD dwNumLeaves = 0;
+
+    Destroy();
+
+    if( pPositions == NULL || pIndices == NULL || dwNumFaces == 0 || dwStride < sizeof( D3DXVECTOR3 ) )
+        return E_INVALIDARG;
+
+    pTris = new D3DXVECTOR3[3 * dwNumFaces];
+    pRefs = new BUILDREF[dwNumFaces];
+    m_pNodes = ( NODE* )_aligned_malloc( sizeof( NODE ) * ( 2 * dwNumFaces - 1 ), 16 );
+    if( pTris == NULL || pRefs == NULL || m_pNodes == NULL )
+    {
+        hr = E_OUTOFMEMORY;
+        goto cleanup;
+    }
+
+    // Gather the triangles and the bounds and centroid the SAH bins each one by
+    for( DWORD i = 0; i < dwNumFaces; i++ )
+    {
+        D3DXVECTOR3* pTri = &pTris[3 * i];
+        for( DWORD j = 0; j < 3; j++ )
+        {
+            DWORD dwIndex = b32BitIndices ? ( ( const DWORD* )pIndices )[3 * i + j]
+                                          : ( ( const WORD* )pIndices )[3 * i + j];
+            if( dwIndex >= dwNumVertices )
+            {
+                hr = E_INVALIDARG;
+                goto cleanup;
+            }
+            pTri[j] = *( const D3DXVECTOR3* )( ( const BYTE* )pPositions + dwIndex * dwStride );
+        }
+
+        BUILDREF* pRef = &pRefs[i];
+        D3DXVec3Minimize( &pRef->vMin, &pTri[0], &pTri[1] );
+        D3DXVec3Minimize( &pRef->vMin, &pRef->vMin, &pTri[2] );
+        D3DXVec3Maximize( &pRef->vMax, &pTri[0], &pTri[1] );
+        D3DXVec3Maximize( &pRef->vMax, &pRef->vMax, &pTri[2] );
+        pRef->vCentroid = ( pRef->vMin + pRef->vMax ) * 0.5f;
+        pRef->dwFace = i;
+    }
+
+    m_lNextNode = 1;
+    BuildNode( 0, pRefs, 0, dwNumFaces, 0 );
+    m_dwNumNodes = ( DWORD )m_lNextNode;
+
+    // Give each leaf its range of triangle blocks.  Leaves still hold the start of their
+    // BUILDREF range in uChildOrBlock, so the first block is parked in uPad until the
+    // blocks are filled.
+    pLeaves = new DWORD[m_dwNumNodes];
+    if( pLeaves == NULL )
+    {
+        hr = E_OUTOFMEMORY;
+        goto cleanup;
+    }
+
+    for( DWORD i = 0; i < m_dwNumNodes; i++ )
+    {
+        if( m_pNodes[i].uNumTris > 0 )
+        {
+            m_pNodes[i].uPad = m_dwNumBlocks;
+            m_dwNumBlocks += ( m_pNodes[i].uNumTris + 3 ) / 4;
+            pLeaves[dwNumLeaves++] = i;
+        }
+    }
+
+    m_pBlocks = ( TRIBLOCK* )_aligned_malloc( sizeof( TRIBLOCK ) * m_dwNumBlocks, 16 );
+    if( m_pBlocks == NULL )
+    {
+        hr = E_OUTOFMEMORY;
+        goto cleanup;
+    }
+
+    Concurrency::parallel_for( DWORD( 0 ), dwNumLeaves, [&]( DWORD iLeaf )
+    {
+        NODE* pNode = &m_pNodes[pLeaves[iLeaf]];
+        TRIBLOCK* pBlocks = &m_pBlocks[pNode->uPad];
+        UINT uNumBlocks = ( pNode->uNumTris + 3 ) / 4;
+
+        ZeroMemory( pBlocks, sizeof( TRIBLOCK ) * uNumBlocks );
+        for( UINT i = 0; i < uNumBlocks * 4; i++ )
+            pBlocks[i / 4].dwFace[i % 4] = BVH_NO_HIT;
+
+        for( UINT i = 0; i < pNode->uNumTris; i++ )
+        {
+            TRIBLOCK* pBlock = &pBlocks[i / 4];
+            DWORD dwFace = pRefs[pNode->uChildOrBlock + i].dwFace;
+            const D3DXVECTOR3* pTri = &pTris[3 * dwFace];
+
+            SetLane( pBlock->v0, i % 4, pTri[0] );
+            SetLane( pBlock->e1, i % 4, pTri[1] - pTri[0] );
+            SetLane( pBlock->e2, i % 4, pTri[2] - pTri[0] );
+            pBlock->dwFace[i % 4] = dwFace;
+        }
+
+        pNode->uChildOrBlock = pNode->uPad;
+        pNode->uPad = 0;
+    } );
+
+    m_dwNumFaces = dwNumFaces;
+
+cleanup:
+    SAFE_DELETE_ARRAY( pTris );
+    SAFE_DELETE_ARRAY( pRefs );
+    SAFE_DELETE_ARRAY( pLeaves );
+    if( FAILED( hr ) )
+        Destroy();
+
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Builds the subtree for pRefs[dwBegin, dwEnd) into node uNode.  Children are allocated
+// in pairs from m_lNextNode, and sibling subtrees only ever touch their own disjoint
+// ranges of pRefs and m_pNodes, so large ones are built in parallel.
+//--------------------------------------------------------------------------------------
+void CTriangleBVH::BuildNode( UINT uNode, BUILDREF* pRefs, DWORD dwBegin, DWORD dwEnd, UINT uDepth )
+{
+    struct BIN
+    {
+        D3DXVECTOR3 vMin;
+        D3DXVECTOR3 vMax;
+        DWORD dwCount;
+    };
+
+    NODE* pNode = &m_pNodes[uNode];
+    DWORD dwCount = dwEnd - dwBegin;
+
+    D3DXVECTOR3 vMin = pRefs[dwBegin].vMin;
+    D3DXVECTOR3 vMax = pRefs[dwBegin].vMax;
+    D3DXVECTOR3 vCMin = pRefs[dwBegin].vCentroid;
+    D3DXVECTOR3 vCMax = pRefs[dwBegin].vCentroid;
+    for( DWORD i = dwBegin + 1; i < dwEnd; i++ )
+    {
+        D3DXVec3Minimize( &vMin, &vMin, &pRefs[i].vMin );
+        D3DXVec3Maximize( &vMax, &vMax, &pRefs[i].vMax );
+        D3DXVec3Minimize( &vCMin, &vCMin, &pRefs[i].vCentroid );
+        D3DXVec3Maximize( &vCMax, &vCMax, &pRefs[i].vCentroid );
+    }
+
+    pNode->fMin[0] = vMin.x;
+    pNode->fMin[1] = vMin.y;
+    pNode->fMin[2] = vMin.z;
+    pNode->fMin[3] = -FLT_MAX;
+    pNode->fMax[0] = vMax.x;
+    pNode->fMax[1] = vMax.y;
+    pNode->fMax[2] = vMax.z;
+    pNode->fMax[3] = FLT_MAX;
+    pNode->uAxis = 0;
+    pNode->uPad = 0;
+
+    // The BUILDREF range start is replaced by the first triangle block once the tree is done
+    pNode->uChildOrBlock = dwBegin;
+    pNode->uNumTris = dwCount;
+    if( dwCount == 1 )
+        return;
+
+    // Find the cheapest SAH split among the bin boundaries of all three axes
+    int iAxis = -1;
+    UINT uSplitBin = 0;
+    FLOAT fBestCost = FLT_MAX;
+    FLOAT fBinMin = 0.0f;
+    FLOAT fBinScale = 0.0f;
+    if( uDepth < BVH_MAX_SAH_DEPTH )
+    {
+        for( int iTryAxis = 0; iTryAxis < 3; iTryAxis++ )
+        {
+            FLOAT fMinC = vCMin[iTryAxis];
+            FLOAT fExtent = vCMax[iTryAxis] - fMinC;
+            if( fExtent <= 0.0f )
+                continue;
+
+            BIN bins[BVH_NUM_BINS];
+            for( UINT i = 0; i < BVH_NUM_BINS; i++ )
+            {
+                bins[i].vMin = D3DXVECTOR3( FLT_MAX, FLT_MAX, FLT_MAX );
+                bins[i].vMax = D3DXVECTOR3( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+                bins[i].dwCount = 0;
+            }
+
+            FLOAT fScale = BVH_NUM_BINS / fExtent;
+            for( DWORD i = dwBegin; i < dwEnd; i++ )
+            {
+                UINT uBin = ( UINT )( ( pRefs[i].vCentroid[iTryAxis] - fMinC ) * fScale );
+                if( uBin >= BVH_NUM_BINS )
+                    uBin = BVH_NUM_BINS - 1;
+                D3DXVec3Minimize( &bins[uBin].vMin, &bins[uBin].vMin, &pRefs[i].vMin );
+                D3DXVec3Maximize( &bins[uBin].vMax, &bins[uBin].vMax, &pRefs[i].vMax );
+                bins[uBin].dwCount++;
+            }
+
+            // Sweep from the left to get the area and count below each boundary, then from
+            // the right to cost every boundary
+            FLOAT fLeftCost[BVH_NUM_BINS - 1];
+            DWORD dwLeftCount[BVH_NUM_BINS - 1];
+            D3DXVECTOR3 vBoxMin = bins[0].vMin;
+            D3DXVECTOR3 vBoxMax = bins[0].vMax;
+            DWORD dwSum = 0;
+            for( UINT i = 0; i < BVH_NUM_BINS - 1; i++ )
+            {
+                D3DXVec3Minimize( &vBoxMin, &vBoxMin, &bins[i].vMin );
+                D3DXVec3Maximize( &vBoxMax, &vBoxMax, &bins[i].vMax );
+                dwSum += bins[i].dwCount;
+                dwLeftCount[i] = dwSum;
+                fLeftCost[i] = dwSum ? HalfArea( vBoxMin, vBoxMax ) * dwSum : 0.0f;
+            }
+
+            vBoxMin = bins[BVH_NUM_BINS - 1].vMin;
+            vBoxMax = bins[BVH_NUM_BINS - 1].vMax;
+            dwSum = 0;
+            for( UINT i = BVH_NUM_BINS - 1; i > 0; i-- )
+            {
+                D3DXVec3Minimize( &vBoxMin, &vBoxMin, &bins[i].vMin );
+                D3DXVec3Maximize( &vBoxMax, &vBoxMax, &bins[i].vMax );
+                dwSum += bins[i].dwCount;
+                if( dwSum == 0 || dwLeftCount[i - 1] == 0 )
+                    continue;
+
+                FLOAT fCost = fLeftCost[i - 1] + HalfArea( vBoxMin, vBoxMax ) * dwSum;
+                if( fCost < fBestCost )
+                {
+                    fBestCost = fCost;
+                    iAxis = iTryAxis;
+                    uSplitBin = i - 1;
+                    fBinMin = fMinC;
+                    fBinScale = fScale;
+                }
+            }
+        }
+    }
+
+    if( iAxis >= 0 )
+    {
+        // Normalize to the expected number of triangle tests and keep the node as a leaf
+        // when splitting it would not pay for the extra traversal step
+        FLOAT fArea = HalfArea( vMin, vMax );
+        FLOAT fSplitCost = BVH_TRAVERSAL_COST + ( fArea > 0.0f ? fBestCost / fArea : 0.0f );
+        if( dwCount <= BVH_MAX_LEAF_TRIS && ( FLOAT )dwCount <= fSplitCost )
+            return;
+    }
+    else if( dwCount <= BVH_MAX_LEAF_TRIS )
+    {
+        return;
+    }
+
+    DWORD dwMid = dwBegin;
+    if( iAxis >= 0 )
+    {
+        BUILDREF* pMid = std::partition( pRefs + dwBegin, pRefs + dwEnd, [=]( const BUILDREF& ref ) -> bool
+        {
+            UINT uBin = ( UINT )( ( ref.vCentroid[iAxis] - fBinMin ) * fBinScale );
+            return uBin <= uSplitBin;
+        } );
+        dwMid = ( DWORD )( pMid - pRefs );
+    }
+
+    if( dwMid == dwBegin || dwMid == dwEnd )
+    {
+        // Past the SAH depth limit, or every centroid coincides: split at the median of the
+        // widest centroid axis, which always halves the range
+        D3DXVECTOR3 vExtent = vCMax - vCMin;
+        iAxis = ( vExtent.x >= vExtent.y && vExtent.x >= vExtent.z ) ? 0 : ( vExtent.y >= vExtent.z ? 1 : 2 );
+        dwMid = dwBegin + dwCount / 2;
+        std::nth_element( pRefs + dwBegin, pRefs + dwMid, pRefs + dwEnd,
+                          [=]( const BUILDREF& a, const BUILDREF& b ) -> bool
+        {
+            return a.vCentroid[iAxis] < b.vCentroid[iAxis];
+        } );
+    }
+
+    UINT uChild = ( UINT )InterlockedExchangeAdd( &m_lNextNode, 2 );
+    pNode->uChildOrBlock = uChild;
+    pNode->uNumTris = 0;
+    pNode->uAxis = ( UINT )iAxis;
+
+    if( dwCount > BVH_PARALLEL_BUILD )
+    {
+        Concurrency::parallel_invoke(
+            [=]() { BuildNode( uChild, pRefs, dwBegin, dwMid, uDepth + 1 ); },
+            [=]() { BuildNode( uChild + 1, pRefs, dwMid, dwEnd, uDepth + 1 ); } );
+    }
+    else
+    {
+        BuildNode( uChild, pRefs, dwBegin, dwMid, uDepth + 1 );
+        BuildNode( uChild + 1, pRefs, dwMid, dwEnd, uDepth + 1 );
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+bool CTriangleBVH::IntersectClosest( const D3DXVECTOR3& vOrig, const D3DXVECTOR3& vDir, BVHHIT* pHit ) const
+{
+    if( m_pNodes == NULL )
+        return false;
+
+    BVHRAY1 ray;
+    SetupRay( vOrig, vDir, &ray );
+
+    FLOAT fBest = FLT_MAX;
+    BVHHIT hit = { BVH_NO_HIT, 0.0f, 0.0f, FLT_MAX };
+
+    UINT uStack[BVH_STACK_SIZE];
+    UINT uStackSize = 0;
+    uStack[uStackSize++] = 0;
+    while( uStackSize > 0 )
+    {
+        const NODE* pNode = &m_pNodes[uStack[--uStackSize]];
+        if( !IntersectBox1( pNode->fMin, pNode->fMax, ray, fBest ) )
+            continue;
+
+        if( pNode->uNumTris > 0 )
+        {
+            const TRIBLOCK* pBlock = &m_pBlocks[pNode->uChildOrBlock];
+            for( UINT i = 0; i < pNode->uNumTris; i += 4, pBlock++ )
+            {
+                __m128 vT, vU, vV;
+                int iMask = _mm_movemask_ps( IntersectTriangles4( ray.vOrigS, ray.vDirS, pBlock->v0, pBlock->e1,
+                                                                  pBlock->e2, _mm_set1_ps( fBest ), &vT, &vU, &vV ) );
+                if( iMask == 0 )
+                    continue;
+
+                FLOAT fT[4], fU[4], fV[4];
+                _mm_storeu_ps( fT, vT );
+                _mm_storeu_ps( fU, vU );
+                _mm_storeu_ps( fV, vV );
+                for( UINT uLane = 0; uLane < 4; uLane++ )
+                {
+                    if( ( iMask & ( 1 << uLane ) ) && fT[uLane] < fBest )
+                    {
+                        fBest = fT[uLane];
+                        hit.dwFace = pBlock->dwFace[uLane];
+                        hit.fBary1 = fU[uLane];
+                        hit.fBary2 = fV[uLane];
+                        hit.fDist = fT[uLane];
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Push the far child first so the near one is visited next and shortens fBest
+            UINT uNear = ray.bNegDir[pNode->uAxis] ? 1 : 0;
+            uStack[uStackSize++] = pNode->uChildOrBlock + 1 - uNear;
+            uStack[uStackSize++] = pNode->uChildOrBlock + uNear;
+        }
+    }
+
+    if( hit.dwFace == BVH_NO_HIT )
+        return false;
+
+    *pHit = hit;
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+DWORD CTriangleBVH::IntersectAll( const D3DXVECTOR3& vOrig, const D3DXVECTOR3& vDir,
+                                  BVHHIT* pHits, DWORD dwMaxHits ) const
+{
+    if( m_pNodes == NULL || dwMaxHits == 0 )
+        return 0;
+
+    BVHRAY1 ray;
+    SetupRay( vOrig, vDir, &ray );
+
+    // Until the output is full every hit is kept; after that only hits nearer than the
+    // farthest kept one matter, so it also culls the traversal
+    FLOAT fCull = FLT_MAX;
+    DWORD dwNumHits = 0;
+
+    UINT uStack[BVH_STACK_SIZE];
+    UINT uStackSize = 0;
+    uStack[uStackSize++] = 0;
+    while( uStackSize > 0 )
+    {
+        const NODE* pNode = &m_pNodes[uStack[--uStackSize]];
+        if( !IntersectBox1( pNode->fMin, pNode->fMax, ray, fCull ) )
+            continue;
+
+        if( pNode->uNumTris > 0 )
+        {
+            const TRIBLOCK* pBlock = &m_pBlocks[pNode->uChildOrBlock];
+            for( UINT i = 0; i < pNode->uNumTris; i += 4, pBlock++ )
+            {
+                __m128 vT, vU, vV;
+                int iMask = _mm_movemask_ps( IntersectTriangles4( ray.vOrigS, ray.vDirS, pBlock->v0, pBlock->e1,
+                                                                  pBlock->e2, _mm_set1_ps( fCull ), &vT, &vU, &vV ) );
+                if( iMask == 0 )
+                    continue;
+
+                FLOAT fT[4], fU[4], fV[4];
+                _mm_storeu_ps( fT, vT );
+                _mm_storeu_ps( fU, vU );
+                _mm_storeu_ps( fV, vV );
+                for( UINT uLane = 0; uLane < 4; uLane++ )
+                {
+                    if( !( iMask & ( 1 << uLane ) ) || fT[uLane] >= fCull )
+                        continue;
+
+                    // Insertion sort front to back, dropping the farthest hit when full
+                    DWORD dwSlot = ( dwNumHits < dwMaxHits ) ? dwNumHits++ : dwMaxHits - 1;
+                    while( dwSlot > 0 && pHits[dwSlot - 1].fDist > fT[uLane] )
+                    {
+                        pHits[dwSlot] = pHits[dwSlot - 1];
+                        dwSlot--;
+                    }
+                    pHits[dwSlot].dwFace = pBlock->dwFace[uLane];
+                    pHits[dwSlot].fBary1 = fU[uLane];
+                    pHits[dwSlot].fBary2 = fV[uLane];
+                    pHits[dwSlot].fDist = fT[uLane];
+
+                    if( dwNumHits == dwMaxHits )
+                        fCull = pHits[dwMaxHits - 1].fDist;
+                }
+            }
+        }
+        else
+        {
+            // Near child first, so the output fills with close hits and fCull tightens early
+            UINT uNear = ray.bNegDir[pNode->uAxis] ? 1 : 0;
+            uStack[uStackSize++] = pNode->uChildOrBlock + 1 - uNear;
+            uStack[uStackSize++] = pNode->uChildOrBlock + uNear;
+        }
+    }
+
+    return dwNumHits;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Traces up to four rays as one SSE packet.  A node is entered when any ray of the packet
+// hits it, so the packet pays for the union of the rays' traversals; unused lanes repeat
+// the first ray and are discarded.
+//--------------------------------------------------------------------------------------
+void CTriangleBVH::TraceClosest4( const BVHRAY* pRays, UINT uNumRays, BVHHIT* pHits ) const
+{
+    FLOAT fOrig[3][4], fDir[3][4], fInvDir[3][4];
+    for( UINT uLane = 0; uLane < 4; uLane++ )
+    {
+        const BVHRAY& ray = pRays[uLane < uNumRays ? uLane : 0];
+        for( UINT uAxis = 0; uAxis < 3; uAxis++ )
+        {
+            fOrig[uAxis][uLane] = ray.vOrig[uAxis];
+            fDir[uAxis][uLane] = ray.vDir[uAxis];
+            fInvDir[uAxis][uLane] = SafeRcp( ray.vDir[uAxis] );
+        }
+    }
+
+    __m128 vOrig[3], vDir[3], vInvDir[3];
+    bool bNegDir[3];
+    for( UINT uAxis = 0; uAxis < 3; uAxis++ )
+    {
+        vOrig[uAxis] = _mm_loadu_ps( fOrig[uAxis] );
+        vDir[uAxis] = _mm_loadu_ps( fDir[uAxis] );
+        vInvDir[uAxis] = _mm_loadu_ps( fInvDir[uAxis] );
+        bNegDir[uAxis] = pRays[0].vDir[uAxis] < 0.0f;
+    }
+
+    const __m128 vZero = _mm_setzero_ps();
+    __m128 vBest = _mm_set1_ps( FLT_MAX );
+    __m128 vBestU = vZero;
+    __m128 vBestV = vZero;
+    DWORD dwFace[4] = { BVH_NO_HIT, BVH_NO_HIT, BVH_NO_HIT, BVH_NO_HIT };
+
+    UINT uStack[BVH_STACK_SIZE];
+    UINT uStackSize = 0;
+    uStack[uStackSize++] = 0;
+    while( uStackSize > 0 )
+    {
+        const NODE* pNode = &m_pNodes[uStack[--uStackSize]];
+
+        // Slab test of the four rays against the node, one axis at a time
+        __m128 vNear = _mm_set1_ps( -FLT_MAX );
+        __m128 vFar = _mm_set1_ps( FLT_MAX );
+        for( UINT uAxis = 0; uAxis < 3; uAxis++ )
+        {
+            __m128 vT0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( pNode->fMin[uAxis] ), vOrig[uAxis] ), vInvDir[uAxis] );
+            __m128 vT1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( pNode->fMax[uAxis] ), vOrig[uAxis] ), vInvDir[uAxis] );
+            vNear = _mm_max_ps( vNear, _mm_min_ps( vT0, vT1 ) );
+            vFar = _mm_min_ps( vFar, _mm_max_ps( vT0, vT1 ) );
+        }
+        __m128 vActive = _mm_and_ps( _mm_cmple_ps( vNear, vFar ), _mm_cmpge_ps( vFar, vZero ) );
+        vActive = _mm_and_ps( vActive, _mm_cmplt_ps( vNear, vBest ) );
+        if( _mm_movemask_ps( vActive ) == 0 )
+            continue;
+
+        if( pNode->uNumTris > 0 )
+        {
+            const TRIBLOCK* pBlock = &m_pBlocks[pNode->uChildOrBlock];
+            for( UINT i = 0; i < pNode->uNumTris; i++ )
+            {
+                if( i > 0 && ( i % 4 ) == 0 )
+                    pBlock++;
+
+                __m128 vV0[3], vE1[3], vE2[3];
+                SplatLane( pBlock->v0, i % 4, vV0 );
+                SplatLane( pBlock->e1, i % 4, vE1 );
+                SplatLane( pBlock->e2, i % 4, vE2 );
+
+                __m128 vT, vU, vV;
+                __m128 vHit = IntersectTriangles4( vOrig, vDir, vV0, vE1, vE2, vBest, &vT, &vU, &vV );
+                int iMask = _mm_movemask_ps( vHit );
+                if( iMask == 0 )
+                    continue;
+
+                vBest = Select( vHit, vT, vBest );
+                vBestU = Select( vHit, vU, vBestU );
+                vBestV = Select( vHit, vV, vBestV );
+                for( UINT uLane = 0; uLane < 4; uLane++ )
+                {
+                    if( iMask & ( 1 << uLane ) )
+                        dwFace[uLane] = pBlock->dwFace[i % 4];
+                }
+            }
+        }
+        else
+        {
+            // Order by the first ray; coherent packets mostly agree with it
+            UINT uNear = bNegDir[pNode->uAxis] ? 1 : 0;
+            uStack[uStackSize++] = pNode->uChildOrBlock + 1 - uNear;
+            uStack[uStackSize++] = pNode->uChildOrBlock + uNear;
+        }
+    }
+
+    FLOAT fT[4], fU[4], fV[4];
+    _mm_storeu_ps( fT, vBest );
+    _mm_storeu_ps( fU, vBestU );
+    _mm_storeu_ps( fV, vBestV );
+    for( UINT uLane = 0; uLane < uNumRays; uLane++ )
+    {
+        pHits[uLane].dwFace = dwFace[uLane];
+        pHits[uLane].fBary1 = ( dwFace[uLane] != BVH_NO_HIT ) ? fU[uLane] : 0.0f;
+        pHits[uLane].fBary2 = ( dwFace[uLane] != BVH_NO_HIT ) ? fV[uLane] : 0.0f;
+        pHits[uLane].fDist = fT[uLane];
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+void CTriangleBVH::IntersectClosestBatch( const BVHRAY* pRays, DWORD dwNumRays, BVHHIT* pHits ) const
+{
+    if( m_pNodes == NULL )
+    {
+        for( DWORD i = 0; i < dwNumRays; i++ )
+        {
+            pHits[i].dwFace = BVH_NO_HIT;
+            pHits[i].fBary1 = pHits[i].fBary2 = 0.0f;
+            pHits[i].fDist = FLT_MAX;
+        }
+        return;
+    }
+
+    const DWORD dwRaysPerTask = 4 * BVH_PACKETS_PER_TASK;
+    DWORD dwNumTasks = ( dwNumRays + dwRaysPerTask - 1 ) / dwRaysPerTask;
+
+    auto TraceTask = [=]( DWORD dwTask )
+    {
+        DWORD dwEnd = ( dwTask + 1 ) * dwRaysPerTask;
+        if( dwEnd > dwNumRays )
+            dwEnd = dwNumRays;
+        for( DWORD i = dwTask * dwRaysPerTask; i < dwEnd; i += 4 )
+            TraceClosest4( pRays + i, ( dwEnd - i < 4 ) ? dwEnd - i : 4, pHits + i );
+    };
+
+    if( dwNumTasks > 1 )
+        Concurrency::parallel_for( DWORD( 0 ), dwNumTasks, TraceTask );
+    else if( dwNumTasks == 1 )
+        TraceTask( 0 );
+}
@@ -0,0 +1,121 @@
+//--------------------------------------------------------------------------------------
+// File: TriangleBVH.h
+//
+// Bounding volume hierarchy over a triangle mesh for fast ray queries.  The tree is built
+// top-down with binned SAH splits, large subtrees are built in parallel, and the leaves
+// store their triangles four at a time so one SSE test covers a whole leaf block.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <xmmintrin.h>
+
+// dwFace value reported for rays that miss the mesh
+#define BVH_NO_HIT 0xffffffff
+
+
+//--------------------------------------------------------------------------------------
+// Result of a ray query.  fBary1/fBary2 and fDist match the values D3DXIntersect and
+// the sample's IntersectTriangle return for the same face.
+//--------------------------------------------------------------------------------------
+struct BVHHIT
+{
+    DWORD dwFace;                 // mesh face that was intersected, or BVH_NO_HIT
+    FLOAT fBary1, fBary2;         // barycentric coords of intersection
+    FLOAT fDist;                  // distance from ray origin to intersection, in units of the ray direction
+};
+
+struct BVHRAY
+{
+    D3DXVECTOR3 vOrig;
+    D3DXVECTOR3 vDir;
+};
+
+
+class CTriangleBVH
+{
+public:
+    CTriangleBVH();
+    ~CTriangleBVH();
+
+    //--------------------------------------------------------------------------------------
+    // Builds the hierarchy over dwNumFaces triangles.  pPositions points at the position of
+    // the first vertex and dwStride is the size of one vertex; pIndices holds 3 WORD or DWORD
+    // indices per face depending on b32BitIndices.  The mesh data is copied, so it can be
+    // unlocked as soon as Build returns.  Subtrees are built on the Concurrency Runtime.
+    //--------------------------------------------------------------------------------------
+    HRESULT Build( const D3DXVECTOR3* pPositions, DWORD dwStride, DWORD dwNumVertices,
+                   const void* pIndices, bool b32BitIndices, DWORD dwNumFaces );
+    HRESULT BuildFromMesh( ID3DXMesh* pMesh );
+    void Destroy();
+
+    bool IsBuilt() const { return m_pNodes != NULL; }
+    DWORD GetNumFaces() const { return m_dwNumFaces; }
+    DWORD GetNumNodes() const { return m_dwNumNodes; }
+
+    //--------------------------------------------------------------------------------------
+    // Returns true and fills pHit with the nearest face in front of the ray origin.
+    //--------------------------------------------------------------------------------------
+    bool IntersectClosest( const D3DXVECTOR3& vOrig, const D3DXVECTOR3& vDir, BVHHIT* pHit ) const;
+
+    //--------------------------------------------------------------------------------------
+    // Finds the faces the ray passes through.  The dwMaxHits nearest are written to pHits
+    // sorted front to back and their count is returned; once the output is full, subtrees
+    // behind the farthest kept hit are skipped.
+    //--------------------------------------------------------------------------------------
+    DWORD IntersectAll( const D3DXVECTOR3& vOrig, const D3DXVECTOR3& vDir,
+                        BVHHIT* pHits, DWORD dwMaxHits ) const;
+
+    //--------------------------------------------------------------------------------------
+    // Closest hit for each of dwNumRays rays; pHits[i].dwFace is BVH_NO_HIT when ray i
+    // misses.  Rays are traced as SSE packets of four, and large batches are split across
+    // threads.  Coherent rays (neighbouring pixels, a spread of gameplay probes from one
+    // point) should be adjacent in pRays so each packet shares most of its traversal.
+    //--------------------------------------------------------------------------------------
+    void IntersectClosestBatch( const BVHRAY* pRays, DWORD dwNumRays, BVHHIT* pHits ) const;
+
+protected:
+    // 48 bytes; the bounds are padded to 4 floats so a node can be tested with one SSE
+    // slab test.  Interior nodes store the index of their first child (the second child
+    // follows it) and the split axis, leaves store their first triangle block and their
+    // triangle count.
+    struct NODE
+    {
+        FLOAT fMin[4];
+        FLOAT fMax[4];
+        UINT uChildOrBlock;
+        UINT uNumTris;            // 0 for interior nodes
+        UINT uAxis;               // the first child holds the lower centroids on this axis
+        UINT uPad;
+    };
+
+    // Four triangles in SoA form, stored as a vertex and two edges as Moller-Trumbore wants.
+    // Unused lanes have zero edges, which makes their determinant zero so they never hit.
+    struct TRIBLOCK
+    {
+        __m128 v0[3];
+        __m128 e1[3];
+        __m128 e2[3];
+        DWORD dwFace[4];
+    };
+
+    struct BUILDREF
+    {
+        D3DXVECTOR3 vMin;
+        D3DXVECTOR3 vMax;
+        D3DXVECTOR3 vCentroid;
+        DWORD dwFace;
+    };
+
+    void BuildNode( UINT uNode, BUILDREF* pRefs, DWORD dwBegin, DWORD dwEnd, UINT uDepth );
+    void TraceClosest4( const BVHRAY* pRays, UINT uNumRays, BVHHIT* pHits ) const;
+
+    NODE* m_pNodes;
+    TRIBLOCK* m_pBlocks;
+    DWORD m_dwNumFaces;
+    DWORD m_dwNumNodes;
+    DWORD m_dwNumBlocks;
+    volatile LONG m_lNextNode;    // node allocator shared by the build threads
+};
@@ -10,6 +10,7 @@
 #include "SDKmesh.h"
 #include "SDKmisc.h"
 #include "resource.h"
+#include <ppl.h>
 
 //#define DEBUG_VS   // Uncomment this line to debug vertex shaders
 //#define DEBUG_PS   // Uncomment this line to debug pixel shaders
@@ -221,42 +222,133 @@ void CALLBACK OnDestroyDevice( void* pUserContext );
 
 void InitApp();
 HRESULT LoadMesh( IDirect3DDevice9* pd3dDevice, WCHAR* strFileName, ID3DXMesh** ppMesh );
+HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3DXMesh** ppOutMesh, DWORD dwOptions = 0 );
+HRESULT GenerateShadowMeshFile( LPCWSTR strMeshFile, LPCWSTR strOutFile );
 void RenderText();
 
 
 
 //--------------------------------------------------------------------------------------
-// Takes an array of CEdgeMapping objects, then returns an index for the edge in the
-// table if such entry exists, or returns an index at which a new entry for the edge
-// can be written.
-// nV1 and nV2 are the vertex indexes for the old edge.
-// nCount is the number of elements in the array.
-// The function returns -1 if an available entry cannot be found.  In reality,
-// this should never happens as we should have allocated enough memory.
-int FindEdgeInMappingTable( int nV1, int nV2, CEdgeMapping* pMapping, int nCount )
+// Hash index over a table of CEdgeMapping objects.  The key is the ordered vertex pair of
+// the old edge, or just its start or end vertex.  Entries with the same hash are chained
+// through m_pnNext so that an entry can be unlinked without moving anything in the
+// mapping table.
+enum EDGE_HASH_KEY
 {
-    for( int i = 0; i < nCount; ++i )
+    EDGE_HASH_PAIR,     // m_anOldEdge[0] and m_anOldEdge[1]
+    EDGE_HASH_START,    // m_anOldEdge[0]
+    EDGE_HASH_END,      // m_anOldEdge[1]
+};
+
+class CEdgeHash
+{
+public:
+    CEdgeHash() : m_pnBuckets( NULL ), m_pnNext( NULL ), m_nMask( 0 ), m_Key( EDGE_HASH_PAIR ) {}
+    ~CEdgeHash() { delete[] m_pnBuckets; delete[] m_pnNext; }
+
+    // nCount is the number of entries in the mapping table
+    HRESULT Init( int nCount, EDGE_HASH_KEY Key = EDGE_HASH_PAIR )
+    {
+        int nBuckets = 16;
+        while( nBuckets < nCount )
+            nBuckets *= 2;
+
+        m_pnBuckets = new int[nBuckets];
+        m_pnNext = new int[nCount];
+        if( !m_pnBuckets || !m_pnNext )
+            return E_OUTOFMEMORY;
+
+        FillMemory( m_pnBuckets, sizeof( int ) * nBuckets, 0xFF );
+        m_nMask = nBuckets - 1;
+        m_Key = Key;
+        return S_OK;
+    }
+
+    // Adds entry nIndex under the key its old edge has now.  The entry must be unlinked
+    // before its old edge changes.
+    void Insert( int nIndex, const CEdgeMapping* pMapping )
     {
-        // If both vertex indexes of the old edge in mapping entry are -1, then
-        // we have searched every valid entry without finding a match.  Return
-        // this index as a newly created entry.
-        if( ( pMapping[i].m_anOldEdge[0] == -1 && pMapping[i].m_anOldEdge[1] == -1 ) ||
+        int& nHead = m_pnBuckets[Hash( pMapping[nIndex] )];
+        m_pnNext[nIndex] = nHead;
+        nHead = nIndex;
+    }
+
+    // Removes entry nIndex from the index
+    void Unlink( int nIndex, const CEdgeMapping* pMapping )
+    {
+        int* pnLink = &m_pnBuckets[Hash( pMapping[nIndex] )];
+        while( *pnLink != -1 && *pnLink != nIndex )
+            pnLink = &m_pnNext[*pnLink];
+
+        if( *pnLink == nIndex )
+            *pnLink = m_pnNext[nIndex];
+    }
+
+    // Pair key only.  Finds an entry whose old edge runs from nV1 to nV2, removes it from
+    // the index and returns its position in the mapping table, or -1 if there is none.
+    int Remove( int nV1, int nV2, const CEdgeMapping* pMapping )
+    {
+        int* pnLink = &m_pnBuckets[Hash( nV1, nV2 )];
+        while( *pnLink != -1 )
+        {
+            int i = *pnLink;
+            if( pMapping[i].m_anOldEdge[0] == nV1 && pMapping[i].m_anOldEdge[1] == nV2 )
+            {
+                *pnLink = m_pnNext[i];
+                return i;
+            }
+            pnLink = &m_pnNext[i];
+        }
+
+        return -1;
+    }
 
-            // Or if we find a match, return the index.
-            ( pMapping[i].m_anOldEdge[1] == nV1 && pMapping[i].m_anOldEdge[0] == nV2 ) )
+    // Start or end key only.  Returns the lowest position of an entry keyed on vertex nV,
+    // or -1 if there is none.
+    int FindLowest( int nV, const CEdgeMapping* pMapping ) const
+    {
+        int nSlot = ( EDGE_HASH_END == m_Key ) ? 1 : 0;
+        int nLowest = -1;
+        for( int i = m_pnBuckets[Hash( nV, -1 )]; i != -1; i = m_pnNext[i] )
         {
-            return i;
+            if( pMapping[i].m_anOldEdge[nSlot] == nV && ( -1 == nLowest || i < nLowest ) )
+                nLowest = i;
         }
+
+        return nLowest;
     }
 
-    return -1;  // We should never reach this line
-}
+private:
+    int Hash( int nV1, int nV2 ) const
+    {
+        return ( int )( ( ( UINT )nV1 * 73856093U ) ^ ( ( UINT )nV2 * 19349663U ) ) & m_nMask;
+    }
+
+    int Hash( const CEdgeMapping& Map ) const
+    {
+        switch( m_Key )
+        {
+            case EDGE_HASH_START:
+                return Hash( Map.m_anOldEdge[0], -1 );
+            case EDGE_HASH_END:
+                return Hash( Map.m_anOldEdge[1], -1 );
+            default:
+                return Hash( Map.m_anOldEdge[0], Map.m_anOldEdge[1] );
+        }
+    }
+
+    int* m_pnBuckets;
+    int* m_pnNext;
+    int m_nMask;
+    EDGE_HASH_KEY m_Key;
+};
 
 
 //--------------------------------------------------------------------------------------
 // Takes a mesh and generate a new mesh from it that contains the degenerate invisible
 // quads for shadow volume extrusion.
-HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3DXMesh** ppOutMesh )
+// dwOptions holds extra D3DXMESH flags for the meshes created, such as D3DXMESH_SYSTEMMEM.
+HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3DXMesh** ppOutMesh, DWORD dwOptions )
 {
     HRESULT hr = S_OK;
     ID3DXMesh* pInputMesh;
@@ -266,7 +358,7 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
     *ppOutMesh = NULL;
 
     // Convert the input mesh to a format same as the output mesh using 32-bit index.
-    hr = pMesh->CloneMesh( D3DXMESH_32BIT, SHADOWVERT::Decl, pd3dDevice, &pInputMesh );
+    hr = pMesh->CloneMesh( D3DXMESH_32BIT | dwOptions, SHADOWVERT::Decl, pd3dDevice, &pInputMesh );
     if( FAILED( hr ) )
         return hr;
 
@@ -304,7 +396,10 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
         // Maximum number of unique edges = Number of faces * 3
         DWORD dwNumEdges = pInputMesh->GetNumFaces() * 3;
         CEdgeMapping* pMapping = new CEdgeMapping[dwNumEdges];
-        if( pMapping )
+        int* pnQuads = new int[dwNumEdges / 2 + 1];  // Mapping entries of edges shared by two faces
+        CEdgeHash EdgeHash;
+        CEdgeHash StartHash, EndHash;   // open edges, for patching the holes
+        if( pMapping && pnQuads && SUCCEEDED( EdgeHash.Init( ( int )dwNumEdges ) ) )
         {
             int nNumMaps = 0;  // Number of entries that exist in pMapping
 
@@ -312,7 +407,7 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
             ID3DXMesh* pNewMesh;
             hr = D3DXCreateMesh( pInputMesh->GetNumFaces() + dwNumEdges * 2,
                                  pInputMesh->GetNumFaces() * 3,
-                                 D3DXMESH_32BIT,
+                                 D3DXMESH_32BIT | dwOptions,
                                  SHADOWVERT::Decl,
                                  pd3dDevice,
                                  &pNewMesh );
@@ -333,189 +428,114 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
                     ZeroMemory( pNewVBData, pNewMesh->GetNumVertices() * pNewMesh->GetNumBytesPerVertex() );
                     ZeroMemory( pdwNewIBData, sizeof( DWORD ) * pNewMesh->GetNumFaces() * 3 );
 
-                    // pNextOutVertex is the location to write the next
-                    // vertex to.
-                    SHADOWVERT* pNextOutVertex = pNewVBData;
-
-                    // Iterate through the faces.  For each face, output new
-                    // vertices and face in the new mesh, and write its edges
-                    // to the mapping table.
+                    int nNumFaces = ( int )pInputMesh->GetNumFaces();
 
-                    for( UINT f = 0; f < pInputMesh->GetNumFaces(); ++f )
+                    // Output new vertices and a face in the new mesh for every face.  Faces
+                    // are independent, so this runs in parallel.
+                    Concurrency::parallel_for( 0, nNumFaces, [&]( int f )
                     {
+                        SHADOWVERT* pOutVertex = pNewVBData + f * 3;
+
                         // Copy the vertex data for all 3 vertices
-                        CopyMemory( pNextOutVertex, pVBData + pdwIBData[f * 3], sizeof( SHADOWVERT ) );
-                        CopyMemory( pNextOutVertex + 1, pVBData + pdwIBData[f * 3 + 1], sizeof( SHADOWVERT ) );
-                        CopyMemory( pNextOutVertex + 2, pVBData + pdwIBData[f * 3 + 2], sizeof( SHADOWVERT ) );
+                        CopyMemory( pOutVertex, pVBData + pdwIBData[f * 3], sizeof( SHADOWVERT ) );
+                        CopyMemory( pOutVertex + 1, pVBData + pdwIBData[f * 3 + 1], sizeof( SHADOWVERT ) );
+                        CopyMemory( pOutVertex + 2, pVBData + pdwIBData[f * 3 + 2], sizeof( SHADOWVERT ) );
 
                         // Write out the face
-                        pdwNewIBData[nNextIndex++] = f * 3;
-                        pdwNewIBData[nNextIndex++] = f * 3 + 1;
-                        pdwNewIBData[nNextIndex++] = f * 3 + 2;
+                        pdwNewIBData[f * 3] = f * 3;
+                        pdwNewIBData[f * 3 + 1] = f * 3 + 1;
+                        pdwNewIBData[f * 3 + 2] = f * 3 + 2;
 
                         // Compute the face normal and assign it to
                         // the normals of the vertices.
                         D3DXVECTOR3 v1, v2;  // v1 and v2 are the edge vectors of the face
                         D3DXVECTOR3 vNormal;
-                        v1 = *( D3DXVECTOR3* )( pNextOutVertex + 1 ) - *( D3DXVECTOR3* )pNextOutVertex;
-                        v2 = *( D3DXVECTOR3* )( pNextOutVertex + 2 ) - *( D3DXVECTOR3* )( pNextOutVertex + 1 );
+                        v1 = *( D3DXVECTOR3* )( pOutVertex + 1 ) - *( D3DXVECTOR3* )pOutVertex;
+                        v2 = *( D3DXVECTOR3* )( pOutVertex + 2 ) - *( D3DXVECTOR3* )( pOutVertex + 1 );
                         D3DXVec3Cross( &vNormal, &v1, &v2 );
                         D3DXVec3Normalize( &vNormal, &vNormal );
 
-                        pNextOutVertex->Normal = vNormal;
-                        ( pNextOutVertex + 1 )->Normal = vNormal;
-                        ( pNextOutVertex + 2 )->Normal = vNormal;
-
-                        pNextOutVertex += 3;
-
-                        // Add the face's edges to the edge mapping table
-
-                        // Edge 1
-                        int nIndex;
+                        pOutVertex->Normal = vNormal;
+                        ( pOutVertex + 1 )->Normal = vNormal;
+                        ( pOutVertex + 2 )->Normal = vNormal;
+                    } );
+                    nNextIndex = nNumFaces * 3;
+
+                    // Pair up the faces' edges through the edge hash.  An edge walked in the
+                    // opposite direction by an earlier face is shared and gets a quad; otherwise
+                    // the edge is added to the mapping table to wait for its partner.  Entries
+                    // never move, so this pass is O(E).
+                    int nNumQuads = 0;
+                    for( int f = 0; f < nNumFaces; ++f )
+                    {
                         int nVertIndex[3] =
                         {
                             static_cast<int>(pdwPtRep[pdwIBData[f * 3]]),
                             static_cast<int>(pdwPtRep[pdwIBData[f * 3 + 1]]),
                             static_cast<int>(pdwPtRep[pdwIBData[f * 3 + 2]])
                         };
-                        nIndex = FindEdgeInMappingTable( nVertIndex[0], nVertIndex[1], pMapping, dwNumEdges );
-
-                        // If error, we are not able to proceed, so abort.
-                        if( -1 == nIndex )
-                        {
-                            hr = E_INVALIDARG;
-                            goto cleanup;
-                        }
-
-                        if( pMapping[nIndex].m_anOldEdge[0] == -1 && pMapping[nIndex].m_anOldEdge[1] == -1 )
-                        {
-                            // No entry for this edge yet.  Initialize one.
-                            pMapping[nIndex].m_anOldEdge[0] = nVertIndex[0];
-                            pMapping[nIndex].m_anOldEdge[1] = nVertIndex[1];
-                            pMapping[nIndex].m_aanNewEdge[0][0] = f * 3;
-                            pMapping[nIndex].m_aanNewEdge[0][1] = f * 3 + 1;
-
-                            ++nNumMaps;
-                        }
-                        else
-                        {
-                            // An entry is found for this edge.  Create
-                            // a quad and output it.
-                            assert( nNumMaps > 0 );
-
-                            pMapping[nIndex].m_aanNewEdge[1][0] = f * 3;      // For clarity
-                            pMapping[nIndex].m_aanNewEdge[1][1] = f * 3 + 1;
-
-                            // First triangle
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][1];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][0];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][0];
-
-                            // Second triangle
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][1];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][0];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][0];
-
-                            // pMapping[nIndex] is no longer needed. Copy the last map entry
-                            // over and decrement the map count.
-
-                            pMapping[nIndex] = pMapping[nNumMaps - 1];
-                            FillMemory( &pMapping[nNumMaps - 1], sizeof( pMapping[nNumMaps - 1] ), 0xFF );
-                            --nNumMaps;
-                        }
-
-                        // Edge 2
-                        nIndex = FindEdgeInMappingTable( nVertIndex[1], nVertIndex[2], pMapping, dwNumEdges );
-
-                        // If error, we are not able to proceed, so abort.
-                        if( -1 == nIndex )
-                        {
-                            hr = E_INVALIDARG;
-                            goto cleanup;
-                        }
-
-                        if( pMapping[nIndex].m_anOldEdge[0] == -1 && pMapping[nIndex].m_anOldEdge[1] == -1 )
-                        {
-                            pMapping[nIndex].m_anOldEdge[0] = nVertIndex[1];
-                            pMapping[nIndex].m_anOldEdge[1] = nVertIndex[2];
-                            pMapping[nIndex].m_aanNewEdge[0][0] = f * 3 + 1;
-                            pMapping[nIndex].m_aanNewEdge[0][1] = f * 3 + 2;
-
-                            ++nNumMaps;
-                        }
-                        else
-                        {
-                            // An entry is found for this edge.  Create
-                            // a quad and output it.
-                            assert( nNumMaps > 0 );
-
-                            pMapping[nIndex].m_aanNewEdge[1][0] = f * 3 + 1;
-                            pMapping[nIndex].m_aanNewEdge[1][1] = f * 3 + 2;
 
-                            // First triangle
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][1];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][0];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][0];
-
-                            // Second triangle
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][1];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][0];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][0];
-
-                            // pMapping[nIndex] is no longer needed. Copy the last map entry
-                            // over and decrement the map count.
-
-                            pMapping[nIndex] = pMapping[nNumMaps - 1];
-                            FillMemory( &pMapping[nNumMaps - 1], sizeof( pMapping[nNumMaps - 1] ), 0xFF );
-                            --nNumMaps;
-                        }
-
-                        // Edge 3
-                        nIndex = FindEdgeInMappingTable( nVertIndex[2], nVertIndex[0], pMapping, dwNumEdges );
-
-                        // If error, we are not able to proceed, so abort.
-                        if( -1 == nIndex )
-                        {
-                            hr = E_INVALIDARG;
-                            goto cleanup;
-                        }
-
-                        if( pMapping[nIndex].m_anOldEdge[0] == -1 && pMapping[nIndex].m_anOldEdge[1] == -1 )
+                        for( int e = 0; e < 3; ++e )
                         {
-                            pMapping[nIndex].m_anOldEdge[0] = nVertIndex[2];
-                            pMapping[nIndex].m_anOldEdge[1] = nVertIndex[0];
-                            pMapping[nIndex].m_aanNewEdge[0][0] = f * 3 + 2;
-                            pMapping[nIndex].m_aanNewEdge[0][1] = f * 3;
+                            int nV1 = nVertIndex[e];
+                            int nV2 = nVertIndex[( e + 1 ) % 3];
+                            int nNew1 = f * 3 + e;
+                            int nNew2 = f * 3 + ( e + 1 ) % 3;
 
-                            ++nNumMaps;
+                            int nIndex = EdgeHash.Remove( nV2, nV1, pMapping );
+                            if( -1 == nIndex )
+                            {
+                                // No entry for this edge yet.  Initialize one.
+                                pMapping[nNumMaps].m_anOldEdge[0] = nV1;
+                                pMapping[nNumMaps].m_anOldEdge[1] = nV2;
+                                pMapping[nNumMaps].m_aanNewEdge[0][0] = nNew1;
+                                pMapping[nNumMaps].m_aanNewEdge[0][1] = nNew2;
+                                EdgeHash.Insert( nNumMaps, pMapping );
+
+                                ++nNumMaps;
+                            }
+                            else
+                            {
+                                // An entry is found for this edge.  Record the quad
+                                // to be output below.
+                                pMapping[nIndex].m_aanNewEdge[1][0] = nNew1;
+                                pMapping[nIndex].m_aanNewEdge[1][1] = nNew2;
+                                pnQuads[nNumQuads++] = nIndex;
+                            }
                         }
-                        else
-                        {
-                            // An entry is found for this edge.  Create
-                            // a quad and output it.
-                            assert( nNumMaps > 0 );
-
-                            pMapping[nIndex].m_aanNewEdge[1][0] = f * 3 + 2;
-                            pMapping[nIndex].m_aanNewEdge[1][1] = f * 3;
-
-                            // First triangle
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][1];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][0];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][0];
-
-                            // Second triangle
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][1];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[1][0];
-                            pdwNewIBData[nNextIndex++] = pMapping[nIndex].m_aanNewEdge[0][0];
-
-                            // pMapping[nIndex] is no longer needed. Copy the last map entry
-                            // over and decrement the map count.
+                    }
 
-                            pMapping[nIndex] = pMapping[nNumMaps - 1];
-                            FillMemory( &pMapping[nNumMaps - 1], sizeof( pMapping[nNumMaps - 1] ), 0xFF );
-                            --nNumMaps;
-                        }
+                    // Output a degenerate quad for every shared edge.  Each quad owns six
+                    // indices at a known offset, so this runs in parallel too.
+                    DWORD* pdwQuadIBData = pdwNewIBData + nNextIndex;
+                    Concurrency::parallel_for( 0, nNumQuads, [&]( int q )
+                    {
+                        const CEdgeMapping& Map = pMapping[pnQuads[q]];
+                        DWORD* pdwOut = pdwQuadIBData + q * 6;
+
+                        // First triangle
+                        pdwOut[0] = Map.m_aanNewEdge[0][1];
+                        pdwOut[1] = Map.m_aanNewEdge[0][0];
+                        pdwOut[2] = Map.m_aanNewEdge[1][0];
+
+                        // Second triangle
+                        pdwOut[3] = Map.m_aanNewEdge[1][1];
+                        pdwOut[4] = Map.m_aanNewEdge[1][0];
+                        pdwOut[5] = Map.m_aanNewEdge[0][0];
+                    } );
+                    nNextIndex += nNumQuads * 6;
+
+                    // Shared entries are no longer needed.  Compact the non-shared
+                    // ones to the front of the table.
+                    int nNumOpen = 0;
+                    for( int i = 0; i < nNumMaps; ++i )
+                    {
+                        if( pMapping[i].m_aanNewEdge[1][0] == -1 )
+                            pMapping[nNumOpen++] = pMapping[i];
                     }
+                    for( int i = nNumOpen; i < nNumMaps; ++i )
+                        FillMemory( &pMapping[i], sizeof( pMapping[i] ), 0xFF );
+                    nNumMaps = nNumOpen;
 
                     // Now the entries in the edge mapping table represent
                     // non-shared edges.  What they mean is that the original
@@ -535,7 +555,7 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
                     // Make enough room in IB for the face and up to 3 quads for each patching face
                     hr = D3DXCreateMesh( nNextIndex / 3 + nNumMaps * 7,
                                          ( pInputMesh->GetNumFaces() + nNumMaps ) * 3,
-                                         D3DXMESH_32BIT,
+                                         D3DXMESH_32BIT | dwOptions,
                                          SHADOWVERT::Decl,
                                          pd3dDevice,
                                          &pPatchMesh );
@@ -585,6 +605,21 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
                     // nNextVertex is the index of the next vertex.
                     int nNextVertex = pInputMesh->GetNumFaces() * 3;
 
+                    // Index the open edges by start and by end vertex so that the edges
+                    // next to each one along its opening are looked up directly.  Entries
+                    // are unlinked once they are done or become shared, which leaves only
+                    // the entries after the current one, as the table scan used to.
+                    hr = StartHash.Init( nNumMaps, EDGE_HASH_START );
+                    if( SUCCEEDED( hr ) )
+                        hr = EndHash.Init( nNumMaps, EDGE_HASH_END );
+                    if( FAILED( hr ) )
+                        goto cleanup;
+                    for( int i = 0; i < nNumMaps; ++i )
+                    {
+                        StartHash.Insert( i, pMapping );
+                        EndHash.Insert( i, pMapping );
+                    }
+
                     for( int i = 0; i < nNumMaps; ++i )
                     {
                         if( pMapping[i].m_anOldEdge[0] != -1 &&
@@ -597,110 +632,118 @@ HRESULT GenerateShadowMesh( IDirect3DDevice9* pd3dDevice, ID3DXMesh* pMesh, ID3D
                             if( pMapping[i].m_aanNewEdge[1][0] == -1 ||  // must have only one new edge
                                 pMapping[i].m_aanNewEdge[1][1] == -1 )
                             {
-                                // Find another non-shared edge that
-                                // shares a vertex with the current edge.
-                                for( int i2 = i + 1; i2 < nNumMaps; ++i2 )
+                                // This entry is done, so neither hash can return it.
+                                StartHash.Unlink( i, pMapping );
+                                EndHash.Unlink( i, pMapping );
+
+                                // Find another non-shared edge that shares a vertex
+                                // with the current edge: the first one that starts
+                                // where this edge ends or ends where it starts.
+                                int nFollow = StartHash.FindLowest( pMapping[i].m_anOldEdge[1], pMapping );
+                                int nPrecede = EndHash.FindLowest( pMapping[i].m_anOldEdge[0], pMapping );
+                                int i2 = nFollow;
+                                if( -1 == i2 || ( -1 != nPrecede && nPrecede < i2 ) )
+                                    i2 = nPrecede;
+                                if( -1 != i2 )
                                 {
-                                    if( pMapping[i2].m_anOldEdge[0] != -1 &&       // must have a valid old edge
-                                        pMapping[i2].m_anOldEdge[1] != -1 &&
-                                        ( pMapping[i2].m_aanNewEdge[1][0] == -1 || // must have only one new edge
-                                          pMapping[i2].m_aanNewEdge[1][1] == -1 ) )
+                                    int nVertShared = 0;
+                                    if( pMapping[i2].m_anOldEdge[0] == pMapping[i].m_anOldEdge[1] )
+                                        ++nVertShared;
+                                    if( pMapping[i2].m_anOldEdge[1] == pMapping[i].m_anOldEdge[0] )
+                                        ++nVertShared;
+
+                                    if( 2 == nVertShared )
                                     {
-                                        int nVertShared = 0;
+                                        // These are the last two edges of this particular
+                                        // opening. Mark this edge as shared so that a degenerate
+                                        // quad can be created for it.
+
+                                        StartHash.Unlink( i2, pMapping );
+                                        EndHash.Unlink( i2, pMapping );
+                                        pMapping[i2].m_aanNewEdge[1][0] = pMapping[i].m_aanNewEdge[0][0];
+                                        pMapping[i2].m_aanNewEdge[1][1] = pMapping[i].m_aanNewEdge[0][1];
+                                    }
+                                    else if( 1 == nVertShared )
+                                    {
+                                        // nBefore and nAfter tell us which edge comes before the other.
+                                        int nBefore, nAfter;
                                         if( pMapping[i2].m_anOldEdge[0] == pMapping[i].m_anOldEdge[1] )
-                                            ++nVertShared;
-                                        if( pMapping[i2].m_anOldEdge[1] == pMapping[i].m_anOldEdge[0] )
-                                            ++nVertShared;
-
-                                        if( 2 == nVertShared )
                                         {
-                                            // These are the last two edges of this particular
-                                            // opening. Mark this edge as shared so that a degenerate
-                                            // quad can be created for it.
+                                            nBefore = i;
+                                            nAfter = i2;
+                                        }
+                                        else
+                                        {
+                                            nBefore = i2;
+                                            nAfter = i;
+                                        }
 
-                                            pMapping[i2].m_aanNewEdge[1][0] = pMapping[i].m_aanNewEdge[0][0];
-                                            pMapping[i2].m_aanNewEdge[1][1] = pMapping[i].m_aanNewEdge[0][1];
-                                            break;
+                                        // Found such an edge. Now create a face along with two
+                                        // degenerate quads from these two edges.
+
+                                        pNewVBData[nNextVertex] = pNewVBData[pMapping[nAfter].m_aanNewEdge[0][1]];
+                                        pNewVBData[nNextVertex +
+                                            1] = pNewVBData[pMapping[nBefore].m_aanNewEdge[0][1]];
+                                        pNewVBData[nNextVertex +
+                                            2] = pNewVBData[pMapping[nBefore].m_aanNewEdge[0][0]];
+                                        // Recompute the normal
+                                        D3DXVECTOR3 v1 = pNewVBData[nNextVertex + 1].Position -
+                                            pNewVBData[nNextVertex].Position;
+                                        D3DXVECTOR3 v2 = pNewVBData[nNextVertex + 2].Position -
+                                            pNewVBData[nNextVertex + 1].Position;
+                                        D3DXVec3Normalize( &v1, &v1 );
+                                        D3DXVec3Normalize( &v2, &v2 );
+                                        D3DXVec3Cross( &pNewVBData[nNextVertex].Normal, &v1, &v2 );
+                                        pNewVBData[nNextVertex + 1].Normal = pNewVBData[nNextVertex +
+                                            2].Normal = pNewVBData[nNextVertex].Normal;
+
+                                        pdwNewIBData[nNextIndex] = nNextVertex;
+                                        pdwNewIBData[nNextIndex + 1] = nNextVertex + 1;
+                                        pdwNewIBData[nNextIndex + 2] = nNextVertex + 2;
+
+                                        // 1st quad
+
+                                        pdwNewIBData[nNextIndex + 3] = pMapping[nBefore].m_aanNewEdge[0][1];
+                                        pdwNewIBData[nNextIndex + 4] = pMapping[nBefore].m_aanNewEdge[0][0];
+                                        pdwNewIBData[nNextIndex + 5] = nNextVertex + 1;
+
+                                        pdwNewIBData[nNextIndex + 6] = nNextVertex + 2;
+                                        pdwNewIBData[nNextIndex + 7] = nNextVertex + 1;
+                                        pdwNewIBData[nNextIndex + 8] = pMapping[nBefore].m_aanNewEdge[0][0];
+
+                                        // 2nd quad
+
+                                        pdwNewIBData[nNextIndex + 9] = pMapping[nAfter].m_aanNewEdge[0][1];
+                                        pdwNewIBData[nNextIndex + 10] = pMapping[nAfter].m_aanNewEdge[0][0];
+                                        pdwNewIBData[nNextIndex + 11] = nNextVertex;
+
+                                        pdwNewIBData[nNextIndex + 12] = nNextVertex + 1;
+                                        pdwNewIBData[nNextIndex + 13] = nNextVertex;
+                                        pdwNewIBData[nNextIndex + 14] = pMapping[nAfter].m_aanNewEdge[0][0];
+
+                                        // Modify mapping entry i2 to reflect the third edge
+                                        // of the newly added face.  Its key in one of the
+                                        // hashes changes with it.
+
+                                        if( pMapping[i2].m_anOldEdge[0] == pMapping[i].m_anOldEdge[1] )
+                                        {
+                                            StartHash.Unlink( i2, pMapping );
+                                            pMapping[i2].m_anOldEdge[0] = pMapping[i].m_anOldEdge[0];
+                                            StartHash.Insert( i2, pMapping );
                                         }
-                                        else if( 1 == nVertShared )
+                                        else
                                         {
-                                            // nBefore and nAfter tell us which edge comes before the other.
-                                            int nBefore, nAfter;
-                                            if( pMapping[i2].m_anOldEdge[0] == pMapping[i].m_anOldEdge[1] )
-                                            {
-                                                nBefore = i;
-                                                nAfter = i2;
-                                            }
-                                            else
-                                            {
-                                                nBefore = i2;
-                                                nAfter = i;
-                                            }
-
-                                            // Found such an edge. Now create a face along with two
-                                            // degenerate quads from these two edges.
-
-                                            pNewVBData[nNextVertex] = pNewVBData[pMapping[nAfter].m_aanNewEdge[0][1]];
-                                            pNewVBData[nNextVertex +
-                                                1] = pNewVBData[pMapping[nBefore].m_aanNewEdge[0][1]];
-                                            pNewVBData[nNextVertex +
-                                                2] = pNewVBData[pMapping[nBefore].m_aanNewEdge[0][0]];
-                                            // Recompute the normal
-                                            D3DXVECTOR3 v1 = pNewVBData[nNextVertex + 1].Position -
-                                                pNewVBData[nNextVertex].Position;
-                                            D3DXVECTOR3 v2 = pNewVBData[nNextVertex + 2].Position -
-                                                pNewVBData[nNextVertex + 1].Position;
-                                            D3DXVec3Normalize( &v1, &v1 );
-                                            D3DXVec3Normalize( &v2, &v2 );
-                                            D3DXVec3Cross( &pNewVBData[nNextVertex].Normal, &v1, &v2 );
-                                            pNewVBData[nNextVertex + 1].Normal = pNewVBData[nNextVertex +
-                                                2].Normal = pNewVBData[nNextVertex].Normal;
-
-                                            pdwNewIBData[nNextIndex] = nNextVertex;
-                                            pdwNewIBData[nNextIndex + 1] = nNextVertex + 1;
-                                            pdwNewIBData[nNextIndex + 2] = nNextVertex + 2;
-
-                                            // 1st quad
-
-                                            pdwNewIBData[nNextIndex + 3] = pMapping[nBefore].m_aanNewEdge[0][1];
-                                            pdwNewIBData[nNextIndex + 4] = pMapping[nBefore].m_aanNewEdge[0][0];
-                                            pdwNewIBData[nNextIndex + 5] = nNextVertex + 1;
-
-                                            pdwNewIBData[nNextIndex + 6] = nNextVertex + 2;
-                                            pdwNewIBData[nNextIndex + 7] = nNextVertex + 1;
-                                            pdwNewIBData[nNextIndex + 8] = pMapping[nBefore].m_aanNewEdge[0][0];
-
-                                            // 2nd quad
-
-                                            pdwNewIBData[nNextIndex + 9] = pMapping[nAfter].m_aanNewEdge[0][1];
-                                            pdwNewIBData[nNextIndex + 10] = pMapping[nAfter].m_aanNewEdge[0][0];
-                                            pdwNewIBData[nNextIndex + 11] = nNextVertex;
-
-                                            pdwNewIBData[nNextIndex + 12] = nNextVertex + 1;
-                                            pdwNewIBData[nNextIndex + 13] = nNextVertex;
-                                            pdwNewIBData[nNextIndex + 14] = pMapping[nAfter].m_aanNewEdge[0][0];
-
-                                            // Modify mapping entry i2 to reflect the third edge
-                                            // of the newly added face.
-
-                                            if( pMapping[i2].m_anOldEdge[0] == pMapping[i].m_anOldEdge[1] )
-                                            {
-                                                pMapping[i2].m_anOldEdge[0] = pMapping[i].m_anOldEdge[0];
-                                            }
-                                            else
-                                            {
-                                                pMapping[i2].m_anOldEdge[1] = pMapping[i].m_anOldEdge[1];
-                                            }
-                                            pMapping[i2].m_aanNewEdge[0][0] = nNextVertex + 2;
-                                            pMapping[i2].m_aanNewEdge[0][1] = nNextVertex;
-
-                                            // Update next vertex/index positions
-
-                                            nNextVertex += 3;
-                                            nNextIndex += 15;
-
-                                            break;
+                                            EndHash.Unlink( i2, pMapping );
+                                            pMapping[i2].m_anOldEdge[1] = pMapping[i].m_anOldEdge[1];
+                                            EndHash.Insert( i2, pMapping );
                                         }
+                                        pMapping[i2].m_aanNewEdge[0][0] = nNextVertex + 2;
+                                        pMapping[i2].m_aanNewEdge[0][1] = nNextVertex;
+
+                                        // Update next vertex/index positions
+
+                                        nNextVertex += 3;
+                                        nNextIndex += 15;
                                     }
                                 }
                             }
@@ -749,7 +792,7 @@ cleanup:;
                     ID3DXMesh* pFinalMesh;
                     hr = D3DXCreateMesh( nNextIndex / 3,  // Exact number of faces
                                          ( pInputMesh->GetNumFaces() + nNumMaps ) * 3,
-                                         D3DXMESH_WRITEONLY | ( bNeed32Bit ? D3DXMESH_32BIT : 0 ),
+                                         D3DXMESH_WRITEONLY | ( bNeed32Bit ? D3DXMESH_32BIT : 0 ) | dwOptions,
                                          SHADOWVERT::Decl,
                                          pd3dDevice,
                                          &pFinalMesh );
@@ -797,10 +840,12 @@ cleanup:;
                 else
                     pNewMesh->Release();
             }
-            delete[] pMapping;
         }
         else
             hr = E_OUTOFMEMORY;
+
+        delete[] pMapping;
+        delete[] pnQuads;
     }
     else
         hr = E_FAIL;
@@ -818,6 +863,52 @@ cleanup:;
 }
 
 
+
+//--------------------------------------------------------------------------------------
+// Offline path for asset pipelines.  Loads strMeshFile, generates its shadow volume mesh
+// and writes that to strOutFile as a binary .x file.  A NULLREF device is enough for the
+// D3DX mesh work, so no window or rendering capable adapter is needed.
+HRESULT GenerateShadowMeshFile( LPCWSTR strMeshFile, LPCWSTR strOutFile )
+{
+    HRESULT hr;
+
+    IDirect3D9* pD3D = Direct3DCreate9( D3D_SDK_VERSION );
+    if( !pD3D )
+        return E_FAIL;
+
+    D3DPRESENT_PARAMETERS pp;
+    ZeroMemory( &pp, sizeof( pp ) );
+    pp.BackBufferWidth = 1;
+    pp.BackBufferHeight = 1;
+    pp.BackBufferFormat = D3DFMT_UNKNOWN;
+    pp.SwapEffect = D3DSWAPEFFECT_DISCARD;
+    pp.Windowed = TRUE;
+
+    IDirect3DDevice9* pd3dDevice = NULL;
+    hr = pD3D->CreateDevice( D3DADAPTER_DEFAULT, D3DDEVTYPE_NULLREF, GetDesktopWindow(),
+                             D3DCREATE_SOFTWARE_VERTEXPROCESSING, &pp, &pd3dDevice );
+    pD3D->Release();
+    if( FAILED( hr ) )
+        return hr;
+
+    ID3DXMesh* pMesh = NULL;
+    hr = D3DXLoadMeshFromX( strMeshFile, D3DXMESH_SYSTEMMEM, pd3dDevice, NULL, NULL, NULL, NULL, &pMesh );
+    if( SUCCEEDED( hr ) )
+    {
+        ID3DXMesh* pShadowMesh = NULL;
+        hr = GenerateShadowMesh( pd3dDevice, pMesh, &pShadowMesh, D3DXMESH_SYSTEMMEM );
+        if( SUCCEEDED( hr ) )
+        {
+            hr = D3DXSaveMeshToX( strOutFile, pShadowMesh, NULL, NULL, NULL, 0, D3DXF_FILEFORMAT_BINARY );
+            pShadowMesh->Release();
+        }
+        pMesh->Release();
+    }
+
+    pd3dDevice->Release();
+    return hr;
+}
+
 //--------------------------------------------------------------------------------------
 // Entry point to the program. Initializes everything and goes into a message processing
 // loop. Idle time is used to render the scene.
@@ -829,6 +920,17 @@ INT WINAPI wWinMain( HINSTANCE, HINSTANCE, LPWSTR, int )
     _CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+    // "ShadowVolume -genshadowmesh <mesh.x> <shadow.x>" runs the offline path and exits
+    int nArgs = 0;
+    LPWSTR* pstrArgs = CommandLineToArgvW( GetCommandLineW(), &nArgs );
+    if( pstrArgs && nArgs == 4 && !_wcsicmp( pstrArgs[1], L"-genshadowmesh" ) )
+    {
+        HRESULT hr = GenerateShadowMeshFile( pstrArgs[2], pstrArgs[3] );
+        LocalFree( pstrArgs );
+        return SUCCEEDED( hr ) ? 0 : 1;
+    }
+    LocalFree( pstrArgs );
+
     // Set the callback functions. These functions allow DXUT to notify
     // the application about device changes, user input, and windows messages.  The
     // callbacks are optional so you need only set callbacks for events you're interested
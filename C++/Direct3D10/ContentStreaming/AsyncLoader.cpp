@@ -10,6 +10,7 @@
 #include "SDKMisc.h"
 #include "AsyncLoader.h"
 #include "ContentLoaders.h"
+#include "UploadScheduler.h"
 #include <process.h>
 
 //--------------------------------------------------------------------------------------
@@ -39,7 +40,7 @@ void WarmIOCache( BYTE* pData, SIZE_T size )
 {
     // read one byte in every 4k page in order to force all of the pages to load
     SIZE_T start = 0;
-    BYTE byteTemp = 0;
+    volatile BYTE byteTemp = 0;
 
     while( start < size )
     {
@@ -48,14 +49,158 @@ void WarmIOCache( BYTE* pData, SIZE_T size )
     }
 }
 
+//--------------------------------------------------------------------------------------
+CRequestRing::CRequestRing() : m_pCells( NULL ),
+                               m_Mask( 0 ),
+                               m_EnqueuePos( 0 ),
+                               m_DequeuePos( 0 )
+{
+}
+
+//--------------------------------------------------------------------------------------
+CRequestRing::~CRequestRing()
+{
+    SAFE_DELETE_ARRAY( m_pCells );
+}
+
+//--------------------------------------------------------------------------------------
+// Capacity must be a power of 2
+//--------------------------------------------------------------------------------------
+bool CRequestRing::Init( UINT Capacity )
+{
+    m_pCells = new REQUEST_CELL[ Capacity ];
+    if( !m_pCells )
+        return false;
+
+    for( UINT i = 0; i < Capacity; i++ )
+        m_pCells[i].Sequence = ( LONG )i;
+    m_Mask = ( LONG )Capacity - 1;
+    m_EnqueuePos = 0;
+    m_DequeuePos = 0;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Claims the cell at the enqueue position, fills it, then publishes it by advancing its
+// sequence number.  Returns false if the ring is full.
+//--------------------------------------------------------------------------------------
+bool CRequestRing::Push( const RESOURCE_REQUEST& Request )
+{
+    REQUEST_CELL* pCell;
+    LONG Pos = m_EnqueuePos;
+    for(; ; )
+    {
+        pCell = &m_pCells[Pos & m_Mask];
+        LONG Dif = pCell->Sequence - Pos;
+        if( 0 == Dif )
+        {
+            if( Pos == InterlockedCompareExchange( &m_EnqueuePos, Pos + 1, Pos ) )
+                break;
+            Pos = m_EnqueuePos;
+        }
+        else if( Dif < 0 )
+        {
+            // The consumers haven't freed this cell from the last lap
+            return false;
+        }
+        else
+        {
+            Pos = m_EnqueuePos;
+        }
+    }
+
+    pCell->Request = Request;
+    InterlockedExchange( &pCell->Sequence, Pos + 1 );
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Returns false if the ring is empty, or if the next cell has been claimed by a producer
+// that hasn't published it yet.
+//--------------------------------------------------------------------------------------
+bool CRequestRing::Pop( RESOURCE_REQUEST* pRequest )
+{
+    REQUEST_CELL* pCell;
+    LONG Pos = m_DequeuePos;
+    for(; ; )
+    {
+        pCell = &m_pCells[Pos & m_Mask];
+        LONG Dif = pCell->Sequence - ( Pos + 1 );
+        if( 0 == Dif )
+        {
+            if( Pos == InterlockedCompareExchange( &m_DequeuePos, Pos + 1, Pos ) )
+                break;
+            Pos = m_DequeuePos;
+        }
+        else if( Dif < 0 )
+        {
+            return false;
+        }
+        else
+        {
+            Pos = m_DequeuePos;
+        }
+    }
+
+    *pRequest = pCell->Request;
+    InterlockedExchange( &pCell->Sequence, Pos + m_Mask + 1 );
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// The size is only a snapshot when other threads are pushing or popping
+//--------------------------------------------------------------------------------------
+UINT CRequestRing::GetSize()
+{
+    LONG Size = m_EnqueuePos - m_DequeuePos;
+    return ( Size > 0 ) ? ( UINT )Size : 0;
+}
+
+//--------------------------------------------------------------------------------------
+bool CRequestQueue::Init( UINT Capacity )
+{
+    for( UINT i = 0; i < NUM_LOADER_PRIORITIES; i++ )
+    {
+        if( !m_Rings[i].Init( Capacity ) )
+            return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+bool CRequestQueue::Push( const RESOURCE_REQUEST& Request )
+{
+    return m_Rings[ min( Request.Priority, ( UINT )LOADER_PRIORITY_LOWEST ) ].Push( Request );
+}
+
+//--------------------------------------------------------------------------------------
+bool CRequestQueue::Pop( RESOURCE_REQUEST* pRequest )
+{
+    for( UINT i = 0; i < NUM_LOADER_PRIORITIES; i++ )
+    {
+        if( m_Rings[i].Pop( pRequest ) )
+            return true;
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------------------------
+UINT CRequestQueue::GetSize()
+{
+    UINT Size = 0;
+    for( UINT i = 0; i < NUM_LOADER_PRIORITIES; i++ )
+        Size += m_Rings[i].GetSize();
+    return Size;
+}
+
 //--------------------------------------------------------------------------------------
 CAsyncLoader::CAsyncLoader( UINT NumProcessingThreads ) : m_bDone( false ),
-                                                          m_bProcessThreadDone( false ),
-                                                          m_bIOThreadDone( false ),
                                                           m_NumResourcesToService( 0 ),
                                                           m_NumOustandingResources( 0 ),
                                                           m_hIOQueueSemaphore( 0 ),
                                                           m_hProcessQueueSemaphore( 0 ),
+                                                          m_hRenderThreadQueueEvent( 0 ),
                                                           m_hIOThread( 0 ),
                                                           m_NumProcessingThreads( 0 ),
                                                           m_phProcessThreads( NULL )
@@ -63,6 +208,11 @@ CAsyncLoader::CAsyncLoader( UINT NumProcessingThreads ) : m_bDone( false ),
     InitAsyncLoadingThreadObjects( NumProcessingThreads );
     m_NumIORequests = 0;
     m_NumProcessRequests = 0;
+    m_NumCancelledRequests = 0;
+    m_NumMergedRequests = 0;
+    ZeroMemory( m_pInFlight, sizeof( m_pInFlight ) );
+    ZeroMemory( &m_HeldRequest, sizeof( m_HeldRequest ) );
+    m_bHasHeldRequest = false;
 }
 
 //--------------------------------------------------------------------------------------
@@ -72,58 +222,235 @@ CAsyncLoader::~CAsyncLoader()
 }
 
 //--------------------------------------------------------------------------------------
-// Add a work item to the queue of work items
+// Add a work item to the queue of work items.  Requests with a lower Priority value are
+// read, processed and handed to the graphics thread before the others.
+//
+// If a request for the same ppDeviceObject is still in flight, the two are merged: the
+// new loader and processor are deleted and the pending request is resumed if it was
+// cancelled.  If phRequest is not NULL it receives a handle to the request, which must
+// be released with ReleaseWorkItem.  This must be called from the graphics thread.
 //--------------------------------------------------------------------------------------
 HRESULT CAsyncLoader::AddWorkItem( IDataLoader* pDataLoader, IDataProcessor* pDataProcessor, HRESULT* pHResult,
-                                   void** ppDeviceObject )
+                                   void** ppDeviceObject, UINT Priority, HASYNCREQUEST* phRequest )
 {
+    if( phRequest )
+        *phRequest = NULL;
     if( !pDataLoader || !pDataProcessor )
         return E_INVALIDARG;
 
+    // Merge with a request that's already loading into the same object
+    ASYNC_REQUEST_STATUS* pInFlight = ppDeviceObject ? m_pInFlight[ FindInFlight( ppDeviceObject ) ] : NULL;
+    if( pInFlight )
+    {
+        InterlockedCompareExchange( &pInFlight->State, ASYNC_REQUEST_ACTIVE, ASYNC_REQUEST_CANCEL_PENDING );
+        if( ASYNC_REQUEST_ACTIVE == pInFlight->State )
+        {
+            delete pDataLoader;
+            delete pDataProcessor;
+            m_NumMergedRequests ++;
+
+            if( phRequest )
+            {
+                InterlockedIncrement( &pInFlight->RefCount );
+                *phRequest = pInFlight;
+            }
+            return S_FALSE;
+        }
+
+        // It has already been dropped, it's retired without touching ppDeviceObject
+        RemoveInFlight( pInFlight );
+    }
+
+    // Every queue is as large as the number of outstanding requests, so once a request
+    // is admitted here it can always move on to the next queue
+    if( InterlockedIncrement( &m_NumOustandingResources ) > MAX_ASYNC_REQUESTS )
+    {
+        InterlockedDecrement( &m_NumOustandingResources );
+        return E_OUTOFMEMORY;
+    }
+
+    ASYNC_REQUEST_STATUS* pStatus = new ASYNC_REQUEST_STATUS;
+    if( !pStatus )
+    {
+        InterlockedDecrement( &m_NumOustandingResources );
+        return E_OUTOFMEMORY;
+    }
+    pStatus->RefCount = phRequest ? 2 : 1;
+    pStatus->State = ASYNC_REQUEST_ACTIVE;
+    pStatus->ppDeviceObject = ppDeviceObject;
+    if( ppDeviceObject )
+        m_pInFlight[ FindInFlight( ppDeviceObject ) ] = pStatus;
+
     RESOURCE_REQUEST ResourceRequest;
     ResourceRequest.pDataLoader = pDataLoader;
     ResourceRequest.pDataProcessor = pDataProcessor;
     ResourceRequest.pHR = pHResult;
     ResourceRequest.ppDeviceObject = ppDeviceObject;
+    ResourceRequest.pStatus = pStatus;
+    ResourceRequest.Priority = min( Priority, ( UINT )LOADER_PRIORITY_LOWEST );
     ResourceRequest.bCopy = false;
     ResourceRequest.bLock = false;
+    ResourceRequest.bLocked = false;
+    ResourceRequest.bCancelled = false;
     ResourceRequest.bError = false;
     if( ppDeviceObject )
         *ppDeviceObject = NULL;
 
     // Add the request to the read queue
-    EnterCriticalSection( &m_csIOQueue );
-    m_IOQueue.Add( ResourceRequest );
-    LeaveCriticalSection( &m_csIOQueue );
-
-    // TODO: critsec around this?
-    m_NumOustandingResources ++;
+    m_IOQueue.Push( ResourceRequest );
 
     // Signal that we have something to read
     ReleaseSemaphore( m_hIOQueueSemaphore, 1, NULL );
 
+    if( phRequest )
+        *phRequest = pStatus;
     return S_OK;
 }
 
 //--------------------------------------------------------------------------------------
-// Wait for all work in the queues to finish
+// Asks the loader to drop a request.  Whichever stage the request reaches next skips
+// its work, and a device object it already locked goes back to the reuse cache.  Once
+// IsWorkItemFinished returns true, *ppDeviceObject is either still NULL or holds the
+// object if the request got past its last stage before it could be cancelled.
 //--------------------------------------------------------------------------------------
-void CAsyncLoader::WaitForAllItems()
+void CAsyncLoader::CancelWorkItem( HASYNCREQUEST hRequest )
+{
+    if( hRequest )
+        InterlockedCompareExchange( &hRequest->State, ASYNC_REQUEST_CANCEL_PENDING, ASYNC_REQUEST_ACTIVE );
+}
+
+//--------------------------------------------------------------------------------------
+bool CAsyncLoader::IsWorkItemFinished( HASYNCREQUEST hRequest )
+{
+    return ( !hRequest || ASYNC_REQUEST_FINISHED == hRequest->State );
+}
+
+//--------------------------------------------------------------------------------------
+void CAsyncLoader::ReleaseWorkItem( HASYNCREQUEST hRequest )
+{
+    if( hRequest && 0 == InterlockedDecrement( &hRequest->RefCount ) )
+        delete hRequest;
+}
+
+//--------------------------------------------------------------------------------------
+UINT CAsyncLoader::GetNumCancelledRequests()
+{
+    return ( UINT )m_NumCancelledRequests;
+}
+
+//--------------------------------------------------------------------------------------
+UINT CAsyncLoader::GetNumMergedRequests()
+{
+    return m_NumMergedRequests;
+}
+
+//--------------------------------------------------------------------------------------
+// Called by each stage before doing any work on a request.  A pending cancel is only
+// acted on once; after that the request can't be resumed.
+//--------------------------------------------------------------------------------------
+bool CAsyncLoader::CheckCancelled( RESOURCE_REQUEST* pRequest )
+{
+    if( !pRequest->bCancelled &&
+        ASYNC_REQUEST_CANCEL_PENDING == InterlockedCompareExchange( &pRequest->pStatus->State,
+                                                                    ASYNC_REQUEST_CANCELLED,
+                                                                    ASYNC_REQUEST_CANCEL_PENDING ) )
+    {
+        pRequest->bCancelled = true;
+        InterlockedIncrement( &m_NumCancelledRequests );
+    }
+
+    return pRequest->bCancelled;
+}
+
+//--------------------------------------------------------------------------------------
+// Frees a request that has gone through the pipeline, or was dropped along the way.
+// Graphics thread only.
+//--------------------------------------------------------------------------------------
+void CAsyncLoader::RetireRequest( RESOURCE_REQUEST* pRequest )
+{
+    // A cancelled request that got as far as locking has to give the object back
+    if( pRequest->bCancelled && pRequest->bLocked && !pRequest->bError )
+        pRequest->pDataProcessor->CancelDeviceObject();
+
+    SAFE_DELETE( pRequest->pDataLoader );
+    SAFE_DELETE( pRequest->pDataProcessor );
+
+    RemoveInFlight( pRequest->pStatus );
+    InterlockedExchange( &pRequest->pStatus->State, ASYNC_REQUEST_FINISHED );
+    ReleaseWorkItem( pRequest->pStatus );
+
+    // Decrement num oustanding resources
+    InterlockedDecrement( &m_NumOustandingResources );
+}
+
+//--------------------------------------------------------------------------------------
+// The in-flight table is open addressed with linear probing.  Returns the bucket that
+// holds ppDeviceObject, or the empty bucket where it would go.
+//--------------------------------------------------------------------------------------
+UINT CAsyncLoader::FindInFlight( void** ppDeviceObject )
 {
-    ProcessDeviceWorkItems( UINT_MAX, FALSE );
+    UINT_PTR Key = ( UINT_PTR )ppDeviceObject;
+    UINT iBucket = ( UINT )( ( Key >> 3 ) * 2654435761u ) & ( IN_FLIGHT_BUCKETS - 1 );
+    while( m_pInFlight[iBucket] && m_pInFlight[iBucket]->ppDeviceObject != ppDeviceObject )
+        iBucket = ( iBucket + 1 ) & ( IN_FLIGHT_BUCKETS - 1 );
 
+    return iBucket;
+}
+
+//--------------------------------------------------------------------------------------
+// Removes pStatus if it is still the request in flight for its object, then shifts the
+// following entries back so lookups never stop early.
+//--------------------------------------------------------------------------------------
+void CAsyncLoader::RemoveInFlight( ASYNC_REQUEST_STATUS* pStatus )
+{
+    if( !pStatus->ppDeviceObject )
+        return;
+
+    UINT iBucket = FindInFlight( pStatus->ppDeviceObject );
+    if( m_pInFlight[iBucket] != pStatus )
+        return;
+
+    m_pInFlight[iBucket] = NULL;
+    UINT iNext = ( iBucket + 1 ) & ( IN_FLIGHT_BUCKETS - 1 );
+    while( m_pInFlight[iNext] )
+    {
+        ASYNC_REQUEST_STATUS* pMove = m_pInFlight[iNext];
+        m_pInFlight[iNext] = NULL;
+        m_pInFlight[ FindInFlight( pMove->ppDeviceObject ) ] = pMove;
+        iNext = ( iNext + 1 ) & ( IN_FLIGHT_BUCKETS - 1 );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Wait for all work in the queues to finish.  The graphics thread sleeps until one of
+// the loading threads hands it something to lock or unlock.
+//--------------------------------------------------------------------------------------
+void CAsyncLoader::WaitForAllItems()
+{
     for(; ; )
     {
+        // Service Queues
+        ProcessDeviceWorkItems( UINT_MAX, FALSE );
+
         // Only exit when all resources are loaded
         if( 0 == m_NumOustandingResources )
             return;
 
-        // Service Queues
-        ProcessDeviceWorkItems( UINT_MAX, FALSE );
-        Sleep( 100 );
+        WaitForSingleObject( m_hRenderThreadQueueEvent, INFINITE );
     }
 }
 
+//--------------------------------------------------------------------------------------
+// The queue semaphores count published requests, so a thread that acquired one will
+// find a request.  It may have to wait for a producer that claimed an earlier cell to
+// finish publishing it.
+//--------------------------------------------------------------------------------------
+void CAsyncLoader::PopWaitingRequest( CRequestQueue* pQueue, RESOURCE_REQUEST* pRequest )
+{
+    while( !pQueue->Pop( pRequest ) )
+        SwitchToThread();
+}
+
 //--------------------------------------------------------------------------------------
 // FileIOThreadProc
 //
@@ -139,7 +466,6 @@ unsigned int CAsyncLoader::FileIOThreadProc()
 {
     WCHAR szMessage[MAX_PATH];
     HRESULT hr = S_OK;
-    m_bIOThreadDone = false;
 
     RESOURCE_REQUEST ResourceRequest = {0};
 
@@ -150,17 +476,23 @@ unsigned int CAsyncLoader::FileIOThreadProc()
         if( m_bDone )
             break;
 
-        m_NumIORequests ++;
+        InterlockedIncrement( &m_NumIORequests );
 
-        // Pop a request off of the IOQueue
-        EnterCriticalSection( &m_csIOQueue );
-        ResourceRequest = m_IOQueue.GetAt( 0 );
-        m_IOQueue.Remove( 0 );
-        LeaveCriticalSection( &m_csIOQueue );
+        // Pop the most important request off of the IOQueue
+        PopWaitingRequest( &m_IOQueue, &ResourceRequest );
 
         // Handle a read request
         if( !ResourceRequest.bCopy )
         {
+            if( CheckCancelled( &ResourceRequest ) )
+            {
+                // Nothing has been done yet, send it straight back to be retired
+                ResourceRequest.bLock = false;
+                m_RenderThreadQueue.Push( ResourceRequest );
+                SetEvent( m_hRenderThreadQueueEvent );
+                continue;
+            }
+
             if( !ResourceRequest.bError )
             {
                 // Load the data
@@ -178,9 +510,7 @@ unsigned int CAsyncLoader::FileIOThreadProc()
             }
 
             // Add it to the ProcessQueue
-            EnterCriticalSection( &m_csProcessQueue );
-            m_ProcessQueue.Add( ResourceRequest );
-            LeaveCriticalSection( &m_csProcessQueue );
+            m_ProcessQueue.Push( ResourceRequest );
 
             // Let the process thread know it's got work to do
             ReleaseSemaphore( m_hProcessQueueSemaphore, 1, NULL );
@@ -189,7 +519,11 @@ unsigned int CAsyncLoader::FileIOThreadProc()
             // Handle a copy request
         else
         {
-            if( !ResourceRequest.bError )
+            if( CheckCancelled( &ResourceRequest ) )
+            {
+                // Skip the copy, the graphics thread gives the object back
+            }
+            else if( !ResourceRequest.bError )
             {
                 // Create the data
                 hr = ResourceRequest.pDataProcessor->CopyToResource();
@@ -210,12 +544,10 @@ unsigned int CAsyncLoader::FileIOThreadProc()
 
             // send an unlock request
             ResourceRequest.bLock = false;
-            EnterCriticalSection( &m_csRenderThreadQueue );
-            m_RenderThreadQueue.Add( ResourceRequest );
-            LeaveCriticalSection( &m_csRenderThreadQueue );
+            m_RenderThreadQueue.Push( ResourceRequest );
+            SetEvent( m_hRenderThreadQueueEvent );
         }
     }
-    m_bIOThreadDone = true;
     return 0;
 }
 
@@ -232,7 +564,6 @@ unsigned int CAsyncLoader::ProcessingThreadProc()
     WCHAR szMessage[MAX_PATH];
 
     HRESULT hr = S_OK;
-    m_bProcessThreadDone = false;
     while( !m_bDone )
     {
         // Acquire ProcessQueueSemaphore
@@ -240,13 +571,21 @@ unsigned int CAsyncLoader::ProcessingThreadProc()
         if( m_bDone )
             break;
 
-        m_NumProcessRequests ++;
+        InterlockedIncrement( &m_NumProcessRequests );
 
-        // Pop a request off of the ProcessQueue
-        EnterCriticalSection( &m_csProcessQueue );
-        RESOURCE_REQUEST ResourceRequest = m_ProcessQueue.GetAt( 0 );
-        m_ProcessQueue.Remove( 0 );
-        LeaveCriticalSection( &m_csProcessQueue );
+        // Pop the most important request off of the ProcessQueue
+        RESOURCE_REQUEST ResourceRequest;
+        PopWaitingRequest( &m_ProcessQueue, &ResourceRequest );
+        hr = S_OK;
+
+        if( CheckCancelled( &ResourceRequest ) )
+        {
+            // Don't bother decompressing, just retire it
+            ResourceRequest.bLock = false;
+            m_RenderThreadQueue.Push( ResourceRequest );
+            SetEvent( m_hRenderThreadQueueEvent );
+            continue;
+        }
 
         // Decompress the data
         if( !ResourceRequest.bError )
@@ -273,11 +612,9 @@ unsigned int CAsyncLoader::ProcessingThreadProc()
 
         // Add it to the RenderThreadQueue
         ResourceRequest.bLock = true;
-        EnterCriticalSection( &m_csRenderThreadQueue );
-        m_RenderThreadQueue.Add( ResourceRequest );
-        LeaveCriticalSection( &m_csRenderThreadQueue );
+        m_RenderThreadQueue.Push( ResourceRequest );
+        SetEvent( m_hRenderThreadQueueEvent );
     }
-    m_bProcessThreadDone = true;
     return 0;
 }
 
@@ -289,14 +626,18 @@ bool CAsyncLoader::InitAsyncLoadingThreadObjects( UINT NumProcessingThreads )
 {
     LONG MaxSemaphoreCount = LONG_MAX;
 
-    // Create 2 semaphores
+    // Create 2 semaphores and the event the graphics thread waits on
     m_hIOQueueSemaphore = CreateSemaphore( NULL, 0, MaxSemaphoreCount, NULL );
     m_hProcessQueueSemaphore = CreateSemaphore( NULL, 0, MaxSemaphoreCount, NULL );
+    m_hRenderThreadQueueEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if( !m_hIOQueueSemaphore || !m_hProcessQueueSemaphore || !m_hRenderThreadQueueEvent )
+        return false;
 
-    // Create the queue critical sections
-    InitializeCriticalSection( &m_csIOQueue );
-    InitializeCriticalSection( &m_csProcessQueue );
-    InitializeCriticalSection( &m_csRenderThreadQueue );
+    // Create the queues
+    if( !m_IOQueue.Init( MAX_ASYNC_REQUESTS ) ||
+        !m_ProcessQueue.Init( MAX_ASYNC_REQUESTS ) ||
+        !m_RenderThreadQueue.Init( MAX_ASYNC_REQUESTS ) )
+        return false;
 
     // Create the Processing threads
     m_NumProcessingThreads = NumProcessingThreads;
@@ -326,25 +667,105 @@ void CAsyncLoader::DestroyAsyncLoadingThreadObjects()
 {
     m_bDone = true;
 
-    ReleaseSemaphore( m_hIOQueueSemaphore, 1, NULL );
-    ReleaseSemaphore( m_hProcessQueueSemaphore, 1, NULL );
+    // Wake up every thread so it sees m_bDone
+    if( m_hIOQueueSemaphore )
+        ReleaseSemaphore( m_hIOQueueSemaphore, 1, NULL );
+    if( m_hProcessQueueSemaphore )
+        ReleaseSemaphore( m_hProcessQueueSemaphore, m_NumProcessingThreads, NULL );
+
+    if( m_hIOThread )
+    {
+        WaitForSingleObject( m_hIOThread, INFINITE );
+        CloseHandle( m_hIOThread );
+    }
+
+    if( m_phProcessThreads )
+    {
+        for( UINT i = 0; i < m_NumProcessingThreads; i++ )
+        {
+            if( m_phProcessThreads[i] )
+            {
+                WaitForSingleObject( m_phProcessThreads[i], INFINITE );
+                CloseHandle( m_phProcessThreads[i] );
+            }
+        }
+    }
+    SAFE_DELETE_ARRAY( m_phProcessThreads );
+
+    if( m_hIOQueueSemaphore )
+        CloseHandle( m_hIOQueueSemaphore );
+    if( m_hProcessQueueSemaphore )
+        CloseHandle( m_hProcessQueueSemaphore );
+    if( m_hRenderThreadQueueEvent )
+        CloseHandle( m_hRenderThreadQueueEvent );
+}
 
-    while( !m_bIOThreadDone || !m_bProcessThreadDone )
+//--------------------------------------------------------------------------------------
+// Locks or unlocks the device object of one request from the render thread queue.
+// Returns false if the object couldn't be locked yet and the request should be tried
+// again later.
+//--------------------------------------------------------------------------------------
+bool CAsyncLoader::ServiceDeviceWorkItem( RESOURCE_REQUEST* pRequest, BOOL bRetryLoads )
+{
+    HRESULT hr = S_OK;
+
+    if( pRequest->bLock && CheckCancelled( pRequest ) )
     {
-        Sleep( 100 );
+        // Dropped before it took a device object
+        RetireRequest( pRequest );
     }
+    else if( pRequest->bLock )
+    {
+        if( !pRequest->bError )
+        {
+            hr = pRequest->pDataProcessor->LockDeviceObject();
+            if( E_TRYAGAIN == hr && bRetryLoads )
+            {
+                // add it back to the list
+                return false;
+            }
+            else if( FAILED( hr ) )
+            {
+                pRequest->bError = true;
+                if( pRequest->pHR )
+                    *pRequest->pHR = hr;
+            }
+            else
+            {
+                pRequest->bLocked = true;
+            }
+        }
 
-    CloseHandle( m_hIOQueueSemaphore );
-    CloseHandle( m_hProcessQueueSemaphore );
+        pRequest->bCopy = true;
+        m_IOQueue.Push( *pRequest );
 
-    DeleteCriticalSection( &m_csIOQueue );
-    DeleteCriticalSection( &m_csProcessQueue );
-    DeleteCriticalSection( &m_csRenderThreadQueue );
+        // Signal that we have something to copy
+        ReleaseSemaphore( m_hIOQueueSemaphore, 1, NULL );
+    }
+    else
+    {
+        if( !pRequest->bError && !CheckCancelled( pRequest ) )
+        {
+            hr = pRequest->pDataProcessor->UnLockDeviceObject();
+            if( pRequest->pHR )
+                *pRequest->pHR = hr;
+        }
 
-    for( UINT i = 0; i < m_NumProcessingThreads; i++ )
-        CloseHandle( m_phProcessThreads[i] );
+        RetireRequest( pRequest );
+    }
 
-    CloseHandle( m_hIOThread );
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Bytes the request sends to the device when it is serviced.  Only unlocks upload data.
+//--------------------------------------------------------------------------------------
+SIZE_T CAsyncLoader::GetUploadBytes( RESOURCE_REQUEST* pRequest )
+{
+    if( pRequest->bLock || pRequest->bError || pRequest->bCancelled )
+        return 0;
+
+    return pRequest->pDataProcessor->GetUploadBytes();
 }
 
 //--------------------------------------------------------------------------------------
@@ -353,67 +774,60 @@ void CAsyncLoader::DestroyAsyncLoadingThreadObjects()
 // of the arguments is the number of resources to service.  This ensure that no matter
 // how many items are in the queue, the graphics thread doesn't stall trying to process
 // all of them.
+//
+// With a scheduler, servicing also stops once the next request doesn't fit in the
+// frame's byte and time budget.  That request is held and goes first next frame, so a
+// large upload is deferred rather than starved.
 //--------------------------------------------------------------------------------------
-void CAsyncLoader::ProcessDeviceWorkItems( UINT CurrentNumResourcesToService, BOOL bRetryLoads )
+void CAsyncLoader::ProcessDeviceWorkItems( UINT CurrentNumResourcesToService, BOOL bRetryLoads,
+                                           CUploadScheduler* pScheduler )
 {
-    HRESULT hr = S_OK;
+    // Requests that can't be locked yet are held here and requeued at the end, otherwise
+    // a high priority request would be popped again right away
+    CGrowableArray <RESOURCE_REQUEST> RetryRequests;
 
-    EnterCriticalSection( &m_csRenderThreadQueue );
-    UINT numJobs = m_RenderThreadQueue.GetSize();
-    LeaveCriticalSection( &m_csRenderThreadQueue );
+    LARGE_INTEGER liFreq;
+    QueryPerformanceFrequency( &liFreq );
 
+    UINT numJobs = m_RenderThreadQueue.GetSize() + ( m_bHasHeldRequest ? 1 : 0 );
     for( UINT i = 0; i < numJobs && i < CurrentNumResourcesToService; i++ )
     {
-        EnterCriticalSection( &m_csRenderThreadQueue );
-        RESOURCE_REQUEST ResourceRequest = m_RenderThreadQueue.GetAt( 0 );
-        m_RenderThreadQueue.Remove( 0 );
-        LeaveCriticalSection( &m_csRenderThreadQueue );
-
-        if( ResourceRequest.bLock )
+        RESOURCE_REQUEST ResourceRequest;
+        if( m_bHasHeldRequest )
         {
-            if( !ResourceRequest.bError )
-            {
-                hr = ResourceRequest.pDataProcessor->LockDeviceObject();
-                if( E_TRYAGAIN == hr && bRetryLoads )
-                {
-                    // add it back to the list
-                    EnterCriticalSection( &m_csRenderThreadQueue );
-                    m_RenderThreadQueue.Add( ResourceRequest );
-                    LeaveCriticalSection( &m_csRenderThreadQueue );
-
-                    // move on to the next guy
-                    continue;
-                }
-                else if( FAILED( hr ) )
-                {
-                    ResourceRequest.bError = true;
-                    if( ResourceRequest.pHR )
-                        *ResourceRequest.pHR = hr;
-                }
-            }
-
-            ResourceRequest.bCopy = true;
-            EnterCriticalSection( &m_csIOQueue );
-            m_IOQueue.Add( ResourceRequest );
-            LeaveCriticalSection( &m_csIOQueue );
-
-            // Signal that we have something to copy
-            ReleaseSemaphore( m_hIOQueueSemaphore, 1, NULL );
+            ResourceRequest = m_HeldRequest;
+            m_bHasHeldRequest = false;
         }
-        else
+        else if( !m_RenderThreadQueue.Pop( &ResourceRequest ) )
         {
-            if( !ResourceRequest.bError )
+            break;
+        }
+
+        SIZE_T cUploadBytes = 0;
+        if( pScheduler )
+        {
+            cUploadBytes = GetUploadBytes( &ResourceRequest );
+            if( !pScheduler->CanProcess( cUploadBytes ) )
             {
-                hr = ResourceRequest.pDataProcessor->UnLockDeviceObject();
-                if( ResourceRequest.pHR )
-                    *ResourceRequest.pHR = hr;
+                m_HeldRequest = ResourceRequest;
+                m_bHasHeldRequest = true;
+                break;
             }
+        }
 
-            SAFE_DELETE( ResourceRequest.pDataLoader );
-            SAFE_DELETE( ResourceRequest.pDataProcessor );
+        LARGE_INTEGER liStart;
+        LARGE_INTEGER liEnd;
+        QueryPerformanceCounter( &liStart );
 
-            // Decrement num oustanding resources
-            m_NumOustandingResources --;
-        }
+        if( !ServiceDeviceWorkItem( &ResourceRequest, bRetryLoads ) )
+            RetryRequests.Add( ResourceRequest );
+
+        QueryPerformanceCounter( &liEnd );
+        if( pScheduler )
+            pScheduler->OnProcessed( cUploadBytes, ( double )( liEnd.QuadPart - liStart.QuadPart ) /
+                                     ( double )liFreq.QuadPart );
     }
+
+    for( int i = 0; i < RetryRequests.GetSize(); i++ )
+        m_RenderThreadQueue.Push( RetryRequests.GetAt( i ) );
 }
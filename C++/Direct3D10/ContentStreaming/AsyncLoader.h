@@ -19,23 +19,102 @@
 //--------------------------------------------------------------------------------------
 class IDataLoader;
 class IDataProcessor;
+class CUploadScheduler;
 void WarmIOCache( BYTE* pData, SIZE_T size );
 
+//--------------------------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------------------------
+#define MAX_ASYNC_REQUESTS      4096    // outstanding requests, must be a power of 2
+#define NUM_LOADER_PRIORITIES   4
+#define LOADER_PRIORITY_HIGHEST 0
+#define LOADER_PRIORITY_LOWEST  ( NUM_LOADER_PRIORITIES - 1 )
+#define IN_FLIGHT_BUCKETS       ( 2 * MAX_ASYNC_REQUESTS )
+
+enum ASYNC_REQUEST_STATE
+{
+    ASYNC_REQUEST_ACTIVE = 0,
+    ASYNC_REQUEST_CANCEL_PENDING,   // CancelWorkItem was called, the next stage drops it
+    ASYNC_REQUEST_CANCELLED,        // a stage dropped it, it can no longer be resumed
+    ASYNC_REQUEST_FINISHED,         // retired by ProcessDeviceWorkItems
+};
+
 //--------------------------------------------------------------------------------------
 // Structures
 //--------------------------------------------------------------------------------------
+
+// Shared by the loader and the caller of AddWorkItem.  The last one to release it frees it.
+struct ASYNC_REQUEST_STATUS
+{
+    volatile LONG RefCount;
+    volatile LONG State;        // ASYNC_REQUEST_STATE
+    void** ppDeviceObject;
+};
+typedef ASYNC_REQUEST_STATUS* HASYNCREQUEST;
+
 struct RESOURCE_REQUEST
 {
     IDataLoader* pDataLoader;
     IDataProcessor* pDataProcessor;
     HRESULT* pHR;
     void** ppDeviceObject;
+    ASYNC_REQUEST_STATUS* pStatus;
+    UINT Priority;      // LOADER_PRIORITY_HIGHEST is serviced first
     bool bLock;
     bool bCopy;
+    bool bLocked;       // LockDeviceObject succeeded
+    bool bCancelled;
 
     bool bError;
 };
 
+struct REQUEST_CELL
+{
+    volatile LONG Sequence;
+    RESOURCE_REQUEST Request;
+};
+
+//--------------------------------------------------------------------------------------
+// Bounded multi-producer multi-consumer ring of requests.  Push and Pop only use
+// interlocked operations; each cell carries a sequence number that tells producers and
+// consumers whether it is free or filled for the current lap around the ring.
+//--------------------------------------------------------------------------------------
+class CRequestRing
+{
+private:
+    REQUEST_CELL* m_pCells;
+    LONG m_Mask;
+    BYTE m_Pad0[64];
+    volatile LONG m_EnqueuePos;
+    BYTE m_Pad1[64];
+    volatile LONG m_DequeuePos;
+    BYTE m_Pad2[64];
+
+public:
+                                CRequestRing();
+                                ~CRequestRing();
+
+    bool                        Init( UINT Capacity );
+    bool                        Push( const RESOURCE_REQUEST& Request );
+    bool                        Pop( RESOURCE_REQUEST* pRequest );
+    UINT                        GetSize();
+};
+
+//--------------------------------------------------------------------------------------
+// One ring per priority.  Pop always drains the highest priority ring first.
+//--------------------------------------------------------------------------------------
+class CRequestQueue
+{
+private:
+    CRequestRing m_Rings[NUM_LOADER_PRIORITIES];
+
+public:
+    bool                        Init( UINT Capacity );
+    bool                        Push( const RESOURCE_REQUEST& Request );
+    bool                        Pop( RESOURCE_REQUEST* pRequest );
+    UINT                        GetSize();
+};
+
 //--------------------------------------------------------------------------------------
 // Structures
 //--------------------------------------------------------------------------------------
@@ -43,28 +122,40 @@ class CAsyncLoader
 {
 private:
     BOOL m_bDone;
-    BOOL m_bProcessThreadDone;
-    BOOL m_bIOThreadDone;
     UINT m_NumResourcesToService;
-    UINT m_NumOustandingResources;
-    CGrowableArray <RESOURCE_REQUEST> m_IOQueue;
-    CGrowableArray <RESOURCE_REQUEST> m_ProcessQueue;
-    CGrowableArray <RESOURCE_REQUEST> m_RenderThreadQueue;
-    CRITICAL_SECTION m_csIOQueue;
-    CRITICAL_SECTION m_csProcessQueue;
-    CRITICAL_SECTION m_csRenderThreadQueue;
+    volatile LONG m_NumOustandingResources;
+    CRequestQueue m_IOQueue;
+    CRequestQueue m_ProcessQueue;
+    CRequestQueue m_RenderThreadQueue;
     HANDLE m_hIOQueueSemaphore;
     HANDLE m_hProcessQueueSemaphore;
-    HANDLE m_hCopyQueueSemaphore;
+    HANDLE m_hRenderThreadQueueEvent;
     HANDLE m_hIOThread;
     UINT m_NumProcessingThreads;
     HANDLE* m_phProcessThreads;
-    UINT m_NumIORequests;
-    UINT m_NumProcessRequests;
+    volatile LONG m_NumIORequests;
+    volatile LONG m_NumProcessRequests;
+    volatile LONG m_NumCancelledRequests;
+    UINT m_NumMergedRequests;
+
+    // Requests that haven't been retired yet, by ppDeviceObject.  Graphics thread only.
+    ASYNC_REQUEST_STATUS* m_pInFlight[IN_FLIGHT_BUCKETS];
+
+    // Request that didn't fit in the last frame's upload budget.  It goes first next
+    // frame.  Graphics thread only.
+    RESOURCE_REQUEST m_HeldRequest;
+    bool m_bHasHeldRequest;
 
 private:
     unsigned int                FileIOThreadProc();
     unsigned int                ProcessingThreadProc();
+    void                        PopWaitingRequest( CRequestQueue* pQueue, RESOURCE_REQUEST* pRequest );
+    bool                        CheckCancelled( RESOURCE_REQUEST* pRequest );
+    bool                        ServiceDeviceWorkItem( RESOURCE_REQUEST* pRequest, BOOL bRetryLoads );
+    SIZE_T                      GetUploadBytes( RESOURCE_REQUEST* pRequest );
+    void                        RetireRequest( RESOURCE_REQUEST* pRequest );
+    UINT                        FindInFlight( void** ppDeviceObject );
+    void                        RemoveInFlight( ASYNC_REQUEST_STATUS* pStatus );
     bool                        InitAsyncLoadingThreadObjects( UINT NumProcessingThreads );
     void                        DestroyAsyncLoadingThreadObjects();
 
@@ -76,9 +167,17 @@ public:
                                 ~CAsyncLoader();
 
     HRESULT                     AddWorkItem( IDataLoader* pDataLoader, IDataProcessor* pDataProcessor,
-                                             HRESULT* pHResult, void** ppDeviceObject );
+                                             HRESULT* pHResult, void** ppDeviceObject,
+                                             UINT Priority=LOADER_PRIORITY_LOWEST,
+                                             HASYNCREQUEST* phRequest=NULL );
+    void                        CancelWorkItem( HASYNCREQUEST hRequest );
+    bool                        IsWorkItemFinished( HASYNCREQUEST hRequest );
+    static void                 ReleaseWorkItem( HASYNCREQUEST hRequest );
+    UINT                        GetNumCancelledRequests();
+    UINT                        GetNumMergedRequests();
     void                        WaitForAllItems();
-    void                        ProcessDeviceWorkItems( UINT CurrentNumResourcesToService, BOOL bRetryLoads=TRUE );
+    void                        ProcessDeviceWorkItems( UINT CurrentNumResourcesToService, BOOL bRetryLoads=TRUE,
+                                                        CUploadScheduler* pScheduler=NULL );
 };
 
 #endif
@@ -15,6 +15,8 @@
 //--------------------------------------------------------------------------------------
 CTextureLoader::CTextureLoader( WCHAR* szFileName, CPackedFile* pPackedFile ) : m_pData( NULL ),
                                                                                 m_cBytes( 0 ),
+                                                                                m_cStoredBytes( 0 ),
+                                                                                m_pDecompressed( NULL ),
                                                                                 m_pPackedFile( pPackedFile )
 {
     wcscpy_s( m_szFileName, MAX_PATH, szFileName );
@@ -29,10 +31,26 @@ CTextureLoader::~CTextureLoader()
 //--------------------------------------------------------------------------------------
 // The SDK uses only DXTn (BCn) textures with a few small non-compressed texture.  However,
 // for a game that uses compressed textures or textures in a zip file, this is the place
-// to decompress them.
+// to decompress them.  If the packed file is compressed, the texture is decompressed
+// here on the processing thread rather than on the IO thread.
 //--------------------------------------------------------------------------------------
 HRESULT WINAPI CTextureLoader::Decompress( void** ppData, SIZE_T* pcBytes )
 {
+    if( m_pPackedFile->IsCompressed() && m_cStoredBytes != m_cBytes )
+    {
+        m_pDecompressed = new BYTE[ m_cBytes ];
+        if( !m_pDecompressed )
+            return E_OUTOFMEMORY;
+
+        HRESULT hr = DecompressPackedData( m_pData, m_cStoredBytes, m_pDecompressed, m_cBytes );
+        if( FAILED( hr ) )
+            return hr;
+
+        *ppData = ( void* )m_pDecompressed;
+        *pcBytes = m_cBytes;
+        return S_OK;
+    }
+
     *ppData = ( void* )m_pData;
     *pcBytes = m_cBytes;
     return S_OK;
@@ -45,7 +63,15 @@ HRESULT WINAPI CTextureLoader::Destroy()
     {
         SAFE_DELETE_ARRAY( m_pData );
     }
+    else if( m_pData )
+    {
+        // Lets the chunk that Load pinned be unmapped again
+        m_pPackedFile->ReleasePackedFile( m_szFileName );
+        m_pData = NULL;
+    }
+    SAFE_DELETE_ARRAY( m_pDecompressed );
     m_cBytes = 0;
+    m_cStoredBytes = 0;
 
     return S_OK;
 }
@@ -58,7 +84,8 @@ HRESULT WINAPI CTextureLoader::Load()
 {
     if( m_pPackedFile->UsingMemoryMappedIO() )
     {
-        if( !m_pPackedFile->GetPackedFile( m_szFileName, &m_pData, &m_cBytes ) )
+        // Leave compressed data compressed, Decompress takes care of it
+        if( !m_pPackedFile->GetPackedFileStored( m_szFileName, &m_pData, &m_cStoredBytes, &m_cBytes ) )
             return E_FAIL;
     }
     else
@@ -73,6 +100,7 @@ HRESULT WINAPI CTextureLoader::Load()
 
         if( !m_pPackedFile->GetPackedFile( m_szFileName, &m_pData, &m_cBytes ) )
             return E_FAIL;
+        m_cStoredBytes = m_cBytes;
     }
 
     return S_OK;
@@ -413,8 +441,49 @@ void WINAPI CTextureProcessor::SetResourceError()
 }
 
 //--------------------------------------------------------------------------------------
-CVertexBufferLoader::CVertexBufferLoader()
+void WINAPI CTextureProcessor::CancelDeviceObject()
+{
+    if( LDT_D3D10 == m_Device.Type )
+    {
+#if defined(USE_D3D10_STAGING_RESOURCES)
+        for( UINT i = 0; i < m_iNumLockedPtrs; i++ )
+        {
+            m_pStaging10->Unmap( i );
+        }
+#endif
+        m_pResourceReuseCache->UnuseDeviceTexture10( m_pRealRV10 );
+    }
+    else if( LDT_D3D9 == m_Device.Type )
+    {
+        for( UINT i = 0; i < m_iNumLockedPtrs; i++ )
+        {
+            m_pRealTexture9->UnlockRect( i );
+        }
+        m_pResourceReuseCache->UnuseDeviceTexture9( m_pRealTexture9 );
+    }
+    m_iNumLockedPtrs = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Each skipped mip level leaves about a quarter of the data
+//--------------------------------------------------------------------------------------
+SIZE_T WINAPI CTextureProcessor::GetUploadBytes()
+{
+    return m_cBytes >> ( 2 * min( m_SkipMips, 8U ) );
+}
+
+//--------------------------------------------------------------------------------------
+CVertexBufferLoader::CVertexBufferLoader() : m_pData( NULL ),
+                                             m_cBytes( 0 ),
+                                             m_pPackedFile( NULL )
 {
+    m_szFileName[0] = 0;
+}
+CVertexBufferLoader::CVertexBufferLoader( WCHAR* szFileName, CPackedFile* pPackedFile ) : m_pData( NULL ),
+                                                                                          m_cBytes( 0 ),
+                                                                                          m_pPackedFile( pPackedFile )
+{
+    wcscpy_s( m_szFileName, MAX_PATH, szFileName );
 }
 CVertexBufferLoader::~CVertexBufferLoader()
 {
@@ -422,14 +491,22 @@ CVertexBufferLoader::~CVertexBufferLoader()
 }
 HRESULT WINAPI CVertexBufferLoader::Decompress( void** ppData, SIZE_T* pcBytes )
 {
-    *ppData = NULL; *pcBytes = 0; return S_OK;
+    *ppData = ( void* )m_pData; *pcBytes = m_cBytes; return S_OK;
 }
 HRESULT WINAPI CVertexBufferLoader::Destroy()
 {
+    // The processor copied the data by now, so the chunk can be unmapped again
+    if( m_pData )
+        m_pPackedFile->ReleasePackedFile( m_szFileName );
+    m_pData = NULL;
+    m_cBytes = 0;
     return S_OK;
 }
 HRESULT WINAPI CVertexBufferLoader::Load()
 {
+    // GetPackedFile pins the chunk until Destroy
+    if( m_pPackedFile && !m_pPackedFile->GetPackedFile( m_szFileName, &m_pData, &m_cBytes ) )
+        return E_FAIL;
     return S_OK;
 }
 
@@ -562,6 +639,9 @@ HRESULT WINAPI CVertexBufferProcessor::Destroy()
 //--------------------------------------------------------------------------------------
 HRESULT WINAPI CVertexBufferProcessor::Process( void* pData, SIZE_T cBytes )
 {
+    // Loaders that read the packed file hand the data over here
+    if( pData )
+        m_pData = pData;
     return S_OK;
 }
 
@@ -597,8 +677,39 @@ void WINAPI CVertexBufferProcessor::SetResourceError()
 }
 
 //--------------------------------------------------------------------------------------
-CIndexBufferLoader::CIndexBufferLoader()
+void WINAPI CVertexBufferProcessor::CancelDeviceObject()
 {
+    if( LDT_D3D10 == m_Device.Type )
+    {
+        m_pResourceReuseCache->UnuseDeviceVB10( m_pRealBuffer10 );
+    }
+    else if( LDT_D3D9 == m_Device.Type )
+    {
+        if( m_pLockedData )
+            m_pRealBuffer9->Unlock();
+        m_pLockedData = NULL;
+        m_pResourceReuseCache->UnuseDeviceVB9( m_pRealBuffer9 );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+SIZE_T WINAPI CVertexBufferProcessor::GetUploadBytes()
+{
+    return ( LDT_D3D10 == m_Device.Type ) ? m_BufferDesc.ByteWidth : m_iSizeBytes;
+}
+
+//--------------------------------------------------------------------------------------
+CIndexBufferLoader::CIndexBufferLoader() : m_pData( NULL ),
+                                           m_cBytes( 0 ),
+                                           m_pPackedFile( NULL )
+{
+    m_szFileName[0] = 0;
+}
+CIndexBufferLoader::CIndexBufferLoader( WCHAR* szFileName, CPackedFile* pPackedFile ) : m_pData( NULL ),
+                                                                                        m_cBytes( 0 ),
+                                                                                        m_pPackedFile( pPackedFile )
+{
+    wcscpy_s( m_szFileName, MAX_PATH, szFileName );
 }
 CIndexBufferLoader::~CIndexBufferLoader()
 {
@@ -606,14 +717,22 @@ CIndexBufferLoader::~CIndexBufferLoader()
 }
 HRESULT WINAPI CIndexBufferLoader::Decompress( void** ppData, SIZE_T* pcBytes )
 {
-    *ppData = NULL; *pcBytes = 0; return S_OK;
+    *ppData = ( void* )m_pData; *pcBytes = m_cBytes; return S_OK;
 }
 HRESULT WINAPI CIndexBufferLoader::Destroy()
 {
+    // The processor copied the data by now, so the chunk can be unmapped again
+    if( m_pData )
+        m_pPackedFile->ReleasePackedFile( m_szFileName );
+    m_pData = NULL;
+    m_cBytes = 0;
     return S_OK;
 }
 HRESULT WINAPI CIndexBufferLoader::Load()
 {
+    // GetPackedFile pins the chunk until Destroy
+    if( m_pPackedFile && !m_pPackedFile->GetPackedFile( m_szFileName, &m_pData, &m_cBytes ) )
+        return E_FAIL;
     return S_OK;
 }
 
@@ -745,6 +864,9 @@ HRESULT WINAPI CIndexBufferProcessor::Destroy()
 //--------------------------------------------------------------------------------------
 HRESULT WINAPI CIndexBufferProcessor::Process( void* pData, SIZE_T cBytes )
 {
+    // Loaders that read the packed file hand the data over here
+    if( pData )
+        m_pData = pData;
     return S_OK;
 }
 
@@ -783,6 +905,28 @@ void WINAPI CIndexBufferProcessor::SetResourceError()
     }
 }
 
+//--------------------------------------------------------------------------------------
+void WINAPI CIndexBufferProcessor::CancelDeviceObject()
+{
+    if( LDT_D3D10 == m_Device.Type )
+    {
+        m_pResourceReuseCache->UnuseDeviceIB10( m_pRealBuffer10 );
+    }
+    else if( LDT_D3D9 == m_Device.Type )
+    {
+        if( m_pLockedData )
+            m_pRealBuffer9->Unlock();
+        m_pLockedData = NULL;
+        m_pResourceReuseCache->UnuseDeviceIB9( m_pRealBuffer9 );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+SIZE_T WINAPI CIndexBufferProcessor::GetUploadBytes()
+{
+    return ( LDT_D3D10 == m_Device.Type ) ? m_BufferDesc.ByteWidth : m_iSizeBytes;
+}
+
 //--------------------------------------------------------------------------------------
 // SDKMesh
 //--------------------------------------------------------------------------------------
@@ -882,3 +1026,10 @@ HRESULT WINAPI CSDKMeshProcessor::CopyToResource()
 void    WINAPI CSDKMeshProcessor::SetResourceError()
 {
 }
+void    WINAPI CSDKMeshProcessor::CancelDeviceObject()
+{
+}
+SIZE_T  WINAPI CSDKMeshProcessor::GetUploadBytes()
+{
+    return 0;
+}
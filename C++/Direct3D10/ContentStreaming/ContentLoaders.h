@@ -49,6 +49,11 @@ public:
 // CopyToResource copies the data from memory to the locked device object (D3D9).
 // SetResourceError is called to set the resource pointer to an error code in the event
 //   that something went wrong.
+// CancelDeviceObject is called from the Graphics thread instead of UnLockDeviceObject
+//   when a request is cancelled after its device object was locked.  It unlocks the
+//   object and gives it back to the resource reuse cache.
+// GetUploadBytes is called from the Graphics thread before UnLockDeviceObject.  It
+//   returns about how many bytes the unlock sends to the device, for CUploadScheduler.
 // Destroy is called by the graphics thread when it has consumed the data.
 //--------------------------------------------------------------------------------------
 class IDataProcessor
@@ -63,6 +68,8 @@ public:
     virtual HRESULT WINAPI  Process( void* pData, SIZE_T cBytes ) = 0;
     virtual HRESULT WINAPI  CopyToResource() = 0;
     virtual void WINAPI     SetResourceError() = 0;
+    virtual void WINAPI     CancelDeviceObject() = 0;
+    virtual SIZE_T WINAPI   GetUploadBytes() = 0;
 };
 
 //--------------------------------------------------------------------------------------
@@ -74,6 +81,8 @@ private:
     WCHAR           m_szFileName[MAX_PATH];
     BYTE* m_pData;
     UINT m_cBytes;
+    UINT m_cStoredBytes;
+    BYTE* m_pDecompressed;
     CPackedFile* m_pPackedFile;
 
 public:
@@ -126,17 +135,25 @@ public:
     HRESULT WINAPI          Process( void* pData, SIZE_T cBytes );
     HRESULT WINAPI          CopyToResource();
     void WINAPI             SetResourceError();
+    void WINAPI             CancelDeviceObject();
+    SIZE_T WINAPI           GetUploadBytes();
 };
 
 //--------------------------------------------------------------------------------------
-// CVertexBufferLoader implementation of IDataLoader
+// CVertexBufferLoader implementation of IDataLoader.  Without a file name the caller
+// gives the data to the processor directly.
 //--------------------------------------------------------------------------------------
 class CVertexBufferLoader : public IDataLoader
 {
 private:
+    WCHAR           m_szFileName[MAX_PATH];
+    BYTE* m_pData;
+    UINT m_cBytes;
+    CPackedFile* m_pPackedFile;
 
 public:
                     CVertexBufferLoader();
+                    CVertexBufferLoader( WCHAR* szFileName, CPackedFile* pPackedFile );
                     ~CVertexBufferLoader();
 
     // overrides
@@ -190,17 +207,25 @@ public:
     HRESULT WINAPI  Process( void* pData, SIZE_T cBytes );
     HRESULT WINAPI  CopyToResource();
     void WINAPI     SetResourceError();
+    void WINAPI     CancelDeviceObject();
+    SIZE_T WINAPI   GetUploadBytes();
 };
 
 //--------------------------------------------------------------------------------------
-// CIndexBufferLoader implementation of IDataLoader
+// CIndexBufferLoader implementation of IDataLoader.  Without a file name the caller
+// gives the data to the processor directly.
 //--------------------------------------------------------------------------------------
 class CIndexBufferLoader : public IDataLoader
 {
 private:
+    WCHAR           m_szFileName[MAX_PATH];
+    BYTE* m_pData;
+    UINT m_cBytes;
+    CPackedFile* m_pPackedFile;
 
 public:
                     CIndexBufferLoader();
+                    CIndexBufferLoader( WCHAR* szFileName, CPackedFile* pPackedFile );
                     ~CIndexBufferLoader();
 
     // overrides
@@ -254,6 +279,8 @@ public:
     HRESULT WINAPI  Process( void* pData, SIZE_T cBytes );
     HRESULT WINAPI  CopyToResource();
     void WINAPI     SetResourceError();
+    void WINAPI     CancelDeviceObject();
+    SIZE_T WINAPI   GetUploadBytes();
 };
 
 //--------------------------------------------------------------------------------------
@@ -306,4 +333,6 @@ public:
     HRESULT WINAPI  Process( void* pData, SIZE_T cBytes );
     HRESULT WINAPI  CopyToResource();
     void WINAPI     SetResourceError();
+    void WINAPI     CancelDeviceObject();
+    SIZE_T WINAPI   GetUploadBytes();
 };
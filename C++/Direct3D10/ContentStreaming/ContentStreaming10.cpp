@@ -17,12 +17,16 @@
 #include "AsyncLoader.h"
 #include "ContentLoaders.h"
 #include "PackedFile.h"
+#include "LevelItemGrid.h"
+#include "UploadScheduler.h"
 #include "Terrain.h"
+#include "ContentStreamingBench.h"
 
 //--------------------------------------------------------------------------------------
 // Defines
 //--------------------------------------------------------------------------------------
 #define DEG2RAD(p) ( D3DX_PI*(p/180.0f) )
+#define TERRAIN_MAX_PIXEL_ERROR 2.0f    // terrain LODs are picked to stay within this many pixels
 #ifndef ARRAYSIZE
 #define ARRAYSIZE(x) (sizeof(x)/sizeof(x[0]))
 #endif
@@ -45,12 +49,14 @@ extern ID3DXSprite*                 g_pSprite9;
 extern ID3DXEffect*                 g_pEffect9;
 extern D3DXHANDLE                   g_htxDiffuse;
 extern D3DXHANDLE                   g_htxNormal;
+extern IDirect3DIndexBuffer9*       g_pTerrainLODIB9[TERRAIN_MAX_LODS][TERRAIN_NUM_STITCHES];
 
 // Direct3D 10 resources
 ID3DX10Font*                        g_pFont10 = NULL;
 ID3DX10Sprite*                      g_pSprite10 = NULL;
 ID3D10Effect*                       g_pEffect10 = NULL;
 ID3D10InputLayout*                  g_pLayoutObject = NULL;
+ID3D10Buffer*                       g_pTerrainLODIB10[TERRAIN_MAX_LODS][TERRAIN_NUM_STITCHES] = { NULL };
 CAsyncLoader*                       g_pAsyncLoader = NULL;
 CResourceReuseCache*                g_pResourceReuseCache = NULL;
 CPackedFile                         g_PackFile;
@@ -77,6 +83,9 @@ float                               g_fRotationFrequency = 20.0f;
 float                               g_fRotateInLeadTime = 2.0f;
 int                                 g_NumResourceToLoadPerFrame = 1;
 int                                 g_UploadToVRamEveryNthFrame = 3;
+bool                                g_bBudgetUploads = true;
+float                               g_fUploadBudgetMs = 2.0f;
+const UINT64                        g_UploadMaxBytesPerFrame = UPLOAD_MAX_BYTES_PER_FRAME;
 UINT                                g_SkipMips = 0;
 UINT                                g_NumProcessingThreads = 1;
 UINT                                g_MaxOutstandingResources = 1500;
@@ -85,10 +94,14 @@ bool                                g_bUseWDDMPaging = false;
 bool                                g_bStartupResourcesLoaded = false;
 bool                                g_bDrawUI = true;
 bool                                g_bWireframe = false;
+bool                                g_bCompressedPackFile = false;
 
 CGrowableArray <LEVEL_ITEM*>        g_LevelItemArray;
 CGrowableArray <LEVEL_ITEM*>        g_VisibleItemArray;
 CGrowableArray <LEVEL_ITEM*>        g_LoadedItemArray;
+CGrowableArray <LEVEL_ITEM*>        g_UnloadItemArray;      // items that left the loading radius and may still hold resources
+CLevelItemGrid                      g_LevelItemGrid;        // spatial index over g_LevelItemArray
+CUploadScheduler                    g_UploadScheduler;      // per-frame budget for the loader's device work
 CTerrain                            g_Terrain;
 
 enum LOAD_TYPE
@@ -118,6 +131,8 @@ APP_STATE                           g_AppState = APP_STATE_STARTUP; // Current s
 #define IDC_ONDEMANDMULTITHREAD		8
 #define IDC_RUN						9
 #define IDC_DELETE_PACK_FILE		10
+#define IDC_COMPRESSED_PACK_FILE	11
+#define IDC_BENCHMARK_PACK_FILE		12
 // SampleUI
 #define IDC_VIEWHEIGHT_STATIC		20
 #define IDC_VIEWHEIGHT				21
@@ -129,6 +144,9 @@ APP_STATE                           g_AppState = APP_STATE_STARTUP; // Current s
 #define IDC_UPLOADTOVRAMFREQ		27
 #define IDC_WIREFRAME				28
 #define IDC_STARTOVER				29
+#define IDC_BUDGETUPLOADS			30
+#define IDC_UPLOADBUDGET_STATIC		31
+#define IDC_UPLOADBUDGET			32
 
 //--------------------------------------------------------------------------------------
 // Forward declarations
@@ -169,14 +187,15 @@ extern void CALLBACK CreateVertexBuffer9_Serial( IDirect3DDevice9* pDev, IDirect
 extern void CALLBACK CreateIndexBuffer9_Serial( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer,
                                                 UINT iSizeBytes, DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool,
                                                 void* pData, void* pContext );
-extern void CALLBACK CreateTextureFromFile9_Async( IDirect3DDevice9* pDev, WCHAR* szFileName,
-                                                   IDirect3DTexture9** ppTexture, void* pContext );
-extern void CALLBACK CreateVertexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DVertexBuffer9** ppBuffer,
-                                                UINT iSizeBytes, DWORD Usage, DWORD FVF, D3DPOOL Pool, void* pData,
-                                                void* pContext );
-extern void CALLBACK CreateIndexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer,
-                                               UINT iSizeBytes, DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool,
-                                               void* pData, void* pContext );
+extern HASYNCREQUEST CALLBACK CreateTextureFromFile9_Async( IDirect3DDevice9* pDev, WCHAR* szFileName,
+                                                            IDirect3DTexture9** ppTexture, UINT Priority,
+                                                            void* pContext );
+extern HASYNCREQUEST CALLBACK CreateVertexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DVertexBuffer9** ppBuffer,
+                                                         UINT iSizeBytes, DWORD Usage, DWORD FVF, D3DPOOL Pool,
+                                                         WCHAR* szFileName, UINT Priority, void* pContext );
+extern HASYNCREQUEST CALLBACK CreateIndexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer,
+                                                        UINT iSizeBytes, DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool,
+                                                        WCHAR* szFileName, UINT Priority, void* pContext );
 
 void CALLBACK CreateTextureFromFile10_Serial( ID3D10Device* pDev, WCHAR* szFileName, ID3D10ShaderResourceView** ppRV,
                                               void* pContext );
@@ -184,15 +203,19 @@ void CALLBACK CreateVertexBuffer10_Serial( ID3D10Device* pDev, ID3D10Buffer** pp
                                            void* pData, void* pContext );
 void CALLBACK CreateIndexBuffer10_Serial( ID3D10Device* pDev, ID3D10Buffer** ppBuffer, D3D10_BUFFER_DESC BufferDesc,
                                           void* pData, void* pContext );
-void CALLBACK CreateTextureFromFile10_Async( ID3D10Device* pDev, WCHAR* szFileName, ID3D10ShaderResourceView** ppRV,
-                                             void* pContext );
-void CALLBACK CreateVertexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer, D3D10_BUFFER_DESC BufferDesc,
-                                          void* pData, void* pContext );
-void CALLBACK CreateIndexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer, D3D10_BUFFER_DESC BufferDesc,
-                                         void* pData, void* pContext );
+HASYNCREQUEST CALLBACK CreateTextureFromFile10_Async( ID3D10Device* pDev, WCHAR* szFileName,
+                                                      ID3D10ShaderResourceView** ppRV, UINT Priority, void* pContext );
+HASYNCREQUEST CALLBACK CreateVertexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer,
+                                                   D3D10_BUFFER_DESC BufferDesc, WCHAR* szFileName, UINT Priority,
+                                                   void* pContext );
+HASYNCREQUEST CALLBACK CreateIndexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer,
+                                                  D3D10_BUFFER_DESC BufferDesc, WCHAR* szFileName, UINT Priority,
+                                                  void* pContext );
 
 void InitApp();
 void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double fTime );
+HRESULT CreateTerrainLODBuffers( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 );
+void DestroyTerrainLODBuffers( LOADER_DEVICE_TYPE ldt );
 UINT EnsureResourcesLoaded( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, float visradius, float loadradius );
 UINT EnsureUnusedResourcesUnloaded( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double fTime );
 void CheckForLoadDone( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 );
@@ -200,6 +223,7 @@ void SetTextureLOD( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 );
 void RenderText();
 void DestroyAllMeshes( LOADER_DEVICE_TYPE ldt );
 void ClearD3D10State();
+void ProcessDeviceUploads();
 
 //--------------------------------------------------------------------------------------
 // Entry point to the program. Initializes everything and goes into a message processing
@@ -215,6 +239,12 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdL
     // DXUT will create and use the best device (either D3D9 or D3D10)
     // that is available on the system depending on which D3D callbacks are set below
 
+    // "ContentStreaming.exe -visbench", "-uploadsim" or "-terrainbench" runs one of the
+    // headless benchmarks in ContentStreamingBench.cpp instead of the sample
+    int BenchmarkExitCode = 0;
+    if( RunCommandLineBenchmark( &BenchmarkExitCode ) )
+        return BenchmarkExitCode;
+
     // Disable gamma correction in DXUT
     DXUTSetIsInGammaCorrectMode( false );
 
@@ -285,6 +315,12 @@ void InitApp()
     g_SampleUI.AddStatic( IDC_UPLOADTOVRAMFREQ_STATIC, str, 5, iY += 24, 150, 22 );
     g_SampleUI.AddSlider( IDC_UPLOADTOVRAMFREQ, 15, iY += 24, 135, 22, 1, 10, g_UploadToVRamEveryNthFrame );
 
+    g_SampleUI.AddCheckBox( IDC_BUDGETUPLOADS, L"Budget uploads", 35, iY += 24, 125, 22, g_bBudgetUploads );
+    swprintf_s( str, MAX_PATH, L"Upload budget: %.1f ms", g_fUploadBudgetMs );
+    g_SampleUI.AddStatic( IDC_UPLOADBUDGET_STATIC, str, 5, iY += 24, 150, 22 );
+    g_SampleUI.AddSlider( IDC_UPLOADBUDGET, 15, iY += 24, 135, 22, 1, 80, ( int )( g_fUploadBudgetMs * 10.0f ) );
+    g_UploadScheduler.SetBudget( g_fUploadBudgetMs, g_UploadMaxBytesPerFrame );
+
     g_SampleUI.AddCheckBox( IDC_WIREFRAME, L"Wireframe", 35, iY += 24, 125, 22, g_bWireframe );
 
     g_SampleUI.AddButton( IDC_STARTOVER, L"Start Over", 35, iY += 24, 125, 22 );
@@ -308,8 +344,11 @@ void InitApp()
                                 iY += 42, 250, 22 );
     g_StartUpUI.AddRadioButton( IDC_ONDEMANDSINGLETHREAD, IDC_LOAD_TYPE_GROUP, L"On Demand Single-Threaded", iX1,
                                 iY += 22, 250, 22 );
+    g_StartUpUI.AddCheckBox( IDC_COMPRESSED_PACK_FILE, L"Compressed Packfile", iX1, iY += 32, 250, 22,
+                             g_bCompressedPackFile );
     g_StartUpUI.AddButton( IDC_RUN, L"Run", 70, iY += 40, 250, 40 );
     g_StartUpUI.AddButton( IDC_DELETE_PACK_FILE, L"Delete Packfile", 70, iY += 40, 250, 40 );
+    g_StartUpUI.AddButton( IDC_BENCHMARK_PACK_FILE, L"Benchmark Packfiles", 70, iY += 40, 250, 40 );
 
     // Check the defaults
     g_StartUpUI.GetRadioButton( IDC_ONDEMANDMULTITHREAD )->SetChecked( true );
@@ -322,11 +361,63 @@ void InitApp()
     g_Camera.SetEnableYAxisMovement( false );
 }
 
+//--------------------------------------------------------------------------------------
+// Tiles in the view frustum load before tiles outside of it, and close tiles load before
+// far ones.  Half of the loader priorities are used for each.
+//--------------------------------------------------------------------------------------
+UINT GetLoadPriority( LEVEL_ITEM* pItem )
+{
+    D3DXVECTOR3 vDelta = *g_Camera.GetEyePt() - pItem->vCenter;
+    float fDist = D3DXVec3Length( &vDelta );
+
+    UINT NumBands = NUM_LOADER_PRIORITIES / 2;
+    UINT Priority = ( g_fLoadingRadius > 0 ) ? ( UINT )( fDist / g_fLoadingRadius * NumBands ) : 0;
+    Priority = min( Priority, NumBands - 1 );
+    // bInFrustum is only updated for items inside the visible radius
+    if( !pItem->bInFrustum || fDist > g_fVisibleRadius )
+        Priority += NumBands;
+
+    return Priority;
+}
+
+//--------------------------------------------------------------------------------------
+// Remembers the async request for one of the item's resources
+//--------------------------------------------------------------------------------------
+void SetItemRequest( LEVEL_ITEM* pItem, ITEM_REQUEST Request, HASYNCREQUEST hRequest )
+{
+    CAsyncLoader::ReleaseWorkItem( pItem->pRequests[Request] );
+    pItem->pRequests[Request] = hRequest;
+}
+
+//--------------------------------------------------------------------------------------
+// Cancels the item's outstanding requests and lets go of the ones that have finished.
+// Returns true once nothing is left in flight.
+//--------------------------------------------------------------------------------------
+bool CancelItemRequests( LEVEL_ITEM* pItem )
+{
+    bool bFinished = true;
+    for( UINT i = 0; i < NUM_ITEM_REQUESTS; i++ )
+    {
+        if( !pItem->pRequests[i] )
+            continue;
+
+        g_pAsyncLoader->CancelWorkItem( pItem->pRequests[i] );
+        if( g_pAsyncLoader->IsWorkItemFinished( pItem->pRequests[i] ) )
+            SetItemRequest( pItem, ( ITEM_REQUEST )i, NULL );
+        else
+            bFinished = false;
+    }
+
+    return bFinished;
+}
+
 //--------------------------------------------------------------------------------------
 // Load a mesh using one of three techniques
 //--------------------------------------------------------------------------------------
 void SmartLoadMesh( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, LEVEL_ITEM* pItem )
 {
+    UINT Priority = GetLoadPriority( pItem );
+
     if( pDev9 )
     {
         if( LOAD_TYPE_SINGLETHREAD == g_LoadType )
@@ -338,30 +429,48 @@ void SmartLoadMesh( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, LEVEL_ITEM* p
                 return;
             CreateVertexBuffer9_Serial( pDev9, &pItem->VB.pVB9, DataBytes, D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED,
                                         pData, NULL );
+            g_PackFile.ReleasePackedFile( pItem->szVBName );
             if( !g_PackFile.GetPackedFile( pItem->szIBName, &pData, &DataBytes ) )
                 return;
             CreateIndexBuffer9_Serial( pDev9, &pItem->IB.pIB9, DataBytes, D3DUSAGE_WRITEONLY, D3DFMT_INDEX16,
                                        D3DPOOL_MANAGED, pData, NULL );
+            g_PackFile.ReleasePackedFile( pItem->szIBName );
             CreateTextureFromFile9_Serial( pDev9, pItem->szDiffuseName, &pItem->Diffuse.pTexture9, NULL );
             CreateTextureFromFile9_Serial( pDev9, pItem->szNormalName, &pItem->Normal.pTexture9, NULL );
         }
         else if( LOAD_TYPE_MULTITHREAD == g_LoadType )
         {
-            BYTE* pData;
             UINT DataBytes;
 
-            if( !g_PackFile.GetPackedFile( pItem->szVBName, &pData, &DataBytes ) )
-                return;
-            CreateVertexBuffer9_Async( pDev9, &pItem->VB.pVB9, DataBytes, D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED,
-                                       pData, ( void* )g_pAsyncLoader );
-            if( !g_PackFile.GetPackedFile( pItem->szIBName, &pData, &DataBytes ) )
-                return;
-            CreateIndexBuffer9_Async( pDev9, &pItem->IB.pIB9, DataBytes, D3DUSAGE_WRITEONLY, D3DFMT_INDEX16,
-                                      D3DPOOL_MANAGED, pData, ( void* )g_pAsyncLoader );
-            CreateTextureFromFile9_Async( pDev9, pItem->szDiffuseName, &pItem->Diffuse.pTexture9,
-                                          ( void* )g_pAsyncLoader );
-            CreateTextureFromFile9_Async( pDev9, pItem->szNormalName, &pItem->Normal.pTexture9,
-                                          ( void* )g_pAsyncLoader );
+            // Only resources that didn't survive a cancel are requested again.  Ones that are
+            // still in flight merge with their outstanding request in the loader.  The loaders
+            // read the packed file on the IO thread and keep its chunk pinned until they're done.
+            if( !pItem->VB.pVB9 )
+            {
+                if( !g_PackFile.GetPackedFileInfo( pItem->szVBName, &DataBytes ) )
+                    return;
+                SetItemRequest( pItem, ITEM_REQUEST_VB,
+                                CreateVertexBuffer9_Async( pDev9, &pItem->VB.pVB9, DataBytes, D3DUSAGE_WRITEONLY, 0,
+                                                           D3DPOOL_MANAGED, pItem->szVBName, Priority,
+                                                           ( void* )g_pAsyncLoader ) );
+            }
+            if( !pItem->IB.pIB9 )
+            {
+                if( !g_PackFile.GetPackedFileInfo( pItem->szIBName, &DataBytes ) )
+                    return;
+                SetItemRequest( pItem, ITEM_REQUEST_IB,
+                                CreateIndexBuffer9_Async( pDev9, &pItem->IB.pIB9, DataBytes, D3DUSAGE_WRITEONLY,
+                                                          D3DFMT_INDEX16, D3DPOOL_MANAGED, pItem->szIBName, Priority,
+                                                          ( void* )g_pAsyncLoader ) );
+            }
+            if( !pItem->Diffuse.pTexture9 )
+                SetItemRequest( pItem, ITEM_REQUEST_DIFFUSE,
+                                CreateTextureFromFile9_Async( pDev9, pItem->szDiffuseName, &pItem->Diffuse.pTexture9,
+                                                              Priority, ( void* )g_pAsyncLoader ) );
+            if( !pItem->Normal.pTexture9 )
+                SetItemRequest( pItem, ITEM_REQUEST_NORMAL,
+                                CreateTextureFromFile9_Async( pDev9, pItem->szNormalName, &pItem->Normal.pTexture9,
+                                                              Priority, ( void* )g_pAsyncLoader ) );
         }
     }
     else if( pDev10 )
@@ -380,6 +489,7 @@ void SmartLoadMesh( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, LEVEL_ITEM* p
             bufferDesc.CPUAccessFlags = 0;
             bufferDesc.MiscFlags = 0;
             CreateVertexBuffer10_Serial( pDev10, &pItem->VB.pVB10, bufferDesc, pData, NULL );
+            g_PackFile.ReleasePackedFile( pItem->szVBName );
 
             if( !g_PackFile.GetPackedFile( pItem->szIBName, &pData, &DataBytes ) )
                 return;
@@ -389,38 +499,51 @@ void SmartLoadMesh( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, LEVEL_ITEM* p
             bufferDesc.CPUAccessFlags = 0;
             bufferDesc.MiscFlags = 0;
             CreateIndexBuffer10_Serial( pDev10, &pItem->IB.pIB10, bufferDesc, pData, NULL );
+            g_PackFile.ReleasePackedFile( pItem->szIBName );
 
             CreateTextureFromFile10_Serial( pDev10, pItem->szDiffuseName, &pItem->Diffuse.pRV10, NULL );
             CreateTextureFromFile10_Serial( pDev10, pItem->szNormalName, &pItem->Normal.pRV10, NULL );
         }
         else if( LOAD_TYPE_MULTITHREAD == g_LoadType )
         {
-            BYTE* pData;
             UINT DataBytes;
 
-            if( !g_PackFile.GetPackedFile( pItem->szVBName, &pData, &DataBytes ) )
-                return;
             D3D10_BUFFER_DESC bufferDesc;
-            bufferDesc.ByteWidth = DataBytes;
-            bufferDesc.Usage = D3D10_USAGE_DEFAULT;
-            bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
-            bufferDesc.CPUAccessFlags = 0;
-            bufferDesc.MiscFlags = 0;
-            CreateVertexBuffer10_Async( pDev10, &pItem->VB.pVB10, bufferDesc, pData, ( void* )g_pAsyncLoader );
-
-            if( !g_PackFile.GetPackedFile( pItem->szIBName, &pData, &DataBytes ) )
-                return;
-            bufferDesc.ByteWidth = DataBytes;
             bufferDesc.Usage = D3D10_USAGE_DEFAULT;
-            bufferDesc.BindFlags = D3D10_BIND_INDEX_BUFFER;
             bufferDesc.CPUAccessFlags = 0;
             bufferDesc.MiscFlags = 0;
-            CreateIndexBuffer10_Async( pDev10, &pItem->IB.pIB10, bufferDesc, pData, ( void* )g_pAsyncLoader );
 
-            CreateTextureFromFile10_Async( pDev10, pItem->szDiffuseName, &pItem->Diffuse.pRV10,
-                                           ( void* )g_pAsyncLoader );
-            CreateTextureFromFile10_Async( pDev10, pItem->szNormalName, &pItem->Normal.pRV10,
-                                           ( void* )g_pAsyncLoader );
+            // Only resources that didn't survive a cancel are requested again.  Ones that are
+            // still in flight merge with their outstanding request in the loader.  The loaders
+            // read the packed file on the IO thread and keep its chunk pinned until they're done.
+            if( !pItem->VB.pVB10 )
+            {
+                if( !g_PackFile.GetPackedFileInfo( pItem->szVBName, &DataBytes ) )
+                    return;
+                bufferDesc.ByteWidth = DataBytes;
+                bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+                SetItemRequest( pItem, ITEM_REQUEST_VB,
+                                CreateVertexBuffer10_Async( pDev10, &pItem->VB.pVB10, bufferDesc, pItem->szVBName,
+                                                            Priority, ( void* )g_pAsyncLoader ) );
+            }
+            if( !pItem->IB.pIB10 )
+            {
+                if( !g_PackFile.GetPackedFileInfo( pItem->szIBName, &DataBytes ) )
+                    return;
+                bufferDesc.ByteWidth = DataBytes;
+                bufferDesc.BindFlags = D3D10_BIND_INDEX_BUFFER;
+                SetItemRequest( pItem, ITEM_REQUEST_IB,
+                                CreateIndexBuffer10_Async( pDev10, &pItem->IB.pIB10, bufferDesc, pItem->szIBName,
+                                                           Priority, ( void* )g_pAsyncLoader ) );
+            }
+            if( !pItem->Diffuse.pRV10 )
+                SetItemRequest( pItem, ITEM_REQUEST_DIFFUSE,
+                                CreateTextureFromFile10_Async( pDev10, pItem->szDiffuseName, &pItem->Diffuse.pRV10,
+                                                               Priority, ( void* )g_pAsyncLoader ) );
+            if( !pItem->Normal.pRV10 )
+                SetItemRequest( pItem, ITEM_REQUEST_NORMAL,
+                                CreateTextureFromFile10_Async( pDev10, pItem->szNormalName, &pItem->Normal.pRV10,
+                                                               Priority, ( void* )g_pAsyncLoader ) );
         }
     }
 }
@@ -434,7 +557,8 @@ float RPercent()
 
 //-------------------------------------------------------------------------------------
 const WCHAR g_strFile[MAX_PATH] = L"\\ContentPackedFile.packedfile";
-const UINT64                        g_PackedFileSize = 3408789504u;
+const WCHAR g_strCompressedFile[MAX_PATH] = L"\\ContentPackedFileCompressed.packedfile";
+const UINT64                        g_PackedFileSize = 3408789504u; // approximate, used for the free space check
 void GetPackedFilePath( WCHAR* strPath, UINT cchPath )
 {
     WCHAR strFolder[MAX_PATH] = L"\\ContentStreaming";
@@ -443,6 +567,61 @@ void GetPackedFilePath( WCHAR* strPath, UINT cchPath )
     wcscat_s( strPath, cchPath, strFolder );
 }
 
+//--------------------------------------------------------------------------------------
+// Reads every file out of the uncompressed and compressed pack files (whichever have
+// been created) and reports the load throughput of each.  Throughput is measured in
+// uncompressed bytes delivered per second.
+//--------------------------------------------------------------------------------------
+void BenchmarkPackedFiles()
+{
+    WCHAR strDirectory[MAX_PATH] = {0};
+    GetPackedFilePath( strDirectory, MAX_PATH );
+
+    const WCHAR* pstrFiles[2] = { g_strFile, g_strCompressedFile };
+    WCHAR strResults[1024] = {0};
+    for( int i = 0; i < 2; i++ )
+    {
+        WCHAR strPath[MAX_PATH];
+        WCHAR strLine[MAX_PATH];
+        wcscpy_s( strPath, MAX_PATH, strDirectory );
+        wcscat_s( strPath, MAX_PATH, pstrFiles[i] );
+
+        if( !CPackedFile::IsPackedFileCurrent( strPath ) )
+        {
+            swprintf_s( strLine, MAX_PATH, L"%s: not created yet\n", pstrFiles[i] + 1 );
+            wcscat_s( strResults, 1024, strLine );
+            continue;
+        }
+
+        CPackedFile PackFile;
+        CGrowableArray <LEVEL_ITEM*> LevelItemArray;
+        double fSeconds = 0;
+        UINT64 StoredBytes = 0;
+        UINT64 DataBytes = 0;
+        if( PackFile.LoadPackedFile( strPath, false, &LevelItemArray ) &&
+            PackFile.MeasureLoadThroughput( &fSeconds, &StoredBytes, &DataBytes ) && fSeconds > 0 )
+        {
+            swprintf_s( strLine, MAX_PATH, L"%s: %.1f MB on disk, %.1f MB of data, %.2fs, %.1f MB/s\n",
+                        pstrFiles[i] + 1, StoredBytes / ( 1024.0 * 1024.0 ), DataBytes / ( 1024.0 * 1024.0 ),
+                        fSeconds, DataBytes / ( 1024.0 * 1024.0 ) / fSeconds );
+        }
+        else
+        {
+            swprintf_s( strLine, MAX_PATH, L"%s: error reading the pack file\n", pstrFiles[i] + 1 );
+        }
+        wcscat_s( strResults, 1024, strLine );
+
+        PackFile.UnloadPackedFile();
+        for( int j = 0; j < LevelItemArray.GetSize(); j++ )
+        {
+            LEVEL_ITEM* pItem = LevelItemArray.GetAt( j );
+            SAFE_DELETE( pItem );
+        }
+    }
+
+    MessageBox( NULL, strResults, L"Packfile Throughput", MB_OK );
+}
+
 //--------------------------------------------------------------------------------------
 // Load the resources necessary at the beginning of a level
 //--------------------------------------------------------------------------------------
@@ -472,8 +651,14 @@ void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double
     UINT SidesPerTile = 50;
     float fWorldScale = 6667.0f;
     float fHeightScale = 300.0f;
+    if( g_bCompressedPackFile && !IsPackedFileCompressionAvailable() )
+    {
+        MessageBox( NULL, L"Compressed pack files need the Windows Compression API.  The uncompressed pack file will be used instead.",
+                    L"Warning", MB_OK );
+        g_bCompressedPackFile = false;
+    }
     wcscpy_s( strPath, MAX_PATH, strDirectory );
-    wcscat_s( strPath, MAX_PATH, g_strFile );
+    wcscat_s( strPath, MAX_PATH, g_bCompressedPackFile ? g_strCompressedFile : g_strFile );
     bool bCreatePackedFile = false;
     if( 0xFFFFFFFF == GetFileAttributes( strPath ) )
     {
@@ -481,23 +666,10 @@ void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double
     }
     else
     {
-        HANDLE hFile = CreateFile( strPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
-                                   FILE_FLAG_SEQUENTIAL_SCAN, NULL );
-        if( INVALID_HANDLE_VALUE != hFile )
-        {
-            // Check against file size in case the process was killed trying to create the file
-            LARGE_INTEGER FileSize;
-            GetFileSizeEx( hFile, &FileSize );
-            UINT64 Size = FileSize.QuadPart;
-            CloseHandle( hFile );
-
-            if( Size != g_PackedFileSize )
-                bCreatePackedFile = true;
-        }
-        else
-        {
+        // Check the header in case the process was killed trying to create the file, or the
+        // file was created with an older index format
+        if( !CPackedFile::IsPackedFileCurrent( strPath ) )
             bCreatePackedFile = true;
-        }
     }
 
     if( bCreatePackedFile )
@@ -525,7 +697,7 @@ void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double
         }
 
         if( !g_PackFile.CreatePackedFile( pDev10, pDev9, strPath, SqrtNumTiles, SidesPerTile, fWorldScale,
-                                          fHeightScale ) )
+                                          fHeightScale, g_bCompressedPackFile ) )
         {
             MessageBox( NULL, L"There was an error creating the pack file.  ContentStreaming will now exit.", L"Error",
                         MB_OK );
@@ -541,6 +713,11 @@ void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double
     if( FAILED( g_Terrain.LoadTerrain( str, SqrtNumTiles, SidesPerTile, fWorldScale, fHeightScale, false ) ) )
         return;
 
+    // Geomipmap LODs for the tiles.  If they can't be created the tiles are drawn at full
+    // detail with the strips from the pack file.
+    if( SUCCEEDED( g_Terrain.CreateLODs( TERRAIN_MAX_LODS ) ) )
+        CreateTerrainLODBuffers( pDev9, pDev10 );
+
     bool b64Bit = false;
     if( !g_PackFile.LoadPackedFile( strPath, b64Bit, &g_LevelItemArray ) )
     {
@@ -563,6 +740,13 @@ void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double
 #endif
     g_fLoadingRadius = g_PackFile.GetLoadingRadius();
     g_fVisibleRadius = g_fLoadingRadius;
+    if( FAILED( g_LevelItemGrid.Create( &g_LevelItemArray, g_fLoadingRadius / 4.0f ) ) )
+    {
+        MessageBox( NULL, L"There was an error indexing the level.  ContentStreaming will now exit.", L"Error",
+                    MB_OK );
+        PostQuitMessage( 0 );
+        return;
+    }
     g_Camera.SetProjParams( DEG2RAD(g_fFOV), g_fAspectRatio, 0.5f, g_fVisibleRadius );
 
     // Determine our available texture memory and try to skip mip levels to fit into it
@@ -590,6 +774,75 @@ void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double
     g_bStartupResourcesLoaded = true;
 }
 
+//--------------------------------------------------------------------------------------
+// Create an index buffer for every LOD and stitch of the terrain tiles.  All of them index
+// the tile vertex buffers from the pack file.
+//--------------------------------------------------------------------------------------
+HRESULT CreateTerrainLODBuffers( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 )
+{
+    HRESULT hr = S_OK;
+
+    DestroyTerrainLODBuffers( pDev9 ? LDT_D3D9 : LDT_D3D10 );
+    for( UINT iLOD = 0; iLOD < g_Terrain.GetNumLODs() && SUCCEEDED( hr ); iLOD++ )
+    {
+        TERRAIN_LOD* pLOD = g_Terrain.GetLOD( iLOD );
+        for( UINT Stitch = 0; Stitch < TERRAIN_NUM_STITCHES && SUCCEEDED( hr ); Stitch++ )
+        {
+            UINT SizeBytes = pLOD->NumIndices[Stitch] * sizeof( SHORT );
+            if( pDev9 )
+            {
+                IDirect3DIndexBuffer9* pIB = NULL;
+                void* pData = NULL;
+                hr = pDev9->CreateIndexBuffer( SizeBytes, D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_MANAGED, &pIB,
+                                               NULL );
+                if( SUCCEEDED( hr ) )
+                    hr = pIB->Lock( 0, 0, &pData, 0 );
+                if( SUCCEEDED( hr ) )
+                {
+                    CopyMemory( pData, pLOD->pIndices[Stitch], SizeBytes );
+                    pIB->Unlock();
+                }
+                g_pTerrainLODIB9[iLOD][Stitch] = pIB;
+            }
+            else if( pDev10 )
+            {
+                D3D10_BUFFER_DESC bufferDesc;
+                bufferDesc.ByteWidth = SizeBytes;
+                bufferDesc.Usage = D3D10_USAGE_IMMUTABLE;
+                bufferDesc.BindFlags = D3D10_BIND_INDEX_BUFFER;
+                bufferDesc.CPUAccessFlags = 0;
+                bufferDesc.MiscFlags = 0;
+                D3D10_SUBRESOURCE_DATA InitData;
+                InitData.pSysMem = pLOD->pIndices[Stitch];
+                InitData.SysMemPitch = 0;
+                InitData.SysMemSlicePitch = 0;
+                hr = pDev10->CreateBuffer( &bufferDesc, &InitData, &g_pTerrainLODIB10[iLOD][Stitch] );
+            }
+        }
+    }
+
+    // Either every list has a buffer or the tiles fall back to the full detail strips
+    if( FAILED( hr ) )
+        DestroyTerrainLODBuffers( pDev9 ? LDT_D3D9 : LDT_D3D10 );
+
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+void DestroyTerrainLODBuffers( LOADER_DEVICE_TYPE ldt )
+{
+    for( UINT iLOD = 0; iLOD < TERRAIN_MAX_LODS; iLOD++ )
+    {
+        for( UINT Stitch = 0; Stitch < TERRAIN_NUM_STITCHES; Stitch++ )
+        {
+            if( LDT_D3D9 == ldt )
+                SAFE_RELEASE( g_pTerrainLODIB9[iLOD][Stitch] );
+            else
+                SAFE_RELEASE( g_pTerrainLODIB10[iLOD][Stitch] );
+        }
+    }
+}
+
 //--------------------------------------------------------------------------------------
 // GetCameraCullPlanes
 //--------------------------------------------------------------------------------------
@@ -618,12 +871,37 @@ void GetCameraCullPlanes( D3DXVECTOR3* p1Normal, D3DXVECTOR3* p2Normal, float* p
 }
 
 //--------------------------------------------------------------------------------------
-// Calculate our visible and potentially visible items
+// Shrink an item array to its first NumItems entries.  CGrowableArray::SetSize only grows.
+//--------------------------------------------------------------------------------------
+void TruncateItemArray( CGrowableArray <LEVEL_ITEM*>* pItems, int NumItems )
+{
+    while( pItems->GetSize() > NumItems )
+        pItems->Remove( pItems->GetSize() - 1 );
+}
+
+//--------------------------------------------------------------------------------------
+// Drop the items that are no longer in the loading radius, keeping the order of the rest
+//--------------------------------------------------------------------------------------
+void RemoveItemsOutsideLoadRadius( CGrowableArray <LEVEL_ITEM*>* pItems )
+{
+    int NumKept = 0;
+    for( int i = 0; i < pItems->GetSize(); i++ )
+    {
+        LEVEL_ITEM* pItem = pItems->GetAt( i );
+        if( pItem->bInLoadRadius )
+            pItems->SetAt( NumKept++, pItem );
+    }
+    TruncateItemArray( pItems, NumKept );
+}
+
+//--------------------------------------------------------------------------------------
+// Calculate our visible and potentially visible items.  The level grid only looks at the
+// cells around the camera, and g_LoadedItemArray is updated with the items that entered
+// or left the loading radius since the last frame instead of being rebuilt.
 //--------------------------------------------------------------------------------------
 void CalculateVisibleItems( D3DXVECTOR3 vEye, float fVisRadius, float fLoadRadius )
 {
     g_VisibleItemArray.Reset();
-    g_LoadedItemArray.Reset();
 
     // setup cull planes
     D3DXVECTOR3 vLeftNormal;
@@ -633,33 +911,28 @@ void CalculateVisibleItems( D3DXVECTOR3 vEye, float fVisRadius, float fLoadRadiu
     GetCameraCullPlanes( &vLeftNormal, &vRightNormal, &leftD, &rightD );
     float fTileSize = g_PackFile.GetTileSideSize();
 
-    for( int i = 0; i < g_LevelItemArray.GetSize(); i++ )
-    {
-        LEVEL_ITEM* pItem = g_LevelItemArray.GetAt( i );
+    // Items entering the loading radius go on the end of the loaded items, and items
+    // leaving it are queued for EnsureUnusedResourcesUnloaded
+    int NumUnloading = g_UnloadItemArray.GetSize();
+    g_LevelItemGrid.UpdateLoadRadius( vEye, fLoadRadius, &g_LoadedItemArray, &g_UnloadItemArray );
+    if( g_UnloadItemArray.GetSize() > NumUnloading )
+        RemoveItemsOutsideLoadRadius( &g_LoadedItemArray );
 
-        // Default is not in loading radius
-        pItem->bInLoadRadius = false;
+    g_LevelItemGrid.GetItemsInRadius( vEye, fVisRadius, &g_VisibleItemArray );
+    for( int i = 0; i < g_VisibleItemArray.GetSize(); i++ )
+    {
+        LEVEL_ITEM* pItem = g_VisibleItemArray.GetAt( i );
 
         D3DXVECTOR3 vDelta = vEye - pItem->vCenter;
         float len2 = D3DXVec3LengthSq( &vDelta );
-        if( len2 < fVisRadius * fVisRadius )
-        {
-            pItem->bInFrustum = false;
+        pItem->bInFrustum = false;
 
-            if( len2 < fTileSize * fTileSize ||
-                ( D3DXVec3Dot( &pItem->vCenter, &vLeftNormal ) < leftD + fTileSize &&
-                  D3DXVec3Dot( &pItem->vCenter, &vRightNormal ) < rightD + fTileSize )
-                )
-            {
-                pItem->bInFrustum = true;
-            }
-
-            g_VisibleItemArray.Add( pItem );
-        }
-        if( len2 < fLoadRadius * fLoadRadius )
+        if( len2 < fTileSize * fTileSize ||
+            ( D3DXVec3Dot( &pItem->vCenter, &vLeftNormal ) < leftD + fTileSize &&
+              D3DXVec3Dot( &pItem->vCenter, &vRightNormal ) < rightD + fTileSize )
+            )
         {
-            pItem->bInLoadRadius = true;
-            g_LoadedItemArray.Add( pItem );
+            pItem->bInFrustum = true;
         }
     }
 }
@@ -674,9 +947,11 @@ UINT EnsureResourcesLoaded( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, float
     {
         LEVEL_ITEM* pItem = g_LoadedItemArray.GetAt( i );
 
-        if( !pItem->bLoaded && !pItem->bLoading )
+        // An item that is still cancelling picks its requests back up
+        if( !pItem->bLoaded && ( !pItem->bLoading || pItem->bCancelling ) )
         {
             pItem->bLoading = true;
+            pItem->bCancelling = false;
             NumToLoad ++;
             SmartLoadMesh( pDev9, pDev10, pItem );
         }
@@ -694,6 +969,10 @@ void FreeUpMeshResources( LEVEL_ITEM* pItem, IDirect3DDevice9* pDev9, ID3D10Devi
         g_pResourceReuseCache->UnuseDeviceTexture9( pItem->Normal.pTexture9 );
         g_pResourceReuseCache->UnuseDeviceVB9( pItem->VB.pVB9 );
         g_pResourceReuseCache->UnuseDeviceIB9( pItem->IB.pIB9 );
+        pItem->Diffuse.pTexture9 = NULL;
+        pItem->Normal.pTexture9 = NULL;
+        pItem->VB.pVB9 = NULL;
+        pItem->IB.pIB9 = NULL;
     }
     else if( pDev10 )
     {
@@ -701,47 +980,67 @@ void FreeUpMeshResources( LEVEL_ITEM* pItem, IDirect3DDevice9* pDev9, ID3D10Devi
         g_pResourceReuseCache->UnuseDeviceTexture10( pItem->Normal.pRV10 );
         g_pResourceReuseCache->UnuseDeviceVB10( pItem->VB.pVB10 );
         g_pResourceReuseCache->UnuseDeviceIB10( pItem->IB.pIB10 );
+        pItem->Diffuse.pRV10 = NULL;
+        pItem->Normal.pRV10 = NULL;
+        pItem->VB.pVB10 = NULL;
+        pItem->IB.pIB10 = NULL;
     }
 }
 
 //--------------------------------------------------------------------------------------
-// Ensure resources that are unused are unloaded
+// Ensure resources that are unused are unloaded.  Only the items that left the loading
+// radius are looked at; items that came back into it before they were unloaded are
+// dropped from the list.
 //--------------------------------------------------------------------------------------
 UINT EnsureUnusedResourcesUnloaded( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double fTime )
 {
     UINT NumToUnload = 0;
+    int NumStillCancelling = 0;
 
-    for( int i = 0; i < g_LevelItemArray.GetSize(); i++ )
+    for( int i = 0; i < g_UnloadItemArray.GetSize(); i++ )
     {
-        LEVEL_ITEM* pItem = g_LevelItemArray.GetAt( i );
+        LEVEL_ITEM* pItem = g_UnloadItemArray.GetAt( i );
 
-        if( pItem->bLoaded && !pItem->bInLoadRadius )
+        if( ( pItem->bLoaded || pItem->bLoading ) && !pItem->bInLoadRadius )
         {
+            // Items that left the radius before they finished loading drop their requests.
+            // Keep checking back until the loader has let go of all of them.
+            if( LOAD_TYPE_MULTITHREAD == g_LoadType && !CancelItemRequests( pItem ) )
+            {
+                pItem->bCancelling = true;
+                g_UnloadItemArray.SetAt( NumStillCancelling++, pItem );
+                continue;
+            }
+
             // Unload the mesh textures from the texture cache
             FreeUpMeshResources( pItem, pDev9, pDev10 );
+            NumToUnload ++;
             pItem->bLoading = false;
             pItem->bLoaded = false;
+            pItem->bCancelling = false;
             pItem->bHasBeenRenderedDiffuse = false;
             pItem->bHasBeenRenderedNormal = false;
         }
     }
+    TruncateItemArray( &g_UnloadItemArray, NumStillCancelling );
 
     return NumToUnload;
 }
 
 
 //--------------------------------------------------------------------------------------
-// If an item is done loading, label it as loaded
+// If an item is done loading, label it as loaded.  Items outside of the loading radius
+// have either been unloaded or are cancelling, so only the loaded items are checked.
 //--------------------------------------------------------------------------------------
 void CheckForLoadDone( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 )
 {
     if( pDev9 )
     {
-        for( int i = 0; i < g_LevelItemArray.GetSize(); i++ )
+        for( int i = 0; i < g_LoadedItemArray.GetSize(); i++ )
         {
-            LEVEL_ITEM* pItem = g_LevelItemArray.GetAt( i );
+            LEVEL_ITEM* pItem = g_LoadedItemArray.GetAt( i );
 
-            if( pItem->bLoading )
+            if( pItem->bLoading && !pItem->bCancelling )
             {
                 if( pItem->VB.pVB9 &&
                     pItem->IB.pIB9 )
@@ -757,11 +1056,11 @@ void CheckForLoadDone( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 )
     }
     else if( pDev10 )
     {
-        for( int i = 0; i < g_LevelItemArray.GetSize(); i++ )
+        for( int i = 0; i < g_LoadedItemArray.GetSize(); i++ )
         {
-            LEVEL_ITEM* pItem = g_LevelItemArray.GetAt( i );
+            LEVEL_ITEM* pItem = g_LoadedItemArray.GetAt( i );
 
-            if( pItem->bLoading )
+            if( pItem->bLoading && !pItem->bCancelling )
             {
                 if( pItem->VB.pVB10 &&
                     pItem->IB.pIB10 )
@@ -777,6 +1076,24 @@ void CheckForLoadDone( IDirect3DDevice9* pDev9, ID3D10Device* pDev10 )
     }
 }
 
+//--------------------------------------------------------------------------------------
+// Service the loader's device work items at the end of a frame, either as many as fit in
+// the upload scheduler's byte and time budget or up to g_NumResourceToLoadPerFrame
+//--------------------------------------------------------------------------------------
+void ProcessDeviceUploads()
+{
+    if( g_bBudgetUploads )
+    {
+        g_UploadScheduler.BeginFrame();
+        g_pAsyncLoader->ProcessDeviceWorkItems( UINT_MAX, TRUE, &g_UploadScheduler );
+    }
+    else
+    {
+        UINT NumResToProcess = g_NumResourceToLoadPerFrame;
+        g_pAsyncLoader->ProcessDeviceWorkItems( NumResToProcess );
+    }
+}
+
 //--------------------------------------------------------------------------------------
 // Render the help and statistics text. This function uses the ID3DXFont interface for
 // efficient text rendering.
@@ -795,20 +1112,30 @@ void RenderText()
     g_pTxtHelper->DrawTextLine( str );
     swprintf_s( str, MAX_PATH, L"Models in Use: %d", g_NumModelsInUse );
     g_pTxtHelper->DrawTextLine( str );
+    swprintf_s( str, MAX_PATH, L"Chunks mapped by readahead: %d", g_PackFile.GetNumReadaheadMapped() );
+    g_pTxtHelper->DrawTextLine( str );
+    if( g_pAsyncLoader )
+    {
+        swprintf_s( str, MAX_PATH, L"Requests cancelled: %d  merged: %d", g_pAsyncLoader->GetNumCancelledRequests(),
+                    g_pAsyncLoader->GetNumMergedRequests() );
+        g_pTxtHelper->DrawTextLine( str );
+        if( g_bBudgetUploads )
+        {
+            swprintf_s( str, MAX_PATH, L"Uploads: %d items, %d of %d KB, %.2f ms (measured %.0f MB/s)",
+                        g_UploadScheduler.GetFrameItems(), ( int )( g_UploadScheduler.GetFrameBytes() / 1024 ),
+                        ( int )( g_UploadScheduler.GetFrameByteAllowance() / 1024 ),
+                        g_UploadScheduler.GetFrameSeconds() * 1000.0,
+                        g_UploadScheduler.GetBytesPerSecond() / ( 1024.0 * 1024.0 ) );
+            g_pTxtHelper->DrawTextLine( str );
+        }
+    }
     g_pTxtHelper->DrawTextLine( L"" );
     if( g_pResourceReuseCache )
     {
         int NumTextures = g_pResourceReuseCache->GetNumTextures();
-        UINT NumUsed = 0;
+        int NumUsed = g_pResourceReuseCache->GetNumUsedTextures();
         UINT64 EstimatedManagedMemory = g_pResourceReuseCache->GetUsedManagedMemory();
 
-        for( int i = 0; i < NumTextures; i++ )
-        {
-            DEVICE_TEXTURE* tex = g_pResourceReuseCache->GetTexture( i );
-            if( tex->bInUse )
-                NumUsed ++;
-        }
-
         swprintf_s( str, MAX_PATH, L"Estimated video memory used: %d (mb) of %d (mb)", ( int )
                          ( EstimatedManagedMemory / ( 1024 * 1024 ) ), ( int )( g_AvailableVideoMem /
                                                                                 ( 1024 * 1024 ) ) );
@@ -827,21 +1154,8 @@ void RenderText()
 
         int NumVBs = g_pResourceReuseCache->GetNumVBs();
         int NumIBs = g_pResourceReuseCache->GetNumIBs();
-        UINT NumUsedVBs = 0;
-        UINT NumUsedIBs = 0;
-
-        for( int i = 0; i < NumVBs; i++ )
-        {
-            DEVICE_VERTEX_BUFFER* vb = g_pResourceReuseCache->GetVB( i );
-            if( vb->bInUse )
-                NumUsedVBs ++;
-        }
-        for( int i = 0; i < NumIBs; i++ )
-        {
-            DEVICE_INDEX_BUFFER* ib = g_pResourceReuseCache->GetIB( i );
-            if( ib->bInUse )
-                NumUsedIBs ++;
-        }
+        int NumUsedVBs = g_pResourceReuseCache->GetNumUsedVBs();
+        int NumUsedIBs = g_pResourceReuseCache->GetNumUsedIBs();
 
         swprintf_s( str, MAX_PATH, L"BufferCache: Total buffers: %d", NumVBs + NumIBs );
         g_pTxtHelper->DrawTextLine( str );
@@ -856,6 +1170,16 @@ void RenderText()
         swprintf_s( str, MAX_PATH, L"    IBs: %d", NumUsedIBs );
         g_pTxtHelper->DrawTextLine( str );
 
+        REUSE_CACHE_STATS Stats;
+        g_pResourceReuseCache->GetStats( &Stats );
+        float fHitRate = Stats.NumRequests ? 100.0f * ( float )Stats.NumHits / ( float )Stats.NumRequests : 0.0f;
+        swprintf_s( str, MAX_PATH, L"ReuseCache: Hit rate: %.1f%%  Evictions: %d", fHitRate,
+                    ( int )Stats.NumEvictions );
+        g_pTxtHelper->DrawTextLine( str );
+        swprintf_s( str, MAX_PATH, L"ReuseCache: Recycled: %d (mb)  Evicted: %d (mb)",
+                    ( int )( Stats.BytesRecycled / ( 1024 * 1024 ) ), ( int )( Stats.BytesEvicted / ( 1024 * 1024 ) ) );
+        g_pTxtHelper->DrawTextLine( str );
+
     }
 
     g_pTxtHelper->End();
@@ -1020,9 +1344,12 @@ void RenderScene( ID3D10Device* pd3dDevice, double fTime, float fElapsedTime, vo
         NewTextureUploadsToVidMem = g_NumResourceToLoadPerFrame;
     iFrameNum ++;
 
-    // Render the level
+    // Render the level.  Tiles are drawn with the LOD and stitch SelectLODs picked for them,
+    // or with the full detail strips from the pack file if there are no LOD buffers.
+    bool bTerrainLODs = ( g_Terrain.GetNumLODs() > 0 && g_pTerrainLODIB10[0][0] != NULL );
     pd3dDevice->IASetInputLayout( g_pLayoutObject );
-    pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP );
+    pd3dDevice->IASetPrimitiveTopology( bTerrainLODs ? D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST :
+                                        D3D10_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP );
     for( int i = 0; i < g_VisibleItemArray.GetSize(); i++ )
     {
         LEVEL_ITEM* pItem = g_VisibleItemArray.GetAt( i );
@@ -1038,7 +1365,20 @@ void RenderScene( ID3D10Device* pd3dDevice, double fTime, float fElapsedTime, vo
             UINT Stride = sizeof( TERRAIN_VERTEX );
             UINT Offset = 0;
             pd3dDevice->IASetVertexBuffers( 0, 1, &pItem->VB.pVB10, &Stride, &Offset );
-            pd3dDevice->IASetIndexBuffer( pItem->IB.pIB10, DXGI_FORMAT_R16_UINT, 0 );
+
+            UINT NumIndices = g_Terrain.GetNumIndices();
+            if( bTerrainLODs )
+            {
+                UINT iTile = g_Terrain.GetTileForPosition( &pItem->vCenter );
+                UINT iLOD = g_Terrain.GetTileLOD( iTile );
+                UINT Stitch = g_Terrain.GetTileStitch( iTile );
+                pd3dDevice->IASetIndexBuffer( g_pTerrainLODIB10[iLOD][Stitch], DXGI_FORMAT_R16_UINT, 0 );
+                NumIndices = g_Terrain.GetLOD( iLOD )->NumIndices[Stitch];
+            }
+            else
+            {
+                pd3dDevice->IASetIndexBuffer( pItem->IB.pIB10, DXGI_FORMAT_R16_UINT, 0 );
+            }
 
             bool bDiff = pItem->Diffuse.pRV10 ? true : false;
             if( bDiff && pItem->CurrentCountdownDiff > 0 )
@@ -1102,7 +1442,7 @@ void RenderScene( ID3D10Device* pd3dDevice, double fTime, float fElapsedTime, vo
             {
                 pTechnique->GetPassByIndex( iPass )->Apply( 0 );
 
-                pd3dDevice->DrawIndexed( g_Terrain.GetNumIndices(), 0, 0 );
+                pd3dDevice->DrawIndexed( NumIndices, 0, 0 );
             }
         }
         else
@@ -1162,12 +1502,9 @@ void CALLBACK OnD3D10FrameRender( ID3D10Device* pd3dDevice, double fTime, float
 
     DXUT_EndPerfEvent();
 
-    // Load in up to g_NumResourceToLoadPerFrame resources at the end of every frame
+    // Load in resources at the end of every frame
     if( LOAD_TYPE_MULTITHREAD == g_LoadType && APP_STATE_RENDER_SCENE == g_AppState )
-    {
-        UINT NumResToProcess = g_NumResourceToLoadPerFrame;
-        g_pAsyncLoader->ProcessDeviceWorkItems( NumResToProcess );
-    }
+        ProcessDeviceUploads();
 }
 
 
@@ -1268,6 +1605,9 @@ void CALLBACK OnFrameMove( double fTime, float fElapsedTime, void* pUserContext
         vAt = vEye + vDir;
         g_Camera.SetViewParams( &vEye, &vAt );
 
+        // Pick the LOD each terrain tile is drawn with from here
+        g_Terrain.SelectLODs( &vEye, DEG2RAD( g_fFOV ), ( float )DXUTGetWindowHeight(), TERRAIN_MAX_PIXEL_ERROR );
+
         IDirect3DDevice9* pDev9 = NULL;
         ID3D10Device* pDev10 = NULL;
 
@@ -1279,12 +1619,18 @@ void CALLBACK OnFrameMove( double fTime, float fElapsedTime, void* pUserContext
         // Find visible sets
         CalculateVisibleItems( vEye, g_fVisibleRadius, g_fLoadingRadius );
 
+        // Map and pre-fault the chunks that are about to come into the loading radius
+        if( LOAD_TYPE_MULTITHREAD == g_LoadType && g_PackFile.UsingMemoryMappedIO() )
+            g_PackFile.RequestReadahead( &vEye, g_fLoadingRadius );
+
         // Ensure resources within a certian radius are loaded
         EnsureResourcesLoaded( pDev9, pDev10, g_fVisibleRadius, g_fLoadingRadius );
 
         // Never unload when using WDDM paging
         if( !g_bUseWDDMPaging )
             EnsureUnusedResourcesUnloaded( pDev9, pDev10, fTime );
+        else
+            g_UnloadItemArray.Reset();
 
         CheckForLoadDone( pDev9, pDev10 );
     }
@@ -1350,9 +1696,13 @@ void CALLBACK OnKeyboard( UINT nChar, bool bKeyDown, bool bAltDown, void* pUserC
 //--------------------------------------------------------------------------------------
 void DestroyAllMeshes( LOADER_DEVICE_TYPE ldt )
 {
-    // Wait for everything to load
+    // Cancel whatever is still loading and wait for the loader to drain
     if( LOAD_TYPE_MULTITHREAD == g_LoadType )
+    {
+        for( int i = 0; i < g_LevelItemArray.GetSize(); i++ )
+            CancelItemRequests( g_LevelItemArray.GetAt( i ) );
         g_pAsyncLoader->WaitForAllItems();
+    }
 
     g_pResourceReuseCache->OnDestroy();
 
@@ -1360,11 +1710,16 @@ void DestroyAllMeshes( LOADER_DEVICE_TYPE ldt )
     for( int i = 0; i < g_LevelItemArray.GetSize(); i++ )
     {
         LEVEL_ITEM* pItem = g_LevelItemArray.GetAt( i );
+        for( UINT j = 0; j < NUM_ITEM_REQUESTS; j++ )
+            CAsyncLoader::ReleaseWorkItem( pItem->pRequests[j] );
         SAFE_DELETE( pItem );
     }
+    g_LevelItemGrid.Destroy();
+    DestroyTerrainLODBuffers( ldt );
     g_LevelItemArray.RemoveAll();
     g_VisibleItemArray.RemoveAll();
     g_LoadedItemArray.RemoveAll();
+    g_UnloadItemArray.RemoveAll();
 }
 
 //--------------------------------------------------------------------------------------
@@ -1396,6 +1751,12 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
             g_bUseWDDMPaging = false;
         }
             break;
+        case IDC_COMPRESSED_PACK_FILE:
+            g_bCompressedPackFile = g_StartUpUI.GetCheckBox( IDC_COMPRESSED_PACK_FILE )->GetChecked();
+            break;
+        case IDC_BENCHMARK_PACK_FILE:
+            BenchmarkPackedFiles();
+            break;
         case IDC_RUN:
         {
             if( DXUTIsAppRenderingWithD3D9() )
@@ -1440,6 +1801,18 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
             g_SampleUI.GetStatic( IDC_UPLOADTOVRAMFREQ_STATIC )->SetText( str );
             break;
         }
+        case IDC_BUDGETUPLOADS:
+            g_bBudgetUploads = g_SampleUI.GetCheckBox( IDC_BUDGETUPLOADS )->GetChecked();
+            break;
+        case IDC_UPLOADBUDGET:
+        {
+            g_fUploadBudgetMs = ( float )g_SampleUI.GetSlider( IDC_UPLOADBUDGET )->GetValue() / 10.0f;
+            g_UploadScheduler.SetBudget( g_fUploadBudgetMs, g_UploadMaxBytesPerFrame );
+
+            swprintf_s( str, MAX_PATH, L"Upload budget: %.1f ms", g_fUploadBudgetMs );
+            g_SampleUI.GetStatic( IDC_UPLOADBUDGET_STATIC )->SetText( str );
+            break;
+        }
         case IDC_WIREFRAME:
         {
             g_bWireframe = !g_bWireframe;
@@ -1470,7 +1843,7 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
         {
             WCHAR strPath[MAX_PATH] = {0};
             GetPackedFilePath( strPath, MAX_PATH );
-            wcscat_s( strPath, MAX_PATH, g_strFile );
+            wcscat_s( strPath, MAX_PATH, g_bCompressedPackFile ? g_strCompressedFile : g_strFile );
             if( 0xFFFFFFFF == GetFileAttributes( strPath ) )
             {
                 MessageBox( NULL, L"No PackFile exists.", L"Error", MB_OK );
@@ -1598,51 +1971,77 @@ Finish:
 //--------------------------------------------------------------------------------------
 // Async create texture
 //--------------------------------------------------------------------------------------
-void	CALLBACK CreateTextureFromFile10_Async( ID3D10Device* pDev, WCHAR* szFileName, ID3D10ShaderResourceView** ppRV,
-                                                void* pContext )
+HASYNCREQUEST CALLBACK CreateTextureFromFile10_Async( ID3D10Device* pDev, WCHAR* szFileName,
+                                                      ID3D10ShaderResourceView** ppRV, UINT Priority, void* pContext )
 {
+    HASYNCREQUEST hRequest = NULL;
     CAsyncLoader* pAsyncLoader = ( CAsyncLoader* )pContext;
     if( pAsyncLoader )
     {
         CTextureLoader* pLoader = new CTextureLoader( szFileName, &g_PackFile );
         CTextureProcessor* pProcessor = new CTextureProcessor( pDev, ppRV, g_pResourceReuseCache, g_SkipMips );
 
-        pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppRV );
+
+        if( FAILED( pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppRV, Priority, &hRequest ) ) )
+        {
+            SAFE_DELETE( pLoader );
+            SAFE_DELETE( pProcessor );
+        }
     }
+
+    return hRequest;
 }
 
 //--------------------------------------------------------------------------------------
 // Async create buffer
 //--------------------------------------------------------------------------------------
-void	CALLBACK CreateVertexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer, D3D10_BUFFER_DESC BufferDesc,
-                                             void* pData, void* pContext )
+HASYNCREQUEST CALLBACK CreateVertexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer,
+                                                   D3D10_BUFFER_DESC BufferDesc, WCHAR* szFileName, UINT Priority,
+                                                   void* pContext )
 {
+    HASYNCREQUEST hRequest = NULL;
     CAsyncLoader* pAsyncLoader = ( CAsyncLoader* )pContext;
     if( pAsyncLoader )
     {
-        CVertexBufferLoader* pLoader = new CVertexBufferLoader();
-        CVertexBufferProcessor* pProcessor = new CVertexBufferProcessor( pDev, ppBuffer, &BufferDesc, pData,
+        CVertexBufferLoader* pLoader = new CVertexBufferLoader( szFileName, &g_PackFile );
+        CVertexBufferProcessor* pProcessor = new CVertexBufferProcessor( pDev, ppBuffer, &BufferDesc, NULL,
                                                                          g_pResourceReuseCache );
 
-        pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer );
+
+        if( FAILED( pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer, Priority, &hRequest ) ) )
+        {
+            SAFE_DELETE( pLoader );
+            SAFE_DELETE( pProcessor );
+        }
     }
+
+    return hRequest;
 }
 
 //--------------------------------------------------------------------------------------
 // Async create buffer
 //--------------------------------------------------------------------------------------
-void	CALLBACK CreateIndexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer, D3D10_BUFFER_DESC BufferDesc,
-                                            void* pData, void* pContext )
+HASYNCREQUEST CALLBACK CreateIndexBuffer10_Async( ID3D10Device* pDev, ID3D10Buffer** ppBuffer,
+                                                  D3D10_BUFFER_DESC BufferDesc, WCHAR* szFileName, UINT Priority,
+                                                  void* pContext )
 {
+    HASYNCREQUEST hRequest = NULL;
     CAsyncLoader* pAsyncLoader = ( CAsyncLoader* )pContext;
     if( pAsyncLoader )
     {
-        CIndexBufferLoader* pLoader = new CIndexBufferLoader();
-        CIndexBufferProcessor* pProcessor = new CIndexBufferProcessor( pDev, ppBuffer, &BufferDesc, pData,
+        CIndexBufferLoader* pLoader = new CIndexBufferLoader( szFileName, &g_PackFile );
+        CIndexBufferProcessor* pProcessor = new CIndexBufferProcessor( pDev, ppBuffer, &BufferDesc, NULL,
                                                                        g_pResourceReuseCache );
 
-        pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer );
+
+        if( FAILED( pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer, Priority, &hRequest ) ) )
+        {
+            SAFE_DELETE( pLoader );
+            SAFE_DELETE( pProcessor );
+        }
     }
+
+    return hRequest;
 }
 
 
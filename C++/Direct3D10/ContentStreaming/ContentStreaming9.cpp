@@ -49,6 +49,7 @@ ID3DXFont*                          g_pFont9 = NULL;
 ID3DXSprite*                        g_pSprite9 = NULL;
 ID3DXEffect*                        g_pEffect9 = NULL;
 IDirect3DVertexDeclaration9*        g_pDeclTile = NULL;
+IDirect3DIndexBuffer9*              g_pTerrainLODIB9[TERRAIN_MAX_LODS][TERRAIN_NUM_STITCHES] = { NULL };
 
 // Effect variable handles
 D3DXHANDLE                          g_hTimeShift = 0;
@@ -112,16 +113,19 @@ void CALLBACK CreateVertexBuffer9_Serial( IDirect3DDevice9* pDev, IDirect3DVerte
                                           DWORD Usage, DWORD FVF, D3DPOOL Pool, void* pData, void* pContext );
 void CALLBACK CreateIndexBuffer9_Serial( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer, UINT iSizeBytes,
                                          DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool, void* pData, void* pContext );
-void CALLBACK CreateTextureFromFile9_Async( IDirect3DDevice9* pDev, WCHAR* szFileName, IDirect3DTexture9** ppTexture,
-                                            void* pContext );
-void CALLBACK CreateVertexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DVertexBuffer9** ppBuffer, UINT iSizeBytes,
-                                         DWORD Usage, DWORD FVF, D3DPOOL Pool, void* pData, void* pContext );
-void CALLBACK CreateIndexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer, UINT iSizeBytes,
-                                        DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool, void* pData, void* pContext );
+HASYNCREQUEST CALLBACK CreateTextureFromFile9_Async( IDirect3DDevice9* pDev, WCHAR* szFileName,
+                                                     IDirect3DTexture9** ppTexture, UINT Priority, void* pContext );
+HASYNCREQUEST CALLBACK CreateVertexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DVertexBuffer9** ppBuffer,
+                                                  UINT iSizeBytes, DWORD Usage, DWORD FVF, D3DPOOL Pool,
+                                                  WCHAR* szFileName, UINT Priority, void* pContext );
+HASYNCREQUEST CALLBACK CreateIndexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer,
+                                                 UINT iSizeBytes, DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool,
+                                                 WCHAR* szFileName, UINT Priority, void* pContext );
 
 extern void LoadStartupResources( IDirect3DDevice9* pDev9, ID3D10Device* pDev10, double fTime );
 extern void RenderText();
 extern void DestroyAllMeshes( LOADER_DEVICE_TYPE ldt );
+extern void ProcessDeviceUploads();
 
 //--------------------------------------------------------------------------------------
 // Rejects any D3D9 devices that aren't acceptable to the app by returning false
@@ -394,7 +398,9 @@ void RenderScene( IDirect3DDevice9* pd3dDevice, double fTime, float fElapsedTime
         NewTextureUploadsToVidMem = g_NumResourceToLoadPerFrame;
     iFrameNum ++;
 
-    // Render the level
+    // Render the level.  Tiles are drawn with the LOD and stitch SelectLODs picked for them,
+    // or with the full detail strips from the pack file if there are no LOD buffers.
+    bool bTerrainLODs = ( g_Terrain.GetNumLODs() > 0 && g_pTerrainLODIB9[0][0] != NULL );
     pd3dDevice->SetVertexDeclaration( g_pDeclTile );
     for( int i = 0; i < g_VisibleItemArray.GetSize(); i++ )
     {
@@ -409,7 +415,22 @@ void RenderScene( IDirect3DDevice9* pd3dDevice, double fTime, float fElapsedTime
         if( pItem->bLoaded )
         {
             pd3dDevice->SetStreamSource( 0, pItem->VB.pVB9, 0, sizeof( TERRAIN_VERTEX ) );
-            pd3dDevice->SetIndices( pItem->IB.pIB9 );
+
+            D3DPRIMITIVETYPE PrimitiveType = D3DPT_TRIANGLESTRIP;
+            UINT NumPrimitives = g_Terrain.GetNumIndices() - 2;
+            if( bTerrainLODs )
+            {
+                UINT iTile = g_Terrain.GetTileForPosition( &pItem->vCenter );
+                UINT iLOD = g_Terrain.GetTileLOD( iTile );
+                UINT Stitch = g_Terrain.GetTileStitch( iTile );
+                pd3dDevice->SetIndices( g_pTerrainLODIB9[iLOD][Stitch] );
+                PrimitiveType = D3DPT_TRIANGLELIST;
+                NumPrimitives = g_Terrain.GetLOD( iLOD )->NumIndices[Stitch] / 3;
+            }
+            else
+            {
+                pd3dDevice->SetIndices( pItem->IB.pIB9 );
+            }
 
             bool bDiff = pItem->Diffuse.pTexture9 ? true : false;
             if( bDiff && pItem->CurrentCountdownDiff > 0 )
@@ -472,8 +493,8 @@ void RenderScene( IDirect3DDevice9* pd3dDevice, double fTime, float fElapsedTime
             {
                 V( g_pEffect9->BeginPass( iPass ) );
 
-                pd3dDevice->DrawIndexedPrimitive( D3DPT_TRIANGLESTRIP, 0, 0, g_Terrain.GetNumTileVertices(), 0,
-                                                  g_Terrain.GetNumIndices() - 2 );
+                pd3dDevice->DrawIndexedPrimitive( PrimitiveType, 0, 0, g_Terrain.GetNumTileVertices(), 0,
+                                                  NumPrimitives );
 
                 V( g_pEffect9->EndPass() );
             }
@@ -533,12 +554,9 @@ void CALLBACK OnD3D9FrameRender( IDirect3DDevice9* pd3dDevice, double fTime, flo
         V( pd3dDevice->EndScene() );
     }
 
-    // Load in up to g_NumResourceToLoadPerFrame resources at the end of every frame
+    // Load in resources at the end of every frame
     if( LOAD_TYPE_MULTITHREAD == g_LoadType && APP_STATE_RENDER_SCENE == g_AppState )
-    {
-        UINT NumResToProcess = g_NumResourceToLoadPerFrame;
-        g_pAsyncLoader->ProcessDeviceWorkItems( NumResToProcess );
-    }
+        ProcessDeviceUploads();
 }
 
 
@@ -688,49 +706,75 @@ Finish:
 //--------------------------------------------------------------------------------------
 // Async create texture
 //--------------------------------------------------------------------------------------
-void	CALLBACK CreateTextureFromFile9_Async( IDirect3DDevice9* pDev, WCHAR* szFileName,
-                                               IDirect3DTexture9** ppTexture, void* pContext )
+HASYNCREQUEST CALLBACK CreateTextureFromFile9_Async( IDirect3DDevice9* pDev, WCHAR* szFileName,
+                                                     IDirect3DTexture9** ppTexture, UINT Priority, void* pContext )
 {
+    HASYNCREQUEST hRequest = NULL;
     CAsyncLoader* pAsyncLoader = ( CAsyncLoader* )pContext;
     if( pAsyncLoader )
     {
         CTextureLoader* pLoader = new CTextureLoader( szFileName, &g_PackFile );
         CTextureProcessor* pProcessor = new CTextureProcessor( pDev, ppTexture, g_pResourceReuseCache, g_SkipMips );
 
-        pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppTexture );
+
+        if( FAILED( pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppTexture, Priority, &hRequest ) ) )
+        {
+            SAFE_DELETE( pLoader );
+            SAFE_DELETE( pProcessor );
+        }
     }
+
+    return hRequest;
 }
 
 //--------------------------------------------------------------------------------------
 // Async create VB
 //--------------------------------------------------------------------------------------
-void	CALLBACK CreateVertexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DVertexBuffer9** ppBuffer, UINT iSizeBytes,
-                                            DWORD Usage, DWORD FVF, D3DPOOL Pool, void* pData, void* pContext )
+HASYNCREQUEST CALLBACK CreateVertexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DVertexBuffer9** ppBuffer,
+                                                  UINT iSizeBytes, DWORD Usage, DWORD FVF, D3DPOOL Pool,
+                                                  WCHAR* szFileName, UINT Priority, void* pContext )
 {
+    HASYNCREQUEST hRequest = NULL;
     CAsyncLoader* pAsyncLoader = ( CAsyncLoader* )pContext;
     if( pAsyncLoader )
     {
-        CVertexBufferLoader* pLoader = new CVertexBufferLoader();
+        CVertexBufferLoader* pLoader = new CVertexBufferLoader( szFileName, &g_PackFile );
         CVertexBufferProcessor* pProcessor = new CVertexBufferProcessor( pDev, ppBuffer, iSizeBytes, Usage, FVF, Pool,
-                                                                         pData, g_pResourceReuseCache );
+                                                                         NULL, g_pResourceReuseCache );
+
 
-        pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer );
+        if( FAILED( pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer, Priority, &hRequest ) ) )
+        {
+            SAFE_DELETE( pLoader );
+            SAFE_DELETE( pProcessor );
+        }
     }
+
+    return hRequest;
 }
 
 //--------------------------------------------------------------------------------------
 // Async create IB
 //--------------------------------------------------------------------------------------
-void	CALLBACK CreateIndexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer, UINT iSizeBytes,
-                                           DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool, void* pData, void* pContext )
+HASYNCREQUEST CALLBACK CreateIndexBuffer9_Async( IDirect3DDevice9* pDev, IDirect3DIndexBuffer9** ppBuffer,
+                                                 UINT iSizeBytes, DWORD Usage, D3DFORMAT ibFormat, D3DPOOL Pool,
+                                                 WCHAR* szFileName, UINT Priority, void* pContext )
 {
+    HASYNCREQUEST hRequest = NULL;
     CAsyncLoader* pAsyncLoader = ( CAsyncLoader* )pContext;
     if( pAsyncLoader )
     {
-        CIndexBufferLoader* pLoader = new CIndexBufferLoader();
+        CIndexBufferLoader* pLoader = new CIndexBufferLoader( szFileName, &g_PackFile );
         CIndexBufferProcessor* pProcessor = new CIndexBufferProcessor( pDev, ppBuffer, iSizeBytes, Usage, ibFormat,
-                                                                       Pool, pData, g_pResourceReuseCache );
+                                                                       Pool, NULL, g_pResourceReuseCache );
 
-        pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer );
+
+        if( FAILED( pAsyncLoader->AddWorkItem( pLoader, pProcessor, NULL, ( void** )ppBuffer, Priority, &hRequest ) ) )
+        {
+            SAFE_DELETE( pLoader );
+            SAFE_DELETE( pProcessor );
+        }
     }
+
+    return hRequest;
 }
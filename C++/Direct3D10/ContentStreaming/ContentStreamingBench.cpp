@@ -0,0 +1,927 @@
+//--------------------------------------------------------------------------------------
+// File: ContentStreamingBench.cpp
+//
+// Headless benchmarks that run from the command line in place of the sample, without
+// creating a window or a device.  Results go to the console and the debugger.
+//    ContentStreaming.exe -visbench [frames]
+//    ContentStreaming.exe -uploadsim [frames]
+//    ContentStreaming.exe -terrainbench [heightmap.bmp]
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#include "DXUT.h"
+#include "DXUTmisc.h"
+#include "SDKmisc.h"
+#include "AsyncLoader.h"
+#include "PackedFile.h"
+#include "LevelItemGrid.h"
+#include "UploadScheduler.h"
+#include "Terrain.h"
+#include "ContentStreamingBench.h"
+
+//--------------------------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------------------------
+#define DEG2RAD(p) ( D3DX_PI*(p/180.0f) )
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Global variables
+//--------------------------------------------------------------------------------------
+HANDLE                              g_hBenchmarkConsole = NULL;
+
+// The sample's camera settings, which the terrain benchmark uses
+extern float                        g_fFOV;
+extern float                        g_fViewHeight;
+
+//--------------------------------------------------------------------------------------
+// Forward declarations
+//--------------------------------------------------------------------------------------
+extern void RemoveItemsOutsideLoadRadius( CGrowableArray <LEVEL_ITEM*>* pItems );
+
+int RunVisibilityBenchmark( UINT NumFrames );
+int RunUploadSimulation( UINT NumFrames );
+int RunTerrainBenchmark( LPCWSTR strHeightMap );
+
+
+//--------------------------------------------------------------------------------------
+bool RunCommandLineBenchmark( int* pExitCode )
+{
+    int nArgs = 0;
+    LPWSTR* pstrArgs = CommandLineToArgvW( GetCommandLineW(), &nArgs );
+    if( !pstrArgs )
+        return false;
+
+    LPCWSTR strBenchmark = ( nArgs >= 2 ) ? pstrArgs[1] : L"";
+    LPCWSTR strParam = ( nArgs >= 3 ) ? pstrArgs[2] : L"";
+    if( _wcsicmp( strBenchmark, L"-visbench" ) && _wcsicmp( strBenchmark, L"-uploadsim" ) &&
+        _wcsicmp( strBenchmark, L"-terrainbench" ) )
+    {
+        LocalFree( pstrArgs );
+        return false;
+    }
+
+    if( AttachConsole( ATTACH_PARENT_PROCESS ) || AllocConsole() )
+        g_hBenchmarkConsole = GetStdHandle( STD_OUTPUT_HANDLE );
+
+    UINT NumFrames = ( UINT )_wtoi( strParam );
+    if( !_wcsicmp( strBenchmark, L"-visbench" ) )
+        *pExitCode = RunVisibilityBenchmark( ( NumFrames > 0 ) ? NumFrames : 2000 );
+    else if( !_wcsicmp( strBenchmark, L"-uploadsim" ) )
+        *pExitCode = RunUploadSimulation( ( NumFrames > 0 ) ? NumFrames : 3000 );
+    else
+        *pExitCode = RunTerrainBenchmark( strParam );
+
+    LocalFree( pstrArgs );
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Write a line of benchmark output to the console and the debugger
+//--------------------------------------------------------------------------------------
+void BenchmarkPrint( LPCWSTR strFormat, ... )
+{
+    WCHAR strLine[256];
+    va_list args;
+    va_start( args, strFormat );
+    vswprintf_s( strLine, 256, strFormat, args );
+    va_end( args );
+
+    OutputDebugStringW( strLine );
+    if( g_hBenchmarkConsole != INVALID_HANDLE_VALUE && g_hBenchmarkConsole != NULL )
+    {
+        DWORD dwWritten;
+        WriteConsoleW( g_hBenchmarkConsole, strLine, ( DWORD )wcslen( strLine ), &dwWritten, NULL );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+double GetBenchmarkTime()
+{
+    LARGE_INTEGER liFreq;
+    LARGE_INTEGER liTime;
+    QueryPerformanceFrequency( &liFreq );
+    QueryPerformanceCounter( &liTime );
+    return ( double )liTime.QuadPart / ( double )liFreq.QuadPart;
+}
+
+//--------------------------------------------------------------------------------------
+// Visibility benchmark
+//--------------------------------------------------------------------------------------
+#define VISBENCH_NUM_ITEMS      100000
+#define VISBENCH_WORLD_SIZE     20000.0f
+#define VISBENCH_HEIGHT_SCALE   300.0f
+#define VISBENCH_LOAD_RADIUS    1000.0f
+
+//--------------------------------------------------------------------------------------
+// The item loop CalculateVisibleItems used before the level grid, without the frustum
+// test or the bInLoadRadius flags, which the grid owns
+//--------------------------------------------------------------------------------------
+void CalculateVisibleItemsBruteForce( CGrowableArray <LEVEL_ITEM*>* pLevelItems, D3DXVECTOR3 vEye, float fVisRadius,
+                                      float fLoadRadius, CGrowableArray <LEVEL_ITEM*>* pVisibleItems,
+                                      CGrowableArray <LEVEL_ITEM*>* pLoadedItems )
+{
+    pVisibleItems->Reset();
+    pLoadedItems->Reset();
+
+    for( int i = 0; i < pLevelItems->GetSize(); i++ )
+    {
+        LEVEL_ITEM* pItem = pLevelItems->GetAt( i );
+
+        D3DXVECTOR3 vDelta = vEye - pItem->vCenter;
+        float len2 = D3DXVec3LengthSq( &vDelta );
+        if( len2 < fVisRadius * fVisRadius )
+            pVisibleItems->Add( pItem );
+        if( len2 < fLoadRadius * fLoadRadius )
+            pLoadedItems->Add( pItem );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Camera for frame iFrame of the benchmark path.  The camera sweeps the level on a
+// Lissajous curve, jumps a third of the level over every 500 frames, and the radii shrink
+// for the second half of the run as they do when the visible radius slider is moved.
+//--------------------------------------------------------------------------------------
+void GetBenchmarkCamera( UINT iFrame, UINT NumFrames, D3DXVECTOR3* pvEye, float* pfVisRadius, float* pfLoadRadius )
+{
+    float t = ( float )iFrame / ( float )NumFrames;
+    float fX = 0.5f + 0.4f * sinf( 2.0f * D3DX_PI * 3.0f * t );
+    float fZ = 0.5f + 0.4f * sinf( 2.0f * D3DX_PI * 2.0f * t + 0.5f );
+    if( ( iFrame / 500 ) & 1 )
+        fX = fmodf( fX + 1.0f / 3.0f, 1.0f );
+
+    pvEye->x = fX * VISBENCH_WORLD_SIZE;
+    pvEye->y = VISBENCH_HEIGHT_SCALE * ( 0.5f + 0.5f * sinf( 2.0f * D3DX_PI * 7.0f * t ) ) + 7.5f;
+    pvEye->z = fZ * VISBENCH_WORLD_SIZE;
+
+    *pfLoadRadius = ( iFrame < NumFrames / 2 ) ? VISBENCH_LOAD_RADIUS : VISBENCH_LOAD_RADIUS * 0.75f;
+    *pfVisRadius = *pfLoadRadius * 0.8f;
+}
+
+//--------------------------------------------------------------------------------------
+int __cdecl CompareItemPointers( const void* pA, const void* pB )
+{
+    const LEVEL_ITEM* pItemA = *( const LEVEL_ITEM** )pA;
+    const LEVEL_ITEM* pItemB = *( const LEVEL_ITEM** )pB;
+    return ( pItemA < pItemB ) ? -1 : ( ( pItemA > pItemB ) ? 1 : 0 );
+}
+
+//--------------------------------------------------------------------------------------
+// True if the two arrays hold the same items in any order.  Sorts both arrays.
+//--------------------------------------------------------------------------------------
+bool SameItems( CGrowableArray <LEVEL_ITEM*>* pA, CGrowableArray <LEVEL_ITEM*>* pB )
+{
+    if( pA->GetSize() != pB->GetSize() )
+        return false;
+    if( pA->GetSize() == 0 )
+        return true;
+
+    qsort( pA->GetData(), pA->GetSize(), sizeof( LEVEL_ITEM* ), CompareItemPointers );
+    qsort( pB->GetData(), pB->GetSize(), sizeof( LEVEL_ITEM* ), CompareItemPointers );
+    return 0 == memcmp( pA->GetData(), pB->GetData(), pA->GetSize() * sizeof( LEVEL_ITEM* ) );
+}
+
+//--------------------------------------------------------------------------------------
+// Headless benchmark of the visible and loaded item sets.  A synthetic level of
+// VISBENCH_NUM_ITEMS items is scattered over a square world, and a camera path is
+// replayed over it once with the brute force loop and once per grid cell size.  The grid
+// path does what CalculateVisibleItems does each frame, and every frame its sets are
+// checked against the brute force ones.
+//--------------------------------------------------------------------------------------
+int RunVisibilityBenchmark( UINT NumFrames )
+{
+    // Items are allocated one at a time, as LoadPackedFile does, so the brute force loop
+    // walks memory the way it does in the sample
+    CGrowableArray <LEVEL_ITEM*> LevelItems;
+    UINT Seed = 12345;
+    for( int i = 0; i < VISBENCH_NUM_ITEMS; i++ )
+    {
+        LEVEL_ITEM* pItem = new LEVEL_ITEM;
+        if( !pItem || FAILED( LevelItems.Add( pItem ) ) )
+        {
+            SAFE_DELETE( pItem );
+            BenchmarkPrint( L"Out of memory creating the level\r\n" );
+            for( int j = 0; j < LevelItems.GetSize(); j++ )
+                delete LevelItems.GetAt( j );
+            return 1;
+        }
+        ZeroMemory( pItem, sizeof( LEVEL_ITEM ) );
+
+        float fPos[3];
+        for( int j = 0; j < 3; j++ )
+        {
+            Seed = Seed * 1664525 + 1013904223;
+            fPos[j] = ( float )( Seed >> 8 ) / ( float )( 1 << 24 );
+        }
+        pItem->vCenter = D3DXVECTOR3( fPos[0] * VISBENCH_WORLD_SIZE, fPos[1] * VISBENCH_HEIGHT_SCALE,
+                                      fPos[2] * VISBENCH_WORLD_SIZE );
+    }
+
+    BenchmarkPrint( L"\r\nContentStreaming visibility: %d items, %u frames, loading radius %.0f\r\n",
+                    VISBENCH_NUM_ITEMS, NumFrames, VISBENCH_LOAD_RADIUS );
+    BenchmarkPrint( L"%-22s %8s %12s %12s %10s %10s\r\n", L"Method", L"Cells", L"Avg us/frame",
+                    L"Max us/frame", L"Speedup", L"Mismatches" );
+
+    CGrowableArray <LEVEL_ITEM*> RefVisible;
+    CGrowableArray <LEVEL_ITEM*> RefLoaded;
+    CGrowableArray <LEVEL_ITEM*> Visible;
+    CGrowableArray <LEVEL_ITEM*> Loaded;
+    CGrowableArray <LEVEL_ITEM*> Exited;
+    CGrowableArray <LEVEL_ITEM*> Scratch;
+
+    // Brute force timings
+    double fBruteTotal = 0.0;
+    double fBruteMax = 0.0;
+    UINT64 NumLoadedTotal = 0;
+    for( UINT iFrame = 0; iFrame < NumFrames; iFrame++ )
+    {
+        D3DXVECTOR3 vEye;
+        float fVisRadius, fLoadRadius;
+        GetBenchmarkCamera( iFrame, NumFrames, &vEye, &fVisRadius, &fLoadRadius );
+
+        double fTime = GetBenchmarkTime();
+        CalculateVisibleItemsBruteForce( &LevelItems, vEye, fVisRadius, fLoadRadius, &RefVisible, &RefLoaded );
+        fTime = GetBenchmarkTime() - fTime;
+
+        fBruteTotal += fTime;
+        fBruteMax = max( fBruteMax, fTime );
+        NumLoadedTotal += RefLoaded.GetSize();
+    }
+    BenchmarkPrint( L"%-22s %8s %12.1f %12.1f %10s %10s\r\n", L"Brute force", L"-",
+                    fBruteTotal * 1e6 / NumFrames, fBruteMax * 1e6, L"1.00x", L"-" );
+
+    // Grid timings and validation, at a few cell sizes
+    static const float s_fCellsPerRadius[] = { 2.0f, 4.0f, 8.0f };
+    UINT NumMismatches = 0;
+    UINT64 NumChangedTotal = 0;
+    for( UINT iSize = 0; iSize < ARRAYSIZE( s_fCellsPerRadius ); iSize++ )
+    {
+        for( int i = 0; i < LevelItems.GetSize(); i++ )
+            LevelItems.GetAt( i )->bInLoadRadius = false;
+        Loaded.Reset();
+
+        CLevelItemGrid Grid;
+        if( FAILED( Grid.Create( &LevelItems, VISBENCH_LOAD_RADIUS / s_fCellsPerRadius[iSize] ) ) )
+        {
+            BenchmarkPrint( L"Out of memory creating the grid\r\n" );
+            NumMismatches++;
+            break;
+        }
+
+        double fGridTotal = 0.0;
+        double fGridMax = 0.0;
+        UINT SizeMismatches = 0;
+        NumChangedTotal = 0;
+        for( UINT iFrame = 0; iFrame < NumFrames; iFrame++ )
+        {
+            D3DXVECTOR3 vEye;
+            float fVisRadius, fLoadRadius;
+            GetBenchmarkCamera( iFrame, NumFrames, &vEye, &fVisRadius, &fLoadRadius );
+
+            int NumLoadedBefore = Loaded.GetSize();
+            double fTime = GetBenchmarkTime();
+            Visible.Reset();
+            Exited.Reset();
+            Grid.UpdateLoadRadius( vEye, fLoadRadius, &Loaded, &Exited );
+            if( Exited.GetSize() > 0 )
+                RemoveItemsOutsideLoadRadius( &Loaded );
+            Grid.GetItemsInRadius( vEye, fVisRadius, &Visible );
+            fTime = GetBenchmarkTime() - fTime;
+
+            fGridTotal += fTime;
+            fGridMax = max( fGridMax, fTime );
+            NumChangedTotal += ( Loaded.GetSize() + Exited.GetSize() - NumLoadedBefore ) + Exited.GetSize();
+
+            // Compare against the brute force sets.  The loaded items are compared through
+            // a copy so their order is left as the sample would see it.
+            CalculateVisibleItemsBruteForce( &LevelItems, vEye, fVisRadius, fLoadRadius, &RefVisible, &RefLoaded );
+            Scratch.Reset();
+            for( int i = 0; i < Loaded.GetSize(); i++ )
+                Scratch.Add( Loaded.GetAt( i ) );
+            if( !SameItems( &Visible, &RefVisible ) || !SameItems( &Scratch, &RefLoaded ) )
+                SizeMismatches++;
+        }
+        NumMismatches += SizeMismatches;
+
+        WCHAR strMethod[32];
+        WCHAR strCells[32];
+        WCHAR strSpeedup[32];
+        swprintf_s( strMethod, 32, L"Grid, radius/%.0f cells", s_fCellsPerRadius[iSize] );
+        swprintf_s( strCells, 32, L"%d", Grid.GetNumCells() );
+        swprintf_s( strSpeedup, 32, L"%.2fx", ( fGridTotal > 0.0 ) ? fBruteTotal / fGridTotal : 0.0 );
+        BenchmarkPrint( L"%-22s %8s %12.1f %12.1f %10s %10u\r\n", strMethod, strCells,
+                        fGridTotal * 1e6 / NumFrames, fGridMax * 1e6, strSpeedup, SizeMismatches );
+    }
+
+    BenchmarkPrint( L"Average of %.0f items in the loading radius, %.1f entering or leaving it per frame\r\n",
+                    ( double )NumLoadedTotal / NumFrames, ( double )NumChangedTotal / NumFrames );
+    BenchmarkPrint( ( NumMismatches == 0 ) ? L"The grid matched the brute force results on every frame\r\n" :
+                    L"The grid did NOT match the brute force results\r\n" );
+
+    for( int i = 0; i < LevelItems.GetSize(); i++ )
+    {
+        LEVEL_ITEM* pItem = LevelItems.GetAt( i );
+        SAFE_DELETE( pItem );
+    }
+
+    return ( NumMismatches == 0 ) ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Upload simulation
+//--------------------------------------------------------------------------------------
+#define UPLOADSIM_RENDER_MS         8.0     // frame time without any uploads
+#define UPLOADSIM_ITEM_MS           0.05    // fixed cost of each upload
+#define UPLOADSIM_FAST_BYTES_PER_MS ( 2.0 * 1024.0 * 1024.0 )
+#define UPLOADSIM_SLOW_BYTES_PER_MS ( 0.5 * 1024.0 * 1024.0 )
+#define UPLOADSIM_TARGET_MS         ( 1000.0 / 60.0 )
+#define UPLOADSIM_BURST_FRAMES      90      // a burst of tiles streams in this often
+#define UPLOADSIM_BURST_TILES       16
+
+struct UPLOADSIM_REQUEST
+{
+    UINT cBytes;
+    UINT Priority;
+    UINT ArrivalFrame;
+};
+
+struct UPLOADSIM_POLICY
+{
+    const WCHAR* strName;
+    UINT ItemsPerFrame;         // 0 for the upload scheduler
+    float fBudgetMs;
+};
+
+//--------------------------------------------------------------------------------------
+UINT UploadSimRandom( UINT* pSeed )
+{
+    *pSeed = *pSeed * 1664525 + 1013904223;
+    return *pSeed >> 8;
+}
+
+//--------------------------------------------------------------------------------------
+// Adds the four resources of a tile, as SmartLoadMesh requests them.  Texture sizes vary
+// from 256 KB to 16 MB, the buffers are small.
+//--------------------------------------------------------------------------------------
+void AddUploadSimTile( CGrowableArray <UPLOADSIM_REQUEST>* pRequests, UINT iFrame, UINT* pSeed )
+{
+    UINT Priority = UploadSimRandom( pSeed ) % NUM_LOADER_PRIORITIES;
+    UPLOADSIM_REQUEST Request;
+    Request.Priority = Priority;
+    Request.ArrivalFrame = iFrame;
+
+    Request.cBytes = 64 * 1024;
+    pRequests->Add( Request );
+    Request.cBytes = 8 * 1024;
+    pRequests->Add( Request );
+    for( int i = 0; i < 2; i++ )
+    {
+        UINT Pick = UploadSimRandom( pSeed ) % 100;
+        Request.cBytes = ( Pick < 50 ) ? 256 * 1024 : ( Pick < 80 ) ? 1024 * 1024 : ( Pick < 95 ) ? 4 * 1024 * 1024 :
+                         16 * 1024 * 1024;
+        pRequests->Add( Request );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+int __cdecl CompareDoubles( const void* pA, const void* pB )
+{
+    double fA = *( const double* )pA;
+    double fB = *( const double* )pB;
+    return ( fA < fB ) ? -1 : ( ( fA > fB ) ? 1 : 0 );
+}
+
+//--------------------------------------------------------------------------------------
+// Nearest rank percentile.  Sorts the values in place.
+//--------------------------------------------------------------------------------------
+double GetPercentile( CGrowableArray <double>* pValues, double fPercentile )
+{
+    if( pValues->GetSize() == 0 )
+        return 0.0;
+
+    qsort( pValues->GetData(), pValues->GetSize(), sizeof( double ), CompareDoubles );
+    int iIndex = ( int )( fPercentile / 100.0 * ( pValues->GetSize() - 1 ) + 0.5 );
+    return pValues->GetAt( iIndex );
+}
+
+//--------------------------------------------------------------------------------------
+double GetAverage( CGrowableArray <double>* pValues )
+{
+    double fSum = 0.0;
+    for( int i = 0; i < pValues->GetSize(); i++ )
+        fSum += pValues->GetAt( i );
+    return ( pValues->GetSize() > 0 ) ? fSum / pValues->GetSize() : 0.0;
+}
+
+//--------------------------------------------------------------------------------------
+// Headless simulation of the end of frame uploads.  A synthetic stream of requests
+// (bursts of tiles as the camera crosses into new areas, plus a trickle in between) is
+// queued by priority as the loader does, and each policy services the queue once a
+// frame.  Uploads cost a fixed time plus their size over the upload rate, which drops
+// to a quarter for the middle fifth of the run, as when another process contends for
+// the bus.  Reported per policy:
+//    frame time average, standard deviation, maximum and the frames that miss 60 Hz
+//    time to visible, from the start of the frame a request arrives to the end of the
+//    frame it is uploaded on, for the nearest priority and for all requests
+//--------------------------------------------------------------------------------------
+int RunUploadSimulation( UINT NumFrames )
+{
+    CGrowableArray <UPLOADSIM_REQUEST> Requests;
+    UINT Seed = 4321;
+    for( UINT iFrame = 0; iFrame < NumFrames; iFrame++ )
+    {
+        if( 0 == iFrame % UPLOADSIM_BURST_FRAMES )
+        {
+            for( int i = 0; i < UPLOADSIM_BURST_TILES; i++ )
+                AddUploadSimTile( &Requests, iFrame, &Seed );
+        }
+        else if( UploadSimRandom( &Seed ) % 10 == 0 )
+        {
+            AddUploadSimTile( &Requests, iFrame, &Seed );
+        }
+    }
+
+    static const UPLOADSIM_POLICY s_Policies[] =
+    {
+        { L"1 item/frame", 1, 0.0f },
+        { L"4 items/frame", 4, 0.0f },
+        { L"Budget 1 ms", 0, 1.0f },
+        { L"Budget 2 ms", 0, 2.0f },
+        { L"Budget 4 ms", 0, 4.0f },
+    };
+
+    BenchmarkPrint( L"\r\nContentStreaming upload simulation: %d requests over %u frames, %.1f ms render time\r\n",
+                    Requests.GetSize(), NumFrames, UPLOADSIM_RENDER_MS );
+    BenchmarkPrint( L"%-14s %9s %8s %8s %7s %10s %10s %10s %10s %6s\r\n", L"Policy", L"Frame ms",
+                    L"Std dev", L"Max", L">16.7", L"Near TTV", L"Near p95", L"All TTV", L"All p95", L"Done" );
+
+    for( UINT iPolicy = 0; iPolicy < ARRAYSIZE( s_Policies ); iPolicy++ )
+    {
+        const UPLOADSIM_POLICY& Policy = s_Policies[iPolicy];
+        CUploadScheduler Scheduler;
+        Scheduler.SetBudget( Policy.fBudgetMs, UPLOAD_MAX_BYTES_PER_FRAME );
+
+        // One FIFO of request indices per priority, like the loader's request rings
+        CGrowableArray <int> Queues[NUM_LOADER_PRIORITIES];
+        int QueueHeads[NUM_LOADER_PRIORITIES] = {0};
+        CGrowableArray <double> FrameStarts;
+        CGrowableArray <double> FrameTimes;
+        CGrowableArray <double> NearTTV;
+        CGrowableArray <double> AllTTV;
+        CGrowableArray <int> Completed;
+
+        int iNextRequest = 0;
+        double fClock = 0.0;
+        for( UINT iFrame = 0; iFrame < NumFrames; iFrame++ )
+        {
+            FrameStarts.Add( fClock );
+            while( iNextRequest < Requests.GetSize() && Requests.GetAt( iNextRequest ).ArrivalFrame == iFrame )
+            {
+                Queues[ Requests.GetAt( iNextRequest ).Priority ].Add( iNextRequest );
+                iNextRequest++;
+            }
+
+            bool bSlow = ( iFrame >= NumFrames * 2 / 5 && iFrame < NumFrames * 3 / 5 );
+            double fBytesPerMs = bSlow ? UPLOADSIM_SLOW_BYTES_PER_MS : UPLOADSIM_FAST_BYTES_PER_MS;
+
+            Scheduler.BeginFrame();
+            Completed.Reset();
+            double fUploadMs = 0.0;
+            for(; ; )
+            {
+                int iQueue = 0;
+                while( iQueue < NUM_LOADER_PRIORITIES && QueueHeads[iQueue] == Queues[iQueue].GetSize() )
+                    iQueue++;
+                if( iQueue == NUM_LOADER_PRIORITIES )
+                    break;
+
+                const UPLOADSIM_REQUEST& Request = Requests.GetAt( Queues[iQueue].GetAt( QueueHeads[iQueue] ) );
+                if( Policy.ItemsPerFrame > 0 ? ( UINT )Completed.GetSize() >= Policy.ItemsPerFrame :
+                    !Scheduler.CanProcess( Request.cBytes ) )
+                    break;
+
+                double fItemMs = UPLOADSIM_ITEM_MS + Request.cBytes / fBytesPerMs;
+                Scheduler.OnProcessed( Request.cBytes, fItemMs / 1000.0 );
+                fUploadMs += fItemMs;
+                Completed.Add( Queues[iQueue].GetAt( QueueHeads[iQueue] ) );
+                QueueHeads[iQueue]++;
+            }
+
+            double fFrameMs = UPLOADSIM_RENDER_MS + fUploadMs;
+            FrameTimes.Add( fFrameMs );
+            fClock += fFrameMs;
+
+            for( int i = 0; i < Completed.GetSize(); i++ )
+            {
+                const UPLOADSIM_REQUEST& Request = Requests.GetAt( Completed.GetAt( i ) );
+                double fTTV = fClock - FrameStarts.GetAt( Request.ArrivalFrame );
+                AllTTV.Add( fTTV );
+                if( LOADER_PRIORITY_HIGHEST == Request.Priority )
+                    NearTTV.Add( fTTV );
+            }
+        }
+
+        double fAverage = GetAverage( &FrameTimes );
+        double fVariance = 0.0;
+        UINT NumLate = 0;
+        for( int i = 0; i < FrameTimes.GetSize(); i++ )
+        {
+            double fFrameMs = FrameTimes.GetAt( i );
+            fVariance += ( fFrameMs - fAverage ) * ( fFrameMs - fAverage );
+            if( fFrameMs > UPLOADSIM_TARGET_MS )
+                NumLate++;
+        }
+        fVariance /= max( 1, FrameTimes.GetSize() );
+
+        double fNearAverage = GetAverage( &NearTTV );
+        double fAllAverage = GetAverage( &AllTTV );
+        double fNearP95 = GetPercentile( &NearTTV, 95.0 );
+        double fAllP95 = GetPercentile( &AllTTV, 95.0 );
+        double fMax = GetPercentile( &FrameTimes, 100.0 );
+        BenchmarkPrint( L"%-14s %9.2f %8.2f %8.2f %7u %10.0f %10.0f %10.0f %10.0f %5.0f%%\r\n",
+                        Policy.strName, fAverage, sqrt( fVariance ), fMax, NumLate, fNearAverage, fNearP95,
+                        fAllAverage, fAllP95, 100.0 * AllTTV.GetSize() / max( 1, Requests.GetSize() ) );
+    }
+
+    BenchmarkPrint( L"Times in ms.  TTV is time to visible; Done is the share of requests uploaded by the last frame.\r\n" );
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Terrain benchmark
+//--------------------------------------------------------------------------------------
+#define TERRAINBENCH_FRAMES         1000
+#define TERRAINBENCH_VIEWPORT       1080.0f
+#define TERRAINBENCH_NUM_QUERIES    ( 1 << 20 )
+#define TERRAINBENCH_NUM_NORMALS    ( 1 << 18 )
+#define TERRAINBENCH_NUM_RAYS       20000
+#define TERRAINBENCH_RAY_LENGTH     1000.0f
+#define TERRAINBENCH_MARCH_STEP     0.5f
+
+//--------------------------------------------------------------------------------------
+// Checks every index list of every LOD: the triangles must cover the tile exactly once
+// and have the tile strips' winding, and the vertices each list uses along each edge are
+// recorded in pEdgeMasks (N + 1 flags per LOD, stitch and side) for the crack check.
+// Returns the number of lists that fail.
+//--------------------------------------------------------------------------------------
+UINT CheckTerrainLODs( CTerrain* pTerrain, BYTE* pEdgeMasks )
+{
+    UINT N = pTerrain->GetNumSidesPerTile();
+    UINT NumFailed = 0;
+    for( UINT iLOD = 0; iLOD < pTerrain->GetNumLODs(); iLOD++ )
+    {
+        TERRAIN_LOD* pLOD = pTerrain->GetLOD( iLOD );
+        for( UINT Stitch = 0; Stitch < TERRAIN_NUM_STITCHES; Stitch++ )
+        {
+            BYTE* pMasks = &pEdgeMasks[ ( ( iLOD * TERRAIN_NUM_STITCHES + Stitch ) * 4 ) * ( N + 1 ) ];
+            ZeroMemory( pMasks, 4 * ( N + 1 ) );
+
+            INT64 DoubleArea = 0;
+            bool bFailed = ( pLOD->NumIndices[Stitch] % 3 ) != 0;
+            for( UINT i = 0; i + 2 < pLOD->NumIndices[Stitch]; i += 3 )
+            {
+                int x[3], z[3];
+                for( UINT v = 0; v < 3; v++ )
+                {
+                    UINT iVertex = ( USHORT )pLOD->pIndices[Stitch][i + v];
+                    x[v] = iVertex % ( N + 1 );
+                    z[v] = iVertex / ( N + 1 );
+                    if( x[v] == 0 ) pMasks[ 0 * ( N + 1 ) + z[v] ] = 1;
+                    if( x[v] == ( int )N ) pMasks[ 1 * ( N + 1 ) + z[v] ] = 1;
+                    if( z[v] == 0 ) pMasks[ 2 * ( N + 1 ) + x[v] ] = 1;
+                    if( z[v] == ( int )N ) pMasks[ 3 * ( N + 1 ) + x[v] ] = 1;
+                }
+
+                // The strips' first triangle goes (0,0) (0,1) (1,0), which is negative here
+                int Cross = ( x[1] - x[0] ) * ( z[2] - z[0] ) - ( z[1] - z[0] ) * ( x[2] - x[0] );
+                if( Cross >= 0 )
+                    bFailed = true;
+                DoubleArea -= Cross;
+            }
+            if( DoubleArea != 2 * ( INT64 )N * N )
+                bFailed = true;
+            if( bFailed )
+                NumFailed++;
+        }
+    }
+    return NumFailed;
+}
+
+//--------------------------------------------------------------------------------------
+// Counts the shared edges where the two tiles are more than one LOD apart or don't use
+// the same vertices along the edge
+//--------------------------------------------------------------------------------------
+UINT CountTerrainCracks( CTerrain* pTerrain, BYTE* pEdgeMasks )
+{
+    UINT N = pTerrain->GetNumSidesPerTile();
+    UINT SqrtNumTiles = pTerrain->GetSqrtNumTiles();
+    UINT NumCracks = 0;
+    for( UINT z = 0; z < SqrtNumTiles; z++ )
+    {
+        for( UINT x = 0; x < SqrtNumTiles; x++ )
+        {
+            UINT iTile = z * SqrtNumTiles + x;
+            for( UINT iNeighbor = 0; iNeighbor < 2; iNeighbor++ )
+            {
+                // The right and the top neighbors
+                if( ( 0 == iNeighbor && x + 1 == SqrtNumTiles ) || ( 1 == iNeighbor && z + 1 == SqrtNumTiles ) )
+                    continue;
+                UINT iOther = ( 0 == iNeighbor ) ? iTile + 1 : iTile + SqrtNumTiles;
+                UINT Side = ( 0 == iNeighbor ) ? 1 : 3;
+                UINT OtherSide = Side - 1;
+
+                UINT LOD = pTerrain->GetTileLOD( iTile );
+                UINT OtherLOD = pTerrain->GetTileLOD( iOther );
+                BYTE* pMask = &pEdgeMasks[ ( ( LOD * TERRAIN_NUM_STITCHES + pTerrain->GetTileStitch( iTile ) ) * 4 +
+                                             Side ) * ( N + 1 ) ];
+                BYTE* pOtherMask = &pEdgeMasks[ ( ( OtherLOD * TERRAIN_NUM_STITCHES +
+                                                    pTerrain->GetTileStitch( iOther ) ) * 4 + OtherSide ) * ( N + 1 ) ];
+                if( LOD > OtherLOD + 1 || OtherLOD > LOD + 1 || memcmp( pMask, pOtherMask, N + 1 ) )
+                    NumCracks++;
+            }
+        }
+    }
+    return NumCracks;
+}
+
+//--------------------------------------------------------------------------------------
+// Reference ray cast: steps along the ray sampling GetHeightOnMap and bisects the first
+// step that ends under the terrain.  Crossings thinner than a step are missed.
+//--------------------------------------------------------------------------------------
+bool MarchTerrainRay( CTerrain* pTerrain, const D3DXVECTOR3* pOrigin, const D3DXVECTOR3* pDir, float fMaxDist,
+                      float* pfDist )
+{
+    float tPrev = 0.0f;
+    for( float t = 0.0f; t <= fMaxDist; t += TERRAINBENCH_MARCH_STEP )
+    {
+        D3DXVECTOR3 vPos = *pOrigin + *pDir * t;
+        if( pTerrain->GetHeightOnMap( &vPos ) >= vPos.y )
+        {
+            if( t == 0.0f )
+            {
+                *pfDist = 0.0f;
+                return true;
+            }
+
+            float tAbove = tPrev;
+            float tBelow = t;
+            for( int i = 0; i < 24; i++ )
+            {
+                float tMid = ( tAbove + tBelow ) * 0.5f;
+                vPos = *pOrigin + *pDir * tMid;
+                if( pTerrain->GetHeightOnMap( &vPos ) >= vPos.y )
+                    tBelow = tMid;
+                else
+                    tAbove = tMid;
+            }
+            *pfDist = tBelow;
+            return true;
+        }
+        tPrev = t;
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Headless checks and timings for the terrain on the CPU, using the sample's terrain
+// settings and heightmap unless another BMP heightmap is given:
+//    the LOD index lists, and the triangle counts SelectLODs gives along a camera path
+//    for a few pixel error limits, with every frame checked for cracks
+//    GetHeightsOnMap and GetNormalsOnMap against a loop over the single queries
+//    IntersectRays against a ray march, for rays cast down from above the terrain and
+//    nearly level from eye height
+//--------------------------------------------------------------------------------------
+int RunTerrainBenchmark( LPCWSTR strHeightMap )
+{
+    // The same terrain LoadStartupResources creates
+    UINT SqrtNumTiles = 20;
+    UINT SidesPerTile = 50;
+    float fWorldScale = 6667.0f;
+    float fHeightScale = 300.0f;
+
+    WCHAR str[MAX_PATH];
+    if( strHeightMap && strHeightMap[0] )
+        wcscpy_s( str, MAX_PATH, strHeightMap );
+    else if( FAILED( DXUTFindDXSDKMediaFileCch( str, MAX_PATH, L"contentstreaming\\terrain1.bmp" ) ) )
+    {
+        BenchmarkPrint( L"Can't find contentstreaming\\terrain1.bmp\r\n" );
+        return 1;
+    }
+
+    CTerrain Terrain;
+    if( FAILED( Terrain.LoadTerrain( str, SqrtNumTiles, SidesPerTile, fWorldScale, fHeightScale, false ) ) )
+    {
+        BenchmarkPrint( L"Can't load the heightmap %s\r\n", str );
+        return 1;
+    }
+
+    double fStart = GetBenchmarkTime();
+    if( FAILED( Terrain.CreateLODs( TERRAIN_MAX_LODS ) ) )
+    {
+        BenchmarkPrint( L"Can't create the terrain LODs\r\n" );
+        return 1;
+    }
+    double fCreateTime = GetBenchmarkTime() - fStart;
+
+    int Result = 0;
+    UINT NumTiles = Terrain.GetNumTiles();
+    UINT FullTriangles = NumTiles * SidesPerTile * SidesPerTile * 2;
+    BenchmarkPrint( L"\r\nContentStreaming terrain: %u tiles of %u x %u, %u triangles at full detail\r\n",
+                    NumTiles, SidesPerTile, SidesPerTile, FullTriangles );
+    BenchmarkPrint( L"%u LODs created in %.1f ms\r\n", Terrain.GetNumLODs(), fCreateTime * 1000.0 );
+    for( UINT iLOD = 0; iLOD < Terrain.GetNumLODs(); iLOD++ )
+    {
+        TERRAIN_LOD* pLOD = Terrain.GetLOD( iLOD );
+        float fMaxError = 0.0f;
+        for( UINT iTile = 0; iTile < NumTiles; iTile++ )
+            fMaxError = max( fMaxError, Terrain.GetTileLODError( iTile, iLOD ) );
+        BenchmarkPrint( L"  LOD %u: step %2u, %5u triangles, %5u stitched on all sides, error up to %.2f\r\n",
+                        iLOD, pLOD->Step, pLOD->NumIndices[0] / 3,
+                        pLOD->NumIndices[TERRAIN_NUM_STITCHES - 1] / 3, fMaxError );
+    }
+
+    BYTE* pEdgeMasks = new BYTE[ Terrain.GetNumLODs() * TERRAIN_NUM_STITCHES * 4 * ( SidesPerTile + 1 ) ];
+    if( !pEdgeMasks )
+        return 1;
+    UINT NumBadLists = CheckTerrainLODs( &Terrain, pEdgeMasks );
+    if( NumBadLists > 0 )
+    {
+        BenchmarkPrint( L"%u index lists don't cover their tile\r\n", NumBadLists );
+        Result = 1;
+    }
+
+    // Triangle counts along a camera path that follows the ground at the sample's view
+    // height, and climbs to three times the terrain height every few hundred frames
+    static const float s_fPixelErrors[] = { 1.0f, 2.0f, 4.0f, 8.0f };
+    BenchmarkPrint( L"\r\n%-12s %12s %12s %12s %10s %12s %8s\r\n", L"Pixel error", L"Avg tris",
+                    L"Min tris", L"Max tris", L"% of full", L"us/select", L"Cracks" );
+    for( UINT iError = 0; iError < ARRAYSIZE( s_fPixelErrors ); iError++ )
+    {
+        double fTriangles = 0.0;
+        UINT MinTriangles = UINT_MAX;
+        UINT MaxTriangles = 0;
+        UINT NumCracks = 0;
+        double fSelectTime = 0.0;
+        for( UINT iFrame = 0; iFrame < TERRAINBENCH_FRAMES; iFrame++ )
+        {
+            float t = ( float )iFrame / ( float )TERRAINBENCH_FRAMES;
+            D3DXVECTOR3 vEye;
+            vEye.x = fWorldScale * 0.45f * sinf( 2.0f * D3DX_PI * 3.0f * t );
+            vEye.z = fWorldScale * 0.45f * sinf( 2.0f * D3DX_PI * 2.0f * t + 0.5f );
+            vEye.y = Terrain.GetHeightOnMap( &vEye ) + g_fViewHeight;
+            if( ( iFrame / 250 ) & 1 )
+                vEye.y += fHeightScale * 3.0f * sinf( D3DX_PI * ( float )( iFrame % 250 ) / 250.0f );
+
+            fStart = GetBenchmarkTime();
+            UINT NumTriangles = Terrain.SelectLODs( &vEye, DEG2RAD( g_fFOV ), TERRAINBENCH_VIEWPORT,
+                                                    s_fPixelErrors[iError] );
+            fSelectTime += GetBenchmarkTime() - fStart;
+
+            fTriangles += NumTriangles;
+            MinTriangles = min( MinTriangles, NumTriangles );
+            MaxTriangles = max( MaxTriangles, NumTriangles );
+            NumCracks += CountTerrainCracks( &Terrain, pEdgeMasks );
+        }
+        fTriangles /= TERRAINBENCH_FRAMES;
+        BenchmarkPrint( L"%-12.1f %12.0f %12u %12u %9.1f%% %12.1f %8u\r\n", s_fPixelErrors[iError],
+                        fTriangles, MinTriangles, MaxTriangles, 100.0 * fTriangles / FullTriangles,
+                        fSelectTime * 1e6 / TERRAINBENCH_FRAMES, NumCracks );
+        if( NumCracks > 0 )
+            Result = 1;
+    }
+    SAFE_DELETE_ARRAY( pEdgeMasks );
+
+    // Height and normal queries at random points, single and batched
+    D3DXVECTOR3* pPositions = new D3DXVECTOR3[ TERRAINBENCH_NUM_QUERIES ];
+    float* pHeights = new float[ TERRAINBENCH_NUM_QUERIES ];
+    float* pBatchHeights = new float[ TERRAINBENCH_NUM_QUERIES ];
+    D3DXVECTOR3* pNormals = new D3DXVECTOR3[ TERRAINBENCH_NUM_NORMALS ];
+    D3DXVECTOR3* pBatchNormals = new D3DXVECTOR3[ TERRAINBENCH_NUM_NORMALS ];
+    if( !pPositions || !pHeights || !pBatchHeights || !pNormals || !pBatchNormals )
+    {
+        SAFE_DELETE_ARRAY( pPositions );
+        SAFE_DELETE_ARRAY( pHeights );
+        SAFE_DELETE_ARRAY( pBatchHeights );
+        SAFE_DELETE_ARRAY( pNormals );
+        SAFE_DELETE_ARRAY( pBatchNormals );
+        return 1;
+    }
+
+    srand( 1234 );
+    for( UINT i = 0; i < TERRAINBENCH_NUM_QUERIES; i++ )
+        pPositions[i] = D3DXVECTOR3( RPercent() * fWorldScale * 0.5f, 0, RPercent() * fWorldScale * 0.5f );
+
+    fStart = GetBenchmarkTime();
+    for( UINT i = 0; i < TERRAINBENCH_NUM_QUERIES; i++ )
+        pHeights[i] = Terrain.GetHeightOnMap( &pPositions[i] );
+    double fSingleHeightTime = GetBenchmarkTime() - fStart;
+
+    fStart = GetBenchmarkTime();
+    Terrain.GetHeightsOnMap( pPositions, pBatchHeights, TERRAINBENCH_NUM_QUERIES );
+    double fBatchHeightTime = GetBenchmarkTime() - fStart;
+
+    fStart = GetBenchmarkTime();
+    for( UINT i = 0; i < TERRAINBENCH_NUM_NORMALS; i++ )
+        pNormals[i] = Terrain.GetNormalOnMap( &pPositions[i] );
+    double fSingleNormalTime = GetBenchmarkTime() - fStart;
+
+    fStart = GetBenchmarkTime();
+    Terrain.GetNormalsOnMap( pPositions, pBatchNormals, TERRAINBENCH_NUM_NORMALS );
+    double fBatchNormalTime = GetBenchmarkTime() - fStart;
+
+    bool bHeightsMatch = 0 == memcmp( pHeights, pBatchHeights, TERRAINBENCH_NUM_QUERIES * sizeof( float ) );
+    bool bNormalsMatch = 0 == memcmp( pNormals, pBatchNormals, TERRAINBENCH_NUM_NORMALS * sizeof( D3DXVECTOR3 ) );
+    if( !bHeightsMatch || !bNormalsMatch )
+        Result = 1;
+
+    BenchmarkPrint( L"\r\n%-12s %14s %14s %8s\r\n", L"Query", L"Single M/s", L"Batched M/s", L"Match" );
+    BenchmarkPrint( L"%-12s %14.1f %14.1f %8s\r\n", L"Height",
+                    TERRAINBENCH_NUM_QUERIES / fSingleHeightTime * 1e-6,
+                    TERRAINBENCH_NUM_QUERIES / fBatchHeightTime * 1e-6, bHeightsMatch ? L"yes" : L"NO" );
+    BenchmarkPrint( L"%-12s %14.1f %14.1f %8s\r\n", L"Normal",
+                    TERRAINBENCH_NUM_NORMALS / fSingleNormalTime * 1e-6,
+                    TERRAINBENCH_NUM_NORMALS / fBatchNormalTime * 1e-6, bNormalsMatch ? L"yes" : L"NO" );
+
+    SAFE_DELETE_ARRAY( pHeights );
+    SAFE_DELETE_ARRAY( pBatchHeights );
+    SAFE_DELETE_ARRAY( pNormals );
+    SAFE_DELETE_ARRAY( pBatchNormals );
+
+    // Ray casts.  The positions array is reused for the ray origins and directions.
+    D3DXVECTOR3* pOrigins = pPositions;
+    D3DXVECTOR3* pDirs = pPositions + TERRAINBENCH_NUM_RAYS;
+    float* pDists = new float[ TERRAINBENCH_NUM_RAYS ];
+    if( !pDists )
+    {
+        SAFE_DELETE_ARRAY( pPositions );
+        return 1;
+    }
+    for( UINT i = 0; i < TERRAINBENCH_NUM_RAYS; i++ )
+    {
+        float fYaw = RPercent() * D3DX_PI;
+        float fPitch;
+        pOrigins[i] = D3DXVECTOR3( RPercent() * fWorldScale * 0.3f, 0, RPercent() * fWorldScale * 0.3f );
+        if( i & 1 )
+        {
+            pOrigins[i].y = fHeightScale * 1.2f;
+            fPitch = DEG2RAD( -35.0f + 25.0f * RPercent() );
+        }
+        else
+        {
+            pOrigins[i].y = Terrain.GetHeightOnMap( &pOrigins[i] ) + g_fViewHeight;
+            fPitch = DEG2RAD( 2.0f * RPercent() );
+        }
+        pDirs[i] = D3DXVECTOR3( cosf( fPitch ) * cosf( fYaw ), sinf( fPitch ), cosf( fPitch ) * sinf( fYaw ) );
+    }
+
+    // The first ray builds the quadtree
+    fStart = GetBenchmarkTime();
+    float fDist;
+    Terrain.IntersectRay( &pOrigins[0], &pDirs[0], TERRAINBENCH_RAY_LENGTH, &fDist );
+    double fTreeTime = GetBenchmarkTime() - fStart;
+
+    fStart = GetBenchmarkTime();
+    UINT NumHits = Terrain.IntersectRays( pOrigins, pDirs, TERRAINBENCH_NUM_RAYS, TERRAINBENCH_RAY_LENGTH, pDists );
+    double fTreeRayTime = GetBenchmarkTime() - fStart;
+
+    // A march can only find a crossing later than the exact one, or miss it, when the
+    // ray clips a ridge between two steps.  The other way round is an error.
+    UINT NumMarchHits = 0;
+    UINT NumMarchLate = 0;
+    UINT NumMismatches = 0;
+    fStart = GetBenchmarkTime();
+    for( UINT i = 0; i < TERRAINBENCH_NUM_RAYS; i++ )
+    {
+        float fMarchDist;
+        bool bMarchHit = MarchTerrainRay( &Terrain, &pOrigins[i], &pDirs[i], TERRAINBENCH_RAY_LENGTH, &fMarchDist );
+        if( bMarchHit )
+            NumMarchHits++;
+
+        if( bMarchHit && ( pDists[i] < 0.0f || pDists[i] > fMarchDist + 0.05f ) )
+            NumMismatches++;
+        else if( pDists[i] >= 0.0f && ( !bMarchHit || pDists[i] < fMarchDist - 0.05f ) )
+            NumMarchLate++;
+    }
+    double fMarchRayTime = GetBenchmarkTime() - fStart;
+    if( NumMismatches > 0 )
+        Result = 1;
+
+    BenchmarkPrint( L"\r\nRays: %u of length %.0f, quadtree built in %.1f ms\r\n", TERRAINBENCH_NUM_RAYS,
+                    TERRAINBENCH_RAY_LENGTH, fTreeTime * 1000.0 );
+    BenchmarkPrint( L"%-12s %14s %10s\r\n", L"Method", L"K rays/s", L"Hits" );
+    BenchmarkPrint( L"%-12s %14.1f %10u\r\n", L"Quadtree", TERRAINBENCH_NUM_RAYS / fTreeRayTime * 1e-3,
+                    NumHits );
+    BenchmarkPrint( L"%-12s %14.1f %10u\r\n", L"March", TERRAINBENCH_NUM_RAYS / fMarchRayTime * 1e-3,
+                    NumMarchHits );
+    BenchmarkPrint( L"March found %u crossings late or not at all, quadtree was behind on %u\r\n",
+                    NumMarchLate, NumMismatches );
+
+    SAFE_DELETE_ARRAY( pPositions );
+    SAFE_DELETE_ARRAY( pDists );
+
+    return Result;
+}
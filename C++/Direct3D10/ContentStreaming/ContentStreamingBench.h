@@ -0,0 +1,21 @@
+//--------------------------------------------------------------------------------------
+// File: ContentStreamingBench.h
+//
+// Headless benchmarks that run from the command line in place of the sample
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef CONTENT_STREAMING_BENCH_H
+#define CONTENT_STREAMING_BENCH_H
+
+// Runs the benchmark named by the first command line argument, if there is one, and
+// returns true with its exit code.  Returns false to start the sample.
+bool RunCommandLineBenchmark( int* pExitCode );
+
+// Output and timing shared by the benchmarks
+void BenchmarkPrint( LPCWSTR strFormat, ... );
+double GetBenchmarkTime();
+
+#endif
@@ -0,0 +1,293 @@
+//--------------------------------------------------------------------------------------
+// File: LevelItemGrid.cpp
+//
+// Uniform grid over the level items, used to find the items around the camera without
+// walking the whole level every frame
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#include "DXUT.h"
+#include "LevelItemGrid.h"
+#include <float.h>
+
+// The cell size is grown if the level would need more cells than this along a side
+#define MAX_GRID_CELLS_PER_SIDE 1024
+
+// Cells are only classified as entirely inside or outside with this much relative margin
+// on the squared radius, so the per item tests decide every item that is close to the
+// sphere and the results match a test of every item exactly
+#define CELL_CLASSIFY_MARGIN    0.0001f
+
+enum CELL_CLASS
+{
+    CELL_OUTSIDE = 0,
+    CELL_INSIDE,
+    CELL_PARTIAL,
+};
+
+
+//--------------------------------------------------------------------------------------
+CLevelItemGrid::CLevelItemGrid() : m_fMinX( 0.0f ),
+                                   m_fMinZ( 0.0f ),
+                                   m_fCellSize( 0.0f ),
+                                   m_fInvCellSize( 0.0f ),
+                                   m_CellsX( 0 ),
+                                   m_CellsZ( 0 ),
+                                   m_pCellStart( NULL ),
+                                   m_pCellBounds( NULL ),
+                                   m_ppItems( NULL ),
+                                   m_bHasLoadSphere( false ),
+                                   m_vLoadEye( 0, 0, 0 ),
+                                   m_fLoadRadius( 0.0f )
+{
+    ZeroMemory( &m_LoadRect, sizeof( GRID_RECT ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+CLevelItemGrid::~CLevelItemGrid()
+{
+    Destroy();
+}
+
+
+//--------------------------------------------------------------------------------------
+void CLevelItemGrid::Destroy()
+{
+    SAFE_DELETE_ARRAY( m_pCellStart );
+    SAFE_DELETE_ARRAY( m_pCellBounds );
+    SAFE_DELETE_ARRAY( m_ppItems );
+    m_CellsX = 0;
+    m_CellsZ = 0;
+    m_bHasLoadSphere = false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Bucket the items with a counting sort over the cells
+//--------------------------------------------------------------------------------------
+HRESULT CLevelItemGrid::Create( CGrowableArray <LEVEL_ITEM*>* pItems, float fCellSize )
+{
+    Destroy();
+
+    const int NumItems = pItems->GetSize();
+    if( NumItems == 0 || !( fCellSize > 0.0f ) )
+        return S_OK;
+
+    D3DXVECTOR3 vMin = pItems->GetAt( 0 )->vCenter;
+    D3DXVECTOR3 vMax = vMin;
+    for( int i = 1; i < NumItems; i++ )
+    {
+        D3DXVec3Minimize( &vMin, &vMin, &pItems->GetAt( i )->vCenter );
+        D3DXVec3Maximize( &vMax, &vMax, &pItems->GetAt( i )->vCenter );
+    }
+
+    float fExtent = max( vMax.x - vMin.x, vMax.z - vMin.z );
+    fCellSize = max( fCellSize, fExtent / ( MAX_GRID_CELLS_PER_SIDE - 1 ) );
+
+    m_fMinX = vMin.x;
+    m_fMinZ = vMin.z;
+    m_fCellSize = fCellSize;
+    m_fInvCellSize = 1.0f / fCellSize;
+    m_CellsX = min( ( int )( ( vMax.x - vMin.x ) * m_fInvCellSize ) + 1, MAX_GRID_CELLS_PER_SIDE );
+    m_CellsZ = min( ( int )( ( vMax.z - vMin.z ) * m_fInvCellSize ) + 1, MAX_GRID_CELLS_PER_SIDE );
+
+    const int NumCells = m_CellsX * m_CellsZ;
+    m_pCellStart = new UINT[ NumCells + 1 ];
+    m_pCellBounds = new GRID_CELL_BOUNDS[ NumCells ];
+    m_ppItems = new LEVEL_ITEM*[ NumItems ];
+    UINT* pItemCells = new UINT[ NumItems ];
+    if( !m_pCellStart || !m_pCellBounds || !m_ppItems || !pItemCells )
+    {
+        SAFE_DELETE_ARRAY( pItemCells );
+        Destroy();
+        return E_OUTOFMEMORY;
+    }
+
+    ZeroMemory( m_pCellStart, ( NumCells + 1 ) * sizeof( UINT ) );
+    for( int i = 0; i < NumCells; i++ )
+    {
+        m_pCellBounds[i].vMin = D3DXVECTOR3( FLT_MAX, FLT_MAX, FLT_MAX );
+        m_pCellBounds[i].vMax = D3DXVECTOR3( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+    }
+
+    // Count the items in each cell, shifted by one so the prefix sum gives the starts
+    for( int i = 0; i < NumItems; i++ )
+    {
+        const D3DXVECTOR3& vCenter = pItems->GetAt( i )->vCenter;
+        int iX = min( ( int )( ( vCenter.x - m_fMinX ) * m_fInvCellSize ), m_CellsX - 1 );
+        int iZ = min( ( int )( ( vCenter.z - m_fMinZ ) * m_fInvCellSize ), m_CellsZ - 1 );
+        UINT iCell = iZ * m_CellsX + iX;
+        pItemCells[i] = iCell;
+        m_pCellStart[ iCell + 1 ] ++;
+
+        D3DXVec3Minimize( &m_pCellBounds[iCell].vMin, &m_pCellBounds[iCell].vMin, &vCenter );
+        D3DXVec3Maximize( &m_pCellBounds[iCell].vMax, &m_pCellBounds[iCell].vMax, &vCenter );
+    }
+    for( int i = 0; i < NumCells; i++ )
+        m_pCellStart[ i + 1 ] += m_pCellStart[i];
+
+    // Scatter, using the starts as write cursors and then shifting them back
+    for( int i = 0; i < NumItems; i++ )
+        m_ppItems[ m_pCellStart[ pItemCells[i] ] ++ ] = pItems->GetAt( i );
+    for( int i = NumCells; i > 0; i-- )
+        m_pCellStart[i] = m_pCellStart[ i - 1 ];
+    m_pCellStart[0] = 0;
+
+    SAFE_DELETE_ARRAY( pItemCells );
+    return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cells overlapped by the square around a sphere, clipped to the grid
+//--------------------------------------------------------------------------------------
+GRID_RECT CLevelItemGrid::GetRect( const D3DXVECTOR3& vEye, float fRadius )
+{
+    GRID_RECT Rect = { 0, 0, -1, -1 };
+    if( m_CellsX == 0 || !( fRadius > 0.0f ) )
+        return Rect;
+
+    // Clamp before converting so far away spheres can't overflow the integers
+    float fX0 = max( -1.0f, ( vEye.x - fRadius - m_fMinX ) * m_fInvCellSize );
+    float fZ0 = max( -1.0f, ( vEye.z - fRadius - m_fMinZ ) * m_fInvCellSize );
+    float fX1 = min( ( float )m_CellsX, ( vEye.x + fRadius - m_fMinX ) * m_fInvCellSize );
+    float fZ1 = min( ( float )m_CellsZ, ( vEye.z + fRadius - m_fMinZ ) * m_fInvCellSize );
+
+    Rect.X0 = max( 0, ( int )floorf( fX0 ) );
+    Rect.Z0 = max( 0, ( int )floorf( fZ0 ) );
+    Rect.X1 = min( m_CellsX - 1, ( int )floorf( fX1 ) );
+    Rect.Z1 = min( m_CellsZ - 1, ( int )floorf( fZ1 ) );
+    if( Rect.X0 > Rect.X1 || Rect.Z0 > Rect.Z1 )
+    {
+        Rect.X0 = Rect.Z0 = 0;
+        Rect.X1 = Rect.Z1 = -1;
+    }
+
+    return Rect;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compare the bounds of a cell's items against a sphere
+//--------------------------------------------------------------------------------------
+int CLevelItemGrid::ClassifyCell( int iX, int iZ, const D3DXVECTOR3& vEye, float fRadius )
+{
+    const UINT iCell = iZ * m_CellsX + iX;
+    if( m_pCellStart[iCell] == m_pCellStart[ iCell + 1 ] || !( fRadius > 0.0f ) )
+        return CELL_OUTSIDE;
+
+    const GRID_CELL_BOUNDS& Bounds = m_pCellBounds[iCell];
+    D3DXVECTOR3 vNear( max( Bounds.vMin.x - vEye.x, max( 0.0f, vEye.x - Bounds.vMax.x ) ),
+                       max( Bounds.vMin.y - vEye.y, max( 0.0f, vEye.y - Bounds.vMax.y ) ),
+                       max( Bounds.vMin.z - vEye.z, max( 0.0f, vEye.z - Bounds.vMax.z ) ) );
+    D3DXVECTOR3 vFar( max( fabsf( vEye.x - Bounds.vMin.x ), fabsf( vEye.x - Bounds.vMax.x ) ),
+                      max( fabsf( vEye.y - Bounds.vMin.y ), fabsf( vEye.y - Bounds.vMax.y ) ),
+                      max( fabsf( vEye.z - Bounds.vMin.z ), fabsf( vEye.z - Bounds.vMax.z ) ) );
+
+    const float fRadius2 = fRadius * fRadius;
+    if( D3DXVec3LengthSq( &vNear ) > fRadius2 * ( 1.0f + CELL_CLASSIFY_MARGIN ) )
+        return CELL_OUTSIDE;
+    if( D3DXVec3LengthSq( &vFar ) < fRadius2 * ( 1.0f - CELL_CLASSIFY_MARGIN ) )
+        return CELL_INSIDE;
+    return CELL_PARTIAL;
+}
+
+
+//--------------------------------------------------------------------------------------
+void CLevelItemGrid::GetItemsInRadius( const D3DXVECTOR3& vEye, float fRadius,
+                                       CGrowableArray <LEVEL_ITEM*>* pItems )
+{
+    const GRID_RECT Rect = GetRect( vEye, fRadius );
+    const float fRadius2 = fRadius * fRadius;
+
+    for( int iZ = Rect.Z0; iZ <= Rect.Z1; iZ++ )
+    {
+        for( int iX = Rect.X0; iX <= Rect.X1; iX++ )
+        {
+            const int Class = ClassifyCell( iX, iZ, vEye, fRadius );
+            if( CELL_OUTSIDE == Class )
+                continue;
+
+            const UINT iCell = iZ * m_CellsX + iX;
+            for( UINT i = m_pCellStart[iCell]; i < m_pCellStart[ iCell + 1 ]; i++ )
+            {
+                LEVEL_ITEM* pItem = m_ppItems[i];
+                if( CELL_PARTIAL == Class )
+                {
+                    D3DXVECTOR3 vDelta = vEye - pItem->vCenter;
+                    if( !( D3DXVec3LengthSq( &vDelta ) < fRadius2 ) )
+                        continue;
+                }
+                pItems->Add( pItem );
+            }
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Retest the items of one cell against the new loading sphere, unless the cell was and
+// still is entirely on one side of it
+//--------------------------------------------------------------------------------------
+void CLevelItemGrid::UpdateCell( int iX, int iZ, const D3DXVECTOR3& vEye, float fRadius,
+                                 CGrowableArray <LEVEL_ITEM*>* pEntered, CGrowableArray <LEVEL_ITEM*>* pExited )
+{
+    const int OldClass = m_bHasLoadSphere ? ClassifyCell( iX, iZ, m_vLoadEye, m_fLoadRadius ) : CELL_OUTSIDE;
+    const int NewClass = ClassifyCell( iX, iZ, vEye, fRadius );
+    if( OldClass == NewClass && CELL_PARTIAL != NewClass )
+        return;
+
+    const float fRadius2 = fRadius * fRadius;
+    const UINT iCell = iZ * m_CellsX + iX;
+    for( UINT i = m_pCellStart[iCell]; i < m_pCellStart[ iCell + 1 ]; i++ )
+    {
+        LEVEL_ITEM* pItem = m_ppItems[i];
+        D3DXVECTOR3 vDelta = vEye - pItem->vCenter;
+        bool bInLoadRadius = D3DXVec3LengthSq( &vDelta ) < fRadius2;
+        if( bInLoadRadius == pItem->bInLoadRadius )
+            continue;
+
+        pItem->bInLoadRadius = bInLoadRadius;
+        CGrowableArray <LEVEL_ITEM*>* pChanged = bInLoadRadius ? pEntered : pExited;
+        if( pChanged )
+            pChanged->Add( pItem );
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Only cells under the old or the new square can hold items that changed sides
+//--------------------------------------------------------------------------------------
+void CLevelItemGrid::UpdateLoadRadius( const D3DXVECTOR3& vEye, float fRadius,
+                                       CGrowableArray <LEVEL_ITEM*>* pEntered,
+                                       CGrowableArray <LEVEL_ITEM*>* pExited )
+{
+    if( m_CellsX == 0 )
+        return;
+
+    const GRID_RECT OldRect = m_bHasLoadSphere ? m_LoadRect : GetRect( vEye, 0.0f );
+    const GRID_RECT NewRect = GetRect( vEye, fRadius );
+
+    for( int iZ = OldRect.Z0; iZ <= OldRect.Z1; iZ++ )
+    {
+        for( int iX = OldRect.X0; iX <= OldRect.X1; iX++ )
+            UpdateCell( iX, iZ, vEye, fRadius, pEntered, pExited );
+    }
+
+    for( int iZ = NewRect.Z0; iZ <= NewRect.Z1; iZ++ )
+    {
+        for( int iX = NewRect.X0; iX <= NewRect.X1; iX++ )
+        {
+            if( iX >= OldRect.X0 && iX <= OldRect.X1 && iZ >= OldRect.Z0 && iZ <= OldRect.Z1 )
+                continue;
+            UpdateCell( iX, iZ, vEye, fRadius, pEntered, pExited );
+        }
+    }
+
+    m_bHasLoadSphere = true;
+    m_vLoadEye = vEye;
+    m_fLoadRadius = fRadius;
+    m_LoadRect = NewRect;
+}
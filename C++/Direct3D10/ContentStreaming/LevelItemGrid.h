@@ -0,0 +1,92 @@
+//--------------------------------------------------------------------------------------
+// File: LevelItemGrid.h
+//
+// Uniform grid over the level items, used to find the items around the camera without
+// walking the whole level every frame
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef LEVEL_ITEM_GRID_H
+#define LEVEL_ITEM_GRID_H
+
+#include "PackedFile.h"
+
+//--------------------------------------------------------------------------------------
+// Integer cell rectangle, inclusive.  Empty when X0 > X1.
+//--------------------------------------------------------------------------------------
+struct GRID_RECT
+{
+    int X0;
+    int Z0;
+    int X1;
+    int Z1;
+};
+
+// Bounds of the item centers in a cell.  Empty cells have vMin > vMax.
+struct GRID_CELL_BOUNDS
+{
+    D3DXVECTOR3 vMin;
+    D3DXVECTOR3 vMax;
+};
+
+//--------------------------------------------------------------------------------------
+// Buckets the level items into square cells on the XZ plane.  Each cell also keeps the
+// bounds of its items, so a cell can be classified as entirely inside or entirely outside
+// of a sphere without looking at its items.
+//
+// UpdateLoadRadius tracks which items are inside the loading radius through
+// LEVEL_ITEM::bInLoadRadius.  Between two calls only the cells that straddle the old or
+// the new sphere are tested item by item; the cells that were and still are entirely
+// inside (or outside) cannot change.
+//--------------------------------------------------------------------------------------
+class CLevelItemGrid
+{
+private:
+    float m_fMinX;
+    float m_fMinZ;
+    float m_fCellSize;
+    float m_fInvCellSize;
+    int m_CellsX;
+    int m_CellsZ;
+    UINT* m_pCellStart;         // m_CellsX * m_CellsZ + 1 offsets into m_ppItems
+    GRID_CELL_BOUNDS* m_pCellBounds;
+    LEVEL_ITEM** m_ppItems;     // items sorted by cell, in level order within a cell
+
+    bool m_bHasLoadSphere;      // false until the first UpdateLoadRadius
+    D3DXVECTOR3 m_vLoadEye;
+    float m_fLoadRadius;
+    GRID_RECT m_LoadRect;
+
+    GRID_RECT   GetRect( const D3DXVECTOR3& vEye, float fRadius );
+    int         ClassifyCell( int iX, int iZ, const D3DXVECTOR3& vEye, float fRadius );
+    void        UpdateCell( int iX, int iZ, const D3DXVECTOR3& vEye, float fRadius,
+                            CGrowableArray <LEVEL_ITEM*>* pEntered, CGrowableArray <LEVEL_ITEM*>* pExited );
+
+public:
+                CLevelItemGrid();
+                ~CLevelItemGrid();
+
+    // fCellSize is a side of a cell in world units.  A quarter of the loading radius is a
+    // good place to start.  The item pointers are kept, so the grid must be destroyed or
+    // recreated before the items are freed.
+    HRESULT     Create( CGrowableArray <LEVEL_ITEM*>* pItems, float fCellSize );
+    void        Destroy();
+
+    // Adds every item closer than fRadius to vEye to pItems, in cell order
+    void        GetItemsInRadius( const D3DXVECTOR3& vEye, float fRadius, CGrowableArray <LEVEL_ITEM*>* pItems );
+
+    // Moves the loading sphere to vEye and fRadius, updates bInLoadRadius on the items that
+    // changed and adds them to pEntered or pExited.  Either array may be NULL.  The first
+    // call after Create assumes that no item is in the loading radius yet.
+    void        UpdateLoadRadius( const D3DXVECTOR3& vEye, float fRadius, CGrowableArray <LEVEL_ITEM*>* pEntered,
+                                  CGrowableArray <LEVEL_ITEM*>* pExited );
+
+    int         GetNumCells()
+    {
+        return m_CellsX * m_CellsZ;
+    }
+};
+
+#endif
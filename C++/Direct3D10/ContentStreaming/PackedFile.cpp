@@ -10,22 +10,53 @@
 #include "PackedFile.h"
 #include "SDKMisc.h"
 #include "Terrain.h"
+#include "AsyncLoader.h"
+#include <process.h>
 
 //--------------------------------------------------------------------------------------
 CPackedFile::CPackedFile() : m_pChunks( NULL ),
                              m_pMappedChunks( NULL ),
                              m_pFileIndices( NULL ),
+                             m_pStringTable( NULL ),
+                             m_pHashTable( NULL ),
+                             m_pIndexView( NULL ),
+                             m_pLRUHead( NULL ),
+                             m_pLRUTail( NULL ),
                              m_hFileMapping( 0 ),
                              m_hFile( 0 ),
-                             m_MaxChunksMapped( 78 )
+                             m_ChunksMapped( 0 ),
+                             m_MaxChunksMapped( 78 ),
+                             m_fChunkGridMinX( 0 ),
+                             m_fChunkGridMinZ( 0 ),
+                             m_fChunkGridInvCellSize( 0 ),
+                             m_ChunkGridCellsX( 0 ),
+                             m_ChunkGridCellsZ( 0 ),
+                             m_pChunkGridStart( NULL ),
+                             m_pChunkGridChunks( NULL ),
+                             m_hReadaheadThread( 0 ),
+                             m_hReadaheadEvent( 0 ),
+                             m_bReadaheadDone( FALSE ),
+                             m_vReadaheadEye( 0, 0, 0 ),
+                             m_fReadaheadRadius( 0 ),
+                             m_NumReadaheadMapped( 0 )
 {
     ZeroMemory( &m_FileHeader, sizeof( PACKED_FILE_HEADER ) );
+    InitializeCriticalSection( &m_csMapping );
+    InitializeCriticalSection( &m_csReadahead );
 }
 
 //--------------------------------------------------------------------------------------
 CPackedFile::~CPackedFile()
 {
     UnloadPackedFile();
+    DeleteCriticalSection( &m_csMapping );
+    DeleteCriticalSection( &m_csReadahead );
+}
+
+//--------------------------------------------------------------------------------------
+unsigned int WINAPI _ReadaheadThreadProc( LPVOID lpParameter )
+{
+    return ( ( CPackedFile* )lpParameter )->ReadaheadThreadProc();
 }
 
 //--------------------------------------------------------------------------------------
@@ -81,41 +112,185 @@ UINT64 FillToGranularity( HANDLE hFile, UINT64 CurrentOffset, UINT64 Granularity
     UINT64 NewOffset = AlignToGranularity( CurrentOffset, Granularity );
     UINT64 NumBytes = NewOffset - CurrentOffset;
 
+    // The padding is never more than one granule, so write it in one call
+    static BYTE Zero[64 * 1024] = {0};
     DWORD dwWritten;
-    BYTE Zero = 0;
-    for( UINT64 i = 0; i < NumBytes; i++ )
+    while( NumBytes > 0 )
     {
-        if( !WriteFile( hFile, &Zero, sizeof( BYTE ), &dwWritten, NULL ) )
+        DWORD dwToWrite = ( DWORD )min( NumBytes, sizeof( Zero ) );
+        if( !WriteFile( hFile, Zero, dwToWrite, &dwWritten, NULL ) )
             return 0;
+        NumBytes -= dwToWrite;
     }
 
     return NewOffset;
 }
 
 //--------------------------------------------------------------------------------------
-// Creates a packed file.  The file is a flat uncompressed file containing all resources
-// needed for the sample.  The file consists of chunks of data.  Each chunk represents
+// Compression API entry points, loaded from cabinet.dll on first use
+//--------------------------------------------------------------------------------------
+#define PACKED_COMPRESS_ALGORITHM_XPRESS    3
+#define PACKED_COMPRESS_RAW                 ( 1 << 29 )
+
+typedef BOOL ( WINAPI* LPCREATECOMPRESSOR )( DWORD Algorithm, PVOID pAllocationRoutines, PVOID* phCompressor );
+typedef BOOL ( WINAPI* LPCOMPRESSORPROC )( PVOID hCompressor, LPCVOID pSrc, SIZE_T cSrc, PVOID pDest, SIZE_T cDest,
+                                           PSIZE_T pcOut );
+typedef BOOL ( WINAPI* LPCLOSECOMPRESSOR )( PVOID hCompressor );
+
+static LPCREATECOMPRESSOR   s_DynamicCreateCompressor = NULL;
+static LPCOMPRESSORPROC     s_DynamicCompress = NULL;
+static LPCLOSECOMPRESSOR    s_DynamicCloseCompressor = NULL;
+static LPCREATECOMPRESSOR   s_DynamicCreateDecompressor = NULL;
+static LPCOMPRESSORPROC     s_DynamicDecompress = NULL;
+static LPCLOSECOMPRESSOR    s_DynamicCloseDecompressor = NULL;
+static bool                 s_bCompressionEnsured = false;
+
+//--------------------------------------------------------------------------------------
+// This is called from the graphics thread before any loading thread can decompress
+//--------------------------------------------------------------------------------------
+bool IsPackedFileCompressionAvailable()
+{
+    if( !s_bCompressionEnsured )
+    {
+        s_bCompressionEnsured = true;
+
+        HMODULE hCabinet = LoadLibrary( L"cabinet.dll" );
+        if( hCabinet )
+        {
+            s_DynamicCreateCompressor = ( LPCREATECOMPRESSOR )GetProcAddress( hCabinet, "CreateCompressor" );
+            s_DynamicCompress = ( LPCOMPRESSORPROC )GetProcAddress( hCabinet, "Compress" );
+            s_DynamicCloseCompressor = ( LPCLOSECOMPRESSOR )GetProcAddress( hCabinet, "CloseCompressor" );
+            s_DynamicCreateDecompressor = ( LPCREATECOMPRESSOR )GetProcAddress( hCabinet, "CreateDecompressor" );
+            s_DynamicDecompress = ( LPCOMPRESSORPROC )GetProcAddress( hCabinet, "Decompress" );
+            s_DynamicCloseDecompressor = ( LPCLOSECOMPRESSOR )GetProcAddress( hCabinet, "CloseDecompressor" );
+        }
+    }
+
+    return ( s_DynamicCreateCompressor && s_DynamicCompress && s_DynamicCloseCompressor &&
+             s_DynamicCreateDecompressor && s_DynamicDecompress && s_DynamicCloseDecompressor );
+}
+
+//--------------------------------------------------------------------------------------
+// Compresses cSrc bytes.  Returns the compressed size, or 0 if the data didn't get
+// smaller, in which case it should be stored as is.
+//--------------------------------------------------------------------------------------
+SIZE_T CompressPackedData( const BYTE* pSrc, SIZE_T cSrc, BYTE* pDest, SIZE_T cDest )
+{
+    PVOID hCompressor = NULL;
+    if( !s_DynamicCreateCompressor( PACKED_COMPRESS_ALGORITHM_XPRESS | PACKED_COMPRESS_RAW, NULL, &hCompressor ) )
+        return 0;
+
+    SIZE_T cOut = 0;
+    if( !s_DynamicCompress( hCompressor, pSrc, cSrc, pDest, cDest, &cOut ) || cOut >= cSrc )
+        cOut = 0;
+
+    s_DynamicCloseCompressor( hCompressor );
+    return cOut;
+}
+
+//--------------------------------------------------------------------------------------
+// Decompresses a file stored with CompressPackedData.  This is safe to call from any
+// thread; each call uses its own decompressor.
+//--------------------------------------------------------------------------------------
+HRESULT DecompressPackedData( const BYTE* pStored, SIZE_T cStored, BYTE* pData, SIZE_T cData )
+{
+    if( cStored == cData )
+    {
+        // Stored uncompressed
+        CopyMemory( pData, pStored, cData );
+        return S_OK;
+    }
+
+    if( !s_DynamicDecompress )
+        return E_NOTIMPL;
+
+    PVOID hDecompressor = NULL;
+    if( !s_DynamicCreateDecompressor( PACKED_COMPRESS_ALGORITHM_XPRESS | PACKED_COMPRESS_RAW, NULL,
+                                      &hDecompressor ) )
+        return HRESULT_FROM_WIN32( GetLastError() );
+
+    HRESULT hr = S_OK;
+    SIZE_T cOut = 0;
+    if( !s_DynamicDecompress( hDecompressor, pStored, cStored, pData, cData, &cOut ) )
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+    else if( cOut != cData )
+        hr = E_FAIL;
+
+    s_DynamicCloseDecompressor( hDecompressor );
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// FNV-1a hash of a file name.  This is stored in the index of the packed file, so it
+// must not change without bumping PACKED_FILE_VERSION.
+//--------------------------------------------------------------------------------------
+UINT HashFileName( const WCHAR* szFile )
+{
+    UINT hash = 2166136261u;
+    while( *szFile )
+    {
+        hash ^= ( UINT )( *szFile );
+        hash *= 16777619u;
+        szFile++;
+    }
+    return hash;
+}
+
+//--------------------------------------------------------------------------------------
+// Creates a packed file.  The file is a flat file containing all resources needed for
+// the sample.  The file consists of chunks of data.  Each chunk represents
 // a mappable window that can be accessed by MapViewOfFile.  Since MapViewOfFile can
 // only map a view onto a file in 64k granularities, each chunk must start on a 64k
-// boundary.  The packed file also creates an index.  This index is loaded into memory
-// at startup and is not memory mapped.  The index is used to find the locations of
-// resource files within the packed file.
+// boundary.  The packed file also creates an index.  The index is used to find the
+// locations of resource files within the packed file.
+//
+// The index is laid out so that it can be mapped in place at load time:
+//
+//   PACKED_FILE_HEADER
+//   CHUNK_HEADER[NumChunks]
+//   FILE_INDEX[NumFiles]
+//   WCHAR string table (all file names, null terminated, padded to 8 bytes)
+//   UINT hash table[NumHashBuckets] (open addressing, linear probing)
+//
+// NumHashBuckets is a power of two at least twice NumFiles, so a lookup touches one or
+// two buckets, one FILE_INDEX and one name.
+//
+// If bCompress is set, each file in a chunk is compressed independently with XPRESS.
+// Chunks stay the unit of mapping, but the files of one tile can be decompressed in
+// parallel on the processing threads.  A file that doesn't get smaller is stored as is
+// (StoredSize == FileSize).  Since the stored sizes aren't known until the data has been
+// compressed, the chunks are written first and the index is written last.
 //--------------------------------------------------------------------------------------
 struct STRING
 {
     WCHAR str[MAX_PATH];
 };
+struct STORED_SOURCE
+{
+    STRING strPath;
+    BYTE* pStored;
+    UINT64 StoredSize;
+};
 bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev9, WCHAR* szFileName,
-                                    UINT SqrtNumTiles, UINT SidesPerTile, float fWorldScale, float fHeightScale )
+                                    UINT SqrtNumTiles, UINT SidesPerTile, float fWorldScale, float fHeightScale,
+                                    bool bCompress )
 {
     bool bRet = false;
-    HANDLE hFile;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
 
     m_FileHeader.NumFiles = 4 * SqrtNumTiles * SqrtNumTiles;
 
     CGrowableArray <FILE_INDEX*> TempFileIndices;
     CGrowableArray <CHUNK_HEADER*> TempHeaderList;
     CGrowableArray <STRING> FullFilePath;
+    CGrowableArray <STRING> FileNames;
+    CGrowableArray <STORED_SOURCE> StoredSources;
+    WCHAR* pStringTable = NULL;
+    UINT* pHashTable = NULL;
+    BYTE* pCompressed = NULL;
+
+    if( bCompress && !IsPackedFileCompressionAvailable() )
+        bCompress = false;
 
     STRING strDiffuseTexture;
     STRING strNormalTexture;
@@ -203,8 +378,10 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
             D3DXVECTOR3 vCenter = ( pTile2->BBox.min + pTile2->BBox.max ) / 2.0f;
 
             // TerrainVB
+            STRING strName;
             FILE_INDEX* pFileIndex = new FILE_INDEX;
-            swprintf_s( pFileIndex->szFileName, MAX_PATH, L"terrainVB%d_%d", x, y );
+            swprintf_s( strName.str, MAX_PATH, L"terrainVB%d_%d", x, y );
+            FileNames.Add( strName );
             pFileIndex->FileSize = SizeTerrainVB;
             pFileIndex->ChunkIndex = ChunkIndex;
             pFileIndex->OffsetIntoChunk = 0; // unknown
@@ -217,7 +394,8 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
 
             // TerrainIB
             pFileIndex = new FILE_INDEX;
-            swprintf_s( pFileIndex->szFileName, MAX_PATH, L"terrainIB%d_%d", x, y );
+            swprintf_s( strName.str, MAX_PATH, L"terrainIB%d_%d", x, y );
+            FileNames.Add( strName );
             pFileIndex->FileSize = SizeTerrainIB;
             pFileIndex->ChunkIndex = ChunkIndex;
             pFileIndex->OffsetIntoChunk = 0; // unknown
@@ -229,7 +407,8 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
 
             // TerrainDiffuse
             pFileIndex = new FILE_INDEX;
-            swprintf_s( pFileIndex->szFileName, MAX_PATH, L"terrainDiff%d_%d", x, y );
+            swprintf_s( strName.str, MAX_PATH, L"terrainDiff%d_%d", x, y );
+            FileNames.Add( strName );
             pFileIndex->FileSize = SizeDiffuse;
             pFileIndex->ChunkIndex = ChunkIndex;
             pFileIndex->OffsetIntoChunk = 0; // unknown
@@ -240,7 +419,8 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
 
             // TerrainDiffuse
             pFileIndex = new FILE_INDEX;
-            swprintf_s( pFileIndex->szFileName, MAX_PATH, L"terrainNorm%d_%d", x, y );
+            swprintf_s( strName.str, MAX_PATH, L"terrainNorm%d_%d", x, y );
+            FileNames.Add( strName );
             pFileIndex->FileSize = SizeNormal;
             pFileIndex->ChunkIndex = ChunkIndex;
             pFileIndex->OffsetIntoChunk = 0; // unknown
@@ -258,86 +438,98 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
     GetSystemInfo( &SystemInfo );
     UINT64 Granularity = SystemInfo.dwAllocationGranularity; // Allocation granularity (always 64k)
 
-    // Calculate offsets into chunks
-    for( int c = 0; c < NumChunks; c++ )
-    {
-        CHUNK_HEADER* pChunkHeader = TempHeaderList.GetAt( c );
-        pChunkHeader->ChunkSize = 0;
+    // Build the string table
+    UINT64 StringTableChars = 0;
+    for( int i = 0; i < TempFileIndices.GetSize(); i++ )
+        StringTableChars += wcslen( FileNames.GetAt( i ).str ) + 1;
+    UINT64 StringTableSize = ( ( StringTableChars * sizeof( WCHAR ) ) + 7 ) & ~7;
 
-        for( int i = 0; i < TempFileIndices.GetSize(); i++ )
-        {
-            FILE_INDEX* pIndex = TempFileIndices.GetAt( i );
+    pStringTable = new WCHAR[ ( SIZE_T )( StringTableSize / sizeof( WCHAR ) ) ];
+    if( !pStringTable )
+        goto Error;
+    ZeroMemory( pStringTable, ( SIZE_T )StringTableSize );
 
-            if( pIndex->ChunkIndex == c )
-            {
-                pIndex->OffsetIntoChunk = pChunkHeader->ChunkSize;
-                pChunkHeader->ChunkSize += pIndex->FileSize;
-            }
-        }
-    }
+    UINT64 NumHashBuckets = 1;
+    while( NumHashBuckets < 2 * ( UINT64 )TempFileIndices.GetSize() )
+        NumHashBuckets <<= 1;
 
-    UINT64 IndexSize = sizeof( PACKED_FILE_HEADER ) + sizeof( CHUNK_HEADER ) * TempHeaderList.GetSize() + sizeof
-        ( FILE_INDEX ) * TempFileIndices.GetSize();
-    UINT64 ChunkOffset = AlignToGranularity( IndexSize, Granularity );
+    pHashTable = new UINT[ ( SIZE_T )NumHashBuckets ];
+    if( !pHashTable )
+        goto Error;
+    ZeroMemory( pHashTable, ( SIZE_T )( sizeof( UINT ) * NumHashBuckets ) );
 
-    // Align chunks to the proper granularities
-    for( int c = 0; c < NumChunks; c++ )
+    UINT CurrentChar = 0;
+    for( int i = 0; i < TempFileIndices.GetSize(); i++ )
     {
-        CHUNK_HEADER* pChunkHeader = TempHeaderList.GetAt( c );
-        pChunkHeader->ChunkOffset = ChunkOffset;
-
-        ChunkOffset += AlignToGranularity( pChunkHeader->ChunkSize, Granularity );
+        FILE_INDEX* pIndex = TempFileIndices.GetAt( i );
+        WCHAR* szName = FileNames.GetAt( i ).str;
+        size_t cchName = wcslen( szName ) + 1;
+
+        pIndex->NameOffset = CurrentChar;
+        pIndex->NameHash = HashFileName( szName );
+        wcscpy_s( pStringTable + CurrentChar, cchName, szName );
+        CurrentChar += ( UINT )cchName;
+
+        // Insert into the hash table
+        UINT64 iBucket = pIndex->NameHash & ( NumHashBuckets - 1 );
+        while( PACKED_FILE_EMPTY_BUCKET != pHashTable[iBucket] )
+            iBucket = ( iBucket + 1 ) & ( NumHashBuckets - 1 );
+        pHashTable[iBucket] = ( UINT )i + 1;
     }
 
-    // Fill in the header data
-    m_FileHeader.FileSize = ChunkOffset;
+    UINT64 ChunkTableOffset = sizeof( PACKED_FILE_HEADER );
+    UINT64 FileTableOffset = ChunkTableOffset + sizeof( CHUNK_HEADER ) * TempHeaderList.GetSize();
+    UINT64 StringTableOffset = FileTableOffset + sizeof( FILE_INDEX ) * TempFileIndices.GetSize();
+    UINT64 HashTableOffset = StringTableOffset + StringTableSize;
+    UINT64 IndexSize = HashTableOffset + sizeof( UINT ) * NumHashBuckets;
+    UINT64 ChunkOffset = AlignToGranularity( IndexSize, Granularity );
+
+    // Fill in the header data.  FileSize and the chunk table are filled in as the chunks
+    // are written.
+    m_FileHeader.Magic = PACKED_FILE_MAGIC;
+    m_FileHeader.Version = PACKED_FILE_VERSION;
     m_FileHeader.NumChunks = TempHeaderList.GetSize();
     m_FileHeader.NumFiles = TempFileIndices.GetSize();
     m_FileHeader.Granularity = Granularity;
     m_FileHeader.MaxChunksInVA = m_MaxChunksMapped;
+    m_FileHeader.Compression = bCompress ? PACKED_FILE_COMPRESSION_XPRESS : PACKED_FILE_COMPRESSION_NONE;
 
     m_FileHeader.TileBytesSize = TotalTerrainTileSize;
     m_FileHeader.TileSideSize = pTile->BBox.max.x - pTile->BBox.min.x;
     m_FileHeader.LoadingRadius = fLoadingRadius;
     m_FileHeader.VideoMemoryUsageAtFullMips = VideoMemoryUsage;
 
+    m_FileHeader.IndexSize = IndexSize;
+    m_FileHeader.ChunkTableOffset = ChunkTableOffset;
+    m_FileHeader.FileTableOffset = FileTableOffset;
+    m_FileHeader.StringTableOffset = StringTableOffset;
+    m_FileHeader.StringTableSize = StringTableSize;
+    m_FileHeader.HashTableOffset = HashTableOffset;
+    m_FileHeader.NumHashBuckets = NumHashBuckets;
+
     // Open the file
     hFile = CreateFile( szFileName, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN,
                         NULL );
     if( INVALID_HANDLE_VALUE == hFile )
-        return bRet;
+        goto Error;
 
-    // write the header
+    // Skip the index for now, it's written once the stored sizes are known
     DWORD dwWritten;
     DWORD dwRead;
-    if( !WriteFile( hFile, &m_FileHeader, sizeof( PACKED_FILE_HEADER ), &dwWritten, NULL ) )
-        goto Error;
-
-    // write out chunk headers
-    for( int i = 0; i < TempHeaderList.GetSize(); i++ )
-    {
-        CHUNK_HEADER* pChunkHeader = TempHeaderList.GetAt( i );
-        if( !WriteFile( hFile, pChunkHeader, sizeof( CHUNK_HEADER ), &dwWritten, NULL ) )
-            goto Error;
-    }
-
-    // write the index
-    for( int i = 0; i < TempFileIndices.GetSize(); i++ )
-    {
-        FILE_INDEX* pIndex = TempFileIndices.GetAt( i );
-        if( !WriteFile( hFile, pIndex, sizeof( FILE_INDEX ), &dwWritten, NULL ) )
-            goto Error;
-    }
-
-    // Fill in up to the granularity
-    UINT64 CurrentFileSize = IndexSize;
-    CurrentFileSize = FillToGranularity( hFile, CurrentFileSize, Granularity );
-    if( 0 == CurrentFileSize )
+    LARGE_INTEGER liOffset;
+    liOffset.QuadPart = ( LONGLONG )ChunkOffset;
+    if( !SetFilePointerEx( hFile, liOffset, NULL, FILE_BEGIN ) )
         goto Error;
+    UINT64 CurrentFileSize = ChunkOffset;
 
     // Write out the files
     for( int c = 0; c < TempHeaderList.GetSize(); c++ )
     {
+        CHUNK_HEADER* pChunkHeader = TempHeaderList.GetAt( c );
+        pChunkHeader->ChunkOffset = CurrentFileSize;
+        pChunkHeader->ChunkSize = 0;
+        pChunkHeader->UncompressedSize = 0;
+
         for( int i = 0; i < TempFileIndices.GetSize(); i++ )
         {
             FILE_INDEX* pIndex = TempFileIndices.GetAt( i );
@@ -345,8 +537,8 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
             if( pIndex->ChunkIndex == c )
             {
                 // Write out the indexed file
-                bool bDel = false;
                 BYTE* pTempData = NULL;
+                UINT64 StoredSize = pIndex->FileSize;
 
                 if( 0 == wcscmp( FullFilePath.GetAt( i ).str, L"VB" ) )
                 {
@@ -358,41 +550,92 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
                 }
                 else
                 {
-                    HANDLE hIndexFile = CreateFile( FullFilePath.GetAt( i ).str, FILE_READ_DATA, FILE_SHARE_READ, NULL,
-                                                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
-                    if( INVALID_HANDLE_VALUE == hIndexFile )
-                        goto Error;
+                    // Every tile uses the same textures, so they are read (and compressed) once
+                    for( int s = 0; s < StoredSources.GetSize(); s++ )
+                    {
+                        if( 0 == wcscmp( StoredSources.GetAt( s ).strPath.str, FullFilePath.GetAt( i ).str ) )
+                        {
+                            pTempData = StoredSources.GetAt( s ).pStored;
+                            StoredSize = StoredSources.GetAt( s ).StoredSize;
+                            break;
+                        }
+                    }
 
-                    pTempData = new BYTE[ ( SIZE_T )pIndex->FileSize ];
                     if( !pTempData )
                     {
+                        HANDLE hIndexFile = CreateFile( FullFilePath.GetAt( i ).str, FILE_READ_DATA, FILE_SHARE_READ,
+                                                        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+                        if( INVALID_HANDLE_VALUE == hIndexFile )
+                            goto Error;
+
+                        STORED_SOURCE Source;
+                        Source.strPath = FullFilePath.GetAt( i );
+                        Source.pStored = new BYTE[ ( SIZE_T )pIndex->FileSize ];
+                        Source.StoredSize = pIndex->FileSize;
+                        if( !Source.pStored )
+                        {
+                            CloseHandle( hIndexFile );
+                            goto Error;
+                        }
+
+                        if( !ReadFile( hIndexFile, Source.pStored, ( DWORD )pIndex->FileSize, &dwRead, NULL ) )
+                        {
+                            CloseHandle( hIndexFile );
+                            SAFE_DELETE_ARRAY( Source.pStored );
+                            goto Error;
+                        }
+
                         CloseHandle( hIndexFile );
-                        goto Error;
+
+                        if( bCompress )
+                        {
+                            BYTE* pStored = new BYTE[ ( SIZE_T )pIndex->FileSize ];
+                            SIZE_T cStored = pStored ? CompressPackedData( Source.pStored, ( SIZE_T )pIndex->FileSize,
+                                                                           pStored, ( SIZE_T )pIndex->FileSize ) : 0;
+                            if( cStored )
+                            {
+                                SAFE_DELETE_ARRAY( Source.pStored );
+                                Source.pStored = pStored;
+                                Source.StoredSize = cStored;
+                            }
+                            else
+                            {
+                                SAFE_DELETE_ARRAY( pStored );
+                            }
+                        }
+
+                        StoredSources.Add( Source );
+                        pTempData = Source.pStored;
+                        StoredSize = Source.StoredSize;
                     }
+                }
 
-                    bDel = true;
+                // The terrain buffers are different for every tile
+                if( bCompress && ( 0 == wcscmp( FullFilePath.GetAt( i ).str, L"VB" ) ||
+                                   0 == wcscmp( FullFilePath.GetAt( i ).str, L"IB" ) ) )
+                {
+                    SAFE_DELETE_ARRAY( pCompressed );
+                    pCompressed = new BYTE[ ( SIZE_T )pIndex->FileSize ];
+                    if( !pCompressed )
+                        goto Error;
 
-                    if( !ReadFile( hIndexFile, pTempData, ( DWORD )pIndex->FileSize, &dwRead, NULL ) )
+                    SIZE_T cStored = CompressPackedData( pTempData, ( SIZE_T )pIndex->FileSize, pCompressed,
+                                                         ( SIZE_T )pIndex->FileSize );
+                    if( cStored )
                     {
-                        CloseHandle( hIndexFile );
-                        SAFE_DELETE_ARRAY( pTempData );
-                        goto Error;
+                        pTempData = pCompressed;
+                        StoredSize = cStored;
                     }
-
-                    CloseHandle( hIndexFile );
                 }
 
-                if( !WriteFile( hFile, pTempData, ( DWORD )pIndex->FileSize, &dwWritten, NULL ) )
-                {
-                    if( bDel )
-                        SAFE_DELETE_ARRAY( pTempData );
+                if( !WriteFile( hFile, pTempData, ( DWORD )StoredSize, &dwWritten, NULL ) )
                     goto Error;
-                }
-
-                if( bDel )
-                    SAFE_DELETE_ARRAY( pTempData );
 
-                CurrentFileSize += pIndex->FileSize;
+                pIndex->StoredSize = StoredSize;
+                pIndex->OffsetIntoChunk = pChunkHeader->ChunkSize;
+                pChunkHeader->ChunkSize += StoredSize;
+                pChunkHeader->UncompressedSize += pIndex->FileSize;
+                CurrentFileSize += StoredSize;
             }
         }
 
@@ -402,6 +645,39 @@ bool CPackedFile::CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev
             goto Error;
     }
 
+    m_FileHeader.FileSize = CurrentFileSize;
+
+    // Go back and write the index
+    liOffset.QuadPart = 0;
+    if( !SetFilePointerEx( hFile, liOffset, NULL, FILE_BEGIN ) )
+        goto Error;
+
+    // write the header
+    if( !WriteFile( hFile, &m_FileHeader, sizeof( PACKED_FILE_HEADER ), &dwWritten, NULL ) )
+        goto Error;
+
+    // write out chunk headers
+    for( int i = 0; i < TempHeaderList.GetSize(); i++ )
+    {
+        CHUNK_HEADER* pChunkHeader = TempHeaderList.GetAt( i );
+        if( !WriteFile( hFile, pChunkHeader, sizeof( CHUNK_HEADER ), &dwWritten, NULL ) )
+            goto Error;
+    }
+
+    // write the index
+    for( int i = 0; i < TempFileIndices.GetSize(); i++ )
+    {
+        FILE_INDEX* pIndex = TempFileIndices.GetAt( i );
+        if( !WriteFile( hFile, pIndex, sizeof( FILE_INDEX ), &dwWritten, NULL ) )
+            goto Error;
+    }
+
+    // write the string table and the hash table
+    if( !WriteFile( hFile, pStringTable, ( DWORD )StringTableSize, &dwWritten, NULL ) )
+        goto Error;
+    if( !WriteFile( hFile, pHashTable, ( DWORD )( sizeof( UINT ) * NumHashBuckets ), &dwWritten, NULL ) )
+        goto Error;
+
     bRet = true;
 Error:
 
@@ -417,7 +693,46 @@ Error:
         SAFE_DELETE( pChunkHeader );
     }
 
-    FlushFileBuffers( hFile );
+    for( int i = 0; i < StoredSources.GetSize(); i++ )
+        SAFE_DELETE_ARRAY( StoredSources.GetAt( i ).pStored );
+
+    SAFE_DELETE_ARRAY( pStringTable );
+    SAFE_DELETE_ARRAY( pHashTable );
+    SAFE_DELETE_ARRAY( pCompressed );
+
+    if( INVALID_HANDLE_VALUE != hFile )
+    {
+        FlushFileBuffers( hFile );
+        CloseHandle( hFile );
+    }
+    return bRet;
+}
+
+//--------------------------------------------------------------------------------------
+// Returns true if the file on disk is a complete packed file of the current version.
+// A packed file left half written (the process was killed while creating it) or one
+// written by an older version of the sample needs to be recreated.
+//--------------------------------------------------------------------------------------
+bool CPackedFile::IsPackedFileCurrent( WCHAR* szFileName )
+{
+    HANDLE hFile = CreateFile( szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if( INVALID_HANDLE_VALUE == hFile )
+        return false;
+
+    bool bRet = false;
+    PACKED_FILE_HEADER Header;
+    DWORD dwRead;
+    LARGE_INTEGER FileSize;
+    if( ReadFile( hFile, &Header, sizeof( PACKED_FILE_HEADER ), &dwRead, NULL ) &&
+        sizeof( PACKED_FILE_HEADER ) == dwRead &&
+        GetFileSizeEx( hFile, &FileSize ) )
+    {
+        bRet = ( PACKED_FILE_MAGIC == Header.Magic &&
+                 PACKED_FILE_VERSION == Header.Version &&
+                 Header.FileSize == ( UINT64 )FileSize.QuadPart );
+    }
+
     CloseHandle( hFile );
     return bRet;
 }
@@ -426,6 +741,9 @@ Error:
 // Loads the index of a packed file and optionally creates mapped pointers using
 // MapViewOfFile for each of the different chunks in the file.  The chunks must be
 // aligned to the proper granularity (64k) or MapViewOfFile will fail.
+//
+// The index block at the front of the file is mapped with a single view and used in
+// place.  Only the header is read with ReadFile.
 //--------------------------------------------------------------------------------------
 bool CPackedFile::LoadPackedFile( WCHAR* szFileName, bool b64Bit, CGrowableArray <LEVEL_ITEM*>* pLevelItemArray )
 {
@@ -435,13 +753,23 @@ bool CPackedFile::LoadPackedFile( WCHAR* szFileName, bool b64Bit, CGrowableArray
     m_hFile = CreateFile( szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
                           NULL );
     if( INVALID_HANDLE_VALUE == m_hFile )
+    {
+        m_hFile = 0;
         return bRet;
+    }
 
     // read the header
     DWORD dwRead;
     if( !ReadFile( m_hFile, &m_FileHeader, sizeof( PACKED_FILE_HEADER ), &dwRead, NULL ) )
         goto Error;
 
+    if( PACKED_FILE_MAGIC != m_FileHeader.Magic || PACKED_FILE_VERSION != m_FileHeader.Version )
+        goto Error;
+
+    // Compressed files need the Compression API
+    if( PACKED_FILE_COMPRESSION_NONE != m_FileHeader.Compression && !IsPackedFileCompressionAvailable() )
+        goto Error;
+
     // Make sure the granularity is the same
     SYSTEM_INFO SystemInfo;
     GetSystemInfo( &SystemInfo );
@@ -450,31 +778,30 @@ bool CPackedFile::LoadPackedFile( WCHAR* szFileName, bool b64Bit, CGrowableArray
 
     m_ChunksMapped = 0;
 
-    // Create the chunk and index data
-    m_pChunks = new CHUNK_HEADER[ ( SIZE_T )m_FileHeader.NumChunks ];
-    if( !m_pChunks )
-        goto Error;
-    m_pFileIndices = new FILE_INDEX[ ( SIZE_T )m_FileHeader.NumFiles ];
-    if( !m_pFileIndices )
+    // Map the file.  The index is always read through the mapping.
+    m_hFileMapping = CreateFileMapping( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    if( !m_hFileMapping )
         goto Error;
 
-    // Load the chunk and index data
-    if( !ReadFile( m_hFile, m_pChunks, sizeof( CHUNK_HEADER ) * ( DWORD )m_FileHeader.NumChunks, &dwRead, NULL ) )
-        goto Error;
-    if( !ReadFile( m_hFile, m_pFileIndices, sizeof( FILE_INDEX ) * ( ( DWORD )m_FileHeader.NumFiles ), &dwRead,
-                   NULL ) )
+    m_pIndexView = MapViewOfFile( m_hFileMapping, FILE_MAP_READ, 0, 0, ( SIZE_T )m_FileHeader.IndexSize );
+    if( !m_pIndexView )
         goto Error;
 
+    m_pChunks = ( CHUNK_HEADER* )( ( BYTE* )m_pIndexView + m_FileHeader.ChunkTableOffset );
+    m_pFileIndices = ( FILE_INDEX* )( ( BYTE* )m_pIndexView + m_FileHeader.FileTableOffset );
+    m_pStringTable = ( WCHAR* )( ( BYTE* )m_pIndexView + m_FileHeader.StringTableOffset );
+    m_pHashTable = ( UINT* )( ( BYTE* )m_pIndexView + m_FileHeader.HashTableOffset );
+
     // Load the level item array
     for( UINT i = 0; i < m_FileHeader.NumFiles; i += 4 )
     {
         LEVEL_ITEM* pLevelItem = new LEVEL_ITEM;
         ZeroMemory( pLevelItem, sizeof( LEVEL_ITEM ) );
         pLevelItem->vCenter = m_pFileIndices[i].vCenter;
-        wcscpy_s( pLevelItem->szVBName, MAX_PATH, m_pFileIndices[i].szFileName );
-        wcscpy_s( pLevelItem->szIBName, MAX_PATH, m_pFileIndices[i + 1].szFileName );
-        wcscpy_s( pLevelItem->szDiffuseName, MAX_PATH, m_pFileIndices[i + 2].szFileName );
-        wcscpy_s( pLevelItem->szNormalName, MAX_PATH, m_pFileIndices[i + 3].szFileName );
+        wcscpy_s( pLevelItem->szVBName, MAX_PATH, GetFileName( i ) );
+        wcscpy_s( pLevelItem->szIBName, MAX_PATH, GetFileName( i + 1 ) );
+        wcscpy_s( pLevelItem->szDiffuseName, MAX_PATH, GetFileName( i + 2 ) );
+        wcscpy_s( pLevelItem->szNormalName, MAX_PATH, GetFileName( i + 3 ) );
         pLevelItem->bLoaded = false;
         pLevelItem->bLoading = false;
         pLevelItem->bInLoadRadius = false;
@@ -493,17 +820,42 @@ bool CPackedFile::LoadPackedFile( WCHAR* szFileName, bool b64Bit, CGrowableArray
         if( !m_pMappedChunks )
             goto Error;
 
-        // Memory map the rest
-        m_hFileMapping = CreateFileMapping( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
-        if( INVALID_HANDLE_VALUE == m_hFile )
-            goto Error;
-
         for( UINT64 i = 0; i < m_FileHeader.NumChunks; i++ )
         {
             m_pMappedChunks[i].bInUse = FALSE;
             m_pMappedChunks[i].pMappingPointer = NULL;
-            m_pMappedChunks[i].UseCounter = 0;
+            m_pMappedChunks[i].pDecodedFiles = NULL;
+            m_pMappedChunks[i].pLRUPrev = NULL;
+            m_pMappedChunks[i].pLRUNext = NULL;
+            m_pMappedChunks[i].vCenter = D3DXVECTOR3( 0, 0, 0 );
+            m_pMappedChunks[i].PinCount = 0;
         }
+        m_pLRUHead = NULL;
+        m_pLRUTail = NULL;
+
+        // The center of a chunk is the average center of the files it holds
+        UINT* pFilesPerChunk = new UINT[ ( SIZE_T )m_FileHeader.NumChunks ];
+        if( !pFilesPerChunk )
+            goto Error;
+        ZeroMemory( pFilesPerChunk, ( SIZE_T )( sizeof( UINT ) * m_FileHeader.NumChunks ) );
+        for( UINT64 i = 0; i < m_FileHeader.NumFiles; i++ )
+        {
+            UINT64 iChunk = m_pFileIndices[i].ChunkIndex;
+            m_pMappedChunks[iChunk].vCenter += m_pFileIndices[i].vCenter;
+            pFilesPerChunk[iChunk] ++;
+        }
+        for( UINT64 i = 0; i < m_FileHeader.NumChunks; i++ )
+        {
+            if( pFilesPerChunk[i] )
+                m_pMappedChunks[i].vCenter /= ( float )pFilesPerChunk[i];
+        }
+        SAFE_DELETE_ARRAY( pFilesPerChunk );
+
+        if( !BuildChunkGrid() )
+            goto Error;
+
+        if( !InitReadahead() )
+            goto Error;
     }
     else
     {
@@ -518,6 +870,8 @@ Error:
 //--------------------------------------------------------------------------------------
 void CPackedFile::UnloadPackedFile()
 {
+    DestroyReadahead();
+
     if( m_pMappedChunks )
     {
         for( UINT i = 0; i < m_FileHeader.NumChunks; i++ )
@@ -526,11 +880,27 @@ void CPackedFile::UnloadPackedFile()
             {
                 UnmapViewOfFile( m_pMappedChunks[i].pMappingPointer );
             }
+            FreeDecodedFiles( &m_pMappedChunks[i] );
         }
     }
 
     SAFE_DELETE_ARRAY( m_pMappedChunks );
+    SAFE_DELETE_ARRAY( m_pChunkGridStart );
+    SAFE_DELETE_ARRAY( m_pChunkGridChunks );
+    m_ChunkGridCellsX = 0;
+    m_ChunkGridCellsZ = 0;
+    m_pLRUHead = NULL;
+    m_pLRUTail = NULL;
+    m_ChunksMapped = 0;
 
+    // The chunk, file, string and hash tables all live in the index view
+    if( m_pIndexView )
+        UnmapViewOfFile( m_pIndexView );
+    m_pIndexView = NULL;
+    m_pChunks = NULL;
+    m_pFileIndices = NULL;
+    m_pStringTable = NULL;
+    m_pHashTable = NULL;
 
     if( m_hFileMapping )
         CloseHandle( m_hFileMapping );
@@ -539,58 +909,409 @@ void CPackedFile::UnloadPackedFile()
     if( m_hFile )
         CloseHandle( m_hFile );
     m_hFile = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The mapped chunks form an intrusive doubly linked list ordered from most recently
+// used (head) to least recently used (tail).  All list operations are O(1).  The caller
+// must hold m_csMapping.
+//--------------------------------------------------------------------------------------
+void CPackedFile::LRURemove( MAPPED_CHUNK* pChunk )
+{
+    if( pChunk->pLRUPrev )
+        pChunk->pLRUPrev->pLRUNext = pChunk->pLRUNext;
+    else
+        m_pLRUHead = pChunk->pLRUNext;
 
-    SAFE_DELETE_ARRAY( m_pChunks );
-    SAFE_DELETE_ARRAY( m_pFileIndices );
+    if( pChunk->pLRUNext )
+        pChunk->pLRUNext->pLRUPrev = pChunk->pLRUPrev;
+    else
+        m_pLRUTail = pChunk->pLRUPrev;
+
+    pChunk->pLRUPrev = NULL;
+    pChunk->pLRUNext = NULL;
 }
 
+//--------------------------------------------------------------------------------------
+void CPackedFile::LRUPushFront( MAPPED_CHUNK* pChunk )
+{
+    pChunk->pLRUPrev = NULL;
+    pChunk->pLRUNext = m_pLRUHead;
+    if( m_pLRUHead )
+        m_pLRUHead->pLRUPrev = pChunk;
+    m_pLRUHead = pChunk;
+    if( !m_pLRUTail )
+        m_pLRUTail = pChunk;
+}
 
 //--------------------------------------------------------------------------------------
-void CPackedFile::EnsureChunkMapped( UINT64 iChunk )
+// Unmaps the least recently used chunk that isn't pinned.  If pvEye is not NULL, chunks
+// within fKeepRadius of the eye are kept, so the readahead thread never evicts the
+// chunks it is trying to bring in.  The caller must hold m_csMapping.
+//--------------------------------------------------------------------------------------
+bool CPackedFile::EvictLRUChunk( float fKeepRadius, const D3DXVECTOR3* pvEye )
 {
-    if( !m_pMappedChunks[iChunk].bInUse )
+    MAPPED_CHUNK* pVictim = m_pLRUTail;
+    while( pVictim && pVictim->PinCount > 0 )
+        pVictim = pVictim->pLRUPrev;
+
+    if( !pVictim )
+        return false;
+
+    if( pvEye )
     {
-        if( m_ChunksMapped == m_MaxChunksMapped )
-        {
-            // We need to free a chunk
-            UINT lruValue = m_CurrentUseCounter;
-            UINT64 lruChunk = ( UINT )-1;
-            for( UINT64 i = 0; i < m_FileHeader.NumChunks; i++ )
-            {
-                if( m_pMappedChunks[i].bInUse )
-                {
-                    if( lruChunk == ( UINT )-1 || m_pMappedChunks[i].UseCounter < lruValue )
-                    {
-                        lruValue = m_pMappedChunks[i].UseCounter;
-                        lruChunk = i;
-                    }
-                }
-            }
+        D3DXVECTOR3 vDelta = pVictim->vCenter - *pvEye;
+        if( D3DXVec3LengthSq( &vDelta ) < fKeepRadius * fKeepRadius )
+            return false;
+    }
 
-            UnmapViewOfFile( m_pMappedChunks[lruChunk].pMappingPointer );
-            m_pMappedChunks[lruChunk].pMappingPointer = NULL;
-            m_pMappedChunks[lruChunk].bInUse = FALSE;
-            m_ChunksMapped --;
+    LRURemove( pVictim );
+    FreeDecodedFiles( pVictim );
+    UnmapViewOfFile( pVictim->pMappingPointer );
+    pVictim->pMappingPointer = NULL;
+    pVictim->bInUse = FALSE;
+    m_ChunksMapped --;
 
-            OutputDebugString( L"Unmapped File Chunk\n" );
-        }
+    OutputDebugString( L"Unmapped File Chunk\n" );
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Frees the files GetPackedFile decompressed out of this chunk.  Callers got pointers
+// into the mapping before, so the decoded copies live exactly as long as the mapping.
+//--------------------------------------------------------------------------------------
+void CPackedFile::FreeDecodedFiles( MAPPED_CHUNK* pChunk )
+{
+    while( pChunk->pDecodedFiles )
+    {
+        DECODED_FILE* pNext = pChunk->pDecodedFiles->pNext;
+        SAFE_DELETE_ARRAY( pChunk->pDecodedFiles->pData );
+        SAFE_DELETE( pChunk->pDecodedFiles );
+        pChunk->pDecodedFiles = pNext;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Maps the chunk if it isn't already, and marks it as the most recently used.  Returns
+// the mapped pointer for the chunk.  If bPin is set the chunk is also pinned, so it
+// stays mapped until UnpinChunk.  When every mapped chunk is pinned, the chunk is mapped
+// anyway and the limit is exceeded until some are unpinned.
+//--------------------------------------------------------------------------------------
+void* CPackedFile::AcquireChunk( UINT64 iChunk, bool bPin )
+{
+    EnterCriticalSection( &m_csMapping );
+
+    MAPPED_CHUNK* pChunk = &m_pMappedChunks[iChunk];
+    if( !pChunk->bInUse )
+    {
+        // We need to free a chunk
+        if( m_ChunksMapped >= m_MaxChunksMapped )
+            EvictLRUChunk( 0, NULL );
 
         // Map this chunk
         DWORD dwOffsetHigh = ( DWORD )( ( m_pChunks[iChunk].ChunkOffset & 0xFFFFFFFF00000000 ) >> 32 );
         DWORD dwOffsetLow = ( DWORD )( ( m_pChunks[iChunk].ChunkOffset & 0x00000000FFFFFFFF ) );
-        m_pMappedChunks[iChunk].bInUse = TRUE;
-        m_pMappedChunks[iChunk].pMappingPointer = MapViewOfFile( m_hFileMapping, FILE_MAP_READ, dwOffsetHigh,
-                                                                 dwOffsetLow, ( DWORD )m_pChunks[iChunk].ChunkSize );
-        if( !m_pMappedChunks[iChunk].pMappingPointer )
+        pChunk->bInUse = TRUE;
+        pChunk->pMappingPointer = MapViewOfFile( m_hFileMapping, FILE_MAP_READ, dwOffsetHigh,
+                                                 dwOffsetLow, ( DWORD )m_pChunks[iChunk].ChunkSize );
+        if( !pChunk->pMappingPointer )
         {
             OutputDebugString( L"File Chunk not Mapped!\n" );
         }
         m_ChunksMapped ++;
     }
+    else
+    {
+        LRURemove( pChunk );
+    }
+
+    // Move it to the front for the LRU check
+    LRUPushFront( pChunk );
+
+    void* pMappingPointer = pChunk->pMappingPointer;
+    if( bPin && pMappingPointer )
+        pChunk->PinCount ++;
+    LeaveCriticalSection( &m_csMapping );
+
+    return pMappingPointer;
+}
+
+//--------------------------------------------------------------------------------------
+void CPackedFile::UnpinChunk( UINT64 iChunk )
+{
+    EnterCriticalSection( &m_csMapping );
+    MAPPED_CHUNK* pChunk = &m_pMappedChunks[iChunk];
+    if( pChunk->PinCount > 0 )
+        pChunk->PinCount --;
+    LeaveCriticalSection( &m_csMapping );
+}
+
+//--------------------------------------------------------------------------------------
+void CPackedFile::EnsureChunkMapped( UINT64 iChunk )
+{
+    AcquireChunk( iChunk, false );
+}
+
+//--------------------------------------------------------------------------------------
+// Create the readahead thread.  It sleeps until RequestReadahead gives it a new camera
+// position.
+//--------------------------------------------------------------------------------------
+bool CPackedFile::InitReadahead()
+{
+    m_bReadaheadDone = FALSE;
+    m_fReadaheadRadius = 0;
+    m_NumReadaheadMapped = 0;
+
+    m_hReadaheadEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if( !m_hReadaheadEvent )
+        return false;
+
+    m_hReadaheadThread = ( HANDLE )_beginthreadex( NULL, 0, _ReadaheadThreadProc, ( LPVOID )this,
+                                                   CREATE_SUSPENDED, NULL );
+    if( !m_hReadaheadThread )
+        return false;
+
+    // Pre-faulting is background work, keep it from competing with the IO thread
+    SetThreadPriority( m_hReadaheadThread, THREAD_PRIORITY_BELOW_NORMAL );
+    ResumeThread( m_hReadaheadThread );
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+void CPackedFile::DestroyReadahead()
+{
+    if( m_hReadaheadThread )
+    {
+        m_bReadaheadDone = TRUE;
+        SetEvent( m_hReadaheadEvent );
+        WaitForSingleObject( m_hReadaheadThread, INFINITE );
+        CloseHandle( m_hReadaheadThread );
+    }
+    m_hReadaheadThread = 0;
+
+    if( m_hReadaheadEvent )
+        CloseHandle( m_hReadaheadEvent );
+    m_hReadaheadEvent = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Tells the readahead thread where the camera is.  Chunks that are about to come into
+// the loading radius are mapped and pre-faulted on the readahead thread, so the IO
+// thread doesn't take the page faults when it gets to them.  This is cheap enough to
+// call every frame.
+//--------------------------------------------------------------------------------------
+void CPackedFile::RequestReadahead( const D3DXVECTOR3* pvEye, float fLoadingRadius )
+{
+    if( !m_hReadaheadThread )
+        return;
+
+    EnterCriticalSection( &m_csReadahead );
+    m_vReadaheadEye = *pvEye;
+    m_fReadaheadRadius = fLoadingRadius;
+    LeaveCriticalSection( &m_csReadahead );
+
+    SetEvent( m_hReadaheadEvent );
+}
+
+//--------------------------------------------------------------------------------------
+// Bucket the chunk centers into cells about a tile across with a counting sort, so the
+// readahead thread only looks at the chunks around the eye
+//--------------------------------------------------------------------------------------
+bool CPackedFile::BuildChunkGrid()
+{
+    const UINT NumChunks = ( UINT )m_FileHeader.NumChunks;
+    if( NumChunks == 0 )
+        return true;
+
+    D3DXVECTOR3 vMin = m_pMappedChunks[0].vCenter;
+    D3DXVECTOR3 vMax = vMin;
+    for( UINT i = 1; i < NumChunks; i++ )
+    {
+        D3DXVec3Minimize( &vMin, &vMin, &m_pMappedChunks[i].vCenter );
+        D3DXVec3Maximize( &vMax, &vMax, &m_pMappedChunks[i].vCenter );
+    }
+
+    float fExtent = max( vMax.x - vMin.x, vMax.z - vMin.z );
+    float fCellSize = max( m_FileHeader.TileSideSize, fExtent / ( MAX_CHUNK_GRID_CELLS_PER_SIDE - 1 ) );
+    if( !( fCellSize > 0.0f ) )
+        fCellSize = 1.0f;
+
+    m_fChunkGridMinX = vMin.x;
+    m_fChunkGridMinZ = vMin.z;
+    m_fChunkGridInvCellSize = 1.0f / fCellSize;
+    m_ChunkGridCellsX = min( ( int )( ( vMax.x - vMin.x ) * m_fChunkGridInvCellSize ) + 1,
+                             MAX_CHUNK_GRID_CELLS_PER_SIDE );
+    m_ChunkGridCellsZ = min( ( int )( ( vMax.z - vMin.z ) * m_fChunkGridInvCellSize ) + 1,
+                             MAX_CHUNK_GRID_CELLS_PER_SIDE );
+
+    const int NumCells = m_ChunkGridCellsX * m_ChunkGridCellsZ;
+    m_pChunkGridStart = new UINT[ NumCells + 1 ];
+    m_pChunkGridChunks = new UINT[ NumChunks ];
+    UINT* pChunkCells = new UINT[ NumChunks ];
+    if( !m_pChunkGridStart || !m_pChunkGridChunks || !pChunkCells )
+    {
+        SAFE_DELETE_ARRAY( pChunkCells );
+        return false;
+    }
+
+    // Count the chunks in each cell, shifted by one so the prefix sum gives the starts
+    ZeroMemory( m_pChunkGridStart, ( NumCells + 1 ) * sizeof( UINT ) );
+    for( UINT i = 0; i < NumChunks; i++ )
+    {
+        const D3DXVECTOR3& vCenter = m_pMappedChunks[i].vCenter;
+        int iX = min( ( int )( ( vCenter.x - m_fChunkGridMinX ) * m_fChunkGridInvCellSize ), m_ChunkGridCellsX - 1 );
+        int iZ = min( ( int )( ( vCenter.z - m_fChunkGridMinZ ) * m_fChunkGridInvCellSize ), m_ChunkGridCellsZ - 1 );
+        pChunkCells[i] = iZ * m_ChunkGridCellsX + iX;
+        m_pChunkGridStart[ pChunkCells[i] + 1 ] ++;
+    }
+    for( int i = 0; i < NumCells; i++ )
+        m_pChunkGridStart[ i + 1 ] += m_pChunkGridStart[i];
+
+    // Scatter, using the starts as write cursors and then shifting them back
+    for( UINT i = 0; i < NumChunks; i++ )
+        m_pChunkGridChunks[ m_pChunkGridStart[ pChunkCells[i] ] ++ ] = i;
+    for( int i = NumCells; i > 0; i-- )
+        m_pChunkGridStart[i] = m_pChunkGridStart[ i - 1 ];
+    m_pChunkGridStart[0] = 0;
+
+    SAFE_DELETE_ARRAY( pChunkCells );
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Adds the chunks whose centers are closer than fRadius to vEye.  Only the chunk grid and
+// the chunk centers are read, and neither changes once the file is loaded, so this
+// doesn't need m_csMapping.
+//--------------------------------------------------------------------------------------
+void CPackedFile::GetChunksInRadius( const D3DXVECTOR3& vEye, float fRadius,
+                                     CGrowableArray <READAHEAD_CANDIDATE>* pCandidates )
+{
+    if( m_ChunkGridCellsX == 0 || !( fRadius > 0.0f ) )
+        return;
+
+    // Clamp before converting so far away eyes can't overflow the integers
+    float fX0 = max( 0.0f, ( vEye.x - fRadius - m_fChunkGridMinX ) * m_fChunkGridInvCellSize );
+    float fZ0 = max( 0.0f, ( vEye.z - fRadius - m_fChunkGridMinZ ) * m_fChunkGridInvCellSize );
+    float fX1 = min( ( float )( m_ChunkGridCellsX - 1 ),
+                     ( vEye.x + fRadius - m_fChunkGridMinX ) * m_fChunkGridInvCellSize );
+    float fZ1 = min( ( float )( m_ChunkGridCellsZ - 1 ),
+                     ( vEye.z + fRadius - m_fChunkGridMinZ ) * m_fChunkGridInvCellSize );
+    if( fX0 > fX1 || fZ0 > fZ1 )
+        return;
+
+    const float fRadius2 = fRadius * fRadius;
+    for( int iZ = ( int )fZ0; iZ <= ( int )fZ1; iZ++ )
+    {
+        for( int iX = ( int )fX0; iX <= ( int )fX1; iX++ )
+        {
+            const UINT iCell = iZ * m_ChunkGridCellsX + iX;
+            for( UINT i = m_pChunkGridStart[iCell]; i < m_pChunkGridStart[ iCell + 1 ]; i++ )
+            {
+                READAHEAD_CANDIDATE Candidate;
+                Candidate.iChunk = m_pChunkGridChunks[i];
+
+                D3DXVECTOR3 vDelta = m_pMappedChunks[Candidate.iChunk].vCenter - vEye;
+                Candidate.fDist2 = D3DXVec3LengthSq( &vDelta );
+                if( Candidate.fDist2 < fRadius2 )
+                    pCandidates->Add( Candidate );
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+int __cdecl CompareReadaheadCandidates( const void* pA, const void* pB )
+{
+    float fA = ( ( READAHEAD_CANDIDATE* )pA )->fDist2;
+    float fB = ( ( READAHEAD_CANDIDATE* )pB )->fDist2;
+    return ( fA < fB ) ? -1 : ( fA > fB ) ? 1 : 0;
+}
+
+//--------------------------------------------------------------------------------------
+// ReadaheadThreadProc
+//
+// Finds the chunks within the readahead radius with the chunk grid, closest first, maps
+// the ones that aren't mapped yet and touches every page so the data is resident before
+// the IO thread asks for it.  Chunks inside the readahead radius are never evicted to
+// make room for other readahead.  The search and the sort run outside of m_csMapping;
+// the lock is only held to map and pin each chosen chunk.
+//--------------------------------------------------------------------------------------
+unsigned int CPackedFile::ReadaheadThreadProc()
+{
+    CGrowableArray <READAHEAD_CANDIDATE> Candidates;
+
+    while( !m_bReadaheadDone )
+    {
+        WaitForSingleObject( m_hReadaheadEvent, INFINITE );
+        if( m_bReadaheadDone )
+            break;
+
+        EnterCriticalSection( &m_csReadahead );
+        D3DXVECTOR3 vEye = m_vReadaheadEye;
+        float fRadius = m_fReadaheadRadius + m_FileHeader.TileSideSize * READAHEAD_TILES;
+        LeaveCriticalSection( &m_csReadahead );
+
+        // Collect the chunks that are close enough.  Whether they are already mapped is
+        // checked under the lock as each one comes up.
+        Candidates.Reset();
+        GetChunksInRadius( vEye, fRadius, &Candidates );
+
+        if( Candidates.GetSize() > 1 )
+            qsort( Candidates.GetData(), Candidates.GetSize(), sizeof( READAHEAD_CANDIDATE ),
+                   CompareReadaheadCandidates );
+
+        for( int c = 0; c < Candidates.GetSize() && !m_bReadaheadDone; c++ )
+        {
+            UINT64 iChunk = Candidates.GetAt( c ).iChunk;
+            MAPPED_CHUNK* pChunk = &m_pMappedChunks[iChunk];
+
+            EnterCriticalSection( &m_csMapping );
+            if( pChunk->bInUse )
+            {
+                // Already mapped, or the IO thread got to it first
+                LeaveCriticalSection( &m_csMapping );
+                continue;
+            }
+            if( m_ChunksMapped >= m_MaxChunksMapped && !EvictLRUChunk( fRadius, &vEye ) )
+            {
+                // Everything mapped is still needed
+                LeaveCriticalSection( &m_csMapping );
+                break;
+            }
+
+            DWORD dwOffsetHigh = ( DWORD )( ( m_pChunks[iChunk].ChunkOffset & 0xFFFFFFFF00000000 ) >> 32 );
+            DWORD dwOffsetLow = ( DWORD )( ( m_pChunks[iChunk].ChunkOffset & 0x00000000FFFFFFFF ) );
+            pChunk->pMappingPointer = MapViewOfFile( m_hFileMapping, FILE_MAP_READ, dwOffsetHigh,
+                                                     dwOffsetLow, ( DWORD )m_pChunks[iChunk].ChunkSize );
+            if( !pChunk->pMappingPointer )
+            {
+                LeaveCriticalSection( &m_csMapping );
+                continue;
+            }
+            pChunk->bInUse = TRUE;
+            m_ChunksMapped ++;
+
+            // Readahead chunks go to the front so they aren't evicted before the IO thread
+            // gets to them
+            LRUPushFront( pChunk );
+
+            // Pin it so it can't be unmapped while we touch the pages outside the lock
+            pChunk->PinCount ++;
+            BYTE* pData = ( BYTE* )pChunk->pMappingPointer;
+            LeaveCriticalSection( &m_csMapping );
+
+            WarmIOCache( pData, ( SIZE_T )m_pChunks[iChunk].ChunkSize );
+
+            EnterCriticalSection( &m_csMapping );
+            pChunk->PinCount --;
+            m_NumReadaheadMapped ++;
+            LeaveCriticalSection( &m_csMapping );
+        }
+    }
 
-    // Set our use counter for the LRU check
-    m_pMappedChunks[iChunk].UseCounter = m_CurrentUseCounter;
-    m_CurrentUseCounter ++;
+    return 0;
 }
 
 //--------------------------------------------------------------------------------------
@@ -603,21 +1324,44 @@ bool CPackedFile::GetPackedFileInfo( char* szFile, UINT* pDataBytes )
 }
 
 //--------------------------------------------------------------------------------------
-// Finds information about a resource using the index
+// Looks a file up in the hash table of the index.  Returns -1 if the file is not in
+// the packed file.
 //--------------------------------------------------------------------------------------
-bool CPackedFile::GetPackedFileInfo( WCHAR* szFile, UINT* pDataBytes )
+INT64 CPackedFile::FindFile( WCHAR* szFile )
 {
-    // Look the file up in the index
-    int iFoundIndex = -1;
-    for( UINT i = 0; i < m_FileHeader.NumFiles; i++ )
+    if( !m_pHashTable || 0 == m_FileHeader.NumHashBuckets )
+        return -1;
+
+    UINT hash = HashFileName( szFile );
+    UINT64 mask = m_FileHeader.NumHashBuckets - 1;
+    UINT64 iBucket = hash & mask;
+
+    // The table is never more than half full, so this always hits an empty bucket
+    while( PACKED_FILE_EMPTY_BUCKET != m_pHashTable[iBucket] )
     {
-        if( 0 == wcscmp( szFile, m_pFileIndices[i].szFileName ) )
-        {
-            iFoundIndex = i;
-            break;
-        }
+        UINT64 iFile = m_pHashTable[iBucket] - 1;
+        if( m_pFileIndices[iFile].NameHash == hash && 0 == wcscmp( szFile, GetFileName( iFile ) ) )
+            return ( INT64 )iFile;
+
+        iBucket = ( iBucket + 1 ) & mask;
     }
 
+    return -1;
+}
+
+//--------------------------------------------------------------------------------------
+WCHAR* CPackedFile::GetFileName( UINT64 iFile )
+{
+    return m_pStringTable + m_pFileIndices[iFile].NameOffset;
+}
+
+//--------------------------------------------------------------------------------------
+// Finds information about a resource using the index
+//--------------------------------------------------------------------------------------
+bool CPackedFile::GetPackedFileInfo( WCHAR* szFile, UINT* pDataBytes )
+{
+    // Look the file up in the index
+    INT64 iFoundIndex = FindFile( szFile );
     if( -1 == iFoundIndex )
         return false;
 
@@ -638,39 +1382,189 @@ bool CPackedFile::GetPackedFile( char* szFile, BYTE** ppData, UINT* pDataBytes )
 //--------------------------------------------------------------------------------------
 // Finds the location of a resource in a packed file and returns its contents in
 // *ppData.
+//
+// If the file is compressed it is decompressed here, on the calling thread, and the
+// decoded copy is kept with the chunk until the chunk is unmapped.  Large files should
+// use GetPackedFileStored instead and decompress on a processing thread.
+//
+// The chunk holding the file is pinned so the readahead thread can't unmap it while the
+// caller still uses *ppData.  Every successful call must be matched by ReleasePackedFile.
 //--------------------------------------------------------------------------------------
 bool CPackedFile::GetPackedFile( WCHAR* szFile, BYTE** ppData, UINT* pDataBytes )
 {
     // Look the file up in the index
-    int iFoundIndex = -1;
-    for( UINT i = 0; i < m_FileHeader.NumFiles; i++ )
+    INT64 iFoundIndex = FindFile( szFile );
+    if( -1 == iFoundIndex )
+        return false;
+
+    FILE_INDEX* pIndex = &m_pFileIndices[iFoundIndex];
+    *pDataBytes = ( UINT )pIndex->FileSize;
+
+    // Memory mapped io
+    BYTE* pChunkData = ( BYTE* )AcquireChunk( pIndex->ChunkIndex, true );
+    if( !pChunkData )
+        return false;
+    *ppData = pChunkData + pIndex->OffsetIntoChunk;
+
+    if( pIndex->StoredSize == pIndex->FileSize )
+        return true;
+
+    // Decode under the lock so two callers don't both decode the same file
+    bool bRet = false;
+    EnterCriticalSection( &m_csMapping );
+
+    MAPPED_CHUNK* pChunk = &m_pMappedChunks[pIndex->ChunkIndex];
+    DECODED_FILE* pDecoded = pChunk->pDecodedFiles;
+    while( pDecoded && pDecoded->iFile != ( UINT64 )iFoundIndex )
+        pDecoded = pDecoded->pNext;
+
+    if( !pDecoded && pChunk->bInUse )
     {
-        if( 0 == wcscmp( szFile, m_pFileIndices[i].szFileName ) )
+        pDecoded = new DECODED_FILE;
+        if( pDecoded )
         {
-            iFoundIndex = i;
-            break;
+            pDecoded->iFile = ( UINT64 )iFoundIndex;
+            pDecoded->pData = new BYTE[ ( SIZE_T )pIndex->FileSize ];
+            if( !pDecoded->pData ||
+                FAILED( DecompressPackedData( ( BYTE* )pChunk->pMappingPointer + pIndex->OffsetIntoChunk,
+                                              ( SIZE_T )pIndex->StoredSize, pDecoded->pData,
+                                              ( SIZE_T )pIndex->FileSize ) ) )
+            {
+                SAFE_DELETE_ARRAY( pDecoded->pData );
+                SAFE_DELETE( pDecoded );
+            }
+            else
+            {
+                pDecoded->pNext = pChunk->pDecodedFiles;
+                pChunk->pDecodedFiles = pDecoded;
+            }
         }
     }
 
+    if( pDecoded )
+    {
+        *ppData = pDecoded->pData;
+        bRet = true;
+    }
+
+    LeaveCriticalSection( &m_csMapping );
+
+    if( !bRet )
+        UnpinChunk( pIndex->ChunkIndex );
+    return bRet;
+}
+
+//--------------------------------------------------------------------------------------
+// Returns the bytes of a resource as they are stored in the packed file, without
+// decompressing them.  *pStoredBytes == *pDataBytes means the file is stored as is.
+// Otherwise the caller decompresses it with DecompressPackedData.  As with
+// GetPackedFile, the chunk stays pinned until ReleasePackedFile.
+//--------------------------------------------------------------------------------------
+bool CPackedFile::GetPackedFileStored( WCHAR* szFile, BYTE** ppStored, UINT* pStoredBytes, UINT* pDataBytes )
+{
+    // Look the file up in the index
+    INT64 iFoundIndex = FindFile( szFile );
     if( -1 == iFoundIndex )
         return false;
 
     *pDataBytes = ( UINT )m_pFileIndices[iFoundIndex].FileSize;
+    *pStoredBytes = ( UINT )m_pFileIndices[iFoundIndex].StoredSize;
 
     // Memory mapped io
-    EnsureChunkMapped( m_pFileIndices[iFoundIndex].ChunkIndex );
-    *ppData = ( BYTE* )m_pMappedChunks[ m_pFileIndices[iFoundIndex].ChunkIndex ].pMappingPointer +
-        m_pFileIndices[iFoundIndex].OffsetIntoChunk;
+    BYTE* pChunkData = ( BYTE* )AcquireChunk( m_pFileIndices[iFoundIndex].ChunkIndex, true );
+    if( !pChunkData )
+        return false;
+    *ppStored = pChunkData + m_pFileIndices[iFoundIndex].OffsetIntoChunk;
 
     return true;
 }
 
+//--------------------------------------------------------------------------------------
+// Unpins the chunk that GetPackedFile or GetPackedFileStored pinned for this file.  The
+// pointer they returned must not be used afterwards.
+//--------------------------------------------------------------------------------------
+void CPackedFile::ReleasePackedFile( WCHAR* szFile )
+{
+    if( !m_pMappedChunks )
+        return;
+
+    INT64 iFoundIndex = FindFile( szFile );
+    if( -1 == iFoundIndex )
+        return;
+
+    UnpinChunk( m_pFileIndices[iFoundIndex].ChunkIndex );
+}
+
+//--------------------------------------------------------------------------------------
+// Reads every file in the packed file once, decompressing it if needed, and reports
+// how long it took.  Used to compare the compressed and uncompressed formats.  Chunks
+// are mapped and unmapped as usual, so the first run also includes the disk reads.
+//--------------------------------------------------------------------------------------
+bool CPackedFile::MeasureLoadThroughput( double* pfSeconds, UINT64* pStoredBytes, UINT64* pDataBytes )
+{
+    if( !m_pMappedChunks )
+        return false;
+
+    BYTE* pScratch = NULL;
+    UINT64 ScratchSize = 0;
+    bool bRet = false;
+
+    *pStoredBytes = 0;
+    *pDataBytes = 0;
+
+    LARGE_INTEGER liFreq, liStart, liEnd;
+    QueryPerformanceFrequency( &liFreq );
+    QueryPerformanceCounter( &liStart );
+
+    for( UINT64 i = 0; i < m_FileHeader.NumFiles; i++ )
+    {
+        FILE_INDEX* pIndex = &m_pFileIndices[i];
+        if( ScratchSize < pIndex->FileSize )
+        {
+            SAFE_DELETE_ARRAY( pScratch );
+            ScratchSize = pIndex->FileSize;
+            pScratch = new BYTE[ ( SIZE_T )ScratchSize ];
+            if( !pScratch )
+                goto Error;
+        }
+
+        // Pinned so the readahead thread can't unmap it while we decompress
+        BYTE* pChunkData = ( BYTE* )AcquireChunk( pIndex->ChunkIndex, true );
+        if( !pChunkData )
+            goto Error;
+
+        // Copying the uncompressed files touches the same pages the loaders would
+        HRESULT hr = DecompressPackedData( pChunkData + pIndex->OffsetIntoChunk, ( SIZE_T )pIndex->StoredSize,
+                                           pScratch, ( SIZE_T )pIndex->FileSize );
+        UnpinChunk( pIndex->ChunkIndex );
+        if( FAILED( hr ) )
+            goto Error;
+
+        *pStoredBytes += pIndex->StoredSize;
+        *pDataBytes += pIndex->FileSize;
+    }
+
+    QueryPerformanceCounter( &liEnd );
+    *pfSeconds = ( double )( liEnd.QuadPart - liStart.QuadPart ) / ( double )liFreq.QuadPart;
+
+    bRet = true;
+Error:
+    SAFE_DELETE_ARRAY( pScratch );
+    return bRet;
+}
+
 //--------------------------------------------------------------------------------------
 bool CPackedFile::UsingMemoryMappedIO()
 {
     return ( NULL != m_pMappedChunks );
 }
 
+//--------------------------------------------------------------------------------------
+bool CPackedFile::IsCompressed()
+{
+    return ( PACKED_FILE_COMPRESSION_NONE != m_FileHeader.Compression );
+}
+
 //--------------------------------------------------------------------------------------
 void CPackedFile::SetMaxChunksMapped( UINT maxmapped )
 {
@@ -718,3 +1612,9 @@ UINT64 CPackedFile::GetVideoMemoryUsageAtFullMips()
 {
     return m_FileHeader.VideoMemoryUsageAtFullMips;
 }
+
+//--------------------------------------------------------------------------------------
+UINT CPackedFile::GetNumReadaheadMapped()
+{
+    return m_NumReadaheadMapped;
+}
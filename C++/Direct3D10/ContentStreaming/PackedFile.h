@@ -15,33 +15,73 @@
 //--------------------------------------------------------------------------------------
 // Packed file structures
 //--------------------------------------------------------------------------------------
+#define PACKED_FILE_MAGIC   0x4B504443  // 'CDPK'
+#define PACKED_FILE_VERSION 3
+
+enum PACKED_FILE_COMPRESSION
+{
+    PACKED_FILE_COMPRESSION_NONE = 0,
+    PACKED_FILE_COMPRESSION_XPRESS,     // Windows XPRESS (LZ77) through the Compression API in cabinet.dll
+};
+
 struct PACKED_FILE_HEADER
 {
+    UINT Magic;
+    UINT Version;
     UINT64 FileSize;
     UINT64 NumFiles;
     UINT64 NumChunks;
     UINT64 Granularity;
     UINT MaxChunksInVA;
+    UINT Compression;           // PACKED_FILE_COMPRESSION
 
     UINT64 TileBytesSize;
     float TileSideSize;
     float LoadingRadius;
     UINT64 VideoMemoryUsageAtFullMips;
+
+    // Layout of the index block (byte offsets from the start of the file).  The whole
+    // index block is mapped with a single view, so nothing here is copied at load time.
+    UINT64 IndexSize;
+    UINT64 ChunkTableOffset;
+    UINT64 FileTableOffset;
+    UINT64 StringTableOffset;
+    UINT64 StringTableSize;
+    UINT64 HashTableOffset;
+    UINT64 NumHashBuckets;
 };
 
 struct CHUNK_HEADER
 {
     UINT64 ChunkOffset;
-    UINT64 ChunkSize;
+    UINT64 ChunkSize;           // bytes stored on disk
+    UINT64 UncompressedSize;    // sum of the FileSize of the files in the chunk
 };
 
 struct FILE_INDEX
 {
-    WCHAR szFileName[MAX_PATH];
-    UINT64 FileSize;
+    UINT64 FileSize;            // uncompressed size
+    UINT64 StoredSize;          // size on disk.  Equal to FileSize when not compressed.
     UINT64 ChunkIndex;
-    UINT64 OffsetIntoChunk;
+    UINT64 OffsetIntoChunk;     // offset of the stored bytes
     D3DXVECTOR3 vCenter;
+    UINT NameOffset;    // offset in WCHARs into the string table
+    UINT NameHash;      // HashFileName() of the name, checked before the string compare
+};
+
+// Each hash bucket holds (file index + 1), or zero for an empty bucket
+#define PACKED_FILE_EMPTY_BUCKET 0
+
+struct ASYNC_REQUEST_STATUS;
+
+// Async requests issued for each level item
+enum ITEM_REQUEST
+{
+    ITEM_REQUEST_VB = 0,
+    ITEM_REQUEST_IB,
+    ITEM_REQUEST_DIFFUSE,
+    ITEM_REQUEST_NORMAL,
+    NUM_ITEM_REQUESTS
 };
 
 struct LEVEL_ITEM
@@ -63,15 +103,40 @@ struct LEVEL_ITEM
     int CurrentCountdownNorm;
     bool bHasBeenRenderedDiffuse;
     bool bHasBeenRenderedNormal;
+    ASYNC_REQUEST_STATUS* pRequests[NUM_ITEM_REQUESTS];  // outstanding async requests, NULL once released
+    bool bCancelling;           // left the loading radius while requests were still in flight
+};
+
+struct DECODED_FILE
+{
+    UINT64 iFile;
+    BYTE* pData;
+    DECODED_FILE* pNext;
 };
 
 struct MAPPED_CHUNK
 {
     void* pMappingPointer;
-    UINT UseCounter;
+    DECODED_FILE* pDecodedFiles;    // files decompressed by GetPackedFile, freed with the mapping
+    MAPPED_CHUNK* pLRUPrev;     // toward the most recently used chunk
+    MAPPED_CHUNK* pLRUNext;     // toward the least recently used chunk
+    D3DXVECTOR3 vCenter;        // center of the files in this chunk, used for readahead
+    LONG PinCount;              // pinned chunks are not evicted
     bool bInUse;
 };
 
+// Chunks within the loading radius plus this many tiles are mapped ahead of time
+#define READAHEAD_TILES 1.5f
+
+// The chunk grid is never more than this many cells along a side
+#define MAX_CHUNK_GRID_CELLS_PER_SIDE 1024
+
+struct READAHEAD_CANDIDATE
+{
+    UINT64 iChunk;
+    float fDist2;
+};
+
 struct BOX_VERTEX
 {
     D3DXVECTOR3 pos;
@@ -89,28 +154,76 @@ private:
     PACKED_FILE_HEADER m_FileHeader;
     FILE_INDEX* m_pFileIndices;
     CHUNK_HEADER* m_pChunks;
+    WCHAR* m_pStringTable;
+    UINT* m_pHashTable;
     MAPPED_CHUNK* m_pMappedChunks;
+    MAPPED_CHUNK* m_pLRUHead;
+    MAPPED_CHUNK* m_pLRUTail;
+    void* m_pIndexView;
 
     HANDLE m_hFile;
     HANDLE m_hFileMapping;
     UINT m_ChunksMapped;
     UINT m_MaxChunksMapped;
-    UINT m_CurrentUseCounter;
+    CRITICAL_SECTION m_csMapping;
+
+    // Uniform grid over the chunk centers on the XZ plane.  It is built when the file is
+    // loaded and never changes, so it is read without taking m_csMapping.
+    float m_fChunkGridMinX;
+    float m_fChunkGridMinZ;
+    float m_fChunkGridInvCellSize;
+    int m_ChunkGridCellsX;
+    int m_ChunkGridCellsZ;
+    UINT* m_pChunkGridStart;    // m_ChunkGridCellsX * m_ChunkGridCellsZ + 1 offsets into m_pChunkGridChunks
+    UINT* m_pChunkGridChunks;   // chunk indices sorted by cell
+
+    // Readahead thread
+    HANDLE m_hReadaheadThread;
+    HANDLE m_hReadaheadEvent;
+    BOOL m_bReadaheadDone;
+    CRITICAL_SECTION m_csReadahead;     // guards m_vReadaheadEye and m_fReadaheadRadius
+    D3DXVECTOR3 m_vReadaheadEye;
+    float m_fReadaheadRadius;
+    UINT m_NumReadaheadMapped;
+
+private:
+    INT64   FindFile( WCHAR* szFile );
+    WCHAR*  GetFileName( UINT64 iFile );
+    void    LRURemove( MAPPED_CHUNK* pChunk );
+    void    LRUPushFront( MAPPED_CHUNK* pChunk );
+    bool    EvictLRUChunk( float fKeepRadius, const D3DXVECTOR3* pvEye );
+    void    FreeDecodedFiles( MAPPED_CHUNK* pChunk );
+    void*   AcquireChunk( UINT64 iChunk, bool bPin );
+    void    UnpinChunk( UINT64 iChunk );
+    bool    BuildChunkGrid();
+    void    GetChunksInRadius( const D3DXVECTOR3& vEye, float fRadius,
+                               CGrowableArray <READAHEAD_CANDIDATE>* pCandidates );
+    bool    InitReadahead();
+    void    DestroyReadahead();
+    unsigned int ReadaheadThreadProc();
 
 public:
+    friend unsigned int WINAPI _ReadaheadThreadProc( LPVOID lpParameter );
+
             CPackedFile();
             ~CPackedFile();
 
     bool    CreatePackedFile( ID3D10Device* pDev10, IDirect3DDevice9* pDev9, WCHAR* szFileName, UINT SqrtNumTiles,
-                              UINT SidesPerTile, float fWorldScale, float fHeightScale );
+                              UINT SidesPerTile, float fWorldScale, float fHeightScale, bool bCompress=false );
     bool    LoadPackedFile( WCHAR* szFileName, bool b64Bit, CGrowableArray <LEVEL_ITEM*>* pLevelItemArray );
+    static bool IsPackedFileCurrent( WCHAR* szFileName );
     void    UnloadPackedFile();
     void    EnsureChunkMapped( UINT64 iChunk );
+    void    RequestReadahead( const D3DXVECTOR3* pvEye, float fLoadingRadius );
     bool    GetPackedFileInfo( char* szFile, UINT* pDataBytes );
     bool    GetPackedFileInfo( WCHAR* szFile, UINT* pDataBytes );
     bool    GetPackedFile( char* szFile, BYTE** ppData, UINT* pDataBytes );
     bool    GetPackedFile( WCHAR* szFile, BYTE** ppData, UINT* pDataBytes );
+    bool    GetPackedFileStored( WCHAR* szFile, BYTE** ppStored, UINT* pStoredBytes, UINT* pDataBytes );
+    void    ReleasePackedFile( WCHAR* szFile );
     bool    UsingMemoryMappedIO();
+    bool    IsCompressed();
+    bool    MeasureLoadThroughput( double* pfSeconds, UINT64* pStoredBytes, UINT64* pDataBytes );
 
     void    SetMaxChunksMapped( UINT maxmapped );
     UINT64  GetTileBytesSize();
@@ -120,6 +233,19 @@ public:
     UINT    GetMaxChunksInVA();
     UINT64  GetNumChunks();
     UINT64  GetVideoMemoryUsageAtFullMips();
+    UINT    GetNumReadaheadMapped();
 };
 
+//--------------------------------------------------------------------------------------
+// Hash used for the packed file name index
+//--------------------------------------------------------------------------------------
+UINT HashFileName( const WCHAR* szFile );
+
+//--------------------------------------------------------------------------------------
+// Packed file compression.  The Compression API is loaded from cabinet.dll at runtime
+// since it is only present on Windows 8 and later.
+//--------------------------------------------------------------------------------------
+bool IsPackedFileCompressionAvailable();
+HRESULT DecompressPackedData( const BYTE* pStored, SIZE_T cStored, BYTE* pData, SIZE_T cData );
+
 #endif
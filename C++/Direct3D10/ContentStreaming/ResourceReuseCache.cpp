@@ -14,34 +14,321 @@
 //--------------------------------------------------------------------------------------
 #define ISBITMASK( r,g,b,a ) ( ddpf.dwRBitMask == r && ddpf.dwGBitMask == g && ddpf.dwBBitMask == b && ddpf.dwABitMask == a )
 
+// Initial size of the CReuseIndex hash tables.  Must be a power of two.
+#define REUSE_INITIAL_BUCKETS 64
+
 //--------------------------------------------------------------------------------------
-// Texture functions
+// CReuseIndex
+//--------------------------------------------------------------------------------------
+CReuseIndex::CReuseIndex() : m_ppObjectBuckets( NULL ),
+                             m_NumObjectBuckets( 0 ),
+                             m_ppClassBuckets( NULL ),
+                             m_NumClassBuckets( 0 ),
+                             m_NumClasses( 0 ),
+                             m_pLRUHead( NULL ),
+                             m_pLRUTail( NULL ),
+                             m_NumFree( 0 )
+{
+}
+
+//--------------------------------------------------------------------------------------
+CReuseIndex::~CReuseIndex()
+{
+    RemoveAll();
+    SAFE_DELETE_ARRAY( m_ppObjectBuckets );
+    SAFE_DELETE_ARRAY( m_ppClassBuckets );
+}
+
+//--------------------------------------------------------------------------------------
+UINT CReuseIndex::HashObject( void* pObject )
+{
+    UINT_PTR Key = ( UINT_PTR )pObject;
+    return ( UINT )( ( Key >> 3 ) * 2654435761u );
+}
+
+//--------------------------------------------------------------------------------------
+// FNV-1a over the size class
 //--------------------------------------------------------------------------------------
-int CResourceReuseCache::FindTexture( ID3D10ShaderResourceView* pRV10 )
+UINT CReuseIndex::HashKey( const UINT* Key )
 {
-    for( int i = 0; i < m_TextureList.GetSize(); i++ )
+    UINT Hash = 2166136261u;
+    for( UINT i = 0; i < REUSE_KEY_SIZE; i++ )
     {
-        DEVICE_TEXTURE* texTest = m_TextureList.GetAt( i );
-        if( texTest->pRV10 == pRV10 )
-            return i;
+        Hash ^= Key[i];
+        Hash *= 16777619u;
     }
+    return Hash;
+}
+
+//--------------------------------------------------------------------------------------
+void CReuseIndex::GrowObjectBuckets()
+{
+    UINT NumBuckets = max( m_NumObjectBuckets * 2, ( UINT )REUSE_INITIAL_BUCKETS );
+    REUSE_ENTRY** ppBuckets = new REUSE_ENTRY*[NumBuckets];
+    if( !ppBuckets )
+        return;
+    ZeroMemory( ppBuckets, NumBuckets * sizeof( REUSE_ENTRY* ) );
+
+    for( int i = 0; i < m_Entries.GetSize(); i++ )
+    {
+        REUSE_ENTRY* pEntry = m_Entries.GetAt( i );
+        UINT iBucket = HashObject( pEntry->pObject ) & ( NumBuckets - 1 );
+        pEntry->pHashNext = ppBuckets[iBucket];
+        ppBuckets[iBucket] = pEntry;
+    }
+
+    SAFE_DELETE_ARRAY( m_ppObjectBuckets );
+    m_ppObjectBuckets = ppBuckets;
+    m_NumObjectBuckets = NumBuckets;
+}
+
+//--------------------------------------------------------------------------------------
+void CReuseIndex::GrowClassBuckets()
+{
+    UINT NumBuckets = max( m_NumClassBuckets * 2, ( UINT )REUSE_INITIAL_BUCKETS );
+    REUSE_CLASS** ppBuckets = new REUSE_CLASS*[NumBuckets];
+    if( !ppBuckets )
+        return;
+    ZeroMemory( ppBuckets, NumBuckets * sizeof( REUSE_CLASS* ) );
+
+    for( UINT i = 0; i < m_NumClassBuckets; i++ )
+    {
+        REUSE_CLASS* pClass = m_ppClassBuckets[i];
+        while( pClass )
+        {
+            REUSE_CLASS* pNext = pClass->pHashNext;
+            UINT iBucket = HashKey( pClass->Key ) & ( NumBuckets - 1 );
+            pClass->pHashNext = ppBuckets[iBucket];
+            ppBuckets[iBucket] = pClass;
+            pClass = pNext;
+        }
+    }
+
+    SAFE_DELETE_ARRAY( m_ppClassBuckets );
+    m_ppClassBuckets = ppBuckets;
+    m_NumClassBuckets = NumBuckets;
+}
+
+//--------------------------------------------------------------------------------------
+REUSE_CLASS* CReuseIndex::FindClass( const UINT* Key, bool bCreate )
+{
+    if( m_NumClassBuckets )
+    {
+        REUSE_CLASS* pClass = m_ppClassBuckets[ HashKey( Key ) & ( m_NumClassBuckets - 1 ) ];
+        while( pClass )
+        {
+            if( 0 == memcmp( pClass->Key, Key, sizeof( pClass->Key ) ) )
+                return pClass;
+            pClass = pClass->pHashNext;
+        }
+    }
+
+    if( !bCreate )
+        return NULL;
+
+    if( m_NumClasses >= m_NumClassBuckets )
+        GrowClassBuckets();
+    if( !m_ppClassBuckets )
+        return NULL;
+
+    REUSE_CLASS* pClass = new REUSE_CLASS;
+    if( !pClass )
+        return NULL;
+    memcpy( pClass->Key, Key, sizeof( pClass->Key ) );
+    pClass->pFreeHead = NULL;
+
+    UINT iBucket = HashKey( Key ) & ( m_NumClassBuckets - 1 );
+    pClass->pHashNext = m_ppClassBuckets[iBucket];
+    m_ppClassBuckets[iBucket] = pClass;
+    m_NumClasses ++;
+
+    return pClass;
+}
+
+//--------------------------------------------------------------------------------------
+// Takes a free entry off its size class list and the LRU list
+//--------------------------------------------------------------------------------------
+void CReuseIndex::Unlink( REUSE_ENTRY* pEntry )
+{
+    if( pEntry->pClassPrev )
+        pEntry->pClassPrev->pClassNext = pEntry->pClassNext;
+    else
+        pEntry->pClass->pFreeHead = pEntry->pClassNext;
+    if( pEntry->pClassNext )
+        pEntry->pClassNext->pClassPrev = pEntry->pClassPrev;
+
+    if( pEntry->pLRUPrev )
+        pEntry->pLRUPrev->pLRUNext = pEntry->pLRUNext;
+    else
+        m_pLRUHead = pEntry->pLRUNext;
+    if( pEntry->pLRUNext )
+        pEntry->pLRUNext->pLRUPrev = pEntry->pLRUPrev;
+    else
+        m_pLRUTail = pEntry->pLRUPrev;
+
+    pEntry->pClassPrev = pEntry->pClassNext = NULL;
+    pEntry->pLRUPrev = pEntry->pLRUNext = NULL;
+    pEntry->bFree = FALSE;
+    m_NumFree --;
+}
+
+//--------------------------------------------------------------------------------------
+// Adds a newly created entry.  Key, pObject and pOwner must be filled in.  New entries
+// start out in use.
+//--------------------------------------------------------------------------------------
+bool CReuseIndex::Insert( REUSE_ENTRY* pEntry )
+{
+    if( m_Entries.GetSize() >= ( int )m_NumObjectBuckets )
+        GrowObjectBuckets();
+    if( !m_ppObjectBuckets )
+        return false;
+
+    pEntry->pClass = FindClass( pEntry->Key, true );
+    if( !pEntry->pClass )
+        return false;
+    if( FAILED( m_Entries.Add( pEntry ) ) )
+        return false;
+
+    pEntry->iIndex = m_Entries.GetSize() - 1;
+    pEntry->bFree = FALSE;
+    pEntry->pClassPrev = pEntry->pClassNext = NULL;
+    pEntry->pLRUPrev = pEntry->pLRUNext = NULL;
+
+    UINT iBucket = HashObject( pEntry->pObject ) & ( m_NumObjectBuckets - 1 );
+    pEntry->pHashNext = m_ppObjectBuckets[iBucket];
+    m_ppObjectBuckets[iBucket] = pEntry;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Forgets an entry that is about to be destroyed
+//--------------------------------------------------------------------------------------
+void CReuseIndex::Remove( REUSE_ENTRY* pEntry )
+{
+    if( pEntry->bFree )
+        Unlink( pEntry );
+
+    REUSE_ENTRY** ppLink = &m_ppObjectBuckets[ HashObject( pEntry->pObject ) & ( m_NumObjectBuckets - 1 ) ];
+    while( *ppLink != pEntry )
+        ppLink = &( *ppLink )->pHashNext;
+    *ppLink = pEntry->pHashNext;
+
+    // Move the last entry into the hole
+    int iLast = m_Entries.GetSize() - 1;
+    REUSE_ENTRY* pLast = m_Entries.GetAt( iLast );
+    m_Entries.SetAt( pEntry->iIndex, pLast );
+    pLast->iIndex = pEntry->iIndex;
+    m_Entries.Remove( iLast );
+}
+
+//--------------------------------------------------------------------------------------
+REUSE_ENTRY* CReuseIndex::Find( void* pObject )
+{
+    if( !pObject || !m_ppObjectBuckets )
+        return NULL;
 
-    return -1;
+    REUSE_ENTRY* pEntry = m_ppObjectBuckets[ HashObject( pObject ) & ( m_NumObjectBuckets - 1 ) ];
+    while( pEntry && pEntry->pObject != pObject )
+        pEntry = pEntry->pHashNext;
+
+    return pEntry;
 }
 
 //--------------------------------------------------------------------------------------
-int CResourceReuseCache::FindTexture( IDirect3DTexture9* pTex9 )
+// Returns the most recently freed entry of the size class, marked in use, or NULL
+//--------------------------------------------------------------------------------------
+REUSE_ENTRY* CReuseIndex::AcquireFree( const UINT* Key )
 {
-    for( int i = 0; i < m_TextureList.GetSize(); i++ )
+    REUSE_CLASS* pClass = FindClass( Key, false );
+    if( !pClass || !pClass->pFreeHead )
+        return NULL;
+
+    REUSE_ENTRY* pEntry = pClass->pFreeHead;
+    Unlink( pEntry );
+    return pEntry;
+}
+
+//--------------------------------------------------------------------------------------
+// Puts an entry that is no longer used at the head of its class list and the LRU list
+//--------------------------------------------------------------------------------------
+void CReuseIndex::Release( REUSE_ENTRY* pEntry )
+{
+    if( pEntry->bFree )
+        return;
+
+    pEntry->pClassPrev = NULL;
+    pEntry->pClassNext = pEntry->pClass->pFreeHead;
+    if( pEntry->pClassNext )
+        pEntry->pClassNext->pClassPrev = pEntry;
+    pEntry->pClass->pFreeHead = pEntry;
+
+    pEntry->pLRUPrev = NULL;
+    pEntry->pLRUNext = m_pLRUHead;
+    if( m_pLRUHead )
+        m_pLRUHead->pLRUPrev = pEntry;
+    else
+        m_pLRUTail = pEntry;
+    m_pLRUHead = pEntry;
+
+    pEntry->bFree = TRUE;
+    m_NumFree ++;
+}
+
+//--------------------------------------------------------------------------------------
+// The free entry that has gone unused the longest, or NULL if everything is in use
+//--------------------------------------------------------------------------------------
+REUSE_ENTRY* CReuseIndex::GetLRU()
+{
+    return m_pLRUTail;
+}
+
+//--------------------------------------------------------------------------------------
+// Forgets every entry.  The entries themselves belong to the caller.
+//--------------------------------------------------------------------------------------
+void CReuseIndex::RemoveAll()
+{
+    m_Entries.RemoveAll();
+    if( m_ppObjectBuckets )
+        ZeroMemory( m_ppObjectBuckets, m_NumObjectBuckets * sizeof( REUSE_ENTRY* ) );
+
+    for( UINT i = 0; i < m_NumClassBuckets; i++ )
     {
-        DEVICE_TEXTURE* texTest = m_TextureList.GetAt( i );
-        if( texTest->pTexture9 == pTex9 )
-            return i;
+        REUSE_CLASS* pClass = m_ppClassBuckets[i];
+        while( pClass )
+        {
+            REUSE_CLASS* pNext = pClass->pHashNext;
+            delete pClass;
+            pClass = pNext;
+        }
+        m_ppClassBuckets[i] = NULL;
     }
 
-    return -1;
+    m_NumClasses = 0;
+    m_pLRUHead = NULL;
+    m_pLRUTail = NULL;
+    m_NumFree = 0;
 }
 
+//--------------------------------------------------------------------------------------
+int CReuseIndex::GetSize()
+{
+    return m_Entries.GetSize();
+}
+
+//--------------------------------------------------------------------------------------
+int CReuseIndex::GetNumFree()
+{
+    return m_NumFree;
+}
+
+//--------------------------------------------------------------------------------------
+REUSE_ENTRY* CReuseIndex::GetAt( int i )
+{
+    return m_Entries.GetAt( i );
+}
+
+
 //--------------------------------------------------------------------------------------
 DXGI_FORMAT ConvertToDXGI_FORMAT( D3DFORMAT d3dformat )
 {
@@ -146,24 +433,20 @@ D3DFORMAT ConvertToD3DFORMAT( DXGI_FORMAT dxgiformat )
 }
 
 //--------------------------------------------------------------------------------------
-int CResourceReuseCache::EnsureFreeTexture( UINT Width, UINT Height, UINT MipLevels, UINT Format )
+DEVICE_TEXTURE* CResourceReuseCache::EnsureFreeTexture( UINT Width, UINT Height, UINT MipLevels, UINT Format )
 {
-    // see if we have a free one available
-    for( int i = 0; i < m_TextureList.GetSize(); i++ )
+    m_Stats.NumRequests ++;
+
+    // see if we have a free one of the same size class available
+    UINT Key[REUSE_KEY_SIZE] = { Width, Height, MipLevels, Format };
+    REUSE_ENTRY* pEntry = m_TextureList.AcquireFree( Key );
+    if( pEntry )
     {
-        DEVICE_TEXTURE* texTest = m_TextureList.GetAt( i );
-        if( !texTest->bInUse )
-        {
-            if( texTest->Width == Width &&
-                texTest->Height == Height &&
-                texTest->MipLevels == MipLevels &&
-                texTest->Format == Format )
-            {
-                // Found one that matches all criteria
-                texTest->bInUse = TRUE;
-                return i;
-            }
-        }
+        DEVICE_TEXTURE* texFree = ( DEVICE_TEXTURE* )pEntry->pOwner;
+        texFree->bInUse = TRUE;
+        m_Stats.NumHits ++;
+        m_Stats.BytesRecycled += texFree->EstimatedSize;
+        return texFree;
     }
 
     // haven't found a free one
@@ -183,7 +466,9 @@ int CResourceReuseCache::EnsureFreeTexture( UINT Width, UINT Height, UINT MipLev
         tex->Format = Format;
         tex->EstimatedSize = newSize;
         tex->pTexture9 = NULL;
-        tex->RecentUseCounter = 0;
+#if defined(USE_D3D10_STAGING_RESOURCES)
+        tex->pStaging10 = NULL;
+#endif
 
         if( !m_bSilent )
             OutputDebugString( L"RESOURCE WARNING: Device needs to create new Texture\n" );
@@ -246,18 +531,27 @@ int CResourceReuseCache::EnsureFreeTexture( UINT Width, UINT Height, UINT MipLev
             SAFE_DELETE( tex );
             if( !m_bSilent )
                 OutputDebugString( L"RESOURCE ERROR: Cannot Load Texture!\n" );
-            return -1;
+            return NULL;
+        }
+
+        memcpy( tex->Entry.Key, Key, sizeof( Key ) );
+        tex->Entry.pObject = ( LDT_D3D10 == m_Device.Type ) ? ( void* )tex->pRV10 : ( void* )tex->pTexture9;
+        tex->Entry.pOwner = tex;
+        if( !m_TextureList.Insert( &tex->Entry ) )
+        {
+            if( LDT_D3D9 == m_Device.Type )
+                DestroyTexture9( tex );
+            else
+                DestroyTexture10( tex );
+            return NULL;
         }
 
         m_UsedManagedMemory += tex->EstimatedSize;
         tex->bInUse = TRUE;
-
-        int index = m_TextureList.GetSize();
-        m_TextureList.Add( tex );
-        return index;
+        return tex;
     }
 
-    return -1;
+    return NULL;
 }
 
 //--------------------------------------------------------------------------------------
@@ -482,57 +776,20 @@ UINT64 CResourceReuseCache::GetEstimatedSize( UINT Width, UINT Height, UINT MipL
 //--------------------------------------------------------------------------------------
 // Vertex Buffer functions
 //--------------------------------------------------------------------------------------
-int CResourceReuseCache::FindVB( ID3D10Buffer* pVB )
-{
-    for( int i = 0; i < m_VBList.GetSize(); i++ )
-    {
-        DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( i );
-        if( vb->pVB10 == pVB )
-            return i;
-    }
-
-    return -1;
-}
-
-//--------------------------------------------------------------------------------------
-int CResourceReuseCache::FindVB( IDirect3DVertexBuffer9* pVB )
-{
-    for( int i = 0; i < m_VBList.GetSize(); i++ )
-    {
-        DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( i );
-        if( vb->pVB9 == pVB )
-            return i;
-    }
-
-    return -1;
-}
-
-//--------------------------------------------------------------------------------------
-int CResourceReuseCache::EnsureFreeVB( UINT iSizeBytes )
+DEVICE_VERTEX_BUFFER* CResourceReuseCache::EnsureFreeVB( UINT iSizeBytes )
 {
-    // Find the closest match
-    int closestindex = -1;
-    UINT smallestSize = UINT_MAX;
-    for( int i = 0; i < m_VBList.GetSize(); i++ )
-    {
-        DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( i );
-        if( !vb->bInUse )
-        {
-            if( vb->iSizeBytes == iSizeBytes )
-            {
-                smallestSize = vb->iSizeBytes;
-                closestindex = i;
-                break;
-            }
-        }
-    }
+    m_Stats.NumRequests ++;
 
-    // if we found a closest match, return it
-    if( -1 != closestindex )
+    // see if we have a free one of the same size available
+    UINT Key[REUSE_KEY_SIZE] = { iSizeBytes, 0, 0, 0 };
+    REUSE_ENTRY* pEntry = m_VBList.AcquireFree( Key );
+    if( pEntry )
     {
-        DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( closestindex );
-        vb->bInUse = TRUE;
-        return closestindex;
+        DEVICE_VERTEX_BUFFER* vbFree = ( DEVICE_VERTEX_BUFFER* )pEntry->pOwner;
+        vbFree->bInUse = TRUE;
+        m_Stats.NumHits ++;
+        m_Stats.BytesRecycled += vbFree->iSizeBytes;
+        return vbFree;
     }
 
     // haven't found a free one
@@ -549,7 +806,6 @@ int CResourceReuseCache::EnsureFreeVB( UINT iSizeBytes )
         vb->iSizeBytes = iSizeBytes;
         vb->pVB10 = NULL;
         vb->pVB9 = NULL;
-        vb->RecentUseCounter = 0;
 
         if( !m_bSilent )
             OutputDebugString( L"RESOURCE WARNING: Device needs to create new Vertex Buffer\n" );
@@ -579,75 +835,47 @@ int CResourceReuseCache::EnsureFreeVB( UINT iSizeBytes )
             SAFE_DELETE( vb );
             if( !m_bSilent )
                 OutputDebugString( L"RESOURCE ERROR: Cannot Load Vertex Buffer!\n" );
-            return -1;
+            return NULL;
+        }
+
+        memcpy( vb->Entry.Key, Key, sizeof( Key ) );
+        vb->Entry.pObject = ( LDT_D3D10 == m_Device.Type ) ? ( void* )vb->pVB10 : ( void* )vb->pVB9;
+        vb->Entry.pOwner = vb;
+        if( !m_VBList.Insert( &vb->Entry ) )
+        {
+            if( LDT_D3D9 == m_Device.Type )
+                DestroyVB9( vb );
+            else
+                DestroyVB10( vb );
+            return NULL;
         }
 
         m_UsedManagedMemory += vb->iSizeBytes;
         vb->bInUse = TRUE;
-        int index = m_VBList.GetSize();
-        m_VBList.Add( vb );
-        return index;
+        return vb;
     }
 
-    return -1;
+    return NULL;
 }
 
 //--------------------------------------------------------------------------------------
 // Index Buffer
 //--------------------------------------------------------------------------------------
-int CResourceReuseCache::FindIB( ID3D10Buffer* pIB )
+DEVICE_INDEX_BUFFER* CResourceReuseCache::EnsureFreeIB( UINT iSizeBytes, UINT ibFormat )
 {
-    for( int i = 0; i < m_IBList.GetSize(); i++ )
-    {
-        DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( i );
-        if( IB->pIB10 == pIB )
-            return i;
-    }
+    m_Stats.NumRequests ++;
 
-    return -1;
-}
-
-//--------------------------------------------------------------------------------------
-int CResourceReuseCache::FindIB( IDirect3DIndexBuffer9* pIB )
-{
-    for( int i = 0; i < m_IBList.GetSize(); i++ )
+    // see if we have a free one of the same size and format available.  D3D10 index
+    // buffers are typeless and always come through here with a format of 0.
+    UINT Key[REUSE_KEY_SIZE] = { iSizeBytes, ibFormat, 0, 0 };
+    REUSE_ENTRY* pEntry = m_IBList.AcquireFree( Key );
+    if( pEntry )
     {
-        DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( i );
-        if( IB->pIB9 == pIB )
-            return i;
-    }
-
-    return -1;
-}
-
-//--------------------------------------------------------------------------------------
-int CResourceReuseCache::EnsureFreeIB( UINT iSizeBytes, UINT ibFormat )
-{
-    // Find the closest match
-    int closestindex = -1;
-    UINT smallestSize = UINT_MAX;
-    for( int i = 0; i < m_IBList.GetSize(); i++ )
-    {
-        DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( i );
-        if( !IB->bInUse )
-        {
-            if( 0 == ibFormat )
-                ibFormat = IB->ibFormat;
-            if( IB->iSizeBytes == iSizeBytes && IB->ibFormat == ibFormat )
-            {
-                smallestSize = IB->iSizeBytes;
-                closestindex = i;
-                break;
-            }
-        }
-    }
-
-    // if we found a closest match, return it
-    if( -1 != closestindex )
-    {
-        DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( closestindex );
-        IB->bInUse = TRUE;
-        return closestindex;
+        DEVICE_INDEX_BUFFER* IBFree = ( DEVICE_INDEX_BUFFER* )pEntry->pOwner;
+        IBFree->bInUse = TRUE;
+        m_Stats.NumHits ++;
+        m_Stats.BytesRecycled += IBFree->iSizeBytes;
+        return IBFree;
     }
 
     // We haven't found a free one, so create a new one
@@ -664,7 +892,6 @@ int CResourceReuseCache::EnsureFreeIB( UINT iSizeBytes, UINT ibFormat )
         IB->ibFormat = ibFormat;
         IB->pIB10 = NULL;
         IB->pIB9 = NULL;
-        IB->RecentUseCounter = 0;
 
         if( !m_bSilent )
             OutputDebugString( L"RESOURCE WARNING: Device needs to create new Index Buffer\n" );
@@ -694,17 +921,27 @@ int CResourceReuseCache::EnsureFreeIB( UINT iSizeBytes, UINT ibFormat )
             SAFE_DELETE( IB );
             if( !m_bSilent )
                 OutputDebugString( L"RESOURCE ERROR: Cannot Load Index Buffer!\n" );
-            return -1;
+            return NULL;
+        }
+
+        memcpy( IB->Entry.Key, Key, sizeof( Key ) );
+        IB->Entry.pObject = ( LDT_D3D10 == m_Device.Type ) ? ( void* )IB->pIB10 : ( void* )IB->pIB9;
+        IB->Entry.pOwner = IB;
+        if( !m_IBList.Insert( &IB->Entry ) )
+        {
+            if( LDT_D3D9 == m_Device.Type )
+                DestroyIB9( IB );
+            else
+                DestroyIB10( IB );
+            return NULL;
         }
 
         m_UsedManagedMemory += IB->iSizeBytes;
         IB->bInUse = TRUE;
-        int index = m_IBList.GetSize();
-        m_IBList.Add( IB );
-        return index;
+        return IB;
     }
 
-    return -1;
+    return NULL;
 }
 
 //--------------------------------------------------------------------------------------
@@ -775,15 +1012,19 @@ void CResourceReuseCache::DestroyIB10( DEVICE_INDEX_BUFFER* pIB )
 CResourceReuseCache::CResourceReuseCache( ID3D10Device* pDev ) : m_MaxManagedMemory( 1024 * 1024 * 32 ),
                                                                  m_UsedManagedMemory( 0 ),
                                                                  m_Device( pDev ),
-                                                                 m_bSilent( FALSE )
+                                                                 m_bSilent( FALSE ),
+                                                                 m_bDontCreateResources( FALSE )
 {
+    ResetStats();
 }
 
 CResourceReuseCache::CResourceReuseCache( LPDIRECT3DDEVICE9 pDev ) : m_MaxManagedMemory( 1024 * 1024 * 32 ),
                                                                      m_UsedManagedMemory( 0 ),
                                                                      m_Device( pDev ),
-                                                                     m_bSilent( FALSE )
+                                                                     m_bSilent( FALSE ),
+                                                                     m_bDontCreateResources( FALSE )
 {
+    ResetStats();
 }
 
 //--------------------------------------------------------------------------------------
@@ -816,26 +1057,23 @@ void CResourceReuseCache::SetDontCreateResources( BOOL bDontCreateResources )
     m_bDontCreateResources = bDontCreateResources;
 }
 
+//--------------------------------------------------------------------------------------
+// Destroys the texture that has been free the longest.  Textures in use are never
+// destroyed.  Returns the size freed, or 0 if there was nothing to destroy.
 //--------------------------------------------------------------------------------------
 UINT64 CResourceReuseCache::DestroyLRUTexture()
 {
-    DEVICE_TEXTURE* pLRURes = m_TextureList.GetAt( 0 );
-    UINT64 SizeGain = 0;
+    REUSE_ENTRY* pEntry = m_TextureList.GetLRU();
+    if( !pEntry )
+        return 0;
 
-    int iIndex = 0;
-    int NumResources = m_TextureList.GetSize();
-    for( int i = 0; i < NumResources; i++ )
-    {
-        DEVICE_TEXTURE* pRes = m_TextureList.GetAt( i );
-        if( pRes->RecentUseCounter < pLRURes->RecentUseCounter )
-        {
-            pLRURes = pRes;
-            iIndex = i;
-        }
-    }
+    DEVICE_TEXTURE* pLRURes = ( DEVICE_TEXTURE* )pEntry->pOwner;
+    m_TextureList.Remove( pEntry );
 
     m_UsedManagedMemory -= pLRURes->EstimatedSize;
-    SizeGain = pLRURes->EstimatedSize;
+    UINT64 SizeGain = pLRURes->EstimatedSize;
+    m_Stats.NumEvictions ++;
+    m_Stats.BytesEvicted += SizeGain;
 
     if( LDT_D3D9 == m_Device.Type )
         DestroyTexture9( pLRURes );
@@ -849,23 +1087,17 @@ UINT64 CResourceReuseCache::DestroyLRUTexture()
 //--------------------------------------------------------------------------------------
 UINT64 CResourceReuseCache::DestroyLRUVB()
 {
-    DEVICE_VERTEX_BUFFER* pLRURes = m_VBList.GetAt( 0 );
-    UINT64 SizeGain = 0;
+    REUSE_ENTRY* pEntry = m_VBList.GetLRU();
+    if( !pEntry )
+        return 0;
 
-    int iIndex = 0;
-    int NumResources = m_VBList.GetSize();
-    for( int i = 0; i < NumResources; i++ )
-    {
-        DEVICE_VERTEX_BUFFER* pRes = m_VBList.GetAt( i );
-        if( pRes->RecentUseCounter < pLRURes->RecentUseCounter )
-        {
-            pLRURes = pRes;
-            iIndex = i;
-        }
-    }
+    DEVICE_VERTEX_BUFFER* pLRURes = ( DEVICE_VERTEX_BUFFER* )pEntry->pOwner;
+    m_VBList.Remove( pEntry );
 
     m_UsedManagedMemory -= pLRURes->iSizeBytes;
-    SizeGain = pLRURes->iSizeBytes;
+    UINT64 SizeGain = pLRURes->iSizeBytes;
+    m_Stats.NumEvictions ++;
+    m_Stats.BytesEvicted += SizeGain;
 
     if( LDT_D3D9 == m_Device.Type )
         DestroyVB9( pLRURes );
@@ -878,23 +1110,17 @@ UINT64 CResourceReuseCache::DestroyLRUVB()
 //--------------------------------------------------------------------------------------
 UINT64 CResourceReuseCache::DestroyLRUIB()
 {
-    DEVICE_INDEX_BUFFER* pLRURes = m_IBList.GetAt( 0 );
-    UINT64 SizeGain = 0;
+    REUSE_ENTRY* pEntry = m_IBList.GetLRU();
+    if( !pEntry )
+        return 0;
 
-    int iIndex = 0;
-    int NumResources = m_IBList.GetSize();
-    for( int i = 0; i < NumResources; i++ )
-    {
-        DEVICE_INDEX_BUFFER* pRes = m_IBList.GetAt( i );
-        if( pRes->RecentUseCounter < pLRURes->RecentUseCounter )
-        {
-            pLRURes = pRes;
-            iIndex = i;
-        }
-    }
+    DEVICE_INDEX_BUFFER* pLRURes = ( DEVICE_INDEX_BUFFER* )pEntry->pOwner;
+    m_IBList.Remove( pEntry );
 
     m_UsedManagedMemory -= pLRURes->iSizeBytes;
-    SizeGain = pLRURes->iSizeBytes;
+    UINT64 SizeGain = pLRURes->iSizeBytes;
+    m_Stats.NumEvictions ++;
+    m_Stats.BytesEvicted += SizeGain;
 
     if( LDT_D3D9 == m_Device.Type )
         DestroyIB9( pLRURes );
@@ -910,6 +1136,8 @@ void CResourceReuseCache::DestroyLRUResources( UINT64 SizeGainNeeded )
     UINT64 ReleasedSize = 0;
     while( ReleasedSize < SizeGainNeeded )
     {
+        UINT64 PassStart = ReleasedSize;
+
         ReleasedSize += DestroyLRUTexture();
         if( ReleasedSize > SizeGainNeeded )
             return;
@@ -921,59 +1149,78 @@ void CResourceReuseCache::DestroyLRUResources( UINT64 SizeGainNeeded )
         ReleasedSize += DestroyLRUIB();
         if( ReleasedSize > SizeGainNeeded )
             return;
+
+        // Everything that's left is in use
+        if( ReleasedSize == PassStart )
+            return;
     }
 }
 
+//--------------------------------------------------------------------------------------
+// Hit rate is NumHits / NumRequests.  A low hit rate with many evictions means
+// SetMaxManagedMemory is set too low for the working set.
+//--------------------------------------------------------------------------------------
+void CResourceReuseCache::GetStats( REUSE_CACHE_STATS* pStats )
+{
+    *pStats = m_Stats;
+}
+
+//--------------------------------------------------------------------------------------
+void CResourceReuseCache::ResetStats()
+{
+    ZeroMemory( &m_Stats, sizeof( REUSE_CACHE_STATS ) );
+}
+
 //--------------------------------------------------------------------------------------
 // Texture functions
 //--------------------------------------------------------------------------------------
 ID3D10ShaderResourceView* CResourceReuseCache::GetFreeTexture10( UINT Width, UINT Height, UINT MipLevels, UINT Format,
                                                                  ID3D10Texture2D** ppStaging10 )
 {
-    int iTex = EnsureFreeTexture( Width, Height, MipLevels, Format );
-    if( -1 == iTex )
+    DEVICE_TEXTURE* tex = EnsureFreeTexture( Width, Height, MipLevels, Format );
+    if( !tex )
         return NULL;
     else
     {
 #if defined(USE_D3D10_STAGING_RESOURCES)
-        *ppStaging10 = m_TextureList.GetAt( iTex )->pStaging10;
+        *ppStaging10 = tex->pStaging10;
 #endif
-        return m_TextureList.GetAt( iTex )->pRV10;
+        return tex->pRV10;
     }
 }
 
 //--------------------------------------------------------------------------------------
 IDirect3DTexture9* CResourceReuseCache::GetFreeTexture9( UINT Width, UINT Height, UINT MipLevels, UINT Format )
 {
-    int iTex = EnsureFreeTexture( Width, Height, MipLevels, Format );
-    if( -1 == iTex )
+    DEVICE_TEXTURE* tex = EnsureFreeTexture( Width, Height, MipLevels, Format );
+    if( !tex )
         return NULL;
     else
-    {
-        return m_TextureList.GetAt( iTex )->pTexture9;
-    }
+        return tex->pTexture9;
 }
 
 //--------------------------------------------------------------------------------------
-void CResourceReuseCache::UnuseDeviceTexture10( ID3D10ShaderResourceView* pRV )
+void CResourceReuseCache::UnuseTexture( void* pObject )
 {
-    int index = FindTexture( pRV );
-    if( index >= 0 )
+    REUSE_ENTRY* pEntry = m_TextureList.Find( pObject );
+    if( pEntry )
     {
-        DEVICE_TEXTURE* tex = m_TextureList.GetAt( index );
+        DEVICE_TEXTURE* tex = ( DEVICE_TEXTURE* )pEntry->pOwner;
         tex->bInUse = FALSE;
+        m_TextureList.Release( pEntry );
     }
 }
 
+//--------------------------------------------------------------------------------------
+void CResourceReuseCache::UnuseDeviceTexture10( ID3D10ShaderResourceView* pRV )
+{
+    UnuseTexture( pRV );
+}
+
 //--------------------------------------------------------------------------------------
 void CResourceReuseCache::UnuseDeviceTexture9( IDirect3DTexture9* pTexture )
 {
-    int index = FindTexture( pTexture );
-    if( index >= 0 )
-    {
-        DEVICE_TEXTURE* tex = m_TextureList.GetAt( index );
-        tex->bInUse = FALSE;
-    }
+    UnuseTexture( pTexture );
 }
 
 //--------------------------------------------------------------------------------------
@@ -982,10 +1229,16 @@ int CResourceReuseCache::GetNumTextures()
     return m_TextureList.GetSize();
 }
 
+//--------------------------------------------------------------------------------------
+int CResourceReuseCache::GetNumUsedTextures()
+{
+    return m_TextureList.GetSize() - m_TextureList.GetNumFree();
+}
+
 //--------------------------------------------------------------------------------------
 DEVICE_TEXTURE* CResourceReuseCache::GetTexture( int i )
 {
-    return m_TextureList.GetAt( i );
+    return ( DEVICE_TEXTURE* )m_TextureList.GetAt( i )->pOwner;
 }
 
 //--------------------------------------------------------------------------------------
@@ -993,43 +1246,45 @@ DEVICE_TEXTURE* CResourceReuseCache::GetTexture( int i )
 //--------------------------------------------------------------------------------------
 ID3D10Buffer* CResourceReuseCache::GetFreeVB10( UINT sizeBytes )
 {
-    int iVB = EnsureFreeVB( sizeBytes );
-    if( -1 == iVB )
+    DEVICE_VERTEX_BUFFER* vb = EnsureFreeVB( sizeBytes );
+    if( !vb )
         return NULL;
     else
-        return m_VBList.GetAt( iVB )->pVB10;
+        return vb->pVB10;
 }
 
 //--------------------------------------------------------------------------------------
 IDirect3DVertexBuffer9* CResourceReuseCache::GetFreeVB9( UINT sizeBytes )
 {
-    int iVB = EnsureFreeVB( sizeBytes );
-    if( -1 == iVB )
+    DEVICE_VERTEX_BUFFER* vb = EnsureFreeVB( sizeBytes );
+    if( !vb )
         return NULL;
     else
-        return m_VBList.GetAt( iVB )->pVB9;
+        return vb->pVB9;
 }
 
 //--------------------------------------------------------------------------------------
-void CResourceReuseCache::UnuseDeviceVB10( ID3D10Buffer* pVB )
+void CResourceReuseCache::UnuseVB( void* pObject )
 {
-    int index = FindVB( pVB );
-    if( index >= 0 )
+    REUSE_ENTRY* pEntry = m_VBList.Find( pObject );
+    if( pEntry )
     {
-        DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( index );
+        DEVICE_VERTEX_BUFFER* vb = ( DEVICE_VERTEX_BUFFER* )pEntry->pOwner;
         vb->bInUse = FALSE;
+        m_VBList.Release( pEntry );
     }
 }
 
+//--------------------------------------------------------------------------------------
+void CResourceReuseCache::UnuseDeviceVB10( ID3D10Buffer* pVB )
+{
+    UnuseVB( pVB );
+}
+
 //--------------------------------------------------------------------------------------
 void CResourceReuseCache::UnuseDeviceVB9( IDirect3DVertexBuffer9* pVB )
 {
-    int index = FindVB( pVB );
-    if( index >= 0 )
-    {
-        DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( index );
-        vb->bInUse = FALSE;
-    }
+    UnuseVB( pVB );
 }
 
 //--------------------------------------------------------------------------------------
@@ -1038,10 +1293,16 @@ int CResourceReuseCache::GetNumVBs()
     return m_VBList.GetSize();
 }
 
+//--------------------------------------------------------------------------------------
+int CResourceReuseCache::GetNumUsedVBs()
+{
+    return m_VBList.GetSize() - m_VBList.GetNumFree();
+}
+
 //--------------------------------------------------------------------------------------
 DEVICE_VERTEX_BUFFER* CResourceReuseCache::GetVB( int i )
 {
-    return m_VBList.GetAt( i );
+    return ( DEVICE_VERTEX_BUFFER* )m_VBList.GetAt( i )->pOwner;
 }
 
 //--------------------------------------------------------------------------------------
@@ -1049,43 +1310,45 @@ DEVICE_VERTEX_BUFFER* CResourceReuseCache::GetVB( int i )
 //--------------------------------------------------------------------------------------
 ID3D10Buffer* CResourceReuseCache::GetFreeIB10( UINT sizeBytes, UINT ibFormat )
 {
-    int iIB = EnsureFreeIB( sizeBytes, ibFormat );
-    if( -1 == iIB )
+    DEVICE_INDEX_BUFFER* IB = EnsureFreeIB( sizeBytes, ibFormat );
+    if( !IB )
         return NULL;
     else
-        return m_IBList.GetAt( iIB )->pIB10;
+        return IB->pIB10;
 }
 
 //--------------------------------------------------------------------------------------
 IDirect3DIndexBuffer9* CResourceReuseCache::GetFreeIB9( UINT sizeBytes, UINT ibFormat )
 {
-    int iIB = EnsureFreeIB( sizeBytes, ibFormat );
-    if( -1 == iIB )
+    DEVICE_INDEX_BUFFER* IB = EnsureFreeIB( sizeBytes, ibFormat );
+    if( !IB )
         return NULL;
     else
-        return m_IBList.GetAt( iIB )->pIB9;
+        return IB->pIB9;
 }
 
 //--------------------------------------------------------------------------------------
-void CResourceReuseCache::UnuseDeviceIB10( ID3D10Buffer* pIB )
+void CResourceReuseCache::UnuseIB( void* pObject )
 {
-    int index = FindIB( pIB );
-    if( index >= 0 )
+    REUSE_ENTRY* pEntry = m_IBList.Find( pObject );
+    if( pEntry )
     {
-        DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( index );
+        DEVICE_INDEX_BUFFER* IB = ( DEVICE_INDEX_BUFFER* )pEntry->pOwner;
         IB->bInUse = FALSE;
+        m_IBList.Release( pEntry );
     }
 }
 
+//--------------------------------------------------------------------------------------
+void CResourceReuseCache::UnuseDeviceIB10( ID3D10Buffer* pIB )
+{
+    UnuseIB( pIB );
+}
+
 //--------------------------------------------------------------------------------------
 void CResourceReuseCache::UnuseDeviceIB9( IDirect3DIndexBuffer9* pIB )
 {
-    int index = FindIB( pIB );
-    if( index >= 0 )
-    {
-        DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( index );
-        IB->bInUse = FALSE;
-    }
+    UnuseIB( pIB );
 }
 
 //--------------------------------------------------------------------------------------
@@ -1094,10 +1357,16 @@ int CResourceReuseCache::GetNumIBs()
     return m_IBList.GetSize();
 }
 
+//--------------------------------------------------------------------------------------
+int CResourceReuseCache::GetNumUsedIBs()
+{
+    return m_IBList.GetSize() - m_IBList.GetNumFree();
+}
+
 //--------------------------------------------------------------------------------------
 DEVICE_INDEX_BUFFER* CResourceReuseCache::GetIB( int i )
 {
-    return m_IBList.GetAt( i );
+    return ( DEVICE_INDEX_BUFFER* )m_IBList.GetAt( i )->pOwner;
 }
 
 //--------------------------------------------------------------------------------------
@@ -1111,17 +1380,17 @@ void CResourceReuseCache::OnDestroy()
     {
         for( int i = 0; i < TexListSize; i++ )
         {
-            DEVICE_TEXTURE* tex = m_TextureList.GetAt( i );
+            DEVICE_TEXTURE* tex = GetTexture( i );
             DestroyTexture9( tex );
         }
         for( int i = 0; i < VBListSize; i++ )
         {
-            DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( i );
+            DEVICE_VERTEX_BUFFER* vb = GetVB( i );
             DestroyVB9( vb );
         }
         for( int i = 0; i < IBListSize; i++ )
         {
-            DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( i );
+            DEVICE_INDEX_BUFFER* IB = GetIB( i );
             DestroyIB9( IB );
         }
     }
@@ -1129,17 +1398,17 @@ void CResourceReuseCache::OnDestroy()
     {
         for( int i = 0; i < TexListSize; i++ )
         {
-            DEVICE_TEXTURE* tex = m_TextureList.GetAt( i );
+            DEVICE_TEXTURE* tex = GetTexture( i );
             DestroyTexture10( tex );
         }
         for( int i = 0; i < VBListSize; i++ )
         {
-            DEVICE_VERTEX_BUFFER* vb = m_VBList.GetAt( i );
+            DEVICE_VERTEX_BUFFER* vb = GetVB( i );
             DestroyVB10( vb );
         }
         for( int i = 0; i < IBListSize; i++ )
         {
-            DEVICE_INDEX_BUFFER* IB = m_IBList.GetAt( i );
+            DEVICE_INDEX_BUFFER* IB = GetIB( i );
             DestroyIB10( IB );
         }
     }
@@ -43,8 +43,90 @@ LOADER_DEVICE( ID3D10Device* pDevice ) { pDev10 = pDevice; Type = LDT_D3D10; }
 LOADER_DEVICE( IDirect3DDevice9* pDevice ) { pDev9 = pDevice; Type = LDT_D3D9; }
 };
 
+//--------------------------------------------------------------------------------------
+// Bookkeeping for each cached resource.  A free entry is on the free list of its size
+// class and on the LRU list of its resource type.  Every entry is on a hash chain
+// keyed on its device pointer.
+//--------------------------------------------------------------------------------------
+#define REUSE_KEY_SIZE 4
+
+struct REUSE_CLASS;
+
+struct REUSE_ENTRY
+{
+UINT Key[REUSE_KEY_SIZE];   // size class: Width, Height, MipLevels, Format or byte size, format
+void* pObject;              // device pointer handed out by the cache
+void* pOwner;               // DEVICE_TEXTURE, DEVICE_VERTEX_BUFFER or DEVICE_INDEX_BUFFER holding this entry
+int iIndex;                 // position in CReuseIndex::m_Entries
+BOOL bFree;                 // on the free lists
+REUSE_CLASS* pClass;
+REUSE_ENTRY* pClassPrev;    // free entries of the same size class
+REUSE_ENTRY* pClassNext;
+REUSE_ENTRY* pLRUPrev;      // toward the most recently freed entry
+REUSE_ENTRY* pLRUNext;      // toward the least recently freed entry
+REUSE_ENTRY* pHashNext;     // next entry in the same device pointer bucket
+};
+
+struct REUSE_CLASS
+{
+UINT Key[REUSE_KEY_SIZE];
+REUSE_ENTRY* pFreeHead;
+REUSE_CLASS* pHashNext;
+};
+
+struct REUSE_CACHE_STATS
+{
+UINT64 NumRequests;         // calls to GetFree*
+UINT64 NumHits;             // requests satisfied by a free resource of the same size class
+UINT64 NumEvictions;        // free resources destroyed to stay under the managed memory limit
+UINT64 BytesRecycled;       // bytes handed back out instead of being created
+UINT64 BytesEvicted;
+};
+
+//--------------------------------------------------------------------------------------
+// CReuseIndex keeps the entries for one resource type.  Every operation is O(1)
+// amortized.  The hash tables double when they get too full.
+//--------------------------------------------------------------------------------------
+class CReuseIndex
+{
+private:
+CGrowableArray<REUSE_ENTRY*>			m_Entries;
+REUSE_ENTRY**							m_ppObjectBuckets;
+UINT									m_NumObjectBuckets;
+REUSE_CLASS**							m_ppClassBuckets;
+UINT									m_NumClassBuckets;
+UINT									m_NumClasses;
+REUSE_ENTRY*							m_pLRUHead;
+REUSE_ENTRY*							m_pLRUTail;
+int										m_NumFree;
+
+static UINT HashObject( void* pObject );
+static UINT HashKey( const UINT* Key );
+void GrowObjectBuckets();
+void GrowClassBuckets();
+REUSE_CLASS* FindClass( const UINT* Key, bool bCreate );
+void Unlink( REUSE_ENTRY* pEntry );
+
+public:
+CReuseIndex();
+~CReuseIndex();
+
+bool Insert( REUSE_ENTRY* pEntry );
+void Remove( REUSE_ENTRY* pEntry );
+REUSE_ENTRY* Find( void* pObject );
+REUSE_ENTRY* AcquireFree( const UINT* Key );
+void Release( REUSE_ENTRY* pEntry );
+REUSE_ENTRY* GetLRU();
+void RemoveAll();
+
+int GetSize();
+int GetNumFree();
+REUSE_ENTRY* GetAt( int i );
+};
+
 struct DEVICE_TEXTURE
 {
+REUSE_ENTRY Entry;
 UINT Width;
 UINT Height;
 UINT MipLevels;
@@ -62,11 +144,11 @@ ID3D10Texture2D*			  pStaging10;
 
 UINT64 EstimatedSize;
 BOOL bInUse;
-UINT RecentUseCounter;
 };
 
 struct DEVICE_VERTEX_BUFFER
 {
+REUSE_ENTRY Entry;
 UINT iSizeBytes;
 
 union
@@ -77,11 +159,11 @@ UINT64                   Align64bit;
 };
 
 BOOL bInUse;
-UINT RecentUseCounter;
 };
 
 struct DEVICE_INDEX_BUFFER
 {
+REUSE_ENTRY Entry;
 UINT iSizeBytes;
 UINT ibFormat;
 
@@ -93,7 +175,6 @@ UINT64                   Align64bit;
 };
 
 BOOL bInUse;
-UINT RecentUseCounter;
 };
 
 //--------------------------------------------------------------------------------------
@@ -103,26 +184,24 @@ class CResourceReuseCache
 {
 private:
 LOADER_DEVICE							m_Device;
-CGrowableArray<DEVICE_TEXTURE*>			m_TextureList;
-CGrowableArray<DEVICE_VERTEX_BUFFER*>	m_VBList;
-CGrowableArray<DEVICE_INDEX_BUFFER*>	m_IBList;
+CReuseIndex								m_TextureList;
+CReuseIndex								m_VBList;
+CReuseIndex								m_IBList;
+REUSE_CACHE_STATS						m_Stats;
 UINT64									m_MaxManagedMemory;
 UINT64									m_UsedManagedMemory;
 BOOL									m_bSilent;
 BOOL									m_bDontCreateResources;
 
-int FindTexture( ID3D10ShaderResourceView* pRV10 );
-int FindTexture( IDirect3DTexture9* pTex9 );
-int EnsureFreeTexture( UINT Width, UINT Height, UINT MipLevels, UINT Format );
+DEVICE_TEXTURE* EnsureFreeTexture( UINT Width, UINT Height, UINT MipLevels, UINT Format );
 UINT64 GetEstimatedSize( UINT Width, UINT Height, UINT MipLevels, UINT Format );
+void UnuseTexture( void* pObject );
 
-int FindVB( ID3D10Buffer* pVB );
-int FindVB( IDirect3DVertexBuffer9* pVB );
-int EnsureFreeVB( UINT iSizeBytes );
+DEVICE_VERTEX_BUFFER* EnsureFreeVB( UINT iSizeBytes );
+void UnuseVB( void* pObject );
 
-int FindIB( ID3D10Buffer* pIB );
-int FindIB( IDirect3DIndexBuffer9* pIB );
-int EnsureFreeIB( UINT iSizeBytes, UINT ibFormat );
+DEVICE_INDEX_BUFFER* EnsureFreeIB( UINT iSizeBytes, UINT ibFormat );
+void UnuseIB( void* pObject );
 
 void DestroyTexture9( DEVICE_TEXTURE* pTex );
 void DestroyTexture10( DEVICE_TEXTURE* pTex );
@@ -145,6 +224,8 @@ UINT64 DestroyLRUTexture();
 UINT64 DestroyLRUVB();
 UINT64 DestroyLRUIB();
 void DestroyLRUResources( UINT64 SizeGainNeeded );
+void GetStats( REUSE_CACHE_STATS* pStats );
+void ResetStats();
 
 // texture functions
 ID3D10ShaderResourceView* GetFreeTexture10( UINT Width, UINT Height, UINT MipLevels, UINT Format,
@@ -153,6 +234,7 @@ IDirect3DTexture9* GetFreeTexture9( UINT Width, UINT Height, UINT MipLevels, UIN
 void UnuseDeviceTexture10( ID3D10ShaderResourceView* pRV );
 void UnuseDeviceTexture9( IDirect3DTexture9* pTexture );
 int GetNumTextures();
+int GetNumUsedTextures();
 DEVICE_TEXTURE* GetTexture( int i );
 
 // vertex buffer functions
@@ -161,6 +243,7 @@ IDirect3DVertexBuffer9* GetFreeVB9( UINT sizeBytes );
 void UnuseDeviceVB10( ID3D10Buffer* pVB );
 void UnuseDeviceVB9( IDirect3DVertexBuffer9* pVB );
 int GetNumVBs();
+int GetNumUsedVBs();
 DEVICE_VERTEX_BUFFER* GetVB( int i );
 
 // index buffer functions
@@ -169,6 +252,7 @@ IDirect3DIndexBuffer9* GetFreeIB9( UINT sizeBytes, UINT ibFormat );
 void UnuseDeviceIB10( ID3D10Buffer* pVB );
 void UnuseDeviceIB9( IDirect3DIndexBuffer9* pVB );
 int GetNumIBs();
+int GetNumUsedIBs();
 DEVICE_INDEX_BUFFER* GetIB( int i );
 
 void OnDestroy();
@@ -19,8 +19,19 @@ CTerrain::CTerrain() : m_SqrtNumTiles( 0 ),
                        m_HeightMapY( 0 ),
                        m_pHeightBits( NULL ),
                        m_NumIndices( 0 ),
-                       m_pTerrainRawIndices( NULL )
+                       m_pTerrainRawIndices( NULL ),
+                       m_NumLODs( 0 ),
+                       m_pTileLODErrors( NULL ),
+                       m_pTileBounds( NULL ),
+                       m_pTileLODs( NULL ),
+                       m_pTileStitches( NULL ),
+                       m_NumTreeLevels( 0 ),
+                       m_pHeightTree( NULL )
 {
+    ZeroMemory( m_LODs, sizeof( m_LODs ) );
+    ZeroMemory( m_TreeLevelWidth, sizeof( m_TreeLevelWidth ) );
+    ZeroMemory( m_TreeLevelHeight, sizeof( m_TreeLevelHeight ) );
+    ZeroMemory( m_TreeLevelOffset, sizeof( m_TreeLevelOffset ) );
 }
 
 
@@ -38,6 +49,8 @@ CTerrain::~CTerrain()
     SAFE_DELETE_ARRAY( m_pTiles );
     SAFE_DELETE_ARRAY( m_pHeightBits );
     SAFE_DELETE_ARRAY( m_pTerrainRawIndices );
+    SAFE_DELETE_ARRAY( m_pHeightTree );
+    DestroyLODs();
 }
 
 //--------------------------------------------------------------------------------------
@@ -132,12 +145,17 @@ float CTerrain::GetHeightOnMap( D3DXVECTOR3* pPos )
 {
     // move x and z into [0..1] range
     D3DXVECTOR2 uv = GetUVForPosition( pPos );
-    float x = uv.x;
-    float z = uv.y;
 
     // scale into heightmap space
-    x *= m_HeightMapX;
-    z *= m_HeightMapY;
+    return SampleHeight( uv.x * m_HeightMapX, uv.y * m_HeightMapY );
+}
+
+
+//--------------------------------------------------------------------------------------
+// x and z are in heightmap texels
+//--------------------------------------------------------------------------------------
+float CTerrain::SampleHeight( float x, float z )
+{
     x += 0.5f;
     z += 0.5f;
     if( x >= m_HeightMapX - 1 )
@@ -168,6 +186,18 @@ float CTerrain::GetHeightOnMap( D3DXVECTOR3* pPos )
 }
 
 
+//--------------------------------------------------------------------------------------
+void CTerrain::GetHeightsOnMap( const D3DXVECTOR3* pPositions, float* pHeights, UINT NumPositions )
+{
+    for( UINT i = 0; i < NumPositions; i++ )
+    {
+        float u = ( pPositions[i].x / m_fWorldScale ) + 0.5f;
+        float v = ( pPositions[i].z / m_fWorldScale ) + 0.5f;
+        pHeights[i] = SampleHeight( u * m_HeightMapX, v * m_HeightMapY );
+    }
+}
+
+
 //--------------------------------------------------------------------------------------
 D3DXVECTOR3 CTerrain::GetNormalOnMap( D3DXVECTOR3* pPos )
 {
@@ -196,6 +226,35 @@ D3DXVECTOR3 CTerrain::GetNormalOnMap( D3DXVECTOR3* pPos )
 }
 
 
+//--------------------------------------------------------------------------------------
+// The same central differences as GetNormalOnMap, with the spacing worked out once
+//--------------------------------------------------------------------------------------
+void CTerrain::GetNormalsOnMap( const D3DXVECTOR3* pPositions, D3DXVECTOR3* pNormals, UINT NumPositions )
+{
+    float xDelta = ( m_fWorldScale / ( float )m_SqrtNumTiles ) / ( float )m_NumSidesPerTile;
+    float zDelta = ( m_fWorldScale / ( float )m_SqrtNumTiles ) / ( float )m_NumSidesPerTile;
+
+    for( UINT i = 0; i < NumPositions; i++ )
+    {
+        D3DXVECTOR3 vLeft = pPositions[i] - D3DXVECTOR3( xDelta, 0, 0 );
+        D3DXVECTOR3 vRight = pPositions[i] + D3DXVECTOR3( xDelta, 0, 0 );
+        D3DXVECTOR3 vUp = pPositions[i] + D3DXVECTOR3( 0, 0, zDelta );
+        D3DXVECTOR3 vDown = pPositions[i] - D3DXVECTOR3( 0, 0, zDelta );
+
+        vLeft.y = GetHeightOnMap( &vLeft );
+        vRight.y = GetHeightOnMap( &vRight );
+        vUp.y = GetHeightOnMap( &vUp );
+        vDown.y = GetHeightOnMap( &vDown );
+
+        D3DXVECTOR3 e0 = vRight - vLeft;
+        D3DXVECTOR3 e1 = vUp - vDown;
+        D3DXVECTOR3 ortho;
+        D3DXVec3Cross( &ortho, &e1, &e0 );
+        D3DXVec3Normalize( &pNormals[i], &ortho );
+    }
+}
+
+
 //--------------------------------------------------------------------------------------
 /*void CTerrain::RenderTile( TERRAIN_TILE* pTile )
    {
@@ -298,6 +357,7 @@ HRESULT CTerrain::LoadBMPImage( WCHAR* strHeightMap )
     }
 
     SAFE_DELETE_ARRAY( pBits );
+    CloseHandle( hFile );
 
     return S_OK;
 
@@ -353,3 +413,660 @@ HRESULT CTerrain::GenerateTile( TERRAIN_TILE* pTile, BOUNDING_BOX* pBBox )
 
     return hr;
 }
+
+
+//--------------------------------------------------------------------------------------
+void CTerrain::GetTileBounds( UINT iTile, BOUNDING_BOX* pBBox )
+{
+    float fDelta = m_fWorldScale / ( float )m_SqrtNumTiles;
+    float xStart = -m_fWorldScale / 2.0f + ( float )( iTile % m_SqrtNumTiles ) * fDelta;
+    float zStart = -m_fWorldScale / 2.0f + ( float )( iTile / m_SqrtNumTiles ) * fDelta;
+
+    pBBox->min = D3DXVECTOR3( xStart, 0, zStart );
+    pBBox->max = D3DXVECTOR3( xStart + fDelta, 0, zStart + fDelta );
+}
+
+
+//--------------------------------------------------------------------------------------
+void CTerrain::DestroyLODs()
+{
+    for( UINT i = 0; i < m_NumLODs; i++ )
+    {
+        for( UINT s = 0; s < TERRAIN_NUM_STITCHES; s++ )
+        {
+            SAFE_DELETE_ARRAY( m_LODs[i].pIndices[s] );
+        }
+    }
+    ZeroMemory( m_LODs, sizeof( m_LODs ) );
+    m_NumLODs = 0;
+
+    SAFE_DELETE_ARRAY( m_pTileLODErrors );
+    SAFE_DELETE_ARRAY( m_pTileBounds );
+    SAFE_DELETE_ARRAY( m_pTileLODs );
+    SAFE_DELETE_ARRAY( m_pTileStitches );
+}
+
+
+//--------------------------------------------------------------------------------------
+HRESULT CTerrain::CreateLODs( UINT MaxLODs )
+{
+    HRESULT hr = S_OK;
+
+    DestroyLODs();
+    if( !m_pHeightBits || 0 == m_NumTiles || 0 == m_NumSidesPerTile || 0 == MaxLODs )
+        return E_FAIL;
+
+    // The index lists are 16 bit
+    UINT NumVertices = GetNumTileVertices();
+    if( NumVertices > 65536 )
+        return E_INVALIDARG;
+
+    // Each LOD multiplies the step by the smallest factor left in the number of sides, so
+    // the coarser steps are multiples of the finer ones and shared edges line up.  With a
+    // power of two number of sides every LOD halves the vertex density.
+    if( MaxLODs > TERRAIN_MAX_LODS )
+        MaxLODs = TERRAIN_MAX_LODS;
+    UINT Step = 1;
+    UINT Remaining = m_NumSidesPerTile;
+    m_LODs[0].Step = 1;
+    m_NumLODs = 1;
+    while( m_NumLODs < MaxLODs && Remaining > 1 )
+    {
+        UINT Factor = 2;
+        while( Remaining % Factor )
+            Factor++;
+
+        Step *= Factor;
+        Remaining /= Factor;
+        m_LODs[m_NumLODs].Step = Step;
+        m_NumLODs++;
+    }
+
+    for( UINT i = 0; i < m_NumLODs; i++ )
+    {
+        for( UINT s = 0; s < TERRAIN_NUM_STITCHES; s++ )
+        {
+            V_RETURN( GenerateLODIndices( i, s ) );
+        }
+    }
+
+    m_pTileLODErrors = new float[ m_NumTiles * m_NumLODs ];
+    m_pTileBounds = new BOUNDING_BOX[ m_NumTiles ];
+    m_pTileLODs = new BYTE[ m_NumTiles ];
+    m_pTileStitches = new BYTE[ m_NumTiles ];
+    D3DXVECTOR3* pPositions = new D3DXVECTOR3[ NumVertices ];
+    float* pHeights = new float[ NumVertices ];
+    if( !m_pTileLODErrors || !m_pTileBounds || !m_pTileLODs || !m_pTileStitches || !pPositions || !pHeights )
+    {
+        SAFE_DELETE_ARRAY( pPositions );
+        SAFE_DELETE_ARRAY( pHeights );
+        DestroyLODs();
+        return E_OUTOFMEMORY;
+    }
+    ZeroMemory( m_pTileLODs, m_NumTiles );
+    ZeroMemory( m_pTileStitches, m_NumTiles );
+
+    UINT N = m_NumSidesPerTile;
+    for( UINT iTile = 0; iTile < m_NumTiles; iTile++ )
+    {
+        BOUNDING_BOX BBox;
+        GetTileBounds( iTile, &BBox );
+        float xDelta = ( BBox.max.x - BBox.min.x ) / ( float )N;
+        float zDelta = ( BBox.max.z - BBox.min.z ) / ( float )N;
+
+        UINT iVertex = 0;
+        for( UINT z = 0; z < N + 1; z++ )
+        {
+            for( UINT x = 0; x < N + 1; x++ )
+            {
+                pPositions[iVertex] = D3DXVECTOR3( BBox.min.x + x * xDelta, 0, BBox.min.z + z * zDelta );
+                iVertex ++;
+            }
+        }
+        GetHeightsOnMap( pPositions, pHeights, NumVertices );
+
+        BBox.min.y = BBox.max.y = pHeights[0];
+        for( UINT i = 1; i < NumVertices; i++ )
+        {
+            BBox.min.y = min( BBox.min.y, pHeights[i] );
+            BBox.max.y = max( BBox.max.y, pHeights[i] );
+        }
+        m_pTileBounds[iTile] = BBox;
+
+        // The error of a LOD is the largest height difference at any tile vertex between
+        // the full tile and the LOD's triangles, which are measured with the diagonal of
+        // the interior blocks.  An error never drops from one LOD to the next.
+        float* pErrors = &m_pTileLODErrors[ iTile * m_NumLODs ];
+        pErrors[0] = 0.0f;
+        for( UINT iLOD = 1; iLOD < m_NumLODs; iLOD++ )
+        {
+            UINT s = m_LODs[iLOD].Step;
+            UINT NumBlocks = N / s;
+            float fError = pErrors[iLOD - 1];
+            for( UINT z = 0; z < N + 1; z++ )
+            {
+                UINT bz = min( z / s, NumBlocks - 1 );
+                float fz = ( float )( z - bz * s ) / ( float )s;
+                for( UINT x = 0; x < N + 1; x++ )
+                {
+                    UINT bx = min( x / s, NumBlocks - 1 );
+                    float fx = ( float )( x - bx * s ) / ( float )s;
+
+                    float h00 = pHeights[ ( bz * s ) * ( N + 1 ) + bx * s ];
+                    float h10 = pHeights[ ( bz * s ) * ( N + 1 ) + ( bx + 1 ) * s ];
+                    float h01 = pHeights[ ( ( bz + 1 ) * s ) * ( N + 1 ) + bx * s ];
+                    float h11 = pHeights[ ( ( bz + 1 ) * s ) * ( N + 1 ) + ( bx + 1 ) * s ];
+                    float h;
+                    if( fx + fz <= 1.0f )
+                        h = h00 + fx * ( h10 - h00 ) + fz * ( h01 - h00 );
+                    else
+                        h = h11 + ( 1.0f - fx ) * ( h01 - h11 ) + ( 1.0f - fz ) * ( h10 - h11 );
+
+                    fError = max( fError, fabsf( pHeights[ z * ( N + 1 ) + x ] - h ) );
+                }
+            }
+            pErrors[iLOD] = fError;
+        }
+    }
+
+    SAFE_DELETE_ARRAY( pPositions );
+    SAFE_DELETE_ARRAY( pHeights );
+
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Grid point t along side Side of a tile, d vertices in from the edge.  Sides are in
+// TERRAIN_STITCH_ bit order.
+//--------------------------------------------------------------------------------------
+void GetTileSidePoint( UINT Side, UINT N, UINT t, UINT d, UINT* pX, UINT* pZ )
+{
+    switch( Side )
+    {
+        case 0:
+            *pX = d; *pZ = t; break;
+        case 1:
+            *pX = N - d; *pZ = t; break;
+        case 2:
+            *pX = t; *pZ = d; break;
+        default:
+            *pX = t; *pZ = N - d; break;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Adds a triangle between tile grid points, wound the same way as the tile strips
+//--------------------------------------------------------------------------------------
+void AddTileTriangle( CGrowableArray <SHORT>* pIndices, UINT N, UINT x0, UINT z0, UINT x1, UINT z1, UINT x2,
+                      UINT z2 )
+{
+    int Cross = ( ( int )x1 - ( int )x0 ) * ( ( int )z2 - ( int )z0 ) - ( ( int )z1 - ( int )z0 ) *
+                ( ( int )x2 - ( int )x0 );
+    if( Cross > 0 )
+    {
+        UINT x = x1; x1 = x2; x2 = x;
+        UINT z = z1; z1 = z2; z2 = z;
+    }
+
+    pIndices->Add( ( SHORT )( z0 * ( N + 1 ) + x0 ) );
+    pIndices->Add( ( SHORT )( z1 * ( N + 1 ) + x1 ) );
+    pIndices->Add( ( SHORT )( z2 * ( N + 1 ) + x2 ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+// The blocks inside the outer ring are split in two like the strips.  The outer ring is
+// four trapezoids, each between an edge (at the LOD's step, or the next LOD's step when
+// that side is stitched) and the side of the inner square, and each is zipped together
+// from one end to the other.
+//--------------------------------------------------------------------------------------
+HRESULT CTerrain::GenerateLODIndices( UINT iLOD, UINT Stitch )
+{
+    UINT N = m_NumSidesPerTile;
+    UINT Step = m_LODs[iLOD].Step;
+    UINT CoarseStep = ( iLOD + 1 < m_NumLODs ) ? m_LODs[iLOD + 1].Step : Step;
+    UINT NumBlocks = N / Step;
+    CGrowableArray <SHORT> Indices;
+
+    if( 1 == NumBlocks )
+    {
+        AddTileTriangle( &Indices, N, 0, 0, 0, N, N, 0 );
+        AddTileTriangle( &Indices, N, 0, N, N, N, N, 0 );
+    }
+    else
+    {
+        for( UINT bz = 1; bz + 1 < NumBlocks; bz++ )
+        {
+            for( UINT bx = 1; bx + 1 < NumBlocks; bx++ )
+            {
+                UINT x0 = bx * Step;
+                UINT z0 = bz * Step;
+                AddTileTriangle( &Indices, N, x0, z0, x0, z0 + Step, x0 + Step, z0 );
+                AddTileTriangle( &Indices, N, x0, z0 + Step, x0 + Step, z0 + Step, x0 + Step, z0 );
+            }
+        }
+
+        for( UINT Side = 0; Side < 4; Side++ )
+        {
+            UINT EdgeStep = ( Stitch & ( 1 << Side ) ) ? CoarseStep : Step;
+            UINT NumOuter = N / EdgeStep;
+            UINT NumInner = NumBlocks - 2;
+            UINT iOuter = 0;
+            UINT iInner = 0;
+            while( iOuter < NumOuter || iInner < NumInner )
+            {
+                UINT tOuter = iOuter * EdgeStep;
+                UINT tInner = Step + iInner * Step;
+                bool bAdvanceOuter = ( iInner == NumInner ) ||
+                    ( iOuter < NumOuter && tOuter + EdgeStep <= tInner + Step );
+
+                UINT x0, z0, x1, z1, x2, z2;
+                GetTileSidePoint( Side, N, tOuter, 0, &x0, &z0 );
+                GetTileSidePoint( Side, N, tInner, Step, &x1, &z1 );
+                if( bAdvanceOuter )
+                {
+                    GetTileSidePoint( Side, N, tOuter + EdgeStep, 0, &x2, &z2 );
+                    iOuter++;
+                }
+                else
+                {
+                    GetTileSidePoint( Side, N, tInner + Step, Step, &x2, &z2 );
+                    iInner++;
+                }
+                AddTileTriangle( &Indices, N, x0, z0, x1, z1, x2, z2 );
+            }
+        }
+    }
+
+    m_LODs[iLOD].NumIndices[Stitch] = Indices.GetSize();
+    m_LODs[iLOD].pIndices[Stitch] = new SHORT[ Indices.GetSize() ];
+    if( !m_LODs[iLOD].pIndices[Stitch] )
+        return E_OUTOFMEMORY;
+    CopyMemory( m_LODs[iLOD].pIndices[Stitch], Indices.GetData(), Indices.GetSize() * sizeof( SHORT ) );
+
+    return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+UINT CTerrain::SelectLODs( const D3DXVECTOR3* pEye, float fFovY, float fViewportHeight, float fMaxPixelError )
+{
+    if( 0 == m_NumLODs )
+        return 0;
+
+    // An error of e world units d units away covers about e * fPixelsPerRadian / d pixels
+    float fPixelsPerRadian = fViewportHeight / ( 2.0f * tanf( fFovY * 0.5f ) );
+    for( UINT iTile = 0; iTile < m_NumTiles; iTile++ )
+    {
+        BOUNDING_BOX* pBBox = &m_pTileBounds[iTile];
+        D3DXVECTOR3 vNearest;
+        D3DXVec3Maximize( &vNearest, pEye, &pBBox->min );
+        D3DXVec3Minimize( &vNearest, &vNearest, &pBBox->max );
+        D3DXVECTOR3 vDelta = *pEye - vNearest;
+        float fMaxError = fMaxPixelError * D3DXVec3Length( &vDelta ) / fPixelsPerRadian;
+
+        UINT iLOD = 0;
+        while( iLOD + 1 < m_NumLODs && GetTileLODError( iTile, iLOD + 1 ) <= fMaxError )
+            iLOD++;
+        m_pTileLODs[iTile] = ( BYTE )iLOD;
+    }
+
+    // Refine until neighbors are within a LOD of each other.  LODs only ever drop, so this
+    // settles after a few passes.
+    bool bChanged = true;
+    while( bChanged )
+    {
+        bChanged = false;
+        for( UINT z = 0; z < m_SqrtNumTiles; z++ )
+        {
+            for( UINT x = 0; x < m_SqrtNumTiles; x++ )
+            {
+                UINT iTile = z * m_SqrtNumTiles + x;
+                UINT MinNeighbor = m_pTileLODs[iTile];
+                if( x > 0 )
+                    MinNeighbor = min( MinNeighbor, ( UINT )m_pTileLODs[iTile - 1] );
+                if( x + 1 < m_SqrtNumTiles )
+                    MinNeighbor = min( MinNeighbor, ( UINT )m_pTileLODs[iTile + 1] );
+                if( z > 0 )
+                    MinNeighbor = min( MinNeighbor, ( UINT )m_pTileLODs[iTile - m_SqrtNumTiles] );
+                if( z + 1 < m_SqrtNumTiles )
+                    MinNeighbor = min( MinNeighbor, ( UINT )m_pTileLODs[iTile + m_SqrtNumTiles] );
+
+                if( m_pTileLODs[iTile] > MinNeighbor + 1 )
+                {
+                    m_pTileLODs[iTile] = ( BYTE )( MinNeighbor + 1 );
+                    bChanged = true;
+                }
+            }
+        }
+    }
+
+    UINT NumTriangles = 0;
+    for( UINT z = 0; z < m_SqrtNumTiles; z++ )
+    {
+        for( UINT x = 0; x < m_SqrtNumTiles; x++ )
+        {
+            UINT iTile = z * m_SqrtNumTiles + x;
+            UINT iLOD = m_pTileLODs[iTile];
+            UINT Stitch = 0;
+            if( x > 0 && m_pTileLODs[iTile - 1] > iLOD )
+                Stitch |= TERRAIN_STITCH_LEFT;
+            if( x + 1 < m_SqrtNumTiles && m_pTileLODs[iTile + 1] > iLOD )
+                Stitch |= TERRAIN_STITCH_RIGHT;
+            if( z > 0 && m_pTileLODs[iTile - m_SqrtNumTiles] > iLOD )
+                Stitch |= TERRAIN_STITCH_BOTTOM;
+            if( z + 1 < m_SqrtNumTiles && m_pTileLODs[iTile + m_SqrtNumTiles] > iLOD )
+                Stitch |= TERRAIN_STITCH_TOP;
+
+            m_pTileStitches[iTile] = ( BYTE )Stitch;
+            NumTriangles += m_LODs[iLOD].NumIndices[Stitch] / 3;
+        }
+    }
+
+    return NumTriangles;
+}
+
+
+//--------------------------------------------------------------------------------------
+UINT CTerrain::GetTileForPosition( const D3DXVECTOR3* pPos )
+{
+    float fTilesPerUnit = ( float )m_SqrtNumTiles / m_fWorldScale;
+    int x = ( int )floorf( ( pPos->x + m_fWorldScale / 2.0f ) * fTilesPerUnit );
+    int z = ( int )floorf( ( pPos->z + m_fWorldScale / 2.0f ) * fTilesPerUnit );
+    x = max( 0, min( ( int )m_SqrtNumTiles - 1, x ) );
+    z = max( 0, min( ( int )m_SqrtNumTiles - 1, z ) );
+    return z * m_SqrtNumTiles + x;
+}
+
+
+//--------------------------------------------------------------------------------------
+HRESULT CTerrain::BuildHeightTree()
+{
+    if( !m_pHeightBits || m_HeightMapX < 2 || m_HeightMapY < 2 )
+        return E_FAIL;
+
+    m_TreeLevelWidth[0] = m_HeightMapX - 1;
+    m_TreeLevelHeight[0] = m_HeightMapY - 1;
+    m_TreeLevelOffset[0] = 0;
+    m_NumTreeLevels = 1;
+
+    UINT NumNodes = 0;
+    while( ( m_TreeLevelWidth[m_NumTreeLevels - 1] > 1 || m_TreeLevelHeight[m_NumTreeLevels - 1] > 1 ) &&
+           m_NumTreeLevels < TERRAIN_MAX_TREE_LEVELS )
+    {
+        UINT Level = m_NumTreeLevels;
+        m_TreeLevelWidth[Level] = ( m_TreeLevelWidth[Level - 1] + 1 ) / 2;
+        m_TreeLevelHeight[Level] = ( m_TreeLevelHeight[Level - 1] + 1 ) / 2;
+        m_TreeLevelOffset[Level] = NumNodes;
+        NumNodes += m_TreeLevelWidth[Level] * m_TreeLevelHeight[Level];
+        m_NumTreeLevels++;
+    }
+
+    m_pHeightTree = new HEIGHT_RANGE[ max( NumNodes, 1 ) ];
+    if( !m_pHeightTree )
+        return E_OUTOFMEMORY;
+
+    for( UINT Level = 1; Level < m_NumTreeLevels; Level++ )
+    {
+        HEIGHT_RANGE* pNodes = &m_pHeightTree[ m_TreeLevelOffset[Level] ];
+        for( UINT z = 0; z < m_TreeLevelHeight[Level]; z++ )
+        {
+            for( UINT x = 0; x < m_TreeLevelWidth[Level]; x++ )
+            {
+                HEIGHT_RANGE Range = GetNodeRange( Level - 1, x * 2, z * 2 );
+                for( UINT i = 1; i < 4; i++ )
+                {
+                    UINT cx = x * 2 + ( i & 1 );
+                    UINT cz = z * 2 + ( i >> 1 );
+                    if( cx < m_TreeLevelWidth[Level - 1] && cz < m_TreeLevelHeight[Level - 1] )
+                    {
+                        HEIGHT_RANGE Child = GetNodeRange( Level - 1, cx, cz );
+                        Range.fMin = min( Range.fMin, Child.fMin );
+                        Range.fMax = max( Range.fMax, Child.fMax );
+                    }
+                }
+                pNodes[ z * m_TreeLevelWidth[Level] + x ] = Range;
+            }
+        }
+    }
+
+    return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+HEIGHT_RANGE CTerrain::GetNodeRange( UINT Level, UINT X, UINT Z )
+{
+    HEIGHT_RANGE Range;
+    if( 0 == Level )
+    {
+        float h00 = m_pHeightBits[ HEIGHT_INDEX( X, Z ) ];
+        float h10 = m_pHeightBits[ HEIGHT_INDEX( X + 1, Z ) ];
+        float h01 = m_pHeightBits[ HEIGHT_INDEX( X, Z + 1 ) ];
+        float h11 = m_pHeightBits[ HEIGHT_INDEX( X + 1, Z + 1 ) ];
+        Range.fMin = min( min( h00, h10 ), min( h01, h11 ) );
+        Range.fMax = max( max( h00, h10 ), max( h01, h11 ) );
+    }
+    else
+    {
+        Range = m_pHeightTree[ m_TreeLevelOffset[Level] + Z * m_TreeLevelWidth[Level] + X ];
+    }
+    return Range;
+}
+
+
+// Slack on the ray tests, in world units, so that rounding can't let a ray through a flat
+// cell (whose box has no height) or the seam between two cells
+#define TERRAIN_RAY_EPSILON     1e-3f
+
+//--------------------------------------------------------------------------------------
+// Narrows [*ptEnter, *ptExit] to where the ray is between fMin and fMax on one axis
+//--------------------------------------------------------------------------------------
+bool ClipRayToSlab( float fOrigin, float fDir, float fMin, float fMax, float* ptEnter, float* ptExit )
+{
+    if( 0.0f == fDir )
+        return fOrigin >= fMin && fOrigin <= fMax;
+
+    float fInvDir = 1.0f / fDir;
+    float t0 = ( fMin - fOrigin ) * fInvDir;
+    float t1 = ( fMax - fOrigin ) * fInvDir;
+    if( t0 > t1 )
+    {
+        float t = t0; t0 = t1; t1 = t;
+    }
+    if( t0 > *ptEnter )
+        *ptEnter = t0;
+    if( t1 < *ptExit )
+        *ptExit = t1;
+    return *ptEnter <= *ptExit;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Solves for the ray meeting the bilinear patch of cell X,Z.  Along the ray the patch
+// height is quadratic in t, so the first crossing is the smallest root in the range.
+// A ray that is already under the patch at tEnter hits at tEnter.
+//--------------------------------------------------------------------------------------
+bool CTerrain::IntersectCell( UINT X, UINT Z, const D3DXVECTOR3& vOrigin, const D3DXVECTOR3& vDir, float tEnter,
+                              float tExit, float* pfDist )
+{
+    double h00 = m_pHeightBits[ HEIGHT_INDEX( X, Z ) ];
+    double h10 = m_pHeightBits[ HEIGHT_INDEX( X + 1, Z ) ];
+    double h01 = m_pHeightBits[ HEIGHT_INDEX( X, Z + 1 ) ];
+    double h11 = m_pHeightBits[ HEIGHT_INDEX( X + 1, Z + 1 ) ];
+    double b = h10 - h00;
+    double c = h01 - h00;
+    double d = h00 - h10 - h01 + h11;
+    double px = ( double )vOrigin.x - X;
+    double pz = ( double )vOrigin.z - Z;
+
+    // height - ray y = A t^2 + B t + C
+    double A = d * vDir.x * vDir.z;
+    double B = b * vDir.x + c * vDir.z + d * ( px * vDir.z + pz * vDir.x ) - vDir.y;
+    double C = h00 + b * px + c * pz + d * px * pz - vOrigin.y;
+
+    if( ( A * tEnter + B ) * tEnter + C >= 0.0 )
+    {
+        *pfDist = tEnter;
+        return true;
+    }
+
+    double Roots[2];
+    UINT NumRoots = 0;
+    if( fabs( A ) < 1e-12 )
+    {
+        if( B != 0.0 )
+            Roots[NumRoots++] = -C / B;
+    }
+    else
+    {
+        double Disc = B * B - 4.0 * A * C;
+        if( Disc >= 0.0 )
+        {
+            double q = -0.5 * ( B + ( ( B < 0.0 ) ? -sqrt( Disc ) : sqrt( Disc ) ) );
+            Roots[NumRoots++] = q / A;
+            if( q != 0.0 )
+                Roots[NumRoots++] = C / q;
+        }
+    }
+
+    bool bHit = false;
+    double tBest = tExit + TERRAIN_RAY_EPSILON;
+    for( UINT i = 0; i < NumRoots; i++ )
+    {
+        if( Roots[i] >= tEnter - TERRAIN_RAY_EPSILON && Roots[i] <= tBest )
+        {
+            tBest = Roots[i];
+            bHit = true;
+        }
+    }
+    if( bHit )
+        *pfDist = ( float )max( tBest, 0.0 );
+    return bHit;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Walks the min/max quadtree front to back.  Children are visited nearest first, and a
+// node is skipped when the ray misses its box or enters it beyond the nearest hit so far.
+//--------------------------------------------------------------------------------------
+bool CTerrain::IntersectRay( const D3DXVECTOR3* pOrigin, const D3DXVECTOR3* pDir, float fMaxDist, float* pfDist )
+{
+    if( !m_pHeightTree && FAILED( BuildHeightTree() ) )
+        return false;
+
+    // Move the ray into heightmap space, where cell X,Z spans [X,X+1] by [Z,Z+1] and
+    // heights stay in world units.  The ray parameter is the same in both spaces.
+    float fScaleX = m_HeightMapX / m_fWorldScale;
+    float fScaleZ = m_HeightMapY / m_fWorldScale;
+    D3DXVECTOR3 vOrigin( pOrigin->x * fScaleX + 0.5f * m_HeightMapX + 0.5f, pOrigin->y,
+                         pOrigin->z * fScaleZ + 0.5f * m_HeightMapY + 0.5f );
+    D3DXVECTOR3 vDir( pDir->x * fScaleX, pDir->y, pDir->z * fScaleZ );
+
+    struct TREE_NODE
+    {
+        UINT Level;
+        UINT X;
+        UINT Z;
+        float tEnter;
+        float tExit;
+    };
+    TREE_NODE Stack[ TERRAIN_MAX_TREE_LEVELS * 3 + 1 ];
+    UINT NumStack = 0;
+
+    float tBest = fMaxDist;
+    bool bHit = false;
+
+    TREE_NODE Root;
+    Root.Level = m_NumTreeLevels - 1;
+    Root.X = 0;
+    Root.Z = 0;
+    Root.tEnter = 0.0f;
+    Root.tExit = fMaxDist;
+    HEIGHT_RANGE Range = GetNodeRange( Root.Level, 0, 0 );
+    if( !ClipRayToSlab( vOrigin.x, vDir.x, 0.0f, ( float )m_TreeLevelWidth[0], &Root.tEnter, &Root.tExit ) ||
+        !ClipRayToSlab( vOrigin.z, vDir.z, 0.0f, ( float )m_TreeLevelHeight[0], &Root.tEnter, &Root.tExit ) ||
+        !ClipRayToSlab( vOrigin.y, vDir.y, Range.fMin - TERRAIN_RAY_EPSILON, Range.fMax + TERRAIN_RAY_EPSILON,
+                        &Root.tEnter, &Root.tExit ) )
+        return false;
+    Stack[NumStack++] = Root;
+
+    while( NumStack > 0 )
+    {
+        TREE_NODE Node = Stack[--NumStack];
+        if( Node.tEnter > tBest )
+            continue;
+
+        if( 0 == Node.Level )
+        {
+            float t;
+            if( IntersectCell( Node.X, Node.Z, vOrigin, vDir, Node.tEnter, min( Node.tExit, tBest ), &t ) )
+            {
+                tBest = t;
+                bHit = true;
+            }
+            continue;
+        }
+
+        // Clip the ray to each child and sort the ones it enters by distance
+        TREE_NODE Children[4];
+        UINT NumChildren = 0;
+        UINT Level = Node.Level - 1;
+        for( UINT i = 0; i < 4; i++ )
+        {
+            TREE_NODE Child;
+            Child.Level = Level;
+            Child.X = Node.X * 2 + ( i & 1 );
+            Child.Z = Node.Z * 2 + ( i >> 1 );
+            if( Child.X >= m_TreeLevelWidth[Level] || Child.Z >= m_TreeLevelHeight[Level] )
+                continue;
+
+            float x0 = ( float )( Child.X << Level );
+            float z0 = ( float )( Child.Z << Level );
+            float x1 = ( float )min( ( Child.X + 1 ) << Level, m_TreeLevelWidth[0] );
+            float z1 = ( float )min( ( Child.Z + 1 ) << Level, m_TreeLevelHeight[0] );
+            Range = GetNodeRange( Level, Child.X, Child.Z );
+            Child.tEnter = Node.tEnter;
+            Child.tExit = min( Node.tExit, tBest );
+            if( !ClipRayToSlab( vOrigin.x, vDir.x, x0, x1, &Child.tEnter, &Child.tExit ) ||
+                !ClipRayToSlab( vOrigin.z, vDir.z, z0, z1, &Child.tEnter, &Child.tExit ) ||
+                !ClipRayToSlab( vOrigin.y, vDir.y, Range.fMin - TERRAIN_RAY_EPSILON, Range.fMax + TERRAIN_RAY_EPSILON,
+                                &Child.tEnter, &Child.tExit ) )
+                continue;
+
+            UINT j = NumChildren++;
+            while( j > 0 && Children[j - 1].tEnter > Child.tEnter )
+            {
+                Children[j] = Children[j - 1];
+                j--;
+            }
+            Children[j] = Child;
+        }
+
+        // Farthest first, so the nearest is popped next
+        while( NumChildren > 0 )
+            Stack[NumStack++] = Children[--NumChildren];
+    }
+
+    if( bHit )
+        *pfDist = tBest;
+    return bHit;
+}
+
+
+//--------------------------------------------------------------------------------------
+UINT CTerrain::IntersectRays( const D3DXVECTOR3* pOrigins, const D3DXVECTOR3* pDirs, UINT NumRays, float fMaxDist,
+                              float* pDists )
+{
+    UINT NumHits = 0;
+    for( UINT i = 0; i < NumRays; i++ )
+    {
+        if( IntersectRay( &pOrigins[i], &pDirs[i], fMaxDist, &pDists[i] ) )
+            NumHits++;
+        else
+            pDists[i] = -1.0f;
+    }
+    return NumHits;
+}
@@ -19,6 +19,35 @@ struct BOUNDING_BOX
     D3DXVECTOR3 max;
 };
 
+//--------------------------------------------------------------------------------------
+// Geomipmapping.  Every LOD of a tile is a triangle list into the same tile vertex grid,
+// taking every Step-th vertex.  A tile whose neighbor is one LOD coarser uses the
+// neighbor's step along that edge, so there is a list for each combination of the four
+// TERRAIN_STITCH_ flags.  SelectLODs keeps neighbors within one LOD of each other.
+//--------------------------------------------------------------------------------------
+#define TERRAIN_MAX_LODS        8
+#define TERRAIN_STITCH_LEFT     1       // tile at -x is one LOD coarser
+#define TERRAIN_STITCH_RIGHT    2       // tile at +x
+#define TERRAIN_STITCH_BOTTOM   4       // tile at -z
+#define TERRAIN_STITCH_TOP      8       // tile at +z
+#define TERRAIN_NUM_STITCHES    16
+
+struct TERRAIN_LOD
+{
+    UINT Step;
+    UINT NumIndices[TERRAIN_NUM_STITCHES];
+    SHORT* pIndices[TERRAIN_NUM_STITCHES];
+};
+
+// Min/max heights over a block of heightmap cells
+struct HEIGHT_RANGE
+{
+    float fMin;
+    float fMax;
+};
+
+#define TERRAIN_MAX_TREE_LEVELS 24
+
 struct TERRAIN_TILE
 {
     UINT NumVertices;
@@ -43,6 +72,21 @@ private:
     UINT m_NumIndices;
     SHORT* m_pTerrainRawIndices;
 
+    UINT m_NumLODs;
+    TERRAIN_LOD m_LODs[TERRAIN_MAX_LODS];
+    float* m_pTileLODErrors;            // m_NumTiles * m_NumLODs, world units
+    BOUNDING_BOX* m_pTileBounds;
+    BYTE* m_pTileLODs;                  // chosen by SelectLODs
+    BYTE* m_pTileStitches;
+
+    // Min/max quadtree over the heightmap cells.  Level 0 is the cells themselves and isn't
+    // stored; level k covers 2^k by 2^k cells.
+    UINT m_NumTreeLevels;
+    UINT m_TreeLevelWidth[TERRAIN_MAX_TREE_LEVELS];
+    UINT m_TreeLevelHeight[TERRAIN_MAX_TREE_LEVELS];
+    UINT m_TreeLevelOffset[TERRAIN_MAX_TREE_LEVELS];
+    HEIGHT_RANGE* m_pHeightTree;
+
 public:
                 CTerrain();
                 ~CTerrain();
@@ -53,6 +97,30 @@ public:
     float       GetHeightOnMap( D3DXVECTOR3* pPos );
     D3DXVECTOR3 GetNormalOnMap( D3DXVECTOR3* pPos );
 
+    // Same results as GetHeightOnMap and GetNormalOnMap for each position
+    void        GetHeightsOnMap( const D3DXVECTOR3* pPositions, float* pHeights, UINT NumPositions );
+    void        GetNormalsOnMap( const D3DXVECTOR3* pPositions, D3DXVECTOR3* pNormals, UINT NumPositions );
+
+    // Distance along pDir to the first point where the ray meets the bilinear heightmap
+    // surface, within fMaxDist.  Only the part of the map inside the heightmap samples is
+    // tested.  The min/max quadtree the rays walk is built by the first call.
+    bool        IntersectRay( const D3DXVECTOR3* pOrigin, const D3DXVECTOR3* pDir, float fMaxDist, float* pfDist );
+    // Sets pDists to -1 for the rays that miss and returns the number of hits
+    UINT        IntersectRays( const D3DXVECTOR3* pOrigins, const D3DXVECTOR3* pDirs, UINT NumRays, float fMaxDist,
+                               float* pDists );
+
+    // Builds up to MaxLODs index lists per tile, halving the vertex density or better each
+    // LOD, and measures the height error of each tile at each LOD.  Call after LoadTerrain.
+    HRESULT     CreateLODs( UINT MaxLODs );
+
+    // Picks the coarsest LOD of each tile whose height error projects to no more than
+    // fMaxPixelError pixels on a viewport fViewportHeight pixels high, then refines tiles
+    // until no two neighbors are more than one LOD apart.  Returns the triangle count.
+    UINT        SelectLODs( const D3DXVECTOR3* pEye, float fFovY, float fViewportHeight, float fMaxPixelError );
+
+    // The tile under the given point, clamped to the terrain
+    UINT        GetTileForPosition( const D3DXVECTOR3* pPos );
+
     float       GetWorldScale()
     {
         return m_fWorldScale;
@@ -77,11 +145,47 @@ public:
     {
         return ( m_NumSidesPerTile + 1 ) * ( m_NumSidesPerTile + 1 );
     }
+    UINT        GetNumSidesPerTile()
+    {
+        return m_NumSidesPerTile;
+    }
+    UINT        GetSqrtNumTiles()
+    {
+        return m_SqrtNumTiles;
+    }
+    UINT        GetNumLODs()
+    {
+        return m_NumLODs;
+    }
+    TERRAIN_LOD* GetLOD( UINT iLOD )
+    {
+        return &m_LODs[iLOD];
+    }
+    float       GetTileLODError( UINT iTile, UINT iLOD )
+    {
+        return m_pTileLODErrors[ iTile * m_NumLODs + iLOD ];
+    }
+    UINT        GetTileLOD( UINT iTile )
+    {
+        return m_pTileLODs[iTile];
+    }
+    UINT        GetTileStitch( UINT iTile )
+    {
+        return m_pTileStitches[iTile];
+    }
 
 protected:
     D3DXVECTOR2 GetUVForPosition( D3DXVECTOR3* pPos );
     HRESULT     LoadBMPImage( WCHAR* strHeightMap );
     HRESULT     GenerateTile( TERRAIN_TILE* pTile, BOUNDING_BOX* pBBox );
+    void        GetTileBounds( UINT iTile, BOUNDING_BOX* pBBox );
+    HRESULT     GenerateLODIndices( UINT iLOD, UINT Stitch );
+    void        DestroyLODs();
+    float       SampleHeight( float x, float z );
+    HRESULT     BuildHeightTree();
+    HEIGHT_RANGE GetNodeRange( UINT Level, UINT X, UINT Z );
+    bool        IntersectCell( UINT X, UINT Z, const D3DXVECTOR3& vOrigin, const D3DXVECTOR3& vDir, float tEnter,
+                               float tExit, float* pfDist );
 };
 
 float RPercent();
@@ -0,0 +1,111 @@
+//--------------------------------------------------------------------------------------
+// File: UploadScheduler.cpp
+//
+// Per-frame byte and time budget for the device work the graphics thread does on behalf
+// of the async loader
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#include "DXUT.h"
+#include "UploadScheduler.h"
+
+// Weight of each new measurement in the running averages
+#define UPLOAD_ESTIMATE_WEIGHT      0.1
+
+// Items smaller than this are timed into the fixed cost, larger ones into the byte cost
+#define UPLOAD_SMALL_ITEM_BYTES     65536
+
+// Starting estimates, before anything has been measured
+#define UPLOAD_INITIAL_ITEM_SECONDS 0.00002
+#define UPLOAD_INITIAL_BYTES_PER_SECOND ( 1024.0 * 1024.0 * 1024.0 )
+
+// Limits on the byte cost, so a single odd measurement can't stop uploads altogether
+#define UPLOAD_MIN_BYTES_PER_SECOND ( 16.0 * 1024.0 * 1024.0 )
+#define UPLOAD_MAX_BYTES_PER_SECOND ( 64.0 * 1024.0 * 1024.0 * 1024.0 )
+
+
+//--------------------------------------------------------------------------------------
+CUploadScheduler::CUploadScheduler() : m_fBudgetSeconds( 0.002 ),
+                                       m_MaxBytesPerFrame( 8 * 1024 * 1024 ),
+                                       m_FrameByteAllowance( 0 ),
+                                       m_FrameBytes( 0 ),
+                                       m_fFrameSeconds( 0.0 ),
+                                       m_FrameItems( 0 )
+{
+    ResetEstimates();
+}
+
+
+//--------------------------------------------------------------------------------------
+void CUploadScheduler::SetBudget( float fMilliseconds, UINT64 MaxBytesPerFrame )
+{
+    m_fBudgetSeconds = fMilliseconds / 1000.0;
+    m_MaxBytesPerFrame = MaxBytesPerFrame;
+}
+
+
+//--------------------------------------------------------------------------------------
+void CUploadScheduler::ResetEstimates()
+{
+    m_fItemSeconds = UPLOAD_INITIAL_ITEM_SECONDS;
+    m_fSecondsPerByte = 1.0 / UPLOAD_INITIAL_BYTES_PER_SECOND;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The byte allowance is what the time budget buys at the measured rate, up to the cap
+//--------------------------------------------------------------------------------------
+void CUploadScheduler::BeginFrame()
+{
+    double fBytes = m_fBudgetSeconds / m_fSecondsPerByte;
+    m_FrameByteAllowance = ( fBytes < ( double )m_MaxBytesPerFrame ) ? ( UINT64 )fBytes : m_MaxBytesPerFrame;
+    m_FrameBytes = 0;
+    m_fFrameSeconds = 0.0;
+    m_FrameItems = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+double CUploadScheduler::PredictSeconds( SIZE_T cUploadBytes )
+{
+    return m_fItemSeconds + ( double )cUploadBytes * m_fSecondsPerByte;
+}
+
+
+//--------------------------------------------------------------------------------------
+bool CUploadScheduler::CanProcess( SIZE_T cUploadBytes )
+{
+    // Always make progress
+    if( 0 == m_FrameItems )
+        return true;
+
+    if( m_FrameBytes + cUploadBytes > m_FrameByteAllowance )
+        return false;
+
+    return m_fFrameSeconds + PredictSeconds( cUploadBytes ) <= m_fBudgetSeconds;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Small items mostly measure the fixed cost and large ones the byte cost, so each only
+// updates one term, after taking the current estimate of the other one out
+//--------------------------------------------------------------------------------------
+void CUploadScheduler::OnProcessed( SIZE_T cUploadBytes, double fSeconds )
+{
+    m_FrameBytes += cUploadBytes;
+    m_fFrameSeconds += fSeconds;
+    m_FrameItems ++;
+
+    if( cUploadBytes < UPLOAD_SMALL_ITEM_BYTES )
+    {
+        double fSample = max( 0.0, fSeconds - ( double )cUploadBytes * m_fSecondsPerByte );
+        m_fItemSeconds += UPLOAD_ESTIMATE_WEIGHT * ( fSample - m_fItemSeconds );
+    }
+    else
+    {
+        double fSample = max( 0.0, fSeconds - m_fItemSeconds ) / ( double )cUploadBytes;
+        fSample = max( 1.0 / UPLOAD_MAX_BYTES_PER_SECOND, min( 1.0 / UPLOAD_MIN_BYTES_PER_SECOND, fSample ) );
+        m_fSecondsPerByte += UPLOAD_ESTIMATE_WEIGHT * ( fSample - m_fSecondsPerByte );
+    }
+}
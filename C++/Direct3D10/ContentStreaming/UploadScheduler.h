@@ -0,0 +1,85 @@
+//--------------------------------------------------------------------------------------
+// File: UploadScheduler.h
+//
+// Per-frame byte and time budget for the device work the graphics thread does on behalf
+// of the async loader
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef UPLOAD_SCHEDULER_H
+#define UPLOAD_SCHEDULER_H
+
+// Cap on the bytes uploaded in a frame, whatever the budget allows
+#define UPLOAD_MAX_BYTES_PER_FRAME  ( 8 * 1024 * 1024 )
+
+//--------------------------------------------------------------------------------------
+// Decides how many device work items (locks, and the unlocks or UpdateSubresource calls
+// that upload the data) fit in a frame.  Counting items doesn't work when one item is a
+// 4 KB index buffer and the next a 16 MB texture, so each frame is limited by
+//    time:  the predicted cost of the next item must fit in what is left of the budget
+//    bytes: no more than the budget's worth of data at the measured upload rate, and never
+//           more than the MaxBytesPerFrame cap, since drivers often defer the real copy
+// The cost model is  seconds = ItemSeconds + bytes * SecondsPerByte,  and both terms are
+// running averages of the work items that were timed, so the budget follows the upload
+// rate the machine is actually getting.  The first item of a frame is always let
+// through, so an item larger than the budget is still uploaded on its own frame.
+//
+// The scheduler doesn't reorder work; the loader hands it items highest priority first,
+// which is nearest first and in the frustum first (see GetLoadPriority).
+//--------------------------------------------------------------------------------------
+class CUploadScheduler
+{
+private:
+    double m_fBudgetSeconds;
+    UINT64 m_MaxBytesPerFrame;
+
+    double m_fItemSeconds;          // fixed cost of a work item
+    double m_fSecondsPerByte;       // cost of each uploaded byte
+
+    UINT64 m_FrameByteAllowance;
+    UINT64 m_FrameBytes;
+    double m_fFrameSeconds;
+    UINT m_FrameItems;
+
+public:
+                CUploadScheduler();
+
+    void        SetBudget( float fMilliseconds, UINT64 MaxBytesPerFrame );
+    void        ResetEstimates();
+
+    // Call once a frame before the work items are serviced
+    void        BeginFrame();
+
+    // True if a work item that uploads cUploadBytes (zero for a lock) fits in this frame
+    bool        CanProcess( SIZE_T cUploadBytes );
+
+    // Charges a serviced work item to the frame and folds its time into the estimates
+    void        OnProcessed( SIZE_T cUploadBytes, double fSeconds );
+
+    double      PredictSeconds( SIZE_T cUploadBytes );
+
+    double      GetBytesPerSecond()
+    {
+        return 1.0 / m_fSecondsPerByte;
+    }
+    UINT64      GetFrameByteAllowance()
+    {
+        return m_FrameByteAllowance;
+    }
+    UINT64      GetFrameBytes()
+    {
+        return m_FrameBytes;
+    }
+    double      GetFrameSeconds()
+    {
+        return m_fFrameSeconds;
+    }
+    UINT        GetFrameItems()
+    {
+        return m_FrameItems;
+    }
+};
+
+#endif
@@ -18,6 +18,7 @@
 #include "utils.h"
 #include "BC6HEncodeDecode.h"
 #include "BC7EncodeDecode.h"
+#include "CPUEncodeDecode.h"
 
 
 ID3D11Device*               g_pDevice = NULL;
@@ -31,6 +32,8 @@ CGPUBC6HDecoder             g_GPUBC6HDecoder;
 CGPUBC7Encoder              g_GPUBC7Encoder;
 CGPUBC7Decoder              g_GPUBC7Decoder;
 
+CCPUBCEncoderDecoder        g_CPUEncoderDecoder;
+
 HRESULT EncodeDecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture );
 HRESULT EncodeDecodeBC6H( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture );
 HRESULT DecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture );
@@ -38,7 +41,8 @@ HRESULT DecodeBC6H( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture );
 
 HRESULT CPU_EncodeDecode( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
                           ID3D11Texture2D* pSrcTexture,
-                          DXGI_FORMAT dstFormat, ID3D11Texture2D** ppDstTextureOut );
+                          DXGI_FORMAT dstFormat, ID3D11Texture2D** ppDstTextureOut,
+                          double* pfMPixelsPerSec = NULL );
 
 struct CCommandLineOptions
 {
@@ -54,12 +58,16 @@ struct CCommandLineOptions
     BOOL bShowReconstructionError;
     BOOL bSaveReconstructionFile;
     bool bForceCPU;
+    BC7_QUALITY bc7Quality;
+    BOOL bCompareBC7Quality;
 
     CCommandLineOptions() :
         mode(MODE_NOT_SET),
         bShowReconstructionError(FALSE),
         bSaveReconstructionFile(FALSE),
-        bForceCPU(FALSE)
+        bForceCPU(FALSE),
+        bc7Quality(BC7_QUALITY_EXHAUSTIVE),
+        bCompareBC7Quality(FALSE)
     {
     }
 
@@ -84,6 +92,7 @@ VOID Cleanup()
     g_GPUBC6HDecoder.Cleanup();
     g_GPUBC7Encoder.Cleanup();
     g_GPUBC7Decoder.Cleanup();
+    g_CPUEncoderDecoder.Cleanup();
     SAFE_RELEASE( g_pSourceTexture );
     SAFE_RELEASE( g_pContext );
     SAFE_RELEASE( g_pDevice );
@@ -126,6 +135,22 @@ BOOL ParseCommandLine( int argc, WCHAR* argv[] )
         {
             g_CommandLineOptions.bSaveReconstructionFile = TRUE;
         } else
+        if ( wcscmp( argv[i], L"/q:fast" ) == 0 )
+        {
+            g_CommandLineOptions.bc7Quality = BC7_QUALITY_FAST;
+        } else
+        if ( wcscmp( argv[i], L"/q:normal" ) == 0 )
+        {
+            g_CommandLineOptions.bc7Quality = BC7_QUALITY_NORMAL;
+        } else
+        if ( wcscmp( argv[i], L"/q:exhaustive" ) == 0 )
+        {
+            g_CommandLineOptions.bc7Quality = BC7_QUALITY_EXHAUSTIVE;
+        } else
+        if ( wcscmp( argv[i], L"/qcompare" ) == 0 )
+        {
+            g_CommandLineOptions.bCompareBC7Quality = TRUE;
+        } else
         if ( argv[i][0] == L'/' )
         {
             wprintf( L"Unknown option %s\n", argv[i] );
@@ -158,7 +183,11 @@ int __cdecl wmain(int argc, WCHAR* argv[])
 
         printf( "\t/cpu\t\tForce to use CPU encoder and decoder\n" );
         printf( "\t/sre\t\tShow reconstruction error\n" );
-        printf( "\t/srf\t\tSave reconstruction file\n\n" );
+        printf( "\t/srf\t\tSave reconstruction file\n" );
+        printf( "\t/q:fast\t\tBC7 only, try fewer modes, and only on the blocks that need them\n" );
+        printf( "\t/q:normal\tBC7 only, try all modes, but only on the blocks that need them\n" );
+        printf( "\t/q:exhaustive\tBC7 only, try all modes on every block, this is the default\n" );
+        printf( "\t/qcompare\tBC7 only, also encode at every quality level and show PSNR and time\n\n" );
 
         printf( "\t/sre and /srf are only valid when encoding textures. \n\n\tAfter encoding to BC6H or BC7, \
 /sre decodes the encoded texture and then compares this reconstructed texture with original input texture, and output the L2 error and bias. \
@@ -207,12 +236,17 @@ You can choose to save this reconstructed texture using /srf\n\n" );
                 return 1;
         }
 
+        g_CPUEncoderDecoder.Initialize();
+
         if ( g_CommandLineOptions.bForceCPU )
-            printf( "Forcing CPU encoder, might be very very slow\n" );
+            printf( "Forcing CPU encoder, using %u threads\n", g_CPUEncoderDecoder.GetNumThreads() );
         else
-            printf( "No, using CPU encoder, might be very very slow\n" );
+            printf( "No, using CPU encoder on %u threads\n", g_CPUEncoderDecoder.GetNumThreads() );
     }
 
+    g_GPUBC7Encoder.SetQuality( g_CommandLineOptions.bc7Quality );
+    g_CPUEncoderDecoder.SetBC7Quality( g_CommandLineOptions.bc7Quality );
+
     // Process the input files
     for ( int i = 1; i < argc; ++i )
     {
@@ -382,10 +416,11 @@ void BC6HAnalyzeAndDisplayResult( ID3D11Device* pd3dDevice,
     delete[] pDataRestoredByte;
 }
 
-void BC7AnalyzeAndDisplayResult( ID3D11Device* pd3dDevice,
-                                ID3D11DeviceContext* pd3dContext,
-                                ID3D11Texture2D* pSourceTexture,
-                                ID3D11Texture2D* pRestoredTexture )
+void BC7ComputeError( ID3D11Device* pd3dDevice,
+                      ID3D11DeviceContext* pd3dContext,
+                      ID3D11Texture2D* pSourceTexture,
+                      ID3D11Texture2D* pRestoredTexture,
+                      double* pfError, double* pfBias )
 {
     D3D11_TEXTURE2D_DESC texSrcDesc;
     pSourceTexture->GetDesc(&texSrcDesc);
@@ -416,13 +451,105 @@ void BC7AnalyzeAndDisplayResult( ID3D11Device* pd3dDevice,
     bias /= texSrcDesc.Width * texSrcDesc.Height * 4;
     error = sqrt( error / (texSrcDesc.Width * texSrcDesc.Height * 4) );
 
+    *pfError = error;
+    *pfBias = bias;
+
+    delete[] pDataSource;
+    delete[] pDataRestored;
+}
+
+void BC7AnalyzeAndDisplayResult( ID3D11Device* pd3dDevice,
+                                ID3D11DeviceContext* pd3dContext,
+                                ID3D11Texture2D* pSourceTexture,
+                                ID3D11Texture2D* pRestoredTexture )
+{
+    double bias = 0;
+    double error = 0;
+    BC7ComputeError( pd3dDevice, pd3dContext, pSourceTexture, pRestoredTexture, &error, &bias );
+
     printf( "\n" );
     printf( "Image Encode-Decode L2 Error ( sqrt(ave((r-t)^2)) ): %.10f\n", error );
     printf( "Image Encode-Decode Bias ( ave(r-t) ): %.10f\n", bias );
     printf( "\n" );
+}
 
-    delete[] pDataSource;
-    delete[] pDataRestored;
+//--------------------------------------------------------------------------------------
+// Encodes pSourceTexture at every BC7 quality level and prints the PSNR and encoding
+// time of each, then restores the quality level chosen on the command line
+//--------------------------------------------------------------------------------------
+HRESULT CompareBC7QualityLevels( ID3D11Texture2D* pSourceTexture )
+{
+    HRESULT hr = S_OK;
+
+    D3D11_TEXTURE2D_DESC srcTexDesc;
+    pSourceTexture->GetDesc( &srcTexDesc );
+
+    ID3D11Query* pEventQuery = NULL;
+    ID3D11Texture2D* pTexEncoded = NULL;
+    ID3D11Texture2D* pTexRestored = NULL;
+    LARGE_INTEGER liFreq, liStart, liStop;
+
+    D3D11_QUERY_DESC queryDesc;
+    queryDesc.Query = D3D11_QUERY_EVENT;
+    queryDesc.MiscFlags = 0;
+    V_RETURN( g_pDevice->CreateQuery( &queryDesc, &pEventQuery ) );
+
+    QueryPerformanceFrequency( &liFreq );
+
+    printf( "\tComparing BC7 quality levels...\n" );
+    for ( UINT q = 0; q < BC7_QUALITY_COUNT; ++q )
+    {
+        BC7_QUALITY quality = (BC7_QUALITY)q;
+        ID3D11Texture2D* pRestored = NULL;
+
+        if ( g_bCS4xAvailable )
+        {
+            g_GPUBC7Encoder.SetQuality( quality );
+
+            // Wait for the GPU to go idle before and after, so only the encoding is timed
+            g_pContext->End( pEventQuery );
+            while ( S_FALSE == g_pContext->GetData( pEventQuery, NULL, 0, 0 ) );
+
+            QueryPerformanceCounter( &liStart );
+            V_GOTO( g_GPUBC7Encoder.GPU_BC7EncodeInternal( pSourceTexture, DXGI_FORMAT_BC7_UNORM ) );
+            g_pContext->End( pEventQuery );
+            while ( S_FALSE == g_pContext->GetData( pEventQuery, NULL, 0, 0 ) );
+            QueryPerformanceCounter( &liStop );
+
+            V_GOTO( g_GPUBC7Decoder.GPU_BC7DecodeAndSaveInternal( g_GPUBC7Encoder.GetEncodedTextureAsBuf(),
+                                                                  srcTexDesc.Width, srcTexDesc.Height,
+                                                                  DXGI_FORMAT_BC7_UNORM, NULL ) );
+            pRestored = g_GPUBC7Decoder.GetRestoredTexture();
+        } else
+        {
+            g_CPUEncoderDecoder.SetBC7Quality( quality );
+
+            QueryPerformanceCounter( &liStart );
+            V_GOTO( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_BC7_UNORM, &pTexEncoded ) );
+            QueryPerformanceCounter( &liStop );
+
+            V_GOTO( CPU_EncodeDecode( g_pDevice, g_pContext, pTexEncoded, DXGI_FORMAT_R8G8B8A8_UNORM, &pTexRestored ) );
+            pRestored = pTexRestored;
+        }
+
+        double error = 0;
+        double bias = 0;
+        BC7ComputeError( g_pDevice, g_pContext, pSourceTexture, pRestored, &error, &bias );
+
+        double fPSNR = error > 0 ? 20.0 * log10( 255.0 / error ) : 99.99;
+        double fMilliseconds = (double)( liStop.QuadPart - liStart.QuadPart ) * 1000.0 / (double)liFreq.QuadPart;
+        printf( "\t\t%-10s  PSNR %6.2f dB  %10.1f ms\n", GetBC7QualitySettings( quality ).strName, fPSNR, fMilliseconds );
+    }
+
+quit:
+    g_GPUBC7Encoder.SetQuality( g_CommandLineOptions.bc7Quality );
+    g_CPUEncoderDecoder.SetBC7Quality( g_CommandLineOptions.bc7Quality );
+
+    SAFE_RELEASE( pTexEncoded );
+    SAFE_RELEASE( pTexRestored );
+    SAFE_RELEASE( pEventQuery );
+
+    return hr;
 }
 
 HRESULT EncodeDecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture )
@@ -440,6 +567,9 @@ HRESULT EncodeDecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture
     fname.erase( pos + 1, fname.length() );
     fname += std::wstring( L"dds" );
 
+    if ( g_CommandLineOptions.bCompareBC7Quality )
+        V_RETURN( CompareBC7QualityLevels( pSourceTexture ) );
+
     if ( g_bCS4xAvailable )
     {
         // GPU path
@@ -465,9 +595,10 @@ HRESULT EncodeDecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture
 
         ID3D11Texture2D* pTexEncoded = NULL;
         ID3D11Texture2D* pTexRestored = NULL;
+        double fMPixelsPerSec = 0;
         printf( "\tEncoding to BC7..." );
-        V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_BC7_UNORM, &pTexEncoded ) );
-        printf( "done\n" );
+        V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_BC7_UNORM, &pTexEncoded, &fMPixelsPerSec ) );
+        printf( "done (%.2f MP/s)\n", fMPixelsPerSec );
 
         wprintf( L"\tSaving to %s...", &fname[0] );
         D3DX11SaveTextureToFile( g_pContext, pTexEncoded, D3DX11_IFF_DDS, &fname[0] );
@@ -478,8 +609,8 @@ HRESULT EncodeDecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture
             fname.insert( fname.rfind( '.' ), L"_Restored" );
 
             printf( "\tDecoding from BC7..." );
-            V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pTexEncoded, DXGI_FORMAT_R8G8B8A8_UNORM, &pTexRestored ) );
-            printf( "done\n" );
+            V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pTexEncoded, DXGI_FORMAT_R8G8B8A8_UNORM, &pTexRestored, &fMPixelsPerSec ) );
+            printf( "done (%.2f MP/s)\n", fMPixelsPerSec );
 
             if ( g_CommandLineOptions.bSaveReconstructionFile )
             {
@@ -543,10 +674,11 @@ HRESULT EncodeDecodeBC6H( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture
 
         ID3D11Texture2D* pTexEncoded = NULL;
         ID3D11Texture2D* pTexRestored = NULL;
+        double fMPixelsPerSec = 0;
         printf( "\tEncoding to BC6H..." );
         V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture,
-            g_CommandLineOptions.mode == CCommandLineOptions::MODE_ENCODE_BC6HS ? DXGI_FORMAT_BC6H_SF16 : DXGI_FORMAT_BC6H_UF16, &pTexEncoded ) );
-        printf( "done\n" );
+            g_CommandLineOptions.mode == CCommandLineOptions::MODE_ENCODE_BC6HS ? DXGI_FORMAT_BC6H_SF16 : DXGI_FORMAT_BC6H_UF16, &pTexEncoded, &fMPixelsPerSec ) );
+        printf( "done (%.2f MP/s)\n", fMPixelsPerSec );
 
         wprintf( L"\tSaving to %s...", &fname[0] );
         D3DX11SaveTextureToFile( g_pContext, pTexEncoded, D3DX11_IFF_DDS, &fname[0] );
@@ -557,8 +689,8 @@ HRESULT EncodeDecodeBC6H( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture
             fname.insert( fname.rfind( '.' ), L"_Restored" );
 
             printf( "\tDecoding from BC6H..." );
-            V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pTexEncoded, DXGI_FORMAT_R32G32B32A32_FLOAT, &pTexRestored ) );
-            printf( "done\n" );
+            V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pTexEncoded, DXGI_FORMAT_R32G32B32A32_FLOAT, &pTexRestored, &fMPixelsPerSec ) );
+            printf( "done (%.2f MP/s)\n", fMPixelsPerSec );
 
             if ( g_CommandLineOptions.bSaveReconstructionFile )
             {
@@ -593,9 +725,10 @@ HRESULT DecodeBC7( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture )
     } else
     {
         ID3D11Texture2D* pTexRestored = NULL;
+        double fMPixelsPerSec = 0;
         printf( "\tDecoding from BC7..." );
-        V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_R8G8B8A8_UNORM, &pTexRestored ) );
-        printf( "done\n" );
+        V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_R8G8B8A8_UNORM, &pTexRestored, &fMPixelsPerSec ) );
+        printf( "done (%.2f MP/s)\n", fMPixelsPerSec );
 
         wprintf( L"\tSaving to %s...", &fname[0] );
         D3DX11SaveTextureToFile( g_pContext, pTexRestored, D3DX11_IFF_DDS, &fname[0] );
@@ -619,9 +752,10 @@ HRESULT DecodeBC6H( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture )
     } else
     {
         ID3D11Texture2D* pTexRestored = NULL;
+        double fMPixelsPerSec = 0;
         printf( "\tDecoding from BC6H..." );
-        V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_R32G32B32A32_FLOAT, &pTexRestored ) );
-        printf( "done\n" );
+        V_RETURN( CPU_EncodeDecode( g_pDevice, g_pContext, pSourceTexture, DXGI_FORMAT_R32G32B32A32_FLOAT, &pTexRestored, &fMPixelsPerSec ) );
+        printf( "done (%.2f MP/s)\n", fMPixelsPerSec );
 
         wprintf( L"\tSaving to %s...", &fname[0] );
         D3DX11SaveTextureToFile( g_pContext, pTexRestored, D3DX11_IFF_DDS, &fname[0] );
@@ -634,13 +768,20 @@ HRESULT DecodeBC6H( WCHAR* strSrcFilename, ID3D11Texture2D* pSourceTexture )
 
 HRESULT CPU_EncodeDecode( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
                           ID3D11Texture2D* pSrcTexture,
-                          DXGI_FORMAT dstFormat, ID3D11Texture2D** ppDstTextureOut )
+                          DXGI_FORMAT dstFormat, ID3D11Texture2D** ppDstTextureOut,
+                          double* pfMPixelsPerSec )
 {
     HRESULT hr = S_OK;
 
     D3D11_TEXTURE2D_DESC texDesc;
     pSrcTexture->GetDesc( &texDesc );
 
+    // Our own multithreaded codec covers every conversion this sample does,
+    // D3DX is kept for anything else
+    if ( CCPUBCEncoderDecoder::IsSupported( texDesc.Format, dstFormat ) && texDesc.ArraySize == 1 )
+        return g_CPUEncoderDecoder.EncodeDecode( pDevice, pContext, pSrcTexture, dstFormat,
+                                                 ppDstTextureOut, pfMPixelsPerSec );
+
     texDesc.Format = dstFormat;
     SAFE_RELEASE( *ppDstTextureOut );
     V_RETURN( pDevice->CreateTexture2D( &texDesc, NULL, ppDstTextureOut ) );
@@ -661,10 +802,20 @@ HRESULT CPU_EncodeDecode( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
     tex_load_info.Filter = D3DX11_DEFAULT;
     tex_load_info.MipFilter = D3DX11_DEFAULT;
 
+    LARGE_INTEGER liFreq, liStart, liStop;
+    QueryPerformanceFrequency( &liFreq );
+    QueryPerformanceCounter( &liStart );
     hr = D3DX11LoadTextureFromTexture( pContext, pSrcTexture, &tex_load_info, *ppDstTextureOut );
+    QueryPerformanceCounter( &liStop );
     if ( FAILED( hr ) )
         SAFE_RELEASE( *ppDstTextureOut );
 
+    if ( pfMPixelsPerSec )
+    {
+        double fSeconds = (double)( liStop.QuadPart - liStart.QuadPart ) / (double)liFreq.QuadPart;
+        *pfMPixelsPerSec = fSeconds > 0 ? (double)texDesc.Width * texDesc.Height / fSeconds / 1000000.0 : 0;
+    }
+
     return hr;
 }
 
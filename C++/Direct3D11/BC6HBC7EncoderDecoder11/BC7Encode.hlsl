@@ -181,6 +181,9 @@ cbuffer cbCS : register( b0 )
     uint g_mode_id;
     uint g_start_block_id;
     uint g_num_total_blocks;
+    uint g_error_threshold;
+    uint g_min_variance_3subsets;
+    uint g_skip_opaque_modes_on_alpha;
 };
 
 //Forward declaration
@@ -246,6 +249,45 @@ struct BufferShared
 };
 groupshared BufferShared shared_temp[THREAD_GROUP_SIZE];
 
+//Whether the partitioned mode being tried can be skipped for a block
+//whose pixels have been loaded into shared_temp
+bool skip_block( uint blockID, uint threadBase, bool opaque_mode )
+{
+    if ( g_InBuff[blockID].x <= g_error_threshold )
+    {
+        return true;
+    }
+
+    if ( g_skip_opaque_modes_on_alpha && opaque_mode )
+    {
+        for ( uint i = 0; i < 16; i ++ )
+        {
+            if ( shared_temp[threadBase + i].pixel.a != 255 )
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+//Sum of the squared distances of the RGB of the pixels from their mean
+uint block_variance( uint threadBase )
+{
+    uint3 sum = 0;
+    uint3 sum_sqr = 0;
+    for ( uint i = 0; i < 16; i ++ )
+    {
+        uint3 pixel = shared_temp[threadBase + i].pixel.rgb;
+        sum += pixel;
+        sum_sqr += pixel * pixel;
+    }
+
+    uint3 variance = sum_sqr - sum * sum / 16;
+    return variance.r + variance.g + variance.b;
+}
+
 [numthreads( THREAD_GROUP_SIZE, 1, 1 )]
 void TryMode456CS( uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID )
 {
@@ -574,10 +616,14 @@ void TryMode137CS( uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID )
 
     shared_temp[GI].error = 0xFFFFFFFF;
 
+    // Below the exhaustive quality level a block may keep the mode it has so far, see BC7Quality.h.
+    // A skipped block keeps every candidate error at 0xFFFFFFFF, so g_InBuff is passed through.
+    bool skip = skip_block( blockID, threadBase, g_mode_id != 7 );
+
     uint4 pixel_r;
     uint2x4 endPoint[2];
     uint color_index;
-    if (threadInBlock < 64)
+    if (threadInBlock < 64 && !skip)
     {
         uint partition = threadInBlock;
         uint error = 0;
@@ -810,6 +856,12 @@ void TryMode02CS( uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID )
         num_partitions = 64;
     }
 
+    // Same as in TryMode137CS, and smooth blocks gain little from a third subset
+    if ( skip_block( blockID, threadBase, true ) || block_variance( threadBase ) < g_min_variance_3subsets )
+    {
+        num_partitions = 0;
+    }
+
     uint4 pixel_r;
     uint2x4 endPoint[3];
     uint color_index[16];
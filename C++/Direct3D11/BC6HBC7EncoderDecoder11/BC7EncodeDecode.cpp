@@ -76,6 +76,13 @@ HRESULT CGPUBC7Encoder::GPU_BC7EncodeAndSave( ID3D11Texture2D* pSourceTexture, D
     return hr;
 }
 
+HRESULT CGPUBC7Encoder::GPU_BC7EncodeInternal( ID3D11Texture2D* pSourceTexture, DXGI_FORMAT fmtEncode )
+{
+    SAFE_RELEASE( m_pEncodedTextureAsBuf );
+
+    return GPU_BC7Encode( m_pDevice, m_pContext, pSourceTexture, fmtEncode, &m_pEncodedTextureAsBuf );
+}
+
 HRESULT CGPUBC7Encoder::GPU_SaveToFile( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
                                         ID3D11Texture2D* pSrcTexture,
                                         WCHAR* strFilename,
@@ -178,6 +185,8 @@ HRESULT CGPUBC7Encoder::GPU_BC7Encode( ID3D11Device* pDevice, ID3D11DeviceContex
 
     HRESULT hr = S_OK;
 
+    const BC7_QUALITY_SETTINGS& quality = GetBC7QualitySettings( m_Quality );
+
     // Create a SRV for input texture
     {
         D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc;
@@ -265,7 +274,7 @@ HRESULT CGPUBC7Encoder::GPU_BC7Encode( ID3D11Device* pDevice, ID3D11DeviceContex
         cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
         cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
         cbDesc.MiscFlags = 0;
-        cbDesc.ByteWidth = sizeof( UINT ) * 8;
+        cbDesc.ByteWidth = sizeof( UINT ) * 12;
         V_GOTO( pDevice->CreateBuffer( &cbDesc, NULL, &pCBCS ) );
 
 #if defined(DEBUG) || defined(PROFILE)
@@ -284,17 +293,21 @@ HRESULT CGPUBC7Encoder::GPU_BC7Encode( ID3D11Device* pDevice, ID3D11DeviceContex
         int n = min(num_blocks, MAX_BLOCK_BATCH);
         UINT uThreadGroupCount = n;
 
+        UINT param[12];
+        param[0] = texSrcDesc.Width;
+        param[1] = texSrcDesc.Width / BLOCK_SIZE_X;
+        param[2] = dstFormat;// fixed a bug in v0.2
+        param[3] = 0;
+        param[4] = start_block_id;
+        param[5] = num_total_blocks;
+        param[6] = quality.uErrorThreshold;
+        param[7] = quality.uMinVariance3Subsets;
+        param[8] = quality.bSkipOpaqueModesOnAlpha;
+        param[9] = param[10] = param[11] = 0;
+
         {
             D3D11_MAPPED_SUBRESOURCE cbMapped;
             pContext->Map( pCBCS, 0, D3D11_MAP_WRITE_DISCARD, 0, &cbMapped );
-
-            UINT param[8];
-            param[0] = texSrcDesc.Width;
-            param[1] = texSrcDesc.Width / BLOCK_SIZE_X;
-            param[2] = dstFormat;// fixed a bug in v0.2
-            param[3] = 0;
-            param[4] = start_block_id;
-            param[5] = num_total_blocks;
             memcpy( cbMapped.pData, param, sizeof( param ) );
             pContext->Unmap( pCBCS, 0 );
         }
@@ -302,51 +315,31 @@ HRESULT CGPUBC7Encoder::GPU_BC7Encode( ID3D11Device* pDevice, ID3D11DeviceContex
         ID3D11ShaderResourceView* pSRVs[] = { pSRV, NULL };
         RunComputeShader( pContext, m_pTryMode456CS, pSRVs, 2, pCBCS, pErrBestModeUAV[0], uThreadGroupCount / 4, 1, 1 );
 
-        for (int i = 0; i < 3; ++ i)
+        // The best mode so far ping-pongs between the two buffers, starting in buffer 0.
+        // Modes the quality level leaves out are not dispatched at all.
+        UINT uCurrent = 0;
+        int modes[] = { 1, 3, 7, 0, 2 };
+        for (int i = 0; i < 5; ++ i)
         {
-            int modes[] = { 1, 3, 7 };
-            {
-                D3D11_MAPPED_SUBRESOURCE cbMapped;
-                pContext->Map( pCBCS, 0, D3D11_MAP_WRITE_DISCARD, 0, &cbMapped );
-
-                UINT param[8];
-                param[0] = texSrcDesc.Width;
-                param[1] = texSrcDesc.Width / BLOCK_SIZE_X;
-                param[2] = dstFormat;// fixed a bug in v0.2
-                param[3] = modes[i];
-                param[4] = start_block_id;
-                param[5] = num_total_blocks;
-                memcpy( cbMapped.pData, param, sizeof( param ) );
-                pContext->Unmap( pCBCS, 0 );
-            }
+            if ( !( quality.uModeMask & ( 1 << modes[i] ) ) )
+                continue;
 
-            pSRVs[1] = pErrBestModeSRV[i & 1];
-            RunComputeShader( pContext, m_pTryMode137CS, pSRVs, 2, pCBCS,  pErrBestModeUAV[!(i & 1)], uThreadGroupCount, 1, 1 );
-        }
-
-        for (int i = 0; i < 2; ++ i)
-        {
-            int modes[] = { 0, 2 };
             {
                 D3D11_MAPPED_SUBRESOURCE cbMapped;
                 pContext->Map( pCBCS, 0, D3D11_MAP_WRITE_DISCARD, 0, &cbMapped );
 
-                UINT param[8];
-                param[0] = texSrcDesc.Width;
-                param[1] = texSrcDesc.Width / BLOCK_SIZE_X;
-                param[2] = dstFormat;// fixed a bug in v0.2
                 param[3] = modes[i];
-                param[4] = start_block_id;
-                param[5] = num_total_blocks;
                 memcpy( cbMapped.pData, param, sizeof( param ) );
                 pContext->Unmap( pCBCS, 0 );
             }
 
-            pSRVs[1] = pErrBestModeSRV[!(i & 1)];
-            RunComputeShader( pContext, m_pTryMode02CS, pSRVs, 2, pCBCS,  pErrBestModeUAV[i & 1], uThreadGroupCount, 1, 1 );
+            pSRVs[1] = pErrBestModeSRV[uCurrent];
+            RunComputeShader( pContext, ( modes[i] == 0 || modes[i] == 2 ) ? m_pTryMode02CS : m_pTryMode137CS,
+                              pSRVs, 2, pCBCS, pErrBestModeUAV[!uCurrent], uThreadGroupCount, 1, 1 );
+            uCurrent = !uCurrent;
         }
 
-        pSRVs[1] = pErrBestModeSRV[1];
+        pSRVs[1] = pErrBestModeSRV[uCurrent];
         RunComputeShader( pContext, m_pEncodeBlockCS, pSRVs, 2, pCBCS,  pUAV, uThreadGroupCount / 4, 1, 1 );
 
         start_block_id += n;
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include "BC7Quality.h"
 
 class CGPUBC7Encoder
 {
@@ -22,7 +23,8 @@ public:
         m_pTryMode137CS( NULL ),
         m_pTryMode02CS( NULL ),
         m_pEncodeBlockCS( NULL ),
-        m_pEncodedTextureAsBuf( NULL )
+        m_pEncodedTextureAsBuf( NULL ),
+        m_Quality( BC7_QUALITY_EXHAUSTIVE )
     {}
 
     HRESULT Initialize( ID3D11Device* pDevice, ID3D11DeviceContext* pContext );
@@ -36,8 +38,17 @@ public:
     HRESULT GPU_BC7EncodeAndSave( ID3D11Texture2D* pSourceTexture,
                                   DXGI_FORMAT fmtEncode, WCHAR* strDstFilename );
 
+    //--------------------------------------------------------------------------------------
+    // Encode the pSourceTexture to BC7 format using CS acceleration without saving it,
+    // the result is left in GetEncodedTextureAsBuf()
+    //--------------------------------------------------------------------------------------
+    HRESULT GPU_BC7EncodeInternal( ID3D11Texture2D* pSourceTexture, DXGI_FORMAT fmtEncode );
+
     ID3D11Buffer* GetEncodedTextureAsBuf() { return m_pEncodedTextureAsBuf; }
 
+    void SetQuality( BC7_QUALITY quality ) { m_Quality = quality; }
+    BC7_QUALITY GetQuality() { return m_Quality; }
+
 protected:
     ID3D11Device* m_pDevice;
     ID3D11DeviceContext* m_pContext;
@@ -46,6 +57,7 @@ protected:
     ID3D11ComputeShader* m_pTryMode02CS;
     ID3D11ComputeShader* m_pEncodeBlockCS;
     ID3D11Buffer* m_pEncodedTextureAsBuf;
+    BC7_QUALITY m_Quality;
 
     HRESULT GPU_BC7Encode( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
                            ID3D11Texture2D* pSrcTexture,
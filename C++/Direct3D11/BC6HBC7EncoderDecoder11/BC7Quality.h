@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------
+// File: BC7Quality.h
+//
+// Quality levels shared by the GPU and CPU BC7 encoders
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#ifndef __BC7QUALITY_H
+#define __BC7QUALITY_H
+
+#pragma once
+
+enum BC7_QUALITY
+{
+    BC7_QUALITY_FAST,
+    BC7_QUALITY_NORMAL,
+    BC7_QUALITY_EXHAUSTIVE,
+    BC7_QUALITY_COUNT
+};
+
+//--------------------------------------------------------------------------------------
+// Modes 4, 5 and 6 are always tried first.  The partitioned modes that follow only run
+// on the blocks where they can still make a difference:
+// - a block whose best error so far is at most uErrorThreshold is left alone,
+// - a block with less RGB variance than uMinVariance3Subsets skips modes 0 and 2,
+// - with bSkipOpaqueModesOnAlpha a block that is not fully opaque skips modes 0 to 3,
+//   which always decode alpha as 255.
+// The errors are sums of squared differences over the 16 texels, and the variance is
+// the sum of squared distances of the texels from their mean color.
+//--------------------------------------------------------------------------------------
+struct BC7_QUALITY_SETTINGS
+{
+    const char* strName;
+    UINT uModeMask;                 // bit i set means mode i is tried, 4, 5 and 6 are always tried
+    UINT uErrorThreshold;
+    UINT uMinVariance3Subsets;
+    BOOL bSkipOpaqueModesOnAlpha;
+};
+
+inline const BC7_QUALITY_SETTINGS& GetBC7QualitySettings( BC7_QUALITY quality )
+{
+    static const BC7_QUALITY_SETTINGS s_settings[BC7_QUALITY_COUNT] =
+    {
+        { "fast",       0xF2, 16 * 16, 0xFFFFFFFF, TRUE },
+        { "normal",     0xFF, 16 * 4,  16 * 64,    TRUE },
+        { "exhaustive", 0xFF, 0,       0,          FALSE },
+    };
+
+    return s_settings[quality < BC7_QUALITY_COUNT ? quality : BC7_QUALITY_EXHAUSTIVE];
+}
+
+#endif
@@ -0,0 +1,1203 @@
+//--------------------------------------------------------------------------------------
+// File: CPUBC6HEncodeDecode.cpp
+//
+// CPU BC6H block Encoder/Decoder
+//
+// This is a port of BC6HEncode.hlsl and BC6HDecode.hlsl.  The candidates that the GPU
+// encoder spreads over threads (the four one-region modes, and the 32 partitions of
+// each two-region mode) are evaluated one after another and reduced in the same order,
+// so the CPU picks the same mode and partition.  The index search handles 4 texels at
+// a time with SSE2.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <windows.h>
+#include <emmintrin.h>
+#include "CPUBC6HEncodeDecode.h"
+
+#define MAX_INT             0x7FFFFFFF
+#define MIN_INT             ( -MAX_INT - 1 )
+
+static const UINT candidateModeMemory[14] = { 0x00, 0x01,
+    0x02, 0x06, 0x0A, 0x0E, 0x12, 0x16, 0x1A, 0x1E, 0x03, 0x07, 0x0B, 0x0F };
+static const BOOL candidateModeTransformed[14] = { TRUE, TRUE, TRUE, TRUE, TRUE, TRUE, TRUE, TRUE, TRUE, FALSE, FALSE, TRUE, TRUE, TRUE };
+static const UINT candidateModePrec[14][4] = { {10,5,5,5}, {7,6,6,6},
+    {11,5,4,4}, {11,4,5,4}, {11,4,4,5}, {9,5,5,5},
+    {8,6,5,5}, {8,5,6,5}, {8,5,5,6}, {6,6,6,6},
+    {10,10,10,10}, {11,9,9,9}, {12,8,8,8}, {16,4,4,4} };
+
+static const UINT candidateSectionBit[32] =
+{
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8,
+    0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+    0xC800, 0xFFEC, 0xFE80, 0xE800,
+    0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE,
+    0x008C, 0x7310, 0x3100, 0x8CCE,
+    0x088C, 0x3110, 0x6666, 0x366C,
+    0x17E8, 0x0FF0, 0x718E, 0x399C
+};
+
+static const UINT candidateFixUpIndex1D[32] =
+{
+    15,15,15,15,
+    15,15,15,15,
+    15,15,15,15,
+    15,15,15,15,
+    15, 2, 8, 2,
+     2, 8, 8,15,
+     2, 8, 2, 2,
+     8, 8, 2, 2
+};
+
+//0, 9, 18, 27, 37, 46, 55, 64
+static const UINT aStep1[64] = {0,0,0,0,0,1,1,1,
+                                1,1,1,1,1,1,2,2,
+                                2,2,2,2,2,2,2,3,
+                                3,3,3,3,3,3,3,3,
+                                3,4,4,4,4,4,4,4,
+                                4,4,5,5,5,5,5,5,
+                                5,5,5,6,6,6,6,6,
+                                6,6,6,6,7,7,7,7};
+
+//0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+static const UINT aStep2[64] = { 0, 0, 0, 1, 1, 1, 1, 2,
+                                 2, 2, 2, 2, 3, 3, 3, 3,
+                                 4, 4, 4, 4, 5, 5, 5, 5,
+                                 6, 6, 6, 6, 6, 7, 7, 7,
+                                 7, 8, 8, 8, 8, 9, 9, 9,
+                                 9,10,10,10,10,10,11,11,
+                                11,11,12,12,12,12,13,13,
+                                13,13,14,14,14,14,15,15};
+
+static const int aWeight3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+static const int aWeight4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct BC6H_TEXELS
+{
+    __m128 vPixelPH[3][4];      // [channel][group of 4 texels], for the SSE2 loops
+    int    iPixelPH[16][3];     // start_quantize'd half floats
+    float  fPixelHR[16][3];     // the texels rounded to half precision
+};
+
+// What the trial passes hand to the final encoding pass, like the uint4 in g_OutBuff
+struct BC6H_CHOICE
+{
+    float fError;
+    UINT  uModeType;            // 1 to 14, the index into the mode tables plus one
+    UINT  uPartition;
+};
+
+//--------------------------------------------------------------------------------------
+// Half float conversion, quantization and unquantization, see BC6HEncode.hlsl
+//--------------------------------------------------------------------------------------
+static UINT Float2Half( float f )
+{
+    UINT u = *(UINT*)&f;
+    UINT sign = u & 0x80000000;
+    UINT expo = u & 0x7F800000;
+    UINT base = u & 0x007FFFFF;
+    return ( expo < 0x33800000 ) ? 0
+        : ( ( expo < 0x38800000 ) ? ( sign >> 16 ) | ( ( base + 0x00800000 ) >> ( 23 - ( ( expo - 0x33800000 ) >> 23 ) ) )
+        : ( ( expo == 0x7F800000 || expo > 0x47000000 ) ? ( ( sign >> 16 ) | 0x7bff )
+        : ( ( sign >> 16 ) | ( ( ( expo - 0x38000000 ) | base ) >> 13 ) ) ) );
+}
+
+static float Half2Float( UINT h )
+{
+    UINT sign = h & 0x8000;
+    UINT expo = h & 0x7C00;
+    UINT base = h & 0x03FF;
+    UINT u;
+    if ( 0 == expo )
+    {
+        float f = (float)base / 16777216;
+        u = ( sign << 16 ) | *(UINT*)&f;
+    }
+    else
+    {
+        u = ( sign << 16 ) | ( ( ( expo + 0x1C000 ) | base ) << 13 );
+    }
+    return *(float*)&u;
+}
+
+static int StartQuantize( UINT h, BOOL bSigned )
+{
+    if ( !bSigned )
+        return (int)( ( h << 6 ) / 31 );
+
+    return ( h < 0x8000 ) ? ( ( h == 0x7bff ) ? 0x7fff : (int)( ( h << 5 ) / 31 ) )
+        : -(int)( ( ( 0x00007fff & h ) << 5 ) / 31 );
+}
+
+static void Quantize( int* pColor, UINT uPrec, BOOL bSigned )
+{
+    int iPrec = (int)uPrec;
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        int e = pColor[c];
+        if ( !bSigned )
+        {
+            if ( iPrec >= 15 || 0 == e )
+                continue;
+            pColor[c] = ( e == 0xFFFF ) ? ( ( 1 << iPrec ) - 1 ) : (int)( ( (UINT)e << iPrec ) >> 16 );
+        }
+        else
+        {
+            if ( iPrec >= 16 || 0 == e )
+                continue;
+            if ( e >= 0 )
+                pColor[c] = ( e == 0x7FFF ) ? ( ( 1 << ( iPrec - 1 ) ) - 1 ) : ( ( e << ( iPrec - 1 ) ) >> 15 );
+            else
+                pColor[c] = ( -e == 0x7FFF ) ? -( ( 1 << ( iPrec - 1 ) ) - 1 ) : -( ( -e << ( iPrec - 1 ) ) >> 15 );
+        }
+    }
+}
+
+// Clamps a delta to the range a uPrec bit two's complement field can hold
+static BOOL ClampDelta( int& d, UINT uPrec )
+{
+    int iLimit = 1 << ( uPrec - 1 );
+    if ( d >= 0 )
+    {
+        if ( d >= iLimit )
+        {
+            d = iLimit - 1;
+            return TRUE;
+        }
+    }
+    else if ( -d > iLimit )
+    {
+        d = iLimit;
+        return TRUE;
+    }
+    else
+    {
+        d &= ( 1 << uPrec ) - 1;
+    }
+    return FALSE;
+}
+
+// finish_quantize_0 and finish_quantize: the first endpoint keeps the base value
+static void FinishQuantize0( BOOL& bBadQuantize, int endPoint[2][3], const UINT* pPrec, BOOL bTransformed )
+{
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        if ( bTransformed )
+        {
+            endPoint[0][c] &= ( 1 << pPrec[0] ) - 1;
+            if ( ClampDelta( endPoint[1][c], pPrec[1 + c] ) )
+                bBadQuantize = TRUE;
+        }
+        else
+        {
+            endPoint[0][c] &= ( 1 << pPrec[0] ) - 1;
+            endPoint[1][c] &= ( 1 << pPrec[0] ) - 1;
+        }
+    }
+}
+
+// finish_quantize_1: both endpoints of the second region are deltas
+static void FinishQuantize1( BOOL& bBadQuantize, int endPoint[2][3], const UINT* pPrec, BOOL bTransformed )
+{
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        for ( UINT e = 0; e < 2; ++e )
+        {
+            if ( bTransformed )
+            {
+                if ( ClampDelta( endPoint[e][c], pPrec[1 + c] ) )
+                    bBadQuantize = TRUE;
+            }
+            else
+            {
+                endPoint[e][c] &= ( 1 << pPrec[0] ) - 1;
+            }
+        }
+    }
+}
+
+static int SignExtend( int c, UINT uPrec )
+{
+    int p = 1 << ( uPrec - 1 );
+    return ( c & p ) ? ( c & ( p - 1 ) ) - p : c;
+}
+
+// sign_extend followed by start_unquantize, for one or two regions
+static void StartUnquantize( int endPoint[2][2][3], UINT uNumRegions, const UINT* pPrec, BOOL bTransformed, BOOL bSigned )
+{
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        if ( bSigned )
+            endPoint[0][0][c] = SignExtend( endPoint[0][0][c], pPrec[0] );
+
+        for ( UINT i = 1; i < uNumRegions * 2; ++i )
+        {
+            int& e = endPoint[i >> 1][i & 1][c];
+            if ( bSigned || bTransformed )
+                e = SignExtend( e, pPrec[1 + c] );
+            if ( bTransformed )
+                e += endPoint[0][0][c];
+        }
+    }
+}
+
+static void Unquantize( int* pColor, UINT uPrec, BOOL bSigned )
+{
+    int iPrec = (int)uPrec;
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        int e = pColor[c];
+        if ( !bSigned )
+        {
+            if ( uPrec < 15 && 0 != e )
+                pColor[c] = ( e == ( ( 1 << iPrec ) - 1 ) ) ? 0xFFFF : ( ( ( e << 16 ) + 0x8000 ) >> iPrec );
+        }
+        else if ( uPrec < 16 )
+        {
+            BOOL bNegative = e < 0;
+            e = bNegative ? -e : e;
+            if ( 0 != e )
+                e = ( e >= ( ( 1 << ( iPrec - 1 ) ) - 1 ) ) ? 0x7FFF : ( ( ( e << 15 ) + 0x4000 ) >> ( iPrec - 1 ) );
+            pColor[c] = bNegative ? -e : e;
+        }
+    }
+}
+
+static UINT FinishUnquantize( int c, BOOL bSigned )
+{
+    if ( !bSigned )
+        return (UINT)( ( c * 31 ) >> 6 );
+
+    c = ( c < 0 ) ? -( ( -c * 31 ) >> 5 ) : ( c * 31 ) >> 5;
+    return ( c < 0 ) ? ( ( -c ) | 0x8000 ) : (UINT)c;
+}
+
+// generate_palette_unquantized8/16, the weight is looked up by the caller
+static UINT Palette( int iLow, int iHigh, int iWeight, BOOL bSigned )
+{
+    return FinishUnquantize( ( iLow * ( 64 - iWeight ) + iHigh * iWeight + 32 ) >> 6, bSigned );
+}
+
+//--------------------------------------------------------------------------------------
+// Endpoint search helpers
+//--------------------------------------------------------------------------------------
+static void LoadTexels( const float* pTexels, BOOL bSigned, BC6H_TEXELS* pOut )
+{
+    for ( UINT i = 0; i < 16; ++i )
+    {
+        for ( UINT c = 0; c < 3; ++c )
+        {
+            UINT h = Float2Half( pTexels[i * 4 + c] );
+            pOut->fPixelHR[i][c] = Half2Float( h );
+            pOut->iPixelPH[i][c] = StartQuantize( h, bSigned );
+        }
+    }
+
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        for ( UINT g = 0; g < 4; ++g )
+        {
+            pOut->vPixelPH[c][g] = _mm_setr_ps( (float)pOut->iPixelPH[g * 4 + 0][c], (float)pOut->iPixelPH[g * 4 + 1][c],
+                                                (float)pOut->iPixelPH[g * 4 + 2][c], (float)pOut->iPixelPH[g * 4 + 3][c] );
+        }
+    }
+}
+
+// Bounding box of the texels in uMask
+static void RegionMinMax( const BC6H_TEXELS& texels, UINT uMask, int endPoint[2][3] )
+{
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        endPoint[0][c] = MAX_INT;
+        endPoint[1][c] = MIN_INT;
+    }
+
+    for ( UINT i = 0; i < 16; ++i )
+    {
+        if ( ( uMask >> i ) & 1 )
+        {
+            for ( UINT c = 0; c < 3; ++c )
+            {
+                endPoint[0][c] = min( endPoint[0][c], texels.iPixelPH[i][c] );
+                endPoint[1][c] = max( endPoint[1][c], texels.iPixelPH[i][c] );
+            }
+        }
+    }
+}
+
+static float SpanNormSqr( const int endPoint[2][3], float* pSpan )
+{
+    for ( UINT c = 0; c < 3; ++c )
+        pSpan[c] = (float)( endPoint[1][c] - endPoint[0][c] );
+    return pSpan[0] * pSpan[0] + pSpan[1] * pSpan[1] + pSpan[2] * pSpan[2];
+}
+
+// Orders the endpoints so that the anchor texel lands in the lower half of the palette
+// and the top bit of its index can be dropped
+static void FixAnchor( const BC6H_TEXELS& texels, UINT uAnchor, int endPoint[2][3] )
+{
+    float span[3];
+    float fSpanNormSqr = SpanNormSqr( endPoint, span );
+    float fDotProduct = span[0] * ( texels.iPixelPH[uAnchor][0] - endPoint[0][0] )
+                      + span[1] * ( texels.iPixelPH[uAnchor][1] - endPoint[0][1] )
+                      + span[2] * ( texels.iPixelPH[uAnchor][2] - endPoint[0][2] );
+    if ( fSpanNormSqr > 0 && fDotProduct >= 0 && (UINT)( fDotProduct * 63.49999f / fSpanNormSqr ) > 32 )
+    {
+        for ( UINT c = 0; c < 3; ++c )
+        {
+            int tmp = endPoint[0][c];
+            endPoint[0][c] = endPoint[1][c];
+            endPoint[1][c] = tmp;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Picks the index of every texel in uMask the way the shader does:
+// pStep[uint(dot * 63.49999 / |span|^2)], 0 when the texel projects before the first
+// endpoint and the last step when it projects past the second one
+//--------------------------------------------------------------------------------------
+static void FindIndices( const BC6H_TEXELS& texels, const int endPoint[2][3], const UINT* pStep, UINT uMask, UINT* pIndex )
+{
+    float span[3];
+    float fSpanNormSqr = SpanNormSqr( endPoint, span );
+    if ( fSpanNormSqr <= 0 )
+    {
+        for ( UINT i = 0; i < 16; ++i )
+        {
+            if ( ( uMask >> i ) & 1 )
+                pIndex[i] = 0;
+        }
+        return;
+    }
+
+    const __m128 vSpanNormSqr = _mm_set1_ps( fSpanNormSqr );
+    const __m128 vScale = _mm_set1_ps( 63.49999f );
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128i vLastStep = _mm_set1_epi32( 63 );
+    __m128 vSpan[3], vEP0[3];
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        vSpan[c] = _mm_set1_ps( span[c] );
+        vEP0[c] = _mm_set1_ps( (float)endPoint[0][c] );
+    }
+
+    for ( UINT g = 0; g < 4; ++g )
+    {
+        UINT uLanes = ( uMask >> ( g * 4 ) ) & 0xF;
+        if ( !uLanes )
+            continue;
+
+        __m128 vDot = _mm_mul_ps( vSpan[0], _mm_sub_ps( texels.vPixelPH[0][g], vEP0[0] ) );
+        vDot = _mm_add_ps( vDot, _mm_mul_ps( vSpan[1], _mm_sub_ps( texels.vPixelPH[1][g], vEP0[1] ) ) );
+        vDot = _mm_add_ps( vDot, _mm_mul_ps( vSpan[2], _mm_sub_ps( texels.vPixelPH[2][g], vEP0[2] ) ) );
+
+        // Lanes past the second endpoint are replaced before the conversion can overflow
+        __m128 vPastEnd = _mm_cmpge_ps( vDot, vSpanNormSqr );
+        __m128 vRatio = _mm_andnot_ps( vPastEnd, _mm_div_ps( _mm_mul_ps( vDot, vScale ), vSpanNormSqr ) );
+        __m128i vStep = _mm_cvttps_epi32( vRatio );
+        vStep = _mm_or_si128( _mm_andnot_si128( _mm_castps_si128( vPastEnd ), vStep ),
+                              _mm_and_si128( _mm_castps_si128( vPastEnd ), vLastStep ) );
+        vStep = _mm_andnot_si128( _mm_castps_si128( _mm_cmple_ps( vDot, vZero ) ), vStep );
+
+        int aLaneStep[4];
+        _mm_storeu_si128( (__m128i*)aLaneStep, vStep );
+        for ( UINT l = 0; l < 4; ++l )
+        {
+            if ( ( uLanes >> l ) & 1 )
+                pIndex[g * 4 + l] = pStep[aLaneStep[l]];
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Quantizes the endpoints for a mode, then reconstructs them the way the decoder will.
+// Returns FALSE if a delta does not fit.
+//--------------------------------------------------------------------------------------
+static BOOL QuantizeEndPoints( const int endPoint[2][2][3], UINT uModeType, BOOL bSigned, int endPoint_q[2][2][3] )
+{
+    const UINT* pPrec = candidateModePrec[uModeType - 1];
+    BOOL bTransformed = candidateModeTransformed[uModeType - 1];
+    UINT uNumRegions = uModeType > 10 ? 1 : 2;
+    BOOL bBadQuantize = FALSE;
+
+    for ( UINT r = 0; r < uNumRegions; ++r )
+    {
+        for ( UINT e = 0; e < 2; ++e )
+        {
+            for ( UINT c = 0; c < 3; ++c )
+                endPoint_q[r][e][c] = endPoint[r][e][c];
+            Quantize( endPoint_q[r][e], pPrec[0], bSigned );
+        }
+    }
+
+    if ( bTransformed )
+    {
+        for ( UINT i = 1; i < uNumRegions * 2; ++i )
+        {
+            for ( UINT c = 0; c < 3; ++c )
+                endPoint_q[i >> 1][i & 1][c] -= endPoint_q[0][0][c];
+        }
+    }
+
+    FinishQuantize0( bBadQuantize, endPoint_q[0], pPrec, bTransformed );
+    if ( 2 == uNumRegions )
+        FinishQuantize1( bBadQuantize, endPoint_q[1], pPrec, bTransformed );
+
+    return !bBadQuantize;
+}
+
+static float ModeError( const BC6H_TEXELS& texels, const int endPoint[2][2][3], UINT uModeType, UINT uMask, BOOL bSigned )
+{
+    int endPoint_q[2][2][3];
+    const UINT* pPrec = candidateModePrec[uModeType - 1];
+    UINT uNumRegions = uModeType > 10 ? 1 : 2;
+
+    BOOL bGood = QuantizeEndPoints( endPoint, uModeType, bSigned, endPoint_q );
+    StartUnquantize( endPoint_q, uNumRegions, pPrec, candidateModeTransformed[uModeType - 1], bSigned );
+    for ( UINT r = 0; r < uNumRegions; ++r )
+    {
+        Unquantize( endPoint_q[r][0], pPrec[0], bSigned );
+        Unquantize( endPoint_q[r][1], pPrec[0], bSigned );
+    }
+
+    UINT uIndex[16];
+    if ( 1 == uNumRegions )
+    {
+        FindIndices( texels, endPoint[0], aStep2, 0xFFFF, uIndex );
+    }
+    else
+    {
+        FindIndices( texels, endPoint[0], aStep1, ~uMask & 0xFFFF, uIndex );
+        FindIndices( texels, endPoint[1], aStep1, uMask, uIndex );
+    }
+
+    // Summed in texel order, like the shader
+    float fError = 0;
+    for ( UINT j = 0; j < 16; ++j )
+    {
+        UINT r = ( uMask >> j ) & 1;
+        int iWeight = ( 1 == uNumRegions ) ? aWeight4[uIndex[j]] : aWeight3[uIndex[j]];
+        float fDiff[3];
+        for ( UINT c = 0; c < 3; ++c )
+        {
+            UINT h = Palette( endPoint_q[r][0][c], endPoint_q[r][1][c], iWeight, bSigned );
+            fDiff[c] = Half2Float( h ) - texels.fPixelHR[j][c];
+        }
+        fError += fDiff[0] * fDiff[0] + fDiff[1] * fDiff[1] + fDiff[2] * fDiff[2];
+    }
+
+    return bGood ? fError : 1e20f;
+}
+
+//--------------------------------------------------------------------------------------
+// TryModeG10CS: the one-region modes 11 to 14
+//--------------------------------------------------------------------------------------
+static void TryModeG10( const BC6H_TEXELS& texels, BOOL bSigned, BC6H_CHOICE* pBest )
+{
+    int endPoint[2][2][3];
+    RegionMinMax( texels, 0xFFFF, endPoint[0] );
+    FixAnchor( texels, 0, endPoint[0] );
+
+    BC6H_CHOICE candidate[4];
+    for ( UINT t = 0; t < 4; ++t )
+    {
+        candidate[t].uModeType = t + 11;
+        candidate[t].uPartition = 0;
+        candidate[t].fError = ModeError( texels, endPoint, t + 11, 0, bSigned );
+    }
+
+    for ( UINT uStride = 2; uStride > 0; uStride /= 2 )
+    {
+        for ( UINT i = 0; i < uStride; ++i )
+        {
+            if ( candidate[i].fError > candidate[i + uStride].fError )
+                candidate[i] = candidate[i + uStride];
+        }
+    }
+    *pBest = candidate[0];
+}
+
+//--------------------------------------------------------------------------------------
+// TryModeLE10CS: one candidate per partition of a two-region mode
+//--------------------------------------------------------------------------------------
+static void TryModeLE10( const BC6H_TEXELS& texels, UINT uModeType, BOOL bSigned, BC6H_CHOICE* pBest )
+{
+    if ( pBest->fError < 1e-6f )
+        return;
+
+    BC6H_CHOICE candidate[32];
+    for ( UINT p = 0; p < 32; ++p )
+    {
+        UINT uMask = candidateSectionBit[p];
+        int endPoint[2][2][3];
+        RegionMinMax( texels, ~uMask & 0xFFFF, endPoint[0] );
+        RegionMinMax( texels, uMask, endPoint[1] );
+        FixAnchor( texels, 0, endPoint[0] );
+        FixAnchor( texels, candidateFixUpIndex1D[p], endPoint[1] );
+
+        candidate[p].uModeType = uModeType;
+        candidate[p].uPartition = p;
+        candidate[p].fError = ModeError( texels, endPoint, uModeType, uMask, bSigned );
+    }
+
+    for ( UINT uStride = 16; uStride > 0; uStride /= 2 )
+    {
+        for ( UINT i = 0; i < uStride; ++i )
+        {
+            if ( candidate[i].fError > candidate[i + uStride].fError )
+                candidate[i] = candidate[i + uStride];
+        }
+    }
+
+    if ( pBest->fError > candidate[0].fError )
+        *pBest = candidate[0];
+}
+
+//--------------------------------------------------------------------------------------
+// block_package, ported from BC6HEncode.hlsl
+//--------------------------------------------------------------------------------------
+static void PackTwoRegions( UINT* pBlock, const UINT endPoint[2][2][3], UINT uModeType, UINT uPartition )
+{
+    pBlock[2] |= uPartition << 13;
+
+    if ( uModeType == 1 )
+    {
+        pBlock[0] = candidateModeMemory[0];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00007FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x01FF8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[0] |= ( endPoint[1][0][1] >> 2 ) & 0x00000004;
+        pBlock[0] |= ( endPoint[1][0][2] >> 1 ) & 0x00000008;
+        pBlock[0] |= endPoint[1][1][2] & 0x00000010;
+        pBlock[1] |= ( ( endPoint[0][0][2] >> 7 ) & 0x00000007 );
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000000F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0003E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x0F800000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000003E;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( ( endPoint[1][1][1] << 4 ) & 0x00000100 );
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000F80;
+        pBlock[1] |= ( ( endPoint[1][1][2] << 27 ) & 0x10000000 ) | ( ( endPoint[1][1][2] << 18 ) & 0x00040000 );
+        pBlock[2] |= ( ( endPoint[1][1][2] << 9 ) & 0x00001000 ) | ( ( endPoint[1][1][2] << 4 ) & 0x00000040 );
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+    }
+    else if ( uModeType == 2 )
+    {
+        pBlock[0] = candidateModeMemory[1];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00000FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x003F8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000001F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0007E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x1F800000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] >> 3 ) & 0x00000004 ) | ( ( endPoint[1][0][1] << 20 ) & 0x01000000 );
+        pBlock[0] |= ( endPoint[1][1][1] >> 1 ) & 0x00000018;
+        pBlock[0] |= ( ( endPoint[1][1][2] << 21 ) & 0x00800000 ) | ( ( endPoint[1][1][2] << 12 ) & 0x00003000 );
+        pBlock[0] |= ( ( endPoint[1][0][2] << 17 ) & 0x00400000 ) | ( ( endPoint[1][0][2] << 10 ) & 0x00004000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000007E;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00001F80;
+        pBlock[1] |= ( ( endPoint[1][1][2] >> 4 ) & 0x00000002 ) | ( ( endPoint[1][1][2] >> 2 ) & 0x00000004 ) | ( ( endPoint[1][1][2] >> 3 ) & 0x00000001 );
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+    }
+    else if ( uModeType == 3 )
+    {
+        pBlock[0] = candidateModeMemory[2];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00007FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x01FF8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][0] >> 2 ) & 0x00000100;
+        pBlock[1] |= ( endPoint[0][0][1] << 7 ) & 0x00020000;
+        pBlock[1] |= ( ( endPoint[0][0][2] << 17 ) & 0x08000000 ) | ( ( endPoint[0][0][2] >> 7 ) & 0x00000007 );
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000000F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0001E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x07800000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000003E;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000F80;
+        pBlock[1] |= ( ( endPoint[1][1][2] << 27 ) & 0x10000000 ) | ( ( endPoint[1][1][2] << 18 ) & 0x00040000 );
+        pBlock[2] |= ( ( endPoint[1][1][2] << 9 ) & 0x00001000 ) | ( ( endPoint[1][1][2] << 4 ) & 0x00000040 );
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+    }
+    else if ( uModeType == 4 )
+    {
+        pBlock[0] = candidateModeMemory[3];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00007FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x01FF8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][0] >> 3 ) & 0x00000080;
+        pBlock[1] |= ( endPoint[0][0][1] << 8 ) & 0x00040000;
+        pBlock[1] |= ( ( endPoint[0][0][2] << 17 ) & 0x08000000 ) | ( ( endPoint[0][0][2] >> 7 ) & 0x00000007 );
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x00000078 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0003E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x07800000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000001E;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( ( endPoint[1][1][1] << 4 ) & 0x00000100 );
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000780;
+        pBlock[1] |= ( endPoint[1][1][2] << 27 ) & 0x10000000;
+        pBlock[2] |= ( endPoint[1][1][2] << 9 ) & 0x00001000;
+        pBlock[2] |= ( ( endPoint[1][0][1] << 7 ) & 0x00000800 );
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+        pBlock[2] |= ( endPoint[1][1][2] << 4 ) & 0x00000040;
+        pBlock[2] |= ( endPoint[1][1][2] << 5 ) & 0x00000020;
+    }
+    else if ( uModeType == 5 )
+    {
+        pBlock[0] = candidateModeMemory[4];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00007FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x01FF8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][0] >> 3 ) & 0x00000080;
+        pBlock[1] |= ( endPoint[0][0][1] << 7 ) & 0x00020000;
+        pBlock[1] |= ( ( endPoint[0][0][2] << 18 ) & 0x10000000 ) | ( ( endPoint[0][0][2] >> 7 ) & 0x00000007 );
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x00000078 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0001E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x0F800000 );
+        pBlock[1] |= ( ( endPoint[1][0][1] << 9 ) & 0x00001E00 ) | ( ( endPoint[1][0][2] << 4 ) & 0x00000100 );
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000780;
+        pBlock[1] |= ( endPoint[1][1][2] << 18 ) & 0x00040000;
+        pBlock[2] |= ( endPoint[1][1][2] << 4 ) & 0x00000060;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000001E;
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+        pBlock[2] |= ( ( endPoint[1][1][2] << 7 ) & 0x00000800 ) | ( ( endPoint[1][1][2] << 9 ) & 0x00001000 );
+    }
+    else if ( uModeType == 6 )
+    {
+        pBlock[0] = candidateModeMemory[5];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00003FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x00FF8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][2] >> 7 ) & 0x00000003;
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000000F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0003E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x0F800000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] << 20 ) & 0x01000000 ) | ( ( endPoint[1][0][2] << 10 ) & 0x00004000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000003E;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( ( endPoint[1][1][1] << 4 ) & 0x00000100 ) | ( ( endPoint[1][1][2] >> 2 ) & 0x00000004 );
+        pBlock[1] |= ( ( endPoint[1][1][2] << 27 ) & 0x10000000 );
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000F80;
+        pBlock[1] |= ( endPoint[1][1][2] << 18 ) & 0x00040000;
+        pBlock[2] |= ( endPoint[1][1][2] << 4 ) & 0x00000040;
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+        pBlock[2] |= ( ( endPoint[1][1][2] << 9 ) & 0x00001000 );
+    }
+    else if ( uModeType == 7 )
+    {
+        pBlock[0] = candidateModeMemory[6];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00001FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x007F8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][2] >> 7 ) & 0x00000001;
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000001F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0003E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x0F800000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] << 20 ) & 0x01000000 ) | ( ( endPoint[1][0][2] << 10 ) & 0x00004000 );
+        pBlock[0] |= ( ( endPoint[1][1][1] << 9 ) & 0x00002000 ) | ( ( endPoint[1][1][2] << 21 ) & 0x00800000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000007E;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00001F80;
+        pBlock[1] |= ( ( endPoint[1][1][2] >> 2 ) & 0x00000006 );
+        pBlock[1] |= ( ( endPoint[1][1][2] << 27 ) & 0x10000000 ) | ( ( endPoint[1][1][2] << 18 ) & 0x00040000 );
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+    }
+    else if ( uModeType == 8 )
+    {
+        pBlock[0] = candidateModeMemory[7];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00001FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x007F8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][2] >> 7 ) & 0x00000001;
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000000F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0007E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x0F800000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] << 20 ) & 0x01000000 ) | ( ( endPoint[1][0][2] << 10 ) & 0x00004000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] << 18 ) & 0x00800000 );
+        pBlock[0] |= ( ( endPoint[1][1][2] << 13 ) & 0x00002000 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000003E;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000F80;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( ( endPoint[1][1][1] >> 4 ) & 0x00000002 ) | ( ( endPoint[1][1][1] << 4 ) & 0x00000100 ) | ( ( endPoint[1][1][2] >> 2 ) & 0x00000004 );
+        pBlock[1] |= ( endPoint[1][1][2] << 27 ) & 0x10000000;
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+        pBlock[2] |= ( ( endPoint[1][1][2] << 9 ) & 0x00001000 ) | ( ( endPoint[1][1][2] << 4 ) & 0x00000040 );
+    }
+    else if ( uModeType == 9 )
+    {
+        pBlock[0] = candidateModeMemory[8];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x00001FE0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x007F8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0xFE000000 );
+        pBlock[1] |= ( endPoint[0][0][2] >> 7 ) & 0x00000001;
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000000F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0003E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x1F800000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] << 20 ) & 0x01000000 ) | ( ( endPoint[1][0][2] << 10 ) & 0x00004000 );
+        pBlock[0] |= ( ( endPoint[1][0][2] << 18 ) & 0x00800000 );
+        pBlock[0] |= ( endPoint[1][1][2] << 12 ) & 0x00002000;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( ( endPoint[1][1][1] << 4 ) & 0x00000100 ) | ( ( endPoint[1][1][2] >> 4 ) & 0x00000002 ) | ( ( endPoint[1][1][2] >> 2 ) & 0x00000004 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000003E;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00000F80;
+        pBlock[1] |= ( endPoint[1][1][2] << 18 ) & 0x00040000;
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+        pBlock[2] |= ( ( endPoint[1][1][2] << 9 ) & 0x00001000 ) | ( ( endPoint[1][1][2] << 4 ) & 0x00000040 );
+    }
+    else if ( uModeType == 10 )
+    {
+        pBlock[0] = candidateModeMemory[9];
+        pBlock[0] |= ( ( endPoint[0][0][0] << 5 ) & 0x000007E0 ) | ( ( endPoint[0][0][1] << 15 ) & 0x001F8000 ) | ( ( endPoint[0][0][2] << 25 ) & 0x7E000000 );
+        pBlock[1] |= ( ( endPoint[0][1][0] << 3 ) & 0x000001F8 ) | ( ( endPoint[0][1][1] << 13 ) & 0x0007E000 ) | ( ( endPoint[0][1][2] << 23 ) & 0x1F800000 );
+        pBlock[0] |= ( ( endPoint[1][0][1] << 16 ) & 0x00200000 ) | ( ( endPoint[1][0][1] << 20 ) & 0x01000000 );
+        pBlock[0] |= ( ( endPoint[1][0][2] << 17 ) & 0x00400000 ) | ( ( endPoint[1][0][2] << 10 ) & 0x00004000 );
+        pBlock[0] |= ( ( endPoint[1][1][2] << 21 ) & 0x00800000 ) | ( ( endPoint[1][1][2] << 12 ) & 0x00003000 );
+        pBlock[0] |= ( ( endPoint[1][1][1] << 26 ) & 0x80000000 ) | ( ( endPoint[1][1][1] << 7 ) & 0x00000800 );
+        pBlock[1] |= ( endPoint[1][0][1] << 9 ) & 0x00001E00;
+        pBlock[2] |= ( endPoint[1][0][0] << 1 ) & 0x0000007E;
+        pBlock[1] |= ( endPoint[1][1][1] << 19 ) & 0x00780000;
+        pBlock[2] |= ( endPoint[1][1][0] << 7 ) & 0x00001F80;
+        pBlock[1] |= ( endPoint[1][0][2] << 29 ) & 0xE0000000;
+        pBlock[1] |= ( ( endPoint[1][1][2] >> 4 ) & 0x00000002 ) | ( ( endPoint[1][1][2] >> 2 ) & 0x00000004 ) | ( ( endPoint[1][1][2] >> 3 ) & 0x00000001 );
+        pBlock[2] |= ( endPoint[1][0][2] >> 3 ) & 0x00000001;
+    }
+}
+
+static void PackOneRegion( UINT* pBlock, const UINT endPoint[2][3], UINT uModeType )
+{
+    pBlock[0] = ( ( endPoint[0][0] << 5 ) & 0x00007FE0 ) | ( ( endPoint[0][1] << 15 ) & 0x01FF8000 ) | ( ( endPoint[0][2] << 25 ) & 0xFE000000 );
+    pBlock[1] |= ( endPoint[0][2] >> 7 ) & 0x00000007;
+
+    if ( uModeType == 11 )
+    {
+        pBlock[0] |= candidateModeMemory[10];
+        pBlock[1] |= ( ( endPoint[1][0] << 3 ) & 0x00001FF8 ) | ( ( endPoint[1][1] << 13 ) & 0x007FE000 ) | ( ( endPoint[1][2] << 23 ) & 0xFF800000 );
+        pBlock[2] |= ( endPoint[1][2] >> 9 ) & 0x00000001;
+    }
+    else if ( uModeType == 12 )
+    {
+        pBlock[0] |= candidateModeMemory[11];
+        pBlock[1] |= ( ( endPoint[0][0] << 2 ) & 0x00001000 ) | ( ( endPoint[0][1] << 12 ) & 0x00400000 );
+        pBlock[1] |= ( ( endPoint[1][0] << 3 ) & 0x00000FF8 ) | ( ( endPoint[1][1] << 13 ) & 0x003FE000 ) | ( ( endPoint[1][2] << 23 ) & 0xFF800000 );
+        pBlock[2] |= ( endPoint[0][2] >> 10 ) & 0x00000001;
+    }
+    else if ( uModeType == 13 ) // violate the spec in [0].low
+    {
+        pBlock[0] |= candidateModeMemory[12];
+        pBlock[1] |= ( ( endPoint[0][0] << 2 ) & 0x00001000 ) | ( ( endPoint[0][1] << 12 ) & 0x00400000 );
+        pBlock[1] |= ( ( endPoint[0][0] << 0 ) & 0x00000800 ) | ( ( endPoint[0][1] << 10 ) & 0x00200000 );
+        pBlock[1] |= ( endPoint[0][2] << 20 ) & 0x80000000;
+        pBlock[1] |= ( ( endPoint[1][0] << 3 ) & 0x000007F8 ) | ( ( endPoint[1][1] << 13 ) & 0x001FE000 ) | ( ( endPoint[1][2] << 23 ) & 0x7F800000 );
+        pBlock[2] |= ( endPoint[0][2] >> 10 ) & 0x00000001;
+    }
+    else if ( uModeType == 14 )
+    {
+        pBlock[0] |= candidateModeMemory[13];
+        pBlock[1] |= ( ( endPoint[0][0] >> 3 ) & 0x00001F80 ) | ( ( endPoint[0][1] << 7 ) & 0x007E0000 ) | ( ( endPoint[0][2] << 17 ) & 0xF8000000 );
+        pBlock[1] |= ( ( endPoint[1][0] << 3 ) & 0x00000078 ) | ( ( endPoint[1][1] << 13 ) & 0x0001E000 ) | ( ( endPoint[1][2] << 23 ) & 0x07800000 );
+        pBlock[2] |= ( endPoint[0][2] >> 15 ) & 0x00000001;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// EncodeBlockCS: recomputes the endpoints and indices of the chosen mode and packs them
+//--------------------------------------------------------------------------------------
+static void EncodeBlock( const BC6H_TEXELS& texels, const BC6H_CHOICE& choice, BOOL bSigned, UINT* pBlock )
+{
+    UINT uModeType = choice.uModeType;
+    UINT uMask = uModeType > 10 ? 0 : candidateSectionBit[choice.uPartition];
+
+    int endPoint[2][2][3];
+    UINT uIndex[16];
+    if ( uModeType > 10 )
+    {
+        RegionMinMax( texels, 0xFFFF, endPoint[0] );
+        FixAnchor( texels, 0, endPoint[0] );
+        FindIndices( texels, endPoint[0], aStep2, 0xFFFF, uIndex );
+    }
+    else
+    {
+        RegionMinMax( texels, ~uMask & 0xFFFF, endPoint[0] );
+        RegionMinMax( texels, uMask, endPoint[1] );
+        FixAnchor( texels, 0, endPoint[0] );
+        FixAnchor( texels, candidateFixUpIndex1D[choice.uPartition], endPoint[1] );
+        FindIndices( texels, endPoint[0], aStep1, ~uMask & 0xFFFF, uIndex );
+        FindIndices( texels, endPoint[1], aStep1, uMask, uIndex );
+    }
+
+    pBlock[0] = pBlock[1] = pBlock[2] = pBlock[3] = 0;
+
+    if ( uModeType > 10 )
+    {
+        for ( UINT i = 0; i < 16; ++i )
+        {
+            if ( 0 == i )
+                pBlock[2] |= uIndex[i] << 1;
+            else if ( i < 8 )
+                pBlock[2] |= uIndex[i] << ( i * 4 );
+            else
+                pBlock[3] |= uIndex[i] << ( ( i - 8 ) * 4 );
+        }
+    }
+    else
+    {
+        UINT uFixUp = candidateFixUpIndex1D[choice.uPartition];
+        UINT uOffsetX = ( uFixUp != 2 );
+        UINT uOffsetY = ( uFixUp == 15 );
+        for ( UINT i = 0; i < 16; ++i )
+        {
+            if ( 0 == i )
+            {
+                pBlock[2] |= uIndex[i] << 18;
+            }
+            else if ( i < 3 )
+            {
+                pBlock[2] |= uIndex[i] << ( 20 + ( i - 1 ) * 3 );
+            }
+            else if ( i < 5 )
+            {
+                pBlock[2] |= uIndex[i] << ( 25 + ( i - 3 ) * 3 + uOffsetX );
+            }
+            else if ( 5 == i )
+            {
+                pBlock[3] |= uIndex[i] >> !uOffsetX;
+                if ( !uOffsetX )
+                    pBlock[2] |= uIndex[i] << 31;
+            }
+            else if ( i < 9 )
+            {
+                pBlock[3] |= uIndex[i] << ( 2 + ( i - 6 ) * 3 + uOffsetX );
+            }
+            else
+            {
+                pBlock[3] |= uIndex[i] << ( 11 + ( i - 9 ) * 3 + uOffsetY );
+            }
+        }
+    }
+
+    int endPoint_q[2][2][3];
+    QuantizeEndPoints( endPoint, uModeType, bSigned, endPoint_q );
+
+    // Every field is non-negative after finish_quantize
+    UINT endPoint_u[2][2][3];
+    for ( UINT r = 0; r < 2; ++r )
+    {
+        for ( UINT e = 0; e < 2; ++e )
+        {
+            for ( UINT c = 0; c < 3; ++c )
+                endPoint_u[r][e][c] = (UINT)endPoint_q[r][e][c];
+        }
+    }
+
+    if ( uModeType > 10 )
+        PackOneRegion( pBlock, endPoint_u[0], uModeType );
+    else
+        PackTwoRegions( pBlock, endPoint_u, uModeType, choice.uPartition );
+}
+
+//--------------------------------------------------------------------------------------
+void CPU_BC6HEncodeBlock( const float* pTexels, BOOL bSigned, UINT* pBlock )
+{
+    BC6H_TEXELS texels;
+    LoadTexels( pTexels, bSigned, &texels );
+
+    // Same order as CGPUBC6HEncoder::GPU_BC6HEncode, a later mode wins only when it is strictly better
+    BC6H_CHOICE best;
+    TryModeG10( texels, bSigned, &best );
+    for ( UINT uModeType = 1; uModeType <= 10; ++uModeType )
+        TryModeLE10( texels, uModeType, bSigned, &best );
+
+    EncodeBlock( texels, best, bSigned, pBlock );
+}
+
+//--------------------------------------------------------------------------------------
+// Decoder, ported from BC6HDecode.hlsl
+//--------------------------------------------------------------------------------------
+static int ExtractModeIndex( const UINT* pBlock )
+{
+    UINT uType = pBlock[0] & 0x03;
+    if ( uType < 2 )
+        return (int)uType;
+
+    uType = pBlock[0] & 0x1F;
+    for ( int i = 2; i < 14; ++i )
+    {
+        if ( uType == candidateModeMemory[i] )
+            return i;
+    }
+    return -1;
+}
+
+static void ExtractOneRegion( const UINT* pBlock, UINT uModeType, int endPoint[1][2][3] )
+{
+    if ( uModeType == 11 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00007FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x01FF8000 ) >> 15;
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x00001FF8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x007FE000 ) >> 13;
+        endPoint[0][1][2] = ( ( pBlock[2] & 0x00000001 ) << 9 ) | ( ( pBlock[1] & 0xFF800000 ) >> 23 );
+    }
+    else if ( uModeType == 12 )
+    {
+        endPoint[0][0][0] = ( ( pBlock[1] & 0x00001000 ) >> 2 ) | ( ( pBlock[0] & 0x00007FE0 ) >> 5 );
+        endPoint[0][0][1] = ( ( pBlock[1] & 0x00400000 ) >> 12 ) | ( ( pBlock[0] & 0x01FF8000 ) >> 15 );
+        endPoint[0][0][2] = ( ( pBlock[2] & 0x00000001 ) << 10 ) | ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x00000FF8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x003FE000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0xFF800000 ) >> 23;
+    }
+    else if ( uModeType == 13 ) // violate the spec in [0][0]
+    {
+        endPoint[0][0][0] = ( ( pBlock[1] & 0x00000800 ) >> 0 ) | ( ( pBlock[1] & 0x00001000 ) >> 2 ) | ( ( pBlock[0] & 0x00007FE0 ) >> 5 );
+        endPoint[0][0][1] = ( ( pBlock[1] & 0x00200000 ) >> 10 ) | ( ( pBlock[1] & 0x00400000 ) >> 12 ) | ( ( pBlock[0] & 0x01FF8000 ) >> 15 );
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x80000000 ) >> 20 ) | ( ( pBlock[2] & 0x00000001 ) << 10 ) | ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x000007F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x001FE000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x7F800000 ) >> 23;
+    }
+    else if ( uModeType == 14 )
+    {
+        endPoint[0][0][0] = ( ( pBlock[1] & 0x00001F80 ) << 3 ) | ( ( pBlock[0] & 0x00007FE0 ) >> 5 );
+        endPoint[0][0][1] = ( ( pBlock[1] & 0x007E0000 ) >> 7 ) | ( ( pBlock[0] & 0x01FF8000 ) >> 15 );
+        endPoint[0][0][2] = ( ( pBlock[1] & 0xF8000000 ) >> 17 ) | ( ( pBlock[2] & 0x00000001 ) << 15 ) | ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x00000078 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0001E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x07800000 ) >> 23;
+    }
+}
+
+static void ExtractTwoRegions( const UINT* pBlock, UINT uModeType, int endPoint[2][2][3] )
+{
+    if ( uModeType == 1 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00007FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x01FF8000 ) >> 15;
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x000000F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0003E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x0F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000003E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x00000004 ) << 2 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00000008 ) << 1 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[1] & 0x00000100 ) >> 4 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[0] & 0x00000010 ) >> 0 ) | ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000040 ) >> 4 ) | ( ( pBlock[1] & 0x10000000 ) >> 27 ) | ( ( pBlock[1] & 0x00040000 ) >> 18 );
+    }
+    else if ( uModeType == 2 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00000FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x003F8000 ) >> 15;
+        endPoint[0][0][2] = ( pBlock[0] & 0xFE000000 ) >> 25;
+        endPoint[0][1][0] = ( pBlock[1] & 0x000001F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0007E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x1F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000007E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x00000004 ) << 3 ) | ( ( pBlock[0] & 0x01000000 ) >> 20 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00400000 ) >> 17 ) | ( ( pBlock[0] & 0x00004000 ) >> 10 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00001F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[0] & 0x00000018 ) << 1 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[1] & 0x00000002 ) << 4 ) | ( ( pBlock[1] & 0x00000004 ) << 2 ) | ( ( pBlock[1] & 0x00000001 ) << 3 ) | ( ( pBlock[0] & 0x00800000 ) >> 21 ) | ( ( pBlock[0] & 0x00003000 ) >> 12 );
+    }
+    else if ( uModeType == 3 )
+    {
+        endPoint[0][0][0] = ( ( pBlock[1] & 0x00000100 ) << 2 ) | ( ( pBlock[0] & 0x00007FE0 ) >> 5 );// fixed a bug in v0.31
+        endPoint[0][0][1] = ( ( pBlock[1] & 0x00020000 ) >> 7 ) | ( ( pBlock[0] & 0x01FF8000 ) >> 15 );// fixed a bug in v0.31
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x08000000 ) >> 17 ) | ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );// fixed a bug in v0.31
+        endPoint[0][1][0] = ( pBlock[1] & 0x000000F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0001E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x07800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000003E ) >> 1;
+        endPoint[1][0][1] = ( pBlock[1] & 0x00001E00 ) >> 9;
+        endPoint[1][0][2] = ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000F80 ) >> 7;
+        endPoint[1][1][1] = ( pBlock[1] & 0x00780000 ) >> 19;
+        endPoint[1][1][2] = ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000040 ) >> 4 ) | ( ( pBlock[1] & 0x10000000 ) >> 27 ) | ( ( pBlock[1] & 0x00040000 ) >> 18 );
+    }
+    else if ( uModeType == 4 )
+    {
+        endPoint[0][0][0] = ( ( pBlock[1] & 0x00000080 ) << 3 ) | ( ( pBlock[0] & 0x00007FE0 ) >> 5 );// fixed a bug in v0.31
+        endPoint[0][0][1] = ( ( pBlock[1] & 0x00040000 ) >> 8 ) | ( ( pBlock[0] & 0x01FF8000 ) >> 15 );// fixed a bug in v0.31
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x08000000 ) >> 17 ) | ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );// fixed a bug in v0.31
+        endPoint[0][1][0] = ( pBlock[1] & 0x00000078 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0003E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x07800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000001E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[2] & 0x00000800 ) >> 7 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000780 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[1] & 0x00000100 ) >> 4 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000040 ) >> 4 ) | ( ( pBlock[1] & 0x10000000 ) >> 27 ) | ( ( pBlock[2] & 0x00000020 ) >> 5 );
+    }
+    else if ( uModeType == 5 )
+    {
+        endPoint[0][0][0] = ( ( pBlock[1] & 0x00000080 ) << 3 ) | ( ( pBlock[0] & 0x00007FE0 ) >> 5 );// fixed a bug in v0.31
+        endPoint[0][0][1] = ( ( pBlock[1] & 0x00020000 ) >> 7 ) | ( ( pBlock[0] & 0x01FF8000 ) >> 15 );// fixed a bug in v0.31
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x10000000 ) >> 18 ) | ( ( pBlock[1] & 0x00000007 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );// fixed a bug in v0.31
+        endPoint[0][1][0] = ( pBlock[1] & 0x00000078 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0001E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x0F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000001E ) >> 1;
+        endPoint[1][0][1] = ( pBlock[1] & 0x00001E00 ) >> 9;
+        endPoint[1][0][2] = ( ( pBlock[1] & 0x00000100 ) >> 4 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000780 ) >> 7;
+        endPoint[1][1][1] = ( pBlock[1] & 0x00780000 ) >> 19;
+        endPoint[1][1][2] = ( ( pBlock[2] & 0x00000800 ) >> 7 ) | ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000060 ) >> 4 ) | ( ( pBlock[1] & 0x00040000 ) >> 18 );
+    }
+    else if ( uModeType == 6 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00003FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x00FF8000 ) >> 15;
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x00000003 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x000000F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0003E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x0F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000003E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x01000000 ) >> 20 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00004000 ) >> 10 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[1] & 0x00000100 ) >> 4 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[1] & 0x00000004 ) << 2 ) | ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000040 ) >> 4 ) | ( ( pBlock[1] & 0x10000000 ) >> 27 ) | ( ( pBlock[1] & 0x00040000 ) >> 18 );
+    }
+    else if ( uModeType == 7 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00001FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x007F8000 ) >> 15;
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x00000001 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x000001F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0003E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x0F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000007E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x01000000 ) >> 20 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00004000 ) >> 10 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00001F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[0] & 0x00002000 ) >> 9 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[1] & 0x00000006 ) << 2 ) | ( ( pBlock[0] & 0x00800000 ) >> 21 ) | ( ( pBlock[1] & 0x10000000 ) >> 27 ) | ( ( pBlock[1] & 0x00040000 ) >> 18 );
+    }
+    else if ( uModeType == 8 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00001FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x007F8000 ) >> 15;
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x00000001 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x000000F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0007E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x0F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000003E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x00800000 ) >> 18 ) | ( ( pBlock[0] & 0x01000000 ) >> 20 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00004000 ) >> 10 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[1] & 0x00000002 ) << 4 ) | ( ( pBlock[1] & 0x00000100 ) >> 4 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[1] & 0x00000004 ) << 2 ) | ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000040 ) >> 4 ) | ( ( pBlock[1] & 0x10000000 ) >> 27 ) | ( ( pBlock[0] & 0x00002000 ) >> 13 );
+    }
+    else if ( uModeType == 9 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x00001FE0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x007F8000 ) >> 15;
+        endPoint[0][0][2] = ( ( pBlock[1] & 0x00000001 ) << 7 ) | ( ( pBlock[0] & 0xFE000000 ) >> 25 );
+        endPoint[0][1][0] = ( pBlock[1] & 0x000000F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0003E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x1F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000003E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x01000000 ) >> 20 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00800000 ) >> 18 ) | ( ( pBlock[0] & 0x00004000 ) >> 10 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00000F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[1] & 0x00000100 ) >> 4 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[1] & 0x00000002 ) << 4 ) | ( ( pBlock[1] & 0x00000004 ) << 2 ) | ( ( pBlock[2] & 0x00001000 ) >> 9 ) | ( ( pBlock[2] & 0x00000040 ) >> 4 ) | ( ( pBlock[0] & 0x00002000 ) >> 12 ) | ( ( pBlock[1] & 0x00040000 ) >> 18 );
+    }
+    else if ( uModeType == 10 )
+    {
+        endPoint[0][0][0] = ( pBlock[0] & 0x000007E0 ) >> 5;
+        endPoint[0][0][1] = ( pBlock[0] & 0x001F8000 ) >> 15;
+        endPoint[0][0][2] = ( pBlock[0] & 0x7E000000 ) >> 25;
+        endPoint[0][1][0] = ( pBlock[1] & 0x000001F8 ) >> 3;
+        endPoint[0][1][1] = ( pBlock[1] & 0x0007E000 ) >> 13;
+        endPoint[0][1][2] = ( pBlock[1] & 0x1F800000 ) >> 23;
+        endPoint[1][0][0] = ( pBlock[2] & 0x0000007E ) >> 1;
+        endPoint[1][0][1] = ( ( pBlock[0] & 0x00200000 ) >> 16 ) | ( ( pBlock[0] & 0x01000000 ) >> 20 ) | ( ( pBlock[1] & 0x00001E00 ) >> 9 );
+        endPoint[1][0][2] = ( ( pBlock[0] & 0x00400000 ) >> 17 ) | ( ( pBlock[0] & 0x00004000 ) >> 10 ) | ( ( pBlock[2] & 0x00000001 ) << 3 ) | ( ( pBlock[1] & 0xE0000000 ) >> 29 );
+        endPoint[1][1][0] = ( pBlock[2] & 0x00001F80 ) >> 7;
+        endPoint[1][1][1] = ( ( pBlock[0] & 0x80000000 ) >> 26 ) | ( ( pBlock[0] & 0x00000800 ) >> 7 ) | ( ( pBlock[1] & 0x00780000 ) >> 19 );
+        endPoint[1][1][2] = ( ( pBlock[1] & 0x00000002 ) << 4 ) | ( ( pBlock[1] & 0x00000004 ) << 2 ) | ( ( pBlock[1] & 0x00000001 ) << 3 ) | ( ( pBlock[0] & 0x00800000 ) >> 21 ) | ( ( pBlock[0] & 0x00003000 ) >> 12 );
+    }
+}
+
+static UINT ExtractIndexOne( UINT x, UINT y, const UINT* pBlock )
+{
+    if ( x == 0 && y == 0 )
+        return ( pBlock[2] >> 1 ) & 0x00000007;
+    if ( y < 2 )
+        return ( pBlock[2] >> ( y * 16 + x * 4 ) ) & 0x0000000F;
+    return ( pBlock[3] >> ( ( y - 2 ) * 16 + x * 4 ) ) & 0x0000000F;
+}
+
+static UINT ExtractIndexTwo( UINT x, UINT y, UINT uPartition, const UINT* pBlock )
+{
+    if ( x == 0 && y == 0 )
+        return ( pBlock[2] >> 18 ) & 0x00000003;
+    UINT uIndex = y * 4 + x;
+    if ( uIndex < candidateFixUpIndex1D[uPartition] )
+    {
+        if ( uIndex < 5 )
+            return ( pBlock[2] >> ( uIndex * 3 + 17 ) ) & 0x00000007;
+        return ( pBlock[3] >> ( uIndex * 3 - 15 ) ) & 0x00000007;
+    }
+    if ( uIndex == candidateFixUpIndex1D[uPartition] )
+    {
+        if ( uIndex < 5 )
+            return ( pBlock[2] >> ( uIndex * 3 + 17 ) ) & 0x00000003;
+        return ( pBlock[3] >> ( uIndex * 3 - 15 ) ) & 0x00000003;
+    }
+    if ( uIndex < 5 )
+        return ( pBlock[2] >> ( uIndex * 3 + 16 ) ) & 0x00000007;
+    if ( uIndex > 5 )
+        return ( pBlock[3] >> ( uIndex * 3 - 16 ) ) & 0x00000007;
+    return ( ( pBlock[2] >> 31 ) & 0x00000001 ) | ( ( pBlock[3] << 1 ) & 0x00000006 );
+}
+
+//--------------------------------------------------------------------------------------
+void CPU_BC6HDecodeBlock( const UINT* pBlock, BOOL bSigned, USHORT* pTexels )
+{
+    int iModeIndex = ExtractModeIndex( pBlock );
+    if ( iModeIndex < 0 )
+    {
+        // Reserved mode, decodes to black
+        for ( UINT i = 0; i < 16; ++i )
+        {
+            pTexels[i * 4 + 0] = pTexels[i * 4 + 1] = pTexels[i * 4 + 2] = 0;
+            pTexels[i * 4 + 3] = 0x3C00;
+        }
+        return;
+    }
+
+    UINT uModeType = iModeIndex + 1;
+    const UINT* pPrec = candidateModePrec[iModeIndex];
+    BOOL bTransformed = candidateModeTransformed[iModeIndex];
+    UINT uNumRegions = uModeType > 10 ? 1 : 2;
+    UINT uPartition = ( pBlock[2] & 0x0003E000 ) >> 13;
+
+    int endPoint[2][2][3];
+    if ( 1 == uNumRegions )
+        ExtractOneRegion( pBlock, uModeType, endPoint );
+    else
+        ExtractTwoRegions( pBlock, uModeType, endPoint );
+
+    StartUnquantize( endPoint, uNumRegions, pPrec, bTransformed, bSigned );
+    for ( UINT r = 0; r < uNumRegions; ++r )
+    {
+        Unquantize( endPoint[r][0], pPrec[0], bSigned );
+        Unquantize( endPoint[r][1], pPrec[0], bSigned );
+    }
+
+    for ( UINT y = 0; y < 4; ++y )
+    {
+        for ( UINT x = 0; x < 4; ++x )
+        {
+            UINT r = 0;
+            int iWeight;
+            if ( 1 == uNumRegions )
+            {
+                iWeight = aWeight4[ExtractIndexOne( x, y, pBlock )];
+            }
+            else
+            {
+                r = ( candidateSectionBit[uPartition] >> ( y * 4 + x ) ) & 1;
+                iWeight = aWeight3[ExtractIndexTwo( x, y, uPartition, pBlock )];
+            }
+
+            USHORT* pTexel = pTexels + ( y * 4 + x ) * 4;
+            for ( UINT c = 0; c < 3; ++c )
+            {
+                int iLow = endPoint[r][0][c];
+                int iHigh = endPoint[r][1][c];
+                pTexel[c] = (USHORT)FinishUnquantize( ( iLow * 64 + ( iHigh - iLow ) * iWeight + 32 ) >> 6, bSigned );
+            }
+            pTexel[3] = 0x3C00;
+        }
+    }
+}
@@ -0,0 +1,27 @@
+//--------------------------------------------------------------------------------------
+// File: CPUBC6HEncodeDecode.h
+//
+// CPU BC6H block Encoder/Decoder
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#ifndef __CPUBC6HENCODE_H
+#define __CPUBC6HENCODE_H
+
+#pragma once
+
+//--------------------------------------------------------------------------------------
+// Encodes one 4x4 block of R32G32B32A32 float texels, stored row by row, into a 16 byte
+// BC6H block.  Runs the same mode 11-14 and 1-10 search as BC6HEncode.hlsl.
+// bSigned selects BC6H_SF16 over BC6H_UF16.
+//--------------------------------------------------------------------------------------
+void CPU_BC6HEncodeBlock( const float* pTexels, BOOL bSigned, UINT* pBlock );
+
+//--------------------------------------------------------------------------------------
+// Decodes one 16 byte BC6H block into 4x4 R16G16B16A16 half float texels, stored row by
+// row, with alpha set to 1
+//--------------------------------------------------------------------------------------
+void CPU_BC6HDecodeBlock( const UINT* pBlock, BOOL bSigned, USHORT* pTexels );
+
+#endif
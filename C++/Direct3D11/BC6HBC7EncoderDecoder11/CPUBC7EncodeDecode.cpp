@@ -0,0 +1,1060 @@
+//--------------------------------------------------------------------------------------
+// File: CPUBC7EncodeDecode.cpp
+//
+// CPU BC7 block Encoder/Decoder
+//
+// This is a port of BC7Encode.hlsl.  Each compute shader thread of the GPU encoder
+// evaluates one candidate (a rotation, an index selector or a partition), and the
+// candidates are reduced to the one with the least error.  Here the candidates are
+// evaluated one after another and the same reduction is applied, so ties are broken
+// the same way as on the GPU.  The index search and error loops handle 4 texels at
+// a time with SSE2.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <windows.h>
+#include <emmintrin.h>
+#include "CPUBC7EncodeDecode.h"
+
+#define MAX_UINT            0xFFFFFFFF
+
+static const UINT candidateSectionBit[64] = //Associated to partition 0-63
+{
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8,
+    0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+    0xC800, 0xFFEC, 0xFE80, 0xE800,
+    0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE,
+    0x008C, 0x7310, 0x3100, 0x8CCE,
+    0x088C, 0x3110, 0x6666, 0x366C,
+    0x17E8, 0x0FF0, 0x718E, 0x399C,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc,
+    0x3c3c, 0x55aa, 0x9696, 0xa55a,
+    0x73ce, 0x13c8, 0x324c, 0x3bdc,
+    0x6996, 0xc33c, 0x9966, 0x660,
+    0x272, 0x4e4, 0x4e40, 0x2720,
+    0xc936, 0x936c, 0x39c6, 0x639c,
+    0x9336, 0x9cc6, 0x817e, 0xe718,
+    0xccf0, 0xfcc, 0x7744, 0xee22,
+};
+static const UINT candidateSectionBit2[64] = //Associated to partition 64-127
+{
+    0xf60008cc, 0x73008cc8, 0x3310cc80, 0xceec00,
+    0xcc003300, 0xcc0000cc, 0xccff00, 0x3300cccc,
+    0xf0000f00, 0xf0000ff0, 0xff0000f0, 0x88884444,
+    0x88886666, 0xcccc2222, 0xec80136c, 0x7310008c,
+    0xc80036c8, 0x310008ce, 0xccc03330, 0xcccf000,
+    0xee0000ee, 0x77008888, 0xcc0022c0, 0x33004430,
+    0xcc0c22, 0xfc880344, 0x6606996, 0x66009960,
+    0xc88c0330, 0xf9000066, 0xcc0c22c, 0x73108c00,
+
+    0xec801300, 0x8cec400, 0xec80004c, 0x44442222,
+    0xf0000f0, 0x49242492, 0x42942942, 0xc30c30c,
+    0x3c0c03c, 0xff0000aa, 0x5500aa00, 0xcccc3030,
+    0xc0cc0c0, 0x66669090, 0xff0a00a, 0x5550aaa0,
+    0xf0000aaa, 0xe0ee0e0, 0x88887070, 0x99906660,
+    0xe00e0ee0, 0x88880770, 0xf0000666, 0x99006600,
+    0xff000066, 0xc00c0cc0, 0xcccc0330, 0x90006000,
+    0x8088080, 0xeeee1010, 0xfff0000a, 0x731008ce,
+};
+static const UINT candidateFixUpIndex1D[128][2] =
+{
+    {15, 0},{15, 0},{15, 0},{15, 0},
+    {15, 0},{15, 0},{15, 0},{15, 0},
+    {15, 0},{15, 0},{15, 0},{15, 0},
+    {15, 0},{15, 0},{15, 0},{15, 0},
+    {15, 0},{ 2, 0},{ 8, 0},{ 2, 0},
+    { 2, 0},{ 8, 0},{ 8, 0},{15, 0},
+    { 2, 0},{ 8, 0},{ 2, 0},{ 2, 0},
+    { 8, 0},{ 8, 0},{ 2, 0},{ 2, 0},
+
+    {15, 0},{15, 0},{ 6, 0},{ 8, 0},
+    { 2, 0},{ 8, 0},{15, 0},{15, 0},
+    { 2, 0},{ 8, 0},{ 2, 0},{ 2, 0},
+    { 2, 0},{15, 0},{15, 0},{ 6, 0},
+    { 6, 0},{ 2, 0},{ 6, 0},{ 8, 0},
+    {15, 0},{15, 0},{ 2, 0},{ 2, 0},
+    {15, 0},{15, 0},{15, 0},{15, 0},
+    {15, 0},{ 2, 0},{ 2, 0},{15, 0},
+    //candidateFixUpIndex1D[i][1], i < 64 should not be used
+
+    { 3,15},{ 3, 8},{15, 8},{15, 3},
+    { 8,15},{ 3,15},{15, 3},{15, 8},
+    { 8,15},{ 8,15},{ 6,15},{ 6,15},
+    { 6,15},{ 5,15},{ 3,15},{ 3, 8},
+    { 3,15},{ 3, 8},{ 8,15},{15, 3},
+    { 3,15},{ 3, 8},{ 6,15},{10, 8},
+    { 5, 3},{ 8,15},{ 8, 6},{ 6,10},
+    { 8,15},{ 5,15},{15,10},{15, 8},
+
+    { 8,15},{15, 3},{ 3,15},{ 5,10},
+    { 6,10},{10, 8},{ 8, 9},{15,10},
+    {15, 6},{ 3,15},{15, 8},{ 5,15},
+    {15, 3},{15, 6},{15, 6},{15, 8},
+    { 3,15},{15, 3},{ 5,15},{ 5,15},
+    { 5,15},{ 8,15},{ 5,15},{10,15},
+    { 5,15},{10,15},{ 8,15},{13,15},
+    {15, 3},{12,15},{ 3,15},{ 3, 8},
+};
+
+static const UINT aWeight[3][16] = { {0,  4,  9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64},
+                                     {0,  9, 18, 27, 37, 46, 55, 64,  0,  0,  0,  0,  0,  0,  0,  0},
+                                     {0, 21, 43, 64,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0} };
+static const UINT aStep[3][64] = {  { 0, 0, 0, 1, 1, 1, 1, 2,
+                                      2, 2, 2, 2, 3, 3, 3, 3,
+                                      4, 4, 4, 4, 5, 5, 5, 5,
+                                      6, 6, 6, 6, 6, 7, 7, 7,
+                                      7, 8, 8, 8, 8, 9, 9, 9,
+                                      9,10,10,10,10,10,11,11,
+                                     11,11,12,12,12,12,13,13,
+                                     13,13,14,14,14,14,15,15 },
+                                    { 0,0,0,0,0,1,1,1,
+                                      1,1,1,1,1,1,2,2,
+                                      2,2,2,2,2,2,2,3,
+                                      3,3,3,3,3,3,3,3,
+                                      3,4,4,4,4,4,4,4,
+                                      4,4,5,5,5,5,5,5,
+                                      5,5,5,6,6,6,6,6,
+                                      6,6,6,6,7,7,7,7 },
+                                    { 0,0,0,0,0,0,0,0,
+                                      0,0,0,1,1,1,1,1,
+                                      1,1,1,1,1,1,1,1,
+                                      1,1,1,1,1,1,1,1,
+                                      1,2,2,2,2,2,2,2,
+                                      2,2,2,2,2,2,2,2,
+                                      2,2,2,2,2,2,3,3,
+                                      3,3,3,3,3,3,3,3 } };
+
+// Channel order after a mode 4/5 rotation: the rotated channel is swapped with alpha
+static const UINT aRotation[4][4] = { {0,1,2,3}, {3,1,2,0}, {0,3,2,1}, {0,1,3,2} };
+
+// Block layout of each mode, see the BC7 format specification
+struct BC7_MODE_INFO
+{
+    UINT uNumSubsets;
+    UINT uPartitionBits;
+    UINT uRotationBits;
+    UINT uIndexSelectorBits;
+    UINT uColorBits;            // per channel, without the P-bit
+    UINT uAlphaBits;
+    UINT uPBits;                // 0: none, 1: one per endpoint, 2: one per subset
+    UINT uIndexBits;
+    UINT uIndexBits2;           // second index set of modes 4 and 5
+};
+
+static const BC7_MODE_INFO aModeInfo[8] =
+{
+    { 3, 4, 0, 0, 4, 0, 1, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 2, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 2, 0 },
+};
+
+struct BC7_TEXELS
+{
+    __m128 vChannel[4][4];      // [channel][group of 4 texels], for the SSE2 loops
+    int    iTexel[16][4];
+};
+
+// What the trial passes hand to the final encoding pass, like the uint4 in g_OutBuff
+struct BC7_CHOICE
+{
+    UINT uError;
+    UINT uMode;
+    UINT uPartition;
+    UINT uIndexSelector;
+    UINT uRotation;
+};
+
+//--------------------------------------------------------------------------------------
+// Helpers
+//--------------------------------------------------------------------------------------
+static void Swap( int& a, int& b )
+{
+    int tmp = a;
+    a = b;
+    b = tmp;
+}
+
+static int Dot( const int* a, const int* b )
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+}
+
+// The endpoints are ordered so that the anchor texel lands in the lower half of the
+// palette and the top bit of its index can be dropped
+static BOOL NeedSwap( int iDotProduct, int iSpanNormSqr )
+{
+    return iSpanNormSqr > 0 && iDotProduct > 0 && (UINT)( iDotProduct * 63.49999f ) > (UINT)( 32 * iSpanNormSqr );
+}
+
+static void LoadTexels( const BYTE* pTexels, BC7_TEXELS* pOut )
+{
+    for ( UINT i = 0; i < 16; ++i )
+    {
+        for ( UINT c = 0; c < 4; ++c )
+        {
+            pOut->iTexel[i][c] = pTexels[i * 4 + c];
+        }
+    }
+
+    for ( UINT c = 0; c < 4; ++c )
+    {
+        for ( UINT g = 0; g < 4; ++g )
+        {
+            pOut->vChannel[c][g] = _mm_setr_ps( (float)pOut->iTexel[g * 4 + 0][c], (float)pOut->iTexel[g * 4 + 1][c],
+                                                (float)pOut->iTexel[g * 4 + 2][c], (float)pOut->iTexel[g * 4 + 3][c] );
+        }
+    }
+}
+
+static void GetTexel( const BC7_TEXELS& texels, UINT uRotation, UINT i, int* pTexel )
+{
+    for ( UINT c = 0; c < 4; ++c )
+    {
+        pTexel[c] = texels.iTexel[i][aRotation[uRotation][c]];
+    }
+}
+
+static void GetChannels( const BC7_TEXELS& texels, UINT uRotation, const __m128** ppChannel )
+{
+    for ( UINT c = 0; c < 4; ++c )
+    {
+        ppChannel[c] = texels.vChannel[aRotation[uRotation][c]];
+    }
+}
+
+// Bounding box of the texels in uMask
+static void SubsetMinMax( const BC7_TEXELS& texels, UINT uRotation, UINT uMask, int endPoint[2][4] )
+{
+    for ( UINT c = 0; c < 4; ++c )
+    {
+        endPoint[0][c] = 255;
+        endPoint[1][c] = 0;
+    }
+
+    for ( UINT i = 0; i < 16; ++i )
+    {
+        if ( ( uMask >> i ) & 1 )
+        {
+            int texel[4];
+            GetTexel( texels, uRotation, i, texel );
+            for ( UINT c = 0; c < 4; ++c )
+            {
+                endPoint[0][c] = min( endPoint[0][c], texel[c] );
+                endPoint[1][c] = max( endPoint[1][c], texel[c] );
+            }
+        }
+    }
+}
+
+// Same as compress_endpoints0..7 in BC7Encode.hlsl
+static void CompressEndPoints( UINT uMode, int endPoint[2][4] )
+{
+    UINT j, c;
+    int tmp;
+
+    switch ( uMode )
+    {
+    case 0:
+        for ( j = 0; j < 2; ++j )
+        {
+            tmp = ( endPoint[j][0] & 0x0F ) + ( endPoint[j][1] & 0x0F ) + ( endPoint[j][2] & 0x0F );
+            for ( c = 0; c < 3; ++c )
+                endPoint[j][c] = ( endPoint[j][c] & 0xF0 ) | ( ( tmp / 3 ) & 0x08 );
+        }
+        break;
+    case 1:
+        tmp = 0;
+        for ( j = 0; j < 2; ++j )
+            tmp += ( endPoint[j][0] & 0x03 ) + ( endPoint[j][1] & 0x03 ) + ( endPoint[j][2] & 0x03 );
+        tmp = ( tmp / 6 ) & 0x02;
+        for ( j = 0; j < 2; ++j )
+        {
+            for ( c = 0; c < 3; ++c )
+                endPoint[j][c] = ( endPoint[j][c] & 0xFC ) | tmp;
+        }
+        break;
+    case 2:
+        for ( j = 0; j < 2; ++j )
+        {
+            for ( c = 0; c < 3; ++c )
+                endPoint[j][c] = min( 255, endPoint[j][c] + 0x04 ) & 0xF8;
+        }
+        break;
+    case 3:
+        for ( j = 0; j < 2; ++j )
+        {
+            tmp = ( endPoint[j][0] & 0x01 ) + ( endPoint[j][1] & 0x01 ) + ( endPoint[j][2] & 0x01 );
+            for ( c = 0; c < 3; ++c )
+                endPoint[j][c] = ( endPoint[j][c] & 0xFE ) | ( tmp / 3 );
+        }
+        break;
+    case 4:
+        for ( j = 0; j < 2; ++j )
+        {
+            for ( c = 0; c < 3; ++c )
+                endPoint[j][c] = min( 255, endPoint[j][c] + 0x04 ) & 0xF8;
+            endPoint[j][3] = min( 255, endPoint[j][3] + 0x02 ) & 0xFC;
+        }
+        break;
+    case 5:
+        for ( j = 0; j < 2; ++j )
+        {
+            for ( c = 0; c < 3; ++c )
+                endPoint[j][c] = min( 255, endPoint[j][c] + 0x01 ) & 0xFE;
+        }
+        break;
+    case 6:
+        for ( j = 0; j < 2; ++j )
+        {
+            tmp = ( endPoint[j][0] & 0x01 ) + ( endPoint[j][1] & 0x01 ) + ( endPoint[j][2] & 0x01 ) + ( endPoint[j][3] & 0x01 );
+            for ( c = 0; c < 4; ++c )
+                endPoint[j][c] = ( endPoint[j][c] & 0xFE ) | ( ( tmp >> 2 ) & 0x01 );
+        }
+        break;
+    default:
+        for ( j = 0; j < 2; ++j )
+        {
+            tmp = ( endPoint[j][0] & 0x07 ) + ( endPoint[j][1] & 0x07 ) + ( endPoint[j][2] & 0x07 ) + ( endPoint[j][3] & 0x07 );
+            for ( c = 0; c < 4; ++c )
+                endPoint[j][c] = ( endPoint[j][c] & 0xF8 ) | ( ( tmp >> 2 ) & 0x04 );
+        }
+        break;
+    }
+}
+
+static void GetSpan( const int endPoint[2][4], BOOL bRGB, BOOL bAlpha, int* pSpan )
+{
+    for ( UINT c = 0; c < 3; ++c )
+        pSpan[c] = bRGB ? endPoint[1][c] - endPoint[0][c] : 0;
+    pSpan[3] = bAlpha ? endPoint[1][3] - endPoint[0][3] : 0;
+}
+
+// Orders the endpoints of a subset against its anchor texel.  Channels outside the span
+// (alpha for modes 0-3) are swapped along with the others, as in the shader.
+static void FixAnchor( const BC7_TEXELS& texels, UINT uRotation, UINT uAnchor, const int* pSpan, int endPoint[2][4],
+                       UINT uFirstChannel, UINT uLastChannel )
+{
+    int texel[4], diff[4];
+    GetTexel( texels, uRotation, uAnchor, texel );
+    for ( UINT c = 0; c < 4; ++c )
+        diff[c] = texel[c] - endPoint[0][c];
+
+    if ( NeedSwap( Dot( pSpan, diff ), Dot( pSpan, pSpan ) ) )
+    {
+        for ( UINT c = uFirstChannel; c <= uLastChannel; ++c )
+            Swap( endPoint[0][c], endPoint[1][c] );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Picks the index of every texel in uMask the way the shader does:
+// aStep[uStep][uint(dot * 63.49999 / |span|^2)], 0 when the texel projects before the
+// first endpoint and the last step when it projects past the second one
+//--------------------------------------------------------------------------------------
+static void FindIndices( const __m128* const* ppChannel, const int* pEP0, const int* pSpan, UINT uStep, UINT uMask,
+                         UINT* pIndex )
+{
+    int iSpanNormSqr = Dot( pSpan, pSpan );
+    if ( iSpanNormSqr <= 0 )
+    {
+        for ( UINT i = 0; i < 16; ++i )
+        {
+            if ( ( uMask >> i ) & 1 )
+                pIndex[i] = 0;
+        }
+        return;
+    }
+
+    const __m128 vSpanNormSqr = _mm_set1_ps( (float)iSpanNormSqr );
+    const __m128 vScale = _mm_set1_ps( 63.49999f );
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128i vLastStep = _mm_set1_epi32( 63 );
+    __m128 vSpan[4], vEP0[4];
+    for ( UINT c = 0; c < 4; ++c )
+    {
+        vSpan[c] = _mm_set1_ps( (float)pSpan[c] );
+        vEP0[c] = _mm_set1_ps( (float)pEP0[c] );
+    }
+
+    for ( UINT g = 0; g < 4; ++g )
+    {
+        UINT uLanes = ( uMask >> ( g * 4 ) ) & 0xF;
+        if ( !uLanes )
+            continue;
+
+        __m128 vDot = _mm_mul_ps( vSpan[0], _mm_sub_ps( ppChannel[0][g], vEP0[0] ) );
+        vDot = _mm_add_ps( vDot, _mm_mul_ps( vSpan[1], _mm_sub_ps( ppChannel[1][g], vEP0[1] ) ) );
+        vDot = _mm_add_ps( vDot, _mm_mul_ps( vSpan[2], _mm_sub_ps( ppChannel[2][g], vEP0[2] ) ) );
+        vDot = _mm_add_ps( vDot, _mm_mul_ps( vSpan[3], _mm_sub_ps( ppChannel[3][g], vEP0[3] ) ) );
+
+        __m128i vStep = _mm_cvttps_epi32( _mm_div_ps( _mm_mul_ps( vDot, vScale ), vSpanNormSqr ) );
+        __m128i vPastEnd = _mm_castps_si128( _mm_cmpge_ps( vDot, vSpanNormSqr ) );
+        vStep = _mm_or_si128( _mm_andnot_si128( vPastEnd, vStep ), _mm_and_si128( vPastEnd, vLastStep ) );
+        vStep = _mm_andnot_si128( _mm_castps_si128( _mm_cmple_ps( vDot, vZero ) ), vStep );
+
+        int aLaneStep[4];
+        _mm_storeu_si128( (__m128i*)aLaneStep, vStep );
+        for ( UINT l = 0; l < 4; ++l )
+        {
+            if ( ( uLanes >> l ) & 1 )
+                pIndex[g * 4 + l] = aStep[uStep][aLaneStep[l]];
+        }
+    }
+}
+
+// Expands the top uBits of an endpoint channel to 8 bits the way the decoder does
+static int ExpandBits( int x, UINT uBits )
+{
+    UINT v = ( (UINT)x >> ( 8 - uBits ) ) << ( 8 - uBits );
+    return v | ( v >> uBits );
+}
+
+//--------------------------------------------------------------------------------------
+// Squared error of the texels in uMask against ((64 - w) * ep0 + w * ep1 + 32) >> 6.
+// Every term is an integer below 2^24, so the float math is exact.  Without bAlpha the
+// mode has no alpha endpoints and decodes alpha as 255, which is what gets compared.
+// The shader leaves alpha out instead, so blocks with alpha could lose it to modes 0-3.
+//--------------------------------------------------------------------------------------
+static UINT SubsetError( const __m128* const* ppChannel, UINT uMode, const int endPointIn[2][4],
+                         const UINT* pWeightRGB, const UINT* pWeightA, UINT uMask, BOOL bAlpha )
+{
+    // The shader scores the endpoints before their low bits are replicated, which flatters
+    // the modes with few endpoint bits.  Score what the decoder will see instead.
+    const BC7_MODE_INFO& info = aModeInfo[uMode];
+    UINT uPBit = info.uPBits ? 1 : 0;
+    int endPoint[2][4];
+    for ( UINT e = 0; e < 2; ++e )
+    {
+        for ( UINT c = 0; c < 3; ++c )
+            endPoint[e][c] = ExpandBits( endPointIn[e][c], info.uColorBits + uPBit );
+        endPoint[e][3] = info.uAlphaBits ? ExpandBits( endPointIn[e][3], info.uAlphaBits + uPBit ) : 255;
+    }
+
+    const __m128 v64 = _mm_set1_ps( 64.0f );
+    const __m128 v32 = _mm_set1_ps( 32.0f );
+    const __m128 vInv64 = _mm_set1_ps( 1.0f / 64.0f );
+    const __m128 vOpaque = _mm_set1_ps( 255.0f );
+    __m128 vSum = _mm_setzero_ps();
+
+    for ( UINT g = 0; g < 4; ++g )
+    {
+        UINT uLanes = ( uMask >> ( g * 4 ) ) & 0xF;
+        if ( !uLanes )
+            continue;
+
+        __m128 vLaneMask = _mm_castsi128_ps( _mm_setr_epi32( -(int)( uLanes & 1 ), -(int)( ( uLanes >> 1 ) & 1 ),
+                                                             -(int)( ( uLanes >> 2 ) & 1 ), -(int)( ( uLanes >> 3 ) & 1 ) ) );
+        __m128 vWeightRGB = _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i*)( pWeightRGB + g * 4 ) ) );
+        __m128 vWeightA = _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i*)( pWeightA + g * 4 ) ) );
+
+        for ( UINT c = 0; c < 4; ++c )
+        {
+            if ( 3 == c && !bAlpha )
+            {
+                __m128 vDiff = _mm_sub_ps( vOpaque, ppChannel[3][g] );
+                vSum = _mm_add_ps( vSum, _mm_and_ps( vLaneMask, _mm_mul_ps( vDiff, vDiff ) ) );
+                continue;
+            }
+
+            __m128 vWeight = c < 3 ? vWeightRGB : vWeightA;
+            __m128 vRec = _mm_add_ps( _mm_mul_ps( _mm_sub_ps( v64, vWeight ), _mm_set1_ps( (float)endPoint[0][c] ) ),
+                                      _mm_mul_ps( vWeight, _mm_set1_ps( (float)endPoint[1][c] ) ) );
+            vRec = _mm_cvtepi32_ps( _mm_cvttps_epi32( _mm_mul_ps( _mm_add_ps( vRec, v32 ), vInv64 ) ) );
+            __m128 vDiff = _mm_sub_ps( vRec, ppChannel[c][g] );
+            vSum = _mm_add_ps( vSum, _mm_and_ps( vLaneMask, _mm_mul_ps( vDiff, vDiff ) ) );
+        }
+    }
+
+    float aSum[4];
+    _mm_storeu_ps( aSum, vSum );
+    return (UINT)( aSum[0] + aSum[1] + aSum[2] + aSum[3] );
+}
+
+static void ReduceCandidates( BC7_CHOICE* pCandidate, UINT uNumCandidates )
+{
+    for ( UINT uStride = uNumCandidates / 2; uStride > 0; uStride /= 2 )
+    {
+        for ( UINT i = 0; i < uStride; ++i )
+        {
+            if ( pCandidate[i].uError > pCandidate[i + uStride].uError )
+                pCandidate[i] = pCandidate[i + uStride];
+        }
+    }
+}
+
+static void LookupWeights( const UINT* pIndex, UINT uPrec, UINT* pWeight )
+{
+    for ( UINT i = 0; i < 16; ++i )
+        pWeight[i] = aWeight[uPrec][pIndex[i]];
+}
+
+//--------------------------------------------------------------------------------------
+// TryMode456CS: candidates 0-7 are mode 4 with every rotation and index selector,
+// 8-11 are mode 5 with every rotation and 12 is mode 6
+//--------------------------------------------------------------------------------------
+static void TryMode456( const BC7_TEXELS& texels, BC7_CHOICE* pBest )
+{
+    BC7_CHOICE candidate[16];
+
+    for ( UINT t = 0; t < 16; ++t )
+    {
+        BC7_CHOICE& c = candidate[t];
+        c.uError = MAX_UINT;
+        c.uMode = 0;
+        c.uPartition = 0;
+        c.uIndexSelector = 0;
+        c.uRotation = 0;
+
+        if ( t > 12 )
+            continue;
+
+        UINT uIndex[16], uAlphaIndex[16], uWeightRGB[16], uWeightA[16];
+        int endPoint[2][4];
+        const __m128* pChannel[4];
+
+        if ( t < 12 )
+        {
+            // 2 represents 2bit index precision; 1 represents 3bit index precision
+            UINT uPrecRGB = 2, uPrecA = 2;
+            if ( t < 8 )
+            {
+                c.uMode = 4;
+                c.uRotation = t >> 1;
+                c.uIndexSelector = t & 1;
+                uPrecRGB = c.uIndexSelector ? 1 : 2;
+                uPrecA = c.uIndexSelector ? 2 : 1;
+            }
+            else
+            {
+                c.uMode = 5;
+                c.uRotation = t - 8;
+            }
+
+            SubsetMinMax( texels, c.uRotation, 0xFFFF, endPoint );
+            CompressEndPoints( c.uMode, endPoint );
+            GetChannels( texels, c.uRotation, pChannel );
+
+            int spanRGB[4], spanA[4];
+            GetSpan( endPoint, TRUE, FALSE, spanRGB );
+            GetSpan( endPoint, FALSE, TRUE, spanA );
+            FixAnchor( texels, c.uRotation, 0, spanRGB, endPoint, 0, 2 );
+            FixAnchor( texels, c.uRotation, 0, spanA, endPoint, 3, 3 );
+            GetSpan( endPoint, TRUE, FALSE, spanRGB );
+            GetSpan( endPoint, FALSE, TRUE, spanA );
+
+            FindIndices( pChannel, endPoint[0], spanRGB, uPrecRGB, 0xFFFF, uIndex );
+            FindIndices( pChannel, endPoint[0], spanA, uPrecA, 0xFFFF, uAlphaIndex );
+
+            // The shader swaps the two index sets before looking up the weights, so the
+            // weights come from the table of the other set.  Mirrored so the same mode wins.
+            LookupWeights( c.uIndexSelector ? uAlphaIndex : uIndex, uPrecRGB, uWeightRGB );
+            LookupWeights( c.uIndexSelector ? uIndex : uAlphaIndex, uPrecA, uWeightA );
+
+            c.uError = SubsetError( pChannel, c.uMode, endPoint, uWeightRGB, uWeightA, 0xFFFF, TRUE );
+        }
+        else
+        {
+            c.uMode = 6;
+
+            SubsetMinMax( texels, 0, 0xFFFF, endPoint );
+            CompressEndPoints( 6, endPoint );
+            GetChannels( texels, 0, pChannel );
+
+            int span[4];
+            GetSpan( endPoint, TRUE, TRUE, span );
+            FixAnchor( texels, 0, 0, span, endPoint, 0, 3 );
+            GetSpan( endPoint, TRUE, TRUE, span );
+
+            FindIndices( pChannel, endPoint[0], span, 0, 0xFFFF, uIndex );
+            LookupWeights( uIndex, 0, uWeightRGB );
+
+            c.uError = SubsetError( pChannel, 6, endPoint, uWeightRGB, uWeightRGB, 0xFFFF, TRUE );
+        }
+    }
+
+    ReduceCandidates( candidate, 16 );
+    *pBest = candidate[0];
+}
+
+//--------------------------------------------------------------------------------------
+// TryMode137CS: one candidate per two-subset partition
+//--------------------------------------------------------------------------------------
+static void TryMode137( const BC7_TEXELS& texels, UINT uMode, BC7_CHOICE* pBest )
+{
+    BC7_CHOICE candidate[64];
+    const __m128* pChannel[4];
+    GetChannels( texels, 0, pChannel );
+
+    UINT uStep = ( 1 == uMode ) ? 1 : 2;
+
+    for ( UINT p = 0; p < 64; ++p )
+    {
+        UINT uMask[2];
+        uMask[1] = candidateSectionBit[p];
+        uMask[0] = ~uMask[1] & 0xFFFF;
+
+        UINT uIndex[16], uWeight[16];
+        int endPoint[2][2][4];
+        UINT uError = 0;
+        for ( UINT s = 0; s < 2; ++s )
+        {
+            SubsetMinMax( texels, 0, uMask[s], endPoint[s] );
+            CompressEndPoints( uMode, endPoint[s] );
+
+            int span[4];
+            GetSpan( endPoint[s], TRUE, 7 == uMode, span );
+            FixAnchor( texels, 0, s ? candidateFixUpIndex1D[p][0] : 0, span, endPoint[s], 0, 3 );
+            GetSpan( endPoint[s], TRUE, 7 == uMode, span );
+
+            FindIndices( pChannel, endPoint[s][0], span, uStep, uMask[s], uIndex );
+        }
+
+        LookupWeights( uIndex, uStep, uWeight );
+
+        // The shader picks the reconstruction subset of modes 1 and 3 from the three-subset
+        // table, which does not match the partition being tried.  Use the real subset.
+        for ( UINT s = 0; s < 2; ++s )
+            uError += SubsetError( pChannel, uMode, endPoint[s], uWeight, uWeight, uMask[s], 7 == uMode );
+
+        candidate[p].uError = uError;
+        candidate[p].uMode = uMode;
+        candidate[p].uPartition = p;
+        candidate[p].uIndexSelector = 0;
+        candidate[p].uRotation = 0;
+    }
+
+    ReduceCandidates( candidate, 64 );
+    if ( pBest->uError > candidate[0].uError )
+        *pBest = candidate[0];
+}
+
+static void GetSubsetMasks3( UINT uPartition, UINT* pMask )
+{
+    UINT bits2 = candidateSectionBit2[uPartition - 64];
+    pMask[2] = bits2 >> 16;
+    pMask[1] = bits2 & 0xFFFF & ~pMask[2];
+    pMask[0] = ~( pMask[1] | pMask[2] ) & 0xFFFF;
+}
+
+//--------------------------------------------------------------------------------------
+// TryMode02CS: one candidate per three-subset partition, 16 of them for mode 0
+//--------------------------------------------------------------------------------------
+static void TryMode02( const BC7_TEXELS& texels, UINT uMode, BC7_CHOICE* pBest )
+{
+    BC7_CHOICE candidate[64];
+    const __m128* pChannel[4];
+    GetChannels( texels, 0, pChannel );
+
+    UINT uNumPartitions = ( 0 == uMode ) ? 16 : 64;
+    UINT uStep = 1 + ( 2 == uMode );
+
+    for ( UINT t = 0; t < 64; ++t )
+    {
+        candidate[t].uError = MAX_UINT;
+        candidate[t].uMode = uMode;
+        candidate[t].uPartition = t + 64;
+        candidate[t].uIndexSelector = 0;
+        candidate[t].uRotation = 0;
+        if ( t >= uNumPartitions )
+            continue;
+
+        UINT uPartition = t + 64;
+        UINT uMask[3];
+        GetSubsetMasks3( uPartition, uMask );
+
+        UINT uIndex[16], uWeight[16];
+        int endPoint[3][2][4];
+        int iSpanNormSqr[3];
+        for ( UINT s = 0; s < 3; ++s )
+        {
+            SubsetMinMax( texels, 0, uMask[s], endPoint[s] );
+            CompressEndPoints( uMode, endPoint[s] );
+
+            int span[4];
+            GetSpan( endPoint[s], TRUE, FALSE, span );
+            FixAnchor( texels, 0, s ? candidateFixUpIndex1D[uPartition][s - 1] : 0, span, endPoint[s], 0, 3 );
+            GetSpan( endPoint[s], TRUE, FALSE, span );
+            iSpanNormSqr[s] = Dot( span, span );
+
+            FindIndices( pChannel, endPoint[s][0], span, uStep, uMask[s], uIndex );
+        }
+
+        // The shader tests the second subset's span for texels of the third subset
+        if ( iSpanNormSqr[1] <= 0 )
+        {
+            for ( UINT i = 0; i < 16; ++i )
+            {
+                if ( ( uMask[2] >> i ) & 1 )
+                    uIndex[i] = 0;
+            }
+        }
+
+        LookupWeights( uIndex, uStep, uWeight );
+
+        UINT uError = 0;
+        for ( UINT s = 0; s < 3; ++s )
+            uError += SubsetError( pChannel, uMode, endPoint[s], uWeight, uWeight, uMask[s], FALSE );
+        candidate[t].uError = uError;
+    }
+
+    ReduceCandidates( candidate, 64 );
+    if ( pBest->uError > candidate[0].uError )
+        *pBest = candidate[0];
+}
+
+//--------------------------------------------------------------------------------------
+// Bit packing, least significant bit first
+//--------------------------------------------------------------------------------------
+static void WriteBits( UINT* pBlock, UINT& uPos, UINT uValue, UINT uNumBits )
+{
+    if ( 0 == uNumBits )
+        return;
+
+    uValue &= ( 1 << uNumBits ) - 1;
+    UINT uShift = uPos & 31;
+    pBlock[uPos >> 5] |= uValue << uShift;
+    if ( uShift + uNumBits > 32 )
+        pBlock[( uPos >> 5 ) + 1] |= uValue >> ( 32 - uShift );
+    uPos += uNumBits;
+}
+
+static UINT ReadBits( const UINT* pBlock, UINT& uPos, UINT uNumBits )
+{
+    if ( 0 == uNumBits )
+        return 0;
+
+    UINT uShift = uPos & 31;
+    UINT uValue = pBlock[uPos >> 5] >> uShift;
+    if ( uShift + uNumBits > 32 )
+        uValue |= pBlock[( uPos >> 5 ) + 1] << ( 32 - uShift );
+    uPos += uNumBits;
+    return uValue & ( ( 1 << uNumBits ) - 1 );
+}
+
+static BOOL IsAnchor( UINT uNumSubsets, UINT uPartition, UINT i )
+{
+    return 0 == i || ( uNumSubsets > 1 && i == candidateFixUpIndex1D[uPartition][0] )
+                  || ( uNumSubsets > 2 && i == candidateFixUpIndex1D[uPartition][1] );
+}
+
+static void GetSubsetMasks( UINT uMode, UINT uPartition, UINT* pMask )
+{
+    UINT uNumSubsets = aModeInfo[uMode].uNumSubsets;
+    if ( 3 == uNumSubsets )
+    {
+        GetSubsetMasks3( uPartition, pMask );
+    }
+    else if ( 2 == uNumSubsets )
+    {
+        pMask[1] = candidateSectionBit[uPartition];
+        pMask[0] = ~pMask[1] & 0xFFFF;
+    }
+    else
+    {
+        pMask[0] = 0xFFFF;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// The endpoint bytes hold the compressed value in their top bits, followed by the P-bit
+//--------------------------------------------------------------------------------------
+static void PackBlock( const BC7_CHOICE& choice, const int endPoint[3][2][4], const UINT* pIndex,
+                       const UINT* pIndex2, UINT* pBlock )
+{
+    const BC7_MODE_INFO& info = aModeInfo[choice.uMode];
+    UINT uPos = 0;
+
+    pBlock[0] = pBlock[1] = pBlock[2] = pBlock[3] = 0;
+
+    WriteBits( pBlock, uPos, 1 << choice.uMode, choice.uMode + 1 );
+    WriteBits( pBlock, uPos, 3 == info.uNumSubsets ? choice.uPartition - 64 : choice.uPartition, info.uPartitionBits );
+    WriteBits( pBlock, uPos, choice.uRotation, info.uRotationBits );
+    WriteBits( pBlock, uPos, choice.uIndexSelector, info.uIndexSelectorBits );
+
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        for ( UINT s = 0; s < info.uNumSubsets; ++s )
+        {
+            WriteBits( pBlock, uPos, endPoint[s][0][c] >> ( 8 - info.uColorBits ), info.uColorBits );
+            WriteBits( pBlock, uPos, endPoint[s][1][c] >> ( 8 - info.uColorBits ), info.uColorBits );
+        }
+    }
+    for ( UINT s = 0; s < info.uNumSubsets && info.uAlphaBits; ++s )
+    {
+        WriteBits( pBlock, uPos, endPoint[s][0][3] >> ( 8 - info.uAlphaBits ), info.uAlphaBits );
+        WriteBits( pBlock, uPos, endPoint[s][1][3] >> ( 8 - info.uAlphaBits ), info.uAlphaBits );
+    }
+
+    UINT uPBitShift = 7 - info.uColorBits;
+    for ( UINT s = 0; s < info.uNumSubsets && info.uPBits; ++s )
+    {
+        WriteBits( pBlock, uPos, endPoint[s][0][0] >> uPBitShift, 1 );
+        if ( 1 == info.uPBits )
+            WriteBits( pBlock, uPos, endPoint[s][1][0] >> uPBitShift, 1 );
+    }
+
+    // The anchor swap keeps the top bit of the anchor indices clear, so it is dropped
+    for ( UINT i = 0; i < 16; ++i )
+        WriteBits( pBlock, uPos, pIndex[i], info.uIndexBits - IsAnchor( info.uNumSubsets, choice.uPartition, i ) );
+    for ( UINT i = 0; i < 16 && info.uIndexBits2; ++i )
+        WriteBits( pBlock, uPos, pIndex2[i], info.uIndexBits2 - ( 0 == i ) );
+}
+
+//--------------------------------------------------------------------------------------
+// EncodeBlockCS: recomputes the endpoints and indices of the chosen mode and packs them
+//--------------------------------------------------------------------------------------
+static void EncodeBlock( const BC7_TEXELS& texels, const BC7_CHOICE& choice, UINT* pBlock )
+{
+    UINT uMode = choice.uMode;
+    UINT uRotation = choice.uRotation;
+    UINT uNumSubsets = aModeInfo[uMode].uNumSubsets;
+    const __m128* pChannel[4];
+    GetChannels( texels, uRotation, pChannel );
+
+    UINT uMask[3];
+    GetSubsetMasks( uMode, choice.uPartition, uMask );
+
+    int endPoint[3][2][4];
+    UINT uColorIndex[16], uAlphaIndex[16];
+    for ( UINT i = 0; i < 16; ++i )
+        uColorIndex[i] = uAlphaIndex[i] = 0;
+
+    if ( 4 == uMode || 5 == uMode )
+    {
+        UINT uPrecRGB = 2, uPrecA = 2;
+        if ( 4 == uMode )
+        {
+            uPrecRGB = choice.uIndexSelector ? 1 : 2;
+            uPrecA = choice.uIndexSelector ? 2 : 1;
+        }
+
+        SubsetMinMax( texels, uRotation, 0xFFFF, endPoint[0] );
+        CompressEndPoints( uMode, endPoint[0] );
+
+        int spanRGB[4], spanA[4];
+        GetSpan( endPoint[0], TRUE, FALSE, spanRGB );
+        GetSpan( endPoint[0], FALSE, TRUE, spanA );
+        FixAnchor( texels, uRotation, 0, spanRGB, endPoint[0], 0, 2 );
+        FixAnchor( texels, uRotation, 0, spanA, endPoint[0], 3, 3 );
+        GetSpan( endPoint[0], TRUE, FALSE, spanRGB );
+        GetSpan( endPoint[0], FALSE, TRUE, spanA );
+
+        FindIndices( pChannel, endPoint[0][0], spanRGB, uPrecRGB, 0xFFFF, uColorIndex );
+        FindIndices( pChannel, endPoint[0][0], spanA, uPrecA, 0xFFFF, uAlphaIndex );
+
+        // The 2 bit index set is always stored first
+        if ( choice.uIndexSelector )
+            PackBlock( choice, endPoint, uAlphaIndex, uColorIndex, pBlock );
+        else
+            PackBlock( choice, endPoint, uColorIndex, uAlphaIndex, pBlock );
+        return;
+    }
+
+    UINT uPrec;
+    if ( 0 == uMode || 1 == uMode )
+        uPrec = 1;
+    else if ( 6 == uMode )
+        uPrec = 0;
+    else
+        uPrec = 2;
+
+    for ( UINT s = 0; s < uNumSubsets; ++s )
+    {
+        SubsetMinMax( texels, uRotation, uMask[s], endPoint[s] );
+        CompressEndPoints( uMode, endPoint[s] );
+
+        int span[4];
+        GetSpan( endPoint[s], TRUE, uMode >= 4, span );
+        FixAnchor( texels, uRotation, s ? candidateFixUpIndex1D[choice.uPartition][s - 1] : 0, span, endPoint[s], 0, 3 );
+        GetSpan( endPoint[s], TRUE, uMode >= 4, span );
+
+        FindIndices( pChannel, endPoint[s][0], span, uPrec, uMask[s], uColorIndex );
+    }
+
+    PackBlock( choice, endPoint, uColorIndex, NULL, pBlock );
+}
+
+//--------------------------------------------------------------------------------------
+// Block statistics the quality levels use to skip modes, see BC7Quality.h
+//--------------------------------------------------------------------------------------
+static BOOL HasAlpha( const BC7_TEXELS& texels )
+{
+    for ( UINT i = 0; i < 16; ++i )
+    {
+        if ( texels.iTexel[i][3] != 255 )
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static UINT Variance( const BC7_TEXELS& texels )
+{
+    UINT uVariance = 0;
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        UINT uSum = 0, uSumSqr = 0;
+        for ( UINT i = 0; i < 16; ++i )
+        {
+            uSum += texels.iTexel[i][c];
+            uSumSqr += texels.iTexel[i][c] * texels.iTexel[i][c];
+        }
+        uVariance += uSumSqr - uSum * uSum / 16;
+    }
+    return uVariance;
+}
+
+//--------------------------------------------------------------------------------------
+void CPU_BC7EncodeBlock( const BYTE* pTexels, UINT* pBlock, BC7_QUALITY quality )
+{
+    const BC7_QUALITY_SETTINGS& settings = GetBC7QualitySettings( quality );
+
+    BC7_TEXELS texels;
+    LoadTexels( pTexels, &texels );
+
+    BOOL bSkipOpaqueModes = settings.bSkipOpaqueModesOnAlpha && HasAlpha( texels );
+    UINT uModeMask = settings.uModeMask;
+    if ( bSkipOpaqueModes )
+        uModeMask &= ~0x0F;
+    if ( ( uModeMask & 0x05 ) && Variance( texels ) < settings.uMinVariance3Subsets )
+        uModeMask &= ~0x05;
+
+    // Same order as CGPUBC7Encoder::GPU_BC7Encode, a later mode wins only when it is strictly better
+    static const UINT aPartitionedModes[] = { 1, 3, 7, 0, 2 };
+    BC7_CHOICE best;
+    TryMode456( texels, &best );
+    for ( UINT i = 0; i < ARRAYSIZE( aPartitionedModes ); ++i )
+    {
+        UINT uMode = aPartitionedModes[i];
+        if ( !( uModeMask & ( 1 << uMode ) ) || best.uError <= settings.uErrorThreshold )
+            continue;
+
+        if ( uMode == 0 || uMode == 2 )
+            TryMode02( texels, uMode, &best );
+        else
+            TryMode137( texels, uMode, &best );
+    }
+
+    EncodeBlock( texels, best, pBlock );
+}
+
+//--------------------------------------------------------------------------------------
+void CPU_BC7DecodeBlock( const UINT* pBlock, BYTE* pTexels )
+{
+    UINT uMode = 0;
+    while ( uMode < 8 && 0 == ( ( pBlock[0] >> uMode ) & 1 ) )
+        ++uMode;
+
+    if ( uMode >= 8 )
+    {
+        // Reserved mode, decodes to transparent black
+        ZeroMemory( pTexels, 64 );
+        return;
+    }
+
+    const BC7_MODE_INFO& info = aModeInfo[uMode];
+    UINT uPos = uMode + 1;
+
+    UINT uPartition = ReadBits( pBlock, uPos, info.uPartitionBits ) + ( 3 == info.uNumSubsets ? 64 : 0 );
+    UINT uRotation = ReadBits( pBlock, uPos, info.uRotationBits );
+    UINT uIndexSelector = ReadBits( pBlock, uPos, info.uIndexSelectorBits );
+
+    UINT endPoint[3][2][4];
+    for ( UINT c = 0; c < 3; ++c )
+    {
+        for ( UINT s = 0; s < info.uNumSubsets; ++s )
+        {
+            endPoint[s][0][c] = ReadBits( pBlock, uPos, info.uColorBits );
+            endPoint[s][1][c] = ReadBits( pBlock, uPos, info.uColorBits );
+        }
+    }
+    for ( UINT s = 0; s < info.uNumSubsets; ++s )
+    {
+        endPoint[s][0][3] = ReadBits( pBlock, uPos, info.uAlphaBits );
+        endPoint[s][1][3] = ReadBits( pBlock, uPos, info.uAlphaBits );
+    }
+
+    UINT uColorBits = info.uColorBits;
+    UINT uAlphaBits = info.uAlphaBits;
+    if ( info.uPBits )
+    {
+        for ( UINT s = 0; s < info.uNumSubsets; ++s )
+        {
+            UINT uPBit[2];
+            uPBit[0] = ReadBits( pBlock, uPos, 1 );
+            uPBit[1] = ( 1 == info.uPBits ) ? ReadBits( pBlock, uPos, 1 ) : uPBit[0];
+            for ( UINT e = 0; e < 2; ++e )
+            {
+                for ( UINT c = 0; c < 4; ++c )
+                    endPoint[s][e][c] = ( endPoint[s][e][c] << 1 ) | uPBit[e];
+            }
+        }
+        ++uColorBits;
+        if ( uAlphaBits )
+            ++uAlphaBits;
+    }
+
+    // Expand to 8 bits by replicating the top bits
+    for ( UINT s = 0; s < info.uNumSubsets; ++s )
+    {
+        for ( UINT e = 0; e < 2; ++e )
+        {
+            for ( UINT c = 0; c < 3; ++c )
+            {
+                UINT v = endPoint[s][e][c] << ( 8 - uColorBits );
+                endPoint[s][e][c] = v | ( v >> uColorBits );
+            }
+            if ( uAlphaBits )
+            {
+                UINT v = endPoint[s][e][3] << ( 8 - uAlphaBits );
+                endPoint[s][e][3] = v | ( v >> uAlphaBits );
+            }
+            else
+            {
+                endPoint[s][e][3] = 255;
+            }
+        }
+    }
+
+    UINT uIndex[16], uIndex2[16];
+    for ( UINT i = 0; i < 16; ++i )
+        uIndex[i] = ReadBits( pBlock, uPos, info.uIndexBits - IsAnchor( info.uNumSubsets, uPartition, i ) );
+    for ( UINT i = 0; i < 16; ++i )
+        uIndex2[i] = info.uIndexBits2 ? ReadBits( pBlock, uPos, info.uIndexBits2 - ( 0 == i ) ) : uIndex[i];
+
+    UINT uColorIndexBits = info.uIndexBits;
+    UINT uAlphaIndexBits = info.uIndexBits2 ? info.uIndexBits2 : info.uIndexBits;
+    const UINT* pColorIndex = uIndex;
+    const UINT* pAlphaIndex = uIndex2;
+    if ( uIndexSelector )
+    {
+        pColorIndex = uIndex2;
+        pAlphaIndex = uIndex;
+        uColorIndexBits = info.uIndexBits2;
+        uAlphaIndexBits = info.uIndexBits;
+    }
+
+    UINT uMask[3];
+    GetSubsetMasks( uMode, uPartition, uMask );
+
+    for ( UINT i = 0; i < 16; ++i )
+    {
+        UINT s = ( ( uMask[2] >> i ) & 1 ) && info.uNumSubsets > 2 ? 2 : ( ( uMask[1] >> i ) & 1 ) && info.uNumSubsets > 1 ? 1 : 0;
+        UINT wc = aWeight[4 - uColorIndexBits][pColorIndex[i]];
+        UINT wa = aWeight[4 - uAlphaIndexBits][pAlphaIndex[i]];
+
+        BYTE texel[4];
+        for ( UINT c = 0; c < 3; ++c )
+            texel[c] = (BYTE)( ( ( 64 - wc ) * endPoint[s][0][c] + wc * endPoint[s][1][c] + 32 ) >> 6 );
+        texel[3] = (BYTE)( ( ( 64 - wa ) * endPoint[s][0][3] + wa * endPoint[s][1][3] + 32 ) >> 6 );
+
+        for ( UINT c = 0; c < 4; ++c )
+            pTexels[i * 4 + aRotation[uRotation][c]] = texel[c];
+    }
+}
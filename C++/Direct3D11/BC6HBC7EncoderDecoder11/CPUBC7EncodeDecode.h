@@ -0,0 +1,28 @@
+//--------------------------------------------------------------------------------------
+// File: CPUBC7EncodeDecode.h
+//
+// CPU BC7 block Encoder/Decoder
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#ifndef __CPUBC7ENCODE_H
+#define __CPUBC7ENCODE_H
+
+#pragma once
+
+#include "BC7Quality.h"
+
+//--------------------------------------------------------------------------------------
+// Encodes one 4x4 block of R8G8B8A8 texels, stored row by row, into a 16 byte BC7 block.
+// Runs the same mode 4/5/6, 1/3/7 and 0/2 search as BC7Encode.hlsl, cut down the same
+// way for the lower quality levels.
+//--------------------------------------------------------------------------------------
+void CPU_BC7EncodeBlock( const BYTE* pTexels, UINT* pBlock, BC7_QUALITY quality = BC7_QUALITY_EXHAUSTIVE );
+
+//--------------------------------------------------------------------------------------
+// Decodes one 16 byte BC7 block into 4x4 R8G8B8A8 texels, stored row by row
+//--------------------------------------------------------------------------------------
+void CPU_BC7DecodeBlock( const UINT* pBlock, BYTE* pTexels );
+
+#endif
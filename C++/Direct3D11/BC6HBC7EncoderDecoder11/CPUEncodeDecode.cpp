@@ -0,0 +1,261 @@
+//--------------------------------------------------------------------------------------
+// File: CPUEncodeDecode.cpp
+//
+// Multithreaded CPU BC6H BC7 Encoder/Decoder
+//
+// The texture is split into 4x4 blocks, numbered row by row, and the blocks are handed
+// to the task pool.  Encoding a block is far more expensive than decoding one, and its
+// cost varies with the content, so encoding uses a small grain and relies on the pool's
+// work stealing to even out the load.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <d3d11.h>
+#include <d3dx10math.h>    // for D3DXFloat16To32Array
+#include "utils.h"
+#include "CPUBC6HEncodeDecode.h"
+#include "CPUBC7EncodeDecode.h"
+#include "CPUEncodeDecode.h"
+
+#define BLOCK_SIZE_Y            4
+#define BLOCK_SIZE_X            4
+#define BLOCK_SIZE              (BLOCK_SIZE_Y * BLOCK_SIZE_X)
+#define BLOCK_BYTES             16
+
+#define ENCODE_GRAIN            4
+#define DECODE_GRAIN            256
+
+//--------------------------------------------------------------------------------------
+// What the worker threads need to know about one mip level
+//--------------------------------------------------------------------------------------
+struct CPU_BLOCK_JOB
+{
+    const BYTE* pSrc;
+    UINT uSrcRowPitch;
+    BYTE* pDst;
+    UINT uDstRowPitch;
+    UINT uWidth;
+    UINT uHeight;
+    UINT uNumBlocksX;
+    BOOL bSigned;
+    BC7_QUALITY bc7Quality;
+};
+
+//--------------------------------------------------------------------------------------
+// Texels past the right and bottom edges of a texture that is not a multiple of 4 in
+// size repeat the last column and row, so they do not drag the endpoints away
+//--------------------------------------------------------------------------------------
+static const BYTE* GetSrcTexel( const CPU_BLOCK_JOB* pJob, UINT x, UINT y, UINT uTexelSize )
+{
+    x = min( x, pJob->uWidth - 1 );
+    y = min( y, pJob->uHeight - 1 );
+    return pJob->pSrc + y * pJob->uSrcRowPitch + x * uTexelSize;
+}
+
+static void EncodeBC7Blocks( void* pContext, UINT uBegin, UINT uEnd )
+{
+    const CPU_BLOCK_JOB* pJob = (const CPU_BLOCK_JOB*)pContext;
+    BYTE texels[BLOCK_SIZE * 4];
+
+    for ( UINT uBlock = uBegin; uBlock < uEnd; ++uBlock )
+    {
+        UINT bx = ( uBlock % pJob->uNumBlocksX ) * BLOCK_SIZE_X;
+        UINT by = ( uBlock / pJob->uNumBlocksX ) * BLOCK_SIZE_Y;
+
+        for ( UINT i = 0; i < BLOCK_SIZE; ++i )
+            memcpy( &texels[i * 4], GetSrcTexel( pJob, bx + i % BLOCK_SIZE_X, by + i / BLOCK_SIZE_X, 4 ), 4 );
+
+        BYTE* pBlock = pJob->pDst + ( by / BLOCK_SIZE_Y ) * pJob->uDstRowPitch + ( bx / BLOCK_SIZE_X ) * BLOCK_BYTES;
+        CPU_BC7EncodeBlock( texels, (UINT*)pBlock, pJob->bc7Quality );
+    }
+}
+
+static void DecodeBC7Blocks( void* pContext, UINT uBegin, UINT uEnd )
+{
+    const CPU_BLOCK_JOB* pJob = (const CPU_BLOCK_JOB*)pContext;
+    BYTE texels[BLOCK_SIZE * 4];
+
+    for ( UINT uBlock = uBegin; uBlock < uEnd; ++uBlock )
+    {
+        UINT bx = ( uBlock % pJob->uNumBlocksX ) * BLOCK_SIZE_X;
+        UINT by = ( uBlock / pJob->uNumBlocksX ) * BLOCK_SIZE_Y;
+
+        const BYTE* pBlock = pJob->pSrc + ( by / BLOCK_SIZE_Y ) * pJob->uSrcRowPitch + ( bx / BLOCK_SIZE_X ) * BLOCK_BYTES;
+        CPU_BC7DecodeBlock( (const UINT*)pBlock, texels );
+
+        for ( UINT y = 0; y < BLOCK_SIZE_Y && by + y < pJob->uHeight; ++y )
+        {
+            UINT uNumTexels = min( BLOCK_SIZE_X, pJob->uWidth - bx );
+            memcpy( pJob->pDst + ( by + y ) * pJob->uDstRowPitch + bx * 4,
+                    &texels[y * BLOCK_SIZE_X * 4], uNumTexels * 4 );
+        }
+    }
+}
+
+static void EncodeBC6HBlocks( void* pContext, UINT uBegin, UINT uEnd )
+{
+    const CPU_BLOCK_JOB* pJob = (const CPU_BLOCK_JOB*)pContext;
+    float texels[BLOCK_SIZE * 4];
+
+    for ( UINT uBlock = uBegin; uBlock < uEnd; ++uBlock )
+    {
+        UINT bx = ( uBlock % pJob->uNumBlocksX ) * BLOCK_SIZE_X;
+        UINT by = ( uBlock / pJob->uNumBlocksX ) * BLOCK_SIZE_Y;
+
+        for ( UINT i = 0; i < BLOCK_SIZE; ++i )
+            memcpy( &texels[i * 4], GetSrcTexel( pJob, bx + i % BLOCK_SIZE_X, by + i / BLOCK_SIZE_X, 16 ), 16 );
+
+        BYTE* pBlock = pJob->pDst + ( by / BLOCK_SIZE_Y ) * pJob->uDstRowPitch + ( bx / BLOCK_SIZE_X ) * BLOCK_BYTES;
+        CPU_BC6HEncodeBlock( texels, pJob->bSigned, (UINT*)pBlock );
+    }
+}
+
+static void DecodeBC6HBlocks( void* pContext, UINT uBegin, UINT uEnd )
+{
+    const CPU_BLOCK_JOB* pJob = (const CPU_BLOCK_JOB*)pContext;
+    USHORT texels[BLOCK_SIZE * 4];
+
+    for ( UINT uBlock = uBegin; uBlock < uEnd; ++uBlock )
+    {
+        UINT bx = ( uBlock % pJob->uNumBlocksX ) * BLOCK_SIZE_X;
+        UINT by = ( uBlock / pJob->uNumBlocksX ) * BLOCK_SIZE_Y;
+
+        const BYTE* pBlock = pJob->pSrc + ( by / BLOCK_SIZE_Y ) * pJob->uSrcRowPitch + ( bx / BLOCK_SIZE_X ) * BLOCK_BYTES;
+        CPU_BC6HDecodeBlock( (const UINT*)pBlock, pJob->bSigned, texels );
+
+        for ( UINT y = 0; y < BLOCK_SIZE_Y && by + y < pJob->uHeight; ++y )
+        {
+            UINT uNumTexels = min( BLOCK_SIZE_X, pJob->uWidth - bx );
+            D3DXFloat16To32Array( (FLOAT*)( pJob->pDst + ( by + y ) * pJob->uDstRowPitch + bx * 16 ),
+                                  (D3DXFLOAT16*)&texels[y * BLOCK_SIZE_X * 4], uNumTexels * 4 );
+        }
+    }
+}
+
+HRESULT CCPUBCEncoderDecoder::Initialize( UINT uNumThreads )
+{
+    return m_TaskPool.Initialize( uNumThreads );
+}
+
+void CCPUBCEncoderDecoder::Cleanup()
+{
+    m_TaskPool.Cleanup();
+}
+
+BOOL CCPUBCEncoderDecoder::IsSupported( DXGI_FORMAT fmtSrc, DXGI_FORMAT fmtDst )
+{
+    switch ( fmtSrc )
+    {
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+        return fmtDst == DXGI_FORMAT_BC7_UNORM;
+    case DXGI_FORMAT_BC7_UNORM:
+        return fmtDst == DXGI_FORMAT_R8G8B8A8_UNORM;
+    case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        return fmtDst == DXGI_FORMAT_BC6H_UF16 || fmtDst == DXGI_FORMAT_BC6H_SF16;
+    case DXGI_FORMAT_BC6H_UF16:
+    case DXGI_FORMAT_BC6H_SF16:
+        return fmtDst == DXGI_FORMAT_R32G32B32A32_FLOAT;
+    default:
+        return FALSE;
+    }
+}
+
+HRESULT CCPUBCEncoderDecoder::EncodeDecode( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
+                                            ID3D11Texture2D* pSrcTexture, DXGI_FORMAT fmtDst,
+                                            ID3D11Texture2D** ppDstTextureOut, double* pfMPixelsPerSec )
+{
+    HRESULT hr = S_OK;
+
+    ID3D11Device* pSrcDevice = NULL;
+    ID3D11DeviceContext* pSrcContext = NULL;
+    LPTASKPOOLFUNC pfnFunc = NULL;
+    UINT uGrain = 1;
+    UINT64 uNumPixels = 0;
+    LARGE_INTEGER liFreq, liTicks;
+    liTicks.QuadPart = 0;
+
+    D3D11_TEXTURE2D_DESC texDesc;
+    pSrcTexture->GetDesc( &texDesc );
+
+    if ( !IsSupported( texDesc.Format, fmtDst ) || texDesc.ArraySize != 1 )
+        return E_INVALIDARG;
+
+    switch ( fmtDst )
+    {
+    case DXGI_FORMAT_BC7_UNORM:             pfnFunc = EncodeBC7Blocks;  uGrain = ENCODE_GRAIN; break;
+    case DXGI_FORMAT_BC6H_UF16:
+    case DXGI_FORMAT_BC6H_SF16:             pfnFunc = EncodeBC6HBlocks; uGrain = ENCODE_GRAIN; break;
+    case DXGI_FORMAT_R8G8B8A8_UNORM:        pfnFunc = DecodeBC7Blocks;  uGrain = DECODE_GRAIN; break;
+    default:                                pfnFunc = DecodeBC6HBlocks; uGrain = DECODE_GRAIN; break;
+    }
+
+    CPU_BLOCK_JOB job;
+    job.bSigned = ( texDesc.Format == DXGI_FORMAT_BC6H_SF16 || fmtDst == DXGI_FORMAT_BC6H_SF16 );
+    job.bc7Quality = m_BC7Quality;
+
+    // The source may live on another device, see LoadTextureFromFile
+    pSrcTexture->GetDevice( &pSrcDevice );
+    pSrcDevice->GetImmediateContext( &pSrcContext );
+
+    texDesc.Format = fmtDst;
+    texDesc.Usage = D3D11_USAGE_STAGING;
+    texDesc.BindFlags = 0;
+    texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
+    texDesc.MiscFlags = 0;
+    SAFE_RELEASE( *ppDstTextureOut );
+    V_GOTO( pDevice->CreateTexture2D( &texDesc, NULL, ppDstTextureOut ) );
+#if defined(DEBUG) || defined(PROFILE)
+    (*ppDstTextureOut)->SetPrivateData( WKPDID_D3DDebugObjectName, sizeof( "Result" ) - 1, "Result" );
+#endif
+
+    QueryPerformanceFrequency( &liFreq );
+
+    for ( UINT uMip = 0; uMip < texDesc.MipLevels; ++uMip )
+    {
+        UINT uSubresource = D3D11CalcSubresource( uMip, 0, texDesc.MipLevels );
+
+        D3D11_MAPPED_SUBRESOURCE mappedSrc, mappedDst;
+        V_GOTO( pSrcContext->Map( pSrcTexture, uSubresource, D3D11_MAP_READ, 0, &mappedSrc ) );
+        hr = pContext->Map( *ppDstTextureOut, uSubresource, D3D11_MAP_WRITE, 0, &mappedDst );
+        if ( FAILED( hr ) )
+        {
+            pSrcContext->Unmap( pSrcTexture, uSubresource );
+            goto quit;
+        }
+
+        job.pSrc = (const BYTE*)mappedSrc.pData;
+        job.uSrcRowPitch = mappedSrc.RowPitch;
+        job.pDst = (BYTE*)mappedDst.pData;
+        job.uDstRowPitch = mappedDst.RowPitch;
+        job.uWidth = max( texDesc.Width >> uMip, 1 );
+        job.uHeight = max( texDesc.Height >> uMip, 1 );
+        job.uNumBlocksX = ( job.uWidth + BLOCK_SIZE_X - 1 ) / BLOCK_SIZE_X;
+        UINT uNumBlocks = job.uNumBlocksX * ( ( job.uHeight + BLOCK_SIZE_Y - 1 ) / BLOCK_SIZE_Y );
+
+        LARGE_INTEGER liStart, liStop;
+        QueryPerformanceCounter( &liStart );
+        m_TaskPool.ParallelFor( uNumBlocks, uGrain, pfnFunc, &job );
+        QueryPerformanceCounter( &liStop );
+        liTicks.QuadPart += liStop.QuadPart - liStart.QuadPart;
+        uNumPixels += (UINT64)job.uWidth * job.uHeight;
+
+        pContext->Unmap( *ppDstTextureOut, uSubresource );
+        pSrcContext->Unmap( pSrcTexture, uSubresource );
+    }
+
+    if ( pfMPixelsPerSec )
+    {
+        double fSeconds = (double)liTicks.QuadPart / (double)liFreq.QuadPart;
+        *pfMPixelsPerSec = fSeconds > 0 ? (double)uNumPixels / fSeconds / 1000000.0 : 0;
+    }
+
+quit:
+    if ( FAILED( hr ) )
+        SAFE_RELEASE( *ppDstTextureOut );
+    SAFE_RELEASE( pSrcContext );
+    SAFE_RELEASE( pSrcDevice );
+
+    return hr;
+}
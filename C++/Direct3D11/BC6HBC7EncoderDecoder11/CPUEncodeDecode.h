@@ -0,0 +1,55 @@
+//--------------------------------------------------------------------------------------
+// File: CPUEncodeDecode.h
+//
+// Multithreaded CPU BC6H BC7 Encoder/Decoder
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#ifndef __CPUENCODEDECODE_H
+#define __CPUENCODEDECODE_H
+
+#pragma once
+
+#include "TaskPool.h"
+#include "BC7Quality.h"
+
+class CCPUBCEncoderDecoder
+{
+public:
+    CCPUBCEncoderDecoder()
+        : m_BC7Quality( BC7_QUALITY_EXHAUSTIVE )
+    {}
+
+    //--------------------------------------------------------------------------------------
+    // uNumThreads is passed to the task pool, 0 means one thread per logical processor
+    //--------------------------------------------------------------------------------------
+    HRESULT Initialize( UINT uNumThreads = 0 );
+    void Cleanup();
+
+    UINT GetNumThreads() { return m_TaskPool.GetNumThreads(); }
+
+    void SetBC7Quality( BC7_QUALITY quality ) { m_BC7Quality = quality; }
+    BC7_QUALITY GetBC7Quality() { return m_BC7Quality; }
+
+    //--------------------------------------------------------------------------------------
+    // Returns TRUE for the conversions EncodeDecode handles:
+    // R8G8B8A8_UNORM <-> BC7_UNORM and R32G32B32A32_FLOAT <-> BC6H_UF16/BC6H_SF16
+    //--------------------------------------------------------------------------------------
+    static BOOL IsSupported( DXGI_FORMAT fmtSrc, DXGI_FORMAT fmtDst );
+
+    //--------------------------------------------------------------------------------------
+    // Encodes or decodes every mip of pSrcTexture, which must be CPU readable, into a new
+    // staging texture of format fmtDst.  pfMPixelsPerSec, if not NULL, receives the rate
+    // the blocks were processed at, not counting the time spent mapping the textures.
+    //--------------------------------------------------------------------------------------
+    HRESULT EncodeDecode( ID3D11Device* pDevice, ID3D11DeviceContext* pContext,
+                          ID3D11Texture2D* pSrcTexture, DXGI_FORMAT fmtDst,
+                          ID3D11Texture2D** ppDstTextureOut, double* pfMPixelsPerSec );
+
+protected:
+    CTaskPool m_TaskPool;
+    BC7_QUALITY m_BC7Quality;
+};
+
+#endif
@@ -0,0 +1,225 @@
+//--------------------------------------------------------------------------------------
+// File: TaskPool.cpp
+//
+// A small work stealing thread pool for the CPU BC6H BC7 Encoder/Decoder
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <windows.h>
+#include "TaskPool.h"
+
+HRESULT CTaskPool::Initialize( UINT uNumThreads )
+{
+    Cleanup();
+
+    if ( uNumThreads == 0 )
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo( &si );
+        uNumThreads = si.dwNumberOfProcessors;
+    }
+    if ( uNumThreads < 1 )
+        uNumThreads = 1;
+
+    m_pQueues = new WORKER_QUEUE[uNumThreads];
+    m_pParams = new WORKER_PARAM[uNumThreads];
+    m_phThreads = new HANDLE[uNumThreads];
+    m_phWakeEvents = new HANDLE[uNumThreads];
+    if ( !m_pQueues || !m_pParams || !m_phThreads || !m_phWakeEvents )
+    {
+        Cleanup();
+        return E_OUTOFMEMORY;
+    }
+
+    for ( UINT i = 0; i < uNumThreads; ++i )
+    {
+        InitializeCriticalSection( &m_pQueues[i].cs );
+        m_pQueues[i].uBegin = 0;
+        m_pQueues[i].uEnd = 0;
+        m_pParams[i].pPool = this;
+        m_pParams[i].uIndex = i;
+        m_phThreads[i] = NULL;
+        m_phWakeEvents[i] = NULL;
+    }
+    m_uNumThreads = uNumThreads;
+    m_lQuit = 0;
+
+    m_hDoneEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if ( !m_hDoneEvent )
+    {
+        Cleanup();
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    for ( UINT i = 1; i < uNumThreads; ++i )
+    {
+        m_phWakeEvents[i] = CreateEvent( NULL, FALSE, FALSE, NULL );
+        if ( m_phWakeEvents[i] )
+            m_phThreads[i] = CreateThread( NULL, 0, WorkerThreadProc, &m_pParams[i], 0, NULL );
+        if ( !m_phThreads[i] )
+        {
+            HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
+            Cleanup();
+            return hr;
+        }
+    }
+
+    return S_OK;
+}
+
+void CTaskPool::Cleanup()
+{
+    if ( m_uNumThreads > 0 )
+    {
+        InterlockedExchange( &m_lQuit, 1 );
+        for ( UINT i = 1; i < m_uNumThreads; ++i )
+        {
+            if ( m_phThreads[i] )
+            {
+                SetEvent( m_phWakeEvents[i] );
+                WaitForSingleObject( m_phThreads[i], INFINITE );
+                CloseHandle( m_phThreads[i] );
+            }
+            if ( m_phWakeEvents[i] )
+                CloseHandle( m_phWakeEvents[i] );
+        }
+        for ( UINT i = 0; i < m_uNumThreads; ++i )
+            DeleteCriticalSection( &m_pQueues[i].cs );
+    }
+
+    if ( m_hDoneEvent )
+    {
+        CloseHandle( m_hDoneEvent );
+        m_hDoneEvent = NULL;
+    }
+
+    delete[] m_pQueues;
+    delete[] m_pParams;
+    delete[] m_phThreads;
+    delete[] m_phWakeEvents;
+    m_pQueues = NULL;
+    m_pParams = NULL;
+    m_phThreads = NULL;
+    m_phWakeEvents = NULL;
+    m_uNumThreads = 0;
+}
+
+void CTaskPool::ParallelFor( UINT uNumItems, UINT uGrain, LPTASKPOOLFUNC pfnFunc, void* pContext )
+{
+    if ( uNumItems == 0 )
+        return;
+    if ( uGrain < 1 )
+        uGrain = 1;
+
+    // Not worth waking anybody up, or not initialized
+    if ( m_uNumThreads <= 1 || uNumItems <= uGrain )
+    {
+        for ( UINT uBegin = 0; uBegin < uNumItems; uBegin += uGrain )
+            pfnFunc( pContext, uBegin, min( uBegin + uGrain, uNumItems ) );
+        return;
+    }
+
+    m_pfnFunc = pfnFunc;
+    m_pContext = pContext;
+    m_uGrain = uGrain;
+
+    for ( UINT i = 0; i < m_uNumThreads; ++i )
+    {
+        m_pQueues[i].uBegin = (UINT)( (UINT64)uNumItems * i / m_uNumThreads );
+        m_pQueues[i].uEnd = (UINT)( (UINT64)uNumItems * ( i + 1 ) / m_uNumThreads );
+    }
+
+    m_lNumActive = m_uNumThreads;
+    for ( UINT i = 1; i < m_uNumThreads; ++i )
+        SetEvent( m_phWakeEvents[i] );
+
+    RunWorker( 0 );
+
+    if ( InterlockedDecrement( &m_lNumActive ) == 0 )
+        SetEvent( m_hDoneEvent );
+    WaitForSingleObject( m_hDoneEvent, INFINITE );
+}
+
+DWORD WINAPI CTaskPool::WorkerThreadProc( LPVOID pParam )
+{
+    WORKER_PARAM* pWorker = (WORKER_PARAM*)pParam;
+    CTaskPool* pPool = pWorker->pPool;
+
+    for (;;)
+    {
+        WaitForSingleObject( pPool->m_phWakeEvents[pWorker->uIndex], INFINITE );
+        if ( pPool->m_lQuit )
+            break;
+
+        pPool->RunWorker( pWorker->uIndex );
+
+        if ( InterlockedDecrement( &pPool->m_lNumActive ) == 0 )
+            SetEvent( pPool->m_hDoneEvent );
+    }
+
+    return 0;
+}
+
+void CTaskPool::RunWorker( UINT uIndex )
+{
+    // Items only ever move from one queue to another under the queue locks, and whoever
+    // moves them runs them, so a worker may leave as soon as it finds nothing to steal
+    for (;;)
+    {
+        UINT uBegin, uEnd;
+        if ( PopChunk( uIndex, &uBegin, &uEnd ) )
+            m_pfnFunc( m_pContext, uBegin, uEnd );
+        else if ( !Steal( uIndex ) )
+            break;
+    }
+}
+
+BOOL CTaskPool::PopChunk( UINT uIndex, UINT* puBegin, UINT* puEnd )
+{
+    WORKER_QUEUE* pQueue = &m_pQueues[uIndex];
+    BOOL bFound = FALSE;
+
+    EnterCriticalSection( &pQueue->cs );
+    if ( pQueue->uBegin < pQueue->uEnd )
+    {
+        *puBegin = pQueue->uBegin;
+        *puEnd = min( pQueue->uBegin + m_uGrain, pQueue->uEnd );
+        pQueue->uBegin = *puEnd;
+        bFound = TRUE;
+    }
+    LeaveCriticalSection( &pQueue->cs );
+
+    return bFound;
+}
+
+BOOL CTaskPool::Steal( UINT uThief )
+{
+    // The owner works from the front of its range, so take the back half
+    for ( UINT i = 1; i < m_uNumThreads; ++i )
+    {
+        WORKER_QUEUE* pVictim = &m_pQueues[( uThief + i ) % m_uNumThreads];
+        UINT uBegin = 0, uEnd = 0;
+
+        EnterCriticalSection( &pVictim->cs );
+        if ( pVictim->uBegin < pVictim->uEnd )
+        {
+            uEnd = pVictim->uEnd;
+            uBegin = uEnd - ( uEnd - pVictim->uBegin + 1 ) / 2;
+            pVictim->uEnd = uBegin;
+        }
+        LeaveCriticalSection( &pVictim->cs );
+
+        if ( uBegin < uEnd )
+        {
+            WORKER_QUEUE* pQueue = &m_pQueues[uThief];
+            EnterCriticalSection( &pQueue->cs );
+            pQueue->uBegin = uBegin;
+            pQueue->uEnd = uEnd;
+            LeaveCriticalSection( &pQueue->cs );
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,85 @@
+//--------------------------------------------------------------------------------------
+// File: TaskPool.h
+//
+// A small work stealing thread pool for the CPU BC6H BC7 Encoder/Decoder
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#ifndef __TASKPOOL_H
+#define __TASKPOOL_H
+
+#pragma once
+
+//--------------------------------------------------------------------------------------
+// Processes the items [uBegin, uEnd)
+//--------------------------------------------------------------------------------------
+typedef void (*LPTASKPOOLFUNC)( void* pContext, UINT uBegin, UINT uEnd );
+
+class CTaskPool
+{
+public:
+    CTaskPool()
+        : m_uNumThreads( 0 ),
+        m_pQueues( NULL ),
+        m_pParams( NULL ),
+        m_phThreads( NULL ),
+        m_phWakeEvents( NULL ),
+        m_hDoneEvent( NULL ),
+        m_lNumActive( 0 ),
+        m_lQuit( 0 ),
+        m_pfnFunc( NULL ),
+        m_pContext( NULL ),
+        m_uGrain( 1 )
+    {}
+    ~CTaskPool() { Cleanup(); }
+
+    //--------------------------------------------------------------------------------------
+    // uNumThreads counts the thread calling ParallelFor, 0 means one per logical processor
+    //--------------------------------------------------------------------------------------
+    HRESULT Initialize( UINT uNumThreads = 0 );
+    void Cleanup();
+
+    //--------------------------------------------------------------------------------------
+    // Calls pfnFunc on chunks of at most uGrain items until all uNumItems are done, and
+    // returns once they are.  Every thread starts on an equal share of the items; a thread
+    // that runs out takes half of the remaining items of another one.
+    //--------------------------------------------------------------------------------------
+    void ParallelFor( UINT uNumItems, UINT uGrain, LPTASKPOOLFUNC pfnFunc, void* pContext );
+
+    UINT GetNumThreads() { return m_uNumThreads ? m_uNumThreads : 1; }
+
+protected:
+    struct WORKER_QUEUE
+    {
+        CRITICAL_SECTION cs;
+        UINT uBegin;
+        UINT uEnd;
+    };
+
+    struct WORKER_PARAM
+    {
+        CTaskPool* pPool;
+        UINT uIndex;
+    };
+
+    UINT m_uNumThreads;
+    WORKER_QUEUE* m_pQueues;
+    WORKER_PARAM* m_pParams;
+    HANDLE* m_phThreads;            // m_phThreads[0] is unused, the caller of ParallelFor is worker 0
+    HANDLE* m_phWakeEvents;
+    HANDLE m_hDoneEvent;
+    volatile LONG m_lNumActive;
+    volatile LONG m_lQuit;
+
+    LPTASKPOOLFUNC m_pfnFunc;
+    void* m_pContext;
+    UINT m_uGrain;
+
+    static DWORD WINAPI WorkerThreadProc( LPVOID pParam );
+    void RunWorker( UINT uIndex );
+    BOOL PopChunk( UINT uIndex, UINT* puBegin, UINT* puEnd );
+    BOOL Steal( UINT uThief );
+};
+
+#endif
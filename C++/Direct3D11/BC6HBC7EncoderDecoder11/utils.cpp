@@ -193,6 +193,13 @@ HRESULT CreateComputeShaderCached( LPCWSTR pSrcFile, LPCSTR pFunctionName, LPCST
 
     ID3DBlob* pBlob = NULL;
 
+    // A cached shader older than its source is stale
+    WIN32_FILE_ATTRIBUTE_DATA srcAttr, cacheAttr;
+    if ( GetFileAttributesEx( str, GetFileExInfoStandard, &srcAttr ) &&
+         GetFileAttributesEx( &fname[0], GetFileExInfoStandard, &cacheAttr ) &&
+         CompareFileTime( &srcAttr.ftLastWriteTime, &cacheAttr.ftLastWriteTime ) > 0 )
+        DeleteFile( &fname[0] );
+
 again:
     if ( 0xFFFFFFFF == GetFileAttributes( &fname[0] ) )
     {
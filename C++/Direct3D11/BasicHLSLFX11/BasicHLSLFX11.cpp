@@ -16,9 +16,16 @@
 #include "resource.h"
 
 #include <d3dx11effect.h>
+#include <string>
 
 #define MAX_LIGHTS 3
 
+// Size of the generated effect timed by -fxnamebench
+#define NAMEBENCH_NUM_CBUFFERS      40
+#define NAMEBENCH_VARS_PER_CBUFFER  50      // 2,000 variables in all
+#define NAMEBENCH_NUM_TECHNIQUES    100
+#define NAMEBENCH_DEFAULT_LOOKUPS   200000
+
 #pragma warning( disable : 4100 )
 
 using namespace DirectX;
@@ -94,6 +101,7 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 
 void InitApp();
 void RenderText();
+int RunNameLookupBenchmark( UINT iNumLookups );
 
 
 //--------------------------------------------------------------------------------------
@@ -110,6 +118,18 @@ int WINAPI wWinMain( _In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     // DXUT will create and use the best device
     // that is available on the system depending on which D3D callbacks are set below
 
+    // "BasicHLSLFX11.exe -fxnamebench [lookups]" times the effect by-name lookups with and
+    // without the name index, without creating a window, and writes the results to the debugger
+    int nArgs = 0;
+    LPWSTR* pstrArgs = CommandLineToArgvW( GetCommandLineW(), &nArgs );
+    if( pstrArgs && nArgs >= 2 && !_wcsicmp( pstrArgs[1], L"-fxnamebench" ) )
+    {
+        UINT iNumLookups = ( nArgs >= 3 ) ? (UINT)_wtoi( pstrArgs[2] ) : 0;
+        LocalFree( pstrArgs );
+        return RunNameLookupBenchmark( ( iNumLookups > 0 ) ? iNumLookups : NAMEBENCH_DEFAULT_LOOKUPS );
+    }
+    LocalFree( pstrArgs );
+
     // Set DXUT callbacks
     DXUTSetCallbackDeviceChanging( ModifyDeviceSettings );
     DXUTSetCallbackMsgProc( MsgProc );
@@ -625,3 +645,228 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
     g_Mesh11.Destroy();
 
 }
+
+
+//--------------------------------------------------------------------------------------
+// Builds the fx_5_0 source for the name lookup benchmark: NAMEBENCH_NUM_CBUFFERS cbuffers
+// of float4 variables and NAMEBENCH_NUM_TECHNIQUES single pass techniques.  Unused
+// variables stay in the effect, so nothing needs to reference them.
+//--------------------------------------------------------------------------------------
+std::string MakeNameBenchmarkEffect()
+{
+    std::string source;
+    char strLine[128];
+
+    for( UINT i = 0; i < NAMEBENCH_NUM_CBUFFERS; i++ )
+    {
+        sprintf_s( strLine, "cbuffer cbBench%02u\n{\n", i );
+        source += strLine;
+        for( UINT j = 0; j < NAMEBENCH_VARS_PER_CBUFFER; j++ )
+        {
+            sprintf_s( strLine, "    float4 g_vBench%04u;\n", i * NAMEBENCH_VARS_PER_CBUFFER + j );
+            source += strLine;
+        }
+        source += "};\n\n";
+    }
+
+    for( UINT i = 0; i < NAMEBENCH_NUM_TECHNIQUES; i++ )
+    {
+        sprintf_s( strLine, "technique11 BenchTech%03u\n{\n    pass P0\n    {\n", i );
+        source += strLine;
+        source += "        SetVertexShader( NULL );\n        SetPixelShader( NULL );\n    }\n}\n\n";
+    }
+
+    return source;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Looks every name up iNumLookups times in all, in a scattered order so successive
+// lookups don't hit the same part of the table.  Returns the seconds taken, or a
+// negative value if any lookup failed.
+//--------------------------------------------------------------------------------------
+double TimeVariableLookups( ID3DX11Effect* pEffect, const std::vector<std::string>& names, UINT iNumLookups,
+                            bool bExpectValid )
+{
+    const size_t count = names.size();
+    const size_t stride = 7919;     // prime, so the walk visits every name
+    size_t iName = 0;
+    UINT iFailed = 0;
+
+    LARGE_INTEGER liFrequency, liStart, liEnd;
+    QueryPerformanceFrequency( &liFrequency );
+    QueryPerformanceCounter( &liStart );
+    for( UINT i = 0; i < iNumLookups; i++ )
+    {
+        if( pEffect->GetVariableByName( names[iName].c_str() )->IsValid() != bExpectValid )
+            iFailed++;
+        iName = ( iName + stride ) % count;
+    }
+    QueryPerformanceCounter( &liEnd );
+
+    if( iFailed )
+        return -1.0;
+    return (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFrequency.QuadPart;
+}
+
+double TimeTechniqueLookups( ID3DX11Effect* pEffect, const std::vector<std::string>& names, UINT iNumLookups )
+{
+    const size_t count = names.size();
+    const size_t stride = 37;
+    size_t iName = 0;
+    UINT iFailed = 0;
+
+    LARGE_INTEGER liFrequency, liStart, liEnd;
+    QueryPerformanceFrequency( &liFrequency );
+    QueryPerformanceCounter( &liStart );
+    for( UINT i = 0; i < iNumLookups; i++ )
+    {
+        if( !pEffect->GetTechniqueByName( names[iName].c_str() )->IsValid() )
+            iFailed++;
+        iName = ( iName + stride ) % count;
+    }
+    QueryPerformanceCounter( &liEnd );
+
+    if( iFailed )
+        return -1.0;
+    return (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFrequency.QuadPart;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Headless benchmark of GetVariableByName and GetTechniqueByName on an effect with
+// 2,000 variables.  The same compiled effect is created twice, once as usual and once
+// with D3DX11_EFFECT_NO_NAME_INDEX, which leaves the lookups as linear searches.
+//--------------------------------------------------------------------------------------
+int RunNameLookupBenchmark( UINT iNumLookups )
+{
+    WCHAR strLine[256];
+
+    // Only the effect's device objects need a device, so WARP is as good as any
+    ID3D11Device* pDevice = nullptr;
+    HRESULT hr = D3D11CreateDevice( nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION,
+                                    &pDevice, nullptr, nullptr );
+    if( FAILED( hr ) )
+        hr = D3D11CreateDevice( nullptr, D3D_DRIVER_TYPE_WARP, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION,
+                                &pDevice, nullptr, nullptr );
+    if( FAILED( hr ) )
+    {
+        swprintf_s( strLine, 256, L"\nFailed to create a D3D11 device (%08X)\n", hr );
+        OutputDebugStringW( strLine );
+        return 1;
+    }
+
+    int result = 1;
+    ID3DBlob* pBlob = nullptr;
+    ID3DBlob* pErrors = nullptr;
+    ID3DX11Effect* pIndexed = nullptr;
+    ID3DX11Effect* pLinear = nullptr;
+
+    std::string source = MakeNameBenchmarkEffect();
+    hr = D3DCompile( source.c_str(), source.size(), "NameBenchmark.fx", nullptr, nullptr, "", "fx_5_0", 0, 0,
+                     &pBlob, &pErrors );
+    if( FAILED( hr ) )
+    {
+        swprintf_s( strLine, 256, L"\nFailed to compile the benchmark effect (%08X)\n", hr );
+        OutputDebugStringW( strLine );
+        if( pErrors )
+            OutputDebugStringA( (const char*)pErrors->GetBufferPointer() );
+        goto Exit;
+    }
+
+    if( FAILED( hr = D3DX11CreateEffectFromMemory( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), 0, pDevice,
+                                                   &pIndexed ) ) ||
+        FAILED( hr = D3DX11CreateEffectFromMemory( pBlob->GetBufferPointer(), pBlob->GetBufferSize(),
+                                                   D3DX11_EFFECT_NO_NAME_INDEX, pDevice, &pLinear ) ) )
+    {
+        swprintf_s( strLine, 256, L"\nFailed to create the benchmark effect (%08X)\n", hr );
+        OutputDebugStringW( strLine );
+        goto Exit;
+    }
+
+    {
+        const UINT iNumVariables = NAMEBENCH_NUM_CBUFFERS * NAMEBENCH_VARS_PER_CBUFFER;
+        std::vector<std::string> variables, missing, techniques;
+        char strName[32];
+        for( UINT i = 0; i < iNumVariables; i++ )
+        {
+            sprintf_s( strName, "g_vBench%04u", i );
+            variables.push_back( strName );
+            sprintf_s( strName, "g_vMissing%04u", i );
+            missing.push_back( strName );
+        }
+        for( UINT i = 0; i < NAMEBENCH_NUM_TECHNIQUES; i++ )
+        {
+            sprintf_s( strName, "BenchTech%03u", i );
+            techniques.push_back( strName );
+        }
+
+        // Both effects must find the same objects
+        for( UINT i = 0; i < iNumVariables; i++ )
+        {
+            D3DX11_EFFECT_VARIABLE_DESC descIndexed, descLinear;
+            if( FAILED( pIndexed->GetVariableByName( variables[i].c_str() )->GetDesc( &descIndexed ) ) ||
+                FAILED( pLinear->GetVariableByName( variables[i].c_str() )->GetDesc( &descLinear ) ) ||
+                strcmp( descIndexed.Name, variables[i].c_str() ) || strcmp( descLinear.Name, variables[i].c_str() ) )
+            {
+                swprintf_s( strLine, 256, L"\nLookup of %S returned the wrong variable\n", variables[i].c_str() );
+                OutputDebugStringW( strLine );
+                goto Exit;
+            }
+        }
+
+        D3DX11_EFFECT_DESC effectDesc;
+        pIndexed->GetDesc( &effectDesc );
+        swprintf_s( strLine, 256, L"\nEffect name lookups: %u globals, %u techniques, %u lookups per run\n",
+                    effectDesc.GlobalVariables, effectDesc.Techniques, iNumLookups );
+        OutputDebugStringW( strLine );
+        swprintf_s( strLine, 256, L"%-28s %14s %14s %10s\n", L"Lookup", L"Linear", L"Indexed", L"Speedup" );
+        OutputDebugStringW( strLine );
+
+        struct Run
+        {
+            LPCWSTR strName;
+            double fLinear;
+            double fIndexed;
+        } runs[3];
+
+        // Warm up both effects once, then time them
+        TimeVariableLookups( pLinear, variables, iNumVariables, true );
+        TimeVariableLookups( pIndexed, variables, iNumVariables, true );
+
+        runs[0].strName = L"GetVariableByName";
+        runs[0].fLinear = TimeVariableLookups( pLinear, variables, iNumLookups, true );
+        runs[0].fIndexed = TimeVariableLookups( pIndexed, variables, iNumLookups, true );
+        runs[1].strName = L"GetVariableByName (missing)";
+        runs[1].fLinear = TimeVariableLookups( pLinear, missing, iNumLookups, false );
+        runs[1].fIndexed = TimeVariableLookups( pIndexed, missing, iNumLookups, false );
+        runs[2].strName = L"GetTechniqueByName";
+        runs[2].fLinear = TimeTechniqueLookups( pLinear, techniques, iNumLookups );
+        runs[2].fIndexed = TimeTechniqueLookups( pIndexed, techniques, iNumLookups );
+
+        for( UINT i = 0; i < ARRAYSIZE( runs ); i++ )
+        {
+            if( runs[i].fLinear < 0.0 || runs[i].fIndexed < 0.0 )
+            {
+                swprintf_s( strLine, 256, L"%-28s lookup failed\n", runs[i].strName );
+                OutputDebugStringW( strLine );
+                goto Exit;
+            }
+
+            swprintf_s( strLine, 256, L"%-28s %11.1f ns %11.1f ns %9.1fx\n", runs[i].strName,
+                        runs[i].fLinear * 1e9 / iNumLookups, runs[i].fIndexed * 1e9 / iNumLookups,
+                        runs[i].fLinear / ( ( runs[i].fIndexed > 0.0 ) ? runs[i].fIndexed : 1e-9 ) );
+            OutputDebugStringW( strLine );
+        }
+    }
+
+    result = 0;
+
+Exit:
+    SAFE_RELEASE( pLinear );
+    SAFE_RELEASE( pIndexed );
+    SAFE_RELEASE( pErrors );
+    SAFE_RELEASE( pBlob );
+    SAFE_RELEASE( pDevice );
+    return result;
+}
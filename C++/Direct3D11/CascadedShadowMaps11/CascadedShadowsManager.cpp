@@ -15,6 +15,7 @@
 #include "xnacollision.h"
 #include "SDKmisc.h"
 #include "resource.h"
+#include <ppl.h>
 
 static const XMVECTORF32 g_vFLTMAX = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
 static const XMVECTORF32 g_vFLTMIN = { -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
@@ -46,7 +47,11 @@ CascadedShadowsManager::CascadedShadowsManager ()
                             m_iPCFBlurSize( 3 ),
                             m_fPCFOffset( 0.002f ),
                             m_iDerivativeBasedOffset( 0 ),
-                            m_pvsRenderOrthoShadowBlob( NULL )
+                            m_pvsRenderOrthoShadowBlob( NULL ),
+                            m_pCasterMeshes( NULL ),
+                            m_nCasterMeshes( 0 ),
+                            m_pCasters( NULL ),
+                            m_nCasters( 0 )
 {
     sprintf_s( m_cvsModel, "vs_4_0");
     sprintf_s( m_cpsModel, "ps_4_0");
@@ -84,6 +89,8 @@ CascadedShadowsManager::~CascadedShadowsManager()
 {
     DestroyAndDeallocateShadowResources();
     SAFE_RELEASE( m_pvsRenderOrthoShadowBlob );
+    SAFE_DELETE_ARRAY( m_pCasterMeshes );
+    SAFE_DELETE_ARRAY( m_pCasters );
 
     for ( int index=0; index< MAX_CASCADES; ++index )
     {
@@ -145,6 +152,9 @@ HRESULT CascadedShadowsManager::Init ( ID3D11Device* pd3dDevice,
         m_vSceneAABBMax = XMVectorMax( vMeshMax, m_vSceneAABBMax );
     }
 
+    // Finer bounds for culling the shadow casters of each cascade.
+    V_RETURN( CreateCasterBounds( pMesh ) );
+
     m_pViewerCamera = pViewerCamera;
     m_pLightCamera = pLightCamera;
 
@@ -515,13 +525,120 @@ void CascadedShadowsManager::CreateFrustumPointsFromCascadeInterval( float fCasc
 }
 
 //--------------------------------------------------------------------------------------
-// Used to compute an intersection of the orthographic projection and the Scene AABB
+// Computes the bounds of every subset from the mesh's vertex and index data.  The mesh
+// bounds are the union of their subsets so a mesh can be rejected before its subsets.
 //--------------------------------------------------------------------------------------
-struct Triangle
+HRESULT CascadedShadowsManager::CreateCasterBounds( CDXUTSDKMesh* pMesh )
 {
-    XMVECTOR pt[3];
-    BOOL culled;
-};
+    SAFE_DELETE_ARRAY( m_pCasterMeshes );
+    SAFE_DELETE_ARRAY( m_pCasters );
+    m_nCasterMeshes = pMesh->GetNumMeshes();
+    m_nCasters = 0;
+    for( UINT iMesh = 0; iMesh < m_nCasterMeshes; ++iMesh )
+    {
+        m_nCasters += pMesh->GetNumSubsets( iMesh );
+    }
+
+    m_pCasterMeshes = new ShadowCasterMesh[ m_nCasterMeshes ];
+    m_pCasters = new ShadowCasterBounds[ m_nCasters ];
+    if( m_pCasterMeshes == NULL || m_pCasters == NULL )
+    {
+        SAFE_DELETE_ARRAY( m_pCasterMeshes );
+        SAFE_DELETE_ARRAY( m_pCasters );
+        m_nCasterMeshes = m_nCasters = 0;
+        return E_OUTOFMEMORY;
+    }
+
+    UINT iCaster = 0;
+    for( UINT iMesh = 0; iMesh < m_nCasterMeshes; ++iMesh )
+    {
+        SDKMESH_MESH* msh = pMesh->GetMesh( iMesh );
+        XMVECTOR vMeshCenter = XMLoadFloat3( ( XMFLOAT3* )&msh->BoundingBoxCenter );
+        XMVECTOR vMeshExtents = XMLoadFloat3( ( XMFLOAT3* )&msh->BoundingBoxExtents );
+
+        // Positions are the first element of the first vertex stream.
+        BYTE* pVertices = pMesh->GetRawVerticesAt( msh->VertexBuffers[0] );
+        BYTE* pIndices = pMesh->GetRawIndicesAt( msh->IndexBuffer );
+        UINT uStride = pMesh->GetVertexStride( iMesh, 0 );
+        UINT64 uNumVertices = pMesh->GetNumVertices( iMesh, 0 );
+        BOOL b16BitIndices = ( pMesh->GetIndexType( iMesh ) == IT_16BIT );
+
+        ShadowCasterMesh* pCasterMesh = &m_pCasterMeshes[ iMesh ];
+        pCasterMesh->m_iFirstCaster = iCaster;
+        pCasterMesh->m_nCasters = pMesh->GetNumSubsets( iMesh );
+
+        XMVECTOR vMeshMin = g_vFLTMAX;
+        XMVECTOR vMeshMax = g_vFLTMIN;
+        for( UINT iSubset = 0; iSubset < pCasterMesh->m_nCasters; ++iSubset, ++iCaster )
+        {
+            SDKMESH_SUBSET* pSubset = pMesh->GetSubset( iMesh, iSubset );
+            XMVECTOR vMin = g_vFLTMAX;
+            XMVECTOR vMax = g_vFLTMIN;
+
+            if( pVertices != NULL && pIndices != NULL )
+            {
+                for( UINT64 index = pSubset->IndexStart; index < pSubset->IndexStart + pSubset->IndexCount; ++index )
+                {
+                    // Indices are relative to the subset's base vertex, as in DrawIndexed.
+                    UINT64 iVertex = pSubset->VertexStart +
+                        ( b16BitIndices ? ( ( USHORT* )pIndices )[index] : ( ( UINT* )pIndices )[index] );
+                    if( iVertex >= uNumVertices )
+                        continue;
+                    XMVECTOR vPosition = XMLoadFloat3( ( XMFLOAT3* )( pVertices + iVertex * uStride ) );
+                    vMin = XMVectorMin( vMin, vPosition );
+                    vMax = XMVectorMax( vMax, vPosition );
+                }
+            }
+
+            if( XMVector3Greater( vMin, vMax ) )
+            {
+                // No usable vertex data; fall back to the bounds stored in the mesh.
+                vMin = vMeshCenter - vMeshExtents;
+                vMax = vMeshCenter + vMeshExtents;
+            }
+
+            ShadowCasterBounds* pCaster = &m_pCasters[ iCaster ];
+            XMStoreFloat3( &pCaster->m_vCenter, ( vMin + vMax ) * g_vHalfVector );
+            XMStoreFloat3( &pCaster->m_vExtents, ( vMax - vMin ) * g_vHalfVector );
+            pCaster->m_iMesh = iMesh;
+            pCaster->m_iSubset = iSubset;
+
+            vMeshMin = XMVectorMin( vMeshMin, vMin );
+            vMeshMax = XMVectorMax( vMeshMax, vMax );
+        }
+
+        if( pCasterMesh->m_nCasters == 0 )
+        {
+            vMeshMin = vMeshMax = vMeshCenter;
+        }
+        XMStoreFloat3( &pCasterMesh->m_vCenter, ( vMeshMin + vMeshMax ) * g_vHalfVector );
+        XMStoreFloat3( &pCasterMesh->m_vExtents, ( vMeshMax - vMeshMin ) * g_vHalfVector );
+    }
+
+    return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Transforms a center/extents AABB into an AABB in light space.  The light space extents
+// are the world extents projected onto the absolute value of the rotation rows, which is
+// cheaper than transforming all 8 corners.
+//--------------------------------------------------------------------------------------
+static void TransformBoundsToLightSpace( const XMFLOAT3& vCenter,
+                                         const XMFLOAT3& vExtents,
+                                         CXMMATRIX matLightCameraView,
+                                         XMFLOAT3* pvLightSpaceMin,
+                                         XMFLOAT3* pvLightSpaceMax )
+{
+    XMVECTOR vLightCenter = XMVector3TransformCoord( XMLoadFloat3( &vCenter ), matLightCameraView );
+    XMVECTOR vWorldExtents = XMLoadFloat3( &vExtents );
+    XMVECTOR vLightExtents = XMVectorAbs( matLightCameraView.r[0] ) * XMVectorSplatX( vWorldExtents )
+                           + XMVectorAbs( matLightCameraView.r[1] ) * XMVectorSplatY( vWorldExtents )
+                           + XMVectorAbs( matLightCameraView.r[2] ) * XMVectorSplatZ( vWorldExtents );
+
+    XMStoreFloat3( pvLightSpaceMin, vLightCenter - vLightExtents );
+    XMStoreFloat3( pvLightSpaceMax, vLightCenter + vLightExtents );
+}
 
 
 //--------------------------------------------------------------------------------------
@@ -530,288 +647,59 @@ struct Triangle
 // shadows disappear near the base of an object.
 // As offsets are generally used with PCF filtering due self shadowing issues, computing the
 // correct near and far planes becomes even more important.
-// This concept is not complicated, but the intersection code is.
+//
+// A caster can shadow the cascade if it overlaps the orthographic projection in X and Y,
+// however close to the light it is, so only X and Y are culled.  The near and far plane
+// then span the culled casters, which also covers every receiver inside the cascade.
+// Called for all cascades in parallel; each cascade only writes its own visible list.
 //--------------------------------------------------------------------------------------
-void CascadedShadowsManager::ComputeNearAndFar( FLOAT& fNearPlane,
-                                        FLOAT& fFarPlane,
-                                        FXMVECTOR vLightCameraOrthographicMin,
-                                        FXMVECTOR vLightCameraOrthographicMax,
-                                        XMVECTOR* pvPointsInCameraView )
+void CascadedShadowsManager::CullCastersForCascade( INT iCascadeIndex,
+                                                    FXMVECTOR vLightCameraOrthographicMin,
+                                                    FXMVECTOR vLightCameraOrthographicMax,
+                                                    FLOAT& fNearPlane,
+                                                    FLOAT& fFarPlane )
 {
+    CGrowableArray<UINT>& VisibleCasters = m_VisibleCasters[ iCascadeIndex ];
+    VisibleCasters.Reset();
 
-    // Initialize the near and far planes
     fNearPlane = FLT_MAX;
     fFarPlane = -FLT_MAX;
 
-    Triangle triangleList[16];
-    INT iTriangleCnt = 1;
-
-    triangleList[0].pt[0] = pvPointsInCameraView[0];
-    triangleList[0].pt[1] = pvPointsInCameraView[1];
-    triangleList[0].pt[2] = pvPointsInCameraView[2];
-    triangleList[0].culled = false;
+    FLOAT fMinX = XMVectorGetX( vLightCameraOrthographicMin );
+    FLOAT fMinY = XMVectorGetY( vLightCameraOrthographicMin );
+    FLOAT fMaxX = XMVectorGetX( vLightCameraOrthographicMax );
+    FLOAT fMaxY = XMVectorGetY( vLightCameraOrthographicMax );
 
-    // These are the indices used to tesselate an AABB into a list of triangles.
-    static const INT iAABBTriIndexes[] =
+    for( UINT iMesh = 0; iMesh < m_nCasterMeshes; ++iMesh )
     {
-        0,1,2,  1,2,3,
-        4,5,6,  5,6,7,
-        0,2,4,  2,4,6,
-        1,3,5,  3,5,7,
-        0,1,4,  1,4,5,
-        2,3,6,  3,6,7
-    };
-
-    INT iPointPassesCollision[3];
-
-    // At a high level:
-    // 1. Iterate over all 12 triangles of the AABB.
-    // 2. Clip the triangles against each plane. Create new triangles as needed.
-    // 3. Find the min and max z values as the near and far plane.
-
-    //This is easier because the triangles are in camera spacing making the collisions tests simple comparisions.
-
-    float fLightCameraOrthographicMinX = XMVectorGetX( vLightCameraOrthographicMin );
-    float fLightCameraOrthographicMaxX = XMVectorGetX( vLightCameraOrthographicMax );
-    float fLightCameraOrthographicMinY = XMVectorGetY( vLightCameraOrthographicMin );
-    float fLightCameraOrthographicMaxY = XMVectorGetY( vLightCameraOrthographicMax );
-
-    for( INT AABBTriIter = 0; AABBTriIter < 12; ++AABBTriIter )
-    {
-
-        triangleList[0].pt[0] = pvPointsInCameraView[ iAABBTriIndexes[ AABBTriIter*3 + 0 ] ];
-        triangleList[0].pt[1] = pvPointsInCameraView[ iAABBTriIndexes[ AABBTriIter*3 + 1 ] ];
-        triangleList[0].pt[2] = pvPointsInCameraView[ iAABBTriIndexes[ AABBTriIter*3 + 2 ] ];
-        iTriangleCnt = 1;
-        triangleList[0].culled = FALSE;
-
-        // Clip each invidual triangle against the 4 frustums.  When ever a triangle is clipped into new triangles,
-        //add them to the list.
-        for( INT frustumPlaneIter = 0; frustumPlaneIter < 4; ++frustumPlaneIter )
+        const ShadowCasterMesh& CasterMesh = m_pCasterMeshes[ iMesh ];
+        if( CasterMesh.m_vLightSpaceMax.x < fMinX || CasterMesh.m_vLightSpaceMin.x > fMaxX ||
+            CasterMesh.m_vLightSpaceMax.y < fMinY || CasterMesh.m_vLightSpaceMin.y > fMaxY )
         {
+            continue;
+        }
 
-            FLOAT fEdge;
-            INT iComponent;
-
-            if( frustumPlaneIter == 0 )
-            {
-                fEdge = fLightCameraOrthographicMinX; // todo make float temp
-                iComponent = 0;
-            }
-            else if( frustumPlaneIter == 1 )
-            {
-                fEdge = fLightCameraOrthographicMaxX;
-                iComponent = 0;
-            }
-            else if( frustumPlaneIter == 2 )
-            {
-                fEdge = fLightCameraOrthographicMinY;
-                iComponent = 1;
-            }
-            else
+        for( UINT iCaster = CasterMesh.m_iFirstCaster;
+             iCaster < CasterMesh.m_iFirstCaster + CasterMesh.m_nCasters; ++iCaster )
+        {
+            const ShadowCasterBounds& Caster = m_pCasters[ iCaster ];
+            if( Caster.m_vLightSpaceMax.x < fMinX || Caster.m_vLightSpaceMin.x > fMaxX ||
+                Caster.m_vLightSpaceMax.y < fMinY || Caster.m_vLightSpaceMin.y > fMaxY )
             {
-                fEdge = fLightCameraOrthographicMaxY;
-                iComponent = 1;
+                continue;
             }
 
-            for( INT triIter=0; triIter < iTriangleCnt; ++triIter )
+            VisibleCasters.Add( iCaster );
+            if( fNearPlane > Caster.m_vLightSpaceMin.z )
             {
-                // We don't delete triangles, so we skip those that have been culled.
-                if( !triangleList[triIter].culled )
-                {
-                    INT iInsideVertCount = 0;
-                    XMVECTOR tempOrder;
-                    // Test against the correct frustum plane.
-                    // This could be written more compactly, but it would be harder to understand.
-
-                    if( frustumPlaneIter == 0 )
-                    {
-                        for( INT triPtIter=0; triPtIter < 3; ++triPtIter )
-                        {
-                            if( XMVectorGetX( triangleList[triIter].pt[triPtIter] ) >
-                                XMVectorGetX( vLightCameraOrthographicMin ) )
-                            {
-                                iPointPassesCollision[triPtIter] = 1;
-                            }
-                            else
-                            {
-                                iPointPassesCollision[triPtIter] = 0;
-                            }
-                            iInsideVertCount += iPointPassesCollision[triPtIter];
-                        }
-                    }
-                    else if( frustumPlaneIter == 1 )
-                    {
-                        for( INT triPtIter=0; triPtIter < 3; ++triPtIter )
-                        {
-                            if( XMVectorGetX( triangleList[triIter].pt[triPtIter] ) <
-                                XMVectorGetX( vLightCameraOrthographicMax ) )
-                            {
-                                iPointPassesCollision[triPtIter] = 1;
-                            }
-                            else
-                            {
-                                iPointPassesCollision[triPtIter] = 0;
-                            }
-                            iInsideVertCount += iPointPassesCollision[triPtIter];
-                        }
-                    }
-                    else if( frustumPlaneIter == 2 )
-                    {
-                        for( INT triPtIter=0; triPtIter < 3; ++triPtIter )
-                        {
-                            if( XMVectorGetY( triangleList[triIter].pt[triPtIter] ) >
-                                XMVectorGetY( vLightCameraOrthographicMin ) )
-                            {
-                                iPointPassesCollision[triPtIter] = 1;
-                            }
-                            else
-                            {
-                                iPointPassesCollision[triPtIter] = 0;
-                            }
-                            iInsideVertCount += iPointPassesCollision[triPtIter];
-                        }
-                    }
-                    else
-                    {
-                        for( INT triPtIter=0; triPtIter < 3; ++triPtIter )
-                        {
-                            if( XMVectorGetY( triangleList[triIter].pt[triPtIter] ) <
-                                XMVectorGetY( vLightCameraOrthographicMax ) )
-                            {
-                                iPointPassesCollision[triPtIter] = 1;
-                            }
-                            else
-                            {
-                                iPointPassesCollision[triPtIter] = 0;
-                            }
-                            iInsideVertCount += iPointPassesCollision[triPtIter];
-                        }
-                    }
-
-                    // Move the points that pass the frustum test to the begining of the array.
-                    if( iPointPassesCollision[1] && !iPointPassesCollision[0] )
-                    {
-                        tempOrder =  triangleList[triIter].pt[0];
-                        triangleList[triIter].pt[0] = triangleList[triIter].pt[1];
-                        triangleList[triIter].pt[1] = tempOrder;
-                        iPointPassesCollision[0] = TRUE;
-                        iPointPassesCollision[1] = FALSE;
-                    }
-                    if( iPointPassesCollision[2] && !iPointPassesCollision[1] )
-                    {
-                        tempOrder =  triangleList[triIter].pt[1];
-                        triangleList[triIter].pt[1] = triangleList[triIter].pt[2];
-                        triangleList[triIter].pt[2] = tempOrder;
-                        iPointPassesCollision[1] = TRUE;
-                        iPointPassesCollision[2] = FALSE;
-                    }
-                    if( iPointPassesCollision[1] && !iPointPassesCollision[0] )
-                    {
-                        tempOrder =  triangleList[triIter].pt[0];
-                        triangleList[triIter].pt[0] = triangleList[triIter].pt[1];
-                        triangleList[triIter].pt[1] = tempOrder;
-                        iPointPassesCollision[0] = TRUE;
-                        iPointPassesCollision[1] = FALSE;
-                    }
-
-                    if( iInsideVertCount == 0 )
-                    { // All points failed. We're done,
-                        triangleList[triIter].culled = true;
-                    }
-                    else if( iInsideVertCount == 1 )
-                    {// One point passed. Clip the triangle against the Frustum plane
-                        triangleList[triIter].culled = false;
-
-                        //
-                        XMVECTOR vVert0ToVert1 = triangleList[triIter].pt[1] - triangleList[triIter].pt[0];
-                        XMVECTOR vVert0ToVert2 = triangleList[triIter].pt[2] - triangleList[triIter].pt[0];
-
-                        // Find the collision ratio.
-                        FLOAT fHitPointTimeRatio = fEdge - XMVectorGetByIndex( triangleList[triIter].pt[0], iComponent ) ;
-                        // Calculate the distance along the vector as ratio of the hit ratio to the component.
-                        FLOAT fDistanceAlongVector01 = fHitPointTimeRatio / XMVectorGetByIndex( vVert0ToVert1, iComponent );
-                        FLOAT fDistanceAlongVector02 = fHitPointTimeRatio / XMVectorGetByIndex( vVert0ToVert2, iComponent );
-                        // Add the point plus a percentage of the vector.
-                        vVert0ToVert1 *= fDistanceAlongVector01;
-                        vVert0ToVert1 += triangleList[triIter].pt[0];
-                        vVert0ToVert2 *= fDistanceAlongVector02;
-                        vVert0ToVert2 += triangleList[triIter].pt[0];
-
-                        triangleList[triIter].pt[1] = vVert0ToVert2;
-                        triangleList[triIter].pt[2] = vVert0ToVert1;
-
-                    }
-                    else if( iInsideVertCount == 2 )
-                    { // 2 in  // tesselate into 2 triangles
-
-
-                        // Copy the triangle\(if it exists) after the current triangle out of
-                        // the way so we can override it with the new triangle we're inserting.
-                        triangleList[iTriangleCnt] = triangleList[triIter+1];
-
-                        triangleList[triIter].culled = false;
-                        triangleList[triIter+1].culled = false;
-
-                        // Get the vector from the outside point into the 2 inside points.
-                        XMVECTOR vVert2ToVert0 = triangleList[triIter].pt[0] - triangleList[triIter].pt[2];
-                        XMVECTOR vVert2ToVert1 = triangleList[triIter].pt[1] - triangleList[triIter].pt[2];
-
-                        // Get the hit point ratio.
-                        FLOAT fHitPointTime_2_0 =  fEdge - XMVectorGetByIndex( triangleList[triIter].pt[2], iComponent );
-                        FLOAT fDistanceAlongVector_2_0 = fHitPointTime_2_0 / XMVectorGetByIndex( vVert2ToVert0, iComponent );
-                        // Calcaulte the new vert by adding the percentage of the vector plus point 2.
-                        vVert2ToVert0 *= fDistanceAlongVector_2_0;
-                        vVert2ToVert0 += triangleList[triIter].pt[2];
-
-                        // Add a new triangle.
-                        triangleList[triIter+1].pt[0] = triangleList[triIter].pt[0];
-                        triangleList[triIter+1].pt[1] = triangleList[triIter].pt[1];
-                        triangleList[triIter+1].pt[2] = vVert2ToVert0;
-
-                        //Get the hit point ratio.
-                        FLOAT fHitPointTime_2_1 =  fEdge - XMVectorGetByIndex( triangleList[triIter].pt[2], iComponent ) ;
-                        FLOAT fDistanceAlongVector_2_1 = fHitPointTime_2_1 / XMVectorGetByIndex( vVert2ToVert1, iComponent );
-                        vVert2ToVert1 *= fDistanceAlongVector_2_1;
-                        vVert2ToVert1 += triangleList[triIter].pt[2];
-                        triangleList[triIter].pt[0] = triangleList[triIter+1].pt[1];
-                        triangleList[triIter].pt[1] = triangleList[triIter+1].pt[2];
-                        triangleList[triIter].pt[2] = vVert2ToVert1;
-                        // Cncrement triangle count and skip the triangle we just inserted.
-                        ++iTriangleCnt;
-                        ++triIter;
-
-
-                    }
-                    else
-                    { // all in
-                        triangleList[triIter].culled = false;
-
-                    }
-                }// end if !culled loop
+                fNearPlane = Caster.m_vLightSpaceMin.z;
             }
-        }
-        for( INT index=0; index < iTriangleCnt; ++index )
-        {
-            if( !triangleList[index].culled )
+            if( fFarPlane < Caster.m_vLightSpaceMax.z )
             {
-                // Set the near and far plan and the min and max z values respectivly.
-                for( int vertind = 0; vertind < 3; ++ vertind )
-                {
-                    float fTriangleCoordZ = XMVectorGetZ( triangleList[index].pt[vertind] );
-                    if( fNearPlane > fTriangleCoordZ )
-                    {
-                        fNearPlane = fTriangleCoordZ;
-                    }
-                    if( fFarPlane  <fTriangleCoordZ )
-                    {
-                        fFarPlane = fTriangleCoordZ;
-                    }
-                }
+                fFarPlane = Caster.m_vLightSpaceMax.z;
             }
         }
     }
-
 }
 
 
@@ -872,22 +760,43 @@ HRESULT CascadedShadowsManager::InitFrame ( ID3D11Device* pd3dDevice, CDXUTSDKMe
     // This function simply converts the center and extents of an AABB into 8 points
     CreateAABBPoints( vSceneAABBPointsLightSpace, vSceneCenter, vSceneExtents );
     // Transform the scene AABB to Light space.
+    XMVECTOR vLightSpaceSceneAABBminValue = g_vFLTMAX;  // light space scene aabb
+    XMVECTOR vLightSpaceSceneAABBmaxValue = g_vFLTMIN;
     for( int index =0; index < 8; ++index )
     {
         vSceneAABBPointsLightSpace[index] = XMVector4Transform( vSceneAABBPointsLightSpace[index], matLightCameraView );
+        vLightSpaceSceneAABBminValue = XMVectorMin( vSceneAABBPointsLightSpace[index], vLightSpaceSceneAABBminValue );
+        vLightSpaceSceneAABBmaxValue = XMVectorMax( vSceneAABBPointsLightSpace[index], vLightSpaceSceneAABBmaxValue );
     }
+    FLOAT fLightSpaceSceneMinZ = XMVectorGetZ( vLightSpaceSceneAABBminValue );
+    FLOAT fLightSpaceSceneMaxZ = XMVectorGetZ( vLightSpaceSceneAABBmaxValue );
 
+    // The caster bounds only depend on the light, so they are moved to light space once and shared
+    // by all the cascades.
+    for( UINT iMesh = 0; iMesh < m_nCasterMeshes; ++iMesh )
+    {
+        ShadowCasterMesh* pCasterMesh = &m_pCasterMeshes[ iMesh ];
+        TransformBoundsToLightSpace( pCasterMesh->m_vCenter, pCasterMesh->m_vExtents, matLightCameraView,
+            &pCasterMesh->m_vLightSpaceMin, &pCasterMesh->m_vLightSpaceMax );
+    }
+    for( UINT iCaster = 0; iCaster < m_nCasters; ++iCaster )
+    {
+        ShadowCasterBounds* pCaster = &m_pCasters[ iCaster ];
+        TransformBoundsToLightSpace( pCaster->m_vCenter, pCaster->m_vExtents, matLightCameraView,
+            &pCaster->m_vLightSpaceMin, &pCaster->m_vLightSpaceMax );
+    }
 
-    FLOAT fFrustumIntervalBegin, fFrustumIntervalEnd;
-    XMVECTOR vLightCameraOrthographicMin;  // light space frustrum aabb
-    XMVECTOR vLightCameraOrthographicMax;
     FLOAT fCameraNearFarRange = m_pViewerCamera->GetFarClip() - m_pViewerCamera->GetNearClip();
 
-    XMVECTOR vWorldUnitsPerTexel = g_vZero;
-
-    // We loop over the cascades to calculate the orthographic projection for each cascade.
-    for( INT iCascadeIndex=0; iCascadeIndex < m_CopyOfCascadeConfig.m_nCascadeLevels; ++iCascadeIndex )
+    // Calculate the orthographic projection for each cascade.  The cascades are independent, so they
+    // are fit and culled in parallel.
+    Concurrency::parallel_for( 0, m_CopyOfCascadeConfig.m_nCascadeLevels, [&]( INT iCascadeIndex )
     {
+        FLOAT fFrustumIntervalBegin, fFrustumIntervalEnd;
+        XMVECTOR vLightCameraOrthographicMin;  // light space frustrum aabb
+        XMVECTOR vLightCameraOrthographicMax;
+        XMVECTOR vWorldUnitsPerTexel = g_vZero;
+
         // Calculate the interval of the View Frustum that this cascade covers. We measure the interval
         // the cascade covers as a Min and Max distance along the Z Axis.
         if( m_eSelectedCascadesFit == FIT_TO_CASCADES )
@@ -1018,30 +927,33 @@ HRESULT CascadedShadowsManager::InitFrame ( ID3D11Device* pd3dDevice, CDXUTSDKMe
         FLOAT fNearPlane = 0.0f;
         FLOAT fFarPlane = 10000.0f;
 
+        // Only the casters that overlap this cascade are rendered into it.
+        FLOAT fCasterNearPlane, fCasterFarPlane;
+        CullCastersForCascade( iCascadeIndex, vLightCameraOrthographicMin, vLightCameraOrthographicMax,
+            fCasterNearPlane, fCasterFarPlane );
+
         if( m_eSelectedNearFarFit == FIT_NEARFAR_AABB )
         {
-
-            XMVECTOR vLightSpaceSceneAABBminValue = g_vFLTMAX;  // world space scene aabb
-            XMVECTOR vLightSpaceSceneAABBmaxValue = g_vFLTMIN;
-            // We calculate the min and max vectors of the scene in light space. The min and max "Z" values of the
-            // light space AABB can be used for the near and far plane. This is easier than intersecting the scene with the AABB
-            // and in some cases provides similar results.
-            for(int index=0; index< 8; ++index)
-            {
-                vLightSpaceSceneAABBminValue = XMVectorMin( vSceneAABBPointsLightSpace[index], vLightSpaceSceneAABBminValue );
-                vLightSpaceSceneAABBmaxValue = XMVectorMax( vSceneAABBPointsLightSpace[index], vLightSpaceSceneAABBmaxValue );
-            }
-
-            // The min and max z values are the near and far planes.
-            fNearPlane = XMVectorGetZ( vLightSpaceSceneAABBminValue );
-            fFarPlane = XMVectorGetZ( vLightSpaceSceneAABBmaxValue );
+            // The min and max "Z" values of the light space scene AABB can be used for the near and far plane.
+            // This is easier than fitting to the casters and in some cases provides similar results.
+            fNearPlane = fLightSpaceSceneMinZ;
+            fFarPlane = fLightSpaceSceneMaxZ;
         }
         else if( m_eSelectedNearFarFit == FIT_NEARFAR_SCENE_AABB
             || m_eSelectedNearFarFit == FIT_NEARFAR_PANCAKING )
         {
-            // By intersecting the light frustum with the scene AABB we can get a tighter bound on the near and far plane.
-            ComputeNearAndFar( fNearPlane, fFarPlane, vLightCameraOrthographicMin,
-                vLightCameraOrthographicMax, vSceneAABBPointsLightSpace );
+            // Fitting to the bounds of the casters that overlap the cascade gives a much tighter near and far
+            // plane than the scene AABB.  With nothing in the cascade, fall back to the scene.
+            if( fCasterNearPlane <= fCasterFarPlane )
+            {
+                fNearPlane = fCasterNearPlane;
+                fFarPlane = fCasterFarPlane;
+            }
+            else
+            {
+                fNearPlane = fLightSpaceSceneMinZ;
+                fFarPlane = fLightSpaceSceneMaxZ;
+            }
             if (m_eSelectedNearFarFit == FIT_NEARFAR_PANCAKING )
             {
                 if ( fLightCameraOrthographicMinZ > fNearPlane )
@@ -1063,7 +975,7 @@ HRESULT CascadedShadowsManager::InitFrame ( ID3D11Device* pd3dDevice, CDXUTSDKMe
             fNearPlane, fFarPlane );
 
         m_fCascadePartitionsFrustum[ iCascadeIndex ] = fFrustumIntervalEnd;
-    }
+    } );
     m_matShadowView = *m_pLightCamera->GetViewMatrix();
 
 
@@ -1126,7 +1038,50 @@ HRESULT CascadedShadowsManager::RenderShadowsForAllCascades ( ID3D11Device* pd3d
 
         pd3dDeviceContext->VSSetConstantBuffers( 0, 1, &m_pcbGlobalConstantBuffer );
 
-        pMesh->Render( pd3dDeviceContext, 0, 1 );
+        // Draw only the subsets that were found to overlap this cascade in InitFrame.  They are in
+        // mesh order, so each mesh's buffers are bound once.  Depth only, so materials are skipped.
+        CGrowableArray<UINT>& VisibleCasters = m_VisibleCasters[ currentCascade ];
+        UINT iBoundMesh = UINT_MAX;
+        BOOL bMeshReady = FALSE;
+        for( INT iVisible = 0; iVisible < VisibleCasters.GetSize(); ++iVisible )
+        {
+            const ShadowCasterBounds& Caster = m_pCasters[ VisibleCasters[ iVisible ] ];
+            if( Caster.m_iMesh != iBoundMesh )
+            {
+                iBoundMesh = Caster.m_iMesh;
+                SDKMESH_MESH* msh = pMesh->GetMesh( iBoundMesh );
+
+                ID3D11Buffer* pVB[ MAX_VERTEX_STREAMS ];
+                UINT Strides[ MAX_VERTEX_STREAMS ];
+                UINT Offsets[ MAX_VERTEX_STREAMS ];
+                ID3D11Buffer* pIB = pMesh->GetIB11( iBoundMesh );
+                bMeshReady = ( pIB != NULL && msh->NumVertexBuffers <= MAX_VERTEX_STREAMS );
+                for( UINT iVB = 0; bMeshReady && iVB < msh->NumVertexBuffers; ++iVB )
+                {
+                    pVB[ iVB ] = pMesh->GetVB11( iBoundMesh, iVB );
+                    Strides[ iVB ] = pMesh->GetVertexStride( iBoundMesh, iVB );
+                    Offsets[ iVB ] = 0;
+                    bMeshReady = ( pVB[ iVB ] != NULL );
+                }
+
+                // Buffers that are still loading are skipped, as CDXUTSDKMesh::Render does.
+                if( bMeshReady )
+                {
+                    pd3dDeviceContext->IASetVertexBuffers( 0, msh->NumVertexBuffers, pVB, Strides, Offsets );
+                    pd3dDeviceContext->IASetIndexBuffer( pIB, pMesh->GetIBFormat11( iBoundMesh ), 0 );
+                }
+            }
+            if( !bMeshReady )
+            {
+                continue;
+            }
+
+            SDKMESH_SUBSET* pSubset = pMesh->GetSubset( Caster.m_iMesh, Caster.m_iSubset );
+            pd3dDeviceContext->IASetPrimitiveTopology(
+                CDXUTSDKMesh::GetPrimitiveType11( ( SDKMESH_PRIMITIVE_TYPE )pSubset->PrimitiveType ) );
+            pd3dDeviceContext->DrawIndexed( ( UINT )pSubset->IndexCount, ( UINT )pSubset->IndexStart,
+                ( INT )pSubset->VertexStart );
+        }
     }
 
     pd3dDeviceContext->RSSetState( NULL );
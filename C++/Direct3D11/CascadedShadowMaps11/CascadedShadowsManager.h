@@ -17,6 +17,29 @@
 class CFirstPersonCamera;
 class CDXUTSDKMesh;
 
+// World space bounds of one mesh subset, used to cull shadow casters against each cascade.
+// The light space bounds are recomputed by InitFrame.
+struct ShadowCasterBounds
+{
+    XMFLOAT3 m_vCenter;
+    XMFLOAT3 m_vExtents;
+    XMFLOAT3 m_vLightSpaceMin;
+    XMFLOAT3 m_vLightSpaceMax;
+    UINT     m_iMesh;
+    UINT     m_iSubset;
+};
+
+// Union of a mesh's subset bounds, so whole meshes can be rejected before their subsets.
+struct ShadowCasterMesh
+{
+    XMFLOAT3 m_vCenter;
+    XMFLOAT3 m_vExtents;
+    XMFLOAT3 m_vLightSpaceMin;
+    XMFLOAT3 m_vLightSpaceMax;
+    UINT     m_iFirstCaster;    // Index of the mesh's first subset in m_pCasters.
+    UINT     m_nCasters;
+};
+
 #pragma warning(push)
 #pragma warning(disable: 4324)
 
@@ -76,13 +99,17 @@ public:
 
 private:
 
-    // Compute the near and far plane by intersecting an Ortho Projection with the Scenes AABB.
-    void ComputeNearAndFar( FLOAT& fNearPlane,
-                            FLOAT& fFarPlane,
-                            FXMVECTOR vLightCameraOrthographicMin,
-                            FXMVECTOR vLightCameraOrthographicMax,
-                            XMVECTOR* pvPointsInCameraView
-                          );
+    // Gather per mesh and per subset bounds from the mesh's vertex data.
+    HRESULT CreateCasterBounds( CDXUTSDKMesh* pMesh );
+
+    // Fill m_VisibleCasters for one cascade with the casters that overlap its orthographic projection,
+    // and compute the near and far plane from their light space bounds.
+    void CullCastersForCascade( INT iCascadeIndex,
+                                FXMVECTOR vLightCameraOrthographicMin,
+                                FXMVECTOR vLightCameraOrthographicMax,
+                                FLOAT& fNearPlane,
+                                FLOAT& fFarPlane
+                              );
 
 
     void CreateFrustumPointsFromCascadeInterval ( FLOAT fCascadeIntervalBegin,
@@ -99,6 +126,11 @@ private:
 
     XMVECTOR                            m_vSceneAABBMin;
     XMVECTOR                            m_vSceneAABBMax;
+    ShadowCasterMesh*                   m_pCasterMeshes;
+    UINT                                m_nCasterMeshes;
+    ShadowCasterBounds*                 m_pCasters;
+    UINT                                m_nCasters;
+    CGrowableArray<UINT>                m_VisibleCasters[MAX_CASCADES]; // Indices into m_pCasters, in mesh order.
                                                                                // For example: when the shadow buffer size changes.
     char                                m_cvsModel[31];
     char                                m_cpsModel[31];
@@ -0,0 +1,286 @@
+//--------------------------------------------------------------------------------------
+// File: CPUSort.cpp
+//
+// Multithreaded CPU sorts for 32-bit keys
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+#include "DXUT.h"
+#include "CPUSort.h"
+#include <emmintrin.h>
+#include <vector>
+#include <ppl.h>
+
+#define RADIX_BITS              8
+#define RADIX_BUCKETS           ( 1 << RADIX_BITS )
+#define RADIX_PASSES            ( 32 / RADIX_BITS )
+
+// Keys per chunk of the parallel radix sort, and the most chunks used.  The chunking
+// depends only on the count, not on the number of threads.
+#define RADIX_CHUNK_SIZE        65536
+#define RADIX_MAX_CHUNKS        64
+
+// Counts at or below this are sorted with CPUBitonicSort instead of radix passes
+#define RADIX_BITONIC_THRESHOLD 256
+
+
+//--------------------------------------------------------------------------------------
+// Unsigned compare-exchange of four lanes.  SSE2 only has signed 32-bit compares, so the
+// sign bits are flipped first.
+//--------------------------------------------------------------------------------------
+static inline void CompareExchange( __m128i& vA, __m128i& vB )
+{
+    const __m128i vSignBit = _mm_set1_epi32( 0x80000000 );
+    const __m128i vGreater = _mm_cmpgt_epi32( _mm_xor_si128( vA, vSignBit ), _mm_xor_si128( vB, vSignBit ) );
+    const __m128i vMin = _mm_or_si128( _mm_and_si128( vGreater, vB ), _mm_andnot_si128( vGreater, vA ) );
+    const __m128i vMax = _mm_or_si128( _mm_and_si128( vGreater, vA ), _mm_andnot_si128( vGreater, vB ) );
+    vA = vMin;
+    vB = vMax;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compare-exchange of lanes iJ apart (1 or 2) within one vector.  vDescending has all
+// bits set in the lanes that belong to a descending sequence.
+//--------------------------------------------------------------------------------------
+static inline __m128i CompareExchangeInVector( __m128i v, UINT iJ, __m128i vDescending )
+{
+    __m128i vOther, vLowLanes;
+    if( iJ == 2 )
+    {
+        vOther = _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+        vLowLanes = _mm_set_epi32( 0, 0, -1, -1 );
+    }
+    else
+    {
+        vOther = _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+        vLowLanes = _mm_set_epi32( 0, -1, 0, -1 );
+    }
+
+    __m128i vMin = v, vMax = vOther;
+    CompareExchange( vMin, vMax );
+
+    // Ascending sequences keep the min in the lower lane of each pair
+    const __m128i vTakeMin = _mm_xor_si128( vLowLanes, vDescending );
+    return _mm_or_si128( _mm_and_si128( vTakeMin, vMin ), _mm_andnot_si128( vTakeMin, vMax ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Bitonic sort of iCount keys, a power of 2 >= 4, in a 16 byte aligned buffer
+//--------------------------------------------------------------------------------------
+static void BitonicSortPow2( UINT* pKeys, UINT iCount )
+{
+    __m128i* pVectors = (__m128i*)pKeys;
+    const UINT iNumVectors = iCount / 4;
+
+    for( UINT k = 2; k <= iCount; k *= 2 )
+    {
+        for( UINT j = k / 2; j > 0; j /= 2 )
+        {
+            if( j >= 4 )
+            {
+                // Partners are whole vectors apart.  k >= 8 here, so all four lanes of a
+                // vector share a direction.
+                const UINT iJVectors = j / 4;
+                for( UINT i = 0; i < iNumVectors; i++ )
+                {
+                    if( i & iJVectors )
+                        continue;
+
+                    __m128i vA = _mm_load_si128( pVectors + i );
+                    __m128i vB = _mm_load_si128( pVectors + i + iJVectors );
+                    if( ( i * 4 ) & k )
+                        CompareExchange( vB, vA );
+                    else
+                        CompareExchange( vA, vB );
+                    _mm_store_si128( pVectors + i, vA );
+                    _mm_store_si128( pVectors + i + iJVectors, vB );
+                }
+            }
+            else
+            {
+                // Partners are in the same vector.  For k == 2 the direction changes
+                // every two lanes, otherwise once per vector or less often.
+                for( UINT i = 0; i < iNumVectors; i++ )
+                {
+                    __m128i vDescending;
+                    if( k == 2 )
+                        vDescending = _mm_set_epi32( -1, -1, 0, 0 );
+                    else
+                        vDescending = ( ( i * 4 ) & k ) ? _mm_set1_epi32( -1 ) : _mm_setzero_si128();
+
+                    __m128i v = _mm_load_si128( pVectors + i );
+                    _mm_store_si128( pVectors + i, CompareExchangeInVector( v, j, vDescending ) );
+                }
+            }
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+void CPUBitonicSort( UINT* pKeys, UINT iNumElements )
+{
+    assert( iNumElements <= CPU_BITONIC_MAX_ELEMENTS );
+    if( iNumElements < 2 )
+        return;
+
+    // Pad to a power of 2 with the largest key, which sorts to the end
+    UINT iCount = 4;
+    while( iCount < iNumElements )
+        iCount *= 2;
+
+    _DECLSPEC_ALIGN_16_ UINT Block[ CPU_BITONIC_MAX_ELEMENTS ];
+    memcpy( Block, pKeys, iNumElements * sizeof( UINT ) );
+    for( UINT i = iNumElements; i < iCount; i++ )
+        Block[ i ] = 0xffffffff;
+
+    BitonicSortPow2( Block, iCount );
+
+    memcpy( pKeys, Block, iNumElements * sizeof( UINT ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shared implementation of CPURadixSort and CPURadixSortPairs.  Each pass counts the
+// digits of every chunk, turns the counts into per chunk write offsets (digit major,
+// chunk minor, which keeps the sort stable) and scatters the chunks in parallel.
+//--------------------------------------------------------------------------------------
+template <bool bPairs>
+static void RadixSort( UINT* pKeys, UINT* pValues, UINT* pScratchKeys, UINT* pScratchValues, UINT iNumElements )
+{
+    const UINT iNumChunks = max( 1U, min( (UINT)RADIX_MAX_CHUNKS, iNumElements / RADIX_CHUNK_SIZE ) );
+    const UINT iChunkSize = ( iNumElements + iNumChunks - 1 ) / iNumChunks;
+
+    // Counts of every digit in every chunk.  On the first pass these are computed for all
+    // four digits at once, which also shows which passes have nothing to do.
+    std::vector<UINT> ChunkCounts( iNumChunks * RADIX_PASSES * RADIX_BUCKETS, 0 );
+
+    Concurrency::parallel_for( 0U, iNumChunks, [&]( UINT iChunk )
+    {
+        UINT* pCounts = &ChunkCounts[ iChunk * RADIX_PASSES * RADIX_BUCKETS ];
+        const UINT iLast = min( ( iChunk + 1 ) * iChunkSize, iNumElements );
+        for( UINT i = iChunk * iChunkSize; i < iLast; i++ )
+        {
+            const UINT iKey = pKeys[ i ];
+            pCounts[ 0 * RADIX_BUCKETS + ( iKey & 0xff ) ]++;
+            pCounts[ 1 * RADIX_BUCKETS + ( ( iKey >> 8 ) & 0xff ) ]++;
+            pCounts[ 2 * RADIX_BUCKETS + ( ( iKey >> 16 ) & 0xff ) ]++;
+            pCounts[ 3 * RADIX_BUCKETS + ( iKey >> 24 ) ]++;
+        }
+    } );
+
+    bool bSkipPass[ RADIX_PASSES ];
+    for( UINT iPass = 0; iPass < RADIX_PASSES; iPass++ )
+    {
+        bSkipPass[ iPass ] = false;
+        for( UINT iDigit = 0; iDigit < RADIX_BUCKETS; iDigit++ )
+        {
+            UINT iTotal = 0;
+            for( UINT iChunk = 0; iChunk < iNumChunks; iChunk++ )
+                iTotal += ChunkCounts[ ( iChunk * RADIX_PASSES + iPass ) * RADIX_BUCKETS + iDigit ];
+            if( iTotal == iNumElements )
+                bSkipPass[ iPass ] = true;
+            if( iTotal != 0 )
+                break;
+        }
+    }
+
+    UINT* pSrcKeys = pKeys;
+    UINT* pSrcValues = pValues;
+    UINT* pDstKeys = pScratchKeys;
+    UINT* pDstValues = pScratchValues;
+    bool bFirstPass = true;
+
+    for( UINT iPass = 0; iPass < RADIX_PASSES; iPass++ )
+    {
+        if( bSkipPass[ iPass ] )
+            continue;
+
+        const UINT iShift = iPass * RADIX_BITS;
+
+        // The counts from the first pass are only valid while the keys are in their
+        // original order
+        if( !bFirstPass )
+        {
+            Concurrency::parallel_for( 0U, iNumChunks, [&]( UINT iChunk )
+            {
+                UINT* pCounts = &ChunkCounts[ ( iChunk * RADIX_PASSES + iPass ) * RADIX_BUCKETS ];
+                ZeroMemory( pCounts, RADIX_BUCKETS * sizeof( UINT ) );
+                const UINT iLast = min( ( iChunk + 1 ) * iChunkSize, iNumElements );
+                for( UINT i = iChunk * iChunkSize; i < iLast; i++ )
+                    pCounts[ ( pSrcKeys[ i ] >> iShift ) & 0xff ]++;
+            } );
+        }
+        bFirstPass = false;
+
+        UINT iOffset = 0;
+        for( UINT iDigit = 0; iDigit < RADIX_BUCKETS; iDigit++ )
+        {
+            for( UINT iChunk = 0; iChunk < iNumChunks; iChunk++ )
+            {
+                UINT& iCount = ChunkCounts[ ( iChunk * RADIX_PASSES + iPass ) * RADIX_BUCKETS + iDigit ];
+                const UINT iChunkCount = iCount;
+                iCount = iOffset;
+                iOffset += iChunkCount;
+            }
+        }
+
+        Concurrency::parallel_for( 0U, iNumChunks, [&]( UINT iChunk )
+        {
+            UINT Offsets[ RADIX_BUCKETS ];
+            memcpy( Offsets, &ChunkCounts[ ( iChunk * RADIX_PASSES + iPass ) * RADIX_BUCKETS ], sizeof( Offsets ) );
+
+            const UINT iLast = min( ( iChunk + 1 ) * iChunkSize, iNumElements );
+            for( UINT i = iChunk * iChunkSize; i < iLast; i++ )
+            {
+                const UINT iKey = pSrcKeys[ i ];
+                const UINT iDst = Offsets[ ( iKey >> iShift ) & 0xff ]++;
+                pDstKeys[ iDst ] = iKey;
+                if( bPairs )
+                    pDstValues[ iDst ] = pSrcValues[ i ];
+            }
+        } );
+
+        std::swap( pSrcKeys, pDstKeys );
+        std::swap( pSrcValues, pDstValues );
+    }
+
+    // An odd number of passes leaves the result in the scratch buffers
+    if( pSrcKeys != pKeys )
+    {
+        Concurrency::parallel_for( 0U, iNumChunks, [&]( UINT iChunk )
+        {
+            const UINT iFirst = iChunk * iChunkSize;
+            const UINT iCount = min( iFirst + iChunkSize, iNumElements ) - iFirst;
+            memcpy( pKeys + iFirst, pSrcKeys + iFirst, iCount * sizeof( UINT ) );
+            if( bPairs )
+                memcpy( pValues + iFirst, pSrcValues + iFirst, iCount * sizeof( UINT ) );
+        } );
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+void CPURadixSort( UINT* pKeys, UINT* pScratch, UINT iNumElements )
+{
+    if( iNumElements <= RADIX_BITONIC_THRESHOLD )
+    {
+        CPUBitonicSort( pKeys, iNumElements );
+        return;
+    }
+
+    RadixSort<false>( pKeys, NULL, pScratch, NULL, iNumElements );
+}
+
+
+//--------------------------------------------------------------------------------------
+void CPURadixSortPairs( UINT* pKeys, UINT* pValues, UINT* pScratchKeys, UINT* pScratchValues,
+                        UINT iNumElements )
+{
+    if( iNumElements < 2 )
+        return;
+
+    RadixSort<true>( pKeys, pValues, pScratchKeys, pScratchValues, iNumElements );
+}
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// File: CPUSort.h
+//
+// Multithreaded CPU sorts for 32-bit keys, to compare against and stand in for the
+// compute shader bitonic sort.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+// Largest count CPUBitonicSort accepts; smaller counts need not be a power of 2
+const UINT CPU_BITONIC_MAX_ELEMENTS = 4096;
+
+//--------------------------------------------------------------------------------------
+// LSD radix sort of iNumElements keys in ascending order, 8 bits per pass.  pScratch must
+// hold iNumElements keys and not overlap pKeys; the result is always left in pKeys.
+// Passes whose digit is the same for every key are skipped, so keys that only use their
+// low bits (grid cells, draw keys) sort in fewer passes.  Large arrays are split into
+// chunks that are counted and scattered in parallel.
+//--------------------------------------------------------------------------------------
+void CPURadixSort( UINT* pKeys, UINT* pScratch, UINT iNumElements );
+
+//--------------------------------------------------------------------------------------
+// Same as CPURadixSort, but moves pValues along with the keys.  The sort is stable, so
+// values with equal keys keep their order.
+//--------------------------------------------------------------------------------------
+void CPURadixSortPairs( UINT* pKeys, UINT* pValues, UINT* pScratchKeys, UINT* pScratchValues,
+                        UINT iNumElements );
+
+//--------------------------------------------------------------------------------------
+// SSE2 bitonic sort of a small block of keys, for iNumElements <= CPU_BITONIC_MAX_ELEMENTS.
+// Runs on the calling thread.  The same network as the BitonicSort compute shader, four
+// compare-exchanges per instruction.
+//--------------------------------------------------------------------------------------
+void CPUBitonicSort( UINT* pKeys, UINT iNumElements );
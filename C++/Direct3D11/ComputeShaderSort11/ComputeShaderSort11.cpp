@@ -7,20 +7,34 @@
 //--------------------------------------------------------------------------------------
 #include "DXUT.h"
 #include "SDKmisc.h"
+#include "CPUSort.h"
+#include <float.h>
 #include <vector>
 #include <algorithm>
+#include <ppl.h>
 
-// The number of elements to sort is limited to an even power of 2
+// The number of elements the GPU sorts is limited to an even power of 2
 // At minimum 8,192 elements - BITONIC_BLOCK_SIZE * TRANSPOSE_BLOCK_SIZE
 // At maximum 262,144 elements - BITONIC_BLOCK_SIZE * BITONIC_BLOCK_SIZE
-const UINT NUM_ELEMENTS = 512 * 512;
 const UINT BITONIC_BLOCK_SIZE = 512;
 const UINT TRANSPOSE_BLOCK_SIZE = 16;
+const UINT MIN_GPU_ELEMENTS = BITONIC_BLOCK_SIZE * TRANSPOSE_BLOCK_SIZE;
+const UINT MAX_GPU_ELEMENTS = BITONIC_BLOCK_SIZE * BITONIC_BLOCK_SIZE;
 const UINT MATRIX_WIDTH = BITONIC_BLOCK_SIZE;
-const UINT MATRIX_HEIGHT = NUM_ELEMENTS / BITONIC_BLOCK_SIZE;
 
-std::vector<UINT> data( NUM_ELEMENTS );
-std::vector<UINT> results( NUM_ELEMENTS );
+// The CPU sorts are swept from MIN_GPU_ELEMENTS up to this many elements, which can be
+// changed on the command line.  Sorting key/value pairs needs 24 bytes per element.
+#ifdef _WIN64
+const UINT DEFAULT_MAX_ELEMENTS = 64 * 1024 * 1024;
+#else
+const UINT DEFAULT_MAX_ELEMENTS = 16 * 1024 * 1024;
+#endif
+
+// Counts that are not a power of 2, swept along with the powers of 2
+const UINT ODD_ELEMENT_COUNTS[] = { 10007, 100003, 1000003, 9999991, 33333331 };
+
+// Small block sizes timed for CPUBitonicSort
+const UINT BITONIC_TEST_BLOCK_SIZES[] = { 64, 256, 1024, 4096 };
 
 ID3D11Device*               g_pd3dDevice = NULL;
 ID3D11DeviceContext*        g_pd3dImmediateContext = NULL;
@@ -51,6 +65,15 @@ UINT SampleRand()
     return (rand() * rand() + rand());
 }
 
+// Timer for the benchmarks, in seconds
+double GetTime()
+{
+    LARGE_INTEGER liFrequency, liCounter;
+    QueryPerformanceFrequency( &liFrequency );
+    QueryPerformanceCounter( &liCounter );
+    return (double)liCounter.QuadPart / (double)liFrequency.QuadPart;
+}
+
 
 //--------------------------------------------------------------------------------------
 // Create the Device
@@ -196,7 +219,7 @@ HRESULT CreateResources()
     // Create 2 buffers for switching between when performing the transpose
     D3D11_BUFFER_DESC buffer_desc;
     ZeroMemory( &buffer_desc, sizeof(buffer_desc) );
-    buffer_desc.ByteWidth = NUM_ELEMENTS * sizeof(UINT);
+    buffer_desc.ByteWidth = MAX_GPU_ELEMENTS * sizeof(UINT);
     buffer_desc.Usage = D3D11_USAGE_DEFAULT;
     buffer_desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
     buffer_desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
@@ -221,7 +244,7 @@ HRESULT CreateResources()
     ZeroMemory( &srvbuffer_desc, sizeof(srvbuffer_desc) );
     srvbuffer_desc.Format = DXGI_FORMAT_UNKNOWN;
     srvbuffer_desc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-    srvbuffer_desc.Buffer.ElementWidth = NUM_ELEMENTS;
+    srvbuffer_desc.Buffer.ElementWidth = MAX_GPU_ELEMENTS;
     hr = g_pd3dDevice->CreateShaderResourceView( g_pBuffer1, &srvbuffer_desc, &g_pBuffer1SRV );
     if( FAILED( hr ) )
         return hr;
@@ -242,7 +265,7 @@ HRESULT CreateResources()
     ZeroMemory( &uavbuffer_desc, sizeof(uavbuffer_desc) );
     uavbuffer_desc.Format = DXGI_FORMAT_UNKNOWN;
     uavbuffer_desc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-    uavbuffer_desc.Buffer.NumElements = NUM_ELEMENTS;
+    uavbuffer_desc.Buffer.NumElements = MAX_GPU_ELEMENTS;
     hr = g_pd3dDevice->CreateUnorderedAccessView( g_pBuffer1, &uavbuffer_desc, &g_pBuffer1UAV );
     if( FAILED( hr ) )
         return hr;
@@ -261,7 +284,7 @@ HRESULT CreateResources()
     // This is used to read the results back to the CPU
     D3D11_BUFFER_DESC readback_buffer_desc;
     ZeroMemory( &readback_buffer_desc, sizeof(readback_buffer_desc) );
-    readback_buffer_desc.ByteWidth = NUM_ELEMENTS * sizeof(UINT);
+    readback_buffer_desc.ByteWidth = MAX_GPU_ELEMENTS * sizeof(UINT);
     readback_buffer_desc.Usage = D3D11_USAGE_STAGING;
     readback_buffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
     readback_buffer_desc.StructureByteStride = sizeof(UINT);
@@ -289,11 +312,15 @@ void SetConstants( UINT iLevel, UINT iLevelMask, UINT iWidth, UINT iHeight )
 
 //--------------------------------------------------------------------------------------
 // GPU Bitonic Sort
+//    iNumElements must be a power of 2 from MIN_GPU_ELEMENTS to MAX_GPU_ELEMENTS
 //--------------------------------------------------------------------------------------
-void GPUSort()
+void GPUSort( const UINT* pData, UINT* pResults, UINT iNumElements )
 {
+    const UINT MATRIX_HEIGHT = iNumElements / BITONIC_BLOCK_SIZE;
+
     // Upload the data
-    g_pd3dImmediateContext->UpdateSubresource( g_pBuffer1, 0, NULL, &data[0], 0, 0 );
+    D3D11_BOX box = { 0, 0, 0, iNumElements * sizeof(UINT), 1, 1 };
+    g_pd3dImmediateContext->UpdateSubresource( g_pBuffer1, 0, &box, pData, 0, 0 );
 
     // Sort the data
     // First sort the rows for the levels <= to the block size
@@ -304,14 +331,14 @@ void GPUSort()
         // Sort the row data
         g_pd3dImmediateContext->CSSetUnorderedAccessViews( 0, 1, &g_pBuffer1UAV, NULL );
         g_pd3dImmediateContext->CSSetShader( g_pComputeShaderBitonic, NULL, 0 );
-        g_pd3dImmediateContext->Dispatch( NUM_ELEMENTS / BITONIC_BLOCK_SIZE, 1, 1 );
+        g_pd3dImmediateContext->Dispatch( iNumElements / BITONIC_BLOCK_SIZE, 1, 1 );
     }
 
     // Then sort the rows and columns for the levels > than the block size
     // Transpose. Sort the Columns. Transpose. Sort the Rows.
-    for( UINT level = (BITONIC_BLOCK_SIZE * 2) ; level <= NUM_ELEMENTS ; level = level * 2 )
+    for( UINT level = (BITONIC_BLOCK_SIZE * 2) ; level <= iNumElements ; level = level * 2 )
     {
-        SetConstants( (level / BITONIC_BLOCK_SIZE), (level & ~NUM_ELEMENTS) / BITONIC_BLOCK_SIZE, MATRIX_WIDTH, MATRIX_HEIGHT );
+        SetConstants( (level / BITONIC_BLOCK_SIZE), (level & ~iNumElements) / BITONIC_BLOCK_SIZE, MATRIX_WIDTH, MATRIX_HEIGHT );
 
         // Transpose the data from buffer 1 into buffer 2
         ID3D11ShaderResourceView* pViewNULL = NULL;
@@ -323,7 +350,7 @@ void GPUSort()
 
         // Sort the transposed column data
         g_pd3dImmediateContext->CSSetShader( g_pComputeShaderBitonic, NULL, 0 );
-        g_pd3dImmediateContext->Dispatch( NUM_ELEMENTS / BITONIC_BLOCK_SIZE, 1, 1 );
+        g_pd3dImmediateContext->Dispatch( iNumElements / BITONIC_BLOCK_SIZE, 1, 1 );
 
         SetConstants( BITONIC_BLOCK_SIZE, level, MATRIX_HEIGHT, MATRIX_WIDTH );
 
@@ -336,43 +363,200 @@ void GPUSort()
 
         // Sort the row data
         g_pd3dImmediateContext->CSSetShader( g_pComputeShaderBitonic, NULL, 0 );
-        g_pd3dImmediateContext->Dispatch( NUM_ELEMENTS / BITONIC_BLOCK_SIZE, 1, 1 );
+        g_pd3dImmediateContext->Dispatch( iNumElements / BITONIC_BLOCK_SIZE, 1, 1 );
     }
 
     // Download the data
     D3D11_MAPPED_SUBRESOURCE MappedResource = {0};
-    g_pd3dImmediateContext->CopyResource( g_pReadBackBuffer, g_pBuffer1 );
+    g_pd3dImmediateContext->CopySubresourceRegion( g_pReadBackBuffer, 0, 0, 0, 0, g_pBuffer1, 0, &box );
     g_pd3dImmediateContext->Map( g_pReadBackBuffer, 0, D3D11_MAP_READ, 0, &MappedResource );
-    memcpy( &results[0], MappedResource.pData, NUM_ELEMENTS * sizeof(UINT) );
+    memcpy( pResults, MappedResource.pData, iNumElements * sizeof(UINT) );
     g_pd3dImmediateContext->Unmap( g_pReadBackBuffer, 0 );
 }
 
 
 //--------------------------------------------------------------------------------------
-// CPU Sort
+// Number of timed runs for a sort of iNumElements, so each size takes similar time
 //--------------------------------------------------------------------------------------
-void CPUSort()
+UINT GetNumRuns( UINT iNumElements )
 {
-    std::sort( data.begin(), data.end() );
+    return max( 1U, min( 20U, ( 4 * 1024 * 1024 ) / iNumElements ) );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Sort iNumElements random keys with every method and check each result against
+// std::sort.  Prints one row of throughput, in millions of keys per second, and
+// returns false if any result was wrong.
+//--------------------------------------------------------------------------------------
+bool BenchmarkSorts( UINT iNumElements, bool bUseGPU )
+{
+    std::vector<UINT> data( iNumElements );
+    std::vector<UINT> reference( iNumElements );
+    std::vector<UINT> keys( iNumElements );
+    std::vector<UINT> values( iNumElements );
+    std::vector<UINT> scratchKeys( iNumElements );
+    std::vector<UINT> scratchValues( iNumElements );
+    std::generate( data.begin(), data.end(), SampleRand );
+
+    const UINT iNumRuns = GetNumRuns( iNumElements );
+    double fTime, fBest;
+
+    // Single threaded std::sort is both the baseline and the reference result
+    fBest = DBL_MAX;
+    for( UINT iRun = 0 ; iRun < iNumRuns ; ++iRun )
+    {
+        reference = data;
+        fTime = GetTime();
+        std::sort( reference.begin(), reference.end() );
+        fTime = GetTime() - fTime;
+        fBest = min( fBest, fTime );
+    }
+    const double fStdSort = fBest;
+
+    // Radix sort of keys
+    fBest = DBL_MAX;
+    for( UINT iRun = 0 ; iRun < iNumRuns ; ++iRun )
+    {
+        keys = data;
+        fTime = GetTime();
+        CPURadixSort( &keys[0], &scratchKeys[0], iNumElements );
+        fTime = GetTime() - fTime;
+        fBest = min( fBest, fTime );
+    }
+    const double fRadix = fBest;
+    const bool bRadixSucceeded = ( keys == reference );
+
+    // Radix sort of key/value pairs.  The values are the original indices, so the result
+    // can be checked for both the right pairing and stability.
+    fBest = DBL_MAX;
+    for( UINT iRun = 0 ; iRun < iNumRuns ; ++iRun )
+    {
+        keys = data;
+        for( UINT i = 0 ; i < iNumElements ; ++i )
+            values[i] = i;
+        fTime = GetTime();
+        CPURadixSortPairs( &keys[0], &values[0], &scratchKeys[0], &scratchValues[0], iNumElements );
+        fTime = GetTime() - fTime;
+        fBest = min( fBest, fTime );
+    }
+    const double fRadixPairs = fBest;
+    bool bPairsSucceeded = ( keys == reference );
+    for( UINT i = 0 ; i < iNumElements && bPairsSucceeded ; ++i )
+    {
+        if( data[ values[i] ] != keys[i] || ( i > 0 && keys[i] == keys[i - 1] && values[i] < values[i - 1] ) )
+            bPairsSucceeded = false;
+    }
+
+    // GPU bitonic sort, including the upload and download, for the sizes it supports
+    double fGPU = 0;
+    bool bGPUSucceeded = true;
+    const bool bGPUSize = bUseGPU && iNumElements >= MIN_GPU_ELEMENTS && iNumElements <= MAX_GPU_ELEMENTS &&
+                    ( iNumElements & ( iNumElements - 1 ) ) == 0;
+    if( bGPUSize )
+    {
+        // Warm up so shader creation and paging are not timed
+        GPUSort( &data[0], &keys[0], iNumElements );
+
+        fBest = DBL_MAX;
+        for( UINT iRun = 0 ; iRun < iNumRuns ; ++iRun )
+        {
+            fTime = GetTime();
+            GPUSort( &data[0], &keys[0], iNumElements );
+            fTime = GetTime() - fTime;
+            fBest = min( fBest, fTime );
+        }
+        fGPU = fBest;
+        bGPUSucceeded = ( keys == reference );
+    }
+
+    const double fMKeys = iNumElements / 1000000.0;
+    printf( "%10u %10.1f %10.1f %10.1f", iNumElements, fMKeys / fStdSort, fMKeys / fRadix, fMKeys / fRadixPairs );
+    if( bGPUSize )
+        printf( " %10.1f", fMKeys / fGPU );
+    else
+        printf( " %10s", "-" );
+
+    const bool bSucceeded = bRadixSucceeded && bPairsSucceeded && bGPUSucceeded;
+    if( bSucceeded )
+    {
+        printf( "   Succeeded\n" );
+    }
+    else
+    {
+        printf( "   FAILED (%s%s%s)\n", bRadixSucceeded ? "" : "radix ", bPairsSucceeded ? "" : "pairs ",
+                bGPUSucceeded ? "" : "GPU" );
+    }
+
+    return bSucceeded;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Sort 1M keys in blocks of iBlockSize with CPUBitonicSort and with std::sort.  The
+// blocks are independent, so both run in parallel across blocks.
+//--------------------------------------------------------------------------------------
+bool BenchmarkBitonicBlocks( UINT iBlockSize )
+{
+    const UINT iNumBlocks = ( 1024 * 1024 ) / iBlockSize;
+    const UINT iNumElements = iNumBlocks * iBlockSize;
+    std::vector<UINT> data( iNumElements );
+    std::vector<UINT> reference( iNumElements );
+    std::vector<UINT> keys( iNumElements );
+    std::generate( data.begin(), data.end(), SampleRand );
+
+    double fBitonic = DBL_MAX, fStdSort = DBL_MAX;
+    for( UINT iRun = 0 ; iRun < 5 ; ++iRun )
+    {
+        reference = data;
+        double fTime = GetTime();
+        Concurrency::parallel_for( 0U, iNumBlocks, [&]( UINT iBlock )
+        {
+            std::sort( reference.begin() + iBlock * iBlockSize, reference.begin() + ( iBlock + 1 ) * iBlockSize );
+        } );
+        fTime = GetTime() - fTime;
+        fStdSort = min( fStdSort, fTime );
+
+        keys = data;
+        fTime = GetTime();
+        Concurrency::parallel_for( 0U, iNumBlocks, [&]( UINT iBlock )
+        {
+            CPUBitonicSort( &keys[ iBlock * iBlockSize ], iBlockSize );
+        } );
+        fTime = GetTime() - fTime;
+        fBitonic = min( fBitonic, fTime );
+    }
+
+    const bool bSucceeded = ( keys == reference );
+    const double fMKeys = iNumElements / 1000000.0;
+    printf( "%10u %10.1f %10.1f   %s\n", iBlockSize, fMKeys / fStdSort, fMKeys / fBitonic,
+            bSucceeded ? "Succeeded" : "FAILED" );
+
+    return bSucceeded;
 }
 
 
 //--------------------------------------------------------------------------------------
 // Entry point to the program
+//    ComputeShaderSort11.exe [max elements]
 //--------------------------------------------------------------------------------------
-int __cdecl wmain()
+int __cdecl wmain( int argc, WCHAR* argv[] )
 {
     // Enable run-time memory check for debug builds.
 #if defined(DEBUG) | defined(_DEBUG)
     _CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
-    // Generate a random list of numbers to sort
+    UINT iMaxElements = DEFAULT_MAX_ELEMENTS;
+    if( argc > 1 && _wtoi( argv[1] ) > 0 )
+        iMaxElements = max( MIN_GPU_ELEMENTS, (UINT)_wtoi( argv[1] ) );
+
+    // Generate random lists of numbers to sort
     // Not intended for production code
     srand( GetTickCount() );
-    std::generate( data.begin(), data.end(), SampleRand );
 
-    // Create the device
+    // Create the device.  Without one, only the CPU sorts are run.
+    bool bUseGPU = true;
     HRESULT hr = InitDevice();
     if ( FAILED (hr) )
     {
@@ -410,40 +594,49 @@ int __cdecl wmain()
             }
         }
 
-        printf( "Failed to create the device.  Exiting.\n" );
-        return 1;
+        printf( "Failed to create the device.  Only the CPU sorts will be run.\n" );
+        bUseGPU = false;
     }
 
     // Create the buffers and shaders
-    if( FAILED( CreateResources() ) )
+    if( bUseGPU && FAILED( CreateResources() ) )
     {
-        printf( "Failed to create resources.  Exiting.\n" );
-        return 1;
+        printf( "Failed to create resources.  Only the CPU sorts will be run.\n" );
+        bUseGPU = false;
     }
 
-    printf( "Sorting %u Elements\n", NUM_ELEMENTS );
-
-    // GPU Bitonic Sort
-    printf( "Starting GPU Bitonic Sort...\n" );
-    GPUSort();
-    printf( "...GPU Bitonic Sort Finished\n" );
+    // Sweep the powers of 2 and a few other counts, in increasing order
+    std::vector<UINT> sizes;
+    for( UINT iSize = MIN_GPU_ELEMENTS ; iSize <= iMaxElements && iSize != 0 ; iSize *= 2 )
+        sizes.push_back( iSize );
+    for( UINT i = 0 ; i < ARRAYSIZE( ODD_ELEMENT_COUNTS ) ; ++i )
+    {
+        if( ODD_ELEMENT_COUNTS[i] <= iMaxElements )
+            sizes.push_back( ODD_ELEMENT_COUNTS[i] );
+    }
+    std::sort( sizes.begin(), sizes.end() );
 
-    // Sort the data on the CPU to compare for correctness
-    printf( "Starting CPU Sort...\n" );
-    CPUSort();
-    printf( "...CPU Sort Finished\n" );
+    printf( "Sorting random 32-bit keys on %u hardware threads, millions of keys per second\n",
+            Concurrency::GetProcessorCount() );
+    printf( "GPU times include the upload and download\n\n" );
+    printf( "%10s %10s %10s %10s %10s\n", "Elements", "std::sort", "Radix", "Radix K/V", "GPU" );
 
-    // Compare the results for correctness
     bool bComparisonSucceeded = true;
-    for( UINT i = 0 ; i < NUM_ELEMENTS ; ++i )
+    for( size_t i = 0 ; i < sizes.size() ; ++i )
     {
-        if( data[i] != results[i] )
-        {
+        if( !BenchmarkSorts( sizes[i], bUseGPU ) )
+            bComparisonSucceeded = false;
+    }
+
+    printf( "\nSorting 1M keys in independent blocks\n\n" );
+    printf( "%10s %10s %10s\n", "Block", "std::sort", "Bitonic" );
+    for( UINT i = 0 ; i < ARRAYSIZE( BITONIC_TEST_BLOCK_SIZES ) ; ++i )
+    {
+        if( !BenchmarkBitonicBlocks( BITONIC_TEST_BLOCK_SIZES[i] ) )
             bComparisonSucceeded = false;
-            break;
-        }
     }
-    printf( "Comparison %s\n", (bComparisonSucceeded)? "Succeeded" : "FAILED" );
+
+    printf( "\nComparison %s\n", (bComparisonSucceeded)? "Succeeded" : "FAILED" );
 
     // Cleanup the resources
     SAFE_RELEASE( g_pReadBackBuffer );
@@ -459,5 +652,5 @@ int __cdecl wmain()
     SAFE_RELEASE( g_pd3dImmediateContext );
     SAFE_RELEASE( g_pd3dDevice );
 
-    return 0;
+    return (bComparisonSucceeded)? 0 : 1;
 }
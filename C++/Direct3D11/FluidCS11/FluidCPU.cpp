@@ -0,0 +1,506 @@
+//--------------------------------------------------------------------------------------
+// File: FluidCPU.cpp
+//
+// Multithreaded CPU implementation of the grid + sort SPH simulation in FluidCS11.hlsl
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+#include "DXUT.h"
+#include "FluidCPU.h"
+#include <xmmintrin.h>
+#include <ppl.h>
+
+// Grid cell key size, 8-bits for x and y, as in the compute shaders
+#define FLUID_NUM_GRID_CELLS        65536
+
+// Particles handled by one task of the density and force passes
+#define FLUID_BLOCK_SIZE            256
+
+// The counting sort splits the particles into one chunk per FLUID_SORT_CHUNK_SIZE particles,
+// up to FLUID_MAX_SORT_CHUNKS.  Every chunk keeps a full row of cell counts.
+#define FLUID_SORT_CHUNK_SIZE       2048
+#define FLUID_MAX_SORT_CHUNKS       32
+
+// Cells per task of the prefix sum over the grid
+#define FLUID_CELLS_PER_TASK        256
+
+
+//--------------------------------------------------------------------------------------
+// Lane masks for the SSE kernels.  s_TailMasks[n] keeps the first n lanes of a group of
+// four neighbors, s_SkipMasks[n] drops lane n so a particle does not act on itself.
+//--------------------------------------------------------------------------------------
+static const _DECLSPEC_ALIGN_16_ UINT s_TailMasks[5][4] =
+{
+    { 0, 0, 0, 0 },
+    { 0xffffffff, 0, 0, 0 },
+    { 0xffffffff, 0xffffffff, 0, 0 },
+    { 0xffffffff, 0xffffffff, 0xffffffff, 0 },
+    { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+};
+
+static const _DECLSPEC_ALIGN_16_ UINT s_SkipMasks[4][4] =
+{
+    { 0, 0xffffffff, 0xffffffff, 0xffffffff },
+    { 0xffffffff, 0, 0xffffffff, 0xffffffff },
+    { 0xffffffff, 0xffffffff, 0, 0xffffffff },
+    { 0xffffffff, 0xffffffff, 0xffffffff, 0 },
+};
+
+
+//--------------------------------------------------------------------------------------
+// Same cell as GridCalculateCell + GridConstuctKey.  The comparisons are ordered so a NaN
+// position lands in cell 0 rather than producing an out of range key.
+//--------------------------------------------------------------------------------------
+static inline UINT GridCalculateKey( FLOAT fX, FLOAT fY, const CBSimulationConstants& constants )
+{
+    fX = fX * constants.vGridDim.x + constants.vGridDim.z;
+    fY = fY * constants.vGridDim.y + constants.vGridDim.w;
+    fX = ( fX > 0.0f ) ? ( ( fX < 255.0f ) ? fX : 255.0f ) : 0.0f;
+    fY = ( fY > 0.0f ) ? ( ( fY < 255.0f ) ? fY : 255.0f ) : 0.0f;
+    return ( (UINT)fY << 8 ) | (UINT)fX;
+}
+
+
+//--------------------------------------------------------------------------------------
+static inline FLOAT HorizontalSum( __m128 v )
+{
+    v = _mm_add_ps( v, _mm_movehl_ps( v, v ) );
+    v = _mm_add_ss( v, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+    return _mm_cvtss_f32( v );
+}
+
+
+//--------------------------------------------------------------------------------------
+static FLOAT* AllocPadded( UINT iNumParticles )
+{
+    // 3 extra entries so a group of four starting at the last particle stays in bounds
+    FLOAT* p = (FLOAT*)_aligned_malloc( ( iNumParticles + 3 ) * sizeof( FLOAT ), 16 );
+    if( p )
+        ZeroMemory( p, ( iNumParticles + 3 ) * sizeof( FLOAT ) );
+    return p;
+}
+
+static inline void FreePadded( FLOAT*& p )
+{
+    if( p )
+    {
+        _aligned_free( p );
+        p = NULL;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+CFluidCPU::CFluidCPU() : m_iNumParticles( 0 ),
+                         m_iNumChunks( 0 ),
+                         m_iChunkSize( 0 ),
+                         m_pParticles( NULL ),
+                         m_pDensities( NULL ),
+                         m_pForces( NULL ),
+                         m_pPositionX( NULL ),
+                         m_pPositionY( NULL ),
+                         m_pVelocityX( NULL ),
+                         m_pVelocityY( NULL ),
+                         m_pDensity( NULL ),
+                         m_pInvDensity( NULL ),
+                         m_pPressure( NULL ),
+                         m_pKeys( NULL ),
+                         m_pCellOffsets( NULL ),
+                         m_pGridIndices( NULL ),
+                         m_iMinKey( 0 ),
+                         m_iMaxKey( 0 )
+{
+}
+
+
+//--------------------------------------------------------------------------------------
+CFluidCPU::~CFluidCPU()
+{
+    Destroy();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Allocates the simulation state for iNumParticles particles starting at
+// pInitialParticles.  Any previous state is released first.
+//--------------------------------------------------------------------------------------
+HRESULT CFluidCPU::Create( UINT iNumParticles, const Particle* pInitialParticles )
+{
+    Destroy();
+
+    if( iNumParticles == 0 || pInitialParticles == NULL )
+        return E_INVALIDARG;
+
+    m_iNumParticles = iNumParticles;
+    m_iNumChunks = max( 1U, min( (UINT)FLUID_MAX_SORT_CHUNKS, iNumParticles / FLUID_SORT_CHUNK_SIZE ) );
+    m_iChunkSize = ( iNumParticles + m_iNumChunks - 1 ) / m_iNumChunks;
+
+    m_pParticles = new Particle[ iNumParticles ];
+    m_pDensities = new ParticleDensity[ iNumParticles ];
+    m_pForces = new ParticleForces[ iNumParticles ];
+    m_pKeys = new UINT[ iNumParticles ];
+    m_pCellOffsets = new UINT[ m_iNumChunks * FLUID_NUM_GRID_CELLS ];
+    m_pGridIndices = new UINT[ 2 * FLUID_NUM_GRID_CELLS ];
+
+    m_pPositionX = AllocPadded( iNumParticles );
+    m_pPositionY = AllocPadded( iNumParticles );
+    m_pVelocityX = AllocPadded( iNumParticles );
+    m_pVelocityY = AllocPadded( iNumParticles );
+    m_pDensity = AllocPadded( iNumParticles );
+    m_pInvDensity = AllocPadded( iNumParticles );
+    m_pPressure = AllocPadded( iNumParticles );
+
+    if( !m_pParticles || !m_pDensities || !m_pForces || !m_pKeys || !m_pCellOffsets || !m_pGridIndices ||
+        !m_pPositionX || !m_pPositionY || !m_pVelocityX || !m_pVelocityY ||
+        !m_pDensity || !m_pInvDensity || !m_pPressure )
+    {
+        Destroy();
+        return E_OUTOFMEMORY;
+    }
+
+    memcpy( m_pParticles, pInitialParticles, sizeof( Particle ) * iNumParticles );
+    ZeroMemory( m_pDensities, sizeof( ParticleDensity ) * iNumParticles );
+    ZeroMemory( m_pForces, sizeof( ParticleForces ) * iNumParticles );
+
+    return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+void CFluidCPU::Destroy()
+{
+    SAFE_DELETE_ARRAY( m_pParticles );
+    SAFE_DELETE_ARRAY( m_pDensities );
+    SAFE_DELETE_ARRAY( m_pForces );
+    SAFE_DELETE_ARRAY( m_pKeys );
+    SAFE_DELETE_ARRAY( m_pCellOffsets );
+    SAFE_DELETE_ARRAY( m_pGridIndices );
+
+    FreePadded( m_pPositionX );
+    FreePadded( m_pPositionY );
+    FreePadded( m_pVelocityX );
+    FreePadded( m_pVelocityY );
+    FreePadded( m_pDensity );
+    FreePadded( m_pInvDensity );
+    FreePadded( m_pPressure );
+
+    m_iNumParticles = 0;
+    m_iNumChunks = 0;
+    m_iChunkSize = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Replaces BuildGridCS, the bitonic sort, BuildGridIndicesCS and RearrangeParticlesCS
+// with a parallel counting sort.  Each chunk of particles counts its cells, a prefix sum
+// over the cells turns the counts into write offsets per chunk (and the start and end
+// of every cell), and the chunks then scatter their particles in parallel.  Particles
+// keep their relative order inside a cell, which matches sorting on the GPU's
+// cell + particle ID key.
+//--------------------------------------------------------------------------------------
+void CFluidCPU::BuildGrid( const CBSimulationConstants& constants )
+{
+    UINT iChunkMinKey[ FLUID_MAX_SORT_CHUNKS ];
+    UINT iChunkMaxKey[ FLUID_MAX_SORT_CHUNKS ];
+
+    // Compute the cell of every particle and the range of occupied cells
+    Concurrency::parallel_for( 0U, m_iNumChunks, [&]( UINT iChunk )
+    {
+        const UINT iFirst = iChunk * m_iChunkSize;
+        const UINT iLast = min( iFirst + m_iChunkSize, m_iNumParticles );
+        UINT iMinKey = FLUID_NUM_GRID_CELLS - 1;
+        UINT iMaxKey = 0;
+        for( UINT i = iFirst; i < iLast; i++ )
+        {
+            const UINT iKey = GridCalculateKey( m_pParticles[ i ].vPosition.x, m_pParticles[ i ].vPosition.y, constants );
+            m_pKeys[ i ] = iKey;
+            iMinKey = min( iMinKey, iKey );
+            iMaxKey = max( iMaxKey, iKey );
+        }
+        iChunkMinKey[ iChunk ] = iMinKey;
+        iChunkMaxKey[ iChunk ] = iMaxKey;
+    } );
+
+    m_iMinKey = iChunkMinKey[ 0 ];
+    m_iMaxKey = iChunkMaxKey[ 0 ];
+    for( UINT iChunk = 1; iChunk < m_iNumChunks; iChunk++ )
+    {
+        m_iMinKey = min( m_iMinKey, iChunkMinKey[ iChunk ] );
+        m_iMaxKey = max( m_iMaxKey, iChunkMaxKey[ iChunk ] );
+    }
+
+    // Only the occupied range of cells is cleared, counted and scanned; the neighbor
+    // searches clamp their lookups to it
+    const UINT iNumCells = m_iMaxKey - m_iMinKey + 1;
+
+    Concurrency::parallel_for( 0U, m_iNumChunks, [&]( UINT iChunk )
+    {
+        UINT* pCounts = m_pCellOffsets + iChunk * FLUID_NUM_GRID_CELLS;
+        ZeroMemory( pCounts + m_iMinKey, iNumCells * sizeof( UINT ) );
+
+        const UINT iFirst = iChunk * m_iChunkSize;
+        const UINT iLast = min( iFirst + m_iChunkSize, m_iNumParticles );
+        for( UINT i = iFirst; i < iLast; i++ )
+            pCounts[ m_pKeys[ i ] ]++;
+    } );
+
+    // Prefix sum over the cells, then over the chunks within each cell.  Each task first
+    // totals a run of cells, the run totals are scanned serially, and each task then
+    // writes the offsets for its run.
+    const UINT iNumTasks = ( iNumCells + FLUID_CELLS_PER_TASK - 1 ) / FLUID_CELLS_PER_TASK;
+    UINT iTaskBase[ FLUID_NUM_GRID_CELLS / FLUID_CELLS_PER_TASK + 1 ];
+
+    Concurrency::parallel_for( 0U, iNumTasks, [&]( UINT iTask )
+    {
+        const UINT iFirstCell = m_iMinKey + iTask * FLUID_CELLS_PER_TASK;
+        const UINT iLastCell = min( iFirstCell + FLUID_CELLS_PER_TASK, m_iMaxKey + 1 );
+        UINT iTotal = 0;
+        for( UINT iChunk = 0; iChunk < m_iNumChunks; iChunk++ )
+        {
+            const UINT* pCounts = m_pCellOffsets + iChunk * FLUID_NUM_GRID_CELLS;
+            for( UINT iCell = iFirstCell; iCell < iLastCell; iCell++ )
+                iTotal += pCounts[ iCell ];
+        }
+        iTaskBase[ iTask + 1 ] = iTotal;
+    } );
+
+    iTaskBase[ 0 ] = 0;
+    for( UINT iTask = 1; iTask < iNumTasks; iTask++ )
+        iTaskBase[ iTask ] += iTaskBase[ iTask - 1 ];
+
+    Concurrency::parallel_for( 0U, iNumTasks, [&]( UINT iTask )
+    {
+        const UINT iFirstCell = m_iMinKey + iTask * FLUID_CELLS_PER_TASK;
+        const UINT iLastCell = min( iFirstCell + FLUID_CELLS_PER_TASK, m_iMaxKey + 1 );
+        UINT iOffset = iTaskBase[ iTask ];
+        for( UINT iCell = iFirstCell; iCell < iLastCell; iCell++ )
+        {
+            m_pGridIndices[ 2 * iCell ] = iOffset;
+            for( UINT iChunk = 0; iChunk < m_iNumChunks; iChunk++ )
+            {
+                UINT* pOffset = m_pCellOffsets + iChunk * FLUID_NUM_GRID_CELLS + iCell;
+                const UINT iCount = *pOffset;
+                *pOffset = iOffset;
+                iOffset += iCount;
+            }
+            m_pGridIndices[ 2 * iCell + 1 ] = iOffset;
+        }
+    } );
+
+    // Scatter the particles into grid order
+    Concurrency::parallel_for( 0U, m_iNumChunks, [&]( UINT iChunk )
+    {
+        UINT* pOffsets = m_pCellOffsets + iChunk * FLUID_NUM_GRID_CELLS;
+        const UINT iFirst = iChunk * m_iChunkSize;
+        const UINT iLast = min( iFirst + m_iChunkSize, m_iNumParticles );
+        for( UINT i = iFirst; i < iLast; i++ )
+        {
+            const UINT iDst = pOffsets[ m_pKeys[ i ] ]++;
+            m_pPositionX[ iDst ] = m_pParticles[ i ].vPosition.x;
+            m_pPositionY[ iDst ] = m_pParticles[ i ].vPosition.y;
+            m_pVelocityX[ iDst ] = m_pParticles[ i ].vVelocity.x;
+            m_pVelocityY[ iDst ] = m_pParticles[ i ].vVelocity.y;
+        }
+    } );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Finds the particles in the 8 adjacent cells + current cell of iKey.  Cells in a row are
+// adjacent in grid order, so each row is a single run [iStart, iEnd) of sorted particles.
+// Returns the number of runs written.
+//--------------------------------------------------------------------------------------
+UINT CFluidCPU::GetNeighborRuns( UINT iKey, UINT iStart[3], UINT iEnd[3] ) const
+{
+    const INT iCellX = (INT)( iKey & 255 );
+    const INT iCellY = (INT)( iKey >> 8 );
+    const INT iMinX = max( iCellX - 1, 0 );
+    const INT iMaxX = min( iCellX + 1, 255 );
+
+    UINT iNumRuns = 0;
+    for( INT Y = max( iCellY - 1, 0 ); Y <= min( iCellY + 1, 255 ); Y++ )
+    {
+        const UINT iFirstCell = max( (UINT)( Y * 256 + iMinX ), m_iMinKey );
+        const UINT iLastCell = min( (UINT)( Y * 256 + iMaxX ), m_iMaxKey );
+        if( iFirstCell > iLastCell )
+            continue;
+
+        iStart[ iNumRuns ] = m_pGridIndices[ 2 * iFirstCell ];
+        iEnd[ iNumRuns ] = m_pGridIndices[ 2 * iLastCell + 1 ];
+        if( iStart[ iNumRuns ] < iEnd[ iNumRuns ] )
+            iNumRuns++;
+    }
+    return iNumRuns;
+}
+
+
+//--------------------------------------------------------------------------------------
+// DensityCS_Grid for sorted particles [iFirst, iLast).  Also caches each particle's
+// pressure and inverse density for the force pass, which would otherwise recompute them
+// for every pair.
+//--------------------------------------------------------------------------------------
+void CFluidCPU::ComputeDensity( const CBSimulationConstants& constants, UINT iFirst, UINT iLast )
+{
+    const FLOAT fSmoothlenSq = constants.fSmoothlen * constants.fSmoothlen;
+    const __m128 vSmoothlenSq = _mm_set1_ps( fSmoothlenSq );
+
+    for( UINT P_ID = iFirst; P_ID < iLast; P_ID++ )
+    {
+        const FLOAT fPX = m_pPositionX[ P_ID ];
+        const FLOAT fPY = m_pPositionY[ P_ID ];
+        const __m128 vPX = _mm_set1_ps( fPX );
+        const __m128 vPY = _mm_set1_ps( fPY );
+        const UINT iKey = GridCalculateKey( fPX, fPY, constants );
+
+        UINT iStart[ 3 ], iEnd[ 3 ];
+        const UINT iNumRuns = GetNeighborRuns( iKey, iStart, iEnd );
+
+        __m128 vDensity = _mm_setzero_ps();
+        for( UINT iRun = 0; iRun < iNumRuns; iRun++ )
+        {
+            for( UINT N_ID = iStart[ iRun ]; N_ID < iEnd[ iRun ]; N_ID += 4 )
+            {
+                const __m128 vDiffX = _mm_sub_ps( _mm_loadu_ps( m_pPositionX + N_ID ), vPX );
+                const __m128 vDiffY = _mm_sub_ps( _mm_loadu_ps( m_pPositionY + N_ID ), vPY );
+                const __m128 vRSq = _mm_add_ps( _mm_mul_ps( vDiffX, vDiffX ), _mm_mul_ps( vDiffY, vDiffY ) );
+                __m128 vMask = _mm_cmplt_ps( vRSq, vSmoothlenSq );
+                vMask = _mm_and_ps( vMask, _mm_load_ps( (const FLOAT*)s_TailMasks[ min( iEnd[ iRun ] - N_ID, 4U ) ] ) );
+
+                // (h^2 - r^2)^3
+                const __m128 vD = _mm_sub_ps( vSmoothlenSq, vRSq );
+                vDensity = _mm_add_ps( vDensity, _mm_and_ps( vMask, _mm_mul_ps( _mm_mul_ps( vD, vD ), vD ) ) );
+            }
+        }
+
+        // The particle itself is always in range, so the density is never zero
+        const FLOAT fDensity = constants.fDensityCoef * HorizontalSum( vDensity );
+        const FLOAT fRatio = fDensity / constants.fRestDensity;
+
+        m_pDensity[ P_ID ] = fDensity;
+        m_pInvDensity[ P_ID ] = 1.0f / fDensity;
+        m_pPressure[ P_ID ] = constants.fPressureStiffness * max( fRatio * fRatio * fRatio - 1.0f, 0.0f );
+        m_pDensities[ P_ID ].fDensity = fDensity;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// ForceCS_Grid followed by IntegrateCS for sorted particles [iFirst, iLast).  The
+// integrated particles go to m_pParticles while the neighbors are read from the sorted
+// SoA arrays, so the two passes can be fused.
+//--------------------------------------------------------------------------------------
+void CFluidCPU::ComputeForceAndIntegrate( const CBSimulationConstants& constants, UINT iFirst, UINT iLast )
+{
+    const FLOAT fSmoothlen = constants.fSmoothlen;
+    const __m128 vSmoothlen = _mm_set1_ps( fSmoothlen );
+    const __m128 vSmoothlenSq = _mm_set1_ps( fSmoothlen * fSmoothlen );
+    const __m128 vHalfGradPressureCoef = _mm_set1_ps( 0.5f * constants.fGradPressureCoef );
+    const __m128 vLapViscosityCoef = _mm_set1_ps( constants.fLapViscosityCoef );
+
+    for( UINT P_ID = iFirst; P_ID < iLast; P_ID++ )
+    {
+        const FLOAT fPX = m_pPositionX[ P_ID ];
+        const FLOAT fPY = m_pPositionY[ P_ID ];
+        const __m128 vPX = _mm_set1_ps( fPX );
+        const __m128 vPY = _mm_set1_ps( fPY );
+        const __m128 vPVelX = _mm_set1_ps( m_pVelocityX[ P_ID ] );
+        const __m128 vPVelY = _mm_set1_ps( m_pVelocityY[ P_ID ] );
+        const __m128 vPPressure = _mm_set1_ps( m_pPressure[ P_ID ] );
+        const UINT iKey = GridCalculateKey( fPX, fPY, constants );
+
+        UINT iStart[ 3 ], iEnd[ 3 ];
+        const UINT iNumRuns = GetNeighborRuns( iKey, iStart, iEnd );
+
+        __m128 vAccX = _mm_setzero_ps();
+        __m128 vAccY = _mm_setzero_ps();
+        for( UINT iRun = 0; iRun < iNumRuns; iRun++ )
+        {
+            for( UINT N_ID = iStart[ iRun ]; N_ID < iEnd[ iRun ]; N_ID += 4 )
+            {
+                const __m128 vDiffX = _mm_sub_ps( _mm_loadu_ps( m_pPositionX + N_ID ), vPX );
+                const __m128 vDiffY = _mm_sub_ps( _mm_loadu_ps( m_pPositionY + N_ID ), vPY );
+                const __m128 vRSq = _mm_add_ps( _mm_mul_ps( vDiffX, vDiffX ), _mm_mul_ps( vDiffY, vDiffY ) );
+                __m128 vMask = _mm_cmplt_ps( vRSq, vSmoothlenSq );
+                vMask = _mm_and_ps( vMask, _mm_load_ps( (const FLOAT*)s_TailMasks[ min( iEnd[ iRun ] - N_ID, 4U ) ] ) );
+                if( P_ID - N_ID < 4 )
+                    vMask = _mm_and_ps( vMask, _mm_load_ps( (const FLOAT*)s_SkipMasks[ P_ID - N_ID ] ) );
+                if( _mm_movemask_ps( vMask ) == 0 )
+                    continue;
+
+                // Masked lanes may hold inf or NaN from r = 0 or far particles; the final
+                // AND with the mask clears them
+                const __m128 vR = _mm_sqrt_ps( vRSq );
+                const __m128 vHR = _mm_sub_ps( vSmoothlen, vR );
+                const __m128 vNInvDensity = _mm_loadu_ps( m_pInvDensity + N_ID );
+
+                // Pressure Term: fGradPressureCoef * avg_pressure / N_density * (h - r)^2 / r * diff
+                __m128 vPressureScale = _mm_add_ps( _mm_loadu_ps( m_pPressure + N_ID ), vPPressure );
+                vPressureScale = _mm_mul_ps( _mm_mul_ps( vPressureScale, vHalfGradPressureCoef ), vNInvDensity );
+                vPressureScale = _mm_div_ps( _mm_mul_ps( vPressureScale, _mm_mul_ps( vHR, vHR ) ), vR );
+
+                // Viscosity Term: fLapViscosityCoef / N_density * (h - r) * (N_velocity - P_velocity)
+                const __m128 vViscosityScale = _mm_mul_ps( _mm_mul_ps( vLapViscosityCoef, vNInvDensity ), vHR );
+                const __m128 vVelDiffX = _mm_sub_ps( _mm_loadu_ps( m_pVelocityX + N_ID ), vPVelX );
+                const __m128 vVelDiffY = _mm_sub_ps( _mm_loadu_ps( m_pVelocityY + N_ID ), vPVelY );
+
+                const __m128 vX = _mm_add_ps( _mm_mul_ps( vPressureScale, vDiffX ), _mm_mul_ps( vViscosityScale, vVelDiffX ) );
+                const __m128 vY = _mm_add_ps( _mm_mul_ps( vPressureScale, vDiffY ), _mm_mul_ps( vViscosityScale, vVelDiffY ) );
+                vAccX = _mm_add_ps( vAccX, _mm_and_ps( vMask, vX ) );
+                vAccY = _mm_add_ps( vAccY, _mm_and_ps( vMask, vY ) );
+            }
+        }
+
+        XMFLOAT2 vAcceleration( HorizontalSum( vAccX ) * m_pInvDensity[ P_ID ],
+                                HorizontalSum( vAccY ) * m_pInvDensity[ P_ID ] );
+        m_pForces[ P_ID ].vAcceleration = vAcceleration;
+
+        // Apply the forces from the map walls
+        for( UINT i = 0; i < 4; i++ )
+        {
+            const XMFLOAT3A& vPlane = constants.vPlanes[ i ];
+            const FLOAT fDist = fPX * vPlane.x + fPY * vPlane.y + vPlane.z;
+            const FLOAT fPush = min( fDist, 0.0f ) * -constants.fWallStiffness;
+            vAcceleration.x += fPush * vPlane.x;
+            vAcceleration.y += fPush * vPlane.y;
+        }
+
+        // Apply gravity
+        vAcceleration.x += constants.vGravity.x;
+        vAcceleration.y += constants.vGravity.y;
+
+        // Integrate
+        Particle& particle = m_pParticles[ P_ID ];
+        particle.vVelocity.x = m_pVelocityX[ P_ID ] + constants.fTimeStep * vAcceleration.x;
+        particle.vVelocity.y = m_pVelocityY[ P_ID ] + constants.fTimeStep * vAcceleration.y;
+        particle.vPosition.x = fPX + constants.fTimeStep * particle.vVelocity.x;
+        particle.vPosition.y = fPY + constants.fTimeStep * particle.vVelocity.y;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Runs one simulation step.  Each pass finishes on all threads before the next starts,
+// like the Dispatch calls in SimulateFluid_Grid.
+//--------------------------------------------------------------------------------------
+void CFluidCPU::Simulate( const CBSimulationConstants& constants )
+{
+    assert( constants.iNumParticles == m_iNumParticles );
+    if( m_iNumParticles == 0 )
+        return;
+
+    BuildGrid( constants );
+
+    const UINT iNumBlocks = ( m_iNumParticles + FLUID_BLOCK_SIZE - 1 ) / FLUID_BLOCK_SIZE;
+
+    Concurrency::parallel_for( 0U, iNumBlocks, [&]( UINT iBlock )
+    {
+        ComputeDensity( constants, iBlock * FLUID_BLOCK_SIZE,
+                        min( ( iBlock + 1 ) * FLUID_BLOCK_SIZE, m_iNumParticles ) );
+    } );
+
+    Concurrency::parallel_for( 0U, iNumBlocks, [&]( UINT iBlock )
+    {
+        ComputeForceAndIntegrate( constants, iBlock * FLUID_BLOCK_SIZE,
+                                  min( ( iBlock + 1 ) * FLUID_BLOCK_SIZE, m_iNumParticles ) );
+    } );
+}
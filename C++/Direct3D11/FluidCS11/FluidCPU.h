@@ -0,0 +1,115 @@
+//--------------------------------------------------------------------------------------
+// File: FluidCPU.h
+//
+// Multithreaded CPU implementation of the grid + sort SPH simulation in FluidCS11.hlsl.
+// It produces the same particle, density and force buffers as the compute shader path,
+// so it can stand in for it on machines without a D3D11 GPU or run without a device.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <xnamath.h>
+
+//--------------------------------------------------------------------------------------
+// Particle buffer layouts, shared with the structured buffers in FluidCS11.hlsl
+//--------------------------------------------------------------------------------------
+struct Particle
+{
+    XMFLOAT2 vPosition;
+    XMFLOAT2 vVelocity;
+};
+
+struct ParticleDensity
+{
+    FLOAT fDensity;
+};
+
+struct ParticleForces
+{
+    XMFLOAT2 vAcceleration;
+};
+
+// Constant Buffer Layout
+#pragma warning(push)
+#pragma warning(disable:4324) // structure was padded due to __declspec(align())
+_DECLSPEC_ALIGN_16_ struct CBSimulationConstants
+{
+    UINT iNumParticles;
+    FLOAT fTimeStep;
+    FLOAT fSmoothlen;
+    FLOAT fPressureStiffness;
+    FLOAT fRestDensity;
+    FLOAT fDensityCoef;
+    FLOAT fGradPressureCoef;
+    FLOAT fLapViscosityCoef;
+    FLOAT fWallStiffness;
+
+    XMFLOAT2A vGravity;
+    XMFLOAT4A vGridDim;
+
+    XMFLOAT3A vPlanes[4];
+};
+#pragma warning(pop)
+
+
+//--------------------------------------------------------------------------------------
+// CPU fluid solver.  Each Simulate() call performs one step of the grid algorithm:
+//    Build Grid: a counting sort of the particles by grid cell, done in parallel chunks
+//        with a prefix sum over the cells, that also yields the start and end of each cell
+//    Density, Force + Integrate: SSE kernels that test four neighbors at a time from the
+//        8 adjacent cells + current cell
+// The work is spread over the Concurrency Runtime's thread pool, which uses one worker
+// per core by default.  Chunking depends only on the particle count, so the results do
+// not change with the number of threads.
+//--------------------------------------------------------------------------------------
+class CFluidCPU
+{
+public:
+    CFluidCPU();
+    ~CFluidCPU();
+
+    HRESULT Create( UINT iNumParticles, const Particle* pInitialParticles );
+    void Destroy();
+
+    // Advances the simulation by constants.fTimeStep using the same constants the compute
+    // shaders read.  constants.iNumParticles must match the count passed to Create.
+    void Simulate( const CBSimulationConstants& constants );
+
+    // As on the GPU, the results are left in grid order, not in the initial particle order
+    UINT GetNumParticles() const { return m_iNumParticles; }
+    const Particle* GetParticles() const { return m_pParticles; }
+    const ParticleDensity* GetDensities() const { return m_pDensities; }
+    const ParticleForces* GetForces() const { return m_pForces; }
+
+protected:
+    void BuildGrid( const CBSimulationConstants& constants );
+    UINT GetNeighborRuns( UINT iKey, UINT iStart[3], UINT iEnd[3] ) const;
+    void ComputeDensity( const CBSimulationConstants& constants, UINT iFirst, UINT iLast );
+    void ComputeForceAndIntegrate( const CBSimulationConstants& constants, UINT iFirst, UINT iLast );
+
+    UINT m_iNumParticles;
+    UINT m_iNumChunks;             // particle chunks used by the parallel counting sort
+    UINT m_iChunkSize;
+
+    // Output, in the layouts of the GPU buffers
+    Particle* m_pParticles;
+    ParticleDensity* m_pDensities;
+    ParticleForces* m_pForces;
+
+    // Sorted particles in SoA form for the SSE kernels.  Each array has 3 extra entries so
+    // the last group of four can always be loaded.
+    FLOAT* m_pPositionX;
+    FLOAT* m_pPositionY;
+    FLOAT* m_pVelocityX;
+    FLOAT* m_pVelocityY;
+    FLOAT* m_pDensity;
+    FLOAT* m_pInvDensity;
+    FLOAT* m_pPressure;
+
+    UINT* m_pKeys;                 // grid cell of each particle in m_pParticles
+    UINT* m_pCellOffsets;          // m_iNumChunks rows of per cell counts, then write offsets
+    UINT* m_pGridIndices;          // start and end of each cell in the sorted arrays
+    UINT m_iMinKey;                // only cells in [m_iMinKey, m_iMaxKey] are valid this step
+    UINT m_iMaxKey;
+};
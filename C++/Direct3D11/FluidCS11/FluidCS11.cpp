@@ -23,22 +23,8 @@
 #include "resource.h"
 #include "WaitDlg.h"
 #include <xnamath.h>
-
-struct Particle
-{
-    XMFLOAT2 vPosition;
-    XMFLOAT2 vVelocity;
-};
-
-struct ParticleDensity
-{
-    FLOAT fDensity;
-};
-
-struct ParticleForces
-{
-    XMFLOAT2 vAcceleration;
-};
+#include <ppl.h>
+#include "FluidCPU.h"
 
 struct UINT2
 {
@@ -109,11 +95,15 @@ enum eSimulationMode
 {
     SIM_MODE_SIMPLE,
     SIM_MODE_SHARED,
-    SIM_MODE_GRID
+    SIM_MODE_GRID,
+    SIM_MODE_CPU
 };
 
 eSimulationMode g_eSimMode = SIM_MODE_GRID;
 
+// CPU implementation of the grid algorithm, used by SIM_MODE_CPU and the -cpubench switch
+CFluidCPU g_FluidCPU;
+
 //--------------------------------------------------------------------------------------
 // Direct3D11 Global variables
 //--------------------------------------------------------------------------------------
@@ -179,27 +169,9 @@ ID3D11Buffer*                       g_pGridIndices = NULL;
 ID3D11ShaderResourceView*           g_pGridIndicesSRV = NULL;
 ID3D11UnorderedAccessView*          g_pGridIndicesUAV = NULL;
 
-// Constant Buffer Layout
+// Constant Buffer Layout (CBSimulationConstants is shared with the CPU solver in FluidCPU.h)
 #pragma warning(push)
 #pragma warning(disable:4324) // structure was padded due to __declspec(align())
-_DECLSPEC_ALIGN_16_ struct CBSimulationConstants
-{
-    UINT iNumParticles;
-    FLOAT fTimeStep;
-    FLOAT fSmoothlen;
-    FLOAT fPressureStiffness;
-    FLOAT fRestDensity;
-    FLOAT fDensityCoef;
-    FLOAT fGradPressureCoef;
-    FLOAT fLapViscosityCoef;
-    FLOAT fWallStiffness;
-
-    XMFLOAT2A vGravity;
-    XMFLOAT4A vGridDim;
-
-    XMFLOAT3A vPlanes[4];
-};
-
 _DECLSPEC_ALIGN_16_ struct CBRenderConstants
 {
     XMFLOAT4X4 mViewProjection;
@@ -234,6 +206,7 @@ ID3D11Buffer*                       g_pSortCB = NULL;
 #define IDC_SIMSIMPLE             9
 #define IDC_SIMSHARED             10
 #define IDC_SIMGRID               11
+#define IDC_SIMCPU                12
 
 //--------------------------------------------------------------------------------------
 // Forward declarations
@@ -257,6 +230,7 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 HRESULT CreateSimulationBuffers( ID3D11Device* pd3dDevice );
 void InitApp();
 void RenderText();
+int RunCPUBenchmark( UINT iNumSteps );
 
 //--------------------------------------------------------------------------------------
 // Entry point to the program. Initializes everything and goes into a message processing
@@ -272,6 +246,18 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdL
     // DXUT will create and use the best device (either D3D10 or D3D11)
     // that is available on the system depending on which D3D callbacks are set below
 
+    // "FluidCS11.exe -cpubench [steps]" times the CPU solver without creating a window or
+    // a device, and writes the results to the debugger output
+    int nArgs = 0;
+    LPWSTR* pstrArgs = CommandLineToArgvW( GetCommandLineW(), &nArgs );
+    if( pstrArgs && nArgs >= 2 && !_wcsicmp( pstrArgs[1], L"-cpubench" ) )
+    {
+        UINT iNumSteps = ( nArgs >= 3 ) ? (UINT)_wtoi( pstrArgs[2] ) : 0;
+        LocalFree( pstrArgs );
+        return RunCPUBenchmark( ( iNumSteps > 0 ) ? iNumSteps : 500 );
+    }
+    LocalFree( pstrArgs );
+
     // Set DXUT callbacks
     DXUTSetCallbackDeviceChanging( ModifyDeviceSettings );
     DXUTSetCallbackMsgProc( MsgProc );
@@ -329,6 +315,7 @@ void InitApp()
     g_SampleUI.AddRadioButton( IDC_SIMSIMPLE, IDC_SIMMODE, L"Simple N^2", 0, iY += 26, 150, 22 );
     g_SampleUI.AddRadioButton( IDC_SIMSHARED, IDC_SIMMODE, L"Shared Memory N^2", 0, iY += 26, 150, 22 );
     g_SampleUI.AddRadioButton( IDC_SIMGRID, IDC_SIMMODE, L"Grid + Sort", 0, iY += 26, 150, 22 );
+    g_SampleUI.AddRadioButton( IDC_SIMCPU, IDC_SIMMODE, L"CPU Grid + Sort", 0, iY += 26, 150, 22 );
     g_SampleUI.GetRadioButton( IDC_SIMGRID )->SetChecked( true );
 }
 
@@ -430,6 +417,12 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
             g_eSimMode = SIM_MODE_SHARED; break;
         case IDC_SIMGRID:
             g_eSimMode = SIM_MODE_GRID; break;
+        case IDC_SIMCPU:
+            // The CPU solver does not read back the GPU state, so restart both from the
+            // initial particles
+            g_eSimMode = SIM_MODE_CPU;
+            CreateSimulationBuffers( DXUTGetD3D11Device() );
+            break;
     }
 }
 
@@ -543,6 +536,23 @@ HRESULT CreateStructuredBuffer(ID3D11Device* pd3dDevice, UINT iNumElements, ID3D
 }
 
 
+//--------------------------------------------------------------------------------------
+// Fill in the starting state of the particles
+//--------------------------------------------------------------------------------------
+void InitParticles( Particle* particles, UINT iNumParticles )
+{
+    const UINT iStartingWidth = (UINT)sqrt( (FLOAT)iNumParticles );
+    ZeroMemory( particles, sizeof(Particle) * iNumParticles );
+    for ( UINT i = 0 ; i < iNumParticles ; i++ )
+    {
+        // Arrange the particles in a nice square
+        UINT x = i % iStartingWidth;
+        UINT y = i / iStartingWidth;
+        particles[ i ].vPosition = XMFLOAT2( g_fInitialParticleSpacing * (FLOAT)x, g_fInitialParticleSpacing * (FLOAT)y );
+    }
+}
+
+
 //--------------------------------------------------------------------------------------
 // Create the buffers used for the simulation data
 //--------------------------------------------------------------------------------------
@@ -580,17 +590,9 @@ HRESULT CreateSimulationBuffers( ID3D11Device* pd3dDevice )
     SAFE_RELEASE( g_pGridIndices );
 
     // Create the initial particle positions
-    // This is only used to populate the GPU buffers on creation
-    const UINT iStartingWidth = (UINT)sqrt( (FLOAT)g_iNumParticles );
+    // This is only used to populate the GPU buffers and the CPU solver on creation
     Particle* particles = new Particle[ g_iNumParticles ];
-    ZeroMemory( particles, sizeof(Particle) * g_iNumParticles );
-    for ( UINT i = 0 ; i < g_iNumParticles ; i++ )
-    {
-        // Arrange the particles in a nice square
-        UINT x = i % iStartingWidth;
-        UINT y = i / iStartingWidth;
-        particles[ i ].vPosition = XMFLOAT2( g_fInitialParticleSpacing * (FLOAT)x, g_fInitialParticleSpacing * (FLOAT)y );
-    }
+    InitParticles( particles, g_iNumParticles );
 
     // Create Structured Buffers
     V_RETURN( CreateStructuredBuffer< Particle >( pd3dDevice, g_iNumParticles, &g_pParticles, &g_pParticlesSRV, &g_pParticlesUAV, particles ) );
@@ -628,6 +630,8 @@ HRESULT CreateSimulationBuffers( ID3D11Device* pd3dDevice )
     DXUT_SetDebugName( g_pGridIndicesSRV, "Indices SRV" );
     DXUT_SetDebugName( g_pGridIndicesUAV, "Indices UAV" );
 
+    V_RETURN( g_FluidCPU.Create( g_iNumParticles, particles ) );
+
     delete[] particles;
 
     return S_OK;
@@ -980,41 +984,65 @@ void SimulateFluid_Grid( ID3D11DeviceContext* pd3dImmediateContext )
 
 
 //--------------------------------------------------------------------------------------
-// GPU Fluid Simulation
+// CPU Fluid Simulation
+//    Runs the same grid algorithm on the CPU and uploads the particles and densities
+//    for rendering
 //--------------------------------------------------------------------------------------
-void SimulateFluid( ID3D11DeviceContext* pd3dImmediateContext, float fElapsedTime )
+void SimulateFluid_CPU( ID3D11DeviceContext* pd3dImmediateContext, const CBSimulationConstants& constants )
 {
-    UINT UAVInitialCounts = 0;
+    g_FluidCPU.Simulate( constants );
 
-    // Update per-frame variables
-    CBSimulationConstants pData = {};
+    pd3dImmediateContext->UpdateSubresource( g_pParticles, 0, NULL, g_FluidCPU.GetParticles(), 0, 0 );
+    pd3dImmediateContext->UpdateSubresource( g_pParticleDensity, 0, NULL, g_FluidCPU.GetDensities(), 0, 0 );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Fill in the simulation constants shared by the compute shaders and the CPU solver
+//--------------------------------------------------------------------------------------
+void GetSimulationConstants( CBSimulationConstants* pData, UINT iNumParticles, float fElapsedTime )
+{
+    ZeroMemory( pData, sizeof(CBSimulationConstants) );
 
     // Simulation Constants
-    pData.iNumParticles = g_iNumParticles;
+    pData->iNumParticles = iNumParticles;
     // Clamp the time step when the simulation runs slowly to prevent numerical explosion
-    pData.fTimeStep = min( g_fMaxAllowableTimeStep, fElapsedTime );
-    pData.fSmoothlen = g_fSmoothlen;
-    pData.fPressureStiffness = g_fPressureStiffness;
-    pData.fRestDensity = g_fRestDensity;
-    pData.fDensityCoef = g_fParticleMass * 315.0f / (64.0f * XM_PI * pow(g_fSmoothlen, 9));
-    pData.fGradPressureCoef = g_fParticleMass * -45.0f / (XM_PI * pow(g_fSmoothlen, 6));
-    pData.fLapViscosityCoef = g_fParticleMass * g_fViscosity * 45.0f / (XM_PI * pow(g_fSmoothlen, 6));
+    pData->fTimeStep = min( g_fMaxAllowableTimeStep, fElapsedTime );
+    pData->fSmoothlen = g_fSmoothlen;
+    pData->fPressureStiffness = g_fPressureStiffness;
+    pData->fRestDensity = g_fRestDensity;
+    pData->fDensityCoef = g_fParticleMass * 315.0f / (64.0f * XM_PI * pow(g_fSmoothlen, 9));
+    pData->fGradPressureCoef = g_fParticleMass * -45.0f / (XM_PI * pow(g_fSmoothlen, 6));
+    pData->fLapViscosityCoef = g_fParticleMass * g_fViscosity * 45.0f / (XM_PI * pow(g_fSmoothlen, 6));
 
-    pData.vGravity = g_vGravity;
+    pData->vGravity = g_vGravity;
 
     // Cells are spaced the size of the smoothing length search radius
     // That way we only need to search the 8 adjacent cells + current cell
-    pData.vGridDim.x = 1.0f / g_fSmoothlen;
-    pData.vGridDim.y = 1.0f / g_fSmoothlen;
-    pData.vGridDim.z = 0;
-    pData.vGridDim.w = 0;
+    pData->vGridDim.x = 1.0f / g_fSmoothlen;
+    pData->vGridDim.y = 1.0f / g_fSmoothlen;
+    pData->vGridDim.z = 0;
+    pData->vGridDim.w = 0;
 
     // Collision information for the map
-    pData.fWallStiffness = g_fWallStiffness;
-    pData.vPlanes[0] = g_vPlanes[0];
-    pData.vPlanes[1] = g_vPlanes[1];
-    pData.vPlanes[2] = g_vPlanes[2];
-    pData.vPlanes[3] = g_vPlanes[3];
+    pData->fWallStiffness = g_fWallStiffness;
+    pData->vPlanes[0] = g_vPlanes[0];
+    pData->vPlanes[1] = g_vPlanes[1];
+    pData->vPlanes[2] = g_vPlanes[2];
+    pData->vPlanes[3] = g_vPlanes[3];
+}
+
+
+//--------------------------------------------------------------------------------------
+// GPU Fluid Simulation
+//--------------------------------------------------------------------------------------
+void SimulateFluid( ID3D11DeviceContext* pd3dImmediateContext, float fElapsedTime )
+{
+    UINT UAVInitialCounts = 0;
+
+    // Update per-frame variables
+    CBSimulationConstants pData;
+    GetSimulationConstants( &pData, g_iNumParticles, fElapsedTime );
 
     pd3dImmediateContext->UpdateSubresource( g_pcbSimulationConstants, 0, NULL, &pData, 0, 0 );
 
@@ -1033,6 +1061,11 @@ void SimulateFluid( ID3D11DeviceContext* pd3dImmediateContext, float fElapsedTim
         case SIM_MODE_GRID:
             SimulateFluid_Grid( pd3dImmediateContext );
             break;
+
+        // Grid + Sort Algorithm on the CPU
+        case SIM_MODE_CPU:
+            SimulateFluid_CPU( pd3dImmediateContext, pData );
+            break;
     }
 
     // Unset
@@ -1045,6 +1078,81 @@ void SimulateFluid( ID3D11DeviceContext* pd3dImmediateContext, float fElapsedTim
 }
 
 
+//--------------------------------------------------------------------------------------
+// Time iNumSteps steps of the CPU solver from the initial particle layout
+//--------------------------------------------------------------------------------------
+double TimeCPUSolver( UINT iNumParticles, UINT iNumSteps )
+{
+    Particle* particles = new Particle[ iNumParticles ];
+    InitParticles( particles, iNumParticles );
+    HRESULT hr = g_FluidCPU.Create( iNumParticles, particles );
+    delete[] particles;
+    if( FAILED( hr ) )
+        return 0.0;
+
+    // Run at the largest time step the sample allows, as it does when the frame rate drops
+    CBSimulationConstants constants;
+    GetSimulationConstants( &constants, iNumParticles, g_fMaxAllowableTimeStep );
+
+    // Let the thread pool spin up and the particles start moving before timing
+    for( UINT i = 0; i < 10; i++ )
+        g_FluidCPU.Simulate( constants );
+
+    LARGE_INTEGER liFrequency, liStart, liEnd;
+    QueryPerformanceFrequency( &liFrequency );
+    QueryPerformanceCounter( &liStart );
+    for( UINT i = 0; i < iNumSteps; i++ )
+        g_FluidCPU.Simulate( constants );
+    QueryPerformanceCounter( &liEnd );
+
+    g_FluidCPU.Destroy();
+
+    const double fSeconds = (double)( liEnd.QuadPart - liStart.QuadPart ) / (double)liFrequency.QuadPart;
+    return ( fSeconds > 0.0 ) ? iNumSteps / fSeconds : 0.0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Headless benchmark of the CPU solver for each particle count the sample offers.  Each
+// count is run on a single thread and on the default scheduler, which uses every core.
+//--------------------------------------------------------------------------------------
+int RunCPUBenchmark( UINT iNumSteps )
+{
+    static const UINT s_iParticleCounts[] = { NUM_PARTICLES_8K, NUM_PARTICLES_16K, NUM_PARTICLES_32K, NUM_PARTICLES_64K };
+
+    WCHAR strLine[256];
+    swprintf_s( strLine, 256, L"\nFluidCS11 CPU solver: %u steps per run, %u hardware threads\n", iNumSteps,
+                Concurrency::GetProcessorCount() );
+    OutputDebugStringW( strLine );
+    swprintf_s( strLine, 256, L"%10s %18s %18s %10s\n", L"Particles", L"1 thread", L"All threads", L"Speedup" );
+    OutputDebugStringW( strLine );
+
+    for( UINT i = 0; i < ARRAYSIZE( s_iParticleCounts ); i++ )
+    {
+        const UINT iNumParticles = s_iParticleCounts[i];
+
+        Concurrency::CurrentScheduler::Create( Concurrency::SchedulerPolicy( 2, Concurrency::MinConcurrency, 1,
+                                                                             Concurrency::MaxConcurrency, 1 ) );
+        const double fSerial = TimeCPUSolver( iNumParticles, iNumSteps );
+        Concurrency::CurrentScheduler::Detach();
+
+        const double fParallel = TimeCPUSolver( iNumParticles, iNumSteps );
+        if( fSerial == 0.0 || fParallel == 0.0 )
+        {
+            swprintf_s( strLine, 256, L"%9uK  out of memory\n", iNumParticles / 1024 );
+            OutputDebugStringW( strLine );
+            return 1;
+        }
+
+        swprintf_s( strLine, 256, L"%9uK %10.1f steps/s %10.1f steps/s %9.2fx\n", iNumParticles / 1024, fSerial,
+                    fParallel, fParallel / fSerial );
+        OutputDebugStringW( strLine );
+    }
+
+    return 0;
+}
+
+
 //--------------------------------------------------------------------------------------
 // GPU Fluid Rendering
 //--------------------------------------------------------------------------------------
@@ -1189,4 +1297,6 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
     SAFE_RELEASE( g_pGridIndicesSRV );
     SAFE_RELEASE( g_pGridIndicesUAV );
     SAFE_RELEASE( g_pGridIndices );
+
+    g_FluidCPU.Destroy();
 }
@@ -587,6 +587,7 @@ struct SD3DShaderVTable
     void ( __stdcall ID3D11DeviceContext::*pSetSamplers)(uint32_t Offset, uint32_t NumSamplers, ID3D11SamplerState*const* pSamplers);
     void ( __stdcall ID3D11DeviceContext::*pSetShaderResources)(uint32_t Offset, uint32_t NumResources, ID3D11ShaderResourceView *const *pResources);
     HRESULT ( __stdcall ID3D11Device::*pCreateShader)(const void *pShaderBlob, size_t ShaderBlobSize, ID3D11ClassLinkage* pClassLinkage, ID3D11DeviceChild **ppShader);
+    uint32_t Stage;     // index into CEffectStateCache::m_Stages
 };
 
 
@@ -1055,6 +1056,86 @@ public:
 };
 
 
+//////////////////////////////////////////////////////////////////////////
+// Context state cache
+//////////////////////////////////////////////////////////////////////////
+
+// {DC47A8F7-38A2-44BA-9DD6-8FB68D47BA36}
+DEFINE_GUID(GUID_D3DX11EffectStateCache,
+0xdc47a8f7, 0x38a2, 0x44ba, 0x9d, 0xd6, 0x8f, 0xb6, 0x8d, 0x47, 0xba, 0x36);
+
+// Shadow of the state that ID3DX11EffectPass::Apply last bound on a device
+// context.  It is attached to the context as private data, so every effect
+// applied to that context shares it and it is released along with the context.
+//
+// Shader resource views, UAVs and render targets are not tracked: binding
+// a resource for output makes the runtime unbind it as an input (and vice versa),
+// so our shadow of those could go stale without anybody touching the context.
+class CEffectStateCache : public IUnknown
+{
+public:
+    enum { NumStages = 6 };
+
+    struct SStage
+    {
+        ID3D11DeviceChild       *pShader;
+        ID3D11Buffer            *pConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+        ID3D11SamplerState      *pSamplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+    };
+
+    struct SState
+    {
+        SStage                  Stages[NumStages];
+        ID3D11BlendState        *pBlendState;
+        float                   BlendFactor[4];
+        uint32_t                SampleMask;
+        ID3D11DepthStencilState *pDepthStencilState;
+        uint32_t                StencilRef;
+        ID3D11RasterizerState   *pRasterizerState;
+    };
+
+protected:
+    volatile long           m_RefCount;
+    SState                  m_State;
+    bool                    m_SkipRedundantState;
+
+    static volatile long    s_LiveCount;
+
+    CEffectStateCache() noexcept;
+    ~CEffectStateCache();
+
+    bool Issue(_In_ bool Changed);
+
+public:
+    D3DX11_EFFECT_STATE_CACHE_STATS m_Stats;
+
+    // Returns the context's cache with a reference, creating it if Create is set.
+    // Without Create this is free until a cache has been created for some context.
+    static CEffectStateCache *Acquire(_In_ ID3D11DeviceContext *pContext, _In_ bool Create);
+
+    // Called at the start of each Apply; without SkipRedundantState the binds
+    // are still recorded so that later skipping Applies see them
+    void BeginApply(_In_ bool SkipRedundantState) { m_SkipRedundantState = SkipRedundantState; }
+
+    // Forget everything, for when state was set behind the effect's back
+    void Invalidate();
+
+    // Each of these records the new state and returns true if the call has to be
+    // made, i.e. if the state differs from what was last bound or skipping is off
+    bool SetShader(_In_ uint32_t Stage, _In_opt_ ID3D11DeviceChild *pShader, _In_ uint32_t NumClassInstances);
+    bool SetConstantBuffers(_In_ uint32_t Stage, _In_ uint32_t StartSlot, _In_ uint32_t Count, _In_reads_(Count) ID3D11Buffer *const *ppBuffers);
+    bool SetSamplers(_In_ uint32_t Stage, _In_ uint32_t StartSlot, _In_ uint32_t Count, _In_reads_(Count) ID3D11SamplerState *const *ppSamplers);
+    bool SetBlendState(_In_opt_ ID3D11BlendState *pBlendState, _In_reads_(4) const float BlendFactor[4], _In_ uint32_t SampleMask);
+    bool SetDepthStencilState(_In_opt_ ID3D11DepthStencilState *pDepthStencilState, _In_ uint32_t StencilRef);
+    bool SetRasterizerState(_In_opt_ ID3D11RasterizerState *pRasterizerState);
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, _COM_Outptr_ LPVOID *ppv) override;
+    STDMETHOD_(ULONG, AddRef)() override;
+    STDMETHOD_(ULONG, Release)() override;
+};
+
+
 class CEffect : public ID3DX11Effect
 {
     friend struct SBaseBlock;
@@ -1137,6 +1218,7 @@ protected:
 
     ID3D11Device            *m_pDevice;
     ID3D11DeviceContext     *m_pContext;
+    CEffectStateCache       *m_pStateCache;     // only set during Apply, may be nullptr
     ID3D11ClassLinkage      *m_pClassLinkage;
 
     // Master lists of reflection interfaces
@@ -1162,6 +1244,48 @@ protected:
     // remaining data should be migrated into the optimized type heap
     CEffectHeap             *m_pOptimizedTypeHeap;
 
+    //////////////////////////////////////////////////////////////////////////
+    // Name index
+
+    enum ENamedObjectKind
+    {
+        ENO_Variable,
+        ENO_ConstantBuffer,
+        ENO_Group,
+        ENO_Technique,          // pScope is the owning SGroup
+    };
+
+    struct SNamedObject
+    {
+        ENamedObjectKind    Kind;
+        const void          *pScope;
+        LPCSTR              pName;
+        void                *pObject;
+    };
+
+    static bool AreNamedObjectsEqual(const SNamedObject &Obj1, const SNamedObject &Obj2)
+    {
+        return Obj1.Kind == Obj2.Kind && Obj1.pScope == Obj2.pScope && strcmp(Obj1.pName, Obj2.pName) == 0;
+    }
+
+    typedef CEffectHashTableWithPrivateHeap<SNamedObject, AreNamedObjectsEqual> CNameHashTable;
+
+    // Maps variable, cbuffer, group and technique names to their objects so the
+    // by-name lookups don't have to scan.  It is built once the effect data has been
+    // relocated, its entries live in m_pPooledHeap and it is freed by Optimize()
+    // along with the names it points to.  Until it exists the lookups fall back
+    // to a linear search.
+    CNameHashTable          *m_pNameIndex;
+
+    HRESULT BuildNameIndex();
+    HRESULT AddToNameIndex(_In_ ENamedObjectKind Kind, _In_opt_ const void *pScope, _In_opt_z_ LPCSTR pName, _In_ void *pObject);
+
+    // Returns false if there is no name index, otherwise *ppObject is the object or nullptr if not found
+    bool FindInNameIndex(_In_ ENamedObjectKind Kind, _In_opt_ const void *pScope, _In_z_ LPCSTR pName, _Outptr_result_maybenull_ void **ppObject);
+
+    SGroup *FindGroup(_In_z_ LPCSTR pName);
+    STechnique *FindTechnique(_In_ SGroup *pGroup, _In_z_ LPCSTR pName);
+
     // Pools a string or type and modifies the pointer
     void AddStringToPool(const char **ppString);
     void AddTypeToPool(SType **ppType);
@@ -186,7 +186,9 @@ HRESULT D3DX11CompileEffectFromMemory( LPCVOID pData, SIZE_T DataLength, LPCSTR
     }
 
     ID3DBlob *blob = nullptr;
-    HRESULT hr = D3DCompile( pData, DataLength, srcName, pDefines, pInclude, "", "fx_5_0", HLSLFlags, FXFlags, &blob, ppErrors );
+    // The runtime flags are not compiler flags
+    HRESULT hr = D3DCompile( pData, DataLength, srcName, pDefines, pInclude, "", "fx_5_0", HLSLFlags,
+                             FXFlags & ~D3DX11_EFFECT_RUNTIME_VALID_FLAGS, &blob, ppErrors );
     if ( FAILED(hr) )
     {
         DPF(0, "D3DCompile of fx_5_0 profile failed: %08X", hr );
@@ -229,7 +231,8 @@ HRESULT D3DX11CompileEffectFromFile( LPCWSTR pFileName,
 
 #if (D3D_COMPILER_VERSION >= 46) && ( !defined(WINAPI_FAMILY) || ( (WINAPI_FAMILY != WINAPI_FAMILY_APP) && (WINAPI_FAMILY != WINAPI_FAMILY_PHONE_APP) ) )
 
-    HRESULT hr = D3DCompileFromFile( pFileName, pDefines, pInclude, "", "fx_5_0", HLSLFlags, FXFlags, &blob, ppErrors );
+    HRESULT hr = D3DCompileFromFile( pFileName, pDefines, pInclude, "", "fx_5_0", HLSLFlags,
+                                     FXFlags & ~D3DX11_EFFECT_RUNTIME_VALID_FLAGS, &blob, ppErrors );
     if ( FAILED(hr) )
     {
         DPF(0, "D3DCompileFromFile of fx_5_0 profile failed %08X: %ls", hr, pFileName );
@@ -266,7 +269,8 @@ HRESULT D3DX11CompileEffectFromFile( LPCWSTR pFileName,
         pstrName++;
     }
 
-    hr = D3DCompile( fileData.get(), size, pstrName, pDefines, pInclude, "", "fx_5_0", HLSLFlags, FXFlags, &blob, ppErrors );
+    hr = D3DCompile( fileData.get(), size, pstrName, pDefines, pInclude, "", "fx_5_0", HLSLFlags,
+                     FXFlags & ~D3DX11_EFFECT_RUNTIME_VALID_FLAGS, &blob, ppErrors );
     if ( FAILED(hr) )
     {
         DPF(0, "D3DCompile of fx_5_0 profile failed: %08X", hr );
@@ -318,3 +322,43 @@ lExit:
     }
     return hr;
 }
+
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+HRESULT WINAPI D3DX11InvalidateEffectStateCache( ID3D11DeviceContext *pContext )
+{
+    if ( !pContext )
+        return E_INVALIDARG;
+
+    CEffectStateCache *pCache = CEffectStateCache::Acquire( pContext, false );
+    if ( pCache )
+    {
+        pCache->Invalidate();
+        pCache->Release();
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT WINAPI D3DX11GetEffectStateCacheStats( ID3D11DeviceContext *pContext, D3DX11_EFFECT_STATE_CACHE_STATS *pStats, bool Reset )
+{
+    if ( !pContext || !pStats )
+        return E_INVALIDARG;
+
+    memset( pStats, 0, sizeof(D3DX11_EFFECT_STATE_CACHE_STATS) );
+
+    CEffectStateCache *pCache = CEffectStateCache::Acquire( pContext, false );
+    if ( pCache )
+    {
+        *pStats = pCache->m_Stats;
+        if ( Reset )
+        {
+            memset( &pCache->m_Stats, 0, sizeof(D3DX11_EFFECT_STATE_CACHE_STATS) );
+        }
+        pCache->Release();
+    }
+
+    return S_OK;
+}
@@ -35,12 +35,14 @@ SDepthStencilView g_NullDepthStencilView;
 // 3) SetSamplers
 // 4) SetShaderResources
 // 5) CreateShader
+// 6) Stage index
 SD3DShaderVTable g_vtPS = {
     (void (__stdcall ID3D11DeviceContext::*)(ID3D11DeviceChild*, ID3D11ClassInstance*const*, uint32_t)) &ID3D11DeviceContext::PSSetShader,
     &ID3D11DeviceContext::PSSetConstantBuffers,
     &ID3D11DeviceContext::PSSetSamplers,
     &ID3D11DeviceContext::PSSetShaderResources,
-    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreatePixelShader
+    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreatePixelShader,
+    4
 };
 
 SD3DShaderVTable g_vtVS = {
@@ -48,7 +50,8 @@ SD3DShaderVTable g_vtVS = {
     &ID3D11DeviceContext::VSSetConstantBuffers,
     &ID3D11DeviceContext::VSSetSamplers,
     &ID3D11DeviceContext::VSSetShaderResources,
-    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateVertexShader
+    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateVertexShader,
+    0
 };
 
 SD3DShaderVTable g_vtGS = {
@@ -56,7 +59,8 @@ SD3DShaderVTable g_vtGS = {
     &ID3D11DeviceContext::GSSetConstantBuffers,
     &ID3D11DeviceContext::GSSetSamplers,
     &ID3D11DeviceContext::GSSetShaderResources,
-    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateGeometryShader
+    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateGeometryShader,
+    3
 };
 
 SD3DShaderVTable g_vtHS = {
@@ -64,7 +68,8 @@ SD3DShaderVTable g_vtHS = {
     &ID3D11DeviceContext::HSSetConstantBuffers,
     &ID3D11DeviceContext::HSSetSamplers,
     &ID3D11DeviceContext::HSSetShaderResources,
-    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateHullShader
+    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateHullShader,
+    1
 };
 
 SD3DShaderVTable g_vtDS = {
@@ -72,7 +77,8 @@ SD3DShaderVTable g_vtDS = {
     &ID3D11DeviceContext::DSSetConstantBuffers,
     &ID3D11DeviceContext::DSSetSamplers,
     &ID3D11DeviceContext::DSSetShaderResources,
-    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateDomainShader
+    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateDomainShader,
+    2
 };
 
 SD3DShaderVTable g_vtCS = {
@@ -80,7 +86,8 @@ SD3DShaderVTable g_vtCS = {
     &ID3D11DeviceContext::CSSetConstantBuffers,
     &ID3D11DeviceContext::CSSetSamplers,
     &ID3D11DeviceContext::CSSetShaderResources,
-    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateComputeShader
+    (HRESULT (__stdcall ID3D11Device::*)(const void *, size_t, ID3D11ClassLinkage*, ID3D11DeviceChild **)) &ID3D11Device::CreateComputeShader,
+    5
 };
 
 SShaderBlock g_NullVS(&g_vtVS);
@@ -932,6 +939,8 @@ HRESULT CEffectLoader::LoadEffect(CEffect *pEffect, const void *pEffectBuffer, u
     VBD( m_pEffect->m_SamplerBlockCount == m_pHeader->cSamplers, "Internal loading error: mismatched sampler count." );
     VBD( m_pEffect->m_StringCount == m_pHeader->cStrings, "Internal loading error: mismatched string count." );
 
+    VH( m_pEffect->BuildNameIndex() );
+
     // Uncomment if you really need this information
     // DPF(0, "Effect heap size: %d, reflection heap size: %d, allocations avoided: %d", m_EffectMemory, m_ReflectionMemory, m_BulkHeap.m_cAllocations);
 
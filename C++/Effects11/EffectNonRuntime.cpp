@@ -718,11 +718,13 @@ CEffect::CEffect( uint32_t Flags ) noexcept :
     m_FXLIndex(0),
     m_pDevice(nullptr),
     m_pContext(nullptr),
+    m_pStateCache(nullptr),
     m_pClassLinkage(nullptr),
     m_pTypePool(nullptr),
     m_pStringPool(nullptr),
     m_pPooledHeap(nullptr),
-    m_pOptimizedTypeHeap(nullptr)
+    m_pOptimizedTypeHeap(nullptr),
+    m_pNameIndex(nullptr)
 {
 }
 
@@ -770,6 +772,7 @@ CEffect::~CEffect()
     }
 
     SAFE_DELETE( m_pReflection );
+    SAFE_DELETE( m_pNameIndex );
     SAFE_DELETE( m_pTypePool );
     SAFE_DELETE( m_pStringPool );
     SAFE_DELETE( m_pPooledHeap );
@@ -1512,6 +1515,11 @@ SGlobalVariable * CEffect::FindLocalVariableByName(_In_z_ LPCSTR pName)
 {
     SGlobalVariable *pVariable, *pVariableEnd;
 
+    if (FindInNameIndex(ENO_Variable, nullptr, pName, (void**) &pVariable))
+    {
+        return pVariable;
+    }
+
     pVariableEnd = m_pVariables + m_VariableCount;
     for (pVariable = m_pVariables; pVariable != pVariableEnd; pVariable++)
     {
@@ -1653,6 +1661,12 @@ uint32_t SType::GetTotalPackedSize(_In_ bool IsSingleElement) const
 SConstantBuffer *CEffect::FindCB(_In_z_ LPCSTR pName)
 {
     uint32_t  i;
+    SConstantBuffer *pCB;
+
+    if (FindInNameIndex(ENO_ConstantBuffer, nullptr, pName, (void**) &pCB))
+    {
+        return pCB;
+    }
 
     for (i=0; i<m_CBCount; i++)
     {
@@ -1665,6 +1679,161 @@ SConstantBuffer *CEffect::FindCB(_In_z_ LPCSTR pName)
     return nullptr;
 }
 
+SGroup * CEffect::FindGroup(_In_z_ LPCSTR pName)
+{
+    SGroup *pGroup;
+
+    if (FindInNameIndex(ENO_Group, nullptr, pName, (void**) &pGroup))
+    {
+        return pGroup;
+    }
+
+    for (uint32_t i = 0; i < m_GroupCount; ++ i)
+    {
+        if (nullptr != m_pGroups[i].pName &&
+            strcmp(m_pGroups[i].pName, pName) == 0)
+        {
+            return &m_pGroups[i];
+        }
+    }
+
+    return nullptr;
+}
+
+STechnique * CEffect::FindTechnique(_In_ SGroup *pGroup, _In_z_ LPCSTR pName)
+{
+    STechnique *pTechnique;
+
+    if (FindInNameIndex(ENO_Technique, pGroup, pName, (void**) &pTechnique))
+    {
+        return pTechnique;
+    }
+
+    for (uint32_t i = 0; i < pGroup->TechniqueCount; ++ i)
+    {
+        if (nullptr != pGroup->pTechniques[i].pName &&
+            strcmp(pGroup->pTechniques[i].pName, pName) == 0)
+        {
+            return &pGroup->pTechniques[i];
+        }
+    }
+
+    return nullptr;
+}
+
+_Use_decl_annotations_
+bool CEffect::FindInNameIndex(ENamedObjectKind Kind, const void *pScope, LPCSTR pName, void **ppObject)
+{
+    CNameHashTable::CIterator iter;
+    SNamedObject key;
+
+    *ppObject = nullptr;
+
+    if (nullptr == m_pNameIndex)
+    {
+        return false;
+    }
+
+    key.Kind = Kind;
+    key.pScope = pScope;
+    key.pName = pName;
+    key.pObject = nullptr;
+
+    if (SUCCEEDED(m_pNameIndex->FindValueWithHash(key, ComputeHash(pName), &iter)))
+    {
+        *ppObject = iter.GetData().pObject;
+    }
+
+    return true;
+}
+
+_Use_decl_annotations_
+HRESULT CEffect::AddToNameIndex(ENamedObjectKind Kind, const void *pScope, LPCSTR pName, void *pObject)
+{
+    HRESULT hr = S_OK;
+    CNameHashTable::CIterator iter;
+    SNamedObject entry;
+    uint32_t hash;
+
+    if (nullptr == pName)
+    {
+        goto lExit;
+    }
+
+    entry.Kind = Kind;
+    entry.pScope = pScope;
+    entry.pName = pName;
+    entry.pObject = pObject;
+    hash = ComputeHash(pName);
+
+    // The linear searches return the first match, so keep the first of any duplicates
+    if (FAILED(m_pNameIndex->FindValueWithHash(entry, hash, &iter)))
+    {
+        VH( m_pNameIndex->AddValueWithHash(entry, hash) );
+    }
+
+lExit:
+    return hr;
+}
+
+// Called once the variables, cbuffers and groups have reached their final
+// location, i.e. at the end of loading and cloning
+HRESULT CEffect::BuildNameIndex()
+{
+    HRESULT hr = S_OK;
+    uint32_t i, j;
+
+    if ((m_Flags & D3DX11_EFFECT_NO_NAME_INDEX) != 0)
+    {
+        // Lookups stay linear searches
+        goto lExit;
+    }
+
+    assert( nullptr == m_pNameIndex );
+    assert( nullptr != m_pPooledHeap );
+    _Analysis_assume_( nullptr != m_pPooledHeap );
+
+    VN( m_pNameIndex = new CNameHashTable );
+    m_pNameIndex->SetPrivateHeap(m_pPooledHeap);
+
+    // Roughly 50% full, like AutoGrow()
+    VH( m_pNameIndex->Grow((m_VariableCount + m_CBCount + m_GroupCount + m_TechniqueCount) * 2 + 1) );
+
+    for (i = 0; i < m_VariableCount; ++ i)
+    {
+        VH( AddToNameIndex(ENO_Variable, nullptr, m_pVariables[i].pName, &m_pVariables[i]) );
+    }
+
+    for (i = 0; i < m_CBCount; ++ i)
+    {
+        VH( AddToNameIndex(ENO_ConstantBuffer, nullptr, m_pCBs[i].pName, &m_pCBs[i]) );
+    }
+
+    for (i = 0; i < m_GroupCount; ++ i)
+    {
+        SGroup *pGroup = &m_pGroups[i];
+
+        VH( AddToNameIndex(ENO_Group, nullptr, pGroup->pName, pGroup) );
+
+        for (j = 0; j < pGroup->TechniqueCount; ++ j)
+        {
+            VH( AddToNameIndex(ENO_Technique, pGroup, pGroup->pTechniques[j].pName, &pGroup->pTechniques[j]) );
+        }
+    }
+
+#ifdef D3DX11_FX_PRINT_HASH_STATS
+    DPF(0, "Name index hash table statistics:");
+    m_pNameIndex->PrintHashTableStats();
+#endif // D3DX11_FX_PRINT_HASH_STATS
+
+lExit:
+    if (FAILED(hr))
+    {
+        SAFE_DELETE(m_pNameIndex);
+    }
+    return hr;
+}
+
 bool CEffect::IsOptimized()
 {
     if ((m_Flags & D3DX11_EFFECT_OPTIMIZED) != 0)
@@ -2170,6 +2339,11 @@ HRESULT CEffect::CloneEffect(_In_ uint32_t Flags, _Outptr_ ID3DX11Effect** ppClo
         VH( pNewEffect->FixupMemberInterface( pMember, this, mappingTableStrings ) );
     }
 
+    if( !IsOptimized() )
+    {
+        VH( pNewEffect->BuildNameIndex() );
+    }
+
 
 lExit:
     SAFE_DELETE( pTempHeap );
@@ -2428,6 +2602,7 @@ HRESULT CEffect::Optimize()
     m_pStringPool->PrintHashTableStats();
 #endif // D3DX11_FX_PRINT_HASH_STATS
 
+    SAFE_DELETE(m_pNameIndex);
     SAFE_DELETE(m_pTypePool);
     SAFE_DELETE(m_pStringPool);
     SAFE_DELETE(m_pPooledHeap);
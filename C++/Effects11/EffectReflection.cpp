@@ -1620,15 +1620,25 @@ ID3DX11EffectVariable * SPassBlock::GetAnnotationByName(_In_z_ LPCSTR Name)
 HRESULT SPassBlock::Apply(_In_ uint32_t Flags, _In_ ID3D11DeviceContext* pContext)
 
 {
-    UNREFERENCED_PARAMETER(Flags);
     HRESULT hr = S_OK;
 
-    // Flags are unused, so should be 0
-
+    // D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE is the only flag
+    bool bSkipRedundantState = (Flags & D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE) != 0;
 
     assert( pEffect->m_pContext == nullptr );
+    assert( pEffect->m_pStateCache == nullptr );
     pEffect->m_pContext = pContext;
+
+    // Even a plain Apply has to keep an existing cache up to date
+    pEffect->m_pStateCache = CEffectStateCache::Acquire(pContext, bSkipRedundantState);
+    if( pEffect->m_pStateCache )
+    {
+        pEffect->m_pStateCache->BeginApply(bSkipRedundantState);
+    }
+
     pEffect->ApplyPassBlock(this);
+
+    SAFE_RELEASE( pEffect->m_pStateCache );
     pEffect->m_pContext = nullptr;
 
     return hr;
@@ -1982,12 +1992,10 @@ ID3DX11EffectConstantBuffer * CEffect::GetConstantBufferByName(_In_z_ LPCSTR Nam
         return &g_InvalidConstantBuffer;
     }
 
-    for (uint32_t i = 0; i < m_CBCount; ++ i)
+    SConstantBuffer *pCB = FindCB(Name);
+    if (nullptr != pCB)
     {
-        if (strcmp(m_pCBs[i].pName, Name) == 0)
-        {
-            return m_pCBs + i;
-        }
+        return pCB;
     }
 
     DPF(0, "%s: Constant Buffer [%s] not found", pFuncName, Name);
@@ -2023,12 +2031,10 @@ ID3DX11EffectVariable * CEffect::GetVariableByName(_In_z_ LPCSTR Name)
         return &g_InvalidScalarVariable;
     }
 
-    for (uint32_t i = 0; i < m_VariableCount; ++ i)
+    SGlobalVariable *pVariable = FindLocalVariableByName(Name);
+    if (nullptr != pVariable)
     {
-        if (strcmp(m_pVariables[i].pName, Name) == 0)
-        {
-            return m_pVariables + i;
-        }
+        return pVariable;
     }
 
     DPF(0, "%s: Variable [%s] not found", pFuncName, Name);
@@ -2110,6 +2116,9 @@ ID3DX11EffectTechnique * CEffect::GetTechniqueByName(_In_z_ LPCSTR Name)
         return &g_InvalidTechnique;
     }
 
+    SGroup *pGroup;
+    LPCSTR pTechniqueName;
+
     char* pDelimiter = strchr( NameCopy, '|' );
     if( pDelimiter == nullptr )
     {
@@ -2119,13 +2128,31 @@ ID3DX11EffectTechnique * CEffect::GetTechniqueByName(_In_z_ LPCSTR Name)
             return &g_InvalidTechnique;
         }
 
-        return m_pNullGroup->GetTechniqueByName( Name );
+        pGroup = m_pNullGroup;
+        pTechniqueName = Name;
     }
+    else
+    {
+        // separate group name and technique name
+        *pDelimiter = 0;
 
-    // separate group name and technique name
-    *pDelimiter = 0;
+        pGroup = NameCopy[0] == 0 ? m_pNullGroup : FindGroup( NameCopy );
+        if( pGroup == nullptr )
+        {
+            DPF(0, "%s: Group [%s] not found", pFuncName, NameCopy);
+            return &g_InvalidTechnique;
+        }
+        pTechniqueName = pDelimiter + 1;
+    }
+
+    STechnique *pTechnique = FindTechnique( pGroup, pTechniqueName );
+    if( pTechnique == nullptr )
+    {
+        DPF(0, "%s: Technique [%s] not found", pFuncName, pTechniqueName);
+        return &g_InvalidTechnique;
+    }
 
-    return GetGroupByName( NameCopy )->GetTechniqueByName( pDelimiter + 1 );
+    return (ID3DX11EffectTechnique *)pTechnique;
 }
 
 ID3D11ClassLinkage * CEffect::GetClassLinkage()
@@ -2161,23 +2188,14 @@ ID3DX11EffectGroup * CEffect::GetGroupByName(_In_z_ LPCSTR Name)
         return m_pNullGroup ? (ID3DX11EffectGroup *)m_pNullGroup : &g_InvalidGroup;
     }
 
-    uint32_t i = 0;
-    for (; i < m_GroupCount; ++ i)
-    {
-        if (nullptr != m_pGroups[i].pName &&
-            strcmp(m_pGroups[i].pName, Name) == 0)
-        {
-            break;
-        }
-    }
-
-    if (i == m_GroupCount)
+    SGroup *pGroup = FindGroup(Name);
+    if (nullptr == pGroup)
     {
         DPF(0, "%s: Group [%s] not found", pFuncName, Name);
         return &g_InvalidGroup;
     }
 
-    return (ID3DX11EffectGroup *)(m_pGroups + i);
+    return (ID3DX11EffectGroup *)pGroup;
 }
 
 }
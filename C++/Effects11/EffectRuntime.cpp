@@ -133,14 +133,217 @@ bool SPassBlock::CheckDependencies()
 #pragma warning(pop)
 
 // Update constant buffer contents if necessary
-inline void CheckAndUpdateCB_FX(ID3D11DeviceContext *pContext, SConstantBuffer *pCB)
+inline void CheckAndUpdateCB_FX(ID3D11DeviceContext *pContext, CEffectStateCache *pStateCache, SConstantBuffer *pCB)
 {
     if (pCB->IsDirty && !pCB->IsNonUpdatable)
     {
         // CB out of date; rebuild it
         pContext->UpdateSubresource(pCB->pD3DObject, 0, nullptr, pCB->pBackingStore, pCB->Size, pCB->Size);
         pCB->IsDirty = false;
+
+        if (pStateCache)
+            ++ pStateCache->m_Stats.CBUpdatesIssued;
+    }
+    else if (pStateCache)
+    {
+        ++ pStateCache->m_Stats.CBUpdatesSkipped;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// CEffectStateCache
+//--------------------------------------------------------------------------------------
+
+volatile long CEffectStateCache::s_LiveCount = 0;
+
+CEffectStateCache::CEffectStateCache() noexcept :
+    m_RefCount(1),
+    m_SkipRedundantState(false)
+{
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    Invalidate();
+    InterlockedIncrement(&s_LiveCount);
+}
+
+CEffectStateCache::~CEffectStateCache()
+{
+    InterlockedDecrement(&s_LiveCount);
+}
+
+_Use_decl_annotations_
+CEffectStateCache *CEffectStateCache::Acquire(ID3D11DeviceContext *pContext, bool Create)
+{
+    // Plain Applies call this too, so don't go near the context's private data
+    // until somebody has asked for a cache
+    if (!Create && 0 == s_LiveCount)
+    {
+        return nullptr;
+    }
+
+    // GetPrivateData AddRef's interfaces stored with SetPrivateDataInterface
+    CEffectStateCache *pCache = nullptr;
+    UINT size = sizeof(pCache);
+    if (SUCCEEDED(pContext->GetPrivateData(GUID_D3DX11EffectStateCache, &size, &pCache)) && pCache)
+    {
+        return pCache;
+    }
+
+    if (!Create)
+    {
+        return nullptr;
+    }
+
+    pCache = new CEffectStateCache;
+    if (pCache && FAILED(pContext->SetPrivateDataInterface(GUID_D3DX11EffectStateCache, pCache)))
+    {
+        // Apply still works without a cache, it just can't skip anything
+        SAFE_RELEASE(pCache);
+    }
+
+    return pCache;
+}
+
+void CEffectStateCache::Invalidate()
+{
+    // Nothing the runtime hands out has this address, and the NaN blend
+    // factors compare unequal to everything
+    memset(&m_State, 0xff, sizeof(m_State));
+}
+
+bool CEffectStateCache::Issue(_In_ bool Changed)
+{
+    if (Changed || !m_SkipRedundantState)
+    {
+        ++ m_Stats.SetsIssued;
+        return true;
+    }
+
+    ++ m_Stats.SetsSkipped;
+    return false;
+}
+
+_Use_decl_annotations_
+bool CEffectStateCache::SetShader(uint32_t Stage, ID3D11DeviceChild *pShader, uint32_t NumClassInstances)
+{
+    assert(Stage < NumStages);
+    SStage *pStage = &m_State.Stages[Stage];
+
+    // Class instances aren't tracked, so never skip these nor let them
+    // make a later bind of the same shader look redundant
+    if (NumClassInstances > 0)
+    {
+        memset(&pStage->pShader, 0xff, sizeof(pStage->pShader));
+        return Issue(true);
+    }
+
+    bool Changed = (pStage->pShader != pShader);
+    pStage->pShader = pShader;
+    return Issue(Changed);
+}
+
+template<typename T, size_t N>
+static bool UpdateRange(_Inout_updates_(N) T *(&ppCached)[N], _In_ uint32_t StartSlot, _In_ uint32_t Count, _In_reads_(Count) T *const *ppObjects)
+{
+    if (StartSlot > N || Count > N - StartSlot)
+    {
+        // The runtime will complain about this call, don't hide it
+        return true;
+    }
+
+    bool Changed = false;
+    for (size_t i = 0; i < Count; ++ i)
+    {
+        if (ppCached[StartSlot + i] != ppObjects[i])
+        {
+            ppCached[StartSlot + i] = ppObjects[i];
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
+
+_Use_decl_annotations_
+bool CEffectStateCache::SetConstantBuffers(uint32_t Stage, uint32_t StartSlot, uint32_t Count, ID3D11Buffer *const *ppBuffers)
+{
+    assert(Stage < NumStages);
+    return Issue(UpdateRange(m_State.Stages[Stage].pConstantBuffers, StartSlot, Count, ppBuffers));
+}
+
+_Use_decl_annotations_
+bool CEffectStateCache::SetSamplers(uint32_t Stage, uint32_t StartSlot, uint32_t Count, ID3D11SamplerState *const *ppSamplers)
+{
+    assert(Stage < NumStages);
+    return Issue(UpdateRange(m_State.Stages[Stage].pSamplers, StartSlot, Count, ppSamplers));
+}
+
+_Use_decl_annotations_
+bool CEffectStateCache::SetBlendState(ID3D11BlendState *pBlendState, const float BlendFactor[4], uint32_t SampleMask)
+{
+    bool Changed = (m_State.pBlendState != pBlendState ||
+                    m_State.SampleMask != SampleMask);
+
+    for (size_t i = 0; i < 4; ++ i)
+    {
+        Changed |= (m_State.BlendFactor[i] != BlendFactor[i]);
+        m_State.BlendFactor[i] = BlendFactor[i];
+    }
+    m_State.pBlendState = pBlendState;
+    m_State.SampleMask = SampleMask;
+
+    return Issue(Changed);
+}
+
+_Use_decl_annotations_
+bool CEffectStateCache::SetDepthStencilState(ID3D11DepthStencilState *pDepthStencilState, uint32_t StencilRef)
+{
+    bool Changed = (m_State.pDepthStencilState != pDepthStencilState ||
+                    m_State.StencilRef != StencilRef);
+
+    m_State.pDepthStencilState = pDepthStencilState;
+    m_State.StencilRef = StencilRef;
+
+    return Issue(Changed);
+}
+
+_Use_decl_annotations_
+bool CEffectStateCache::SetRasterizerState(ID3D11RasterizerState *pRasterizerState)
+{
+    bool Changed = (m_State.pRasterizerState != pRasterizerState);
+    m_State.pRasterizerState = pRasterizerState;
+    return Issue(Changed);
+}
+
+HRESULT CEffectStateCache::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+    if( !ppv )
+        return E_INVALIDARG;
+
+    *ppv = nullptr;
+    if(IsEqualIID(iid, IID_IUnknown))
+    {
+        *ppv = (IUnknown *) this;
+        AddRef();
+        return S_OK;
+    }
+
+    return E_NOINTERFACE;
+}
+
+ULONG CEffectStateCache::AddRef()
+{
+    return InterlockedIncrement(&m_RefCount);
+}
+
+ULONG CEffectStateCache::Release()
+{
+    ULONG RefCount = InterlockedDecrement(&m_RefCount);
+    if (0 == RefCount)
+    {
+        delete this;
     }
+    return RefCount;
 }
 
 
@@ -151,6 +354,7 @@ inline void CheckAndUpdateCB_FX(ID3D11DeviceContext *pContext, SConstantBuffer *
 void CEffect::ApplyShaderBlock(_In_ SShaderBlock *pBlock)
 {
     SD3DShaderVTable *pVT = pBlock->pVT;
+    CEffectStateCache *pCache = m_pStateCache;
 
     // Apply constant buffers first (tbuffers are done later)
     SShaderCBDependency *pCBDep = pBlock->pCBDeps;
@@ -162,10 +366,11 @@ void CEffect::ApplyShaderBlock(_In_ SShaderBlock *pBlock)
 
         for (size_t i = 0; i < pCBDep->Count; ++ i)
         {
-            CheckAndUpdateCB_FX(m_pContext, (SConstantBuffer*)pCBDep->ppFXPointers[i]);
+            CheckAndUpdateCB_FX(m_pContext, pCache, (SConstantBuffer*)pCBDep->ppFXPointers[i]);
         }
 
-        (m_pContext->*(pVT->pSetConstantBuffers))(pCBDep->StartIndex, pCBDep->Count, pCBDep->ppD3DObjects);
+        if (!pCache || pCache->SetConstantBuffers(pVT->Stage, pCBDep->StartIndex, pCBDep->Count, pCBDep->ppD3DObjects))
+            (m_pContext->*(pVT->pSetConstantBuffers))(pCBDep->StartIndex, pCBDep->Count, pCBDep->ppD3DObjects);
     }
 
     // Next, apply samplers
@@ -184,7 +389,9 @@ void CEffect::ApplyShaderBlock(_In_ SShaderBlock *pBlock)
                 pSampDep->ppD3DObjects[i] = pSampDep->ppFXPointers[i]->pD3DObject;
             }
         }
-        (m_pContext->*(pVT->pSetSamplers))(pSampDep->StartIndex, pSampDep->Count, pSampDep->ppD3DObjects);
+
+        if (!pCache || pCache->SetSamplers(pVT->Stage, pSampDep->StartIndex, pSampDep->Count, pSampDep->ppD3DObjects))
+            (m_pContext->*(pVT->pSetSamplers))(pSampDep->StartIndex, pSampDep->Count, pSampDep->ppD3DObjects);
     }
 
     // Set the UAVs
@@ -221,7 +428,7 @@ void CEffect::ApplyShaderBlock(_In_ SShaderBlock *pBlock)
 
     for (; ppTB<ppLastTB; ppTB++)
     {
-        CheckAndUpdateCB_FX(m_pContext, (SConstantBuffer*)*ppTB);
+        CheckAndUpdateCB_FX(m_pContext, pCache, (SConstantBuffer*)*ppTB);
     }
 
     // Set the textures
@@ -271,7 +478,8 @@ void CEffect::ApplyShaderBlock(_In_ SShaderBlock *pBlock)
     }
 
     // Now set the shader
-    (m_pContext->*(pVT->pSetShader))(pBlock->pD3DObject, ppClassInstances, Interfaces);
+    if (!pCache || pCache->SetShader(pVT->Stage, pBlock->pD3DObject, Interfaces))
+        (m_pContext->*(pVT->pSetShader))(pBlock->pD3DObject, ppClassInstances, Interfaces);
 }
 
 // Returns true if the block D3D data was recreated
@@ -536,9 +744,10 @@ void CEffect::ApplyPassBlock(_Inout_ SPassBlock *pBlock)
             DPF( 0, "Pass::Apply - warning: applying invalid BlendState." );
 #endif
         pBlock->BackingStore.pBlendState = pBlock->BackingStore.pBlendBlock->pBlendObject;
-        m_pContext->OMSetBlendState(pBlock->BackingStore.pBlendState,
-            pBlock->BackingStore.BlendFactor,
-            pBlock->BackingStore.SampleMask);
+        if (!m_pStateCache || m_pStateCache->SetBlendState(pBlock->BackingStore.pBlendState, pBlock->BackingStore.BlendFactor, pBlock->BackingStore.SampleMask))
+            m_pContext->OMSetBlendState(pBlock->BackingStore.pBlendState,
+                pBlock->BackingStore.BlendFactor,
+                pBlock->BackingStore.SampleMask);
     }
 
     if (nullptr != pBlock->BackingStore.pDepthStencilBlock)
@@ -549,8 +758,9 @@ void CEffect::ApplyPassBlock(_Inout_ SPassBlock *pBlock)
             DPF( 0, "Pass::Apply - warning: applying invalid DepthStencilState." );
 #endif
         pBlock->BackingStore.pDepthStencilState = pBlock->BackingStore.pDepthStencilBlock->pDSObject;
-        m_pContext->OMSetDepthStencilState(pBlock->BackingStore.pDepthStencilState,
-            pBlock->BackingStore.StencilRef);
+        if (!m_pStateCache || m_pStateCache->SetDepthStencilState(pBlock->BackingStore.pDepthStencilState, pBlock->BackingStore.StencilRef))
+            m_pContext->OMSetDepthStencilState(pBlock->BackingStore.pDepthStencilState,
+                pBlock->BackingStore.StencilRef);
     }
 
     if (nullptr != pBlock->BackingStore.pRasterizerBlock)
@@ -560,7 +770,8 @@ void CEffect::ApplyPassBlock(_Inout_ SPassBlock *pBlock)
         if( !pBlock->BackingStore.pRasterizerBlock->IsValid )
             DPF( 0, "Pass::Apply - warning: applying invalid RasterizerState." );
 #endif
-        m_pContext->RSSetState(pBlock->BackingStore.pRasterizerBlock->pRasterizerObject);
+        if (!m_pStateCache || m_pStateCache->SetRasterizerState(pBlock->BackingStore.pRasterizerBlock->pRasterizerObject))
+            m_pContext->RSSetState(pBlock->BackingStore.pRasterizerBlock->pRasterizerObject);
     }
 
     if (nullptr != pBlock->BackingStore.pRenderTargetViews[0])
@@ -106,7 +106,11 @@ struct D3DX11_STATE_BLOCK_MASK
 // These flags are passed in when creating an effect, and affect
 // the runtime effect behavior:
 //
-// (Currently none)
+// D3DX11_EFFECT_NO_NAME_INDEX
+//   Don't build the hashed name index. The Get*ByName functions fall
+//   back to a linear search over the names. This saves the index memory
+//   for effects that are only ever looked up a handful of times, and is
+//   used to measure what the index buys.
 //
 //
 // These flags are set by the effect runtime:
@@ -124,11 +128,12 @@ struct D3DX11_STATE_BLOCK_MASK
 //
 //----------------------------------------------------------------------------
 
+#define D3DX11_EFFECT_NO_NAME_INDEX                     (1 << 20)
 #define D3DX11_EFFECT_OPTIMIZED                         (1 << 21)
 #define D3DX11_EFFECT_CLONE                             (1 << 22)
 
 // Mask of valid D3DCOMPILE_EFFECT flags for D3DX11CreateEffect*
-#define D3DX11_EFFECT_RUNTIME_VALID_FLAGS (0)
+#define D3DX11_EFFECT_RUNTIME_VALID_FLAGS (D3DX11_EFFECT_NO_NAME_INDEX)
 
 //----------------------------------------------------------------------------
 // D3DX11_EFFECT_VARIABLE flags:
@@ -163,6 +168,39 @@ struct D3DX11_STATE_BLOCK_MASK
 
 #define D3DX11_EFFECT_CLONE_FORCE_NONSINGLE        	    (1 << 0)
 
+//----------------------------------------------------------------------------
+// D3DX11_EFFECT_APPLY flags:
+// ----------------------------
+//
+// These flags are passed into ID3DX11EffectPass::Apply.
+//
+// D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE
+//   Don't set shaders, constant buffers, samplers and blend, depth-stencil
+//   and rasterizer states that an earlier Apply already set on the same
+//   context. The runtime tracks what Apply binds on each context, but it
+//   can't see state set on the context directly; call
+//   D3DX11InvalidateEffectStateCache after doing so, after ClearState, and
+//   after FinishCommandList on a deferred context.
+//----------------------------------------------------------------------------
+
+#define D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE       (1 << 0)
+
+//----------------------------------------------------------------------------
+// D3DX11_EFFECT_STATE_CACHE_STATS:
+//
+// Retrieved by D3DX11GetEffectStateCacheStats(). Calls are only counted on
+// contexts that have been passed to Apply with
+// D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE.
+//----------------------------------------------------------------------------
+
+struct D3DX11_EFFECT_STATE_CACHE_STATS
+{
+    uint32_t SetsIssued;            // Shader, constant buffer, sampler and state calls made
+    uint32_t SetsSkipped;           // Calls skipped because the context already had the state
+    uint32_t CBUpdatesIssued;       // Constant buffers uploaded because their variables changed
+    uint32_t CBUpdatesSkipped;      // Constant buffers bound without changes since their last upload
+};
+
 
 //////////////////////////////////////////////////////////////////////////////
 // ID3DX11EffectType //////////////////////////////////////////////////////////
@@ -1190,6 +1228,50 @@ HRESULT D3DX11CompileEffectFromFile( _In_z_ LPCWSTR pFileName,
                                      _Out_ ID3DX11Effect **ppEffect,
                                      _Outptr_opt_result_maybenull_ ID3DBlob **ppErrors );
 
+//----------------------------------------------------------------------------
+// D3DX11InvalidateEffectStateCache
+//
+// Makes the next Apply on the context set all of its state, for use with
+// D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE after the context's state was
+// changed outside of the effect runtime
+//
+// Parameters:
+//
+// [in]
+//
+//  pContext
+//      Device context whose state was changed
+//
+//----------------------------------------------------------------------------
+
+HRESULT WINAPI D3DX11InvalidateEffectStateCache( _In_ ID3D11DeviceContext *pContext );
+
+//----------------------------------------------------------------------------
+// D3DX11GetEffectStateCacheStats
+//
+// Returns how many calls Apply made and skipped on the context
+//
+// Parameters:
+//
+// [in]
+//
+//  pContext
+//      Device context to get the counters for
+//  Reset
+//      Clear the counters after reading them
+//
+// [out]
+//
+//  pStats
+//      The counters, zeroes if the context has never been used with
+//      D3DX11_EFFECT_APPLY_SKIP_REDUNDANT_STATE
+//
+//----------------------------------------------------------------------------
+
+HRESULT WINAPI D3DX11GetEffectStateCacheStats( _In_ ID3D11DeviceContext *pContext,
+                                               _Out_ D3DX11_EFFECT_STATE_CACHE_STATS *pStats,
+                                               _In_ bool Reset );
+
 
 //----------------------------------------------------------------------------
 // D3DX11DebugMute
@@ -0,0 +1,390 @@
+//--------------------------------------------------------------------------------------
+// File: MockStreaming.cpp
+//
+// A stdio file and a pretend voice for StreamingEngine, so the scheduling and block
+// slicing can be run and checked without XAudio2 (or Windows)
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+
+#include "MockStreaming.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace
+{
+    const uint64_t c_fnvOffset = 14695981039346656037ULL;
+    const uint64_t c_fnvPrime = 1099511628211ULL;
+
+    const uint32_t c_passMilliseconds = 10;
+
+    inline uint64_t HashBytes( uint64_t hash, const uint8_t* pData, size_t bytes )
+    {
+        for( size_t j = 0; j < bytes; ++j )
+        {
+            hash ^= pData[ j ];
+            hash *= c_fnvPrime;
+        }
+        return hash;
+    }
+
+    inline int SeekFile( FILE* pFile, uint64_t offset )
+    {
+#ifdef _WIN32
+        return _fseeki64( pFile, static_cast<long long>( offset ), SEEK_SET );
+#else
+        return fseeko( pFile, static_cast<off_t>( offset ), SEEK_SET );
+#endif
+    }
+
+    //----------------------------------------------------------------------------------
+    // Hashes the bytes a stream should play when started at byte start of the wave, the
+    // loop region rounded to blocks the same way the engine does.  Returns the number of
+    // bytes hashed, which is short of bytes if the stream ends first.
+    //----------------------------------------------------------------------------------
+    uint64_t HashExpected( FILE* pReference, const MockStreamDesc& desc, uint32_t start, uint64_t bytes, uint64_t* pHash )
+    {
+        const StreamingWave& wave = desc.wave;
+        uint32_t length = wave.lengthBytes - ( wave.lengthBytes % wave.blockAlign );
+        uint64_t loopEndSample = wave.loopLength ? uint64_t( wave.loopStart ) + wave.loopLength
+                                                 : uint64_t( length / wave.blockAlign ) * wave.samplesPerBlock;
+        uint32_t loopBegin = static_cast<uint32_t>( std::min<uint64_t>( length, ( wave.loopStart / wave.samplesPerBlock ) * uint64_t( wave.blockAlign ) ) );
+        uint32_t loopEnd = static_cast<uint32_t>( std::min<uint64_t>( length, ( loopEndSample / wave.samplesPerBlock ) * wave.blockAlign ) );
+        uint32_t loopsLeft = ( loopBegin < loopEnd ) ? desc.loopCount : 0;
+
+        uint32_t position = std::min( start, length );
+        if( position == loopEnd && loopsLeft )
+        {
+            position = loopBegin;
+            if( loopsLeft != STREAMING_LOOP_INFINITE )
+                loopsLeft--;
+        }
+
+        uint8_t chunk[ 4096 ];
+        uint64_t hash = *pHash;
+        uint64_t done = 0;
+
+        while( done < bytes )
+        {
+            bool looping = loopsLeft && position < loopEnd;
+            uint32_t end = looping ? loopEnd : length;
+
+            uint32_t count = static_cast<uint32_t>( std::min<uint64_t>( { uint64_t( end - position ), bytes - done, sizeof( chunk ) } ) );
+            if( count )
+            {
+                if( SeekFile( pReference, wave.offsetBytes + position ) != 0
+                    || fread( chunk, 1, count, pReference ) != count )
+                    break;
+
+                hash = HashBytes( hash, chunk, count );
+                position += count;
+                done += count;
+            }
+
+            if( position == end )
+            {
+                if( !looping )
+                    break;
+
+                position = loopBegin;
+                if( loopsLeft != STREAMING_LOOP_INFINITE )
+                    loopsLeft--;
+            }
+        }
+
+        *pHash = hash;
+        return done;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// StdioStreamingFile
+//--------------------------------------------------------------------------------------
+StdioStreamingFile::StdioStreamingFile( FILE* pFile, uint32_t alignment ) noexcept :
+    m_pFile( pFile ),
+    m_alignment( std::max<uint32_t>( 1, alignment ) ),
+    m_misalignedReads( 0 )
+{
+}
+
+
+uint32_t StdioStreamingFile::GetAlignment() const
+{
+    return m_alignment;
+}
+
+
+bool StdioStreamingFile::Read( uint64_t offset, uint32_t size, void* pDest, uint32_t* pBytesRead )
+{
+    *pBytesRead = 0;
+
+    if( ( offset % m_alignment ) || ( size % m_alignment ) || ( reinterpret_cast<uintptr_t>( pDest ) % m_alignment ) )
+    {
+        // Unbuffered I/O would have failed this read
+        m_misalignedReads++;
+        return false;
+    }
+
+    if( SeekFile( m_pFile, offset ) != 0 )
+        return false;
+
+    size_t bytes = fread( pDest, 1, size, m_pFile );
+    if( bytes < size && ferror( m_pFile ) )
+        return false;
+
+    *pBytesRead = static_cast<uint32_t>( bytes );
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// MockStreamingVoice
+//--------------------------------------------------------------------------------------
+MockStreamingVoice::MockStreamingVoice( FILE* pOutput ) :
+    m_pOutput( pOutput ),
+    m_started( false ),
+    m_ended( false ),
+    m_underruns( 0 ),
+    m_maxQueued( 0 )
+{
+    m_segments.push_back( Segment{ 0, c_fnvOffset } );
+}
+
+
+bool MockStreamingVoice::Submit( const uint8_t* pData, uint32_t bytes, bool endOfStream, void* pContext )
+{
+    if( !pData || !bytes )
+        return false;
+
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    m_queue.push_back( QueuedBuffer{ pData, bytes, 0, endOfStream, pContext } );
+    m_maxQueued = std::max<uint32_t>( m_maxQueued, static_cast<uint32_t>( m_queue.size() ) );
+    m_ended = false;
+    return true;
+}
+
+
+void MockStreamingVoice::Start()
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    m_started = true;
+}
+
+
+void MockStreamingVoice::Stop()
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    m_started = false;
+}
+
+
+void MockStreamingVoice::Flush()
+{
+    std::vector<void*> finished;
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+
+        for( auto& it : m_queue )
+            finished.push_back( it.pContext );
+        m_queue.clear();
+
+        m_segments.push_back( Segment{ 0, c_fnvOffset } );
+    }
+
+    for( auto pContext : finished )
+        StreamingEngine::OnBufferEnd( pContext );
+}
+
+
+uint32_t MockStreamingVoice::Render( uint32_t bytes )
+{
+    std::vector<void*> finished;
+    uint32_t played = 0;
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+
+        if( !m_started )
+            return 0;
+
+        Segment& segment = m_segments.back();
+
+        while( played < bytes && !m_queue.empty() )
+        {
+            QueuedBuffer& buffer = m_queue.front();
+
+            uint32_t count = std::min( bytes - played, buffer.bytes - buffer.played );
+            const uint8_t* pData = buffer.pData + buffer.played;
+
+            segment.hash = HashBytes( segment.hash, pData, count );
+            segment.bytes += count;
+            if( m_pOutput )
+                fwrite( pData, 1, count, m_pOutput );
+
+            buffer.played += count;
+            played += count;
+
+            if( buffer.played == buffer.bytes )
+            {
+                if( buffer.endOfStream )
+                    m_ended = true;
+
+                finished.push_back( buffer.pContext );
+                m_queue.pop_front();
+            }
+        }
+
+        if( played < bytes && !m_ended )
+            m_underruns++;
+    }
+
+    // Like XAudio2, hand the buffers back outside of the voice's own lock
+    for( auto pContext : finished )
+        StreamingEngine::OnBufferEnd( pContext );
+
+    return played;
+}
+
+
+bool MockStreamingVoice::HasEnded() const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_ended;
+}
+
+
+uint32_t MockStreamingVoice::GetUnderruns() const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_underruns;
+}
+
+
+uint32_t MockStreamingVoice::GetMaxQueued() const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_maxQueued;
+}
+
+
+std::vector<MockStreamingVoice::Segment> MockStreamingVoice::GetSegments() const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_segments;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The first segment a voice plays starts at the top of the wave, and the one after a
+// seek at the seek point (rounded down to its block).  RemoveStream flushes the voice,
+// which leaves one more, empty, segment at the end.
+//--------------------------------------------------------------------------------------
+bool RunMockStreaming( IStreamingFile* pFile, FILE* pReference, const StreamingEngine::Settings& settings,
+                       const MockStreamDesc* pStreams, size_t count, uint32_t milliseconds, uint32_t speedup,
+                       MockStreamResult* pResults )
+{
+    if( !pFile || !pReference || !pStreams || !pResults || !speedup )
+        return false;
+
+    std::vector<std::unique_ptr<MockStreamingVoice>> voices;
+    std::vector<int> ids;
+    std::vector<double> carry( count, 0.0 );
+
+    std::unique_ptr<StreamingEngine> engine( new StreamingEngine( pFile, settings ) );
+
+    for( size_t j = 0; j < count; ++j )
+    {
+        voices.emplace_back( new MockStreamingVoice );
+
+        int id = engine->AddStream( voices[ j ].get(), pStreams[ j ].wave, pStreams[ j ].loopCount );
+        if( id < 0 )
+            return false;
+
+        ids.push_back( id );
+        engine->Play( id );
+    }
+
+    auto passTime = std::chrono::microseconds( c_passMilliseconds * 1000 / speedup );
+    auto next = std::chrono::steady_clock::now();
+
+    for( uint32_t time = c_passMilliseconds; time <= milliseconds; time += c_passMilliseconds )
+    {
+        next += passTime;
+        std::this_thread::sleep_until( next );
+
+        for( size_t j = 0; j < count; ++j )
+        {
+            const StreamingWave& wave = pStreams[ j ].wave;
+
+            if( pStreams[ j ].seekTime && pStreams[ j ].seekTime == time )
+                engine->Seek( ids[ j ], pStreams[ j ].seekSample );
+
+            double bytes = double( wave.sampleRate ) * wave.blockAlign / wave.samplesPerBlock
+                           * c_passMilliseconds / 1000.0 + carry[ j ];
+            carry[ j ] = bytes - double( uint32_t( bytes ) );
+            voices[ j ]->Render( uint32_t( bytes ) );
+        }
+    }
+
+    bool passed = true;
+
+    for( size_t j = 0; j < count; ++j )
+    {
+        MockStreamResult& result = pResults[ j ];
+
+        engine->GetStats( ids[ j ], &result.stats );
+        engine->RemoveStream( ids[ j ] );
+
+        MockStreamingVoice* pVoice = voices[ j ].get();
+        std::vector<MockStreamingVoice::Segment> segments = pVoice->GetSegments();
+
+        result.bytesPlayed = 0;
+        result.underruns = pVoice->GetUnderruns();
+        result.maxQueued = pVoice->GetMaxQueued();
+        result.ended = pVoice->HasEnded();
+        result.matches = true;
+
+        const MockStreamDesc& desc = pStreams[ j ];
+        uint32_t seekByte = static_cast<uint32_t>( std::min<uint64_t>( desc.wave.lengthBytes,
+                                                                       uint64_t( desc.seekSample / desc.wave.samplesPerBlock ) * desc.wave.blockAlign ) );
+        size_t played = ( desc.seekTime && desc.seekTime <= milliseconds ) ? 2 : 1;
+
+        for( size_t k = 0; k < segments.size(); ++k )
+        {
+            result.bytesPlayed += segments[ k ].bytes;
+
+            if( k >= played )
+            {
+                if( segments[ k ].bytes )
+                    result.matches = false;
+                continue;
+            }
+
+            uint32_t start = k ? seekByte : 0;
+            uint64_t hash = c_fnvOffset;
+            if( HashExpected( pReference, desc, start, segments[ k ].bytes, &hash ) != segments[ k ].bytes
+                || hash != segments[ k ].hash )
+                result.matches = false;
+
+            // An ended stream must have played all of it
+            if( result.ended && k + 1 == played )
+            {
+                uint64_t total = c_fnvOffset;
+                if( HashExpected( pReference, desc, start, UINT64_MAX, &total ) != segments[ k ].bytes )
+                    result.matches = false;
+            }
+        }
+
+        if( !result.matches || result.underruns || result.stats.underruns
+            || result.stats.maxBuffersInUse > settings.buffersPerVoice
+            || result.maxQueued > settings.buffersPerVoice )
+            passed = false;
+    }
+
+    return passed;
+}
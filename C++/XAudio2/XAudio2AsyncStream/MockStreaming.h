@@ -0,0 +1,119 @@
+//--------------------------------------------------------------------------------------
+// File: MockStreaming.h
+//
+// A stdio file and a pretend voice for StreamingEngine, so the scheduling and block
+// slicing can be run and checked without XAudio2 (or Windows).  MockStreamingTest.cpp
+// drives them from the CMakeLists.txt in this directory.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "StreamingEngine.h"
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+
+//--------------------------------------------------------------------------------------
+// Reads with fread, but holds the engine to the same alignment rules as unbuffered I/O
+//--------------------------------------------------------------------------------------
+class StdioStreamingFile : public IStreamingFile
+{
+public:
+    StdioStreamingFile( FILE* pFile, uint32_t alignment ) noexcept;
+
+    uint32_t GetAlignment() const override;
+    bool Read( uint64_t offset, uint32_t size, void* pDest, uint32_t* pBytesRead ) override;
+
+    uint32_t GetMisalignedReads() const noexcept { return m_misalignedReads; }
+
+private:
+    FILE*                   m_pFile;
+    uint32_t                m_alignment;
+    std::atomic<uint32_t>   m_misalignedReads;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Plays its queue when Render is called, the way an audio engine's processing pass
+// would, and hands finished buffers back to the engine.  What it plays is appended to
+// the output file, if there is one, and hashed; a Flush starts a new segment.
+//--------------------------------------------------------------------------------------
+class MockStreamingVoice : public IStreamingVoice
+{
+public:
+    struct Segment
+    {
+        uint64_t    bytes;
+        uint64_t    hash;           // FNV-1a of the bytes played
+    };
+
+    explicit MockStreamingVoice( FILE* pOutput = nullptr );
+
+    bool Submit( const uint8_t* pData, uint32_t bytes, bool endOfStream, void* pContext ) override;
+    void Start() override;
+    void Stop() override;
+    void Flush() override;
+
+    // Plays up to bytes of queued audio and returns how much was played
+    uint32_t Render( uint32_t bytes );
+
+    bool HasEnded() const;
+    uint32_t GetUnderruns() const;
+    uint32_t GetMaxQueued() const;
+    std::vector<Segment> GetSegments() const;
+
+private:
+    struct QueuedBuffer
+    {
+        const uint8_t*  pData;
+        uint32_t        bytes;
+        uint32_t        played;
+        bool            endOfStream;
+        void*           pContext;
+    };
+
+    mutable std::mutex          m_lock;
+    std::deque<QueuedBuffer>    m_queue;
+    std::vector<Segment>        m_segments;
+    FILE*                       m_pOutput;
+    bool                        m_started;
+    bool                        m_ended;
+    uint32_t                    m_underruns;
+    uint32_t                    m_maxQueued;
+};
+
+
+//--------------------------------------------------------------------------------------
+// RunMockStreaming plays every stream at once on mock voices, and checks what each one
+// played against the wave read straight out of pReference
+//--------------------------------------------------------------------------------------
+struct MockStreamDesc
+{
+    StreamingWave   wave;
+    uint32_t        loopCount;
+    uint32_t        seekTime;       // milliseconds into the run, zero to never seek
+    uint32_t        seekSample;
+};
+
+struct MockStreamResult
+{
+    StreamingStats  stats;
+    uint64_t        bytesPlayed;
+    uint32_t        underruns;      // passes where the voice had nothing to play
+    uint32_t        maxQueued;
+    bool            ended;
+    bool            matches;        // played exactly the expected bytes, in order
+};
+
+// Runs for milliseconds of audio in 10 ms passes, speedup times faster than real time.
+// Returns true if every stream matched, never ran dry and stayed within its buffers.
+bool RunMockStreaming( IStreamingFile* pFile, FILE* pReference, const StreamingEngine::Settings& settings,
+                       const MockStreamDesc* pStreams, size_t count, uint32_t milliseconds, uint32_t speedup,
+                       MockStreamResult* pResults );
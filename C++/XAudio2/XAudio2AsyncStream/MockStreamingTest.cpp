@@ -0,0 +1,282 @@
+//--------------------------------------------------------------------------------------
+// File: MockStreamingTest.cpp
+//
+// Runs StreamingEngine against mock voices without XAudio2 (or Windows).  A bank of PCM
+// and ADPCM waves is generated, then streamed with looping and seeking under several
+// buffer settings, and everything played is checked against the file.
+//
+//    MockStreamingTest [-speedup <n>] [<scratch file>]
+//
+// Built by the CMakeLists.txt next to it; ctest runs it.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+
+#include "MockStreaming.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+//--------------------------------------------------------------------------------------
+// Simulated length and default speed of each run
+#define MOCK_MILLISECONDS 4000
+#define MOCK_SPEEDUP 8
+
+
+namespace
+{
+    const char* c_defaultFileName = "MockStreamingTest.bin";
+
+    struct WaveDesc
+    {
+        const char* name;
+        bool        adpcm;
+        uint32_t    channels;
+        uint32_t    sampleRate;
+        uint32_t    milliseconds;
+        uint32_t    extraBytes;     // partial block left at the end of the wave
+        uint32_t    loopCount;
+        uint32_t    loopStart;      // in 1/1000ths of the wave, zero length loops it all
+        uint32_t    loopLength;
+        uint32_t    seekTime;       // run milliseconds, a multiple of 10
+        uint32_t    seekPoint;      // in 1/1000ths of the wave
+    };
+
+    // Loop counts cover play once, a finite number of loops and looping forever; the
+    // seeks land both inside and past the loop regions
+    const WaveDesc c_waves[] =
+    {
+        { "pcm 16-bit stereo, once",                false, 2, 44100, 1500,   0,                       0,   0,   0,    0,   0 },
+        { "pcm 16-bit mono, loop region forever",   false, 1, 22050, 1200,   0, STREAMING_LOOP_INFINITE, 250, 500,    0,   0 },
+        { "pcm 16-bit stereo, seek",                false, 2, 48000, 2500,   0,                       0,   0,   0,  500, 600 },
+        { "adpcm mono, whole wave twice",           true,  1, 22050,  900,   0,                       2,   0,   0,    0,   0 },
+        { "adpcm stereo, loop region and seek",     true,  2, 44100, 1800,   0,                       3, 100, 300,  700, 250 },
+        { "adpcm mono, partial last block",         true,  1, 11025, 1300, 100,                       0,   0,   0,    0,   0 },
+        { "adpcm stereo, seek past loop forever",   true,  2, 22050, 1600,   0, STREAMING_LOOP_INFINITE, 200, 200, 1000, 900 },
+        { "pcm 16-bit mono, short tail loop",       false, 1, 44100,  400,   0,                       4, 900,  95,    0,   0 },
+    };
+
+    const uint32_t c_adpcmSamplesPerBlock = 512;
+
+    // Same layout as XWBTool's AdpcmBlockAlign: a 7 byte header per channel holding the
+    // first two samples, then a nibble for each of the other samples
+    uint32_t AdpcmBlockAlign( uint32_t channels )
+    {
+        return ( 7 + ( c_adpcmSamplesPerBlock - 2 ) / 2 ) * channels;
+    }
+
+    inline uint32_t NextRandom( uint32_t& seed )
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    }
+
+    //----------------------------------------------------------------------------------
+    // PCM waves are a sine per channel.  The engine never decodes ADPCM, so those waves
+    // are noise nibbles behind well formed block headers; what matters is that every
+    // block differs, so a block played out of order changes the hash.
+    //----------------------------------------------------------------------------------
+    std::vector<uint8_t> MakeWave( const WaveDesc& desc, uint32_t index, StreamingWave& wave )
+    {
+        uint32_t frames = static_cast<uint32_t>( uint64_t( desc.sampleRate ) * desc.milliseconds / 1000 );
+
+        memset( &wave, 0, sizeof( wave ) );
+        wave.sampleRate = desc.sampleRate;
+
+        std::vector<uint8_t> data;
+        if( desc.adpcm )
+        {
+            wave.blockAlign = AdpcmBlockAlign( desc.channels );
+            wave.samplesPerBlock = c_adpcmSamplesPerBlock;
+
+            uint32_t blocks = ( frames + c_adpcmSamplesPerBlock - 1 ) / c_adpcmSamplesPerBlock;
+            data.resize( size_t( blocks ) * wave.blockAlign );
+
+            uint32_t seed = 0x9E3779B9u * ( index + 1 );
+            for( uint32_t b = 0; b < blocks; ++b )
+            {
+                uint8_t* pBlock = data.data() + size_t( b ) * wave.blockAlign;
+                for( uint32_t ch = 0; ch < desc.channels; ++ch )
+                {
+                    pBlock[ ch ] = static_cast<uint8_t>( NextRandom( seed ) % 7 );        // predictor
+                    uint16_t delta = static_cast<uint16_t>( 16 + NextRandom( seed ) % 1024 );
+                    memcpy( pBlock + desc.channels + ch * 2, &delta, sizeof( delta ) );
+                }
+                for( uint32_t j = 3 * desc.channels; j < wave.blockAlign; ++j )
+                    pBlock[ j ] = static_cast<uint8_t>( NextRandom( seed ) );
+            }
+        }
+        else
+        {
+            wave.blockAlign = 2 * desc.channels;
+            wave.samplesPerBlock = 1;
+
+            data.resize( size_t( frames ) * wave.blockAlign );
+            int16_t* pSamples = reinterpret_cast<int16_t*>( data.data() );
+            for( uint32_t i = 0; i < frames; ++i )
+            {
+                for( uint32_t ch = 0; ch < desc.channels; ++ch )
+                {
+                    double hz = 220.0 * ( index + 1 ) + 110.0 * ch;
+                    *pSamples++ = static_cast<int16_t>( 12000.0 * sin( 6.283185307179586 * hz * i / desc.sampleRate ) );
+                }
+            }
+        }
+
+        // A trailing partial block the engine must never submit
+        for( uint32_t j = 0; j < desc.extraBytes % wave.blockAlign; ++j )
+            data.push_back( 0xCD );
+
+        wave.lengthBytes = static_cast<uint32_t>( data.size() );
+
+        uint32_t samples = ( wave.lengthBytes / wave.blockAlign ) * wave.samplesPerBlock;
+        wave.loopStart = static_cast<uint32_t>( uint64_t( samples ) * desc.loopStart / 1000 );
+        wave.loopLength = static_cast<uint32_t>( uint64_t( samples ) * desc.loopLength / 1000 );
+        return data;
+    }
+
+    //----------------------------------------------------------------------------------
+    // Writes every wave at an aligned offset, the way xwbtool lays out a streaming bank
+    //----------------------------------------------------------------------------------
+    bool WriteBank( const char* szFileName, uint32_t alignment, std::vector<MockStreamDesc>& streams )
+    {
+        FILE* pFile = fopen( szFileName, "wb" );
+        if( !pFile )
+            return false;
+
+        // The first sector stands in for the bank header
+        std::vector<uint8_t> padding( alignment, 0 );
+        bool ok = fwrite( padding.data(), 1, alignment, pFile ) == alignment;
+        uint64_t offset = alignment;
+
+        for( uint32_t i = 0; ok && i < std::size( c_waves ); ++i )
+        {
+            MockStreamDesc desc = {};
+            std::vector<uint8_t> data = MakeWave( c_waves[ i ], i, desc.wave );
+            desc.wave.offsetBytes = offset;
+            desc.loopCount = c_waves[ i ].loopCount;
+            desc.seekTime = c_waves[ i ].seekTime;
+            desc.seekSample = static_cast<uint32_t>( uint64_t( desc.wave.lengthBytes / desc.wave.blockAlign )
+                                                     * desc.wave.samplesPerBlock * c_waves[ i ].seekPoint / 1000 );
+            streams.push_back( desc );
+
+            ok = fwrite( data.data(), 1, data.size(), pFile ) == data.size();
+
+            uint32_t pad = static_cast<uint32_t>( ( alignment - ( data.size() % alignment ) ) % alignment );
+            ok = ok && fwrite( padding.data(), 1, pad, pFile ) == pad;
+            offset += data.size() + pad;
+        }
+
+        if( fclose( pFile ) != 0 )
+            ok = false;
+        return ok;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Entry point to the program
+//--------------------------------------------------------------------------------------
+int main( int argc, char* argv[] )
+{
+    const char* szFileName = c_defaultFileName;
+    uint32_t speedup = MOCK_SPEEDUP;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        if( !strcmp( argv[ i ], "-speedup" ) && i + 1 < argc )
+            speedup = static_cast<uint32_t>( strtoul( argv[ ++i ], nullptr, 10 ) );
+        else
+            szFileName = argv[ i ];
+    }
+
+    if( !speedup )
+    {
+        printf( "Usage: MockStreamingTest [-speedup <n>] [<scratch file>]\n" );
+        return 1;
+    }
+
+    //
+    // Each run streams every wave at once.  Two buffers is the least a voice can play
+    // from; the odd buffer size makes ADPCM blocks straddle every read.
+    //
+    struct Run
+    {
+        uint32_t    alignment;
+        uint32_t    bufferBytes;
+        uint32_t    buffersPerVoice;
+    };
+
+    const Run runs[] =
+    {
+        { 4096, 65536, 3 },
+        { 2048, 65536, 2 },
+        { 4096, 10000, 4 },
+        {  512,  4096, 8 },
+    };
+
+    bool passed = true;
+
+    for( const Run& run : runs )
+    {
+        std::vector<MockStreamDesc> streams;
+        if( !WriteBank( szFileName, run.alignment, streams ) )
+        {
+            printf( "Failed to write %s\n", szFileName );
+            return 1;
+        }
+
+        FILE* pBank = fopen( szFileName, "rb" );
+        FILE* pReference = fopen( szFileName, "rb" );
+        if( !pBank || !pReference )
+        {
+            printf( "Failed to open %s for reading\n", szFileName );
+            if( pBank )
+                fclose( pBank );
+            if( pReference )
+                fclose( pReference );
+            return 1;
+        }
+
+        StreamingEngine::Settings settings;
+        settings.bufferBytes = run.bufferBytes;
+        settings.buffersPerVoice = run.buffersPerVoice;
+
+        printf( "Streaming %zu voices, %u byte alignment, %u buffers of %u bytes...\n",
+                streams.size(), run.alignment, run.buffersPerVoice, run.bufferBytes );
+
+        StdioStreamingFile file( pBank, run.alignment );
+        std::vector<MockStreamResult> results( streams.size() );
+        bool ok = RunMockStreaming( &file, pReference, settings, streams.data(), streams.size(),
+                                    MOCK_MILLISECONDS, speedup, results.data() );
+
+        fclose( pReference );
+        fclose( pBank );
+
+        for( size_t i = 0; i < streams.size(); ++i )
+        {
+            const MockStreamResult& r = results[ i ];
+            printf( "  %-40s %9llu bytes played, %4u reads, %u underruns, %u of %u buffers, %s%s\n",
+                    c_waves[ i ].name, static_cast<unsigned long long>( r.bytesPlayed ), r.stats.reads, r.underruns,
+                    r.stats.maxBuffersInUse, run.buffersPerVoice, r.matches ? "audio matches" : "AUDIO MISMATCH",
+                    r.ended ? ", ended" : "" );
+        }
+
+        if( file.GetMisalignedReads() )
+        {
+            printf( "  %u misaligned reads\n", file.GetMisalignedReads() );
+            ok = false;
+        }
+
+        printf( "%s\n", ok ? "PASSED" : "FAILED" );
+        passed = passed && ok;
+    }
+
+    remove( szFileName );
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,715 @@
+//--------------------------------------------------------------------------------------
+// File: StreamingEngine.cpp
+//
+// Streams any number of waves out of one file through a single I/O worker thread
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+
+#include "StreamingEngine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // A stream that hasn't started yet is only late to start, while a playing one that
+    // runs dry is heard, so priming reads go after playing streams with less than this
+    // much audio queued
+    const double c_primingSeconds = 0.05;
+
+    // A buffer is filled by more than one read when it crosses the loop end, which keeps
+    // buffers full however short the audio before the loop point is.  This caps the reads
+    // a very short loop can cost.
+    const uint32_t c_maxReadsPerBuffer = 8;
+
+    inline uint64_t AlignDown( uint64_t value, uint32_t alignment )
+    {
+        return value - ( value % alignment );
+    }
+
+    inline uint32_t AlignUp( uint32_t value, uint32_t alignment )
+    {
+        return ( ( value + alignment - 1 ) / alignment ) * alignment;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+class StreamingEngine::Impl
+{
+public:
+    struct Stream;
+
+    struct StreamBuffer
+    {
+        Stream*             pStream;
+        uint8_t*            pData;
+        uint32_t            audioBytes;
+        bool                endOfStream;
+        std::atomic<bool>   busy;
+    };
+
+    struct Stream
+    {
+        Impl*                   pEngine;
+        IStreamingVoice*        pVoice;
+        StreamingWave           wave;
+        double                  bytesPerSecond;
+        uint32_t                loopCount;
+        uint32_t                loopBegin;          // loop region in bytes, whole blocks
+        uint32_t                loopEnd;
+        uint32_t                bufferBytes;        // audio in a full buffer, whole blocks
+        uint32_t                capacity;           // allocated size of each buffer
+        uint32_t                bufferCount;
+        std::unique_ptr<uint8_t[]> memory;
+        std::unique_ptr<StreamBuffer[]> buffers;
+
+        // Guarded by the engine lock
+        uint32_t                cursor;             // next byte to read, relative to the wave
+        uint32_t                loopsLeft;
+        uint32_t                generation;         // bumped when queued audio is thrown away
+        bool                    active;
+        bool                    started;            // voice has been started
+        bool                    allRead;            // the end of stream buffer has been read
+        bool                    flushing;           // waiting for flushed buffers to come back
+        bool                    failed;
+        StreamingStats          stats;
+
+        // Also touched by OnBufferEnd on the voice's thread
+        std::atomic<uint32_t>   queuedBytes;
+        std::atomic<uint32_t>   buffersQueued;
+        std::atomic<uint32_t>   buffersInUse;       // also guarded by the wake lock
+        std::atomic<uint32_t>   underruns;
+        std::atomic<bool>       audible;            // started, and not being stopped or flushed
+
+        void Rewind()
+        {
+            cursor = 0;
+            loopsLeft = loopCount;
+            allRead = false;
+        }
+    };
+
+    struct ReadSpan
+    {
+        uint64_t        fileOffset;
+        uint32_t        readBytes;
+        uint32_t        bufferOffset;               // where the read lands, aligned
+        uint32_t        skipBytes;                  // from the start of the read to the audio
+        uint32_t        audioBytes;
+    };
+
+    struct ReadRequest
+    {
+        Stream*         pStream;
+        StreamBuffer*   pBuffer;
+        uint32_t        generation;
+        uint32_t        audioOffset;                // where the audio starts in the buffer
+        uint32_t        spanCount;
+        ReadSpan        spans[ c_maxReadsPerBuffer ];
+    };
+
+    Impl( IStreamingFile* pFile, const Settings& settings ) :
+        m_pFile( pFile ),
+        m_settings( settings ),
+        m_alignment( std::max<uint32_t>( 1, pFile->GetAlignment() ) ),
+        m_quit( false ),
+        m_wake( false )
+    {
+        m_settings.buffersPerVoice = std::min<uint32_t>( STREAMING_MAX_BUFFERS,
+                                                         std::max<uint32_t>( STREAMING_MIN_BUFFERS, m_settings.buffersPerVoice ) );
+        m_worker = std::thread( &Impl::Worker, this );
+    }
+
+    ~Impl()
+    {
+        for( size_t j = 0; j < m_streams.size(); ++j )
+        {
+            if( m_streams[ j ] )
+                RemoveStream( static_cast<int>( j ) );
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_lock );
+            m_quit = true;
+        }
+        Signal();
+        m_worker.join();
+    }
+
+    int AddStream( IStreamingVoice* pVoice, const StreamingWave& wave, uint32_t loopCount );
+    void RemoveStream( int stream );
+    void Play( int stream );
+    void Stop( int stream );
+    void Seek( int stream, uint32_t sample );
+    bool IsPlaying( int stream ) const;
+    bool GetStats( int stream, StreamingStats* pStats ) const;
+
+    void Signal() noexcept
+    {
+        std::lock_guard<std::mutex> lock( m_wakeLock );
+        m_wake = true;
+        m_wakeCV.notify_all();
+    }
+
+    void ReleaseBuffer( StreamBuffer* pBuffer ) noexcept
+    {
+        // The count drops under the wake lock, so a RemoveStream waiting for it can't free the
+        // stream until this has stopped touching it
+        std::lock_guard<std::mutex> lock( m_wakeLock );
+        pBuffer->busy = false;
+        pBuffer->pStream->buffersInUse--;
+        m_wake = true;
+        m_wakeCV.notify_all();
+    }
+
+private:
+    Stream* GetStream( int stream ) const
+    {
+        if( stream < 0 || static_cast<size_t>( stream ) >= m_streams.size() )
+            return nullptr;
+
+        return m_streams[ stream ].get();
+    }
+
+    void Drop( Stream* s );
+    bool PickRead( ReadRequest& request );
+    void CompleteRead( const ReadRequest& request, bool succeeded );
+    void Worker();
+
+    IStreamingFile*                         m_pFile;
+    Settings                                m_settings;
+    uint32_t                                m_alignment;
+
+    mutable std::mutex                      m_lock;
+    std::vector<std::unique_ptr<Stream>>    m_streams;
+    bool                                    m_quit;
+
+    // Separate from m_lock so voice callbacks never wait behind a Submit or a Flush
+    std::mutex                              m_wakeLock;
+    std::condition_variable                 m_wakeCV;
+    bool                                    m_wake;
+
+    std::thread                             m_worker;
+};
+
+
+//--------------------------------------------------------------------------------------
+int StreamingEngine::Impl::AddStream( IStreamingVoice* pVoice, const StreamingWave& wave, uint32_t loopCount )
+{
+    if( !pVoice || !wave.blockAlign || !wave.samplesPerBlock || !wave.sampleRate )
+        return -1;
+
+    // Only whole blocks can be submitted, so a partial block at the end is never played
+    uint32_t length = wave.lengthBytes - ( wave.lengthBytes % wave.blockAlign );
+    if( !length )
+        return -1;
+
+    std::unique_ptr<Stream> s( new Stream );
+    s->wave = wave;
+    s->wave.lengthBytes = length;
+    s->bytesPerSecond = double( wave.sampleRate ) * double( wave.blockAlign ) / double( wave.samplesPerBlock );
+
+    uint64_t loopStart = wave.loopStart;
+    uint64_t loopEnd = wave.loopLength ? loopStart + wave.loopLength : uint64_t( length / wave.blockAlign ) * wave.samplesPerBlock;
+    s->loopBegin = static_cast<uint32_t>( std::min<uint64_t>( length, ( loopStart / wave.samplesPerBlock ) * wave.blockAlign ) );
+    s->loopEnd = static_cast<uint32_t>( std::min<uint64_t>( length, ( loopEnd / wave.samplesPerBlock ) * wave.blockAlign ) );
+    s->loopCount = ( s->loopBegin < s->loopEnd ) ? loopCount : 0;
+
+    // The slack covers the skip to an unaligned start, and the rounding up to an aligned
+    // address when a second read follows the loop end
+    s->bufferBytes = std::max( wave.blockAlign, ( m_settings.bufferBytes / wave.blockAlign ) * wave.blockAlign );
+    s->capacity = AlignUp( s->bufferBytes, m_alignment ) + 2 * m_alignment;
+    s->bufferCount = m_settings.buffersPerVoice;
+    s->memory.reset( new uint8_t[ size_t( s->capacity ) * s->bufferCount + m_alignment ] );
+    s->buffers.reset( new StreamBuffer[ s->bufferCount ] );
+
+    uint8_t* pData = s->memory.get();
+    pData += ( m_alignment - reinterpret_cast<uintptr_t>( pData ) % m_alignment ) % m_alignment;
+    for( uint32_t j = 0; j < s->bufferCount; ++j )
+    {
+        StreamBuffer& b = s->buffers[ j ];
+        b.pStream = s.get();
+        b.pData = pData + size_t( j ) * s->capacity;
+        b.audioBytes = 0;
+        b.endOfStream = false;
+        b.busy = false;
+    }
+
+    s->pEngine = this;
+    s->pVoice = pVoice;
+    s->generation = 0;
+    s->active = false;
+    s->started = false;
+    s->flushing = false;
+    s->failed = false;
+    s->stats = {};
+    s->queuedBytes = 0;
+    s->buffersQueued = 0;
+    s->buffersInUse = 0;
+    s->underruns = 0;
+    s->audible = false;
+    s->Rewind();
+
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    for( size_t j = 0; j < m_streams.size(); ++j )
+    {
+        if( !m_streams[ j ] )
+        {
+            m_streams[ j ] = std::move( s );
+            return static_cast<int>( j );
+        }
+    }
+
+    m_streams.push_back( std::move( s ) );
+    return static_cast<int>( m_streams.size() - 1 );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Throws away everything queued or being read.  The buffers come back through
+// OnBufferEnd (or CompleteRead), and nothing new is submitted until they all have,
+// since XAudio2 applies a flush on its next pass rather than when it's called.
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::Drop( Stream* s )
+{
+    s->generation++;
+    s->audible = false;
+
+    if( s->started )
+    {
+        s->pVoice->Stop();
+        s->started = false;
+    }
+
+    s->pVoice->Flush();
+    s->flushing = true;
+}
+
+
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::RemoveStream( int stream )
+{
+    Stream* s;
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+
+        s = GetStream( stream );
+        if( !s )
+            return;
+
+        s->active = false;
+        Drop( s );
+    }
+
+    {
+        std::unique_lock<std::mutex> lock( m_wakeLock );
+        m_wakeCV.wait( lock, [s] { return s->buffersInUse == 0; } );
+    }
+
+    std::lock_guard<std::mutex> lock( m_lock );
+    m_streams[ stream ].reset();
+}
+
+
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::Play( int stream )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+
+        Stream* s = GetStream( stream );
+        if( !s || s->failed )
+            return;
+
+        if( s->active && !( s->allRead && s->buffersInUse == 0 ) )
+            return;
+
+        if( s->allRead )
+        {
+            Drop( s );
+            s->Rewind();
+        }
+
+        s->active = true;
+    }
+
+    Signal();
+}
+
+
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::Stop( int stream )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+
+        Stream* s = GetStream( stream );
+        if( !s )
+            return;
+
+        s->active = false;
+        Drop( s );
+        s->Rewind();
+    }
+
+    Signal();
+}
+
+
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::Seek( int stream, uint32_t sample )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+
+        Stream* s = GetStream( stream );
+        if( !s )
+            return;
+
+        Drop( s );
+        s->Rewind();
+        s->cursor = static_cast<uint32_t>( std::min<uint64_t>( s->wave.lengthBytes,
+                                                               uint64_t( sample / s->wave.samplesPerBlock ) * s->wave.blockAlign ) );
+
+        // Nothing left to play, short of a loop
+        if( s->cursor == s->wave.lengthBytes && !( s->loopsLeft && s->loopEnd == s->wave.lengthBytes ) )
+            s->allRead = true;
+        else if( s->cursor == s->loopEnd && s->loopsLeft )
+        {
+            s->cursor = s->loopBegin;
+            if( s->loopsLeft != STREAMING_LOOP_INFINITE )
+                s->loopsLeft--;
+        }
+    }
+
+    Signal();
+}
+
+
+//--------------------------------------------------------------------------------------
+bool StreamingEngine::Impl::IsPlaying( int stream ) const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    Stream* s = GetStream( stream );
+    if( !s || !s->active || s->failed )
+        return false;
+
+    return !( s->allRead && s->buffersInUse == 0 );
+}
+
+
+//--------------------------------------------------------------------------------------
+bool StreamingEngine::Impl::GetStats( int stream, StreamingStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    Stream* s = GetStream( stream );
+    if( !s || !pStats )
+        return false;
+
+    *pStats = s->stats;
+    pStats->underruns = s->underruns;
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Earliest deadline first: the stream whose queued audio runs out soonest gets the next
+// read.  Called with m_lock held; the cursor moves on as soon as the read is planned.
+//--------------------------------------------------------------------------------------
+bool StreamingEngine::Impl::PickRead( ReadRequest& request )
+{
+    Stream* pBest = nullptr;
+    StreamBuffer* pBestBuffer = nullptr;
+    double bestDeadline = 0.0;
+
+    for( auto& it : m_streams )
+    {
+        Stream* s = it.get();
+        if( !s || !s->active || s->failed || s->allRead )
+            continue;
+
+        if( s->flushing )
+        {
+            if( s->buffersQueued > 0 )
+                continue;
+
+            s->flushing = false;
+        }
+
+        StreamBuffer* pBuffer = nullptr;
+        for( uint32_t j = 0; j < s->bufferCount; ++j )
+        {
+            if( !s->buffers[ j ].busy )
+            {
+                pBuffer = &s->buffers[ j ];
+                break;
+            }
+        }
+        if( !pBuffer )
+            continue;
+
+        double deadline = double( s->queuedBytes ) / s->bytesPerSecond;
+        if( !s->started )
+            deadline += c_primingSeconds;
+
+        if( !pBest || deadline < bestDeadline )
+        {
+            pBest = s;
+            pBestBuffer = pBuffer;
+            bestDeadline = deadline;
+        }
+    }
+
+    if( !pBest )
+        return false;
+
+    Stream* s = pBest;
+    request.pStream = s;
+    request.pBuffer = pBestBuffer;
+    request.generation = s->generation;
+    request.audioOffset = 0;
+    request.spanCount = 0;
+
+    pBestBuffer->busy = true;
+    pBestBuffer->endOfStream = false;
+    s->buffersInUse++;
+    s->stats.maxBuffersInUse = std::max<uint32_t>( s->stats.maxBuffersInUse, s->buffersInUse );
+
+    uint32_t filled = 0;
+    while( filled < s->bufferBytes && request.spanCount < c_maxReadsPerBuffer && !s->allRead )
+    {
+        bool looping = s->loopsLeft && s->cursor < s->loopEnd;
+        uint32_t end = looping ? s->loopEnd : s->wave.lengthBytes;
+        assert( s->cursor < end );
+
+        uint64_t position = s->wave.offsetBytes + s->cursor;
+        uint32_t skip = static_cast<uint32_t>( position % m_alignment );
+        uint32_t at = request.spanCount ? AlignUp( request.audioOffset + filled, m_alignment ) : 0;
+        uint32_t room = ( s->capacity > at + skip ) ? s->capacity - at - skip : 0;
+
+        uint32_t audio = std::min( { end - s->cursor, s->bufferBytes - filled, ( room / s->wave.blockAlign ) * s->wave.blockAlign } );
+        if( !audio )
+            break;
+
+        if( !request.spanCount )
+            request.audioOffset = skip;
+
+        ReadSpan& span = request.spans[ request.spanCount++ ];
+        span.fileOffset = AlignDown( position, m_alignment );
+        span.readBytes = AlignUp( skip + audio, m_alignment );
+        span.bufferOffset = at;
+        span.skipBytes = skip;
+        span.audioBytes = audio;
+
+        filled += audio;
+        s->cursor += audio;
+        if( s->cursor == end )
+        {
+            if( looping )
+            {
+                s->cursor = s->loopBegin;
+                if( s->loopsLeft != STREAMING_LOOP_INFINITE )
+                    s->loopsLeft--;
+            }
+            else
+            {
+                s->allRead = true;
+                pBestBuffer->endOfStream = true;
+            }
+        }
+    }
+
+    assert( filled > 0 );
+    pBestBuffer->audioBytes = filled;
+
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Called with m_lock held
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::CompleteRead( const ReadRequest& request, bool succeeded )
+{
+    Stream* s = request.pStream;
+    StreamBuffer* pBuffer = request.pBuffer;
+
+    // Stopped, seeked or removed while the read was in flight
+    if( request.generation != s->generation || !s->active )
+    {
+        ReleaseBuffer( pBuffer );
+        return;
+    }
+
+    for( uint32_t j = 0; j < request.spanCount; ++j )
+    {
+        s->stats.reads++;
+        s->stats.bytesRead += request.spans[ j ].readBytes;
+    }
+
+    if( succeeded )
+    {
+        s->queuedBytes += pBuffer->audioBytes;
+        s->buffersQueued++;
+
+        succeeded = s->pVoice->Submit( pBuffer->pData + request.audioOffset, pBuffer->audioBytes, pBuffer->endOfStream, pBuffer );
+        if( !succeeded )
+        {
+            s->queuedBytes -= pBuffer->audioBytes;
+            s->buffersQueued--;
+        }
+    }
+
+    if( !succeeded )
+    {
+        s->failed = true;
+        ReleaseBuffer( pBuffer );
+        Drop( s );
+        return;
+    }
+
+    s->stats.bytesSubmitted += pBuffer->audioBytes;
+
+    // Keep one buffer back for the next read before starting
+    if( !s->started && ( s->buffersQueued >= s->bufferCount - 1 || s->allRead ) )
+    {
+        s->started = true;
+        s->audible = true;
+        s->pVoice->Start();
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+void StreamingEngine::Impl::Worker()
+{
+    for( ;; )
+    {
+        ReadRequest request;
+        bool found;
+        {
+            std::lock_guard<std::mutex> lock( m_lock );
+            if( m_quit )
+                return;
+
+            found = PickRead( request );
+        }
+
+        if( !found )
+        {
+            std::unique_lock<std::mutex> lock( m_wakeLock );
+            m_wakeCV.wait( lock, [this] { return m_wake; } );
+            m_wake = false;
+            continue;
+        }
+
+        // The reads run without the lock, so voices keep handing buffers back and the
+        // caller's Play/Stop/Seek don't wait on the disk.  Each read after the first lands
+        // on the next aligned address, and its audio is moved down to follow on from the
+        // audio already in the buffer.
+        uint8_t* pData = request.pBuffer->pData;
+        uint32_t audioEnd = request.audioOffset;
+        bool succeeded = true;
+
+        for( uint32_t j = 0; j < request.spanCount && succeeded; ++j )
+        {
+            const ReadSpan& span = request.spans[ j ];
+
+            uint32_t bytesRead = 0;
+            succeeded = m_pFile->Read( span.fileOffset, span.readBytes, pData + span.bufferOffset, &bytesRead )
+                        && bytesRead >= span.skipBytes + span.audioBytes;
+
+            if( succeeded && span.bufferOffset + span.skipBytes != audioEnd )
+                memmove( pData + audioEnd, pData + span.bufferOffset + span.skipBytes, span.audioBytes );
+
+            audioEnd += span.audioBytes;
+        }
+
+        std::lock_guard<std::mutex> lock( m_lock );
+        CompleteRead( request, succeeded );
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Public interface
+//--------------------------------------------------------------------------------------
+StreamingEngine::StreamingEngine( IStreamingFile* pFile, const Settings& settings ) noexcept(false) :
+    pImpl( new Impl( pFile, settings ) )
+{
+}
+
+
+StreamingEngine::~StreamingEngine()
+{
+}
+
+
+int StreamingEngine::AddStream( IStreamingVoice* pVoice, const StreamingWave& wave, uint32_t loopCount )
+{
+    return pImpl->AddStream( pVoice, wave, loopCount );
+}
+
+
+void StreamingEngine::RemoveStream( int stream )
+{
+    pImpl->RemoveStream( stream );
+}
+
+
+void StreamingEngine::Play( int stream )
+{
+    pImpl->Play( stream );
+}
+
+
+void StreamingEngine::Stop( int stream )
+{
+    pImpl->Stop( stream );
+}
+
+
+void StreamingEngine::Seek( int stream, uint32_t sample )
+{
+    pImpl->Seek( stream, sample );
+}
+
+
+bool StreamingEngine::IsPlaying( int stream ) const
+{
+    return pImpl->IsPlaying( stream );
+}
+
+
+bool StreamingEngine::GetStats( int stream, StreamingStats* pStats ) const
+{
+    return pImpl->GetStats( stream, pStats );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Voice callback: the buffer is free again, and the worker may have a read to start
+//--------------------------------------------------------------------------------------
+void StreamingEngine::OnBufferEnd( void* pContext ) noexcept
+{
+    auto pBuffer = static_cast<Impl::StreamBuffer*>( pContext );
+    Impl::Stream* s = pBuffer->pStream;
+
+    s->queuedBytes -= pBuffer->audioBytes;
+    if( --s->buffersQueued == 0 && s->audible && !pBuffer->endOfStream )
+        s->underruns++;
+
+    s->pEngine->ReleaseBuffer( pBuffer );
+}
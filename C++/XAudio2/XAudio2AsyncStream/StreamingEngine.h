@@ -0,0 +1,153 @@
+//--------------------------------------------------------------------------------------
+// File: StreamingEngine.h
+//
+// Streams any number of waves out of one file through a single I/O worker thread
+//
+// The engine only deals in bytes, blocks and callbacks, so it builds without Windows.
+// XAudio2AsyncStream.cpp plugs in an XAudio2 source voice and an overlapped file handle;
+// MockStreaming.h has a stdio file and a mock voice that run the same code anywhere.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License (MIT).
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+// Same value as XAUDIO2_LOOP_INFINITE
+#define STREAMING_LOOP_INFINITE 255
+
+// Limits on the number of buffers each voice owns; one is being read while the others
+// are queued on the voice, so two is the least that can keep a voice playing
+#define STREAMING_MIN_BUFFERS 2
+#define STREAMING_MAX_BUFFERS 64
+
+
+//--------------------------------------------------------------------------------------
+// Where a wave lives in the file and how it is cut into blocks.  Audio is only ever
+// submitted in whole blocks: one frame for PCM, one nBlockAlign sized block for ADPCM.
+//--------------------------------------------------------------------------------------
+struct StreamingWave
+{
+    uint64_t    offsetBytes;        // start of the wave data in the file
+    uint32_t    lengthBytes;
+    uint32_t    blockAlign;
+    uint32_t    samplesPerBlock;    // 1 for PCM, wSamplesPerBlock for ADPCM
+    uint32_t    sampleRate;
+    uint32_t    loopStart;          // loop region in samples; a zero loopLength loops the whole wave
+    uint32_t    loopLength;
+};
+
+
+//--------------------------------------------------------------------------------------
+// The file the waves are read from
+//--------------------------------------------------------------------------------------
+class IStreamingFile
+{
+public:
+    virtual ~IStreamingFile() = default;
+
+    // The offset, size and destination address of every read are multiples of this
+    virtual uint32_t GetAlignment() const = 0;
+
+    // Blocking read, only ever called on the engine's I/O thread.  A read that runs past
+    // the end of the file succeeds with fewer bytes.
+    virtual bool Read( uint64_t offset, uint32_t size, void* pDest, uint32_t* pBytesRead ) = 0;
+};
+
+
+//--------------------------------------------------------------------------------------
+// What plays the audio.  Every submitted buffer must be handed back through
+// StreamingEngine::OnBufferEnd( pContext ) once the voice is done with it, including the
+// buffers dropped by Flush.  It may be called on any thread, but not from inside Submit.
+//--------------------------------------------------------------------------------------
+class IStreamingVoice
+{
+public:
+    virtual ~IStreamingVoice() = default;
+
+    virtual bool Submit( const uint8_t* pData, uint32_t bytes, bool endOfStream, void* pContext ) = 0;
+    virtual void Start() = 0;
+    virtual void Stop() = 0;
+    virtual void Flush() = 0;
+};
+
+
+//--------------------------------------------------------------------------------------
+struct StreamingStats
+{
+    uint64_t    bytesRead;          // including the padding needed to keep reads aligned
+    uint64_t    bytesSubmitted;
+    uint32_t    reads;
+    uint32_t    underruns;          // times the voice ran dry while it should have been playing
+    uint32_t    maxBuffersInUse;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Each stream owns a fixed set of buffers, so memory doesn't grow with the length of a
+// wave or with how far ahead the worker gets.  A buffer is either free, being read, or
+// queued on the voice.  The worker fills one free buffer at a time, always for the stream
+// with the least audio left queued, which is the one that would run dry first.
+//
+// Reads start and end on the file's alignment, so unbuffered I/O works, but the audio
+// submitted out of each read is cut on block boundaries.  That is what lets ADPCM blocks
+// (which rarely divide a 2K or 4K sector) stream: a block that straddles the end of one
+// read is simply the first block of the next one.
+//
+// Loop points are rounded down to whole blocks.  The stream plays up to the end of the
+// loop region, then loopCount more times from its start, then on to the end of the wave.
+// A buffer that reaches the loop end is topped up from the loop start with another read,
+// so the loop is seamless and a short tail before the loop point doesn't leave the voice
+// with a nearly empty buffer queued.  Seek drops everything queued and restarts the loop
+// count, as if the stream had been started at that sample.
+//--------------------------------------------------------------------------------------
+class StreamingEngine
+{
+public:
+    struct Settings
+    {
+        uint32_t    bufferBytes;        // audio in each buffer, rounded down to whole blocks
+        uint32_t    buffersPerVoice;
+
+        Settings() noexcept : bufferBytes( 65536 ), buffersPerVoice( 3 ) {}
+    };
+
+    StreamingEngine( IStreamingFile* pFile, const Settings& settings ) noexcept(false);
+    ~StreamingEngine();
+
+    StreamingEngine( StreamingEngine const& ) = delete;
+    StreamingEngine& operator= ( StreamingEngine const& ) = delete;
+
+    // Returns a stream id, or -1 if the wave can't be streamed.  The voice must outlive
+    // the stream.
+    int AddStream( IStreamingVoice* pVoice, const StreamingWave& wave, uint32_t loopCount );
+
+    // Stops the voice and waits for the engine's buffers to come back from it.  XAudio2
+    // returns flushed buffers on its next processing pass, so do this before DestroyVoice.
+    void RemoveStream( int stream );
+
+    // Reads ahead until the voice has enough queued, then starts it.  A stream that has
+    // played to its end starts over.
+    void Play( int stream );
+
+    // Stops the voice and rewinds to the start of the wave
+    void Stop( int stream );
+
+    // Moves playback to the block that holds the sample
+    void Seek( int stream, uint32_t sample );
+
+    // False once a stream has been stopped, or has played to its end
+    bool IsPlaying( int stream ) const;
+
+    bool GetStats( int stream, StreamingStats* pStats ) const;
+
+    static void OnBufferEnd( void* pContext ) noexcept;
+
+private:
+    class Impl;
+
+    std::unique_ptr<Impl> pImpl;
+};
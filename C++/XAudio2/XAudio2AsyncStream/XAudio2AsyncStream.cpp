@@ -3,8 +3,18 @@
 //
 // Streaming from a Wave Bank using XAudio2 and asynchronous I/O
 //
-// NOTE: Currently ignores loop regions in the Wave Bank, and only works for PCM data.
-//       For streaming of ADPCM, xWMA, and XMA2 content, see *DirectX Tool Kit for Audio*'s
+// Every PCM and ADPCM entry in the bank is streamed at once through StreamingEngine, which
+// serves all of the voices from a single I/O thread and honors the bank's loop regions.
+//
+//    XAudio2AsyncStream [-voices <count>] [-mock]
+//
+//    -voices   streams this many voices, going round the bank's entries (default is one
+//              voice per entry)
+//    -mock     runs the streams against mock voices, faster than real time, and checks
+//              that each one played exactly the audio it should have
+//
+// NOTE: xWMA and XMA2 entries are skipped, since they have to be streamed in whole
+//       packets using their seek tables. See *DirectX Tool Kit for Audio*'s
 //       SoundStreamInstance class - http://go.microsoft.com/fwlink/?LinkId=248929
 //
 // Copyright (c) Microsoft Corporation.
@@ -15,11 +25,14 @@
 #include <Windows.h>
 #include <cassert>
 #include <cstdio>
+#include <vector>
 
 #include <wrl\client.h>
 
 #include "XAudio2Versions.h"
 #include "WaveBankReader.h"
+#include "StreamingEngine.h"
+#include "MockStreaming.h"
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
@@ -28,18 +41,14 @@ using Microsoft::WRL::ComPtr;
 #define STREAMING_BUFFER_SIZE 65536
 #define MAX_BUFFER_COUNT 3
 
+// Simulated length and speed of the -mock run
+#define MOCK_MILLISECONDS 10000
+#define MOCK_SPEEDUP 4
+
 // Use 4k streaming alignment to support Advanced Format (4Kn) drives. See the xwbtool -af switch.
 // Otherwise uses 2K streaming alignment to support DVD, HDDs, and Advanced Format (512e) drives.
 #define SUPPORT_AF_4KN
 
-#ifdef SUPPORT_AF_4KN
-static_assert( (STREAMING_BUFFER_SIZE % 4096) == 0,
-    "Streaming size error for non-buffered async I/O for Advanced Format (4Kn)" );
-#else
-static_assert( (STREAMING_BUFFER_SIZE % 2048) == 0,
-    "Streaming size error for non-buffered async I/O for DVD/HDD" );
-#endif
-
 
 namespace
 {
@@ -52,10 +61,113 @@ namespace
 
 
 //--------------------------------------------------------------------------------------
-// Callback structure
+// Reads the wave bank through its unbuffered, overlapped handle.  The engine calls this
+// on its own I/O thread, so waiting for each read here doesn't hold up the audio or the
+// main thread, and neither does ReadFile blocking while the file system looks up where
+// the data is.
+//--------------------------------------------------------------------------------------
+class Win32StreamingFile : public IStreamingFile
+{
+public:
+    Win32StreamingFile( HANDLE hFile, uint32_t alignment ) :
+        m_hFile( hFile ),
+        m_alignment( alignment ),
+#if (_WIN32_WINNT >= _WIN32_WINNT_VISTA)
+        m_hEvent( CreateEventEx( nullptr, nullptr, CREATE_EVENT_MANUAL_RESET, EVENT_MODIFY_STATE | SYNCHRONIZE ) )
+#else
+        m_hEvent( CreateEvent( nullptr, TRUE, FALSE, nullptr ) )
+#endif
+    {
+    }
+    virtual ~Win32StreamingFile()
+    {
+        CloseHandle( m_hEvent );
+    }
+
+    uint32_t GetAlignment() const override
+    {
+        return m_alignment;
+    }
+
+    bool Read( uint64_t offset, uint32_t size, void* pDest, uint32_t* pBytesRead ) override
+    {
+        *pBytesRead = 0;
+
+        OVERLAPPED ovl = {};
+        ovl.Offset = static_cast<DWORD>( offset );
+        ovl.OffsetHigh = static_cast<DWORD>( offset >> 32 );
+        ovl.hEvent = m_hEvent;
+
+        if( !ReadFile( m_hFile, pDest, size, nullptr, &ovl ) )
+        {
+            DWORD error = GetLastError();
+            if( error == ERROR_HANDLE_EOF )
+                return true;
+
+            if( error != ERROR_IO_PENDING )
+                return false;
+        }
+
+        DWORD cb = 0;
+        if( !GetOverlappedResult( m_hFile, &ovl, &cb, TRUE ) )
+            return ( GetLastError() == ERROR_HANDLE_EOF );
+
+        *pBytesRead = cb;
+        return true;
+    }
+
+private:
+    HANDLE      m_hFile;
+    uint32_t    m_alignment;
+    HANDLE      m_hEvent;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Source voice for one stream.  The engine passes its buffers as the XAudio2 buffer
+// context, and gets them back from OnBufferEnd.
 //--------------------------------------------------------------------------------------
-struct StreamingVoiceContext : public IXAudio2VoiceCallback
+class XAudio2StreamingVoice : public IStreamingVoice, public IXAudio2VoiceCallback
 {
+public:
+    XAudio2StreamingVoice() : m_pSourceVoice( nullptr )
+    {
+    }
+    virtual ~XAudio2StreamingVoice()
+    {
+        if( m_pSourceVoice )
+            m_pSourceVoice->DestroyVoice();
+    }
+
+    HRESULT Create( IXAudio2* pXAudio2, const WAVEFORMATEX* wfx )
+    {
+        return pXAudio2->CreateSourceVoice( &m_pSourceVoice, wfx, 0, 1.0f, this );
+    }
+
+    bool Submit( const uint8_t* pData, uint32_t bytes, bool endOfStream, void* pContext ) override
+    {
+        XAUDIO2_BUFFER buf = {};
+        buf.AudioBytes = bytes;
+        buf.pAudioData = pData;
+        buf.pContext = pContext;
+        if( endOfStream )
+            buf.Flags = XAUDIO2_END_OF_STREAM;
+
+        return SUCCEEDED( m_pSourceVoice->SubmitSourceBuffer( &buf ) );
+    }
+    void Start() override
+    {
+        m_pSourceVoice->Start( 0, 0 );
+    }
+    void Stop() override
+    {
+        m_pSourceVoice->Stop( 0 );
+    }
+    void Flush() override
+    {
+        m_pSourceVoice->FlushSourceBuffers();
+    }
+
     STDMETHOD_( void, OnVoiceProcessingPassStart )( UINT32 ) override
     {
     }
@@ -68,9 +180,9 @@ struct StreamingVoiceContext : public IXAudio2VoiceCallback
     STDMETHOD_( void, OnBufferStart )( void* ) override
     {
     }
-    STDMETHOD_( void, OnBufferEnd )( void* ) override
+    STDMETHOD_( void, OnBufferEnd )( void* pContext ) override
     {
-        SetEvent( hBufferEndEvent );
+        StreamingEngine::OnBufferEnd( pContext );
     }
     STDMETHOD_( void, OnLoopEnd )( void* ) override
     {
@@ -79,20 +191,8 @@ struct StreamingVoiceContext : public IXAudio2VoiceCallback
     {
     }
 
-    HANDLE hBufferEndEvent;
-
-    StreamingVoiceContext() :
-#if (_WIN32_WINNT >= _WIN32_WINNT_VISTA)
-        hBufferEndEvent( CreateEventEx( nullptr, nullptr, 0, EVENT_MODIFY_STATE | SYNCHRONIZE ) )
-#else
-        hBufferEndEvent( CreateEvent( nullptr, FALSE, FALSE, nullptr ) )
-#endif
-    {
-    }
-    virtual ~StreamingVoiceContext()
-    {
-        CloseHandle( hBufferEndEvent );
-    }
+private:
+    IXAudio2SourceVoice* m_pSourceVoice;
 };
 
 
@@ -100,13 +200,26 @@ struct StreamingVoiceContext : public IXAudio2VoiceCallback
 // Forward declaration
 //--------------------------------------------------------------------------------------
 HRESULT FindMediaFileCch( _Out_writes_(cchDest) WCHAR* strDestPath, _In_ int cchDest, _In_z_ LPCWSTR strFilename );
+HRESULT GetStreamingWave( const WaveBankReader& wb, uint32_t index, _Out_writes_bytes_(cbFormat) WAVEFORMATEX* wfx, size_t cbFormat,
+                          _Out_ StreamingWave& wave );
 
 
 //--------------------------------------------------------------------------------------
 // Entry point to the program
 //--------------------------------------------------------------------------------------
-int main()
+int wmain( int argc, wchar_t* argv[] )
 {
+    bool mock = false;
+    uint32_t voiceCount = 0;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        if( !_wcsicmp( argv[ i ], L"-mock" ) )
+            mock = true;
+        else if( !_wcsicmp( argv[ i ], L"-voices" ) && i + 1 < argc )
+            voiceCount = wcstoul( argv[ ++i ], nullptr, 10 );
+    }
+
     //
     // Initialize XAudio2
     //
@@ -222,231 +335,163 @@ int main()
     }
 #endif
 
-    wprintf( L"Press <ESC> to exit.\n" );
-
     //
-    // Repeated loop through all the wavebank entries
+    // Work out which entries can be streamed (need enough space for PCM, ADPCM, and xWMA formats)
     //
-    bool exit = false;
+    std::vector<uint32_t> entries;
+    std::vector<StreamingWave> waves;
+    std::vector<std::vector<char>> formats;
 
-    while( !exit )
+    for( uint32_t i = 0; i < wb.Count(); ++i )
     {
-        for( DWORD i = 0; i < wb.Count(); ++i )
+        std::vector<char> formatBuff( 64 );
+        StreamingWave wave;
+
+        if( FAILED( hr = GetStreamingWave( wb, i, reinterpret_cast<WAVEFORMATEX*>( formatBuff.data() ), formatBuff.size(), wave ) ) )
         {
-            wprintf( L"Now playing wave entry %u", i );
+            wprintf( L"Skipping wave entry %u: error %#X\n", i, hr );
+            continue;
+        }
+
+        entries.push_back( i );
+        waves.push_back( wave );
+        formats.push_back( std::move( formatBuff ) );
+    }
 
-            //
-            // Get the info we need to play back this wave (need enough space for PCM, ADPCM, and xWMA formats)
-            //
-            char formatBuff[ 64 ];
-            WAVEFORMATEX *wfx = reinterpret_cast<WAVEFORMATEX*>(&formatBuff);
+    if( entries.empty() )
+    {
+        wprintf( L"No PCM or ADPCM entries to stream\n" );
+        pXAudio2.Reset();
+        CoUninitialize();
+        return 0;
+    }
 
-            if( FAILED( hr = wb.GetFormat( i, wfx, 64 ) ) )
-            {
-                wprintf( L"\nCouldn't get wave format for entry %u: error 0x%x\n", i, hr );
-                exit = true;
-                break;
-            }
+    if( !voiceCount )
+        voiceCount = static_cast<uint32_t>( entries.size() );
 
-            WaveBankReader::Metadata metadata;
-            if ( FAILED( hr = wb.GetMetadata( i, metadata ) ) )
-            {
-                wprintf( L"\nCouldn't get metadta for entry %u: error 0x%x\n", i, hr );
-                exit = true;
-                break;
-            }
+    StreamingEngine::Settings settings;
+    settings.bufferBytes = STREAMING_BUFFER_SIZE;
+    settings.buffersPerVoice = MAX_BUFFER_COUNT;
+
+    Win32StreamingFile file( wb.GetAsyncHandle(), wb.GetWaveAlignment() );
+
+    int result = 0;
+
+    if( mock )
+    {
+        //
+        // Mock voices: entries with a loop region loop forever, the others play once or twice,
+        // and every third stream seeks a third of the way in after a second
+        //
+        std::vector<MockStreamDesc> streams( voiceCount );
+        for( uint32_t i = 0; i < voiceCount; ++i )
+        {
+            MockStreamDesc& desc = streams[ i ];
+            desc.wave = waves[ i % waves.size() ];
+            desc.loopCount = desc.wave.loopLength ? STREAMING_LOOP_INFINITE : ( i & 1 );
+            desc.seekTime = ( ( i % 3 ) == 2 ) ? 1000 : 0;
+            desc.seekSample = ( ( desc.wave.lengthBytes / desc.wave.blockAlign ) * desc.wave.samplesPerBlock ) / 3;
+        }
+
+        FILE* pReference = nullptr;
+        if( _wfopen_s( &pReference, wavebank, L"rb" ) != 0 || !pReference )
+        {
+            wprintf( L"Failed to open %ls for reading\n", wavebank );
+            result = 1;
+        }
+        else
+        {
+            wprintf( L"Streaming %u voices on mock voices for %u ms of audio...\n", voiceCount, MOCK_MILLISECONDS );
 
-            //
-            // Create an XAudio2 voice to stream this wave
-            //
-            StreamingVoiceContext voiceContext;
+            std::vector<MockStreamResult> results( voiceCount );
+            bool passed = RunMockStreaming( &file, pReference, settings, streams.data(), streams.size(),
+                                            MOCK_MILLISECONDS, MOCK_SPEEDUP, results.data() );
+            fclose( pReference );
 
-            IXAudio2SourceVoice* pSourceVoice;
-            if( FAILED( hr = pXAudio2->CreateSourceVoice( &pSourceVoice, wfx, 0, 1.0f, &voiceContext ) ) )
+            for( uint32_t i = 0; i < voiceCount; ++i )
             {
-                wprintf( L"\nError %#X creating source voice\n", hr );
-                exit = true;
-                break;
+                const MockStreamResult& r = results[ i ];
+                wprintf( L"voice %2u (entry %u): %10llu bytes played, %5u reads, %u underruns, %u of %u buffers, %ls%ls\n",
+                         i, entries[ i % entries.size() ], r.bytesPlayed, r.stats.reads, r.underruns,
+                         r.stats.maxBuffersInUse, MAX_BUFFER_COUNT, r.matches ? L"audio matches" : L"AUDIO MISMATCH",
+                         r.ended ? L", ended" : L"" );
             }
-            pSourceVoice->Start( 0, 0 );
 
-            //
-            // Create an overlapped structure and buffers to handle the async I/O
-            //
-            OVERLAPPED ovlCurrentRequest = {};
-#if (_WIN32_WINNT >= _WIN32_WINNT_VISTA)
-            ovlCurrentRequest.hEvent = CreateEventEx( nullptr, nullptr, CREATE_EVENT_MANUAL_RESET, EVENT_MODIFY_STATE | SYNCHRONIZE );
-#else
-            ovlCurrentRequest.hEvent = CreateEvent( nullptr, TRUE, FALSE, nullptr );
-#endif
+            wprintf( L"%ls\n", passed ? L"PASSED" : L"FAILED" );
+            result = passed ? 0 : 1;
+        }
+    }
+    else
+    {
+        //
+        // Start every stream.  Entries with a loop region loop forever; the others are
+        // restarted each time they finish.
+        //
+        // Declared before the engine, so the engine has taken its buffers back by the time
+        // the voices are destroyed.
+        std::vector<std::unique_ptr<XAudio2StreamingVoice>> voices;
+        std::unique_ptr<StreamingEngine> engine( new StreamingEngine( &file, settings ) );
+        std::vector<int> ids;
+
+        for( uint32_t i = 0; i < voiceCount; ++i )
+        {
+            size_t entry = i % entries.size();
 
-            if ( (STREAMING_BUFFER_SIZE % wfx->nBlockAlign) != 0 )
+            std::unique_ptr<XAudio2StreamingVoice> voice( new XAudio2StreamingVoice );
+            if( FAILED( hr = voice->Create( pXAudio2.Get(), reinterpret_cast<const WAVEFORMATEX*>( formats[ entry ].data() ) ) ) )
             {
-                //
-                // non-PCM data will fail here. ADPCM requires a more complicated streaming mechanism to deal with submission in audio frames that do
-                // not necessarily align to the 2K async boundary.
-                //
-                wprintf( L"\nStreaming buffer size (%u) is not aligned with sample block requirements (%u)\n", STREAMING_BUFFER_SIZE, wfx->nBlockAlign );
-                exit = true;
-                break;
+                wprintf( L"Error %#X creating source voice for wave entry %u\n", hr, entries[ entry ] );
+                continue;
             }
 
-            std::unique_ptr<uint8_t[]> buffers[MAX_BUFFER_COUNT];
-            for( size_t j=0; j < MAX_BUFFER_COUNT; ++j )
+            const StreamingWave& wave = waves[ entry ];
+            int id = engine->AddStream( voice.get(), wave, wave.loopLength ? STREAMING_LOOP_INFINITE : 0 );
+            if( id < 0 )
             {
-                buffers[j].reset( new uint8_t[ STREAMING_BUFFER_SIZE ] );
+                wprintf( L"Couldn't stream wave entry %u\n", entries[ entry ] );
+                continue;
             }
-            DWORD currentDiskReadBuffer = 0;
-            DWORD currentPosition = 0;
-
-            //
-            // This sample code shows the simplest way to manage asynchronous
-            // streaming. There are three different processes involved. One is the management
-            // process, which is what we're writing here. The other two processes are
-            // essentially hardware operations: disk reads from the I/O system, and
-            // audio processing from XAudio2. Disk reads and audio playback both happen
-            // without much intervention from our application, so our job is just to make
-            // sure that the data being read off the disk makes it over to the audio
-            // processor in time to be played back.
-            //
-            // There are two events that can happen in this system. The disk I/O system can
-            // signal that data is ready, and the audio system can signal that it's done
-            // playing back data. We can handle either or both of these events either synchronously
-            // (via polling) or asynchronously (via callbacks or by waiting on an event
-            // object).
-            //
-            HANDLE async = wb.GetAsyncHandle();
-
-            while( currentPosition < metadata.lengthBytes )
-            {
-                wprintf( L"." );
-
-                if( GetAsyncKeyState( VK_ESCAPE ) )
-                {
-                    exit = true;
-
-                    while( GetAsyncKeyState( VK_ESCAPE ) )
-                        Sleep( 10 );
-
-                    break;
-                }
-
-                //
-                // Issue a request.
-                //
-                // Note: although the file read will be done asynchronously, it is possible for the
-                // call to ReadFile to block for longer than you might think. If the I/O system needs
-                // to read the file allocation table in order to satisfy the read, it will do that
-                // BEFORE returning from ReadFile. That means that this call could potentially
-                // block for several milliseconds! In order to get "true" async I/O you should put
-                // this entire loop on a separate thread.
-                //
-                // Second note: async requests have to be a multiple of the disk sector size. Rather than
-                // handle this conditionally, make all reads the same size but remember how many
-                // bytes we actually want and only submit that many to the voice.
-                //
-                DWORD cbValid = min( STREAMING_BUFFER_SIZE, metadata.lengthBytes - currentPosition );
-                ovlCurrentRequest.Offset = metadata.offsetBytes + currentPosition;
-
-                bool wait = false;
-                if( !ReadFile( async, buffers[ currentDiskReadBuffer ].get(), STREAMING_BUFFER_SIZE, nullptr, &ovlCurrentRequest ) )
-                {
-                    DWORD error = GetLastError();
-                    if ( error != ERROR_IO_PENDING )
-                    {
-                        wprintf( L"\nCouldn't start async read: error %#X\n", HRESULT_FROM_WIN32( error ) );
-                        exit = true;
-                        break;
-                    }
-                    wait = true;
-                }
-
-                currentPosition += cbValid;
-
-                //
-                // At this point the read is progressing in the background and we are free to do
-                // other processing while we wait for it to finish. For the purposes of this sample,
-                // however, we'll just go to sleep until the read is done.
-                //
-                if ( wait )
-                    WaitForSingleObject( ovlCurrentRequest.hEvent, INFINITE );
-
-                DWORD cb;
-#if (_WIN32_WINNT >= 0x0602 /*_WIN32_WINNT_WIN8*/)
-                BOOL result = GetOverlappedResultEx( async, &ovlCurrentRequest, &cb, 0, FALSE );
-#else
-                BOOL result = GetOverlappedResult( async, &ovlCurrentRequest, &cb, FALSE );
-#endif
-                if( !result )
-                {
-                    wprintf( L"\nFailed waiting for async read: error %#X\n", HRESULT_FROM_WIN32( GetLastError() ) );
-                    exit = true;
-                    break;
-                }
 
-                //
-                // Now that the event has been signaled, we know we have audio available. The next
-                // question is whether our XAudio2 source voice has played enough data for us to give
-                // it another buffer full of audio. We'd like to keep no more than MAX_BUFFER_COUNT - 1
-                // buffers on the queue, so that one buffer is always free for disk I/O.
-                //
-                XAUDIO2_VOICE_STATE state;
-                for( ;; )
-                {
-                    pSourceVoice->GetState( &state );
-                    if( state.BuffersQueued < MAX_BUFFER_COUNT - 1 )
-                        break;
-
-                    WaitForSingleObject( voiceContext.hBufferEndEvent, INFINITE );
-                }
+            engine->Play( id );
+            voices.push_back( std::move( voice ) );
+            ids.push_back( id );
+        }
 
-                //
-                // At this point we have a buffer full of audio and enough room to submit it, so
-                // let's submit it and get another read request going.
-                //
-                XAUDIO2_BUFFER buf = {};
-                buf.AudioBytes = cbValid;
-                buf.pAudioData = buffers[currentDiskReadBuffer].get();
-                if( currentPosition >= metadata.lengthBytes )
-                    buf.Flags = XAUDIO2_END_OF_STREAM;
+        wprintf( L"Streaming %zu voices. Press <ESC> to exit.\n", ids.size() );
 
-                pSourceVoice->SubmitSourceBuffer( &buf );
+        while( !GetAsyncKeyState( VK_ESCAPE ) )
+        {
+            Sleep( 250 );
 
-                currentDiskReadBuffer++;
-                currentDiskReadBuffer %= MAX_BUFFER_COUNT;
-            }
+            uint32_t reads = 0;
+            uint32_t underruns = 0;
+            uint32_t playing = 0;
 
-            if( !exit )
+            for( size_t j = 0; j < ids.size(); ++j )
             {
-                wprintf( L"done streaming.." );
-
-                XAUDIO2_VOICE_STATE state;
-                for(; ; )
+                StreamingStats stats;
+                if( engine->GetStats( ids[ j ], &stats ) )
                 {
-                    pSourceVoice->GetState( &state );
-                    if( !state.BuffersQueued )
-                        break;
-
-                    wprintf( L"." );
-                    WaitForSingleObject( voiceContext.hBufferEndEvent, INFINITE );
+                    reads += stats.reads;
+                    underruns += stats.underruns;
                 }
-            }
 
-            //
-            // Clean up
-            //
-            pSourceVoice->Stop( 0 );
-            pSourceVoice->DestroyVoice();
+                if( engine->IsPlaying( ids[ j ] ) )
+                    ++playing;
+                else
+                    engine->Play( ids[ j ] );
+            }
 
-            CloseHandle( ovlCurrentRequest.hEvent );
+            wprintf( L"\r%zu voices, %u playing, %u reads, %u underruns   ", ids.size(), playing, reads, underruns );
+        }
 
-            wprintf( L"stopped\n" );
+        while( GetAsyncKeyState( VK_ESCAPE ) )
+            Sleep( 10 );
 
-            if( exit )
-                break;
+        wprintf( L"\nstopped\n" );
 
-            Sleep( 500 );
-        }
+        engine.reset();
+        voices.clear();
     }
 
     //
@@ -464,6 +509,49 @@ int main()
 #endif
 
     CoUninitialize();
+
+    return result;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Gets the format of a wave bank entry, and where its data is for the streaming engine.
+// Only PCM and ADPCM can be cut into whole blocks anywhere.
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT GetStreamingWave( const WaveBankReader& wb, uint32_t index, WAVEFORMATEX* wfx, size_t cbFormat, StreamingWave& wave )
+{
+    HRESULT hr = wb.GetFormat( index, wfx, cbFormat );
+    if( FAILED( hr ) )
+        return hr;
+
+    WaveBankReader::Metadata metadata;
+    if( FAILED( hr = wb.GetMetadata( index, metadata ) ) )
+        return hr;
+
+    wave = {};
+    wave.offsetBytes = metadata.offsetBytes;
+    wave.lengthBytes = metadata.lengthBytes;
+    wave.blockAlign = wfx->nBlockAlign;
+    wave.sampleRate = wfx->nSamplesPerSec;
+    wave.loopStart = metadata.loopStart;
+    wave.loopLength = metadata.loopLength;
+
+    switch( wfx->wFormatTag )
+    {
+    case WAVE_FORMAT_PCM:
+        wave.samplesPerBlock = 1;
+        break;
+
+    case WAVE_FORMAT_ADPCM:
+        wave.samplesPerBlock = reinterpret_cast<const ADPCMWAVEFORMAT*>( wfx )->wSamplesPerBlock;
+        break;
+
+    default:
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+    }
+
+    return ( wave.blockAlign && wave.samplesPerBlock ) ? S_OK : E_UNEXPECTED;
 }
 
 
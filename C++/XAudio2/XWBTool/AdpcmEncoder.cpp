@@ -0,0 +1,487 @@
+//--------------------------------------------------------------------------------------
+// File: AdpcmEncoder.cpp
+//
+// Microsoft ADPCM encoder
+//
+// Every block starts with a header holding, for each channel, a predictor index, a step
+// size (delta) and the first two samples as-is.  Each later sample is predicted from the
+// two before it with the predictor's coefficient pair, and the prediction error is stored
+// as a 4-bit multiple of delta, after which delta grows or shrinks with the size of that
+// nibble.  The encoder runs the decoder's own arithmetic on what it has written so far, so
+// it always predicts from what a player will hear and rounding errors don't build up.
+//
+// What the encoder gets to choose is the predictor and starting delta of each channel of
+// each block, and the nibbles themselves; ADPCM_QUALITY picks how hard it looks.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "AdpcmEncoder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
+
+using namespace DirectX;
+
+const int16_t DirectX::g_AdpcmCoefficients1[ADPCM_NUM_COEFFICIENTS] = { 256, 512, 0, 192, 240, 460, 392 };
+const int16_t DirectX::g_AdpcmCoefficients2[ADPCM_NUM_COEFFICIENTS] = { 0, -256, 0, 64, 0, -208, -232 };
+
+namespace
+{
+    constexpr int c_AdaptationTable[16] = { 230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230 };
+
+    constexpr int c_MinDelta = 16;
+    constexpr int c_MaxDelta = 0x7FFF;      // the header stores the starting delta in 16 bits
+
+    // Samples averaged to estimate a block's starting delta
+    constexpr uint32_t c_DeltaEstimateSamples = 8;
+
+    // Starting deltas tried by ADPCM_QUALITY_BEST, in quarters of the estimate
+    constexpr int c_DeltaScales[] = { 2, 3, 4, 6, 8 };
+
+    // Don't start a thread for fewer blocks than this
+    constexpr size_t c_MinBlocksPerThread = 64;
+
+    struct ChannelState
+    {
+        int sample1;    // the most recent sample
+        int sample2;
+        int delta;
+    };
+
+    struct ChannelChoice
+    {
+        int         predictor;
+        int         delta;
+        uint64_t    error;
+    };
+
+    inline int Clamp16(int value) noexcept
+    {
+        return std::min(std::max(value, -32768), 32767);
+    }
+
+    inline uint64_t Square(int value) noexcept
+    {
+        return uint64_t(int64_t(value) * int64_t(value));
+    }
+
+    inline int Predict(int sample1, int sample2, int predictor) noexcept
+    {
+        return (sample1 * g_AdpcmCoefficients1[predictor] + sample2 * g_AdpcmCoefficients2[predictor]) >> 8;
+    }
+
+    // Nearest multiple of delta to the error that fits in a signed nibble
+    inline int Quantize(int error, int delta) noexcept
+    {
+        const int nibble = (error >= 0) ? (error + delta / 2) / delta : -((delta / 2 - error) / delta);
+        return std::min(std::max(nibble, -8), 7);
+    }
+
+    inline void Advance(ChannelState& state, int sample, int nibble) noexcept
+    {
+        state.sample2 = state.sample1;
+        state.sample1 = sample;
+        state.delta = std::max((c_AdaptationTable[nibble & 0xF] * state.delta) >> 8, c_MinDelta);
+    }
+
+    // Rounding each error on its own can leave delta badly placed for the next sample, so
+    // the nibbles either side of the rounded one are also tried, scoring each by its own
+    // error plus that of the next sample
+    int LookAhead(const ChannelState& state, int prediction, int nibble, int current, int next, int predictor) noexcept
+    {
+        int best = nibble;
+        uint64_t bestError = std::numeric_limits<uint64_t>::max();
+
+        const int first = std::max(nibble - 1, -8);
+        const int last = std::min(nibble + 1, 7);
+        for (int candidate = first; candidate <= last; ++candidate)
+        {
+            ChannelState trial = state;
+            const int sample = Clamp16(prediction + candidate * trial.delta);
+            Advance(trial, sample, candidate);
+
+            const int nextPrediction = Predict(trial.sample1, trial.sample2, predictor);
+            const int nextSample = Clamp16(nextPrediction + Quantize(next - nextPrediction, trial.delta) * trial.delta);
+
+            const uint64_t error = Square(current - sample) + Square(next - nextSample);
+            if (error < bestError || (error == bestError && candidate == nibble))
+            {
+                best = candidate;
+                bestError = error;
+            }
+        }
+
+        return best;
+    }
+
+    // Encodes samples 2 onwards of one channel of a block and returns the squared error of
+    // the first scored samples, giving up as soon as it passes limit.  Only the samples
+    // that came from the source are scored; the padding at the end of the last block is
+    // encoded, but never allowed to sway the choices made for the real audio.
+    uint64_t EncodeChannel(
+        _In_reads_(count) const int* samples,
+        uint32_t count,
+        uint32_t scored,
+        int predictor,
+        int delta,
+        bool lookahead,
+        uint64_t limit,
+        _Out_writes_opt_(count - 2) uint8_t* nibbles) noexcept
+    {
+        ChannelState state = { samples[1], samples[0], delta };
+
+        uint64_t error = 0;
+        for (uint32_t i = 2; i < count; ++i)
+        {
+            const int prediction = Predict(state.sample1, state.sample2, predictor);
+
+            int nibble = Quantize(samples[i] - prediction, state.delta);
+            if (lookahead && (i + 1) < scored)
+            {
+                nibble = LookAhead(state, prediction, nibble, samples[i], samples[i + 1], predictor);
+            }
+
+            const int sample = Clamp16(prediction + nibble * state.delta);
+            if (i < scored)
+            {
+                error += Square(samples[i] - sample);
+                if (error > limit)
+                    return error;
+            }
+
+            Advance(state, sample, nibble);
+
+            if (nibbles)
+            {
+                nibbles[i - 2] = uint8_t(nibble & 0xF);
+            }
+        }
+
+        return error;
+    }
+
+    // A delta about a third of the average prediction error keeps the first few nibbles
+    // clear of both zero and the ends of their range
+    int EstimateDelta(_In_reads_(count) const int* samples, uint32_t count, int predictor) noexcept
+    {
+        int64_t sum = 0;
+        uint32_t n = 0;
+        for (uint32_t i = 2; i < count && n < c_DeltaEstimateSamples; ++i, ++n)
+        {
+            sum += std::abs(samples[i] - Predict(samples[i - 1], samples[i - 2], predictor));
+        }
+
+        if (!n)
+            return c_MinDelta;
+
+        return int(std::min<int64_t>(std::max<int64_t>(sum / (3 * n), c_MinDelta), c_MaxDelta));
+    }
+
+    // The predictor that best fits the source samples themselves, ignoring quantization
+    int GuessPredictor(_In_reads_(count) const int* samples, uint32_t count) noexcept
+    {
+        int best = 0;
+        uint64_t bestError = std::numeric_limits<uint64_t>::max();
+
+        for (int predictor = 0; predictor < int(ADPCM_NUM_COEFFICIENTS); ++predictor)
+        {
+            uint64_t error = 0;
+            for (uint32_t i = 2; i < count; ++i)
+            {
+                error += Square(samples[i] - Predict(samples[i - 1], samples[i - 2], predictor));
+            }
+
+            if (error < bestError)
+            {
+                best = predictor;
+                bestError = error;
+            }
+        }
+
+        return best;
+    }
+
+    ChannelChoice ChooseChannel(_In_reads_(count) const int* samples, uint32_t count, ADPCM_QUALITY quality) noexcept
+    {
+        ChannelChoice best = { 0, c_MinDelta, std::numeric_limits<uint64_t>::max() };
+
+        if (quality == ADPCM_QUALITY_FAST)
+        {
+            best.predictor = GuessPredictor(samples, count);
+            best.delta = EstimateDelta(samples, count, best.predictor);
+            return best;
+        }
+
+        const bool lookahead = (quality >= ADPCM_QUALITY_BEST);
+
+        for (int predictor = 0; predictor < int(ADPCM_NUM_COEFFICIENTS); ++predictor)
+        {
+            const int estimate = EstimateDelta(samples, count, predictor);
+
+            for (const int scale : c_DeltaScales)
+            {
+                if (!lookahead && scale != 4)
+                    continue;
+
+                const int delta = std::min(std::max(estimate * scale / 4, c_MinDelta), c_MaxDelta);
+
+                const uint64_t error = EncodeChannel(samples, count, count, predictor, delta, lookahead, best.error, nullptr);
+                if (error < best.error)
+                {
+                    best.predictor = predictor;
+                    best.delta = delta;
+                    best.error = error;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    inline void Write16(uint8_t* ptr, int value) noexcept
+    {
+        ptr[0] = uint8_t(value & 0xFF);
+        ptr[1] = uint8_t((value >> 8) & 0xFF);
+    }
+
+    inline int Read16(const uint8_t* ptr) noexcept
+    {
+        return int16_t(uint16_t(ptr[0] | (ptr[1] << 8)));
+    }
+
+    void EncodeBlocks(
+        const int16_t* pcm,
+        size_t frames,
+        uint32_t channels,
+        uint32_t samplesPerBlock,
+        ADPCM_QUALITY quality,
+        uint8_t* output,
+        size_t firstBlock,
+        size_t lastBlock) noexcept
+    {
+        const size_t blockAlign = AdpcmBlockAlign(samplesPerBlock, channels);
+
+        // One channel of one block at a time, de-interleaved and padded with silence
+        std::vector<int> samples(samplesPerBlock);
+        std::vector<uint8_t> nibbles(samplesPerBlock * 2);
+
+        for (size_t block = firstBlock; block < lastBlock; ++block)
+        {
+            const size_t firstFrame = block * samplesPerBlock;
+            const size_t count = std::min<size_t>(frames - firstFrame, samplesPerBlock);
+
+            uint8_t* ptr = output + block * blockAlign;
+            uint8_t* data = ptr + ADPCM_HEADER_LENGTH * channels;
+            memset(data, 0, blockAlign - ADPCM_HEADER_LENGTH * channels);
+
+            for (uint32_t ch = 0; ch < channels; ++ch)
+            {
+                const int16_t* src = pcm + firstFrame * channels + ch;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    samples[i] = src[i * channels];
+                }
+                std::fill(samples.begin() + ptrdiff_t(count), samples.end(), 0);
+
+                // The search only looks at the real samples, then the whole block is encoded
+                const ChannelChoice choice = ChooseChannel(samples.data(), uint32_t(count), quality);
+
+                EncodeChannel(samples.data(), samplesPerBlock, uint32_t(count), choice.predictor, choice.delta,
+                    quality >= ADPCM_QUALITY_BEST, std::numeric_limits<uint64_t>::max(), nibbles.data());
+
+                // Header: all the predictors, then all the deltas, then sample1s, then sample2s
+                ptr[ch] = uint8_t(choice.predictor);
+                Write16(ptr + channels + ch * 2, choice.delta);
+                Write16(ptr + channels * 3 + ch * 2, samples[1]);
+                Write16(ptr + channels * 5 + ch * 2, samples[0]);
+
+                // Nibbles are interleaved by channel, high nibble first
+                for (uint32_t i = 0; i < samplesPerBlock - 2; ++i)
+                {
+                    const size_t n = size_t(i) * channels + ch;
+                    data[n / 2] |= (n & 1) ? nibbles[i] : uint8_t(nibbles[i] << 4);
+                }
+            }
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+size_t DirectX::AdpcmBlockAlign(uint32_t samplesPerBlock, uint32_t channels) noexcept
+{
+    if (channels < 1 || channels > 2)
+        return 0;
+
+    if (samplesPerBlock < ADPCM_MIN_SAMPLES_PER_BLOCK || samplesPerBlock > ADPCM_MAX_SAMPLES_PER_BLOCK)
+        return 0;
+
+    if (channels == 1 && (samplesPerBlock & 1))
+        return 0;
+
+    return size_t(ADPCM_HEADER_LENGTH) * channels + size_t(samplesPerBlock - 2) * 4 * channels / 8;
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+size_t DirectX::AdpcmEncodedSize(size_t frames, uint32_t samplesPerBlock, uint32_t channels) noexcept
+{
+    const size_t blockAlign = AdpcmBlockAlign(samplesPerBlock, channels);
+    if (!blockAlign)
+        return 0;
+
+    return ((frames + samplesPerBlock - 1) / samplesPerBlock) * blockAlign;
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+bool DirectX::AdpcmEncode(
+    const int16_t* pcm,
+    size_t frames,
+    uint32_t channels,
+    uint32_t samplesPerBlock,
+    ADPCM_QUALITY quality,
+    uint8_t* output,
+    size_t outputBytes,
+    uint32_t threads) noexcept
+{
+    if (!pcm || !frames || !output)
+        return false;
+
+    const size_t size = AdpcmEncodedSize(frames, samplesPerBlock, channels);
+    if (!size || outputBytes < size)
+        return false;
+
+    const size_t blocks = (frames + samplesPerBlock - 1) / samplesPerBlock;
+
+    if (!threads)
+    {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    const size_t workers = std::min<size_t>(threads, std::max<size_t>(blocks / c_MinBlocksPerThread, 1));
+
+    std::vector<std::thread> pool;
+    size_t first = 0;
+    try
+    {
+        pool.reserve(workers - 1);
+        for (size_t j = 1; j < workers; ++j)
+        {
+            const size_t last = blocks * j / workers;
+            pool.emplace_back(EncodeBlocks, pcm, frames, channels, samplesPerBlock, quality, output, first, last);
+            first = last;
+        }
+    }
+    catch (...)
+    {
+        // Whatever couldn't be handed to a thread is encoded here
+    }
+
+    EncodeBlocks(pcm, frames, channels, samplesPerBlock, quality, output, first, blocks);
+
+    for (auto& it : pool)
+    {
+        it.join();
+    }
+
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+bool DirectX::AdpcmDecode(
+    const uint8_t* input,
+    size_t inputBytes,
+    uint32_t channels,
+    uint32_t samplesPerBlock,
+    int16_t* pcm,
+    size_t frames) noexcept
+{
+    if (!input || !pcm)
+        return false;
+
+    const size_t blockAlign = AdpcmBlockAlign(samplesPerBlock, channels);
+    if (!blockAlign)
+        return false;
+
+    if ((inputBytes / blockAlign) * samplesPerBlock < frames)
+        return false;
+
+    for (size_t firstFrame = 0; firstFrame < frames; firstFrame += samplesPerBlock, input += blockAlign)
+    {
+        const size_t count = std::min<size_t>(frames - firstFrame, samplesPerBlock);
+        int16_t* dest = pcm + firstFrame * channels;
+        const uint8_t* data = input + ADPCM_HEADER_LENGTH * channels;
+
+        for (uint32_t ch = 0; ch < channels; ++ch)
+        {
+            const int predictor = input[ch];
+            if (predictor >= int(ADPCM_NUM_COEFFICIENTS))
+                return false;
+
+            ChannelState state = {
+                Read16(input + channels * 3 + ch * 2),
+                Read16(input + channels * 5 + ch * 2),
+                Read16(input + channels + ch * 2) };
+
+            dest[ch] = int16_t(state.sample2);
+            if (count > 1)
+            {
+                dest[channels + ch] = int16_t(state.sample1);
+            }
+
+            for (size_t i = 2; i < count; ++i)
+            {
+                const size_t n = (i - 2) * channels + ch;
+                const int code = (n & 1) ? (data[n / 2] & 0xF) : (data[n / 2] >> 4);
+                const int nibble = (code & 0x8) ? code - 16 : code;
+
+                const int sample = Clamp16(Predict(state.sample1, state.sample2, predictor) + nibble * state.delta);
+                Advance(state, sample, nibble);
+
+                dest[i * channels + ch] = int16_t(sample);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+double DirectX::SignalToNoiseRatio(const int16_t* source, const int16_t* decoded, size_t count) noexcept
+{
+    double signal = 0;
+    double noise = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const double value = source[i];
+        const double error = value - decoded[i];
+        signal += value * value;
+        noise += error * error;
+    }
+
+    if (noise <= 0)
+        return std::numeric_limits<double>::infinity();
+
+    if (signal <= 0)
+        return 0;
+
+    return 10.0 * log10(signal / noise);
+}
@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// File: AdpcmEncoder.h
+//
+// Microsoft ADPCM encoder (and the matching decoder, used to measure the encoding error)
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <sal.h>
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace DirectX
+{
+    enum ADPCM_QUALITY : uint32_t
+    {
+        // Predictor chosen from the source samples, one encoding pass per block
+        ADPCM_QUALITY_FAST = 0,
+
+        // Every predictor is tried on each block, and the one with the least error is kept
+        ADPCM_QUALITY_NORMAL,
+
+        // Also tries several starting step sizes, and picks each nibble looking one sample
+        // ahead instead of just rounding
+        ADPCM_QUALITY_BEST,
+    };
+
+    constexpr uint32_t ADPCM_NUM_COEFFICIENTS = 7;
+    constexpr uint32_t ADPCM_HEADER_LENGTH = 7;    // per channel
+    constexpr uint32_t ADPCM_MIN_SAMPLES_PER_BLOCK = 4;
+    constexpr uint32_t ADPCM_MAX_SAMPLES_PER_BLOCK = 64000;
+
+    // The standard coefficient pairs, the only ones XAudio2 accepts
+    extern const int16_t g_AdpcmCoefficients1[ADPCM_NUM_COEFFICIENTS];
+    extern const int16_t g_AdpcmCoefficients2[ADPCM_NUM_COEFFICIENTS];
+
+    // Bytes in one block; mono blocks need an even samplesPerBlock
+    size_t AdpcmBlockAlign(uint32_t samplesPerBlock, uint32_t channels) noexcept;
+
+    // Bytes needed to encode frames of audio, rounded up to whole blocks
+    size_t AdpcmEncodedSize(size_t frames, uint32_t samplesPerBlock, uint32_t channels) noexcept;
+
+    // Encodes interleaved 16-bit PCM (1 or 2 channels).  The last block is padded with
+    // silence.  Blocks are independent, so they are shared out between threads (0 uses
+    // one per core).
+    bool AdpcmEncode(
+        _In_reads_(frames * channels) const int16_t* pcm,
+        size_t frames,
+        uint32_t channels,
+        uint32_t samplesPerBlock,
+        ADPCM_QUALITY quality,
+        _Out_writes_bytes_(outputBytes) uint8_t* output,
+        size_t outputBytes,
+        uint32_t threads = 0) noexcept;
+
+    // Decodes whole blocks back to interleaved 16-bit PCM, stopping after frames
+    bool AdpcmDecode(
+        _In_reads_bytes_(inputBytes) const uint8_t* input,
+        size_t inputBytes,
+        uint32_t channels,
+        uint32_t samplesPerBlock,
+        _Out_writes_(frames * channels) int16_t* pcm,
+        size_t frames) noexcept;
+
+    // 10 log10(signal energy / error energy) in dB
+    double SignalToNoiseRatio(
+        _In_reads_(count) const int16_t* source,
+        _In_reads_(count) const int16_t* decoded,
+        size_t count) noexcept;
+}
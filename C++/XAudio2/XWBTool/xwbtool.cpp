@@ -3,7 +3,8 @@
 //
 // Simple command-line tool for building wave banks from 1 or more .WAV files. This
 // generates binary wave banks compliant with XACT 3's Wave Bank .XWB format. The
-// .WAV files are not format converted or compressed.
+// .WAV files are not format converted, although -adpcm compresses integer PCM files
+// to MS ADPCM.
 //
 // For a more full-featured builder, see XACT 3 and the XACTBLD tool in the legacy
 // DirectX SDK (June 2010) release.
@@ -30,6 +31,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
@@ -46,6 +48,7 @@
 #include <utility>
 #include <vector>
 
+#include "AdpcmEncoder.h"
 #include "WAVFileReader.h"
 
 #ifdef __INTEL_COMPILER
@@ -96,6 +99,12 @@ namespace
 
     constexpr size_t ENTRYNAME_LENGTH = 64;
 
+    // MINIWAVEFORMAT keeps an ADPCM block size in 8 bits, as the mono block size less 22,
+    // so banks can only hold 32 to 542 samples per block
+    constexpr uint32_t ADPCM_BANK_MIN_SAMPLES_PER_BLOCK = 32;
+    constexpr uint32_t ADPCM_BANK_MAX_SAMPLES_PER_BLOCK = 542;
+    constexpr uint32_t ADPCM_DEFAULT_SAMPLES_PER_BLOCK = 512;
+
     struct REGION
     {
         uint32_t    dwOffset;   // Region offset, in bytes.
@@ -675,6 +684,10 @@ enum OPTIONS : uint32_t
     OPT_FRIENDLY_NAMES,
     OPT_NOLOGO,
     OPT_FILELIST,
+    OPT_ADPCM,
+    OPT_ADPCM_SAMPLES_PER_BLOCK,
+    OPT_ADPCM_QUALITY,
+    OPT_ADPCM_BENCHMARK,
     OPT_MAX
 };
 
@@ -744,6 +757,10 @@ const SValue g_pOptions[] =
     { L"f",         OPT_FRIENDLY_NAMES },
     { L"nologo",    OPT_NOLOGO },
     { L"flist",     OPT_FILELIST },
+    { L"adpcm",     OPT_ADPCM },
+    { L"spb",       OPT_ADPCM_SAMPLES_PER_BLOCK },
+    { L"aq",        OPT_ADPCM_QUALITY },
+    { L"adpcmbench", OPT_ADPCM_BENCHMARK },
     { nullptr,      0 }
 };
 
@@ -958,6 +975,12 @@ namespace
         wprintf(L"   -f                  include entry friendly names\n");
         wprintf(L"   -nologo             suppress copyright message\n");
         wprintf(L"   -flist <filename>   use text file with a list of input files (one per line)\n");
+        wprintf(L"   -adpcm              compress 8-bit and 16-bit PCM files to MS ADPCM\n");
+        wprintf(L"   -spb <samples>      ADPCM samples per block, even and %u..%u (default %u)\n",
+            ADPCM_BANK_MIN_SAMPLES_PER_BLOCK, ADPCM_BANK_MAX_SAMPLES_PER_BLOCK, ADPCM_DEFAULT_SAMPLES_PER_BLOCK);
+        wprintf(L"   -aq <level>         ADPCM quality: 0 fastest, 1 (default), 2 best\n");
+        wprintf(L"   -adpcmbench         time the ADPCM encoder on the input files instead of\n");
+        wprintf(L"                       building a wave bank\n");
     }
 
     const wchar_t* GetErrorDesc(HRESULT hr)
@@ -1041,6 +1064,198 @@ namespace
             wprintf(L" (%hs %u channels, %u-bit, %lu Hz)", GetFormatTagName(wave.data.wfx->wFormatTag), wave.data.wfx->nChannels, wave.data.wfx->wBitsPerSample, wave.data.wfx->nSamplesPerSec);
         }
     }
+
+    bool IsIntegerPCM(const WAVEFORMATEX* wfx)
+    {
+        if ((wfx->wBitsPerSample != 8) && (wfx->wBitsPerSample != 16))
+            return false;
+
+        if (wfx->wFormatTag == WAVE_FORMAT_PCM)
+            return true;
+
+        if (wfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE
+            && (wfx->cbSize >= (sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))))
+        {
+            static const GUID s_wfexBase = { 0x00000000, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 } };
+
+            auto wfex = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(wfx);
+
+            return (wfex->SubFormat.Data1 == WAVE_FORMAT_PCM)
+                && (memcmp(reinterpret_cast<const BYTE*>(&wfex->SubFormat) + sizeof(DWORD),
+                    reinterpret_cast<const BYTE*>(&s_wfexBase) + sizeof(DWORD), sizeof(GUID) - sizeof(DWORD)) == 0);
+        }
+
+        return false;
+    }
+
+    // The wave's samples as 16-bit (8-bit PCM is unsigned)
+    std::vector<int16_t> ReadPCM16(const DirectX::WAVData& data)
+    {
+        const size_t frames = data.audioBytes / data.wfx->nBlockAlign;
+        std::vector<int16_t> pcm(frames * data.wfx->nChannels);
+
+        if (data.wfx->wBitsPerSample == 16)
+        {
+            memcpy(pcm.data(), data.startAudio, pcm.size() * sizeof(int16_t));
+        }
+        else
+        {
+            for (size_t j = 0; j < pcm.size(); ++j)
+            {
+                pcm[j] = int16_t((int(data.startAudio[j]) - 128) * 256);
+            }
+        }
+
+        return pcm;
+    }
+
+    // Replaces the wave's format and data with an MS ADPCM encoding of it, and reports how
+    // far the decoded result is from the source
+    bool EncodeADPCM(WaveFile& wave, uint32_t samplesPerBlock, DirectX::ADPCM_QUALITY quality, double& snr)
+    {
+        const WAVEFORMATEX* wfx = wave.data.wfx;
+
+        if ((wfx->nChannels != 1) && (wfx->nChannels != 2))
+        {
+            wprintf(L"\nERROR: ADPCM encoding needs 1 or 2 channels (not %u)\n", wfx->nChannels);
+            return false;
+        }
+
+        const std::vector<int16_t> pcm = ReadPCM16(wave.data);
+        const size_t frames = pcm.size() / wfx->nChannels;
+        if (!frames)
+        {
+            wprintf(L"\nERROR: No audio data to encode\n");
+            return false;
+        }
+
+        const size_t blockAlign = DirectX::AdpcmBlockAlign(samplesPerBlock, wfx->nChannels);
+        const size_t audioBytes = DirectX::AdpcmEncodedSize(frames, samplesPerBlock, wfx->nChannels);
+        if (audioBytes > UINT32_MAX)
+        {
+            wprintf(L"\nERROR: Encoded audio data is too large (%zu bytes)\n", audioBytes);
+            return false;
+        }
+
+        // The format (with its coefficient table) and the encoded audio share one buffer
+        constexpr size_t formatBytes = sizeof(WAVEFORMATEX) + 32 /*MSADPCM_FORMAT_EXTRA_BYTES*/;
+
+        std::unique_ptr<uint8_t[]> waveData(new (std::nothrow) uint8_t[formatBytes + audioBytes]);
+        if (!waveData)
+        {
+            wprintf(L"\nERROR: Out of memory encoding ADPCM\n");
+            return false;
+        }
+
+        memset(waveData.get(), 0, formatBytes);
+
+        auto adpcm = reinterpret_cast<ADPCMWAVEFORMAT*>(waveData.get());
+        adpcm->wfx.wFormatTag = WAVE_FORMAT_ADPCM;
+        adpcm->wfx.nChannels = wfx->nChannels;
+        adpcm->wfx.nSamplesPerSec = wfx->nSamplesPerSec;
+        adpcm->wfx.nAvgBytesPerSec = DWORD(uint64_t(wfx->nSamplesPerSec) * blockAlign / samplesPerBlock);
+        adpcm->wfx.nBlockAlign = WORD(blockAlign);
+        adpcm->wfx.wBitsPerSample = 4 /*MSADPCM_BITS_PER_SAMPLE*/;
+        adpcm->wfx.cbSize = 32 /*MSADPCM_FORMAT_EXTRA_BYTES*/;
+        adpcm->wSamplesPerBlock = WORD(samplesPerBlock);
+        adpcm->wNumCoef = DirectX::ADPCM_NUM_COEFFICIENTS;
+        for (uint32_t j = 0; j < DirectX::ADPCM_NUM_COEFFICIENTS; ++j)
+        {
+            adpcm->aCoef[j].iCoef1 = DirectX::g_AdpcmCoefficients1[j];
+            adpcm->aCoef[j].iCoef2 = DirectX::g_AdpcmCoefficients2[j];
+        }
+
+        uint8_t* audio = waveData.get() + formatBytes;
+        if (!DirectX::AdpcmEncode(pcm.data(), frames, wfx->nChannels, samplesPerBlock, quality, audio, audioBytes))
+        {
+            wprintf(L"\nERROR: ADPCM encoding failed\n");
+            return false;
+        }
+
+        std::vector<int16_t> decoded(pcm.size());
+        if (!DirectX::AdpcmDecode(audio, audioBytes, wfx->nChannels, samplesPerBlock, decoded.data(), frames))
+        {
+            wprintf(L"\nERROR: ADPCM decoding failed\n");
+            return false;
+        }
+
+        snr = DirectX::SignalToNoiseRatio(pcm.data(), decoded.data(), pcm.size());
+
+        // ADPCM can only loop on whole blocks
+        if (wave.data.loopLength > 0)
+        {
+            const uint32_t loopStart = wave.data.loopStart - (wave.data.loopStart % samplesPerBlock);
+            const uint64_t loopEnd = ((uint64_t(wave.data.loopStart) + wave.data.loopLength + samplesPerBlock - 1) / samplesPerBlock) * samplesPerBlock;
+            const uint32_t loopLength = uint32_t(std::min<uint64_t>(loopEnd, uint64_t(audioBytes / blockAlign) * samplesPerBlock) - loopStart);
+
+            if ((loopStart != wave.data.loopStart) || (loopLength != wave.data.loopLength))
+            {
+                wprintf(L"\nWARNING: Loop region %u..%u moved to ADPCM block boundaries (%u..%u)",
+                    wave.data.loopStart, wave.data.loopStart + wave.data.loopLength, loopStart, loopStart + loopLength);
+            }
+
+            wave.data.loopStart = loopStart;
+            wave.data.loopLength = loopLength;
+        }
+
+        wave.data.wfx = &adpcm->wfx;
+        wave.data.startAudio = audio;
+        wave.data.audioBytes = uint32_t(audioBytes);
+        wave.data.seek = nullptr;
+        wave.data.seekCount = 0;
+        wave.waveData = std::move(waveData);
+
+        return true;
+    }
+
+    // Encodes the wave at each quality, once on one thread and once on all of them, for
+    // at least a quarter second each
+    void BenchmarkADPCM(const WaveFile& wave, uint32_t samplesPerBlock)
+    {
+        const WAVEFORMATEX* wfx = wave.data.wfx;
+
+        const std::vector<int16_t> pcm = ReadPCM16(wave.data);
+        const size_t frames = pcm.size() / wfx->nChannels;
+        const size_t audioBytes = DirectX::AdpcmEncodedSize(frames, samplesPerBlock, wfx->nChannels);
+        if (!frames || !audioBytes)
+            return;
+
+        std::vector<uint8_t> encoded(audioBytes);
+        std::vector<int16_t> decoded(pcm.size());
+
+        static const wchar_t* s_qualityNames[] = { L"fast", L"normal", L"best" };
+
+        for (uint32_t quality = DirectX::ADPCM_QUALITY_FAST; quality <= DirectX::ADPCM_QUALITY_BEST; ++quality)
+        {
+            double rates[2] = {};
+            for (uint32_t j = 0; j < 2; ++j)
+            {
+                const uint32_t threads = (j == 0) ? 1u : 0u;
+
+                size_t passes = 0;
+                double seconds = 0;
+                const auto start = std::chrono::steady_clock::now();
+                do
+                {
+                    std::ignore = DirectX::AdpcmEncode(pcm.data(), frames, wfx->nChannels, samplesPerBlock,
+                        DirectX::ADPCM_QUALITY(quality), encoded.data(), audioBytes, threads);
+                    ++passes;
+                    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                } while (seconds < 0.25);
+
+                rates[j] = double(frames) * double(passes) / seconds;
+            }
+
+            std::ignore = DirectX::AdpcmDecode(encoded.data(), audioBytes, wfx->nChannels, samplesPerBlock, decoded.data(), frames);
+            const double snr = DirectX::SignalToNoiseRatio(pcm.data(), decoded.data(), pcm.size());
+
+            wprintf(L"\n    %-6ls %8.2f MB/s (%.0fx real time), all threads %8.2f MB/s (%.0fx), SNR %.2f dB",
+                s_qualityNames[quality],
+                rates[0] * wfx->nChannels * sizeof(int16_t) / 1048576.0, rates[0] / wfx->nSamplesPerSec,
+                rates[1] * wfx->nChannels * sizeof(int16_t) / 1048576.0, rates[1] / wfx->nSamplesPerSec,
+                snr);
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1059,6 +1274,8 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
     // Parameters and defaults
     wchar_t szOutputFile[MAX_PATH] = {};
     wchar_t szHeaderFile[MAX_PATH] = {};
+    uint32_t adpcmSamplesPerBlock = ADPCM_DEFAULT_SAMPLES_PER_BLOCK;
+    DirectX::ADPCM_QUALITY adpcmQuality = DirectX::ADPCM_QUALITY_NORMAL;
 
     // Set locale for output since GetErrorDesc can get localized strings.
     std::locale::global(std::locale(""));
@@ -1097,6 +1314,8 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
             case OPT_OUTPUTFILE:
             case OPT_OUTPUTHEADER:
             case OPT_FILELIST:
+            case OPT_ADPCM_SAMPLES_PER_BLOCK:
+            case OPT_ADPCM_QUALITY:
                 if (!*pValue)
                 {
                     if ((iArg + 1 >= argc))
@@ -1166,6 +1385,33 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                 ProcessFileList(inFile, conversion);
             }
             break;
+
+            case OPT_ADPCM_SAMPLES_PER_BLOCK:
+                if (swscanf_s(pValue, L"%u", &adpcmSamplesPerBlock) != 1
+                    || adpcmSamplesPerBlock < ADPCM_BANK_MIN_SAMPLES_PER_BLOCK
+                    || adpcmSamplesPerBlock > ADPCM_BANK_MAX_SAMPLES_PER_BLOCK
+                    || (adpcmSamplesPerBlock % 2))
+                {
+                    wprintf(L"Invalid value specified with -spb (%ls)\n", pValue);
+                    wprintf(L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
+
+            case OPT_ADPCM_QUALITY:
+            {
+                uint32_t level = 0;
+                if (swscanf_s(pValue, L"%u", &level) != 1 || level > DirectX::ADPCM_QUALITY_BEST)
+                {
+                    wprintf(L"Invalid value specified with -aq (%ls)\n", pValue);
+                    wprintf(L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                adpcmQuality = DirectX::ADPCM_QUALITY(level);
+            }
+            break;
             }
         }
         else if (wcspbrk(pArg, L"?*") != nullptr)
@@ -1194,6 +1440,13 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         return 0;
     }
 
+    if ((dwOptions & ((1 << OPT_ADPCM_SAMPLES_PER_BLOCK) | (1 << OPT_ADPCM_QUALITY)))
+        && !(dwOptions & ((1 << OPT_ADPCM) | (1 << OPT_ADPCM_BENCHMARK))))
+    {
+        wprintf(L"-spb and -aq require -adpcm or -adpcmbench\n");
+        return 1;
+    }
+
     if (~dwOptions & (1 << OPT_NOLOGO))
         PrintLogo();
 
@@ -1225,7 +1478,7 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         }
     }
 
-    if (~dwOptions & (1 << OPT_OVERWRITE))
+    if (!(dwOptions & ((1 << OPT_OVERWRITE) | (1 << OPT_ADPCM_BENCHMARK))))
     {
         if (GetFileAttributesW(szOutputFile) != INVALID_FILE_ATTRIBUTES)
         {
@@ -1278,11 +1531,33 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
 
         PrintInfo(wave);
 
+        if ((dwOptions & ((1 << OPT_ADPCM) | (1 << OPT_ADPCM_BENCHMARK))) && IsIntegerPCM(wave.data.wfx))
+        {
+            if (dwOptions & (1 << OPT_ADPCM_BENCHMARK))
+            {
+                BenchmarkADPCM(wave, adpcmSamplesPerBlock);
+            }
+
+            if (dwOptions & (1 << OPT_ADPCM))
+            {
+                double snr = 0;
+                if (!EncodeADPCM(wave, adpcmSamplesPerBlock, adpcmQuality, snr))
+                    return 1;
+
+                wprintf(L"\nencoded to");
+                PrintInfo(wave);
+                wprintf(L" %u samples per block, SNR %.2f dB", adpcmSamplesPerBlock, snr);
+            }
+        }
+
         waves.emplace_back(std::move(wave));
     }
 
     wprintf(L"\n");
 
+    if (dwOptions & (1 << OPT_ADPCM_BENCHMARK))
+        return 0;
+
     DWORD dwAlignment = ALIGNMENT_MIN;
     if (dwOptions & (1 << OPT_STREAMING))
     {